@@ -0,0 +1,57 @@
+/*
+ * dm-remap v4.3 - Checksums of remapped data
+ *
+ * One crc32c per remapped sector, recorded when the sector is written to
+ * the spare and checked when it is read back, so a spare that returns
+ * stale or corrupt data fails the read instead of handing it on. The
+ * records mirror the on-disk table (struct dm_remap_v4_csum_record); the
+ * target writes the sectors of it marked dirty. Read the counters with
+ * "dmsetup message <dev> 0 checksums".
+ */
+
+#ifndef DM_REMAP_V4_CHECKSUM_H
+#define DM_REMAP_V4_CHECKSUM_H
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/bvec.h>
+
+#include "dm-remap-v4-ondisk.h"
+
+struct bio;
+
+struct dm_remap_csum_table {
+    spinlock_t lock;                 /* Protects records, used and dirty */
+    struct dm_remap_v4_csum_record *records;  /* DM_REMAP_V4_CSUM_SLOTS */
+    unsigned int used;
+    unsigned long dirty[BITS_TO_LONGS(DM_REMAP_V4_CSUM_AREA_SECTORS)];
+    atomic64_t recorded;             /* Sectors checksummed as they were written */
+    atomic64_t verified;             /* Sectors read back that matched */
+    atomic64_t failed;               /* ... that did not */
+    atomic64_t unchecked;            /* ... that had no record, or one for another place */
+    atomic64_t dropped;              /* Sectors not recorded, the table was full */
+    atomic64_t area_writes;          /* Writes of dirty table sectors */
+    atomic64_t bytes;                /* Data checksummed */
+    atomic64_t cpu_ns;               /* ... and the time spent on it */
+};
+
+int dm_remap_csum_init(struct dm_remap_csum_table *t);
+void dm_remap_csum_destroy(struct dm_remap_csum_table *t);
+void dm_remap_csum_reset(struct dm_remap_csum_table *t);
+bool dm_remap_csum_load(struct dm_remap_csum_table *t, const struct dm_remap_v4_csum_record *rec);
+void dm_remap_csum_record_buf(struct dm_remap_csum_table *t, sector_t sector,
+                              sector_t spare_sector, const void *data, unsigned int nr,
+                              bool replace);
+unsigned int dm_remap_csum_bio(struct dm_remap_csum_table *t, struct bio *bio,
+                               struct bvec_iter iter, sector_t sector,
+                               sector_t spare_sector, bool write);
+unsigned int dm_remap_csum_take_dirty(struct dm_remap_csum_table *t, void *area,
+                                      unsigned int *first);
+void dm_remap_csum_mark_dirty(struct dm_remap_csum_table *t, unsigned int first,
+                              unsigned int nr);
+void dm_remap_csum_stats_reset(struct dm_remap_csum_table *t);
+int dm_remap_csum_format(struct dm_remap_csum_table *t, char *buf, size_t len);
+
+#endif /* DM_REMAP_V4_CHECKSUM_H */
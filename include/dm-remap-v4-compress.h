@@ -0,0 +1,51 @@
+/*
+ * dm-remap v4.3 - Compressed remapped data
+ *
+ * Units of DM_REMAP_V4_COMPRESS_SECTORS remapped sectors compressed with
+ * "lz4" or "zstd" through the kernel crypto API (acomp), one transform per
+ * algorithm, allocated the first time it is needed. A transform handles
+ * one request at a time, so calls are serialized by @lock; they sleep.
+ * The counters are read with the "stats" message.
+ */
+
+#ifndef DM_REMAP_V4_COMPRESS_H
+#define DM_REMAP_V4_COMPRESS_H
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+
+#include "dm-remap-v4-ondisk.h"
+
+#define DM_REMAP_COMPRESS_UNIT_BYTES (DM_REMAP_V4_COMPRESS_SECTORS << SECTOR_SHIFT)
+#define DM_REMAP_COMPRESS_NR_ALGS    3   /* Indexed by DM_REMAP_V4_COMPRESS_*, 0 unused */
+
+struct crypto_acomp;
+struct acomp_req;
+
+struct dm_remap_compress {
+    struct mutex lock;               /* Serializes the transforms */
+    struct crypto_acomp *tfm[DM_REMAP_COMPRESS_NR_ALGS];
+    struct acomp_req *req[DM_REMAP_COMPRESS_NR_ALGS];
+    atomic64_t units;                /* Units stored compressed */
+    atomic64_t incompressible;       /* ... that did not fit and were stored as is */
+    atomic64_t bytes_in;             /* Bytes given to compress */
+    atomic64_t bytes_out;            /* ... and what came out, for stored units */
+    atomic64_t compress_ns;          /* CPU time compressing */
+    atomic64_t decompressed;         /* Units decompressed */
+    atomic64_t decompress_ns;        /* ... and the time spent on it */
+    atomic64_t errors;               /* Transform failures and bad extents */
+};
+
+void dm_remap_compress_init(struct dm_remap_compress *c);
+void dm_remap_compress_destroy(struct dm_remap_compress *c);
+const char *dm_remap_compress_alg_name(unsigned int alg);
+int dm_remap_compress_prepare(struct dm_remap_compress *c, unsigned int alg);
+int dm_remap_compress_unit(struct dm_remap_compress *c, unsigned int alg, sector_t sector,
+                           const void *src, void *extent, unsigned int *nr_sectors);
+int dm_remap_decompress_unit(struct dm_remap_compress *c, sector_t sector,
+                             const void *extent, unsigned int nr_sectors, void *dst);
+void dm_remap_compress_stats_reset(struct dm_remap_compress *c);
+int dm_remap_compress_format(struct dm_remap_compress *c, char *buf, size_t len);
+
+#endif /* DM_REMAP_V4_COMPRESS_H */
@@ -0,0 +1,55 @@
+/*
+ * dm-remap v4.3 - Error correlation across targets
+ *
+ * Targets behind the same controller form an error domain: by default the
+ * PCI function the main device hangs off, or a name given with
+ * "error_domain". When main device errors arrive from at least
+ * correlation_targets targets of a domain within correlation_window_ms,
+ * the domain is in a burst - a fault of the HBA, expander or enclosure
+ * rather than of the media - until fewer than correlation_targets of its
+ * targets have failed within the last window, so a disk that goes on
+ * failing after the others recovered is remapped again.
+ * Errors that would be remapped during a burst get the "correlated_errors"
+ * action instead. Each burst is logged once when it starts and once when
+ * it is over, and recorded in the event stream of the target that set it
+ * off.
+ *
+ * Virtual and stacked main devices (loop, dm, null_blk) have no
+ * controller and are a domain of their own unless given a name.
+ */
+
+#ifndef DM_REMAP_V4_CORRELATE_H
+#define DM_REMAP_V4_CORRELATE_H
+
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/rcupdate.h>
+
+struct block_device;
+struct dm_remap_err_domain;
+
+/**
+ * struct dm_remap_correlate - A target's membership of an error domain
+ * @domain: The domain, NULL if correlation is off for the target
+ * @node: In the domain's member list
+ * @last_error: jiffies of the target's last main device error
+ * @erred: @last_error is set
+ * @in_burst: Counted in the current burst
+ */
+struct dm_remap_correlate {
+    struct dm_remap_err_domain __rcu *domain;
+    struct list_head node;
+    unsigned long last_error;
+    bool erred;
+    bool in_burst;
+};
+
+void dm_remap_correlate_init(struct dm_remap_correlate *c);
+int dm_remap_correlate_join(struct dm_remap_correlate *c, const char *domain,
+                            struct block_device *bdev);
+void dm_remap_correlate_leave(struct dm_remap_correlate *c);
+bool dm_remap_correlate_error(struct dm_remap_correlate *c, bool *started);
+bool dm_remap_correlate_burst(struct dm_remap_correlate *c);
+int dm_remap_correlate_format(struct dm_remap_correlate *c, char *buf, size_t len);
+
+#endif /* DM_REMAP_V4_CORRELATE_H */
@@ -0,0 +1,52 @@
+/*
+ * dm-remap v4.3 - Remap event stream
+ *
+ * A small per-target ring of recent remap decisions, both those the target
+ * acted on and those a shadow policy would have taken. Read with
+ * "dmsetup message <dev> 0 events [<since_seq>]"; "dmsetup wait" wakes up
+ * when an active remap is committed or a bio is found hung.
+ */
+
+#ifndef DM_REMAP_V4_EVENTS_H
+#define DM_REMAP_V4_EVENTS_H
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+
+#define DM_REMAP_EVENT_RING_SIZE 64  /* Power of two */
+
+enum dm_remap_event_type {
+    DM_REMAP_EVENT_REMAP = 0,        /* Remap committed */
+    DM_REMAP_EVENT_RETRY,            /* Error left on main by the policy */
+    DM_REMAP_EVENT_IGNORE,           /* Error ignored by the policy */
+    DM_REMAP_EVENT_SHADOW_REMAP,     /* Shadow policy would remap */
+    DM_REMAP_EVENT_SHADOW_MIGRATE,   /* Shadow predictor would migrate early */
+    DM_REMAP_EVENT_SHADOW_PREDICT,   /* Shadow predictor would raise its score */
+    DM_REMAP_EVENT_HUNG,             /* Bio outstanding longer than hung_timeout */
+    DM_REMAP_EVENT_VERIFY,           /* Write read back wrong or not at all */
+    DM_REMAP_EVENT_CHECKSUM,         /* Spare read did not match its checksum */
+    DM_REMAP_EVENT_BURST,            /* Correlated errors across the error domain */
+    DM_REMAP_EVENT_MAX,
+};
+
+struct dm_remap_event {
+    u64 seq;                         /* 1-based, monotonic per target */
+    u64 time_ns;                     /* ktime_get_real_ns() */
+    u64 sector;
+    u32 nr_sectors;
+    u32 type;                        /* enum dm_remap_event_type */
+};
+
+struct dm_remap_event_log {
+    spinlock_t lock;
+    u64 next_seq;
+    struct dm_remap_event ring[DM_REMAP_EVENT_RING_SIZE];
+};
+
+void dm_remap_event_log_init(struct dm_remap_event_log *log);
+void dm_remap_event_record(struct dm_remap_event_log *log, enum dm_remap_event_type type,
+                           u64 sector, u32 nr_sectors);
+int dm_remap_event_format(struct dm_remap_event_log *log, u64 since_seq,
+                          char *buf, size_t len);
+
+#endif /* DM_REMAP_V4_EVENTS_H */
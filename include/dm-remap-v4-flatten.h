@@ -0,0 +1,76 @@
+/*
+ * dm-remap v4.3 - Flatten onto a replacement device
+ *
+ * Copies what the target presents, main device sectors with remapped ones
+ * taken from the spare, to a new device with kcopyd while I/O continues.
+ * A first pass walks the target once; writes that complete behind it mark
+ * their chunk dirty and the chunk is copied again. Once the copy has caught
+ * up it keeps following writes until the target is suspended, when the
+ * last dirty chunks are copied and the new device can replace the target
+ * (see dm_remap_flatten_work() in the core).
+ */
+
+#ifndef DM_REMAP_V4_FLATTEN_H
+#define DM_REMAP_V4_FLATTEN_H
+
+#include <linux/types.h>
+#include <linux/wait.h>
+
+struct block_device;
+struct dm_kcopyd_client;
+struct dm_io_region;
+
+#define DM_REMAP_FLATTEN_CHUNK_SECTORS  1024  /* Copy and dirty-tracking unit (512KB) */
+#define DM_REMAP_FLATTEN_BATCH_CHUNKS   16    /* Chunks per work run, between rate checks */
+#define DM_REMAP_FLATTEN_MAX_FAILURES   8     /* Failed runs in a row before giving up */
+
+enum dm_remap_flatten_state {
+    DM_REMAP_FLATTEN_IDLE = 0,
+    DM_REMAP_FLATTEN_COPYING,        /* First pass, I/O continues */
+    DM_REMAP_FLATTEN_SYNCED,         /* Caught up, following writes */
+    DM_REMAP_FLATTEN_DONE,           /* Suspended with nothing left to copy */
+    DM_REMAP_FLATTEN_FAILED,
+    DM_REMAP_FLATTEN_CANCELLED,
+};
+
+/**
+ * struct dm_remap_flatten - One copy of the target to a new device
+ * @kc: kcopyd client
+ * @dst: New device
+ * @nr_sectors: Target length
+ * @nr_chunks: Chunks covering @nr_sectors
+ * @cursor: First chunk the first pass has not reached
+ * @dirty: Chunks below @cursor written since they were copied
+ * @pending: Copies in flight
+ * @wait: Woken when @pending drops to zero
+ * @error: First copy error since the last dm_remap_flatten_wait()
+ * @copied_sectors: Sectors copied so far, over all passes
+ * @copy_errors: Copies that failed and were marked dirty again
+ */
+struct dm_remap_flatten {
+    struct dm_kcopyd_client *kc;
+    struct block_device *dst;
+    sector_t nr_sectors;
+    unsigned long nr_chunks;
+    unsigned long cursor;
+    unsigned long *dirty;
+    atomic_t pending;
+    wait_queue_head_t wait;
+    int error;
+    atomic64_t copied_sectors;
+    atomic64_t copy_errors;
+};
+
+int dm_remap_flatten_init(struct dm_remap_flatten *f, struct block_device *dst,
+                          sector_t nr_sectors, sector_t start);
+void dm_remap_flatten_destroy(struct dm_remap_flatten *f);
+bool dm_remap_flatten_mark(struct dm_remap_flatten *f, sector_t sector, sector_t nr_sectors);
+unsigned long dm_remap_flatten_dirty_chunks(struct dm_remap_flatten *f);
+void dm_remap_flatten_copy(struct dm_remap_flatten *f, struct dm_io_region *from,
+                           sector_t sector);
+void dm_remap_flatten_zero(struct dm_remap_flatten *f, sector_t sector, sector_t nr_sectors);
+void dm_remap_flatten_written(struct dm_remap_flatten *f, sector_t nr_sectors, int error);
+int dm_remap_flatten_wait(struct dm_remap_flatten *f);
+const char *dm_remap_flatten_state_name(enum dm_remap_flatten_state state);
+
+#endif /* DM_REMAP_V4_FLATTEN_H */
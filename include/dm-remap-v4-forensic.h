@@ -0,0 +1,65 @@
+/*
+ * dm-remap v4.3 - Read-only (forensic) activation
+ *
+ * A table loaded with "mode ro" presents main device sectors with the
+ * remapped ones taken from the spare, as the metadata on disk has them,
+ * and never writes to either device. Main device read errors are recorded
+ * here instead of remapped. With an overlay device, writes to the target
+ * go there: each sector written gets an overlay sector, handed out in
+ * order, and later reads of it are served from the overlay. The map of
+ * written sectors lives in memory only.
+ */
+
+#ifndef DM_REMAP_V4_FORENSIC_H
+#define DM_REMAP_V4_FORENSIC_H
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/spinlock.h>
+#include <linux/xarray.h>
+
+#define DM_REMAP_FORENSIC_BAD_EXTENTS   256   /* Recorded read error extents */
+
+struct dm_remap_bad_extent {
+    sector_t start;
+    sector_t nr;
+};
+
+/**
+ * struct dm_remap_forensic - Read errors and the overlay of a read-only target
+ * @lock: Protects @bad, @nr_bad, @bad_dropped and @next
+ * @bad: Failed main device sectors, sorted and merged
+ * @nr_bad: Extents in @bad
+ * @bad_dropped: Failed sectors not recorded, @bad being full
+ * @map: Target sector to overlay sector, for sectors written to the overlay
+ * @next: First overlay sector not handed out yet
+ * @nr_sectors: Overlay size, 0 without an overlay
+ * @reads: Reads served (partly) from the overlay
+ * @writes: Writes stored on the overlay
+ * @full: Writes that failed with the overlay full
+ */
+struct dm_remap_forensic {
+    spinlock_t lock;
+    struct dm_remap_bad_extent *bad;
+    unsigned int nr_bad;
+    u64 bad_dropped;
+    struct xarray map;
+    sector_t next;
+    sector_t nr_sectors;
+    atomic64_t reads;
+    atomic64_t writes;
+    atomic64_t full;
+};
+
+int dm_remap_forensic_init(struct dm_remap_forensic *f, sector_t overlay_sectors);
+void dm_remap_forensic_destroy(struct dm_remap_forensic *f);
+void dm_remap_forensic_note_error(struct dm_remap_forensic *f, sector_t sector, sector_t nr);
+bool dm_remap_overlay_any(struct dm_remap_forensic *f, sector_t sector, sector_t nr);
+sector_t dm_remap_overlay_run(struct dm_remap_forensic *f, sector_t sector, sector_t nr,
+                              sector_t *overlay_sector, bool *mapped);
+int dm_remap_overlay_alloc(struct dm_remap_forensic *f, sector_t nr, sector_t *overlay_sector);
+int dm_remap_overlay_insert(struct dm_remap_forensic *f, sector_t sector, sector_t nr,
+                            sector_t overlay_sector);
+int dm_remap_forensic_format(struct dm_remap_forensic *f, char *buf, size_t len);
+
+#endif /* DM_REMAP_V4_FORENSIC_H */
@@ -0,0 +1,47 @@
+/*
+ * dm-remap v4.3 - Free spare extents
+ *
+ * Spare data sectors below the allocator's high-water mark that no remap
+ * points at any more, kept as a sorted array of extents so new remaps take
+ * them before the spare is used further. Adjacent extents are merged. When
+ * the array is full an extent is dropped rather than allocated: it is only
+ * lost until the free space is rebuilt from the remap table on the next
+ * load. No locking here; the core holds remap_lock around every call.
+ */
+
+#ifndef DM_REMAP_V4_FREELIST_H
+#define DM_REMAP_V4_FREELIST_H
+
+#include <linux/types.h>
+
+#define DM_REMAP_FREELIST_EXTENTS 256
+
+struct dm_remap_free_extent {
+    sector_t start;
+    sector_t nr;
+};
+
+/**
+ * struct dm_remap_freelist - Free spare extents
+ * @ext: DM_REMAP_FREELIST_EXTENTS slots, sorted by start, never overlapping
+ * @nr_ext: Slots in use
+ * @sectors: Sum of the extent lengths
+ * @dropped: Sectors not kept because the array was full
+ */
+struct dm_remap_freelist {
+    struct dm_remap_free_extent *ext;
+    unsigned int nr_ext;
+    sector_t sectors;
+    u64 dropped;
+};
+
+int dm_remap_freelist_init(struct dm_remap_freelist *fl);
+void dm_remap_freelist_destroy(struct dm_remap_freelist *fl);
+void dm_remap_freelist_reset(struct dm_remap_freelist *fl);
+void dm_remap_freelist_add(struct dm_remap_freelist *fl, sector_t start, sector_t nr);
+bool dm_remap_freelist_take(struct dm_remap_freelist *fl, sector_t nr, sector_t align,
+                            sector_t *start);
+void dm_remap_freelist_claim(struct dm_remap_freelist *fl, sector_t start, sector_t nr);
+void dm_remap_freelist_splice(struct dm_remap_freelist *to, struct dm_remap_freelist *from);
+
+#endif /* DM_REMAP_V4_FREELIST_H */
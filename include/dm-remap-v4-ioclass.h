@@ -0,0 +1,58 @@
+/*
+ * dm-remap v4.3 - cgroup and I/O priority of the target's own I/O
+ *
+ * I/O the target issues from its own threads is charged to a cgroup and
+ * given an I/O priority by source (enum dm_remap_io_source), as set with
+ * "<source>_cgroup" and "<source>_ioprio". Work done for one held bio -
+ * salvage re-reads, write read-backs, compressed and overlay I/O - is
+ * charged like that bio instead, so it stays with the submitter's cgroup;
+ * remapped bios keep it anyway, being clones.
+ *
+ * A worker enters a scope for one item of work. The thread's blkcg
+ * association (kthread_associate_blkcg()) and I/O priority then apply to
+ * every bio it submits, dm-bufio's and dm-io's included, and are restored
+ * when it leaves. Outside a kthread, as for a "dmsetup message", the
+ * caller's own cgroup and priority are used. dm-kcopyd submits from its
+ * own workers and is not covered.
+ */
+
+#ifndef DM_REMAP_V4_IOCLASS_H
+#define DM_REMAP_V4_IOCLASS_H
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+
+#include "dm-remap-v4-message.h"
+
+struct bio;
+struct cgroup_subsys_state;
+
+/**
+ * struct dm_remap_ioclass - Resolved settings of a device
+ * @lock: Protects @css and @ioprio
+ * @css: io controller state of each source's cgroup, or NULL
+ * @ioprio: Each source's priority, 0 = the worker's own
+ */
+struct dm_remap_ioclass {
+    spinlock_t lock;
+    struct cgroup_subsys_state *css[DM_REMAP_NR_IO_SOURCES];
+    u16 ioprio[DM_REMAP_NR_IO_SOURCES];
+};
+
+/* What a worker changed on entering a scope, to be undone on leaving */
+struct dm_remap_io_scope {
+    bool active;                     /* Entered in a kthread */
+    bool css;                        /* Associated with a cgroup */
+    bool prio;                       /* Priority changed from... */
+    u16 old_prio;                    /* ... this */
+};
+
+void dm_remap_ioclass_init(struct dm_remap_ioclass *ioc);
+int dm_remap_ioclass_set(struct dm_remap_ioclass *ioc, const struct dm_remap_tunables *tunables);
+void dm_remap_ioclass_destroy(struct dm_remap_ioclass *ioc);
+void dm_remap_io_enter(struct dm_remap_ioclass *ioc, unsigned int source,
+                       struct dm_remap_io_scope *scope);
+void dm_remap_io_enter_bio(struct bio *bio, struct dm_remap_io_scope *scope);
+void dm_remap_io_leave(struct dm_remap_io_scope *scope);
+
+#endif /* DM_REMAP_V4_IOCLASS_H */
@@ -0,0 +1,268 @@
+/*
+ * dm-remap v4.3 - Table and message argument parsing
+ *
+ * Parsing of everything userspace hands the target as strings, kept apart
+ * from the target itself so it can be built and fuzzed in userspace
+ * (tests/fuzz). Parsers only check syntax; range checks that need device
+ * state stay in the core.
+ */
+
+#ifndef DM_REMAP_V4_MESSAGE_H
+#define DM_REMAP_V4_MESSAGE_H
+
+#include <linux/types.h>
+
+enum dm_remap_msg_cmd {
+    DM_REMAP_MSG_HELP,
+    DM_REMAP_MSG_STATUS,
+    DM_REMAP_MSG_STATS,
+    DM_REMAP_MSG_CLEAR_STATS,
+    DM_REMAP_MSG_HEALTH,
+    DM_REMAP_MSG_CACHE_STATS,
+    DM_REMAP_MSG_POLICY,
+    DM_REMAP_MSG_SHADOW,
+    DM_REMAP_MSG_EVENTS,
+    DM_REMAP_MSG_TEST_REMAP,
+    DM_REMAP_MSG_SET,
+    DM_REMAP_MSG_REPLACE_SPARE,
+    DM_REMAP_MSG_GROW,
+    DM_REMAP_MSG_ERRORS,
+    DM_REMAP_MSG_INJECT_ERROR,
+    DM_REMAP_MSG_PIPELINE,
+    DM_REMAP_MSG_HUNG,
+    DM_REMAP_MSG_CHECKSUMS,
+    DM_REMAP_MSG_FLATTEN,
+    DM_REMAP_MSG_FORENSIC,
+};
+
+/* Sub-commands of "shadow" */
+enum dm_remap_msg_shadow_op {
+    DM_REMAP_MSG_SHADOW_SHOW,
+    DM_REMAP_MSG_SHADOW_SET,
+    DM_REMAP_MSG_SHADOW_RESET,
+    DM_REMAP_MSG_SHADOW_OFF,
+};
+
+/* Sub-commands of "replace_spare" */
+enum dm_remap_msg_replace_op {
+    DM_REMAP_MSG_REPLACE_SHOW,
+    DM_REMAP_MSG_REPLACE_START,      /* argv[0]: new spare device */
+    DM_REMAP_MSG_REPLACE_CANCEL,
+};
+
+/* Sub-commands of "flatten" */
+enum dm_remap_msg_flatten_op {
+    DM_REMAP_MSG_FLATTEN_SHOW,
+    DM_REMAP_MSG_FLATTEN_START,      /* argv[0]: replacement device */
+    DM_REMAP_MSG_FLATTEN_CANCEL,
+};
+
+/**
+ * struct dm_remap_msg - A parsed "dmsetup message"
+ * @cmd: Command
+ * @op: Sub-command, where the command has them
+ * @arg: Numeric arguments (test_remap: bad, spare; events: since_seq;
+ *       inject_error: count)
+ * @argc: Remaining arguments (shadow set: "key=value"...; set: key, value;
+ *        replace_spare, flatten: device; inject_error: status)
+ * @argv: ... pointing into the caller's argv
+ * @error: Usage text when parsing fails
+ */
+struct dm_remap_msg {
+    enum dm_remap_msg_cmd cmd;
+    unsigned int op;
+    u64 arg[2];
+    unsigned int argc;
+    char **argv;
+    const char *error;
+};
+
+/* How the metadata thread writes the table after a remap is activated */
+enum dm_remap_commit_policy {
+    DM_REMAP_COMMIT_ASYNC,       /* Dirty dm-bufio buffers, written back later */
+    DM_REMAP_COMMIT_SYNC,        /* Write and flush all copies before moving on */
+};
+
+/* What a reload with a shorter table does with remaps beyond the new end */
+enum dm_remap_shrink_policy {
+    DM_REMAP_SHRINK_REFUSE,      /* Fail the resume, keep everything */
+    DM_REMAP_SHRINK_DROP,        /* Drop them and reclaim their spare sectors */
+};
+
+/* Which writes are read back before they complete (bits) */
+enum dm_remap_write_verify {
+    DM_REMAP_VERIFY_OFF = 0,
+    DM_REMAP_VERIFY_REMAPPED = 1,    /* Writes to the spare */
+    DM_REMAP_VERIFY_ERRORS = 2,      /* Writes within verify_window of a recent error */
+    DM_REMAP_VERIFY_ALL = 3,         /* Both */
+};
+
+/* How remapped data is stored on the spare (v4.3); the algorithms are
+ * numbered as DM_REMAP_V4_COMPRESS_* in the extent headers */
+enum dm_remap_compress {
+    DM_REMAP_COMPRESS_OFF,       /* One spare sector per remapped sector */
+    DM_REMAP_COMPRESS_LZ4,       /* Whole 4KiB units compressed with "lz4" */
+    DM_REMAP_COMPRESS_ZSTD,      /* ... or with "zstd" */
+};
+
+/*
+ * Classes of main device I/O errors, by blk_status_t. Only media errors
+ * mean the sectors themselves are bad; the others come from the path to
+ * the device or from the request and say nothing about the media.
+ */
+enum dm_remap_error_class {
+    DM_REMAP_ERR_MEDIA,          /* MEDIUM, IOERR, PROTECTION, TARGET */
+    DM_REMAP_ERR_TRANSPORT,      /* TRANSPORT, TIMEOUT, OFFLINE, NEXUS */
+    DM_REMAP_ERR_RESOURCE,       /* RESOURCE, DEV_RESOURCE, AGAIN, zone resources */
+    DM_REMAP_ERR_UNSUPPORTED,    /* NOTSUPP */
+    DM_REMAP_ERR_OTHER,          /* Anything else (NOSPC, ...) */
+    DM_REMAP_NR_ERROR_CLASSES
+};
+
+/* What to do with an error of a given class */
+enum dm_remap_error_action {
+    DM_REMAP_ACT_REMAP,          /* Count, analyse and remap the sectors */
+    DM_REMAP_ACT_RETRY,          /* Resubmit up to retry_limit times, then pass */
+    DM_REMAP_ACT_PASS,           /* Complete the bio with the error as is */
+    DM_REMAP_ACT_COUNT,          /* Count and analyse, but never remap */
+};
+
+/* Sources of the target's own I/O, each with a cgroup and an I/O priority (v4.3) */
+enum dm_remap_io_source {
+    DM_REMAP_IOS_METADATA,       /* Metadata commits and remap creation */
+    DM_REMAP_IOS_REPAIR,         /* Metadata copy repair and scrubs */
+    DM_REMAP_IOS_COPY,           /* replace_spare and flatten copies */
+    DM_REMAP_NR_IO_SOURCES
+};
+
+/* I/O priority classes, numbered as IOPRIO_CLASS_* */
+enum dm_remap_ioprio_class {
+    DM_REMAP_IOPRIO_NONE,        /* The submitting thread's own priority */
+    DM_REMAP_IOPRIO_RT,
+    DM_REMAP_IOPRIO_BE,
+    DM_REMAP_IOPRIO_IDLE,
+};
+
+/* An I/O priority as IOPRIO_PRIO_VALUE() makes it */
+#define DM_REMAP_IOPRIO_CLASS_SHIFT 13
+#define DM_REMAP_IOPRIO_LEVELS      8
+#define DM_REMAP_IOPRIO(class, level) (((class) << DM_REMAP_IOPRIO_CLASS_SHIFT) | (level))
+
+#define DM_REMAP_DEFAULT_SCAN_INTERVAL  300           /* Seconds */
+#define DM_REMAP_MAX_SCAN_INTERVAL      (168 * 3600)  /* One week */
+#define DM_REMAP_DEFAULT_CACHE_SIZE     256           /* Entries */
+#define DM_REMAP_MAX_CACHE_SIZE         65536
+#define DM_REMAP_DEFAULT_RETRY_LIMIT    3
+#define DM_REMAP_MAX_RETRY_LIMIT        16
+#define DM_REMAP_DEFAULT_HUNG_TIMEOUT   30            /* Seconds */
+#define DM_REMAP_MAX_HUNG_TIMEOUT       3600
+#define DM_REMAP_DEFAULT_SALVAGE_RETRIES 3
+#define DM_REMAP_MAX_SALVAGE_SECTORS    512           /* Largest read held for salvage */
+#define DM_REMAP_DEFAULT_VERIFY_WINDOW  2048          /* Sectors either side of an error */
+#define DM_REMAP_MAX_VERIFY_WINDOW      (1U << 21)    /* 1GB */
+#define DM_REMAP_MAX_FLATTEN_RATE       65536         /* MiB/s */
+#define DM_REMAP_CGROUP_PATH_LEN        64            /* Including the NUL */
+#define DM_REMAP_DOMAIN_NAME_LEN        32            /* Including the NUL */
+
+/**
+ * struct dm_remap_tunables - Per-device settings
+ * @scan_interval: Health scan interval in seconds
+ * @cache_size: Remap lookup cache entries, a power of two, 0 = no cache
+ * @commit_policy: enum dm_remap_commit_policy
+ * @remap_granularity: Sectors remapped per error, 0 = one logical block
+ * @error_action: enum dm_remap_error_action, by enum dm_remap_error_class
+ *                ("media_errors", "transport_errors", ... as keys)
+ * @retry_limit: Resubmissions of a bio before a retried error is passed up
+ * @shrink_policy: enum dm_remap_shrink_policy
+ * @hung_timeout: Seconds before an outstanding bio is reported, 0 = never
+ * @salvage_retries: Re-reads of a failed read before it is remapped, 0 = none
+ * @salvage_sectors: Unit of the re-reads after whole-range ones failed, a
+ *                   power of two, 0 = whole range only
+ * @write_verify: enum dm_remap_write_verify
+ * @verify_window: Sectors either side of a recent error whose writes are
+ *                 verified under DM_REMAP_VERIFY_ERRORS
+ * @data_checksums: Checksum remapped data on the spare and check it on
+ *                  reads, 0 = off
+ * @flatten_rate: MiB/s a "flatten" copy may read, 0 = unlimited
+ * @compress: enum dm_remap_compress, for remapped data written from now on
+ * @ioprio: I/O priority by enum dm_remap_io_source, a DM_REMAP_IOPRIO()
+ *          value, 0 = the worker's own ("metadata_ioprio", ... as keys)
+ * @cgroup: cgroup v2 path the I/O is charged to, by enum
+ *          dm_remap_io_source, zero-padded, "" = the worker's own
+ *          ("metadata_cgroup", ... as keys)
+ * @correlated_action: enum dm_remap_error_action for errors that would be
+ *                     remapped while the error domain sees a burst
+ *                     ("correlated_errors")
+ * @error_domain: Error domain to correlate with, zero-padded, "" = the
+ *                main device's controller, "none" = no correlation
+ *
+ * Given as optional feature arguments on the table line or changed at
+ * runtime with "set <key> <value>". Settings at their default are not
+ * emitted in the table, so old table lines stay valid.
+ */
+struct dm_remap_tunables {
+    u32 scan_interval;
+    u32 cache_size;
+    u32 commit_policy;
+    u32 remap_granularity;
+    u32 error_action[DM_REMAP_NR_ERROR_CLASSES];
+    u32 retry_limit;
+    u32 shrink_policy;
+    u32 hung_timeout;
+    u32 salvage_retries;
+    u32 salvage_sectors;
+    u32 write_verify;
+    u32 verify_window;
+    u32 data_checksums;
+    u32 flatten_rate;
+    u32 compress;
+    u32 ioprio[DM_REMAP_NR_IO_SOURCES];
+    char cgroup[DM_REMAP_NR_IO_SOURCES][DM_REMAP_CGROUP_PATH_LEN];
+    u32 correlated_action;
+    char error_domain[DM_REMAP_DOMAIN_NAME_LEN];
+};
+
+/* v4.3: A metadata area on a separate device starts on a 4KiB boundary */
+#define DM_REMAP_METADATA_OFFSET_ALIGN   8
+
+/**
+ * struct dm_remap_table_args - Parsed table line
+ * @main_path: Main (data) device
+ * @spare_path: Spare device holding remapped sectors, and the metadata
+ *              unless @metadata_path is given
+ * @metadata_path: Separate metadata device, or NULL
+ * @metadata_offset: First sector of this target's metadata area on it
+ * @read_only: "mode ro": never write to main, spare or metadata device
+ * @overlay_path: "overlay <device>": where writes go with @read_only, or NULL
+ * @tunables: Defaults overridden by the other feature arguments
+ */
+struct dm_remap_table_args {
+    const char *main_path;
+    const char *spare_path;
+    const char *metadata_path;
+    u64 metadata_offset;
+    bool read_only;
+    const char *overlay_path;
+    struct dm_remap_tunables tunables;
+};
+
+#define DM_REMAP_MSG_HELP_TEXT \
+    "Commands: help, status, stats, clear_stats, health, cache_stats, policy, " \
+    "shadow, events, test_remap, set, replace_spare, grow, errors, inject_error, pipeline, " \
+    "hung, checksums, flatten, forensic"
+
+int dm_remap_message_parse(unsigned int argc, char **argv, struct dm_remap_msg *msg);
+int dm_remap_parse_table_args(unsigned int argc, char **argv,
+                              struct dm_remap_table_args *args, char **error);
+int dm_remap_table_args_format(const struct dm_remap_table_args *args,
+                               char *result, unsigned int maxlen);
+
+void dm_remap_tunables_init(struct dm_remap_tunables *tunables);
+int dm_remap_tunable_set(struct dm_remap_tunables *tunables,
+                         const char *key, const char *value);
+int dm_remap_tunables_format(const struct dm_remap_tunables *tunables, bool table,
+                             char *result, unsigned int maxlen);
+const char *dm_remap_error_class_name(unsigned int class);
+const char *dm_remap_io_source_name(unsigned int source);
+
+#endif /* DM_REMAP_V4_MESSAGE_H */
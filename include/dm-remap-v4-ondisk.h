@@ -0,0 +1,217 @@
+/*
+ * dm-remap v4.3 - On-disk metadata format
+ *
+ * The metadata copies at the start of the spare device, shared by the
+ * module and the userspace tools (tools/dmremap-meta, tests/fuzz) so
+ * they cannot drift apart. Copy i is stored at byte offset
+ * i * DM_REMAP_V4_METADATA_BLOCK_SIZE, in host byte order, from the start
+ * of the spare or of the target's area on a separate metadata device.
+ *
+ * Nothing here may depend on kernel-only headers.
+ */
+
+#ifndef DM_REMAP_V4_ONDISK_H
+#define DM_REMAP_V4_ONDISK_H
+
+#include <linux/types.h>
+
+#define DM_REMAP_METADATA_V4_MAGIC      0x444D5234  /* "DMR4" */
+#define DM_REMAP_METADATA_V4_VERSION    4
+#define DM_REMAP_V4_MAX_REMAPS          2048
+#define DM_REMAP_V4_REDUNDANT_COPIES    5
+#define DM_REMAP_V4_METADATA_BLOCK_SIZE 131072      /* dm-bufio block per copy */
+/* First sector of copy @i, from the start of the metadata area */
+#define DM_REMAP_V4_COPY_SECTOR(i) \
+    ((uint64_t)(i) * (DM_REMAP_V4_METADATA_BLOCK_SIZE >> SECTOR_SHIFT))
+/* Sectors taken by the copies, at the start of the spare or at the table's
+ * offset on a separate metadata device (v4.3) */
+#define DM_REMAP_V4_METADATA_AREA_SECTORS \
+    (DM_REMAP_V4_REDUNDANT_COPIES * (DM_REMAP_V4_METADATA_BLOCK_SIZE >> SECTOR_SHIFT))
+/* First spare sector available for remapped data (after the metadata copies).
+ * The area stays reserved with a metadata device, so a spare's layout does
+ * not depend on where its metadata lives. */
+#define DM_REMAP_V4_SPARE_DATA_START    DM_REMAP_V4_METADATA_AREA_SECTORS
+
+/**
+ * Pure v4.0 Metadata Structure - No Legacy Baggage
+ * 
+ * Total size: ~82KB, one copy per dm-bufio block
+ * Optimized layout for cache performance and minimal I/O
+ */
+struct dm_remap_metadata_v4 {
+    /* Streamlined header with single checksum */
+    struct {
+        uint32_t magic;                 /* 0x444D5234 (DMR4) */
+        uint32_t version;               /* Always 4 (no version detection needed) */
+        uint64_t sequence_number;       /* For conflict resolution */
+        uint64_t timestamp;             /* Creation/update time */
+        uint32_t metadata_checksum;     /* Single CRC32 for entire structure */
+        uint32_t copy_index;            /* Which redundant copy (0-4) */
+        uint32_t structure_size;        /* Total metadata size */
+        uint32_t reserved;              /* Future header expansion */
+    } header __attribute__((packed));
+    
+    /* Device identification and configuration */
+    struct {
+        char main_device_uuid[37];      /* Main device UUID */
+        char spare_device_uuid[37];     /* Spare device UUID */
+        uint64_t main_device_sectors;   /* Main device size */
+        uint64_t spare_device_sectors;  /* Spare device size */
+        uint32_t sector_size;           /* Device sector size */
+        uint32_t remap_capacity;        /* Max remaps supported */
+        uint8_t device_fingerprint[32]; /* SHA-256 device fingerprint */
+        char device_model[64];          /* Device model for validation */
+    } device_config __attribute__((packed));
+    
+    /* Health monitoring and scanning */
+    struct {
+        uint64_t last_full_scan;        /* Last complete scan timestamp */
+        uint64_t next_scheduled_scan;   /* Next scan time */
+        uint32_t health_score;          /* Overall health (0-100) */
+        uint32_t scan_progress_percent; /* Current scan progress */
+        uint32_t total_errors_found;    /* Lifetime error count */
+        uint32_t predictive_remaps;     /* Proactive remaps created */
+        uint32_t scan_interval_hours;   /* Configured scan interval */
+        uint32_t scan_flags;            /* Scanning configuration */
+        
+        /* Scan statistics */
+        struct {
+            uint32_t sectors_scanned;
+            uint32_t errors_detected;
+            uint32_t slow_sectors_found;
+            uint32_t scan_interruptions;
+        } scan_stats;
+    } health_data __attribute__((packed));
+    
+    /* Simplified remap table (direct mapping, no indirection) */
+    struct {
+        uint32_t active_remaps;         /* Current number of remaps */
+        uint32_t max_remaps;            /* Maximum capacity */
+        uint32_t next_spare_sector;     /* Next available spare sector */
+        uint32_t remap_flags;           /* Remap behavior flags */
+        
+        /* Direct remap entries (no complex indexing) */
+        struct {
+            uint64_t original_sector;   /* Failing sector */
+            uint64_t spare_sector;      /* Replacement sector */
+            uint64_t remap_timestamp;   /* When remap was created */
+            uint32_t access_count;      /* Usage counter */
+            uint32_t error_count;       /* Errors on original sector */
+            uint16_t remap_reason;      /* Why remap was created */
+            uint16_t flags;             /* Remap-specific flags */
+        } remaps[DM_REMAP_V4_MAX_REMAPS];
+    } remap_data __attribute__((packed));
+    
+    /* Future expansion without breaking compatibility */
+    struct {
+        uint32_t expansion_version;     /* For future v4.x features */
+        uint32_t expansion_size;        /* Bytes used in expansion area */
+        uint8_t expansion_data[2048];   /* Reserved for v4.1, v4.2, etc. */
+    } future_expansion __attribute__((packed));
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct dm_remap_metadata_v4) <= DM_REMAP_V4_METADATA_BLOCK_SIZE,
+               "metadata copy must fit its dm-bufio block");
+
+/*
+ * v4.3: A remap entry with DM_REMAP_V4_REMAP_ZERO in its flags reads as
+ * zeros and holds no spare space; its spare_sector is 0. The other flag
+ * bits are the module's in-memory state and mean nothing on disk.
+ */
+#define DM_REMAP_V4_REMAP_ZERO          0x0004
+
+/*
+ * v4.3: Compressed remaps. The DM_REMAP_V4_COMPRESS_SECTORS sectors of an
+ * aligned unit of the main device are stored as one compressed extent of
+ * 1..DM_REMAP_V4_COMPRESS_SECTORS - 1 spare sectors, its length in bits
+ * 8-11 of the flags. Every entry of the unit carries the same flags and
+ * names the extent's first sector. The extent starts with a struct
+ * dm_remap_v4_compress_header; a unit that does not fit is stored as is.
+ */
+#define DM_REMAP_V4_REMAP_COMPRESSED    0x0008
+#define DM_REMAP_V4_COMPRESS_SECTORS    8
+#define DM_REMAP_V4_REMAP_CLEN_SHIFT    8
+#define DM_REMAP_V4_REMAP_CLEN_MASK     0x0f00
+#define DM_REMAP_V4_REMAP_CLEN(flags) \
+    (((flags) & DM_REMAP_V4_REMAP_CLEN_MASK) >> DM_REMAP_V4_REMAP_CLEN_SHIFT)
+#define DM_REMAP_V4_COMPRESS_MAGIC      0x5A43  /* "CZ" */
+#define DM_REMAP_V4_COMPRESS_LZ4        1
+#define DM_REMAP_V4_COMPRESS_ZSTD       2
+
+struct dm_remap_v4_compress_header {
+    uint16_t magic;                     /* DM_REMAP_V4_COMPRESS_MAGIC */
+    uint8_t alg;                        /* DM_REMAP_V4_COMPRESS_* */
+    uint8_t reserved;
+    uint32_t length;                    /* Compressed bytes after the header */
+    uint64_t original_sector;           /* First sector of the unit */
+    uint32_t crc;                       /* crc32 of the compressed bytes */
+    uint32_t reserved2;
+} __attribute__((packed));
+
+/* Most compressed bytes an extent can hold */
+#define DM_REMAP_V4_COMPRESS_MAX_BYTES \
+    (((DM_REMAP_V4_COMPRESS_SECTORS - 1) << SECTOR_SHIFT) - \
+     sizeof(struct dm_remap_v4_compress_header))
+
+/*
+ * v4.3: expansion_version is a mask of the DM_REMAP_V4_EXPANSION_* records
+ * present in expansion_data, each at its own fixed offset.
+ *
+ * Checksums of remapped data. With DM_REMAP_V4_EXPANSION_CSUM the
+ * expansion area starts with a struct dm_remap_v4_csum_info pointing at a
+ * table of records on the spare, one crc32c per remapped sector, hashed by
+ * original sector with linear probing. The table sits in the spare data
+ * area like any remapped extent.
+ */
+#define DM_REMAP_V4_EXPANSION_CSUM      0x0001
+#define DM_REMAP_V4_CSUM_VALID          0x0001  /* Records kept up to date by every write */
+#define DM_REMAP_V4_CSUM_SLOTS          (2 * DM_REMAP_V4_MAX_REMAPS)
+
+struct dm_remap_v4_csum_record {
+    uint64_t original_sector;           /* Remapped sector */
+    uint64_t spare_sector;              /* Where its data was, 0 = free slot */
+    uint32_t crc;                       /* crc32c of the 512 bytes written there */
+    uint32_t reserved[3];
+} __attribute__((packed));
+
+struct dm_remap_v4_csum_info {
+    uint64_t area_sector;               /* First spare sector of the records */
+    uint32_t flags;                     /* DM_REMAP_V4_CSUM_* */
+    uint32_t slots;                     /* DM_REMAP_V4_CSUM_SLOTS when written */
+} __attribute__((packed));
+
+#define DM_REMAP_V4_CSUM_AREA_SECTORS \
+    (DM_REMAP_V4_CSUM_SLOTS * sizeof(struct dm_remap_v4_csum_record) >> SECTOR_SHIFT)
+
+/*
+ * v4.3: A copy of the target's contents to a replacement device
+ * ("flatten"). With DM_REMAP_V4_EXPANSION_FLATTEN a struct
+ * dm_remap_v4_flatten_info at DM_REMAP_V4_FLATTEN_INFO_OFFSET names the
+ * device. Its cursor is only trusted with DM_REMAP_V4_FLATTEN_CLEAN, set
+ * while the target is suspended with nothing below the cursor left to copy.
+ * A copy found complete at a suspend is recorded DM_REMAP_V4_FLATTEN_DONE
+ * instead of ACTIVE: the replacement may be in use from then on.
+ */
+#define DM_REMAP_V4_EXPANSION_FLATTEN   0x0002
+#define DM_REMAP_V4_FLATTEN_INFO_OFFSET 64
+#define DM_REMAP_V4_FLATTEN_ACTIVE      0x0001  /* Copy to be resumed on load */
+#define DM_REMAP_V4_FLATTEN_CLEAN       0x0002  /* cursor_sector is valid */
+#define DM_REMAP_V4_FLATTEN_DONE        0x0004  /* Complete; started again by hand only */
+
+struct dm_remap_v4_flatten_info {
+    char path[256];                     /* Replacement device as given */
+    uint64_t nr_sectors;                /* Target length being copied */
+    uint64_t cursor_sector;             /* Copied up to here, with CLEAN */
+    uint32_t flags;                     /* DM_REMAP_V4_FLATTEN_* */
+    uint32_t reserved;
+} __attribute__((packed));
+
+/* v4.3: Parsing of on-disk copies (dm-remap-v4-metadata-parse.c) */
+uint32_t dm_remap_metadata_v4_crc32(const struct dm_remap_metadata_v4 *metadata);
+int dm_remap_validate_metadata_v4(const struct dm_remap_metadata_v4 *metadata);
+int dm_remap_validate_remap_table_v4(const struct dm_remap_metadata_v4 *metadata,
+                                     uint64_t main_sectors, uint64_t spare_sectors);
+int dm_remap_select_metadata_copy_v4(const struct dm_remap_metadata_v4 *copies,
+                                     const bool *valid, int nr_copies);
+
+#endif /* DM_REMAP_V4_ONDISK_H */
@@ -0,0 +1,53 @@
+/*
+ * dm-remap v4.3 - Remap pipeline timing
+ *
+ * Where the time goes between an I/O error on the main device and its
+ * remap becoming ACTIVE, as log2 microsecond histograms per stage, and how
+ * many metadata bytes the remaps cost. Read with
+ * "dmsetup message <dev> 0 pipeline", reset with "clear_stats".
+ */
+
+#ifndef DM_REMAP_V4_PIPELINE_H
+#define DM_REMAP_V4_PIPELINE_H
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+
+/* Bucket i counts latencies below 2^i us; the last one takes the rest */
+#define DM_REMAP_PIPE_BUCKETS 24
+
+enum dm_remap_pipe_stage {
+    DM_REMAP_PIPE_QUEUE = 0,         /* Error seen -> write-ahead or salvage work running */
+    DM_REMAP_PIPE_SALVAGE,           /* Re-reads of a failed read */
+    DM_REMAP_PIPE_ALLOC,             /* Spare extent, PENDING entries, salvaged data */
+    DM_REMAP_PIPE_SERIALIZE,         /* Remap table into the dm-bufio buffers */
+    DM_REMAP_PIPE_WRITE,             /* All copies written and the spare flushed */
+    DM_REMAP_PIPE_TOTAL,             /* Error seen -> remap ACTIVE */
+    DM_REMAP_PIPE_NR_STAGES,
+};
+
+struct dm_remap_pipe_hist {
+    u64 count;
+    u64 sum_ns;
+    u64 max_ns;
+    u64 buckets[DM_REMAP_PIPE_BUCKETS];
+};
+
+struct dm_remap_pipeline_stats {
+    spinlock_t lock;
+    struct dm_remap_pipe_hist stage[DM_REMAP_PIPE_NR_STAGES];
+    u64 remaps;                      /* Write-ahead remaps activated */
+    u64 remapped_bytes;              /* ... data they redirect to the spare */
+    u64 metadata_writes;             /* Metadata generations handed to dm-bufio */
+    u64 metadata_bytes;              /* ... all copies, whole blocks */
+};
+
+void dm_remap_pipeline_init(struct dm_remap_pipeline_stats *p);
+void dm_remap_pipeline_reset(struct dm_remap_pipeline_stats *p);
+void dm_remap_pipeline_record(struct dm_remap_pipeline_stats *p,
+                              enum dm_remap_pipe_stage stage, u64 ns);
+void dm_remap_pipeline_remap(struct dm_remap_pipeline_stats *p, u64 bytes);
+void dm_remap_pipeline_metadata_write(struct dm_remap_pipeline_stats *p, u64 bytes);
+int dm_remap_pipeline_format(struct dm_remap_pipeline_stats *p, char *buf, size_t len);
+
+#endif /* DM_REMAP_V4_PIPELINE_H */
@@ -0,0 +1,86 @@
+/*
+ * dm-remap v4.3 - BPF-programmable remap policy
+ *
+ * The policy decisions of the core (whether to remap a failed sector, how
+ * much to remap, where to put it on the spare and how often to scan) can be
+ * overridden by a BPF struct_ops program of type dm_remap_policy_ops.
+ *
+ * Every hook is optional. When no program is attached, or a hook is left
+ * NULL, the built-in default is used. The call sites are behind a static
+ * key, so an unattached system pays one patched-out branch per decision.
+ */
+
+#ifndef DM_REMAP_V4_POLICY_H
+#define DM_REMAP_V4_POLICY_H
+
+#include <linux/types.h>
+#include <linux/jump_label.h>
+
+/* should_remap() verdicts */
+#define DM_REMAP_POLICY_REMAP    0  /* Remap the failed sector (default) */
+#define DM_REMAP_POLICY_RETRY    1  /* Leave it on main; ask again on the next error */
+#define DM_REMAP_POLICY_IGNORE   2  /* Leave it on main and don't count the error */
+
+/* Largest remap a policy may request (64 KiB) */
+#define DM_REMAP_POLICY_MAX_GRANULARITY  128
+
+#define DM_REMAP_POLICY_NAME_LEN 16
+
+/**
+ * struct dm_remap_policy_ops - BPF struct_ops remap policy
+ * @should_remap: Verdict for an I/O error on the main device
+ * @remap_granularity: Sectors to remap around a failed sector, 0 for default
+ * @spare_placement: Preferred first spare sector for a new remap, 0 for default
+ * @scan_interval: Seconds until the next health scan, 0 for default
+ * @name: Policy name reported by the "policy" message
+ *
+ * @dev is the main device's dev_t, so one program can serve several targets.
+ * Hooks may run in interrupt context and must not sleep.
+ */
+struct dm_remap_policy_ops {
+    int (*should_remap)(u32 dev, u64 sector, int error, bool is_write);
+    u32 (*remap_granularity)(u32 dev, u64 sector, u32 default_sectors);
+    u64 (*spare_placement)(u32 dev, u64 sector, u32 nr_sectors);
+    u32 (*scan_interval)(u32 dev, u32 health_score, u32 default_seconds);
+    char name[DM_REMAP_POLICY_NAME_LEN];
+};
+
+DECLARE_STATIC_KEY_FALSE(dm_remap_policy_attached);
+
+int dm_remap_policy_init(void);
+
+int __dm_remap_policy_should_remap(u32 dev, u64 sector, int error, bool is_write);
+u32 __dm_remap_policy_remap_granularity(u32 dev, u64 sector, u32 default_sectors);
+u64 __dm_remap_policy_spare_placement(u32 dev, u64 sector, u32 nr_sectors);
+u32 __dm_remap_policy_scan_interval(u32 dev, u32 health_score, u32 default_seconds);
+int dm_remap_policy_name(char *buf, size_t len);
+
+static inline int dm_remap_policy_should_remap(u32 dev, u64 sector, int error, bool is_write)
+{
+    if (static_branch_unlikely(&dm_remap_policy_attached))
+        return __dm_remap_policy_should_remap(dev, sector, error, is_write);
+    return DM_REMAP_POLICY_REMAP;
+}
+
+static inline u32 dm_remap_policy_remap_granularity(u32 dev, u64 sector, u32 default_sectors)
+{
+    if (static_branch_unlikely(&dm_remap_policy_attached))
+        return __dm_remap_policy_remap_granularity(dev, sector, default_sectors);
+    return default_sectors;
+}
+
+static inline u64 dm_remap_policy_spare_placement(u32 dev, u64 sector, u32 nr_sectors)
+{
+    if (static_branch_unlikely(&dm_remap_policy_attached))
+        return __dm_remap_policy_spare_placement(dev, sector, nr_sectors);
+    return 0;
+}
+
+static inline u32 dm_remap_policy_scan_interval(u32 dev, u32 health_score, u32 default_seconds)
+{
+    if (static_branch_unlikely(&dm_remap_policy_attached))
+        return __dm_remap_policy_scan_interval(dev, health_score, default_seconds);
+    return default_seconds;
+}
+
+#endif /* DM_REMAP_V4_POLICY_H */
@@ -0,0 +1,81 @@
+/*
+ * dm-remap v4.3 - Shadow (dry-run) remap policy
+ *
+ * A shadow policy sees the same main-device error stream as the active one
+ * and simulates its own remap and prediction decisions, without touching
+ * the remap table or the spare. Its decisions are counted and recorded in
+ * the event stream, so an alternate configuration can be compared with the
+ * active one on identical, real workloads before it is rolled out.
+ */
+
+#ifndef DM_REMAP_V4_SHADOW_H
+#define DM_REMAP_V4_SHADOW_H
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+
+#include "dm-remap-v4-events.h"
+
+/* Built-in predictor: consecutive same-sector errors that raise the score */
+#define DM_REMAP_PREDICT_CONSECUTIVE  5
+#define DM_REMAP_PREDICT_STEP         10
+
+/* Failing regions a shadow policy tracks; further ones are only counted */
+#define DM_REMAP_SHADOW_TRACKED       256
+
+/**
+ * struct dm_remap_policy_params - Tunables of a remap policy
+ * @remap_after_errors: Errors in a region before it is remapped
+ * @remap_granularity: Sectors per remap (power of two)
+ * @predict_consecutive: Consecutive same-sector errors that raise the score
+ * @predict_step: Score added each time @predict_consecutive is exceeded
+ * @migrate_score: Score at which failing regions are migrated before they
+ *                 reach @remap_after_errors, 0 for never
+ */
+struct dm_remap_policy_params {
+    u32 remap_after_errors;
+    u32 remap_granularity;
+    u32 predict_consecutive;
+    u32 predict_step;
+    u32 migrate_score;
+};
+
+struct dm_remap_shadow_region {
+    u64 sector;                      /* First sector of the region */
+    u32 errors;
+    bool remapped;                   /* Would be on the spare by now */
+};
+
+struct dm_remap_shadow {
+    spinlock_t lock;
+    bool enabled;
+    struct dm_remap_policy_params params;
+
+    /* Simulated state */
+    struct dm_remap_shadow_region regions[DM_REMAP_SHADOW_TRACKED];
+    u32 nr_regions;
+    u64 last_sector;
+    u32 consecutive;
+    u32 predict_score;
+
+    /* Decisions */
+    u64 errors_seen;
+    u64 would_remap;
+    u64 would_migrate;
+    u64 would_retry;
+    u64 would_predict;
+    u64 would_spare_sectors;
+    u64 untracked;                   /* Errors past DM_REMAP_SHADOW_TRACKED regions */
+};
+
+void dm_remap_shadow_init(struct dm_remap_shadow *shadow);
+int dm_remap_shadow_configure(struct dm_remap_shadow *shadow,
+                              const struct dm_remap_policy_params *defaults,
+                              unsigned int argc, char **argv);
+void dm_remap_shadow_disable(struct dm_remap_shadow *shadow);
+void dm_remap_shadow_reset(struct dm_remap_shadow *shadow);
+void dm_remap_shadow_error(struct dm_remap_shadow *shadow, struct dm_remap_event_log *log,
+                           u64 sector);
+int dm_remap_shadow_format(struct dm_remap_shadow *shadow, char *buf, size_t len);
+
+#endif /* DM_REMAP_V4_SHADOW_H */
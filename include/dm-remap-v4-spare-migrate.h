@@ -0,0 +1,70 @@
+/*
+ * dm-remap v4.3 - Live spare device replacement
+ *
+ * Copies the in-use part of the spare device to a new one with kcopyd
+ * while I/O continues. Writes that complete on the old spare during the
+ * copy mark their chunk dirty and the chunk is copied again, so repeated
+ * passes converge. The target quiesces spare I/O only for the last pass
+ * and the switch itself (see dm_remap_spare_migrate_work() in the core).
+ */
+
+#ifndef DM_REMAP_V4_SPARE_MIGRATE_H
+#define DM_REMAP_V4_SPARE_MIGRATE_H
+
+#include <linux/types.h>
+#include <linux/wait.h>
+
+struct block_device;
+struct dm_kcopyd_client;
+
+#define DM_REMAP_MIGRATE_CHUNK_SECTORS  1024  /* Copy and dirty-tracking unit (512KB) */
+#define DM_REMAP_MIGRATE_MAX_PASSES     8     /* Before quiescing regardless */
+#define DM_REMAP_MIGRATE_SWITCH_CHUNKS  16    /* Dirty chunks left to copy while quiesced */
+
+enum dm_remap_migrate_state {
+    DM_REMAP_MIGRATE_IDLE = 0,
+    DM_REMAP_MIGRATE_COPYING,        /* Copy passes, I/O continues */
+    DM_REMAP_MIGRATE_SWITCHING,      /* Spare I/O held, last pass and switch */
+    DM_REMAP_MIGRATE_DONE,
+    DM_REMAP_MIGRATE_FAILED,
+    DM_REMAP_MIGRATE_CANCELLED,
+};
+
+/**
+ * struct dm_remap_spare_migration - One copy from the old to the new spare
+ * @kc: kcopyd client
+ * @src: Old spare
+ * @dst: New spare
+ * @nr_sectors: Sectors covered by @dirty, from sector 0 of the spare
+ * @nr_chunks: Bits in @dirty
+ * @dirty: Chunks that still need to be copied (set and cleared atomically)
+ * @pending: Copies in flight in the current pass
+ * @wait: Woken when @pending drops to zero
+ * @error: First copy error of the current pass
+ * @copied_sectors: Sectors copied so far, over all passes
+ * @passes: Completed passes
+ */
+struct dm_remap_spare_migration {
+    struct dm_kcopyd_client *kc;
+    struct block_device *src;
+    struct block_device *dst;
+    sector_t nr_sectors;
+    unsigned long nr_chunks;
+    unsigned long *dirty;
+    atomic_t pending;
+    wait_queue_head_t wait;
+    int error;
+    atomic64_t copied_sectors;
+    unsigned int passes;
+};
+
+int dm_remap_migration_init(struct dm_remap_spare_migration *m, struct block_device *src,
+                            struct block_device *dst, sector_t nr_sectors);
+void dm_remap_migration_destroy(struct dm_remap_spare_migration *m);
+void dm_remap_migration_mark(struct dm_remap_spare_migration *m, sector_t sector,
+                             sector_t nr_sectors);
+unsigned long dm_remap_migration_dirty_chunks(struct dm_remap_spare_migration *m);
+int dm_remap_migration_copy_pass(struct dm_remap_spare_migration *m);
+const char *dm_remap_migrate_state_name(enum dm_remap_migrate_state state);
+
+#endif /* DM_REMAP_V4_SPARE_MIGRATE_H */
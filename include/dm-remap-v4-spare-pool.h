@@ -128,6 +128,8 @@ void spare_pool_exit(struct spare_pool *pool);
  */
 int spare_pool_add_device(struct spare_pool *pool, const char *dev_path);
 int spare_pool_remove_device(struct spare_pool *pool, const char *dev_path);
+int spare_pool_resize_device(struct spare_pool *pool, const char *dev_path,
+			     sector_t *old_sectors, sector_t *new_sectors);
 struct spare_device *spare_pool_get_device(struct spare_pool *pool, 
 					    const char *dev_path);
 void spare_pool_put_device(struct spare_device *spare);
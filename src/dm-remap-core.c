@@ -29,9 +29,26 @@
 #include <linux/dm-bufio.h>  /* Proper kernel API for metadata I/O */
 #include <linux/hash.h>  /* Kernel hashing utilities */
 #include <linux/prefetch.h>  /* CPU cache prefetching for optimization */
+#include <linux/rbtree.h>  /* Sorted remap index for range lookups */
+#include <linux/percpu.h>  /* Per-leg I/O counters */
+#include <linux/vmalloc.h>  /* Read salvage buffers */
+#include <linux/sort.h>  /* Rebuilding free spare space */
 
 #include "dm-remap-v4-compat.h"
 #include "../include/dm-remap-v4-stats.h"
+#include "../include/dm-remap-v4-policy.h"
+#include "../include/dm-remap-v4-events.h"
+#include "../include/dm-remap-v4-pipeline.h"
+#include "../include/dm-remap-v4-checksum.h"
+#include "../include/dm-remap-v4-shadow.h"
+#include "../include/dm-remap-v4-message.h"
+#include "../include/dm-remap-v4-spare-migrate.h"
+#include "../include/dm-remap-v4-flatten.h"
+#include "../include/dm-remap-v4-freelist.h"
+#include "../include/dm-remap-v4-compress.h"
+#include "../include/dm-remap-v4-forensic.h"
+#include "../include/dm-remap-v4-ioclass.h"
+#include "../include/dm-remap-v4-correlate.h"
 #include "../include/dm-remap-logging.h"
 #include "dm-remap-v4.h"  /* Shared v4 metadata structures */
 
@@ -68,6 +85,11 @@ static bool strict_spare_sizing = false;
 module_param(strict_spare_sizing, bool, 0644);
 MODULE_PARM_DESC(strict_spare_sizing, "Require spare >= main size (legacy mode, default off)");
 
+/* Atomic write handling (v4.3) */
+static bool atomic_write_staging = true;
+module_param(atomic_write_staging, bool, 0644);
+MODULE_PARM_DESC(atomic_write_staging, "Stage atomic writes that straddle remapped sectors through a new spare extent (default on, off = refuse with EOPNOTSUPP)");
+
 /* v4.0 Enterprise Metadata Structure - Enhanced */
 struct dm_remap_metadata_v4_real {
     /* Header */
@@ -128,6 +150,11 @@ struct dm_remap_metadata_v4_real {
 /* Remap entry flags */
 #define DM_REMAP_FLAG_PENDING    0x0001  /* Metadata not yet persisted - don't use for I/O */
 #define DM_REMAP_FLAG_ACTIVE     0x0002  /* Metadata persisted - safe to use */
+#define DM_REMAP_FLAG_ZERO       DM_REMAP_V4_REMAP_ZERO  /* Reads as zeros, no spare sector (v4.3) */
+#define DM_REMAP_FLAG_COMPRESSED DM_REMAP_V4_REMAP_COMPRESSED  /* In a compressed extent (v4.3) */
+/* Flags an entry keeps on disk, besides being ACTIVE */
+#define DM_REMAP_FLAG_STORED     (DM_REMAP_FLAG_ZERO | DM_REMAP_FLAG_COMPRESSED | \
+                                  DM_REMAP_V4_REMAP_CLEN_MASK)
 
 /* Remap entry structure for Phase 1.3 */
 struct dm_remap_entry_v4 {
@@ -138,6 +165,106 @@ struct dm_remap_entry_v4 {
     uint32_t flags;              /* Status flags (DM_REMAP_FLAG_*) */
     struct list_head list;       /* List linkage (for full iteration) */
     struct hlist_node hlist;     /* Hash list linkage (for fast lookup) */
+    struct rb_node rb_node;      /* Sorted index linkage (for range lookup) */
+};
+
+/* Spare sectors an entry holds: one, none for a zero remap, or the
+ * compressed extent that all the entries of its unit name */
+static inline sector_t dm_remap_entry_spare_len(u32 flags)
+{
+    if (flags & DM_REMAP_FLAG_ZERO)
+        return 0;
+    if (flags & DM_REMAP_FLAG_COMPRESSED)
+        return DM_REMAP_V4_REMAP_CLEN(flags);
+    return 1;
+}
+
+/* Per-bio context flags */
+#define DM_REMAP_IO_SPARE        0x0001  /* Bio was redirected to the spare device */
+#define DM_REMAP_IO_STAGED       0x0002  /* Atomic write staged through a new spare extent */
+#define DM_REMAP_IO_COMMITTED    0x0004  /* Staged extent switched in, completion resumed */
+#define DM_REMAP_IO_REFUSED      0x0008  /* Bio was completed by the target itself */
+#define DM_REMAP_IO_MAIN         0x0010  /* Data bio mapped to the main device, retryable */
+#define DM_REMAP_IO_ACCOUNTED    0x0020  /* In flight on ctx->leg since ctx->start_ns */
+#define DM_REMAP_IO_SALVAGED     0x0040  /* Failed read completed by the salvage work */
+#define DM_REMAP_IO_VERIFIED     0x0080  /* Write completed by the write-verify work */
+#define DM_REMAP_IO_CSUM         0x0100  /* Spare write completed by the checksum work */
+#define DM_REMAP_IO_COMPRESS     0x0200  /* Bio served by the compress work */
+#define DM_REMAP_IO_OVERLAY      0x0400  /* Bio served by the overlay work */
+#define DM_REMAP_IO_SPARE_GEN    0x0800  /* Counted in spare_inflight[1], else [0] */
+
+/*
+ * Per-bio context (v4.3), reserved through ti->per_io_data_size. Captures the
+ * bio as it was mapped, since bi_iter has been advanced by completion time.
+ */
+struct dm_remap_io_ctx {
+    sector_t orig_sector;        /* Target-relative first sector */
+    sector_t stage_sector;       /* Spare extent of a staged atomic write */
+    sector_t spare_sector;       /* First spare sector, if DM_REMAP_IO_SPARE */
+    unsigned int nr_sectors;     /* Length after any split at map time */
+    uint32_t flags;              /* DM_REMAP_IO_* */
+    struct list_head list;       /* Atomic commit or retry queue linkage */
+    struct bvec_iter iter;       /* Iterator as submitted, if DM_REMAP_IO_MAIN or _SPARE */
+    u8 retries;                  /* Resubmissions after a retried error */
+    u8 leg;                      /* enum dm_remap_leg, if DM_REMAP_IO_ACCOUNTED */
+    bool hung;                   /* Reported by the hung I/O watchdog */
+    int cpu;                     /* Whose in-flight list holds the bio */
+    u64 start_ns;                /* Submission to that leg, or when a work item held it */
+    struct list_head inflight;   /* dm_remap_leg_pcpu.inflight, oldest first */
+};
+
+/*
+ * Per-leg I/O accounting (v4.3). Each CPU counts what it submits and
+ * completes; in-flight counts are only meaningful summed over all CPUs.
+ * busy_ns adds up the time each I/O was outstanding, so its growth over
+ * wall time is the time-weighted average queue depth (Little's law).
+ * Data bios also sit on the submitting CPU's in-flight list until they
+ * complete, which is what the hung I/O watchdog walks.
+ */
+enum dm_remap_leg {
+    DM_REMAP_LEG_MAIN,           /* Data and flushes to the main device */
+    DM_REMAP_LEG_SPARE,          /* Data and flushes to the spare data area */
+    DM_REMAP_LEG_META,           /* Metadata copies the target waits for */
+    DM_REMAP_NR_LEGS,
+};
+
+static const char * const dm_remap_leg_names[DM_REMAP_NR_LEGS] = {
+    [DM_REMAP_LEG_MAIN]  = "main",
+    [DM_REMAP_LEG_SPARE] = "spare",
+    [DM_REMAP_LEG_META]  = "meta",
+};
+
+struct dm_remap_leg_counters {
+    u64 ios;                     /* Completed */
+    u64 bytes;
+    u64 busy_ns;                 /* Sum of submission-to-completion times */
+    long inflight;               /* Submitted minus completed on this CPU */
+};
+
+struct dm_remap_leg_pcpu {
+    struct dm_remap_leg_counters leg[DM_REMAP_NR_LEGS];
+    spinlock_t lock;             /* Protects inflight */
+    struct list_head inflight;   /* struct dm_remap_io_ctx, by start_ns */
+};
+
+/* Newly hung bios logged one by one per watchdog pass, the rest summed up */
+#define DM_REMAP_HUNG_REPORT_MAX 8
+
+/* Recent errors whose neighbourhood gets its writes verified, and for how long */
+#define DM_REMAP_VERIFY_REGIONS      8
+#define DM_REMAP_VERIFY_REGION_SECS  600
+
+/* How far spare data checksums are kept (tunables.data_checksums) */
+enum dm_remap_csum_state {
+    DM_REMAP_CSUM_OFF,           /* Nothing recorded or checked */
+    DM_REMAP_CSUM_TRACK,         /* Writes recorded, reads not checked yet */
+    DM_REMAP_CSUM_ON,            /* Writes recorded, reads checked */
+};
+
+static const char * const dm_remap_csum_state_names[] = {
+    [DM_REMAP_CSUM_OFF]   = "off",
+    [DM_REMAP_CSUM_TRACK] = "tracking",
+    [DM_REMAP_CSUM_ON]    = "on",
 };
 
 /* Phase 1.4: Health monitoring structures */
@@ -228,6 +355,11 @@ struct dm_remap_device_v4_real {
     char spare_path[256];
     blk_mode_t device_mode;
     
+    /* v4.3: Separate metadata device, NULL when the metadata is on the spare */
+    struct file *meta_dev;
+    char meta_path[256];
+    sector_t meta_offset;        /* First sector of this target's metadata area */
+    
     /* Device information */
     sector_t main_device_sectors;
     sector_t spare_device_sectors;
@@ -251,6 +383,10 @@ struct dm_remap_device_v4_real {
     uint32_t remap_count_active; /* Current active remaps */
     sector_t spare_sector_count; /* Available spare sectors */
     sector_t next_spare_sector;  /* Next available spare sector */
+    struct rb_root remap_tree;   /* Remaps sorted by original sector (v4.3) */
+    unsigned int block_sectors;  /* Logical block size in sectors (remap unit) */
+    struct dm_dev main_dm_dev;   /* iterate_devices view of main_dev */
+    struct dm_dev spare_dm_dev;  /* iterate_devices view of spare_dev */
     
     /* Background metadata sync - Phase 1.3 */
     struct workqueue_struct *metadata_workqueue; /* Background metadata sync */
@@ -264,6 +400,7 @@ struct dm_remap_device_v4_real {
     struct work_struct writeahead_remap_work; /* Write-ahead remap + metadata work */
     sector_t pending_remap_sector; /* Sector needing write-ahead remap */
     int pending_remap_error; /* Error code that triggered remap */
+    ktime_t pending_remap_time; /* When the error was seen (v4.3 pipeline timing) */
     
     /* v4.2.2 Kernel thread for metadata writes */
     struct task_struct *metadata_thread;        /* Dedicated kernel thread for metadata I/O */
@@ -275,6 +412,151 @@ struct dm_remap_device_v4_real {
     struct workqueue_struct *repair_wq; /* Dedicated workqueue for repair operations */
     struct dm_remap_repair_context repair_ctx; /* Automatic repair context */
     
+    /* v4.3 Atomic writes straddling remapped sectors */
+    struct delayed_work atomic_commit_work; /* Switches staged extents into the table */
+    struct list_head atomic_commit_list;   /* Staged bios waiting for commit (remap_lock) */
+    struct list_head atomic_held_list;     /* Switched bios whose commit failed (remap_lock) */
+    atomic64_t atomic_writes;              /* REQ_ATOMIC writes seen */
+    atomic64_t atomic_staged;              /* ... staged through a spare extent */
+    atomic64_t atomic_refused;             /* ... refused with BLK_STS_NOTSUPP */
+    atomic64_t split_ios;                  /* Bios split at a remap boundary */
+    
+    /* v4.3 Block integrity (T10 PI) passthrough */
+    bool integrity_enabled;                /* Both legs share one integrity profile */
+    atomic64_t integrity_ios;              /* Bios carrying protection information */
+    atomic64_t integrity_remapped;         /* ... redirected to the spare device */
+    atomic64_t integrity_errors;           /* Completions with BLK_STS_PROTECTION */
+    
+    /* v4.3 BPF remap policy (dm-remap-v4-policy.c) */
+    atomic64_t policy_retried;             /* Errors left on main (RETRY verdict) */
+    atomic64_t policy_ignored;             /* Errors dropped (IGNORE verdict) */
+    
+    /* v4.3 Error classification (tunables.error_action) */
+    atomic64_t error_class_count[DM_REMAP_NR_ERROR_CLASSES]; /* Failed bios, by class */
+    atomic64_t retries_issued;             /* Resubmissions of failed main bios */
+    atomic64_t retries_recovered;          /* Bios that succeeded after a retry */
+    atomic64_t retries_exhausted;          /* ... that still failed at retry_limit */
+    struct list_head retry_list;           /* Bios waiting for resubmission (remap_lock) */
+    struct delayed_work retry_work;
+    atomic_t inject_count;                 /* "inject_error": completions left to fail */
+    blk_status_t inject_status;            /* ... and the status they fail with */
+    
+    /* v4.3 Error correlation across targets (tunables.error_domain) */
+    struct dm_remap_correlate correlate;
+    atomic64_t correlated_errors;          /* Errors not remapped during a burst */
+    
+    /* v4.3 Read salvage (tunables.salvage_retries) */
+    atomic64_t salvage_transient;          /* Failed reads a re-read got back whole */
+    atomic64_t salvage_hard;               /* ... that kept failing and were remapped */
+    atomic64_t salvage_recovered_sectors;  /* Sectors of those read back unit by unit */
+    atomic64_t salvage_lost_sectors;       /* ... and those given up (zeroed on the spare) */
+    struct list_head salvage_list;         /* Failed reads to salvage (remap_lock) */
+    struct work_struct salvage_work;       /* On dm_remap_wq, does the re-reads */
+    struct list_head salvage_commit_list;  /* Salvaged ranges to remap (remap_lock) */
+    struct work_struct salvage_commit_work; /* On metadata_workqueue */
+    
+    /* v4.3 Write verification (tunables.write_verify) */
+    atomic64_t verify_writes;              /* Writes read back */
+    atomic64_t verify_failed;              /* ... that differed or could not be read */
+    atomic64_t verify_remapped;            /* Main device extents remapped for them */
+    atomic64_t verify_evacuated;           /* Spare writes moved to a new extent */
+    sector_t verify_region[DM_REMAP_VERIFY_REGIONS]; /* Recent error sectors */
+    u64 verify_region_ns[DM_REMAP_VERIFY_REGIONS];  /* ... when seen, 0 = empty slot */
+    unsigned int verify_region_next;       /* Next slot to overwrite (remap_lock) */
+    struct list_head verify_list;          /* Writes to read back (remap_lock) */
+    struct work_struct verify_work;        /* On dm_remap_wq */
+    struct list_head verify_fix_list;      /* Writes to remap or evacuate (remap_lock) */
+    struct work_struct verify_fix_work;    /* On metadata_workqueue */
+    
+    /* v4.3 Spare data checksums (tunables.data_checksums, dm-remap-v4-checksum.c) */
+    struct dm_remap_csum_table csum;       /* Records allocated when first turned on */
+    int csum_state;                        /* enum dm_remap_csum_state */
+    sector_t csum_area;                    /* Table on the spare, 0 until set up */
+    void *csum_buf;                        /* Table-sized buffer for writing it out */
+    struct mutex csum_mutex;               /* Serializes writing the table out */
+    struct list_head csum_list;            /* Spare writes waiting for their records (remap_lock) */
+    struct work_struct csum_work;          /* On dm_remap_wq */
+    struct work_struct csum_setup_work;    /* On metadata_workqueue */
+    
+    /* v4.3 Event stream and shadow policy */
+    struct dm_target *ti;                  /* For dm_table_event() */
+    struct dm_remap_event_log events;
+    struct dm_remap_shadow shadow;
+    atomic64_t active_remaps;              /* Error-driven remaps committed */
+    atomic64_t active_predictions;         /* Predictor score raises */
+    
+    /* v4.3 Remap pipeline timing (dm-remap-v4-pipeline.c) */
+    struct dm_remap_pipeline_stats pipeline;
+    
+    /* v4.3 Per-leg I/O accounting */
+    struct dm_remap_leg_pcpu __percpu *leg_stats;
+    u64 leg_stats_since;                   /* ktime_get_ns() at the last reset */
+    
+    /* v4.3 Hung I/O watchdog (tunables.hung_timeout) */
+    struct delayed_work hung_work;
+    atomic64_t hung_ios;                   /* Bios found outstanding past the timeout */
+    
+    /* v4.3 Per-device settings (table features, "set" message) */
+    struct dm_remap_tunables tunables;
+    struct mutex tunables_mutex;           /* Serializes changes to tunables */
+    
+    /* v4.3 Live spare replacement (dm-remap-v4-spare-migrate.c) */
+    atomic_t spare_inflight[2];            /* Bios on the spare leg not yet completed, per generation */
+    unsigned int spare_gen;                /* Generation new spare bios count in (remap_lock) */
+    wait_queue_head_t spare_wait;          /* Woken when a spare_inflight count drops to zero */
+    bool spare_quiesced;                   /* Hold new spare bios (remap_lock) */
+    struct bio_list spare_deferred;        /* ... held here until the switch (remap_lock) */
+    struct dm_remap_spare_migration *migration; /* Running replacement (remap_lock) */
+    struct work_struct spare_migrate_work;
+    struct file *new_spare_dev;            /* Device being copied to */
+    char new_spare_path[256];
+    sector_t migrate_saved_spare_count;    /* spare_sector_count before the copy */
+    bool migrate_cancel;
+    enum dm_remap_migrate_state migrate_state;
+    int migrate_error;
+    
+    /* v4.3 Flatten onto a replacement device (dm-remap-v4-flatten.c) */
+    struct dm_remap_flatten *flatten;      /* Running copy (remap_lock) */
+    struct delayed_work flatten_work;      /* On repair_wq */
+    struct file *flatten_dev;              /* Device being copied to */
+    char flatten_path[256];
+    unsigned int flatten_failures;         /* Work runs in a row with a copy error */
+    struct mutex flatten_mutex;            /* Serializes starting, stopping and the work */
+    bool flatten_cancel;
+    enum dm_remap_flatten_state flatten_state;
+    int flatten_error;
+    
+    /* v4.3 Zero remaps and free spare space (dm-remap-v4-freelist.c) */
+    struct dm_remap_freelist spare_free;      /* Reusable now (remap_lock) */
+    struct dm_remap_freelist spare_released;  /* Unused since the last metadata snapshot (remap_lock) */
+    struct dm_remap_freelist spare_committing; /* In a snapshot being written (remap_lock) */
+    atomic64_t zero_reads;                 /* Reads served from zero remaps */
+    atomic64_t zero_writes;                /* Zeroing writes to remaps, served without spare I/O */
+    atomic64_t zero_allocs;                /* Zero remaps that were given a spare sector again */
+    
+    /* v4.3 Compressed remapped data (tunables.compress, dm-remap-v4-compress.c) */
+    struct dm_remap_compress compress;
+    struct list_head compress_list;        /* Bios for the compress work (remap_lock) */
+    struct work_struct compress_work;      /* On metadata_workqueue */
+    atomic64_t compress_ios;               /* Bios it served */
+    atomic64_t compress_io_ns;             /* ... and their time from map to completion */
+    
+    /* v4.3 Read-only (forensic) activation (dm-remap-v4-forensic.c) */
+    bool read_only;                        /* Nothing is written to main, spare or metadata */
+    bool ro_feature;                       /* ... because the table says "mode ro" */
+    struct file *overlay_dev;              /* Writes go here, NULL to refuse them */
+    char overlay_path[256];
+    struct dm_remap_forensic forensic;     /* Read errors seen and the overlay map */
+    struct list_head overlay_list;         /* Bios for the overlay work (remap_lock) */
+    struct work_struct overlay_work;       /* On metadata_workqueue */
+    
+    /* v4.3 cgroups and I/O priorities of the target's own I/O */
+    struct dm_remap_ioclass ioclass;
+    
+    /* v4.3 Suspend/resume */
+    bool suspended;                        /* Between postsuspend and resume */
+    u64 suspend_generation;                /* Metadata sequence committed at postsuspend */
+    
     /* Statistics - Enhanced */
     atomic64_t read_count;
     atomic64_t write_count;
@@ -321,7 +603,6 @@ struct dm_remap_device_v4_real {
     ktime_t creation_time;
     
     /* Performance tracking */
-    ktime_t last_io_time;
     uint64_t peak_throughput;
 };
 
@@ -330,6 +611,9 @@ static LIST_HEAD(dm_remap_devices);
 static DEFINE_MUTEX(dm_remap_devices_mutex);
 static atomic_t dm_remap_device_count = ATOMIC_INIT(0);
 
+/* v4.3: Holder every target claims a shared metadata device with */
+static int dm_remap_metadata_holder;
+
 /* Global statistics */
 static atomic64_t global_reads = ATOMIC64_INIT(0);
 static atomic64_t global_writes = ATOMIC64_INIT(0);
@@ -345,6 +629,19 @@ static void dm_remap_analyze_error_pattern(struct dm_remap_device_v4_real *devic
 static void dm_remap_cache_insert(struct dm_remap_device_v4_real *device, sector_t original_sector, sector_t remapped_sector);
 static sector_t dm_remap_cache_lookup(struct dm_remap_device_v4_real *device, sector_t original_sector);
 static void dm_remap_update_io_pattern(struct dm_remap_device_v4_real *device, sector_t sector);
+static void dm_remap_request_metadata_write(struct dm_remap_device_v4_real *device);
+static int dm_remap_spare_io_sync(struct dm_remap_device_v4_real *device, blk_opf_t opf,
+                                  sector_t sector, void *data, unsigned int nr);
+static void dm_remap_verify_note_error(struct dm_remap_device_v4_real *device,
+                                       sector_t sector);
+static int dm_remap_csum_note(struct dm_remap_device_v4_real *device, sector_t sector,
+                              sector_t spare_sector, const void *data, unsigned int nr);
+static void dm_remap_flatten_note(struct dm_remap_device_v4_real *device, sector_t sector,
+                                  sector_t nr_sectors);
+static void dm_remap_flatten_load(struct dm_remap_device_v4_real *device);
+static int dm_remap_csum_flush(struct dm_remap_device_v4_real *device);
+static bool dm_remap_csum_placed(struct dm_remap_device_v4_real *device);
+static inline struct dm_remap_v4_csum_info *dm_remap_csum_info(struct dm_remap_device_v4_real *device);
 
 /**
  * dm_remap_calculate_crc32() - Calculate CRC32 for metadata validation
@@ -354,6 +651,161 @@ static uint32_t dm_remap_calculate_crc32(const void *data, size_t len)
     return crc32(0, data, len);
 }
 
+/**
+ * dm_remap_leg_start() - Count a bio in flight on one leg
+ * 
+ * v4.3: Must be called before the bio can be submitted, so its completion
+ * always finds DM_REMAP_IO_ACCOUNTED set. The bio goes on this CPU's
+ * in-flight list; start_ns is taken under its lock to keep the list sorted.
+ */
+static inline void dm_remap_leg_start(struct dm_remap_device_v4_real *device,
+                                      struct dm_remap_io_ctx *ctx, enum dm_remap_leg leg)
+{
+    struct dm_remap_leg_pcpu *pcpu;
+    unsigned long flags;
+    
+    ctx->leg = leg;
+    ctx->hung = false;
+    ctx->flags |= DM_REMAP_IO_ACCOUNTED;
+    
+    local_irq_save(flags);
+    pcpu = this_cpu_ptr(device->leg_stats);
+    ctx->cpu = smp_processor_id();
+    spin_lock(&pcpu->lock);
+    ctx->start_ns = ktime_get_ns();
+    list_add_tail(&ctx->inflight, &pcpu->inflight);
+    pcpu->leg[leg].inflight++;
+    spin_unlock(&pcpu->lock);
+    local_irq_restore(flags);
+}
+
+static inline void dm_remap_leg_done(struct dm_remap_device_v4_real *device,
+                                     enum dm_remap_leg leg, unsigned int nr,
+                                     u64 bytes, u64 ns)
+{
+    this_cpu_sub(device->leg_stats->leg[leg].inflight, nr);
+    this_cpu_add(device->leg_stats->leg[leg].ios, nr);
+    this_cpu_add(device->leg_stats->leg[leg].bytes, bytes);
+    this_cpu_add(device->leg_stats->leg[leg].busy_ns, ns * nr);
+}
+
+/**
+ * dm_remap_leg_end() - Complete a bio counted by dm_remap_leg_start()
+ * 
+ * Returns how long it was outstanding, 0 if it was not counted.
+ */
+static inline u64 dm_remap_leg_end(struct dm_remap_device_v4_real *device,
+                                   struct dm_remap_io_ctx *ctx)
+{
+    struct dm_remap_leg_pcpu *pcpu;
+    unsigned long flags;
+    bool hung;
+    u64 ns;
+    
+    if (!(ctx->flags & DM_REMAP_IO_ACCOUNTED))
+        return 0;
+    
+    ctx->flags &= ~DM_REMAP_IO_ACCOUNTED;
+    pcpu = per_cpu_ptr(device->leg_stats, ctx->cpu);
+    spin_lock_irqsave(&pcpu->lock, flags);
+    list_del(&ctx->inflight);
+    hung = ctx->hung;
+    spin_unlock_irqrestore(&pcpu->lock, flags);
+    
+    ns = ktime_get_ns() - ctx->start_ns;
+    dm_remap_leg_done(device, ctx->leg, 1, (u64)ctx->nr_sectors << SECTOR_SHIFT, ns);
+    if (unlikely(hung))
+        DMR_INFO("Hung I/O at sector %llu completed after %llu ms",
+                 (unsigned long long)ctx->orig_sector, ns / NSEC_PER_MSEC);
+    return ns;
+}
+
+/* Metadata goes through dm-bufio; its blocks are counted around the wait */
+static inline u64 dm_remap_meta_io_start(struct dm_remap_device_v4_real *device,
+                                         unsigned int nr)
+{
+    this_cpu_add(device->leg_stats->leg[DM_REMAP_LEG_META].inflight, nr);
+    return ktime_get_ns();
+}
+
+static inline void dm_remap_meta_io_end(struct dm_remap_device_v4_real *device,
+                                        unsigned int nr, u64 start_ns)
+{
+    dm_remap_leg_done(device, DM_REMAP_LEG_META, nr,
+                      (u64)nr * DM_REMAP_V4_METADATA_BLOCK_SIZE, ktime_get_ns() - start_ns);
+}
+
+static long dm_remap_leg_inflight(struct dm_remap_device_v4_real *device, enum dm_remap_leg leg)
+{
+    long inflight = 0;
+    int cpu;
+    
+    for_each_possible_cpu(cpu)
+        inflight += per_cpu_ptr(device->leg_stats, cpu)->leg[leg].inflight;
+    return max(inflight, 0L);
+}
+
+/* In-flight counts are left alone; they still have completions to come */
+static void dm_remap_leg_stats_reset(struct dm_remap_device_v4_real *device)
+{
+    struct dm_remap_leg_counters *c;
+    unsigned int leg;
+    int cpu;
+    
+    for_each_possible_cpu(cpu) {
+        for (leg = 0; leg < DM_REMAP_NR_LEGS; leg++) {
+            c = &per_cpu_ptr(device->leg_stats, cpu)->leg[leg];
+            c->ios = 0;
+            c->bytes = 0;
+            c->busy_ns = 0;
+        }
+    }
+    WRITE_ONCE(device->leg_stats_since, ktime_get_ns());
+}
+
+/**
+ * dm_remap_leg_stats_format() - Append the per-leg counters to a reply
+ * 
+ * " <leg>_inflight= _ios= _bytes= _lat_us= _qdepth= _kbps=" for each leg.
+ * Latency is the mean time outstanding; queue depth and throughput are
+ * averaged over the time since the last reset.
+ */
+static int dm_remap_leg_stats_format(struct dm_remap_device_v4_real *device,
+                                     char *buf, unsigned int len)
+{
+    u64 elapsed = ktime_get_ns() - READ_ONCE(device->leg_stats_since);
+    u64 elapsed_ms = max_t(u64, elapsed / NSEC_PER_MSEC, 1);
+    u64 ios, bytes, busy_ns, qdepth;
+    struct dm_remap_leg_counters *c;
+    unsigned int leg;
+    int cpu, n = 0;
+    
+    for (leg = 0; leg < DM_REMAP_NR_LEGS; leg++) {
+        ios = bytes = busy_ns = 0;
+        for_each_possible_cpu(cpu) {
+            c = &per_cpu_ptr(device->leg_stats, cpu)->leg[leg];
+            ios += READ_ONCE(c->ios);
+            bytes += READ_ONCE(c->bytes);
+            busy_ns += READ_ONCE(c->busy_ns);
+        }
+        qdepth = busy_ns / max_t(u64, elapsed / 100, 1);  /* x100 */
+        
+        n += scnprintf(buf + n, len - n,
+                       " %s_inflight=%ld %s_ios=%llu %s_bytes=%llu %s_lat_us=%llu "
+                       "%s_qdepth=%llu.%02llu %s_kbps=%llu",
+                       dm_remap_leg_names[leg], dm_remap_leg_inflight(device, leg),
+                       dm_remap_leg_names[leg], (unsigned long long)ios,
+                       dm_remap_leg_names[leg], (unsigned long long)bytes,
+                       dm_remap_leg_names[leg],
+                       (unsigned long long)(ios ? busy_ns / ios / NSEC_PER_USEC : 0),
+                       dm_remap_leg_names[leg], (unsigned long long)(qdepth / 100),
+                       (unsigned long long)(qdepth % 100),
+                       dm_remap_leg_names[leg],
+                       (unsigned long long)(bytes / elapsed_ms * 1000 / 1024));
+    }
+    return n;
+}
+
 /**
  * dm_remap_hash_key() - Generate hash key for sector
  * Phase 3 Hot Path Optimization: O(1) remap lookup using hash table
@@ -461,12 +913,202 @@ static struct dm_remap_entry_v4 *dm_remap_find_remap_entry(
     return dm_remap_find_remap_entry_fast(device, sector);
 }
 
+/**
+ * dm_remap_index_insert() - Link an entry into the list, hash table and tree
+ * 
+ * v4.3: Besides the hash table used for single-sector lookups, entries are
+ * kept in an rbtree sorted by original sector so that map can find the first
+ * remap inside a bio's range in O(log n). Caller holds remap_lock.
+ */
+static void dm_remap_index_insert(struct dm_remap_device_v4_real *device,
+                                  struct dm_remap_entry_v4 *entry)
+{
+    struct rb_node **link = &device->remap_tree.rb_node;
+    struct rb_node *parent = NULL;
+    struct dm_remap_entry_v4 *cur;
+    
+    list_add_tail(&entry->list, &device->remap_list);
+    
+    /* Phase 3: Also add to hash table for O(1) lookup */
+    if (device->remap_hash_table && device->remap_hash_size > 0) {
+        uint32_t hash_idx = dm_remap_hash_key(entry->original_sector, device->remap_hash_size);
+        hlist_add_head(&entry->hlist, &device->remap_hash_table[hash_idx]);
+    }
+    
+    while (*link) {
+        parent = *link;
+        cur = rb_entry(parent, struct dm_remap_entry_v4, rb_node);
+        if (entry->original_sector < cur->original_sector)
+            link = &parent->rb_left;
+        else
+            link = &parent->rb_right;
+    }
+    rb_link_node(&entry->rb_node, parent, link);
+    rb_insert_color(&entry->rb_node, &device->remap_tree);
+}
+
+/**
+ * dm_remap_index_remove() - Unlink an entry from all lookup structures
+ * Caller holds remap_lock.
+ */
+static void dm_remap_index_remove(struct dm_remap_device_v4_real *device,
+                                  struct dm_remap_entry_v4 *entry)
+{
+    list_del(&entry->list);
+    if (entry->hlist.pprev)
+        hlist_del(&entry->hlist);
+    rb_erase(&entry->rb_node, &device->remap_tree);
+}
+
+/**
+ * dm_remap_index_ceil() - First entry (PENDING or not) at or after @sector
+ * Caller holds remap_lock.
+ */
+static struct dm_remap_entry_v4 *dm_remap_index_ceil(
+    struct dm_remap_device_v4_real *device, sector_t sector)
+{
+    struct rb_node *node = device->remap_tree.rb_node;
+    struct dm_remap_entry_v4 *entry, *found = NULL;
+    
+    while (node) {
+        entry = rb_entry(node, struct dm_remap_entry_v4, rb_node);
+        if (entry->original_sector >= sector) {
+            found = entry;
+            node = node->rb_left;
+        } else {
+            node = node->rb_right;
+        }
+    }
+    
+    return found;
+}
+
+static inline struct dm_remap_entry_v4 *dm_remap_index_next(struct dm_remap_entry_v4 *entry)
+{
+    struct rb_node *node = rb_next(&entry->rb_node);
+    
+    return node ? rb_entry(node, struct dm_remap_entry_v4, rb_node) : NULL;
+}
+
+/**
+ * dm_remap_lookup_run() - Find how far an I/O stays on a single leg
+ * @device: Target device
+ * @sector: First sector of the I/O
+ * @nr_sectors: Length of the I/O
+ * @spare_sector: Set to the spare location when @sector is remapped
+ * @remapped: Set when @sector is served by the spare device
+ * @compressed: Set when the run is part of one compressed unit
+ * 
+ * Returns the number of sectors from @sector that can be issued as one bio:
+ * either a run of ACTIVE remaps with consecutive spare sectors, or healthy
+ * main device sectors up to the next remap. PENDING remaps count as healthy.
+ * v4.3: A run of zero remaps is reported remapped with @spare_sector 0. A
+ * compressed run never leaves its unit; @spare_sector is then the start of
+ * the unit's extent. Caller holds remap_lock.
+ */
+static sector_t dm_remap_lookup_run(struct dm_remap_device_v4_real *device,
+                                    sector_t sector, sector_t nr_sectors,
+                                    sector_t *spare_sector, bool *remapped,
+                                    bool *compressed)
+{
+    struct dm_remap_entry_v4 *entry, *next;
+    sector_t run;
+    u32 kind;
+    
+    *remapped = false;
+    *compressed = false;
+    
+    entry = dm_remap_index_ceil(device, sector);
+    while (entry && (entry->flags & DM_REMAP_FLAG_PENDING))
+        entry = dm_remap_index_next(entry);
+    
+    if (!entry || entry->original_sector >= sector + nr_sectors)
+        return nr_sectors;  /* Whole range is on the main device */
+    if (entry->original_sector > sector)
+        return entry->original_sector - sector;  /* Main up to next remap */
+    
+    *remapped = true;
+    *spare_sector = entry->spare_sector;
+    kind = entry->flags & (DM_REMAP_FLAG_ZERO | DM_REMAP_FLAG_COMPRESSED);
+    *compressed = kind & DM_REMAP_FLAG_COMPRESSED;
+    for (run = 1; run < nr_sectors; run++) {
+        next = dm_remap_index_next(entry);
+        if (!next || next->original_sector != sector + run ||
+            (next->flags & DM_REMAP_FLAG_PENDING) ||
+            (next->flags & (DM_REMAP_FLAG_ZERO | DM_REMAP_FLAG_COMPRESSED)) != kind ||
+            (!kind && next->spare_sector != *spare_sector + run) ||
+            (*compressed && next->spare_sector != *spare_sector))
+            break;
+        entry = next;
+    }
+    
+    return run;
+}
+
+/**
+ * dm_remap_alloc_spare_extent() - Reserve contiguous sectors on the spare
+ * @device: Target device
+ * @nr_sectors: Extent length
+ * @align: Required alignment of the extent start (power of two)
+ * @hint: Preferred start from the remap policy, 0 for none
+ * @spare_sector: Set to the first sector of the extent
+ * 
+ * Remapped data lives after the redundant metadata copies. A placement hint
+ * can only move the allocator forward, never into space already handed out;
+ * one that does not fit is ignored. v4.3: Without a usable hint, space that
+ * no persisted remap uses any more (device->spare_free) is taken before the
+ * spare is used further. Caller holds remap_lock. Returns 0 or -ENOSPC.
+ */
+static int dm_remap_alloc_spare_extent(struct dm_remap_device_v4_real *device,
+                                       sector_t nr_sectors, sector_t align,
+                                       sector_t hint, sector_t *spare_sector)
+{
+    sector_t start = ALIGN(max_t(sector_t, device->next_spare_sector,
+                                 DM_REMAP_V4_SPARE_DATA_START), align);
+    
+    if (hint > start && IS_ALIGNED(hint, align) &&
+        hint + nr_sectors <= device->spare_sector_count)
+        start = hint;
+    else if (dm_remap_freelist_take(&device->spare_free, nr_sectors, align, spare_sector))
+        return 0;
+    
+    if (start + nr_sectors > device->spare_sector_count)
+        return -ENOSPC;
+    
+    *spare_sector = start;
+    device->next_spare_sector = start + nr_sectors;
+    return 0;
+}
+
+/**
+ * dm_remap_policy_dev() - Identify a target to the remap policy
+ * 
+ * Policies see the main device's dev_t; 0 in demo mode.
+ */
+static inline u32 dm_remap_policy_dev(struct dm_remap_device_v4_real *device)
+{
+    return device->main_dev ? file_bdev(device->main_dev)->bd_dev : 0;
+}
+
+/**
+ * dm_remap_remap_granularity() - Sectors remapped per error unless a policy widens it
+ * 
+ * v4.3: The per-device remap_granularity setting, never less than one
+ * logical block.
+ */
+static inline unsigned int dm_remap_remap_granularity(struct dm_remap_device_v4_real *device)
+{
+    return max_t(unsigned int, device->block_sectors,
+                 READ_ONCE(device->tunables.remap_granularity));
+}
+
 /**
  * dm_remap_sync_persistent_metadata() - Sync in-memory remaps to persistent metadata
  */
 static void dm_remap_sync_persistent_metadata(struct dm_remap_device_v4_real *device)
 {
     struct dm_remap_entry_v4 *entry;
+    unsigned long flags;
     int i = 0;
     
     if (!device->persistent_metadata)
@@ -475,6 +1117,7 @@ static void dm_remap_sync_persistent_metadata(struct dm_remap_device_v4_real *de
     /* Update remap table in persistent metadata */
     device->persistent_metadata->remap_data.active_remaps = 0;
     
+    spin_lock_irqsave(&device->remap_lock, flags);
     list_for_each_entry(entry, &device->remap_list, list) {
         if (i >= DM_REMAP_V4_MAX_REMAPS) {
             DMR_WARN("Remap count exceeds maximum, truncating");
@@ -489,10 +1132,111 @@ static void dm_remap_sync_persistent_metadata(struct dm_remap_device_v4_real *de
         
         i++;
     }
+    device->persistent_metadata->remap_data.next_spare_sector =
+        min_t(sector_t, device->next_spare_sector, U32_MAX);
+    /* v4.3: Space released so far is unused by this snapshot */
+    dm_remap_freelist_splice(&device->spare_committing, &device->spare_released);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
     
     device->persistent_metadata->remap_data.active_remaps = i;
     device->persistent_metadata->header.sequence_number++;
-    device->persistent_metadata->header.timestamp = ktime_to_ns(ktime_get_real());
+    device->persistent_metadata->header.timestamp = ktime_get_real_seconds();  /* Validated in seconds */
+}
+
+/*
+ * Every metadata generation goes out as DM_REMAP_V4_REDUNDANT_COPIES whole
+ * dm-bufio blocks, whatever the size of the remap table in it.
+ */
+#define DM_REMAP_METADATA_WRITE_BYTES \
+    ((u64)DM_REMAP_V4_REDUNDANT_COPIES * DM_REMAP_V4_METADATA_BLOCK_SIZE)
+
+static void dm_remap_spare_drain(struct dm_remap_device_v4_real *device);
+
+/**
+ * dm_remap_spare_committed() - A snapshot reached the disk
+ * 
+ * v4.3: Spare space released before it was taken may be written again: no
+ * metadata copy on disk that could be loaded points at it any more, and
+ * the bios sent to it before it was released have completed.
+ * Caller holds metadata_mutex. Process context only.
+ */
+static void dm_remap_spare_committed(struct dm_remap_device_v4_real *device)
+{
+    unsigned long flags;
+    
+    if (!READ_ONCE(device->spare_committing.sectors))
+        return;
+    
+    dm_remap_spare_drain(device);
+    spin_lock_irqsave(&device->remap_lock, flags);
+    dm_remap_freelist_splice(&device->spare_free, &device->spare_committing);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+}
+
+/**
+ * dm_remap_commit_metadata_timed() - Synchronously persist the remap table
+ * @device: Target device
+ * @timed: Record the serialize and write stages in the pipeline histograms
+ * 
+ * v4.3: The metadata thread only dirties dm-bufio buffers. This writes all
+ * copies and flushes the spare device before returning, so the caller may
+ * rely on the new table surviving a crash. Process context only.
+ * 
+ * dm_bufio_write_dirty_buffers() waits for the copies and issues the flush
+ * itself, so the two are timed as one "write" stage.
+ */
+static int dm_remap_commit_metadata_timed(struct dm_remap_device_v4_real *device, bool timed)
+{
+    ktime_t start, serialized;
+    int ret;
+    
+    if (!device->metadata_bufio_client || !device->persistent_metadata)
+        return -EINVAL;
+    if (device->read_only)
+        return -EROFS;
+    
+    mutex_lock(&device->metadata_mutex);
+    
+    start = ktime_get();
+    device->metadata.last_update = ktime_to_ns(ktime_get_real());
+    device->metadata.sequence_number++;
+    device->metadata.metadata_crc = 0;
+    device->metadata.metadata_crc = dm_remap_calculate_crc32(&device->metadata,
+                                                             sizeof(device->metadata));
+    
+    dm_remap_sync_persistent_metadata(device);
+    
+    ret = dm_remap_write_metadata_v4_async(device->metadata_bufio_client,
+                                           device->persistent_metadata, NULL);
+    serialized = ktime_get();
+    if (!ret) {
+        u64 io_start = dm_remap_meta_io_start(device, DM_REMAP_V4_REDUNDANT_COPIES);
+        
+        ret = dm_bufio_write_dirty_buffers(device->metadata_bufio_client);
+        dm_remap_meta_io_end(device, DM_REMAP_V4_REDUNDANT_COPIES, io_start);
+        dm_remap_pipeline_metadata_write(&device->pipeline, DM_REMAP_METADATA_WRITE_BYTES);
+    }
+    if (ret) {
+        DMR_ERROR("Metadata commit failed: %d", ret);
+    } else {
+        device->metadata_dirty = false;
+        dm_remap_spare_committed(device);
+        if (timed) {
+            dm_remap_pipeline_record(&device->pipeline, DM_REMAP_PIPE_SERIALIZE,
+                                     ktime_to_ns(ktime_sub(serialized, start)));
+            dm_remap_pipeline_record(&device->pipeline, DM_REMAP_PIPE_WRITE,
+                                     ktime_to_ns(ktime_sub(ktime_get(), serialized)));
+        }
+    }
+    
+    mutex_unlock(&device->metadata_mutex);
+    
+    return ret;
+}
+
+static int dm_remap_commit_metadata(struct dm_remap_device_v4_real *device)
+{
+    return dm_remap_commit_metadata_timed(device, false);
 }
 /**
  * dm_remap_init_persistent_metadata() - Initialize persistent v4 metadata
@@ -517,36 +1261,103 @@ static int dm_remap_init_persistent_metadata(struct dm_remap_device_v4_real *dev
     return 0;
 }
 
+static int dm_remap_cmp_extent(const void *a, const void *b)
+{
+    sector_t x = ((const struct dm_remap_free_extent *)a)->start;
+    sector_t y = ((const struct dm_remap_free_extent *)b)->start;
+    
+    return x < y ? -1 : x > y;
+}
+
 /**
- * dm_remap_read_persistent_metadata() - Read and restore metadata from spare device
+ * dm_remap_rebuild_spare_free() - Recover free spare space from the index
+ * 
+ * v4.3: Free extents are not persisted. Whatever part of the spare data area
+ * below the allocator's mark no remap and no checksum table uses is free.
+ * Runs once the index is restored, before any I/O. Without memory for it
+ * the space stays unused until the next load. Compressed extents, named
+ * by every entry of their unit, are counted once per entry.
  */
-static int dm_remap_read_persistent_metadata(struct dm_remap_device_v4_real *device)
+static void dm_remap_rebuild_spare_free(struct dm_remap_device_v4_real *device)
 {
     struct dm_remap_entry_v4 *entry;
-    int ret, i;
-    
-    if (!device->persistent_metadata || !device->metadata_bufio_client)
-        return -EINVAL;
-    
-    DMR_INFO("Reading persistent metadata using dm-bufio...");
-    
-    /* Read from spare device using dm-bufio (safe from any context) */
-    ret = dm_remap_read_metadata_v4_bufio_with_repair(device->metadata_bufio_client,
-                                                      device->persistent_metadata,
-                                                      &device->repair_ctx);
-    if (ret) {
-        DMR_INFO("No valid metadata found, starting fresh: %d", ret);
-        return -ENODATA;  /* Return error code so caller knows no metadata was found */
+    struct dm_remap_free_extent *used;
+    sector_t pos = DM_REMAP_V4_SPARE_DATA_START;
+    unsigned int nr = 0, max_used, i;
+    unsigned long flags;
+    
+    max_used = max_t(unsigned int, device->remap_count_active, 1);
+    used = kvmalloc_array(max_used, sizeof(*used), GFP_KERNEL);
+    if (!used) {
+        DMR_WARN("No memory to rebuild free spare space");
+        return;
     }
     
-    DMR_INFO("Read persistent metadata with %u remaps",
-             device->persistent_metadata->remap_data.active_remaps);
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_for_each_entry(entry, &device->remap_list, list) {
+        if (nr < max_used && dm_remap_entry_spare_len(entry->flags)) {
+            used[nr].start = entry->spare_sector;
+            used[nr++].nr = dm_remap_entry_spare_len(entry->flags);
+        }
+    }
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    sort(used, nr, sizeof(*used), dm_remap_cmp_extent, NULL);
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    dm_remap_freelist_reset(&device->spare_free);
+    dm_remap_freelist_reset(&device->spare_released);
+    dm_remap_freelist_reset(&device->spare_committing);
+    for (i = 0; i < nr; i++) {
+        if (used[i].start > pos)
+            dm_remap_freelist_add(&device->spare_free, pos, used[i].start - pos);
+        pos = max(pos, used[i].start + used[i].nr);
+    }
+    if (device->next_spare_sector > pos)
+        dm_remap_freelist_add(&device->spare_free, pos, device->next_spare_sector - pos);
+    if (dm_remap_csum_placed(device))
+        dm_remap_freelist_claim(&device->spare_free, dm_remap_csum_info(device)->area_sector,
+                                DM_REMAP_V4_CSUM_AREA_SECTORS);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    kvfree(used);
+}
+
+/**
+ * dm_remap_restore_remaps() - Build the in-memory index from persistent_metadata
+ * 
+ * v4.3: Split out of dm_remap_read_persistent_metadata() so a resume can
+ * rebuild the index from a table committed while the device was suspended.
+ * The index is expected to be empty.
+ */
+static int dm_remap_restore_remaps(struct dm_remap_device_v4_real *device)
+{
+    struct dm_remap_entry_v4 *entry;
+    unsigned long flags;
+    sector_t len;
+    u32 stored;
+    int i;
     
     /* Restore remap entries to in-memory list */
     for (i = 0; i < device->persistent_metadata->remap_data.active_remaps; i++) {
         if (i >= DM_REMAP_V4_MAX_REMAPS)
             break;
         
+        stored = device->persistent_metadata->remap_data.remaps[i].flags & DM_REMAP_FLAG_STORED;
+        len = dm_remap_entry_spare_len(stored);
+        
+        /* v4.3: The copy validated against the sizes it recorded; the
+         * devices it is now assembled from may be smaller */
+        if (device->persistent_metadata->remap_data.remaps[i].original_sector >=
+                device->main_device_sectors ||
+            (len && device->persistent_metadata->remap_data.remaps[i].spare_sector + len >
+                device->spare_sector_count)) {
+            DMR_WARN("Skipping remap %d: sector %llu -> %llu outside devices", i,
+                     (unsigned long long)device->persistent_metadata->remap_data.remaps[i].original_sector,
+                     (unsigned long long)device->persistent_metadata->remap_data.remaps[i].spare_sector);
+            continue;
+        }
+        
         entry = kzalloc(sizeof(*entry), GFP_KERNEL);
         if (!entry) {
             DMR_ERROR("Failed to allocate remap entry during restore");
@@ -558,63 +1369,192 @@ static int dm_remap_read_persistent_metadata(struct dm_remap_device_v4_real *dev
         entry->remap_time = device->persistent_metadata->remap_data.remaps[i].remap_timestamp;
         entry->error_count = device->persistent_metadata->remap_data.remaps[i].error_count;
         /* v4.2: Restored remaps are ACTIVE (already persisted to disk) */
-        entry->flags = DM_REMAP_FLAG_ACTIVE;
-        
-        spin_lock(&device->remap_lock);
-        list_add_tail(&entry->list, &device->remap_list);
-        
-        /* Phase 3: Also add to hash table for O(1) lookup */
-        if (device->remap_hash_table && device->remap_hash_size > 0) {
-            uint32_t hash_idx = dm_remap_hash_key(entry->original_sector, device->remap_hash_size);
-            hlist_add_head(&entry->hlist, &device->remap_hash_table[hash_idx]);
-        }
+        entry->flags = DM_REMAP_FLAG_ACTIVE | stored;
         
+        spin_lock_irqsave(&device->remap_lock, flags);
+        dm_remap_index_insert(device, entry);
         device->remap_count_active++;
-        spin_unlock(&device->remap_lock);
+        
+        /* v4.3: Never hand out a spare sector that is already in use */
+        if (len)
+            device->next_spare_sector = max_t(sector_t, device->next_spare_sector,
+                                              entry->spare_sector + len);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
         
         DMR_INFO("Restored remap: sector %llu -> %llu",
                  (unsigned long long)entry->original_sector,
                  (unsigned long long)entry->spare_sector);
     }
     
+    spin_lock_irqsave(&device->remap_lock, flags);
+    device->next_spare_sector = max_t(sector_t, device->next_spare_sector,
+                                      device->persistent_metadata->remap_data.next_spare_sector);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
     DMR_INFO("Restored %u remap entries from persistent metadata", i);
     
     /* Update global sysfs stats counter */
     dm_remap_stats_set_active_mappings(device->remap_count_active);
     
+    dm_remap_rebuild_spare_free(device);
     return 0;
 }
 
 /**
- * dm_remap_check_resize_hash_table() - Dynamically resize hash table based on load factor
- * UNLIMITED DYNAMIC HASH TABLE SIZING (Phase 3 - v4.2.2):
- * 
- * Resizes hash table dynamically to maintain O(1) performance at ANY scale.
- * Growth strategy: Doubles bucket count when load factor exceeds 1.5
- * Shrinks when load factor drops below 0.5 (only if size > 64)
- * 
- * Load factor = remaps / hash_table_size
- * Target: Keep load factor between 0.5 and 1.5 for optimal performance
+ * dm_remap_remaps_beyond() - Count table entries at or past @end
+ */
+static unsigned int dm_remap_remaps_beyond(struct dm_remap_device_v4_real *device,
+                                           sector_t end)
+{
+    unsigned int i, n = 0;
+    
+    for (i = 0; i < device->persistent_metadata->remap_data.active_remaps &&
+                i < DM_REMAP_V4_MAX_REMAPS; i++) {
+        if (device->persistent_metadata->remap_data.remaps[i].original_sector >= end)
+            n++;
+    }
+    return n;
+}
+
+/**
+ * dm_remap_import_spare_metadata() - Move metadata from the spare to the metadata device
  * 
- * Called after incrementing remap_count_active
+ * v4.3: The first time a target is given a metadata device, its metadata
+ * is still on the spare. It is committed to the metadata device and only
+ * then wiped from the spare, so a table without the metadata device cannot
+ * later pick up a stale remap table there. Returns -ENODATA if the spare
+ * has none, -EIO if it has but it could not be moved. A read-only target
+ * only reads it.
  */
-static void dm_remap_check_resize_hash_table(struct dm_remap_device_v4_real *device)
+static int dm_remap_import_spare_metadata(struct dm_remap_device_v4_real *device)
 {
-    struct hlist_head *new_table;
-    struct dm_remap_entry_v4 *entry;
-    uint32_t old_size, new_size, hash_idx;
-    uint32_t load_scaled;  /* Load factor * 100 for integer math */
+    struct dm_bufio_client *client;
+    struct dm_buffer *buffer;
+    void *data;
+    int i, ret;
+    
+    client = dm_bufio_client_create(file_bdev(device->spare_dev), DM_REMAP_V4_METADATA_BLOCK_SIZE,
+                                    1, 0, NULL, NULL, 0);
+    if (IS_ERR(client))
+        return -EIO;
     
-    if (!device->remap_hash_table || device->remap_hash_size == 0) {
-        return; /* Hash table not initialized */
+    ret = dm_remap_read_metadata_v4_bufio(client, device->persistent_metadata);
+    if (ret)
+        goto out;
+    if (device->read_only) {
+        DMR_INFO("Using the metadata on %s, %s has none", device->spare_path, device->meta_path);
+        goto out;
     }
     
-    /* Calculate current load factor using integer math (scaled by 100) */
-    /* load_factor * 100 = (remaps * 100) / hash_size */
-    load_scaled = (device->remap_count_active * 100) / device->remap_hash_size;
+    ret = dm_remap_write_metadata_v4_sync(device->metadata_bufio_client,
+                                          device->persistent_metadata);
+    if (ret) {
+        DMR_ERROR("Failed to move metadata from %s to %s: %d", device->spare_path,
+                  device->meta_path, ret);
+        ret = -EIO;
+        goto out;
+    }
     
-    /* Determine if resize is needed - Grow on high load factor (>1.5) */
-    if (load_scaled > 150) {
+    for (i = 0; i < DM_REMAP_V4_REDUNDANT_COPIES; i++) {
+        data = dm_bufio_new(client, i, &buffer);
+        if (IS_ERR(data))
+            break;
+        memset(data, 0, DM_REMAP_V4_METADATA_BLOCK_SIZE);
+        dm_bufio_mark_buffer_dirty(buffer);
+        dm_bufio_release(buffer);
+    }
+    if (i < DM_REMAP_V4_REDUNDANT_COPIES || dm_bufio_write_dirty_buffers(client))
+        DMR_WARN("Metadata moved to %s, but the old copies on %s were not cleared",
+                 device->meta_path, device->spare_path);
+    else
+        DMR_INFO("Metadata moved from %s to %s", device->spare_path, device->meta_path);
+out:
+    dm_bufio_client_destroy(client);
+    return ret;
+}
+
+/**
+ * dm_remap_read_persistent_metadata() - Read and restore metadata from spare device
+ * 
+ * v4.3: ... or from the metadata device, picking up what an earlier table
+ * left on the spare if it has none yet.
+ */
+static int dm_remap_read_persistent_metadata(struct dm_remap_device_v4_real *device)
+{
+    int ret;
+    
+    if (!device->persistent_metadata || !device->metadata_bufio_client)
+        return -EINVAL;
+    
+    DMR_INFO("Reading persistent metadata using dm-bufio...");
+    
+    /* Read from spare device using dm-bufio (safe from any context);
+     * v4.3: a read-only target leaves bad copies as they are */
+    ret = dm_remap_read_metadata_v4_bufio_with_repair(device->metadata_bufio_client,
+                                                      device->persistent_metadata,
+                                                      device->read_only ? NULL :
+                                                                          &device->repair_ctx);
+    if (ret && device->meta_dev) {
+        ret = dm_remap_import_spare_metadata(device);
+        if (ret == -EIO)
+            return ret;
+    }
+    if (ret) {
+        DMR_INFO("No valid metadata found, starting fresh: %d", ret);
+        return -ENODATA;  /* Return error code so caller knows no metadata was found */
+    }
+    
+    DMR_INFO("Read persistent metadata with %u remaps",
+             device->persistent_metadata->remap_data.active_remaps);
+    
+    /* v4.3: Restoring skips remaps beyond a shortened table; unless told to
+     * drop them, refuse before anything is lost (nothing is, read-only) */
+    if (READ_ONCE(device->tunables.shrink_policy) == DM_REMAP_SHRINK_REFUSE &&
+        !device->read_only) {
+        unsigned int beyond = dm_remap_remaps_beyond(device, device->main_device_sectors);
+        
+        if (beyond) {
+            DMR_ERROR("%u remaps lie beyond the new end at sector %llu "
+                      "(shrink_policy drop discards them)",
+                      beyond, (unsigned long long)device->main_device_sectors);
+            return -EBUSY;
+        }
+    }
+    
+    return dm_remap_restore_remaps(device);
+}
+
+/**
+ * dm_remap_check_resize_hash_table() - Dynamically resize hash table based on load factor
+ * UNLIMITED DYNAMIC HASH TABLE SIZING (Phase 3 - v4.2.2):
+ * 
+ * Resizes hash table dynamically to maintain O(1) performance at ANY scale.
+ * Growth strategy: Doubles bucket count when load factor exceeds 1.5
+ * Shrinks when load factor drops below 0.5 (only if size > 64)
+ * 
+ * Load factor = remaps / hash_table_size
+ * Target: Keep load factor between 0.5 and 1.5 for optimal performance
+ * 
+ * Called after incrementing remap_count_active
+ */
+static void dm_remap_check_resize_hash_table(struct dm_remap_device_v4_real *device)
+{
+    struct hlist_head *new_table, *old_table;
+    struct dm_remap_entry_v4 *entry;
+    unsigned long flags;
+    uint32_t old_size, new_size, hash_idx;
+    uint32_t load_scaled;  /* Load factor * 100 for integer math */
+    
+    if (!device->remap_hash_table || device->remap_hash_size == 0) {
+        return; /* Hash table not initialized */
+    }
+    
+    /* Calculate current load factor using integer math (scaled by 100) */
+    /* load_factor * 100 = (remaps * 100) / hash_size */
+    load_scaled = (device->remap_count_active * 100) / device->remap_hash_size;
+    
+    /* Determine if resize is needed - Grow on high load factor (>1.5) */
+    if (load_scaled > 150) {
         /* Double the bucket count (exponential growth) */
         new_size = device->remap_hash_size * 2;
     } else if (load_scaled < 50 && device->remap_hash_size > 64) {
@@ -635,6 +1575,7 @@ static void dm_remap_check_resize_hash_table(struct dm_remap_device_v4_real *dev
         return;
     }
     
+    spin_lock_irqsave(&device->remap_lock, flags);
     old_size = device->remap_hash_size;
     
     /* Rehash all entries into new table */
@@ -651,9 +1592,11 @@ static void dm_remap_check_resize_hash_table(struct dm_remap_device_v4_real *dev
     }
     
     /* Swap tables and free old one */
-    kfree(device->remap_hash_table);
+    old_table = device->remap_hash_table;
     device->remap_hash_table = new_table;
     device->remap_hash_size = new_size;
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    kfree(old_table);
     
     DMR_INFO("Dynamic hash table resize: %u -> %u buckets (load_scaled=%u%%, remaps=%u)",
              old_size, new_size, load_scaled, device->remap_count_active);
@@ -667,6 +1610,7 @@ static int dm_remap_add_remap_entry(struct dm_remap_device_v4_real *device,
                                    sector_t spare_sector)
 {
     struct dm_remap_entry_v4 *entry;
+    unsigned long flags;
     
     /* Check if entry already exists */
     entry = dm_remap_find_remap_entry(device, original_sector);
@@ -689,19 +1633,12 @@ static int dm_remap_add_remap_entry(struct dm_remap_device_v4_real *device,
     entry->error_count = 1;
     entry->flags = DM_REMAP_FLAG_PENDING;  /* Not usable until metadata persisted */
     
-    /* Add to remap list */
-    spin_lock(&device->remap_lock);
-    list_add_tail(&entry->list, &device->remap_list);
-    
-    /* Phase 3: Also add to hash table for O(1) lookup */
-    if (device->remap_hash_table && device->remap_hash_size > 0) {
-        uint32_t hash_idx = dm_remap_hash_key(original_sector, device->remap_hash_size);
-        hlist_add_head(&entry->hlist, &device->remap_hash_table[hash_idx]);
-    }
-    
+    /* Add to remap list, hash table and sorted index */
+    spin_lock_irqsave(&device->remap_lock, flags);
+    dm_remap_index_insert(device, entry);
     device->remap_count_active++;
     device->metadata.active_mappings++;
-    spin_unlock(&device->remap_lock);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
     
     /* Check if hash table needs to be resized (adaptive sizing) */
     dm_remap_check_resize_hash_table(device);
@@ -721,147 +1658,541 @@ static int dm_remap_add_remap_entry(struct dm_remap_device_v4_real *device,
 }
 
 /**
- * dm_remap_writeahead_remap_work() - Write-ahead remap creation with metadata persistence
+ * dm_remap_drop_pending_range() - Forget PENDING entries that never got persisted
+ * Caller holds remap_lock.
+ */
+static void dm_remap_drop_pending_range(struct dm_remap_device_v4_real *device,
+                                        sector_t sector, sector_t nr_sectors)
+{
+    struct dm_remap_entry_v4 *entry, *next;
+    
+    for (entry = dm_remap_index_ceil(device, sector);
+         entry && entry->original_sector < sector + nr_sectors; entry = next) {
+        next = dm_remap_index_next(entry);
+        if (!(entry->flags & DM_REMAP_FLAG_PENDING))
+            continue;
+        dm_remap_index_remove(device, entry);
+        device->remap_count_active--;
+        device->metadata.active_mappings--;
+        kfree(entry);
+    }
+}
+
+/**
+ * dm_remap_remap_extent() - Range remapped for an error on @sector
  * 
- * v4.2 Data Safety: This workqueue handler ensures metadata is written BEFORE
- * allowing user I/O to succeed. Prevents data loss window where remap exists
- * in memory but not on disk.
+ * v4.3: The whole logical block containing the failed sector, or the
+ * larger aligned chunk an attached remap policy asks for. Falls back to one
+ * logical block near the end of the device or of the remap table.
+ */
+static unsigned int dm_remap_remap_extent(struct dm_remap_device_v4_real *device,
+                                          sector_t sector, sector_t *block_start)
+{
+    unsigned int nr;
+    
+    nr = dm_remap_policy_remap_granularity(dm_remap_policy_dev(device), sector,
+                                           dm_remap_remap_granularity(device));
+    if (round_down(sector, nr) + nr > device->main_device_sectors ||
+        device->remap_count_active + nr > DM_REMAP_V4_MAX_REMAPS)
+        nr = device->block_sectors;
+    *block_start = round_down(sector, nr);
+    return nr;
+}
+
+/**
+ * dm_remap_create_remap() - Remap one extent, metadata first
+ * @device: Target device
+ * @failed_sector: Sector whose error caused the remap
+ * @block_start: First sector of the extent (see dm_remap_remap_extent())
+ * @nr: Length of the extent
+ * @error_time: When the error was seen, for the pipeline timing
+ * @data: Contents for the new spare extent (salvaged reads), or NULL
  * 
- * Flow:
- * 1. Create remap entry with PENDING flag
- * 2. Write metadata synchronously (with wait)
- * 3. Only if successful: activate remap (clear PENDING flag)
- * 4. User I/O will be retried and will find the active remap
+ * v4.2 Data Safety: The entries are created PENDING, the metadata is
+ * written synchronously, and only then are they made ACTIVE, so there is
+ * no window where a remap exists in memory but not on disk.
+ * 
+ * v4.3: @data is written to the spare extent before the metadata, so the
+ * metadata flush makes both durable before the remap is used. Its
+ * checksums are written with it.
+ * 
+ * Runs on the metadata workqueue. Returns 0, -EEXIST if @failed_sector is
+ * already remapped, or the allocation or write error.
  */
-static void dm_remap_writeahead_remap_work(struct work_struct *work)
+static int dm_remap_create_remap(struct dm_remap_device_v4_real *device,
+                                 sector_t failed_sector, sector_t block_start,
+                                 unsigned int nr, ktime_t error_time, void *data)
 {
-    struct dm_remap_device_v4_real *device =
-        container_of(work, struct dm_remap_device_v4_real, writeahead_remap_work);
-    sector_t failed_sector, spare_sector;
-    int result, ret;
+    struct dm_remap_entry_v4 *entry;
+    sector_t spare_sector, hint;
+    unsigned int i;
+    unsigned long flags;
+    ktime_t start = ktime_get();
+    int result = 0, ret;
     
-    /* Get pending remap info (set by bio completion) */
-    spin_lock(&device->remap_lock);
-    failed_sector = device->pending_remap_sector;
-    spin_unlock(&device->remap_lock);
+    hint = dm_remap_policy_spare_placement(dm_remap_policy_dev(device), block_start, nr);
     
-    DMR_INFO("Write-ahead remap: sector %llu (ensuring metadata persisted first)",
-             (unsigned long long)failed_sector);
+    DMR_INFO("Write-ahead remap: sector %llu (block %llu+%u, ensuring metadata persisted first)",
+             (unsigned long long)failed_sector,
+             (unsigned long long)block_start, nr);
     
     /* Check if sector is already remapped */
     if (dm_remap_find_remap_entry(device, failed_sector) != NULL) {
         DMR_ERROR("Sector %llu already remapped during write-ahead work",
                   (unsigned long long)failed_sector);
-        return;
+        return -EEXIST;
     }
     
-    /* Find available spare sector */
-    spin_lock(&device->remap_lock);
+    /* Find available spare extent */
+    spin_lock_irqsave(&device->remap_lock, flags);
+    ret = dm_remap_alloc_spare_extent(device, nr, nr, hint, &spare_sector);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
     
-    if (device->next_spare_sector >= device->spare_sector_count) {
-        spin_unlock(&device->remap_lock);
+    if (ret) {
         DMR_ERROR("No spare sectors available for write-ahead remap of sector %llu",
                   (unsigned long long)failed_sector);
-        return;
+        return ret;
     }
     
-    spare_sector = device->next_spare_sector++;
-    spin_unlock(&device->remap_lock);
+    /* Create remap entries with PENDING flag - not yet safe for I/O */
+    for (i = 0; i < nr; i++) {
+        result = dm_remap_add_remap_entry(device, block_start + i, spare_sector + i);
+        if (result == -EEXIST)
+            result = 0;  /* Sector of this block was remapped on its own */
+        if (result)
+            break;
+    }
     
-    /* Create remap entry with PENDING flag - not yet safe for I/O */
-    result = dm_remap_add_remap_entry(device, failed_sector, spare_sector);
-    if (result != 0) {
-        DMR_ERROR("Failed to add write-ahead remap entry %llu -> %llu (error=%d)",
-                  (unsigned long long)failed_sector,
+    /* v4.3: Salvaged data goes to the extent before anything points at it */
+    if (!result && data)
+        result = dm_remap_spare_io_sync(device, REQ_OP_WRITE | REQ_SYNC, spare_sector,
+                                        data, nr);
+    if (!result && data)
+        result = dm_remap_csum_note(device, block_start, spare_sector, data, nr);
+    dm_remap_pipeline_record(&device->pipeline, DM_REMAP_PIPE_ALLOC,
+                             ktime_to_ns(ktime_sub(ktime_get(), start)));
+    
+    /* CRITICAL: Persist metadata before activating remap */
+    if (!result)
+        result = dm_remap_commit_metadata_timed(device, true);
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    if (result) {
+        /* v4.3: A copy on disk may name the extent until the next commit */
+        dm_remap_drop_pending_range(device, block_start, nr);
+        dm_remap_freelist_add(&device->spare_released, spare_sector, nr);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        DMR_ERROR("Failed to persist write-ahead remap %llu -> %llu (error=%d)",
+                  (unsigned long long)block_start,
                   (unsigned long long)spare_sector, result);
-        
-        /* Return spare sector to pool */
-        spin_lock(&device->remap_lock);
-        device->next_spare_sector--;
-        spin_unlock(&device->remap_lock);
-        return;
+        return result;
     }
     
-    /* CRITICAL: Update metadata before activating remap */
+    /* Activate remap - metadata is on stable storage */
+    for (entry = dm_remap_index_ceil(device, block_start);
+         entry && entry->original_sector < block_start + nr;
+         entry = dm_remap_index_next(entry)) {
+        if (entry->flags & DM_REMAP_FLAG_PENDING) {
+            entry->flags &= ~DM_REMAP_FLAG_PENDING;
+            entry->flags |= DM_REMAP_FLAG_ACTIVE;
+        }
+    }
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    dm_remap_flatten_note(device, block_start, nr);
+    dm_remap_pipeline_record(&device->pipeline, DM_REMAP_PIPE_TOTAL,
+                             ktime_to_ns(ktime_sub(ktime_get(), error_time)));
     
-    mutex_lock(&device->metadata_mutex);
+    /* Add to cache for fast lookup */
+    dm_remap_cache_insert(device, failed_sector, spare_sector + (failed_sector - block_start));
     
-    /* Update metadata */
-    device->metadata.last_update = ktime_to_ns(ktime_get_real());
-    device->metadata.sequence_number++;
-    device->metadata.metadata_crc = 0;
-    device->metadata.metadata_crc = dm_remap_calculate_crc32(&device->metadata,
-                                                             sizeof(device->metadata));
+    /* Update statistics */
+    atomic64_add(nr, &device->stats.remapped_sectors);
+    dm_remap_pipeline_remap(&device->pipeline, (u64)nr << SECTOR_SHIFT);
+    atomic64_inc(&device->active_remaps);
+    dm_remap_event_record(&device->events, DM_REMAP_EVENT_REMAP, block_start, nr);
+    dm_table_event(device->ti->table);
+    
+    DMR_INFO("Remap activated: %llu->%llu (%u sectors, seq: %llu)",
+             (unsigned long long)block_start,
+             (unsigned long long)spare_sector, nr,
+             (unsigned long long)device->persistent_metadata->header.sequence_number);
+    
+    /* Persist the ACTIVE flags in the background */
+    device->metadata_dirty = true;
+    if (device->metadata_workqueue) {
+        queue_work(device->metadata_workqueue, &device->metadata_sync_work);
+    }
+    return 0;
+}
+
+/**
+ * dm_remap_writeahead_remap_work() - Write-ahead remap creation with metadata persistence
+ * 
+ * Flow:
+ * 1. Create remap entries with PENDING flag
+ * 2. Write metadata synchronously (with wait)
+ * 3. Only if successful: activate remaps (clear PENDING flag)
+ * 4. User I/O will be retried and will find the active remap
+ * 
+ * See dm_remap_create_remap(). Each stage is timed into device->pipeline
+ * ("pipeline" message).
+ */
+static void dm_remap_writeahead_remap_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device =
+        container_of(work, struct dm_remap_device_v4_real, writeahead_remap_work);
+    struct dm_remap_io_scope scope;
+    sector_t failed_sector, block_start;
+    ktime_t error_time;
+    unsigned int nr;
+    unsigned long flags;
     
-    /* Sync to persistent metadata */
-    dm_remap_sync_persistent_metadata(device);
+    /* Get pending remap info (set by bio completion) */
+    spin_lock_irqsave(&device->remap_lock, flags);
+    failed_sector = device->pending_remap_sector;
+    error_time = device->pending_remap_time;
+    spin_unlock_irqrestore(&device->remap_lock, flags);
     
-    /* Write metadata using dm-bufio (immediate, safe from any context) */
-    if (device->metadata_bufio_client) {
-        ret = dm_remap_write_metadata_v4_async(device->metadata_bufio_client,
-                                              device->persistent_metadata,
-                                              NULL);  /* NULL = fire-and-forget */
+    dm_remap_pipeline_record(&device->pipeline, DM_REMAP_PIPE_QUEUE,
+                             ktime_to_ns(ktime_sub(ktime_get(), error_time)));
+    
+    nr = dm_remap_remap_extent(device, failed_sector, &block_start);
+    dm_remap_io_enter(&device->ioclass, DM_REMAP_IOS_METADATA, &scope);
+    dm_remap_create_remap(device, failed_sector, block_start, nr, error_time, NULL);
+    dm_remap_io_leave(&scope);
+}
+
+/*
+ * v4.3: Is the compressed extent at @spare_sector still named by an entry
+ * of the unit starting at @unit? Caller holds remap_lock.
+ */
+static bool dm_remap_compress_extent_used(struct dm_remap_device_v4_real *device,
+                                          sector_t unit, sector_t spare_sector)
+{
+    struct dm_remap_entry_v4 *entry;
+    
+    for (entry = dm_remap_index_ceil(device, unit);
+         entry && entry->original_sector < unit + DM_REMAP_V4_COMPRESS_SECTORS;
+         entry = dm_remap_index_next(entry)) {
+        if ((entry->flags & (DM_REMAP_FLAG_PENDING | DM_REMAP_FLAG_COMPRESSED)) ==
+                DM_REMAP_FLAG_COMPRESSED && entry->spare_sector == spare_sector)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * v4.3: Release the spare space an entry for @sector used before it was
+ * retargeted. A compressed extent goes with the last entry of its unit
+ * naming it. Caller holds remap_lock.
+ */
+static void dm_remap_release_spare(struct dm_remap_device_v4_real *device, sector_t sector,
+                                   sector_t spare_sector, u32 flags)
+{
+    if (flags & (DM_REMAP_FLAG_PENDING | DM_REMAP_FLAG_ZERO))
+        return;
+    if ((flags & DM_REMAP_FLAG_COMPRESSED) &&
+        dm_remap_compress_extent_used(device, round_down(sector, DM_REMAP_V4_COMPRESS_SECTORS),
+                                      spare_sector))
+        return;
+    dm_remap_freelist_add(&device->spare_released, spare_sector,
+                          dm_remap_entry_spare_len(flags));
+}
+
+/**
+ * dm_remap_switch_extent() - Point a sector range at a new spare extent
+ * @device: Target device
+ * @sector: First sector of the range
+ * @nr_sectors: Length of the range
+ * @spare_sector: First sector of the new extent, 0 to make the range zero
+ * 
+ * Existing entries are retargeted in place, missing ones are created ACTIVE.
+ * v4.3: Spare sectors they no longer use are released. With @spare_sector 0
+ * the range reads as zeros and holds no spare space; PENDING entries are
+ * then left to their remap. The caller commits the metadata afterwards.
+ * Process context only.
+ */
+static int dm_remap_switch_extent(struct dm_remap_device_v4_real *device,
+                                  sector_t sector, sector_t nr_sectors,
+                                  sector_t spare_sector)
+{
+    struct dm_remap_entry_v4 *entry, *tmp;
+    uint64_t now = ktime_to_ns(ktime_get_real());
+    sector_t i, old_spare;
+    unsigned long flags;
+    LIST_HEAD(spares);
+    u32 old_flags;
+    
+    /* Preallocate outside the spinlock; at most one entry per sector */
+    for (i = 0; i < nr_sectors; i++) {
+        entry = kzalloc(sizeof(*entry), GFP_NOIO);
+        if (!entry)
+            goto out_free;
+        list_add(&entry->list, &spares);
+    }
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    entry = dm_remap_index_ceil(device, sector);
+    for (i = 0; i < nr_sectors; i++) {
+        while (entry && entry->original_sector < sector + i)
+            entry = dm_remap_index_next(entry);
+        
+        if (entry && entry->original_sector == sector + i) {
+            /* Retarget every entry for this sector, PENDING ones included */
+            do {
+                if (!spare_sector && (entry->flags & DM_REMAP_FLAG_PENDING)) {
+                    entry = dm_remap_index_next(entry);
+                    continue;
+                }
+                old_spare = entry->spare_sector;
+                old_flags = entry->flags;
+                entry->spare_sector = spare_sector ? spare_sector + i : 0;
+                entry->flags = DM_REMAP_FLAG_ACTIVE | (spare_sector ? 0 : DM_REMAP_FLAG_ZERO);
+                dm_remap_release_spare(device, sector + i, old_spare, old_flags);
+                entry = dm_remap_index_next(entry);
+            } while (entry && entry->original_sector == sector + i);
+            continue;
+        }
+        
+        tmp = list_first_entry(&spares, struct dm_remap_entry_v4, list);
+        list_del(&tmp->list);
+        tmp->original_sector = sector + i;
+        tmp->spare_sector = spare_sector ? spare_sector + i : 0;
+        tmp->remap_time = now;
+        tmp->flags = DM_REMAP_FLAG_ACTIVE | (spare_sector ? 0 : DM_REMAP_FLAG_ZERO);
+        dm_remap_index_insert(device, tmp);
+        device->remap_count_active++;
+        device->metadata.active_mappings++;
+    }
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    dm_remap_flatten_note(device, sector, nr_sectors);
+    
+    dm_remap_check_resize_hash_table(device);
+    dm_remap_stats_set_active_mappings(device->remap_count_active);
+    /* A cached 0 is a miss: zero remaps are always looked up */
+    for (i = 0; i < nr_sectors; i++)
+        dm_remap_cache_insert(device, sector + i, spare_sector ? spare_sector + i : 0);
+    
+    list_for_each_entry_safe(entry, tmp, &spares, list)
+        kfree(entry);
+    return 0;
+    
+out_free:
+    list_for_each_entry_safe(entry, tmp, &spares, list)
+        kfree(entry);
+    return -ENOMEM;
+}
+
+/* Delay before the first retry of a failed atomic commit; later ones back off linearly */
+#define DM_REMAP_ATOMIC_RETRY_MS  100
+/* Delay before writes held after a failed commit try it again */
+#define DM_REMAP_ATOMIC_HOLD_MS   5000
+
+/**
+ * dm_remap_atomic_commit_work() - Switch staged atomic writes into the table
+ * 
+ * v4.3: An atomic write that straddles remapped and healthy sectors is written
+ * whole to a freshly allocated spare extent (see dm_remap_map_atomic_write()).
+ * Once that write has completed, every sector of its range is pointed at the
+ * new extent and the table is committed with a single metadata write; only
+ * then is the write acknowledged. A crash before the commit leaves the old
+ * mapping, and therefore the old data, in place.
+ * 
+ * All writes staged since the last run share one commit. With data
+ * checksums on, the staged data is recorded and its records written before
+ * the commit. Zeroing writes to remapped sectors come through here too,
+ * with no extent, and turn their range zero (see dm_remap_map_zero()).
+ * 
+ * A write that could not be switched fails with its old mapping in place,
+ * and its extent is released. A failed commit is retried up to retry_limit
+ * times. If it still fails, the switched writes are held, not completed:
+ * their sectors already read the new data, but a crash would bring back
+ * the old. They complete with the next commit here that succeeds; the
+ * work runs again with the next staged write or after a pause.
+ */
+static void dm_remap_atomic_commit_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device =
+        container_of(to_delayed_work(work), struct dm_remap_device_v4_real, atomic_commit_work);
+    struct dm_remap_io_ctx *ctx, *tmp;
+    struct dm_remap_io_scope scope;
+    unsigned int attempt, retries;
+    struct bio *bio;
+    unsigned long flags;
+    LIST_HEAD(switched);
+    LIST_HEAD(batch);
+    LIST_HEAD(failed);
+    int ret = 0;
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_splice_init(&device->atomic_commit_list, &batch);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    list_for_each_entry_safe(ctx, tmp, &batch, list) {
+        ret = dm_remap_switch_extent(device, ctx->orig_sector, ctx->nr_sectors,
+                                     ctx->stage_sector);
         if (ret) {
-            DMR_ERROR("dm-bufio metadata write failed: %d", ret);
-        } else {
-            device->metadata_dirty = false;
-            DMR_INFO("Metadata persisted via dm-bufio (seq: %llu, remap: %llu -> %llu)",
-                     (unsigned long long)device->persistent_metadata->header.sequence_number,
-                     (unsigned long long)failed_sector,
-                     (unsigned long long)spare_sector);
+            /* This one and the rest keep their old mapping */
+            list_cut_before(&switched, &batch, &ctx->list);
+            list_splice_init(&batch, &failed);
+            list_splice_init(&switched, &batch);
+            break;
         }
+        if (ctx->stage_sector && READ_ONCE(device->csum_state) != DM_REMAP_CSUM_OFF)
+            dm_remap_csum_bio(&device->csum,
+                              dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx)),
+                              ctx->iter, ctx->orig_sector, ctx->stage_sector, true);
     }
     
-    mutex_unlock(&device->metadata_mutex);
+    if (ret) {
+        DMR_ERROR("Atomic write switch failed: %d", ret);
+        list_for_each_entry_safe(ctx, tmp, &failed, list) {
+            list_del_init(&ctx->list);
+            ctx->flags |= DM_REMAP_IO_COMMITTED;
+            if (ctx->stage_sector) {
+                spin_lock_irqsave(&device->remap_lock, flags);
+                dm_remap_freelist_add(&device->spare_released, ctx->stage_sector,
+                                      ctx->nr_sectors);
+                spin_unlock_irqrestore(&device->remap_lock, flags);
+            }
+            bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+            bio->bi_status = errno_to_blk_status(ret);
+            bio_endio(bio);
+        }
+    }
     
-    /* Activate remap - metadata already persisted via dm-bufio */
-    struct dm_remap_entry_v4 *entry = dm_remap_find_remap_entry(device, failed_sector);
-    if (entry) {
-        entry->flags &= ~DM_REMAP_FLAG_PENDING;
-        entry->flags |= DM_REMAP_FLAG_ACTIVE;
-        
-        /* Add to cache for fast lookup */
-        dm_remap_cache_insert(device, failed_sector, spare_sector);
-        
-        /* Update statistics */
-        atomic64_inc(&device->stats.remapped_sectors);
-        
-        DMR_INFO("Remap activated: %llu->%llu (metadata will sync in background)",
-                 (unsigned long long)failed_sector,
-                 (unsigned long long)spare_sector);
+    /* Writes held by an earlier failed commit complete with this one */
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_splice_init(&device->atomic_held_list, &batch);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    if (list_empty(&batch))
+        return;
+    
+    retries = READ_ONCE(device->tunables.retry_limit);
+    dm_remap_io_enter(&device->ioclass, DM_REMAP_IOS_METADATA, &scope);
+    for (attempt = 0; ; attempt++) {
+        ret = dm_remap_csum_flush(device);
+        if (!ret)
+            ret = dm_remap_commit_metadata(device);
+        if (!ret || attempt >= retries)
+            break;
+        msleep(DM_REMAP_ATOMIC_RETRY_MS * (attempt + 1));
     }
+    dm_remap_io_leave(&scope);
     
-    /* Mark metadata dirty - will be synced by background worker */
-    device->metadata_dirty = true;
+    if (ret) {
+        /* The switched entries are live in memory; hold the writes until
+         * they are on disk */
+        DMR_ERROR("Atomic write commit failed after %u attempts: %d, holding the writes",
+                  attempt + 1, ret);
+        device->metadata_dirty = true;
+        dm_remap_request_metadata_write(device);
+        spin_lock_irqsave(&device->remap_lock, flags);
+        list_splice(&batch, &device->atomic_held_list);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        queue_delayed_work(device->metadata_workqueue, &device->atomic_commit_work,
+                           msecs_to_jiffies(DM_REMAP_ATOMIC_HOLD_MS));
+        return;
+    }
     
-    /* Trigger background metadata sync (async, fire-and-forget) */
-    if (device->metadata_workqueue) {
-        queue_work(device->metadata_workqueue, &device->metadata_sync_work);
+    list_for_each_entry_safe(ctx, tmp, &batch, list) {
+        list_del_init(&ctx->list);
+        ctx->flags |= DM_REMAP_IO_COMMITTED;
+        bio_endio(dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx)));
     }
 }
 
 /**
- * dm_remap_handle_io_error() - Handle I/O errors and queue write-ahead remap
+ * dm_remap_count_io_error() - Account an error and queue pattern analysis
  * 
- * v4.2 Data Safety: Queue write-ahead remap creation to ensure metadata is
- * written BEFORE user I/O succeeds. Called from bio completion context, so
- * must be fast and non-blocking.
+ * v4.3: Split out of dm_remap_handle_io_error() for errors whose class is
+ * set to "count": they feed the statistics and health analysis but never
+ * remap.
  */
-static void dm_remap_handle_io_error(struct dm_remap_device_v4_real *device,
-                                   sector_t failed_sector, int error)
+static void dm_remap_count_io_error(struct dm_remap_device_v4_real *device,
+                                    sector_t failed_sector)
 {
-    DMR_WARN("I/O error on sector %llu (error=%d), queueing write-ahead remap",
-             (unsigned long long)failed_sector, error);
-             
+    unsigned long flags;
+    
     /* Update error statistics */
     atomic64_inc(&device->stats.io_errors);
     dm_remap_stats_inc_errors();
+    dm_remap_verify_note_error(device, failed_sector);
     
     /* Queue error pattern analysis */
-    spin_lock(&device->remap_lock);
+    spin_lock_irqsave(&device->remap_lock, flags);
     device->pending_error_sector = failed_sector;
-    spin_unlock(&device->remap_lock);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
     queue_work(device->metadata_workqueue, &device->error_analysis_work);
+}
+
+/**
+ * dm_remap_error_verdict() - Account an error and decide whether to remap
+ * 
+ * v4.3: An attached remap policy may keep the sector on the main device for
+ * now (RETRY) or drop the error altogether (IGNORE). A shadow policy, if
+ * configured, sees every error before the active verdict is applied.
+ * Nothing is remapped while the error domain is in a burst, unless
+ * correlated_errors says so; salvaged reads get here after their re-reads,
+ * by when a burst they were part of has usually been recognised.
+ * Returns true if the sector should be remapped.
+ */
+static bool dm_remap_error_verdict(struct dm_remap_device_v4_real *device,
+                                   sector_t failed_sector, int error, bool is_write)
+{
+    u32 correlated = READ_ONCE(device->tunables.correlated_action);
+    int verdict;
+    
+    if (correlated != DM_REMAP_ACT_REMAP && dm_remap_correlate_burst(&device->correlate)) {
+        atomic64_inc(&device->correlated_errors);
+        if (correlated == DM_REMAP_ACT_COUNT)
+            dm_remap_count_io_error(device, failed_sector);
+        DMR_DEBUG(2, "Error on sector %llu correlated with other targets, not remapped",
+                  (unsigned long long)failed_sector);
+        return false;
+    }
+    
+    dm_remap_shadow_error(&device->shadow, &device->events, failed_sector);
+    
+    verdict = dm_remap_policy_should_remap(dm_remap_policy_dev(device), failed_sector,
+                                           error, is_write);
+    if (verdict == DM_REMAP_POLICY_IGNORE) {
+        atomic64_inc(&device->policy_ignored);
+        dm_remap_event_record(&device->events, DM_REMAP_EVENT_IGNORE, failed_sector, 1);
+        DMR_DEBUG(2, "Policy ignores error on sector %llu",
+                  (unsigned long long)failed_sector);
+        return false;
+    }
+    
+    DMR_WARN("I/O error on sector %llu (error=%d), queueing write-ahead remap",
+             (unsigned long long)failed_sector, error);
+    
+    dm_remap_count_io_error(device, failed_sector);
+    
+    if (verdict == DM_REMAP_POLICY_RETRY) {
+        atomic64_inc(&device->policy_retried);
+        dm_remap_event_record(&device->events, DM_REMAP_EVENT_RETRY, failed_sector, 1);
+        DMR_DEBUG(2, "Policy defers remap of sector %llu",
+                  (unsigned long long)failed_sector);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * dm_remap_handle_io_error() - Handle I/O errors and queue write-ahead remap
+ * 
+ * v4.2 Data Safety: Queue write-ahead remap creation to ensure metadata is
+ * written BEFORE user I/O succeeds. Called from bio completion context, so
+ * must be fast and non-blocking.
+ */
+static void dm_remap_handle_io_error(struct dm_remap_device_v4_real *device,
+                                   sector_t failed_sector, int error, bool is_write)
+{
+    unsigned long flags;
+    
+    if (!dm_remap_error_verdict(device, failed_sector, error, is_write))
+        return;
     
     /* Quick check if already remapped (avoid duplicate work) */
     if (dm_remap_find_remap_entry(device, failed_sector) != NULL) {
@@ -871,10 +2202,11 @@ static void dm_remap_handle_io_error(struct dm_remap_device_v4_real *device,
     }
     
     /* Queue write-ahead remap creation (metadata written before I/O succeeds) */
-    spin_lock(&device->remap_lock);
+    spin_lock_irqsave(&device->remap_lock, flags);
     device->pending_remap_sector = failed_sector;
     device->pending_remap_error = error;
-    spin_unlock(&device->remap_lock);
+    device->pending_remap_time = ktime_get();
+    spin_unlock_irqrestore(&device->remap_lock, flags);
     
     queue_work(device->metadata_workqueue, &device->writeahead_remap_work);
     
@@ -882,864 +2214,4499 @@ static void dm_remap_handle_io_error(struct dm_remap_device_v4_real *device,
               (unsigned long long)failed_sector);
 }
 
+/* Delay before the first resubmission; later ones back off linearly */
+#define DM_REMAP_RETRY_DELAY_MS  100
+
 /**
- * dm_remap_metadata_thread() - Kernel thread for metadata writes (v4.2.2)
- * 
- * This dedicated kernel thread handles all metadata write operations.
- * Running in process context allows safe page allocation and synchronous I/O.
+ * dm_remap_classify_error() - Map a completion status to an error class
  * 
- * Why kernel thread instead of workqueue:
- * - Workqueue context doesn't support kmap() operations
- * - Need full process context for page operations
- * - Can safely do synchronous I/O without deadlock
+ * v4.3: Only media errors say anything about the sectors. Transport
+ * errors (path loss, timeouts after a controller reset, offline devices)
+ * and resource shortages clear up on their own, and an unsupported
+ * operation fails the same way on every sector.
  */
-static int dm_remap_metadata_thread(void *data)
+static enum dm_remap_error_class dm_remap_classify_error(blk_status_t status)
 {
-    struct dm_remap_device_v4_real *device = data;
-    struct block_device * __maybe_unused bdev;
-    int ret;
-    
-    DMR_INFO("Metadata write thread started");
-    
-    while (!kthread_should_stop()) {
-        /* Wait for metadata write request or stop signal */
-        wait_event_interruptible(device->metadata_wait_queue,
-                                 atomic_read(&device->metadata_write_requested) ||
-                                 kthread_should_stop());
-        
-        if (kthread_should_stop())
-            break;
-        
-        /* Clear the request flag */
-        if (!atomic_cmpxchg(&device->metadata_write_requested, 1, 0))
-            continue;
-        
-        /* Check if device is still active */
-        if (!atomic_read(&device->device_active)) {
-            DMR_DEBUG(2, "Metadata write skipped - device inactive");
-            continue;
-        }
-        
-        /* Perform metadata write in safe thread context */
-        mutex_lock(&device->metadata_mutex);
-        
-        if (!device->metadata_dirty || !device->persistent_metadata || !device->spare_dev) {
-            mutex_unlock(&device->metadata_mutex);
-            continue;
-        }
-        
-        /* Update metadata */
-        device->metadata.last_update = ktime_to_ns(ktime_get_real());
-        device->metadata.sequence_number++;
-        device->metadata.metadata_crc = 0;
-        device->metadata.metadata_crc = dm_remap_calculate_crc32(&device->metadata,
-                                                                 sizeof(device->metadata));
-        
-        /* Sync to persistent metadata */
-        dm_remap_sync_persistent_metadata(device);
-        
-        /* Write metadata using dm-bufio (safe, no page allocation) */
-        if (device->metadata_bufio_client) {
-            ret = dm_remap_write_metadata_v4_async(device->metadata_bufio_client,
-                                                  device->persistent_metadata,
-                                                  NULL);  /* NULL = fire-and-forget */
-            
-            if (ret) {
-                DMR_ERROR("Metadata write via dm-bufio failed: %d", ret);
-            } else {
-                device->metadata_dirty = false;
-                DMR_DEBUG(2, "Metadata written via dm-bufio (seq: %llu, %u remaps)",
-                     device->metadata.sequence_number,
-                     device->persistent_metadata->remap_data.active_remaps);
-            }
-        }
-        
-        mutex_unlock(&device->metadata_mutex);
-    }
-    
-    DMR_INFO("Metadata write thread stopped");
-    return 0;
+    if (status == BLK_STS_MEDIUM || status == BLK_STS_IOERR ||
+        status == BLK_STS_PROTECTION || status == BLK_STS_TARGET)
+        return DM_REMAP_ERR_MEDIA;
+    if (status == BLK_STS_TRANSPORT || status == BLK_STS_TIMEOUT ||
+        status == BLK_STS_OFFLINE || status == BLK_STS_NEXUS)
+        return DM_REMAP_ERR_TRANSPORT;
+    if (status == BLK_STS_RESOURCE || status == BLK_STS_DEV_RESOURCE ||
+        status == BLK_STS_AGAIN || status == BLK_STS_ZONE_OPEN_RESOURCE ||
+        status == BLK_STS_ZONE_ACTIVE_RESOURCE)
+        return DM_REMAP_ERR_RESOURCE;
+    if (status == BLK_STS_NOTSUPP)
+        return DM_REMAP_ERR_UNSUPPORTED;
+    return DM_REMAP_ERR_OTHER;
 }
 
+/* Statuses "inject_error" accepts */
+static const struct {
+    const char *name;
+    blk_status_t status;
+} dm_remap_inject_statuses[] = {
+    { "medium",     BLK_STS_MEDIUM },
+    { "ioerr",      BLK_STS_IOERR },
+    { "protection", BLK_STS_PROTECTION },
+    { "target",     BLK_STS_TARGET },
+    { "transport",  BLK_STS_TRANSPORT },
+    { "timeout",    BLK_STS_TIMEOUT },
+    { "offline",    BLK_STS_OFFLINE },
+    { "nexus",      BLK_STS_NEXUS },
+    { "resource",   BLK_STS_RESOURCE },
+    { "again",      BLK_STS_AGAIN },
+    { "notsupp",    BLK_STS_NOTSUPP },
+    { "nospc",      BLK_STS_NOSPC },
+};
+
 /**
- * dm_remap_request_metadata_write() - Request metadata write from thread
+ * dm_remap_retry_work() - Resubmit main device bios that failed transiently
  * 
- * Called from any context to request metadata write.
- * Thread-safe, non-blocking.
+ * v4.3: The bio is reissued as it was mapped; dm_remap_end_io_v4_real()
+ * sees it again when it completes.
  */
-static void dm_remap_request_metadata_write(struct dm_remap_device_v4_real *device)
+static void dm_remap_retry_work(struct work_struct *work)
 {
-    atomic_set(&device->metadata_write_requested, 1);
-    wake_up(&device->metadata_wait_queue);
+    struct dm_remap_device_v4_real *device =
+        container_of(to_delayed_work(work), struct dm_remap_device_v4_real, retry_work);
+    struct dm_remap_io_ctx *ctx, *tmp;
+    struct bio *bio;
+    unsigned long flags;
+    LIST_HEAD(batch);
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_splice_init(&device->retry_list, &batch);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    list_for_each_entry_safe(ctx, tmp, &batch, list) {
+        list_del_init(&ctx->list);
+        bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+        bio->bi_iter = ctx->iter;
+        bio->bi_status = BLK_STS_OK;
+        dm_remap_leg_start(device, ctx, DM_REMAP_LEG_MAIN);
+        dm_submit_bio_remap(bio, NULL);
+    }
 }
 
 /**
- * dm_remap_sync_metadata_work() - Background metadata synchronization (v4.2.2)
+ * dm_remap_retry_io() - Queue a failed main device bio for resubmission
  * 
- * Now just requests the kernel thread to write metadata instead of doing it directly.
+ * Returns false if the bio cannot be retried (not a plain main device data
+ * bio, carrying protection information, or out of retries); the error then
+ * goes up as is.
  */
-static void dm_remap_sync_metadata_work(struct work_struct *work)
+static bool dm_remap_retry_io(struct dm_remap_device_v4_real *device,
+                              struct bio *bio, struct dm_remap_io_ctx *ctx)
 {
-    struct dm_remap_device_v4_real *device = 
-        container_of(work, struct dm_remap_device_v4_real, metadata_sync_work);
-    
-    /* CRITICAL: Check if device is being destroyed BEFORE doing ANY work */
-    if (!atomic_read(&device->device_active)) {
-        DMR_DEBUG(2, "Metadata sync skipped - device inactive");
-        return;
+    unsigned long flags;
+    
+    if (!(ctx->flags & DM_REMAP_IO_MAIN) || bio_integrity(bio))
+        return false;
+    if (ctx->retries >= READ_ONCE(device->tunables.retry_limit)) {
+        if (ctx->retries) {
+            atomic64_inc(&device->retries_exhausted);
+            DMR_WARN("Sector %llu still failing after %u retries",
+                     (unsigned long long)ctx->orig_sector, ctx->retries);
+        }
+        return false;
     }
     
-    if (!device->metadata_dirty) {
-        return;
-    }
+    ctx->retries++;
+    atomic64_inc(&device->retries_issued);
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_add_tail(&ctx->list, &device->retry_list);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    queue_delayed_work(device->metadata_workqueue, &device->retry_work,
+                       msecs_to_jiffies(DM_REMAP_RETRY_DELAY_MS * ctx->retries));
+    return true;
+}
+
+/* Delay before the first re-read of a failed read; later ones back off linearly */
+#define DM_REMAP_SALVAGE_DELAY_MS  50
+
+/* Largest range re-read in one bio, wherever in a page the buffer starts */
+#define DM_REMAP_SALVAGE_MAX_RANGE ((BIO_MAX_VECS - 1) << (PAGE_SHIFT - SECTOR_SHIFT))
+
+/**
+ * struct dm_remap_salvage - A failed read on its way to the spare
+ * @list: salvage_commit_list linkage
+ * @ctx: The held bio
+ * @start: First sector of the re-read range, whole remap extents
+ * @nr: Length of the range
+ * @unit: Sectors per re-read once the whole range failed
+ * @data: Contents of the range, lost units zeroed
+ * @lost: Units that could not be read back, one bit each
+ */
+struct dm_remap_salvage {
+    struct list_head list;
+    struct dm_remap_io_ctx *ctx;
+    sector_t start;
+    unsigned int nr;
+    unsigned int unit;
+    void *data;
+    unsigned long lost[];
+};
+
+/**
+ * dm_remap_sync_io() - Synchronous I/O on a vmalloc'ed buffer
+ */
+static int dm_remap_sync_io(struct block_device *bdev, blk_opf_t opf, sector_t sector,
+                            void *data, unsigned int nr)
+{
+    size_t len = (size_t)nr << SECTOR_SHIFT, off, n;
+    struct bio *bio;
+    int ret;
     
-    DMR_DEBUG(2, "Requesting metadata write via kernel thread");
-    dm_remap_request_metadata_write(device);
+    bio = bio_alloc(bdev, DIV_ROUND_UP(offset_in_page(data) + len, PAGE_SIZE), opf, GFP_NOIO);
+    bio->bi_iter.bi_sector = sector;
+    for (off = 0; off < len; off += n) {
+        n = min_t(size_t, len - off, PAGE_SIZE - offset_in_page(data + off));
+        __bio_add_page(bio, vmalloc_to_page(data + off), n, offset_in_page(data + off));
+    }
+    ret = submit_bio_wait(bio);
+    bio_put(bio);
+    return ret;
 }
 
 /**
- * dm_remap_error_analysis_work() - Deferred error pattern analysis
+ * dm_remap_salvage_read() - Re-read part of a failed range from the main device
  * 
- * This work function performs error pattern analysis in a safe context where
- * mutexes can be taken. It's called from a workqueue instead of from I/O
- * completion context to avoid deadlocks.
+ * Up to @retries attempts, the n-th after n * DM_REMAP_SALVAGE_DELAY_MS.
  */
-static void dm_remap_error_analysis_work(struct work_struct *work)
+static int dm_remap_salvage_read(struct dm_remap_device_v4_real *device, sector_t sector,
+                                 void *data, unsigned int nr, unsigned int retries)
 {
-    struct dm_remap_device_v4_real *device = 
-        container_of(work, struct dm_remap_device_v4_real, error_analysis_work);
-    sector_t failed_sector;
-    
-    /* Get the pending error sector */
-    spin_lock(&device->remap_lock);
-    failed_sector = device->pending_error_sector;
-    spin_unlock(&device->remap_lock);
+    unsigned int attempt;
+    int ret = -EIO;
     
-    /* Now safe to call mutex-taking function */
-    dm_remap_analyze_error_pattern(device, failed_sector);
+    for (attempt = 1; attempt <= retries && ret; attempt++) {
+        msleep(DM_REMAP_SALVAGE_DELAY_MS * attempt);
+        ret = dm_remap_sync_io(file_bdev(device->main_dev), REQ_OP_READ | REQ_SYNC,
+                               sector, data, nr);
+    }
+    return ret;
 }
 
 /**
- * dm_remap_deferred_metadata_read_work() - v4.2: Read metadata after construction
+ * dm_remap_salvage_complete() - Complete a held read, with @data if it was read back
  * 
- * This work function safely reads metadata from the spare device after the
- * dm-target constructor has completed. This avoids constructor deadlocks while
- * still enabling metadata persistence and auto-repair functionality.
+ * Without @data the bio fails with the error it was held with.
  */
-static void dm_remap_deferred_metadata_read_work(struct work_struct *work)
+static void dm_remap_salvage_complete(struct dm_remap_io_ctx *ctx, const void *data)
 {
-    struct dm_remap_device_v4_real *device = 
-        container_of(to_delayed_work(work), struct dm_remap_device_v4_real, 
-                     deferred_metadata_read_work);
-    struct block_device * __maybe_unused bdev;
-    int ret;
-    
-    /* Check if already loaded (double-check pattern) */
-    if (atomic_read(&device->metadata_loaded))
-        return;
-    
-    DMR_INFO("Loading persistent metadata (deferred read)...");
-    
-    /* Call the read function which now includes auto-repair */
-    ret = dm_remap_read_persistent_metadata(device);
-    if (ret != 0) {
-        /* ret < 0: Error reading, ret > 0: not used
-         * In either case, no valid metadata found - write initial state */
-        DMR_WARN("No valid metadata found, starting fresh: %d", ret);
-        
-        /* v4.2 Data Safety: Write initial metadata using fire-and-forget
-         * This creates the 5-copy redundant metadata structure on first boot.
-         * We don't wait for completion (safe in workqueue context but not needed).
-         * Critical remaps use write-ahead, this is just initial setup. */
-        
-        printk(KERN_INFO "dm-remap: INITIAL METADATA WRITE PATH (no valid metadata found)\n");
-        
-        /* Mark metadata as dirty and request write via kernel thread */
-        device->metadata_dirty = true;
-        dm_remap_request_metadata_write(device);
-        DMR_INFO("Initial metadata write requested via kernel thread");
-    } else {
-        DMR_INFO("Deferred metadata read completed successfully");
+    struct bio *bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+    struct bvec_iter iter;
+    struct bio_vec bv;
+    
+    if (data) {
+        __bio_for_each_segment(bv, bio, iter, ctx->iter) {
+            memcpy_to_bvec(&bv, data);
+            data += bv.bv_len;
+        }
+        bio->bi_status = BLK_STS_OK;
     }
-    
-    printk(KERN_INFO "dm-remap: Setting metadata_loaded=1\n");
-    atomic_set(&device->metadata_loaded, 1);
-    printk(KERN_INFO "dm-remap: Deferred metadata read work COMPLETE\n");
+    ctx->flags |= DM_REMAP_IO_SALVAGED;
+    bio_endio(bio);
 }
 
 /**
- * Phase 1.4: Health Monitoring Functions
+ * dm_remap_salvage_io() - Hold a failed read for re-reading before the remap
+ * 
+ * v4.3: Called from bio completion for an error that would be remapped.
+ * Returns false if salvage is off or the bio does not qualify (not a plain
+ * main device read, carrying protection information, or too large); the
+ * error is then handled straight away as before.
  */
+static bool dm_remap_salvage_io(struct dm_remap_device_v4_real *device, struct bio *bio,
+                                struct dm_remap_io_ctx *ctx, blk_status_t error)
+{
+    unsigned long flags;
+    
+    if (!READ_ONCE(device->tunables.salvage_retries) || bio_op(bio) != REQ_OP_READ ||
+        !(ctx->flags & DM_REMAP_IO_MAIN) || bio_integrity(bio) ||
+        ctx->nr_sectors > DM_REMAP_MAX_SALVAGE_SECTORS)
+        return false;
+    
+    bio->bi_status = error;
+    ctx->start_ns = ktime_get_ns();
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_add_tail(&ctx->list, &device->salvage_list);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    queue_work(dm_remap_wq, &device->salvage_work);
+    return true;
+}
 
 /**
- * dm_remap_analyze_error_pattern() - Analyze sector error patterns
+ * dm_remap_salvage_one() - Re-read one held read
+ * 
+ * The remap extents under the bio are re-read whole. If that works the
+ * error was transient and the bio completes with the data. Otherwise the
+ * range is re-read a unit at a time, lost units are zeroed, and it is
+ * queued for dm_remap_salvage_commit_work().
  */
-static void dm_remap_analyze_error_pattern(struct dm_remap_device_v4_real *device,
-                                          sector_t failed_sector)
+static void dm_remap_salvage_one(struct dm_remap_device_v4_real *device,
+                                 struct dm_remap_io_ctx *ctx)
 {
-    struct dm_remap_health_monitor *health = &device->health_monitor;
-    struct dm_remap_error_pattern *pattern = NULL;
-    uint64_t current_time = ktime_to_ns(ktime_get_real());
-    int i;
-    
-    mutex_lock(&device->health_mutex);
-    
-    /* Find existing pattern for this sector */
-    for (i = 0; i < health->hotspot_count && i < 32; i++) {
-        if (health->error_hotspots[i].sector == failed_sector) {
-            pattern = &health->error_hotspots[i];
-            break;
-        }
+    unsigned int retries = READ_ONCE(device->tunables.salvage_retries);
+    unsigned int unit = READ_ONCE(device->tunables.salvage_sectors);
+    sector_t start, end, last = ctx->orig_sector + ctx->nr_sectors - 1;
+    struct dm_remap_salvage *s;
+    unsigned int nr, first, units, i, lost = 0;
+    u64 begin = ktime_get_ns();
+    unsigned long flags;
+    void *data, *p;
+    struct bio *bio;
+    
+    dm_remap_pipeline_record(&device->pipeline, DM_REMAP_PIPE_QUEUE, begin - ctx->start_ns);
+    
+    /* Whole remap extents, so every new spare extent can be filled */
+    first = dm_remap_remap_extent(device, ctx->orig_sector, &start);
+    nr = dm_remap_remap_extent(device, last, &end);
+    if (unit)
+        unit = min3(max(unit, device->block_sectors), first, nr);
+    end += nr;
+    nr = end - start;
+    if (!unit || nr % unit)
+        unit = nr;
+    units = nr / unit;
+    
+    s = nr <= DM_REMAP_SALVAGE_MAX_RANGE ?
+        kzalloc(struct_size(s, lost, BITS_TO_LONGS(units)), GFP_NOIO) : NULL;
+    data = s ? __vmalloc((size_t)nr << SECTOR_SHIFT, GFP_NOIO) : NULL;
+    if (!data) {
+        kfree(s);
+        bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+        DMR_WARN("Cannot salvage %u sectors at %llu, remapping without",
+                 nr, (unsigned long long)start);
+        dm_remap_handle_io_error(device, ctx->orig_sector,
+                                 blk_status_to_errno(bio->bi_status), false);
+        dm_remap_salvage_complete(ctx, NULL);
+        return;
     }
     
-    /* Create new pattern if not found */
-    if (!pattern && health->hotspot_count < 32) {
-        pattern = &health->error_hotspots[health->hotspot_count++];
-        pattern->sector = failed_sector;
-        pattern->error_count = 0;
-        pattern->first_error_time = current_time;
-        pattern->pattern_flags = 0;
+    if (!dm_remap_salvage_read(device, start, data, nr, retries)) {
+        atomic64_inc(&device->salvage_transient);
+        dm_remap_pipeline_record(&device->pipeline, DM_REMAP_PIPE_SALVAGE,
+                                 ktime_get_ns() - begin);
+        DMR_INFO("Read of sector %llu succeeded on re-read, not remapped",
+                 (unsigned long long)ctx->orig_sector);
+        dm_remap_salvage_complete(ctx, data + ((ctx->orig_sector - start) << SECTOR_SHIFT));
+        vfree(data);
+        kfree(s);
+        return;
     }
     
-    if (pattern) {
-        pattern->error_count++;
-        pattern->last_error_time = current_time;
-        
-        /* Analyze error frequency */
-        uint64_t time_span = current_time - pattern->first_error_time;
-        if (time_span > 0) {
-            uint64_t error_rate = pattern->error_count * 1000000000ULL / time_span;
-            if (error_rate > 100) { /* More than 100 errors per second */
-                pattern->pattern_flags |= 0x01; /* Mark as high-frequency error */
-            }
+    atomic64_inc(&device->salvage_hard);
+    for (i = 0; i < units; i++) {
+        p = data + (((size_t)i * unit) << SECTOR_SHIFT);
+        if (units == 1 ||
+            dm_remap_salvage_read(device, start + (sector_t)i * unit, p, unit, retries)) {
+            memset(p, 0, (size_t)unit << SECTOR_SHIFT);
+            set_bit(i, s->lost);
+            lost++;
         }
-        
-        DMR_DEBUG(2, "Error pattern updated: sector %llu, count %u, rate flags 0x%x",
-                  (unsigned long long)failed_sector, pattern->error_count,
-                  pattern->pattern_flags);
     }
-    
-    /* Update consecutive error tracking */
-    if (health->last_error_sector == failed_sector) {
-        health->consecutive_errors++;
-    } else {
-        health->consecutive_errors = 1;
-        health->last_error_sector = failed_sector;
+    atomic64_add((u64)(units - lost) * unit, &device->salvage_recovered_sectors);
+    atomic64_add((u64)lost * unit, &device->salvage_lost_sectors);
+    dm_remap_pipeline_record(&device->pipeline, DM_REMAP_PIPE_SALVAGE, ktime_get_ns() - begin);
+    DMR_WARN("Read of sector %llu failed %u re-reads: %u of %u sectors recovered",
+             (unsigned long long)ctx->orig_sector, retries, (units - lost) * unit, nr);
+    
+    s->ctx = ctx;
+    s->start = start;
+    s->nr = nr;
+    s->unit = unit;
+    s->data = data;
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_add_tail(&s->list, &device->salvage_commit_list);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    queue_work(device->metadata_workqueue, &device->salvage_commit_work);
+}
+
+/**
+ * dm_remap_salvage_work() - Re-read failed reads before they are remapped
+ * 
+ * v4.3: Runs on dm_remap_wq rather than the metadata workqueue, so the
+ * re-reads and their backoff never hold up remap creation or metadata
+ * commits.
+ */
+static void dm_remap_salvage_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device =
+        container_of(work, struct dm_remap_device_v4_real, salvage_work);
+    struct dm_remap_io_scope scope;
+    struct dm_remap_io_ctx *ctx;
+    unsigned long flags;
+    
+    for (;;) {
+        spin_lock_irqsave(&device->remap_lock, flags);
+        ctx = list_first_entry_or_null(&device->salvage_list, struct dm_remap_io_ctx, list);
+        if (ctx)
+            list_del_init(&ctx->list);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        if (!ctx)
+            return;
+        /* v4.3: The re-reads are charged like the failed read */
+        dm_remap_io_enter_bio(dm_bio_from_per_bio_data(ctx, sizeof(*ctx)), &scope);
+        dm_remap_salvage_one(device, ctx);
+        dm_remap_io_leave(&scope);
     }
+}
+
+/**
+ * dm_remap_lost_outside() - Does an extent hold lost units outside a bio
+ * @ctx: The bio
+ * @start: First sector of the bitmap's range
+ * @unit: Sectors per bit of @lost
+ * @lost: Units that could not be read back
+ * 
+ * v4.3: Filling such an extent would turn sectors nobody asked for into
+ * zeros that read back without an error.
+ */
+static bool dm_remap_lost_outside(const struct dm_remap_io_ctx *ctx, sector_t start,
+                                  unsigned int unit, const unsigned long *lost,
+                                  sector_t block_start, unsigned int nr)
+{
+    sector_t first = ctx->orig_sector, end = first + ctx->nr_sectors, u;
+    unsigned int i;
     
-    /* Update health prediction score based on error patterns */
-    if (health->consecutive_errors > 5) {
-        health->failure_prediction_score = min(health->failure_prediction_score + 10, 100U);
+    for (i = (block_start - start) / unit; i <= (block_start + nr - 1 - start) / unit; i++) {
+        u = start + (sector_t)i * unit;
+        if (test_bit(i, lost) && (u < first || u + unit > end))
+            return true;
     }
-    
-    mutex_unlock(&device->health_mutex);
+    return false;
 }
 
 /**
- * dm_remap_calculate_health_score() - Calculate overall device health
+ * dm_remap_salvage_commit() - Remap a salvaged range and complete its read
+ * 
+ * Extents with a lost unit are remapped, or, if the re-reads could not
+ * tell (no split, or every unit read back), the extent of the failed bio.
+ * Each new spare extent is filled from @s->data before its remap becomes
+ * ACTIVE. An extent with lost units outside the bio is left alone, so
+ * those sectors keep failing instead of reading zeros. The bio succeeds if
+ * none of its own units were lost.
  */
-static uint32_t dm_remap_calculate_health_score(struct dm_remap_device_v4_real *device)
+static void dm_remap_salvage_commit(struct dm_remap_device_v4_real *device,
+                                    struct dm_remap_salvage *s)
 {
-    struct dm_remap_health_monitor *health = &device->health_monitor;
-    uint64_t error_count = atomic64_read(&device->stats.io_errors);
-    uint64_t total_ios = atomic64_read(&device->stats.total_ios);
-    uint32_t health_score = 100; /* Start with perfect health */
-    
-    mutex_lock(&device->health_mutex);
-    
-    /* Factor in error rate */
-    if (total_ios > 0) {
-        uint64_t error_rate = (error_count * 10000) / total_ios; /* Per 10,000 operations */
-        if (error_rate > 100) {      /* >1% error rate */
-            health_score -= 50;
-        } else if (error_rate > 10) { /* >0.1% error rate */
-            health_score -= 20;
-        } else if (error_rate > 1) {  /* >0.01% error rate */
-            health_score -= 5;
+    struct dm_remap_io_ctx *ctx = s->ctx;
+    struct bio *bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+    int error = blk_status_to_errno(bio->bi_status);
+    unsigned int units = s->nr / s->unit, nr, i;
+    bool each = units > 1 && !bitmap_empty(s->lost, units);
+    sector_t sector, block_start, failed, end = s->start + s->nr;
+    void *data;
+    
+    for (sector = s->start; sector < end; sector = block_start + nr) {
+        nr = dm_remap_remap_extent(device, sector, &block_start);
+        if (each) {
+            i = (unsigned int)(max(block_start, s->start) - s->start) / s->unit;
+            i = find_next_bit(s->lost, units, i);
+            failed = s->start + (sector_t)i * s->unit;
+            if (i >= units || failed >= block_start + nr)
+                continue;
+        } else {
+            failed = ctx->orig_sector;
+            if (failed < block_start || failed >= block_start + nr)
+                continue;
         }
+        
+        /* An extent the re-read did not cover is remapped as before, unfilled */
+        data = block_start >= s->start && block_start + nr <= end ?
+               s->data + ((block_start - s->start) << SECTOR_SHIFT) : NULL;
+        if ((data && dm_remap_lost_outside(ctx, s->start, s->unit, s->lost, block_start, nr)) ||
+            !dm_remap_error_verdict(device, failed, error, false))
+            continue;
+        dm_remap_create_remap(device, failed, block_start, nr, ns_to_ktime(ctx->start_ns), data);
     }
     
-    /* Factor in consecutive errors */
-    if (health->consecutive_errors > 10) {
-        health_score -= 30;
-    } else if (health->consecutive_errors > 5) {
-        health_score -= 15;
-    }
-    
-    /* Factor in hotspot count */
-    if (health->hotspot_count > 20) {
-        health_score -= 25;
-    } else if (health->hotspot_count > 10) {
-        health_score -= 10;
+    i = (unsigned int)(ctx->orig_sector - s->start) / s->unit;
+    nr = (unsigned int)(ctx->orig_sector + ctx->nr_sectors - 1 - s->start) / s->unit + 1;
+    dm_remap_salvage_complete(ctx, find_next_bit(s->lost, nr, i) >= nr ?
+                              s->data + ((ctx->orig_sector - s->start) << SECTOR_SHIFT) : NULL);
+}
+
+/**
+ * dm_remap_salvage_commit_work() - Remap salvaged ranges
+ * 
+ * v4.3: Runs on the metadata workqueue, serialized with every other remap.
+ */
+static void dm_remap_salvage_commit_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device =
+        container_of(work, struct dm_remap_device_v4_real, salvage_commit_work);
+    struct dm_remap_io_scope scope;
+    struct dm_remap_salvage *s;
+    unsigned long flags;
+    
+    for (;;) {
+        spin_lock_irqsave(&device->remap_lock, flags);
+        s = list_first_entry_or_null(&device->salvage_commit_list,
+                                     struct dm_remap_salvage, list);
+        if (s)
+            list_del(&s->list);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        if (!s)
+            return;
+        dm_remap_io_enter(&device->ioclass, DM_REMAP_IOS_METADATA, &scope);
+        dm_remap_salvage_commit(device, s);
+        dm_remap_io_leave(&scope);
+        vfree(s->data);
+        kfree(s);
     }
+}
+
+/**
+ * struct dm_remap_verify - A write that did not read back
+ * @list: verify_fix_list linkage
+ * @ctx: The held bio
+ * @start: First sector of @data, target-relative
+ * @nr: Length of @data
+ * @unit: Sectors per bit of @lost
+ * @data: What the range should hold: the write over what was read back
+ * @lost: Units that could not be read back, zeroed in @data
+ */
+struct dm_remap_verify {
+    struct list_head list;
+    struct dm_remap_io_ctx *ctx;
+    sector_t start;
+    unsigned int nr;
+    unsigned int unit;
+    void *data;
+    unsigned long lost[];
+};
+
+/**
+ * dm_remap_verify_note_error() - Remember an error for DM_REMAP_VERIFY_ERRORS
+ */
+static void dm_remap_verify_note_error(struct dm_remap_device_v4_real *device,
+                                       sector_t sector)
+{
+    unsigned int slot;
+    unsigned long flags;
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    slot = device->verify_region_next++ % DM_REMAP_VERIFY_REGIONS;
+    WRITE_ONCE(device->verify_region[slot], sector);
+    WRITE_ONCE(device->verify_region_ns[slot], ktime_get_ns());
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+}
+
+/**
+ * dm_remap_verify_near_error() - Does a write land within verify_window of a recent error
+ * 
+ * Lockless; a slot being rewritten at the same time is at worst misjudged
+ * for one write.
+ */
+static bool dm_remap_verify_near_error(struct dm_remap_device_v4_real *device,
+                                       sector_t sector, unsigned int nr)
+{
+    sector_t window = READ_ONCE(device->tunables.verify_window), region;
+    u64 now = ktime_get_ns(), ns;
+    unsigned int slot;
     
-    /* Factor in response time degradation */
-    if (health->avg_response_time_ns > 10000000) { /* >10ms average */
-        health_score -= 20;
-    } else if (health->avg_response_time_ns > 1000000) { /* >1ms average */
-        health_score -= 10;
+    for (slot = 0; slot < DM_REMAP_VERIFY_REGIONS; slot++) {
+        ns = READ_ONCE(device->verify_region_ns[slot]);
+        if (!ns || now - ns > DM_REMAP_VERIFY_REGION_SECS * NSEC_PER_SEC)
+            continue;
+        region = READ_ONCE(device->verify_region[slot]);
+        if (sector < region + window + 1 && sector + nr + window > region)
+            return true;
     }
-    
-    health_score = max(health_score, 0U);
-    health->failure_prediction_score = health_score;
-    
-    mutex_unlock(&device->health_mutex);
-    
-    return health_score;
+    return false;
 }
 
 /**
- * dm_remap_health_scan_work() - Background health scanning
+ * dm_remap_verify_io() - Hold a completed write to read it back
+ * 
+ * v4.3: Called from bio completion for a successful write. Writes to the
+ * spare (DM_REMAP_VERIFY_REMAPPED) and writes near a recent main device
+ * error (DM_REMAP_VERIFY_ERRORS) are held until dm_remap_verify_work() has
+ * read them back; everything else completes at once. Returns false if the
+ * bio is not held.
  */
-static void dm_remap_health_scan_work(struct work_struct *work)
+static bool dm_remap_verify_io(struct dm_remap_device_v4_real *device, struct bio *bio,
+                               struct dm_remap_io_ctx *ctx)
 {
-    struct dm_remap_device_v4_real *device = 
-        container_of(work, struct dm_remap_device_v4_real, health_scan_work.work);
-    struct dm_remap_health_monitor *health = &device->health_monitor;
-    uint32_t health_score;
+    u32 mode = READ_ONCE(device->tunables.write_verify);
+    unsigned long flags;
+    
+    if (likely(!mode) || bio_op(bio) != REQ_OP_WRITE || !ctx->nr_sectors ||
+        !(ctx->flags & (DM_REMAP_IO_MAIN | DM_REMAP_IO_SPARE)) || bio_integrity(bio) ||
+        dm_remap_bio_is_atomic(bio) || ctx->nr_sectors > DM_REMAP_MAX_SALVAGE_SECTORS)
+        return false;
+    if (!((mode & DM_REMAP_VERIFY_REMAPPED) && (ctx->flags & DM_REMAP_IO_SPARE)) &&
+        !((mode & DM_REMAP_VERIFY_ERRORS) &&
+          dm_remap_verify_near_error(device, ctx->orig_sector, ctx->nr_sectors)))
+        return false;
+    
+    ctx->start_ns = ktime_get_ns();
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_add_tail(&ctx->list, &device->verify_list);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    queue_work(dm_remap_wq, &device->verify_work);
+    return true;
+}
+
+/**
+ * dm_remap_verify_complete() - Complete a held write with @status
+ * 
+ * The checksums of a spare write go out first.
+ */
+static void dm_remap_verify_complete(struct dm_remap_device_v4_real *device,
+                                     struct dm_remap_io_ctx *ctx, blk_status_t status)
+{
+    struct bio *bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
     
-    if (!atomic_read(&device->device_active)) {
+    if (status == BLK_STS_OK && (ctx->flags & DM_REMAP_IO_SPARE) && dm_remap_csum_flush(device))
+        status = BLK_STS_IOERR;
+    bio->bi_status = status;
+    ctx->flags |= DM_REMAP_IO_VERIFIED;
+    bio_endio(bio);
+}
+
+/**
+ * dm_remap_verify_merge() - Compare a write with what was read back, then copy it over
+ * 
+ * Returns true if @data already held the write.
+ */
+static bool dm_remap_verify_merge(struct dm_remap_io_ctx *ctx, void *data)
+{
+    struct bio *bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+    struct bvec_iter iter;
+    struct bio_vec bv;
+    bool same = true;
+    void *p;
+    
+    __bio_for_each_segment(bv, bio, iter, ctx->iter) {
+        p = bvec_kmap_local(&bv);
+        if (same && memcmp(data, p, bv.bv_len))
+            same = false;
+        memcpy(data, p, bv.bv_len);
+        kunmap_local(p);
+        data += bv.bv_len;
+    }
+    return same;
+}
+
+/**
+ * dm_remap_verify_read() - Read back @nr sectors of a held write's range
+ * @sector: Target-relative; a spare write is read at its spare sectors
+ */
+static int dm_remap_verify_read(struct dm_remap_device_v4_real *device,
+                                struct dm_remap_io_ctx *ctx, sector_t sector,
+                                void *data, unsigned int nr)
+{
+    if (ctx->flags & DM_REMAP_IO_SPARE)
+        return dm_remap_spare_io_sync(device, REQ_OP_READ | REQ_SYNC,
+                                      ctx->spare_sector + (sector - ctx->orig_sector), data, nr);
+    return dm_remap_sync_io(file_bdev(device->main_dev), REQ_OP_READ | REQ_SYNC,
+                            sector, data, nr);
+}
+
+/**
+ * dm_remap_verify_one() - Read back one held write
+ * 
+ * The device's write cache is flushed first, so the read-back comes from
+ * the media. A main device write is read back with the rest of its remap
+ * extents, so they can be remapped with their contents if it does not
+ * match. A spare write is read back as is. If the range cannot be read
+ * whole it is re-read a logical block at a time, and the blocks lost are
+ * zeroed and noted. On a match the write completes; otherwise it goes to
+ * dm_remap_verify_fix_work().
+ */
+static void dm_remap_verify_one(struct dm_remap_device_v4_real *device,
+                                struct dm_remap_io_ctx *ctx)
+{
+    bool spare = ctx->flags & DM_REMAP_IO_SPARE;
+    sector_t start = ctx->orig_sector, end;
+    unsigned int nr = ctx->nr_sectors, unit = device->block_sectors, units, i;
+    struct dm_remap_verify *v;
+    unsigned long flags;
+    void *data, *p;
+    int flush_ret, ret;
+    
+    if (!spare) {
+        dm_remap_remap_extent(device, ctx->orig_sector, &start);
+        nr = dm_remap_remap_extent(device, ctx->orig_sector + ctx->nr_sectors - 1, &end);
+        nr = end + nr - start;
+        if (nr > DM_REMAP_SALVAGE_MAX_RANGE) {
+            start = ctx->orig_sector;
+            nr = ctx->nr_sectors;
+        }
+    }
+    if (nr % unit)
+        unit = nr;
+    units = nr / unit;
+    
+    v = kzalloc(struct_size(v, lost, BITS_TO_LONGS(units)), GFP_NOIO);
+    data = v ? __vmalloc((size_t)nr << SECTOR_SHIFT, GFP_NOIO) : NULL;
+    if (!data) {
+        kfree(v);
+        DMR_WARN("Cannot verify write at sector %llu", (unsigned long long)ctx->orig_sector);
+        dm_remap_verify_complete(device, ctx, BLK_STS_OK);
         return;
     }
     
-    DMR_DEBUG(2, "Starting background health scan (progress: %llu/%llu)",
-              (unsigned long long)health->scan_progress,
-              (unsigned long long)device->main_device_sectors);
-    
-    mutex_lock(&device->health_mutex);
-    health->background_scan_active = true;
-    health->last_health_scan = ktime_to_ns(ktime_get_real());
-    mutex_unlock(&device->health_mutex);
-    
-    /* Calculate current health score */
-    health_score = dm_remap_calculate_health_score(device);
-    
-    /* Update scan progress */
-    mutex_lock(&device->health_mutex);
-    health->scan_progress += 1024; /* Scan 1024 sectors per iteration */
-    if (health->scan_progress >= device->main_device_sectors) {
-        health->scan_progress = 0; /* Restart scan */
-        atomic64_inc(&device->health_scan_count);
-        DMR_INFO("Health scan completed. Health score: %u/100, hotspots: %u",
-                 health_score, health->hotspot_count);
+    if (spare)
+        flush_ret = dm_remap_spare_io_sync(device, REQ_OP_WRITE | REQ_PREFLUSH | REQ_SYNC,
+                                           0, NULL, 0);
+    else
+        flush_ret = blkdev_issue_flush(file_bdev(device->main_dev));
+    ret = flush_ret ?: dm_remap_verify_read(device, ctx, start, data, nr);
+    if (ret) {
+        for (i = 0; i < units; i++) {
+            p = data + (((size_t)i * unit) << SECTOR_SHIFT);
+            if (units == 1 ||
+                dm_remap_verify_read(device, ctx, start + (sector_t)i * unit, p, unit)) {
+                memset(p, 0, (size_t)unit << SECTOR_SHIFT);
+                set_bit(i, v->lost);
+            }
+        }
     }
-    health->background_scan_active = false;
-    mutex_unlock(&device->health_mutex);
     
-    /* Schedule next scan */
-    if (atomic_read(&device->device_active)) {
-        schedule_delayed_work(&device->health_scan_work, 
-                             msecs_to_jiffies(health->scan_interval_seconds * 1000));
+    atomic64_inc(&device->verify_writes);
+    if (dm_remap_verify_merge(ctx, data + ((ctx->orig_sector - start) << SECTOR_SHIFT)) &&
+        bitmap_empty(v->lost, units) && !flush_ret) {
+        vfree(data);
+        kfree(v);
+        dm_remap_verify_complete(device, ctx, BLK_STS_OK);
+        return;
     }
+    
+    atomic64_inc(&device->verify_failed);
+    dm_remap_event_record(&device->events, DM_REMAP_EVENT_VERIFY, ctx->orig_sector,
+                          ctx->nr_sectors);
+    DMR_WARN("Write to %s sector %llu (+%u) %s", spare ? "remapped" : "main",
+             (unsigned long long)ctx->orig_sector, ctx->nr_sectors,
+             flush_ret ? "could not be flushed" :
+             bitmap_empty(v->lost, units) ? "read back different" : "could not be read back");
+    
+    v->ctx = ctx;
+    v->start = start;
+    v->nr = nr;
+    v->unit = unit;
+    v->data = data;
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_add_tail(&v->list, &device->verify_fix_list);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    queue_work(device->metadata_workqueue, &device->verify_fix_work);
 }
 
 /**
- * Phase 1.4: Performance Optimization Functions
+ * dm_remap_verify_work() - Read back held writes
+ * 
+ * v4.3: Runs on dm_remap_wq, like the read salvage, so read-backs never
+ * hold up the metadata workqueue.
  */
+static void dm_remap_verify_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device =
+        container_of(work, struct dm_remap_device_v4_real, verify_work);
+    struct dm_remap_io_scope scope;
+    struct dm_remap_io_ctx *ctx;
+    unsigned long flags;
+    
+    for (;;) {
+        spin_lock_irqsave(&device->remap_lock, flags);
+        ctx = list_first_entry_or_null(&device->verify_list, struct dm_remap_io_ctx, list);
+        if (ctx)
+            list_del_init(&ctx->list);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        if (!ctx)
+            return;
+        /* v4.3: The read-back is charged like the write */
+        dm_remap_io_enter_bio(dm_bio_from_per_bio_data(ctx, sizeof(*ctx)), &scope);
+        dm_remap_verify_one(device, ctx);
+        dm_remap_io_leave(&scope);
+    }
+}
 
 /**
- * dm_remap_cache_lookup() - Fast remap cache lookup
+ * dm_remap_evacuate() - Move remapped sectors to a new spare extent
+ * @device: Target device
+ * @sector: First sector, target-relative
+ * @nr: Number of sectors
+ * @data: Their contents
+ * 
+ * v4.3: The old spare sectors are abandoned; the bump allocator never
+ * frees. Metadata workqueue only.
  */
-static sector_t dm_remap_cache_lookup(struct dm_remap_device_v4_real *device,
-                                     sector_t original_sector)
+static int dm_remap_evacuate(struct dm_remap_device_v4_real *device, sector_t sector,
+                             unsigned int nr, void *data)
 {
-    struct dm_remap_perf_optimizer *perf = &device->perf_optimizer;
-    struct dm_remap_cache_entry *entry;
-    uint32_t cache_index;
-    sector_t result = 0;
-    
-    if (!perf->cache_entries || perf->cache_size == 0) {
-        atomic64_inc(&perf->cache_misses);
-        return 0;
-    }
-    
-    cache_index = original_sector & perf->cache_mask;
-    entry = &perf->cache_entries[cache_index];
-    
-    mutex_lock(&device->cache_mutex);
+    sector_t spare_sector;
+    unsigned long flags;
+    int ret;
     
-    if (entry->original_sector == original_sector) {
-        /* Cache hit */
-        entry->access_time = ktime_to_ns(ktime_get());
-        entry->access_count++;
-        result = entry->remapped_sector;
-        atomic64_inc(&perf->cache_hits);
-        atomic64_inc(&perf->fast_path_hits);
-    } else {
-        /* Cache miss */
-        atomic64_inc(&perf->cache_misses);
+    spin_lock_irqsave(&device->remap_lock, flags);
+    ret = dm_remap_alloc_spare_extent(device, nr, device->block_sectors, 0, &spare_sector);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    if (!ret)
+        ret = dm_remap_spare_io_sync(device, REQ_OP_WRITE | REQ_SYNC, spare_sector, data, nr);
+    if (!ret)
+        ret = dm_remap_csum_note(device, sector, spare_sector, data, nr);
+    if (!ret)
+        ret = dm_remap_switch_extent(device, sector, nr, spare_sector);
+    if (!ret)
+        ret = dm_remap_commit_metadata(device);
+    if (ret) {
+        DMR_ERROR("Failed to evacuate sectors %llu+%u (error=%d)",
+                  (unsigned long long)sector, nr, ret);
+        return ret;
     }
     
-    mutex_unlock(&device->cache_mutex);
-    
-    return result;
+    dm_remap_event_record(&device->events, DM_REMAP_EVENT_REMAP, sector, nr);
+    dm_table_event(device->ti->table);
+    DMR_INFO("Remapped sectors %llu+%u moved to spare sector %llu",
+             (unsigned long long)sector, nr, (unsigned long long)spare_sector);
+    return 0;
 }
 
 /**
- * dm_remap_cache_insert() - Insert entry into remap cache
+ * dm_remap_verify_lost() - Does an extent hold sectors neither read back nor written
+ * 
+ * Remapping it would replace them with zeros.
  */
-static void dm_remap_cache_insert(struct dm_remap_device_v4_real *device,
-                                 sector_t original_sector,
-                                 sector_t remapped_sector)
+static bool dm_remap_verify_lost(const struct dm_remap_verify *v, sector_t block_start,
+                                 unsigned int nr)
 {
-    struct dm_remap_perf_optimizer *perf = &device->perf_optimizer;
-    struct dm_remap_cache_entry *entry;
-    uint32_t cache_index;
-    
-    if (!perf->cache_entries || perf->cache_size == 0) {
+    return dm_remap_lost_outside(v->ctx, v->start, v->unit, v->lost, block_start, nr);
+}
+
+/**
+ * dm_remap_verify_fix() - Put a write that did not read back somewhere safe
+ * 
+ * A spare write is evacuated to a new spare extent. A main device write
+ * counts as a media error on each extent it touched; those the policy lets
+ * through are remapped, filled with the write and the rest of the extent.
+ * An extent with sectors outside the write that could not be read back is
+ * left alone. The write completes only if all of it is in place; otherwise
+ * it fails.
+ */
+static void dm_remap_verify_fix(struct dm_remap_device_v4_real *device,
+                                struct dm_remap_verify *v)
+{
+    struct dm_remap_io_ctx *ctx = v->ctx;
+    sector_t sector, block_start, failed, end = v->start + v->nr;
+    unsigned int nr;
+    void *data;
+    bool ok = true;
+    
+    if (ctx->flags & DM_REMAP_IO_SPARE) {
+        ok = !dm_remap_evacuate(device, ctx->orig_sector, ctx->nr_sectors, v->data);
+        if (ok)
+            atomic64_inc(&device->verify_evacuated);
+        dm_remap_verify_complete(device, ctx, ok ? BLK_STS_OK : BLK_STS_IOERR);
         return;
     }
     
-    cache_index = original_sector & perf->cache_mask;
-    entry = &perf->cache_entries[cache_index];
-    
-    mutex_lock(&device->cache_mutex);
-    
-    entry->original_sector = original_sector;
-    entry->remapped_sector = remapped_sector;
-    entry->access_time = ktime_to_ns(ktime_get());
-    entry->access_count = 1;
-    
-    mutex_unlock(&device->cache_mutex);
-    
-    DMR_DEBUG(3, "Cache entry inserted: %llu -> %llu (index %u)",
-              (unsigned long long)original_sector,
-              (unsigned long long)remapped_sector, cache_index);
+    for (sector = v->start; sector < end; sector = block_start + nr) {
+        nr = dm_remap_remap_extent(device, sector, &block_start);
+        failed = clamp_t(sector_t, sector, ctx->orig_sector,
+                         ctx->orig_sector + ctx->nr_sectors - 1);
+        data = block_start >= v->start && block_start + nr <= end ?
+               v->data + ((block_start - v->start) << SECTOR_SHIFT) : NULL;
+        if (!data || dm_remap_verify_lost(v, block_start, nr) ||
+            !dm_remap_error_verdict(device, failed, -EIO, true) ||
+            dm_remap_create_remap(device, failed, block_start, nr,
+                                  ns_to_ktime(ctx->start_ns), data)) {
+            ok = false;
+            continue;
+        }
+        atomic64_inc(&device->verify_remapped);
+    }
+    dm_remap_verify_complete(device, ctx, ok ? BLK_STS_OK : BLK_STS_IOERR);
 }
 
 /**
- * dm_remap_update_io_pattern() - Update I/O pattern analysis
+ * dm_remap_verify_fix_work() - Remap or evacuate writes that did not read back
+ * 
+ * v4.3: Runs on the metadata workqueue, serialized with every other remap.
  */
-static void dm_remap_update_io_pattern(struct dm_remap_device_v4_real *device,
-                                      sector_t sector)
+static void dm_remap_verify_fix_work(struct work_struct *work)
 {
-    struct dm_remap_perf_optimizer *perf = &device->perf_optimizer;
-    ktime_t current_time = ktime_get();
-    
-    mutex_lock(&device->cache_mutex);
-    
-    /* Check if this is sequential I/O */
-    if (perf->io_pattern.last_sector + 1 == sector) {
-        perf->io_pattern.sequential_count++;
-    } else {
-        perf->io_pattern.random_count++;
+    struct dm_remap_device_v4_real *device =
+        container_of(work, struct dm_remap_device_v4_real, verify_fix_work);
+    struct dm_remap_io_scope scope;
+    struct dm_remap_verify *v;
+    unsigned long flags;
+    
+    for (;;) {
+        spin_lock_irqsave(&device->remap_lock, flags);
+        v = list_first_entry_or_null(&device->verify_fix_list, struct dm_remap_verify, list);
+        if (v)
+            list_del(&v->list);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        if (!v)
+            return;
+        dm_remap_io_enter(&device->ioclass, DM_REMAP_IOS_METADATA, &scope);
+        dm_remap_verify_fix(device, v);
+        dm_remap_io_leave(&scope);
+        vfree(v->data);
+        kfree(v);
     }
+}
+
+/**
+ * dm_remap_csum_flush() - Write the dirty part of the checksum table to the spare
+ * 
+ * v4.3: Called before a spare write completes, so its record is on the
+ * spare by the time the write is acknowledged. Nothing is written until
+ * dm_remap_csum_setup() has placed the table. Process context only.
+ */
+static int dm_remap_csum_flush(struct dm_remap_device_v4_real *device)
+{
+    unsigned int first, nr;
+    int ret = 0;
     
-    perf->io_pattern.last_sector = sector;
+    if (!device->csum.records)
+        return 0;
     
-    /* Update pattern classification every 1000 I/Os */
-    if ((perf->io_pattern.sequential_count + perf->io_pattern.random_count) % 1000 == 0) {
-        perf->io_pattern.is_sequential_workload = 
-            (perf->io_pattern.sequential_count > perf->io_pattern.random_count);
-        
-        DMR_DEBUG(3, "I/O pattern: %s (seq: %u, rand: %u)",
-                  perf->io_pattern.is_sequential_workload ? "sequential" : "random",
-                  perf->io_pattern.sequential_count, perf->io_pattern.random_count);
+    mutex_lock(&device->csum_mutex);
+    while (device->csum_area &&
+           (nr = dm_remap_csum_take_dirty(&device->csum, device->csum_buf, &first))) {
+        ret = dm_remap_spare_io_sync(device, REQ_OP_WRITE | REQ_SYNC, device->csum_area + first,
+                                     device->csum_buf + ((size_t)first << SECTOR_SHIFT), nr);
+        if (ret) {
+            dm_remap_csum_mark_dirty(&device->csum, first, nr);
+            DMR_ERROR("Failed to write checksum records at spare sector %llu (error=%d)",
+                      (unsigned long long)(device->csum_area + first), ret);
+            break;
+        }
     }
+    mutex_unlock(&device->csum_mutex);
+    return ret;
+}
+
+/**
+ * dm_remap_csum_note() - Record data the target wrote to the spare itself
+ * 
+ * Salvaged and evacuated extents; their records are written before the
+ * remap table that points at them.
+ */
+static int dm_remap_csum_note(struct dm_remap_device_v4_real *device, sector_t sector,
+                              sector_t spare_sector, const void *data, unsigned int nr)
+{
+    if (READ_ONCE(device->csum_state) == DM_REMAP_CSUM_OFF)
+        return 0;
+    dm_remap_csum_record_buf(&device->csum, sector, spare_sector, data, nr, true);
+    return dm_remap_csum_flush(device);
+}
+
+/**
+ * dm_remap_csum_io() - Record or check the checksums of a completed spare bio
+ * 
+ * v4.3: Called from bio completion. Writes are recorded from the moment
+ * checksums are turned on, reads are checked once the table has been set
+ * up. A read that does not match fails with BLK_STS_IOERR: remapped data
+ * has no second copy to fall back to, and the main device sector it
+ * replaced is the one that failed. Staged atomic writes are recorded when
+ * they are committed.
+ */
+static void dm_remap_csum_io(struct dm_remap_device_v4_real *device, struct bio *bio,
+                             struct dm_remap_io_ctx *ctx, blk_status_t *error)
+{
+    int state = READ_ONCE(device->csum_state);
+    bool write = op_is_write(bio_op(bio));
+    unsigned int bad;
     
-    perf->io_pattern.pattern_update_time = current_time;
+    if (likely(state == DM_REMAP_CSUM_OFF) || !(ctx->flags & DM_REMAP_IO_SPARE) ||
+        (ctx->flags & DM_REMAP_IO_STAGED) || !ctx->nr_sectors || !bio_has_data(bio) ||
+        (!write && state != DM_REMAP_CSUM_ON))
+        return;
     
-    mutex_unlock(&device->cache_mutex);
+    bad = dm_remap_csum_bio(&device->csum, bio, ctx->iter, ctx->orig_sector,
+                            ctx->spare_sector, write);
+    if (likely(!bad))
+        return;
+    
+    *error = BLK_STS_IOERR;
+    dm_remap_event_record(&device->events, DM_REMAP_EVENT_CHECKSUM, ctx->orig_sector,
+                          ctx->nr_sectors);
+    DMR_WARN("Checksum mismatch reading remapped sector %llu (+%u) from spare sector %llu: "
+             "%u sectors bad", (unsigned long long)ctx->orig_sector, ctx->nr_sectors,
+             (unsigned long long)ctx->spare_sector, bad);
 }
 
 /**
- * dm_remap_validate_device_compatibility() - Enhanced device compatibility checking
+ * dm_remap_csum_hold() - Hold a completed spare write until its records are written
+ * 
+ * Returns false if the bio is not held.
  */
-static int dm_remap_validate_device_compatibility(struct file *main_dev, 
-                                                 struct file *spare_dev)
+static bool dm_remap_csum_hold(struct dm_remap_device_v4_real *device, struct bio *bio,
+                               struct dm_remap_io_ctx *ctx)
 {
-    sector_t main_size, spare_size;
-    unsigned int main_sector_size, spare_sector_size;
-    unsigned int main_physical_size, spare_physical_size;
-    u64 main_capacity, spare_capacity;
-    sector_t min_spare_size;
+    unsigned long flags;
+    
+    if (likely(READ_ONCE(device->csum_state) == DM_REMAP_CSUM_OFF) ||
+        !(ctx->flags & DM_REMAP_IO_SPARE) || bio_op(bio) != REQ_OP_WRITE || !ctx->nr_sectors)
+        return false;
+    
+    ctx->start_ns = ktime_get_ns();
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_add_tail(&ctx->list, &device->csum_list);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    queue_work(dm_remap_wq, &device->csum_work);
+    return true;
+}
+
+/**
+ * dm_remap_csum_work() - Write out checksum records and complete the held writes
+ * 
+ * v4.3: All writes held since the last run share the table writes; records
+ * in the same table sector go out once.
+ */
+static void dm_remap_csum_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device =
+        container_of(work, struct dm_remap_device_v4_real, csum_work);
+    struct dm_remap_io_ctx *ctx, *tmp;
+    struct dm_remap_io_scope scope;
+    blk_status_t status;
+    struct bio *bio;
+    unsigned long flags;
+    LIST_HEAD(batch);
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_splice_init(&device->csum_list, &batch);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    if (list_empty(&batch))
+        return;
     
-    if (!main_dev || IS_ERR(main_dev) || !spare_dev || IS_ERR(spare_dev)) {
-        return -EINVAL;
+    dm_remap_io_enter(&device->ioclass, DM_REMAP_IOS_METADATA, &scope);
+    status = dm_remap_csum_flush(device) ? BLK_STS_IOERR : BLK_STS_OK;
+    dm_remap_io_leave(&scope);
+    list_for_each_entry_safe(ctx, tmp, &batch, list) {
+        list_del_init(&ctx->list);
+        ctx->flags |= DM_REMAP_IO_CSUM;
+        bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+        bio->bi_status = status;
+        bio_endio(bio);
     }
-    
-    /* Get device sizes in sectors */
-    main_size = dm_remap_get_device_size(main_dev);
-    spare_size = dm_remap_get_device_size(spare_dev);
-    
+}
+
+/* The checksum table location in the metadata expansion area */
+static inline struct dm_remap_v4_csum_info *dm_remap_csum_info(struct dm_remap_device_v4_real *device)
+{
+    return (struct dm_remap_v4_csum_info *)device->persistent_metadata->future_expansion.expansion_data;
+}
+
+/**
+ * dm_remap_csum_placed() - Does the metadata place a checksum table we can use
+ * 
+ * It must lie in spare space already handed out, so nothing else is there.
+ */
+static bool dm_remap_csum_placed(struct dm_remap_device_v4_real *device)
+{
+    const struct dm_remap_v4_csum_info *info = dm_remap_csum_info(device);
+    
+    return (device->persistent_metadata->future_expansion.expansion_version &
+            DM_REMAP_V4_EXPANSION_CSUM) &&
+           info->slots == DM_REMAP_V4_CSUM_SLOTS &&
+           info->area_sector >= DM_REMAP_V4_SPARE_DATA_START &&
+           info->area_sector + DM_REMAP_V4_CSUM_AREA_SECTORS <= device->next_spare_sector;
+}
+
+/**
+ * dm_remap_csum_read_table() - Load the checksum table from the spare
+ * 
+ * Only records for a current remap at the same spare sector are kept.
+ */
+static int dm_remap_csum_read_table(struct dm_remap_device_v4_real *device, sector_t area)
+{
+    struct dm_remap_v4_csum_record *records;
+    struct dm_remap_entry_v4 *entry;
+    unsigned int i, loaded = 0, stale = 0;
+    unsigned long flags;
+    bool keep;
+    int ret;
+    
+    records = vmalloc(DM_REMAP_V4_CSUM_AREA_SECTORS << SECTOR_SHIFT);
+    if (!records)
+        return -ENOMEM;
+    
+    ret = dm_remap_spare_io_sync(device, REQ_OP_READ | REQ_SYNC, area, records,
+                                 DM_REMAP_V4_CSUM_AREA_SECTORS);
+    for (i = 0; !ret && i < DM_REMAP_V4_CSUM_SLOTS; i++) {
+        if (!records[i].spare_sector)
+            continue;
+        spin_lock_irqsave(&device->remap_lock, flags);
+        entry = dm_remap_find_remap_entry(device, records[i].original_sector);
+        keep = entry && entry->spare_sector == records[i].spare_sector;
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        if (keep && dm_remap_csum_load(&device->csum, &records[i]))
+            loaded++;
+        else
+            stale++;
+    }
+    vfree(records);
+    
+    if (!ret)
+        DMR_INFO("Loaded %u checksum records from spare sector %llu (%u stale)",
+                 loaded, (unsigned long long)area, stale);
+    return ret;
+}
+
+/**
+ * dm_remap_csum_rebuild() - Checksum every remapped sector as it is now
+ * 
+ * Runs of remaps contiguous on both devices are read together. Sectors
+ * written meanwhile keep the record their write made.
+ */
+static int dm_remap_csum_rebuild(struct dm_remap_device_v4_real *device)
+{
+    struct dm_remap_entry_v4 *entry, *next_entry;
+    sector_t next = 0, start, spare;
+    unsigned int nr, runs = 0;
+    unsigned long flags;
+    void *data;
+    int ret;
+    
+    data = vmalloc(DM_REMAP_V4_CSUM_AREA_SECTORS << SECTOR_SHIFT);
+    if (!data)
+        return -ENOMEM;
+    
+    for (;;) {
+        spin_lock_irqsave(&device->remap_lock, flags);
+        for (entry = dm_remap_index_ceil(device, next);
+             entry && (entry->flags & (DM_REMAP_FLAG_PENDING | DM_REMAP_FLAG_ZERO |
+                                       DM_REMAP_FLAG_COMPRESSED));
+             entry = dm_remap_index_next(entry))
+            ;
+        if (!entry) {
+            spin_unlock_irqrestore(&device->remap_lock, flags);
+            break;
+        }
+        start = entry->original_sector;
+        spare = entry->spare_sector;
+        for (nr = 1; nr < DM_REMAP_V4_CSUM_AREA_SECTORS; nr++) {
+            next_entry = dm_remap_index_next(entry);
+            if (!next_entry || next_entry->original_sector != start + nr ||
+                next_entry->spare_sector != spare + nr ||
+                (next_entry->flags & (DM_REMAP_FLAG_PENDING | DM_REMAP_FLAG_ZERO |
+                                      DM_REMAP_FLAG_COMPRESSED)))
+                break;
+            entry = next_entry;
+        }
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        
+        ret = dm_remap_spare_io_sync(device, REQ_OP_READ | REQ_SYNC, spare, data, nr);
+        if (ret)
+            DMR_WARN("Cannot read remapped sectors %llu+%u to checksum them (error=%d)",
+                     (unsigned long long)start, nr, ret);
+        else
+            dm_remap_csum_record_buf(&device->csum, start, spare, data, nr, false);
+        next = start + nr;
+        runs++;
+    }
+    vfree(data);
+    
+    DMR_INFO("Checksummed %u runs of remapped sectors", runs);
+    return 0;
+}
+
+/**
+ * dm_remap_csum_enable() - Start recording spare writes
+ * 
+ * Allocates the table on first use and starts it empty; reads are only
+ * checked once dm_remap_csum_setup() has filled it.
+ */
+static int dm_remap_csum_enable(struct dm_remap_device_v4_real *device)
+{
+    int ret;
+    
+    if (!device->csum.records) {
+        device->csum_buf = vmalloc(DM_REMAP_V4_CSUM_AREA_SECTORS << SECTOR_SHIFT);
+        if (!device->csum_buf)
+            return -ENOMEM;
+        ret = dm_remap_csum_init(&device->csum);
+        if (ret) {
+            vfree(device->csum_buf);
+            device->csum_buf = NULL;
+            return ret;
+        }
+    }
+    
+    if (READ_ONCE(device->csum_state) == DM_REMAP_CSUM_OFF) {
+        dm_remap_csum_reset(&device->csum);
+        WRITE_ONCE(device->csum_state, DM_REMAP_CSUM_TRACK);
+    }
+    return 0;
+}
+
+/**
+ * dm_remap_csum_setup() - Bring the checksum table in line with data_checksums
+ * 
+ * v4.3: Turning checksums on places the table in the spare data area if
+ * the metadata has none, then loads it if the last writer kept it up to
+ * date (DM_REMAP_V4_CSUM_VALID) and otherwise rebuilds it from the data as
+ * it is now. The compacted table is written back before VALID is
+ * committed, and only then are reads checked. Turning checksums off clears
+ * VALID before writes stop being recorded, so a table that fell behind is
+ * never trusted later.
+ * 
+ * Runs before the first resume, or on the metadata workqueue serialized
+ * with remap creation. Returns 0 or an allocation, I/O or commit error.
+ */
+static int dm_remap_csum_setup(struct dm_remap_device_v4_real *device)
+{
+    struct dm_remap_v4_csum_info *info;
+    sector_t area;
+    unsigned long flags;
+    bool valid;
+    int ret = 0;
+    
+    if (!device->spare_dev || !device->persistent_metadata)
+        return 0;
+    
+    info = dm_remap_csum_info(device);
+    mutex_lock(&device->metadata_mutex);
+    valid = dm_remap_csum_placed(device) && (info->flags & DM_REMAP_V4_CSUM_VALID);
+    area = dm_remap_csum_placed(device) ? info->area_sector : 0;
+    mutex_unlock(&device->metadata_mutex);
+    
+    if (!READ_ONCE(device->tunables.data_checksums)) {
+        if (valid) {
+            mutex_lock(&device->metadata_mutex);
+            info->flags &= ~DM_REMAP_V4_CSUM_VALID;
+            mutex_unlock(&device->metadata_mutex);
+            ret = dm_remap_commit_metadata(device);
+        }
+        if (!ret && !READ_ONCE(device->tunables.data_checksums))
+            WRITE_ONCE(device->csum_state, DM_REMAP_CSUM_OFF);
+        return ret;
+    }
+    
+    if (READ_ONCE(device->csum_state) == DM_REMAP_CSUM_ON)
+        return 0;
+    
+    if (!area) {
+        spin_lock_irqsave(&device->remap_lock, flags);
+        ret = dm_remap_alloc_spare_extent(device, DM_REMAP_V4_CSUM_AREA_SECTORS,
+                                          PAGE_SIZE >> SECTOR_SHIFT, 0, &area);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        if (ret) {
+            DMR_ERROR("No spare space for the checksum table");
+            return ret;
+        }
+    }
+    
+    if (!valid || dm_remap_csum_read_table(device, area))
+        dm_remap_csum_rebuild(device);
+    
+    mutex_lock(&device->csum_mutex);
+    device->csum_area = area;
+    mutex_unlock(&device->csum_mutex);
+    ret = dm_remap_csum_flush(device);
+    if (ret)
+        return ret;
+    
+    mutex_lock(&device->metadata_mutex);
+    device->persistent_metadata->future_expansion.expansion_version |= DM_REMAP_V4_EXPANSION_CSUM;
+    device->persistent_metadata->future_expansion.expansion_size =
+        max_t(u32, device->persistent_metadata->future_expansion.expansion_size, sizeof(*info));
+    info->area_sector = area;
+    info->flags = DM_REMAP_V4_CSUM_VALID;
+    info->slots = DM_REMAP_V4_CSUM_SLOTS;
+    mutex_unlock(&device->metadata_mutex);
+    ret = dm_remap_commit_metadata(device);
+    if (ret)
+        return ret;
+    
+    if (READ_ONCE(device->tunables.data_checksums))
+        WRITE_ONCE(device->csum_state, DM_REMAP_CSUM_ON);
+    DMR_INFO("Data checksums on, table at spare sector %llu", (unsigned long long)area);
+    return 0;
+}
+
+static void dm_remap_csum_setup_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device =
+        container_of(work, struct dm_remap_device_v4_real, csum_setup_work);
+    struct dm_remap_io_scope scope;
+    int ret;
+    
+    dm_remap_io_enter(&device->ioclass, DM_REMAP_IOS_METADATA, &scope);
+    ret = dm_remap_csum_setup(device);
+    dm_remap_io_leave(&scope);
+    if (ret)
+        DMR_ERROR("Data checksum setup failed: %d", ret);
+}
+
+static void dm_remap_error_stats_reset(struct dm_remap_device_v4_real *device)
+{
+    unsigned int class;
+    
+    for (class = 0; class < DM_REMAP_NR_ERROR_CLASSES; class++)
+        atomic64_set(&device->error_class_count[class], 0);
+    atomic64_set(&device->retries_issued, 0);
+    atomic64_set(&device->retries_recovered, 0);
+    atomic64_set(&device->retries_exhausted, 0);
+    atomic64_set(&device->correlated_errors, 0);
+    atomic64_set(&device->salvage_transient, 0);
+    atomic64_set(&device->salvage_hard, 0);
+    atomic64_set(&device->salvage_recovered_sectors, 0);
+    atomic64_set(&device->salvage_lost_sectors, 0);
+    atomic64_set(&device->verify_writes, 0);
+    atomic64_set(&device->verify_failed, 0);
+    atomic64_set(&device->verify_remapped, 0);
+    atomic64_set(&device->verify_evacuated, 0);
+}
+
+/**
+ * dm_remap_metadata_thread() - Kernel thread for metadata writes (v4.2.2)
+ * 
+ * This dedicated kernel thread handles all metadata write operations.
+ * Running in process context allows safe page allocation and synchronous I/O.
+ * 
+ * Why kernel thread instead of workqueue:
+ * - Workqueue context doesn't support kmap() operations
+ * - Need full process context for page operations
+ * - Can safely do synchronous I/O without deadlock
+ */
+static int dm_remap_metadata_thread(void *data)
+{
+    struct dm_remap_device_v4_real *device = data;
+    struct block_device * __maybe_unused bdev;
+    struct dm_remap_io_scope scope;
+    int ret;
+    
+    DMR_INFO("Metadata write thread started");
+    
+    while (!kthread_should_stop()) {
+        /* Wait for metadata write request or stop signal */
+        wait_event_interruptible(device->metadata_wait_queue,
+                                 atomic_read(&device->metadata_write_requested) ||
+                                 kthread_should_stop());
+        
+        if (kthread_should_stop())
+            break;
+        
+        /* Clear the request flag */
+        if (!atomic_cmpxchg(&device->metadata_write_requested, 1, 0))
+            continue;
+        
+        /* Check if device is still active */
+        if (!atomic_read(&device->device_active)) {
+            DMR_DEBUG(2, "Metadata write skipped - device inactive");
+            continue;
+        }
+        
+        /* Perform metadata write in safe thread context */
+        mutex_lock(&device->metadata_mutex);
+        
+        if (!device->metadata_dirty || !device->persistent_metadata || !device->spare_dev) {
+            mutex_unlock(&device->metadata_mutex);
+            continue;
+        }
+        dm_remap_io_enter(&device->ioclass, DM_REMAP_IOS_METADATA, &scope);
+        
+        /* Update metadata */
+        device->metadata.last_update = ktime_to_ns(ktime_get_real());
+        device->metadata.sequence_number++;
+        device->metadata.metadata_crc = 0;
+        device->metadata.metadata_crc = dm_remap_calculate_crc32(&device->metadata,
+                                                                 sizeof(device->metadata));
+        
+        /* Sync to persistent metadata */
+        dm_remap_sync_persistent_metadata(device);
+        
+        /* Write metadata using dm-bufio (safe, no page allocation) */
+        if (device->metadata_bufio_client) {
+            /* v4.3: commit_policy=sync also waits for the copies to be flushed */
+            if (READ_ONCE(device->tunables.commit_policy) == DM_REMAP_COMMIT_SYNC) {
+                u64 io_start = dm_remap_meta_io_start(device, DM_REMAP_V4_REDUNDANT_COPIES);
+                
+                ret = dm_remap_write_metadata_v4_sync(device->metadata_bufio_client,
+                                                      device->persistent_metadata);
+                dm_remap_meta_io_end(device, DM_REMAP_V4_REDUNDANT_COPIES, io_start);
+                if (!ret)
+                    dm_remap_spare_committed(device);
+            } else {
+                ret = dm_remap_write_metadata_v4_async(device->metadata_bufio_client,
+                                                      device->persistent_metadata,
+                                                      NULL);  /* NULL = fire-and-forget */
+            }
+            
+            if (ret) {
+                DMR_ERROR("Metadata write via dm-bufio failed: %d", ret);
+            } else {
+                device->metadata_dirty = false;
+                dm_remap_pipeline_metadata_write(&device->pipeline,
+                                                 DM_REMAP_METADATA_WRITE_BYTES);
+                DMR_DEBUG(2, "Metadata written via dm-bufio (seq: %llu, %u remaps)",
+                     device->metadata.sequence_number,
+                     device->persistent_metadata->remap_data.active_remaps);
+            }
+        }
+        
+        dm_remap_io_leave(&scope);
+        mutex_unlock(&device->metadata_mutex);
+    }
+    
+    DMR_INFO("Metadata write thread stopped");
+    return 0;
+}
+
+/**
+ * dm_remap_request_metadata_write() - Request metadata write from thread
+ * 
+ * Called from any context to request metadata write.
+ * Thread-safe, non-blocking. v4.3: Ignored on a read-only target.
+ */
+static void dm_remap_request_metadata_write(struct dm_remap_device_v4_real *device)
+{
+    if (device->read_only)
+        return;
+    atomic_set(&device->metadata_write_requested, 1);
+    wake_up(&device->metadata_wait_queue);
+}
+
+/**
+ * dm_remap_sync_metadata_work() - Background metadata synchronization (v4.2.2)
+ * 
+ * Now just requests the kernel thread to write metadata instead of doing it directly.
+ */
+static void dm_remap_sync_metadata_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device = 
+        container_of(work, struct dm_remap_device_v4_real, metadata_sync_work);
+    
+    /* CRITICAL: Check if device is being destroyed BEFORE doing ANY work */
+    if (!atomic_read(&device->device_active)) {
+        DMR_DEBUG(2, "Metadata sync skipped - device inactive");
+        return;
+    }
+    
+    if (!device->metadata_dirty) {
+        return;
+    }
+    
+    DMR_DEBUG(2, "Requesting metadata write via kernel thread");
+    dm_remap_request_metadata_write(device);
+}
+
+/**
+ * dm_remap_error_analysis_work() - Deferred error pattern analysis
+ * 
+ * This work function performs error pattern analysis in a safe context where
+ * mutexes can be taken. It's called from a workqueue instead of from I/O
+ * completion context to avoid deadlocks.
+ */
+static void dm_remap_error_analysis_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device = 
+        container_of(work, struct dm_remap_device_v4_real, error_analysis_work);
+    sector_t failed_sector;
+    unsigned long flags;
+    
+    /* Get the pending error sector */
+    spin_lock_irqsave(&device->remap_lock, flags);
+    failed_sector = device->pending_error_sector;
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    /* Now safe to call mutex-taking function */
+    dm_remap_analyze_error_pattern(device, failed_sector);
+}
+
+/**
+ * dm_remap_main_resized() - Record a table length that differs from the metadata
+ * 
+ * v4.3: The remap table was restored for the new length. After a shrink
+ * the entries beyond the end are gone from the index, and the spare
+ * allocator is moved back to just past the highest spare sector still in
+ * use. The new length is committed before I/O starts.
+ */
+static int dm_remap_main_resized(struct dm_remap_device_v4_real *device)
+{
+    struct dm_remap_metadata_v4 *pm = device->persistent_metadata;
+    sector_t old_sectors = pm->device_config.main_device_sectors;
+    sector_t end = DM_REMAP_V4_SPARE_DATA_START, old_next;
+    struct dm_remap_entry_v4 *entry;
+    unsigned int dropped = 0;
+    unsigned long flags;
+    
+    if (device->main_device_sectors < old_sectors)
+        dropped = dm_remap_remaps_beyond(device, device->main_device_sectors);
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    old_next = device->next_spare_sector;
+    if (dropped) {
+        list_for_each_entry(entry, &device->remap_list, list) {
+            if (dm_remap_entry_spare_len(entry->flags))
+                end = max_t(sector_t, end, entry->spare_sector +
+                                           dm_remap_entry_spare_len(entry->flags));
+        }
+        device->next_spare_sector = end;
+        if (old_next > end)
+            dm_remap_freelist_claim(&device->spare_free, end, old_next - end);
+    }
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    DMR_INFO("Main device resized from %llu to %llu sectors (%u remaps dropped, "
+             "%llu spare sectors reclaimed)",
+             (unsigned long long)old_sectors, (unsigned long long)device->main_device_sectors,
+             dropped, (unsigned long long)(old_next - device->next_spare_sector));
+    
+    mutex_lock(&device->metadata_mutex);
+    pm->device_config.main_device_sectors = device->main_device_sectors;
+    mutex_unlock(&device->metadata_mutex);
+    device->metadata.main_device_size = device->main_device_sectors;
+    
+    return dm_remap_commit_metadata(device);
+}
+
+/**
+ * dm_remap_load_metadata() - Read the metadata and build the remap index
+ * 
+ * v4.3: Run from preresume before the first I/O, so a table that replaced
+ * another one (a reload with a new length) sees the remaps committed at
+ * its postsuspend. Returns -EBUSY, with nothing loaded, if a shorter
+ * table would lose remaps and shrink_policy is "refuse", and -EIO if
+ * metadata found on the spare could not be moved to the metadata device.
+ */
+static int dm_remap_load_metadata(struct dm_remap_device_v4_real *device)
+{
+    int ret;
+    
+    /* Check if already loaded (double-check pattern) */
+    if (atomic_read(&device->metadata_loaded))
+        return 0;
+    
+    DMR_INFO("Loading persistent metadata (deferred read)...");
+    
+    /* Call the read function which now includes auto-repair */
+    ret = dm_remap_read_persistent_metadata(device);
+    if (ret == -EBUSY || ret == -EIO)
+        return ret;
+    
+    /* v4.3: Read-only: the table as found, nothing set up or written back */
+    if (device->read_only) {
+        if (ret)
+            DMR_WARN("No valid metadata found, presenting the main device as is: %d", ret);
+        goto loaded;
+    }
+    
+    if (ret != 0) {
+        /* ret < 0: Error reading, ret > 0: not used
+         * In either case, no valid metadata found - write initial state */
+        DMR_WARN("No valid metadata found, starting fresh: %d", ret);
+        
+        /* v4.2 Data Safety: Write initial metadata using fire-and-forget
+         * This creates the 5-copy redundant metadata structure on first boot.
+         * We don't wait for completion (safe in workqueue context but not needed).
+         * Critical remaps use write-ahead, this is just initial setup. */
+        
+        printk(KERN_INFO "dm-remap: INITIAL METADATA WRITE PATH (no valid metadata found)\n");
+        
+        /* Mark metadata as dirty and request write via kernel thread */
+        device->metadata_dirty = true;
+        dm_remap_request_metadata_write(device);
+        DMR_INFO("Initial metadata write requested via kernel thread");
+    } else {
+        DMR_INFO("Deferred metadata read completed successfully");
+        
+        /* v4.3: Record a spare that was resized while inactive */
+        mutex_lock(&device->metadata_mutex);
+        if (device->persistent_metadata->device_config.spare_device_sectors !=
+            device->spare_device_sectors) {
+            DMR_INFO("Spare device size changed from %llu to %llu sectors",
+                     (unsigned long long)device->persistent_metadata->device_config.spare_device_sectors,
+                     (unsigned long long)device->spare_device_sectors);
+            device->persistent_metadata->device_config.spare_device_sectors =
+                device->spare_device_sectors;
+            device->metadata_dirty = true;
+        }
+        mutex_unlock(&device->metadata_mutex);
+        
+        /* v4.3: ... and a table reloaded with a new length */
+        if (device->persistent_metadata->device_config.main_device_sectors !=
+                device->main_device_sectors &&
+            dm_remap_main_resized(device))
+            DMR_WARN("Failed to commit the new main device size, retrying in background");
+        
+        if (device->metadata_dirty)
+            dm_remap_request_metadata_write(device);
+    }
+    
+    /* v4.3: Load or rebuild the checksum table, or retire a stale one */
+    if (device->tunables.data_checksums && dm_remap_csum_enable(device))
+        DMR_WARN("No memory for data checksums, not recording them");
+    else if (dm_remap_csum_setup(device))
+        DMR_WARN("Data checksum setup failed, reads are not checked");
+    
+    /* v4.3: ... and carry on with a flatten an earlier table left running */
+    dm_remap_flatten_load(device);
+    
+loaded:
+    printk(KERN_INFO "dm-remap: Setting metadata_loaded=1\n");
+    atomic_set(&device->metadata_loaded, 1);
+    printk(KERN_INFO "dm-remap: Deferred metadata read work COMPLETE\n");
+    return 0;
+}
+
+/**
+ * dm_remap_deferred_metadata_read_work() - v4.2: Read metadata after construction
+ * 
+ * This work function safely reads metadata from the spare device after the
+ * dm-target constructor has completed. This avoids constructor deadlocks while
+ * still enabling metadata persistence and auto-repair functionality.
+ * 
+ * v4.3: Only used in demo mode and when preresume could not load it.
+ */
+static void dm_remap_deferred_metadata_read_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device = 
+        container_of(to_delayed_work(work), struct dm_remap_device_v4_real, 
+                     deferred_metadata_read_work);
+    struct dm_remap_io_scope scope;
+    
+    dm_remap_io_enter(&device->ioclass, DM_REMAP_IOS_METADATA, &scope);
+    dm_remap_load_metadata(device);
+    dm_remap_io_leave(&scope);
+}
+
+/**
+ * Phase 1.4: Health Monitoring Functions
+ */
+
+/**
+ * dm_remap_analyze_error_pattern() - Analyze sector error patterns
+ */
+static void dm_remap_analyze_error_pattern(struct dm_remap_device_v4_real *device,
+                                          sector_t failed_sector)
+{
+    struct dm_remap_health_monitor *health = &device->health_monitor;
+    struct dm_remap_error_pattern *pattern = NULL;
+    uint64_t current_time = ktime_to_ns(ktime_get_real());
+    int i;
+    
+    mutex_lock(&device->health_mutex);
+    
+    /* Find existing pattern for this sector */
+    for (i = 0; i < health->hotspot_count && i < 32; i++) {
+        if (health->error_hotspots[i].sector == failed_sector) {
+            pattern = &health->error_hotspots[i];
+            break;
+        }
+    }
+    
+    /* Create new pattern if not found */
+    if (!pattern && health->hotspot_count < 32) {
+        pattern = &health->error_hotspots[health->hotspot_count++];
+        pattern->sector = failed_sector;
+        pattern->error_count = 0;
+        pattern->first_error_time = current_time;
+        pattern->pattern_flags = 0;
+    }
+    
+    if (pattern) {
+        pattern->error_count++;
+        pattern->last_error_time = current_time;
+        
+        /* Analyze error frequency */
+        uint64_t time_span = current_time - pattern->first_error_time;
+        if (time_span > 0) {
+            uint64_t error_rate = pattern->error_count * 1000000000ULL / time_span;
+            if (error_rate > 100) { /* More than 100 errors per second */
+                pattern->pattern_flags |= 0x01; /* Mark as high-frequency error */
+            }
+        }
+        
+        DMR_DEBUG(2, "Error pattern updated: sector %llu, count %u, rate flags 0x%x",
+                  (unsigned long long)failed_sector, pattern->error_count,
+                  pattern->pattern_flags);
+    }
+    
+    /* Update consecutive error tracking */
+    if (health->last_error_sector == failed_sector) {
+        health->consecutive_errors++;
+    } else {
+        health->consecutive_errors = 1;
+        health->last_error_sector = failed_sector;
+    }
+    
+    /* Update health prediction score based on error patterns */
+    if (health->consecutive_errors > DM_REMAP_PREDICT_CONSECUTIVE) {
+        health->failure_prediction_score = min(health->failure_prediction_score +
+                                               DM_REMAP_PREDICT_STEP, 100U);
+        atomic64_inc(&device->active_predictions);
+    }
+    
+    mutex_unlock(&device->health_mutex);
+}
+
+/**
+ * dm_remap_note_slow_region() - Record a main device bio the watchdog caught
+ * 
+ * v4.3: Its sector becomes a hotspot flagged slow (0x02) without counting
+ * as an error, and timeout_count feeds the health score.
+ */
+static void dm_remap_note_slow_region(struct dm_remap_device_v4_real *device,
+                                      sector_t sector)
+{
+    struct dm_remap_health_monitor *health = &device->health_monitor;
+    struct dm_remap_error_pattern *pattern = NULL;
+    uint64_t current_time = ktime_to_ns(ktime_get_real());
+    int i;
+    
+    mutex_lock(&device->health_mutex);
+    
+    for (i = 0; i < health->hotspot_count && i < 32; i++) {
+        if (health->error_hotspots[i].sector == sector) {
+            pattern = &health->error_hotspots[i];
+            break;
+        }
+    }
+    
+    if (!pattern && health->hotspot_count < 32) {
+        pattern = &health->error_hotspots[health->hotspot_count++];
+        pattern->sector = sector;
+        pattern->error_count = 0;
+        pattern->first_error_time = current_time;
+        pattern->pattern_flags = 0;
+    }
+    
+    if (pattern) {
+        pattern->last_error_time = current_time;
+        pattern->pattern_flags |= 0x02; /* Mark as slow region */
+    }
+    
+    health->timeout_count++;
+    
+    mutex_unlock(&device->health_mutex);
+}
+
+/**
+ * dm_remap_calculate_health_score() - Calculate overall device health
+ */
+static uint32_t dm_remap_calculate_health_score(struct dm_remap_device_v4_real *device)
+{
+    struct dm_remap_health_monitor *health = &device->health_monitor;
+    uint64_t error_count = atomic64_read(&device->stats.io_errors);
+    uint64_t total_ios = atomic64_read(&device->stats.total_ios);
+    int health_score = 100; /* Start with perfect health */
+    
+    mutex_lock(&device->health_mutex);
+    
+    /* Factor in error rate */
+    if (total_ios > 0) {
+        uint64_t error_rate = (error_count * 10000) / total_ios; /* Per 10,000 operations */
+        if (error_rate > 100) {      /* >1% error rate */
+            health_score -= 50;
+        } else if (error_rate > 10) { /* >0.1% error rate */
+            health_score -= 20;
+        } else if (error_rate > 1) {  /* >0.01% error rate */
+            health_score -= 5;
+        }
+    }
+    
+    /* Factor in consecutive errors */
+    if (health->consecutive_errors > 10) {
+        health_score -= 30;
+    } else if (health->consecutive_errors > 5) {
+        health_score -= 15;
+    }
+    
+    /* Factor in hotspot count */
+    if (health->hotspot_count > 20) {
+        health_score -= 25;
+    } else if (health->hotspot_count > 10) {
+        health_score -= 10;
+    }
+    
+    /* v4.3: Factor in bios the hung I/O watchdog caught */
+    if (health->timeout_count > 10) {
+        health_score -= 20;
+    } else if (health->timeout_count > 0) {
+        health_score -= 10;
+    }
+    
+    /* Factor in response time degradation */
+    if (health->avg_response_time_ns > 10000000) { /* >10ms average */
+        health_score -= 20;
+    } else if (health->avg_response_time_ns > 1000000) { /* >1ms average */
+        health_score -= 10;
+    }
+    
+    health_score = max(health_score, 0);
+    health->failure_prediction_score = health_score;
+    
+    mutex_unlock(&device->health_mutex);
+    
+    return health_score;
+}
+
+/**
+ * dm_remap_health_scan_work() - Background health scanning
+ */
+static void dm_remap_health_scan_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device = 
+        container_of(work, struct dm_remap_device_v4_real, health_scan_work.work);
+    struct dm_remap_health_monitor *health = &device->health_monitor;
+    uint32_t health_score;
+    
+    if (!atomic_read(&device->device_active)) {
+        return;
+    }
+    
+    DMR_DEBUG(2, "Starting background health scan (progress: %llu/%llu)",
+              (unsigned long long)health->scan_progress,
+              (unsigned long long)device->main_device_sectors);
+    
+    mutex_lock(&device->health_mutex);
+    health->background_scan_active = true;
+    health->last_health_scan = ktime_to_ns(ktime_get_real());
+    mutex_unlock(&device->health_mutex);
+    
+    /* Calculate current health score */
+    health_score = dm_remap_calculate_health_score(device);
+    
+    /* Update scan progress */
+    mutex_lock(&device->health_mutex);
+    health->scan_progress += 1024; /* Scan 1024 sectors per iteration */
+    if (health->scan_progress >= device->main_device_sectors) {
+        health->scan_progress = 0; /* Restart scan */
+        atomic64_inc(&device->health_scan_count);
+        DMR_INFO("Health scan completed. Health score: %u/100, hotspots: %u",
+                 health_score, health->hotspot_count);
+    }
+    health->background_scan_active = false;
+    mutex_unlock(&device->health_mutex);
+    
+    /* Schedule next scan */
+    if (atomic_read(&device->device_active)) {
+        u32 interval = dm_remap_policy_scan_interval(dm_remap_policy_dev(device), health_score,
+                                                     health->scan_interval_seconds);
+        
+        schedule_delayed_work(&device->health_scan_work, 
+                             msecs_to_jiffies(interval * 1000));
+    }
+}
+
+/* v4.3: Check four times per timeout, at most once a second */
+static inline unsigned long dm_remap_hung_interval(u32 timeout)
+{
+    return msecs_to_jiffies(max(timeout * 1000 / 4, 1000U));
+}
+
+struct dm_remap_hung_io {
+    sector_t sector;
+    unsigned int nr_sectors;
+    enum dm_remap_leg leg;
+    enum req_op op;
+    u64 age_ns;
+};
+
+/**
+ * dm_remap_hung_work() - Hung I/O watchdog
+ * 
+ * v4.3: Walks the per-CPU in-flight lists for bios outstanding longer than
+ * hung_timeout. Each list is sorted by start time, so only the hung bios
+ * and one more are looked at per CPU. A bio is reported once: logged, put
+ * in the event stream with a dm event, and on the main leg recorded as a
+ * slow region for the health score. Runs until postsuspend.
+ */
+static void dm_remap_hung_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device =
+        container_of(to_delayed_work(work), struct dm_remap_device_v4_real, hung_work);
+    u32 timeout = READ_ONCE(device->tunables.hung_timeout);
+    struct dm_remap_hung_io found[DM_REMAP_HUNG_REPORT_MAX];
+    struct dm_remap_leg_pcpu *pcpu;
+    struct dm_remap_io_ctx *ctx;
+    unsigned int nr = 0, more = 0, i;
+    unsigned long flags;
+    u64 now, age;
+    int cpu;
+    
+    if (!timeout)
+        return;
+    
+    now = ktime_get_ns();
+    for_each_possible_cpu(cpu) {
+        pcpu = per_cpu_ptr(device->leg_stats, cpu);
+        spin_lock_irqsave(&pcpu->lock, flags);
+        list_for_each_entry(ctx, &pcpu->inflight, inflight) {
+            age = now - ctx->start_ns;
+            if ((s64)age < (s64)timeout * NSEC_PER_SEC)
+                break;
+            if (ctx->hung)
+                continue;
+            ctx->hung = true;
+            if (nr == DM_REMAP_HUNG_REPORT_MAX) {
+                more++;
+                continue;
+            }
+            found[nr].sector = ctx->orig_sector;
+            found[nr].nr_sectors = ctx->nr_sectors;
+            found[nr].leg = ctx->leg;
+            found[nr].op = bio_op(dm_bio_from_per_bio_data(ctx, sizeof(*ctx)));
+            found[nr].age_ns = age;
+            nr++;
+        }
+        spin_unlock_irqrestore(&pcpu->lock, flags);
+    }
+    
+    for (i = 0; i < nr; i++) {
+        DMR_WARN("Hung I/O: %s %s at sector %llu (+%u) outstanding for %llu ms",
+                 dm_remap_leg_names[found[i].leg], blk_op_str(found[i].op),
+                 (unsigned long long)found[i].sector, found[i].nr_sectors,
+                 found[i].age_ns / NSEC_PER_MSEC);
+        dm_remap_event_record(&device->events, DM_REMAP_EVENT_HUNG,
+                              found[i].sector, found[i].nr_sectors);
+        if (found[i].leg == DM_REMAP_LEG_MAIN)
+            dm_remap_note_slow_region(device, found[i].sector);
+    }
+    if (more)
+        DMR_WARN("Hung I/O: %u more bios outstanding for over %u s", more, timeout);
+    if (nr) {
+        atomic64_add(nr + more, &device->hung_ios);
+        dm_table_event(device->ti->table);
+    }
+    
+    schedule_delayed_work(&device->hung_work, dm_remap_hung_interval(timeout));
+}
+
+/**
+ * dm_remap_hung_format() - Reply to the "hung" message
+ * 
+ * "hung_timeout=.. hung_ios=.. outstanding=.. oldest_ms=..", then one
+ * "<leg> <op> <sector>+<nr_sectors> age_ms=.." line for each bio currently
+ * outstanding longer than hung_timeout, as many as fit.
+ */
+static void dm_remap_hung_format(struct dm_remap_device_v4_real *device,
+                                 char *result, unsigned int maxlen)
+{
+    u64 limit = (u64)READ_ONCE(device->tunables.hung_timeout) * NSEC_PER_SEC;
+    struct dm_remap_leg_pcpu *pcpu;
+    struct dm_remap_io_ctx *ctx;
+    unsigned int sz, outstanding = 0;
+    unsigned long flags;
+    u64 now = ktime_get_ns(), oldest = 0, age;
+    int cpu;
+    
+    for_each_possible_cpu(cpu) {
+        pcpu = per_cpu_ptr(device->leg_stats, cpu);
+        spin_lock_irqsave(&pcpu->lock, flags);
+        ctx = list_first_entry_or_null(&pcpu->inflight, struct dm_remap_io_ctx, inflight);
+        if (ctx && (s64)(now - ctx->start_ns) > (s64)oldest)
+            oldest = now - ctx->start_ns;
+        list_for_each_entry(ctx, &pcpu->inflight, inflight) {
+            if (!limit || (s64)(now - ctx->start_ns) < (s64)limit)
+                break;
+            outstanding++;
+        }
+        spin_unlock_irqrestore(&pcpu->lock, flags);
+    }
+    
+    sz = scnprintf(result, maxlen,
+                   "hung_timeout=%u hung_ios=%llu outstanding=%u oldest_ms=%llu",
+                   READ_ONCE(device->tunables.hung_timeout),
+                   (unsigned long long)atomic64_read(&device->hung_ios),
+                   outstanding, oldest / NSEC_PER_MSEC);
+    if (!outstanding)
+        return;
+    
+    for_each_possible_cpu(cpu) {
+        pcpu = per_cpu_ptr(device->leg_stats, cpu);
+        spin_lock_irqsave(&pcpu->lock, flags);
+        list_for_each_entry(ctx, &pcpu->inflight, inflight) {
+            age = now - ctx->start_ns;
+            if ((s64)age < (s64)limit)
+                break;
+            sz += scnprintf(result + sz, maxlen - sz, "\n%s %s %llu+%u age_ms=%llu",
+                            dm_remap_leg_names[ctx->leg],
+                            blk_op_str(bio_op(dm_bio_from_per_bio_data(ctx, sizeof(*ctx)))),
+                            (unsigned long long)ctx->orig_sector, ctx->nr_sectors,
+                            age / NSEC_PER_MSEC);
+        }
+        spin_unlock_irqrestore(&pcpu->lock, flags);
+    }
+}
+
+/**
+ * Phase 1.4: Performance Optimization Functions
+ */
+
+/**
+ * dm_remap_cache_lookup() - Fast remap cache lookup
+ */
+static sector_t dm_remap_cache_lookup(struct dm_remap_device_v4_real *device,
+                                     sector_t original_sector)
+{
+    struct dm_remap_perf_optimizer *perf = &device->perf_optimizer;
+    struct dm_remap_cache_entry *entry;
+    uint32_t cache_index;
+    sector_t result = 0;
+    
+    mutex_lock(&device->cache_mutex);
+    
+    /* v4.3: The cache may be resized at runtime, so look at it under the lock */
+    if (!perf->cache_entries || perf->cache_size == 0) {
+        mutex_unlock(&device->cache_mutex);
+        atomic64_inc(&perf->cache_misses);
+        return 0;
+    }
+    
+    cache_index = original_sector & perf->cache_mask;
+    entry = &perf->cache_entries[cache_index];
+    
+    if (entry->original_sector == original_sector) {
+        /* Cache hit */
+        entry->access_time = ktime_to_ns(ktime_get());
+        entry->access_count++;
+        result = entry->remapped_sector;
+        atomic64_inc(&perf->cache_hits);
+        atomic64_inc(&perf->fast_path_hits);
+    } else {
+        /* Cache miss */
+        atomic64_inc(&perf->cache_misses);
+    }
+    
+    mutex_unlock(&device->cache_mutex);
+    
+    return result;
+}
+
+/**
+ * dm_remap_cache_insert() - Insert entry into remap cache
+ */
+static void dm_remap_cache_insert(struct dm_remap_device_v4_real *device,
+                                 sector_t original_sector,
+                                 sector_t remapped_sector)
+{
+    struct dm_remap_perf_optimizer *perf = &device->perf_optimizer;
+    struct dm_remap_cache_entry *entry;
+    uint32_t cache_index;
+    
+    mutex_lock(&device->cache_mutex);
+    
+    if (!perf->cache_entries || perf->cache_size == 0) {
+        mutex_unlock(&device->cache_mutex);
+        return;
+    }
+    
+    cache_index = original_sector & perf->cache_mask;
+    entry = &perf->cache_entries[cache_index];
+    
+    entry->original_sector = original_sector;
+    entry->remapped_sector = remapped_sector;
+    entry->access_time = ktime_to_ns(ktime_get());
+    entry->access_count = 1;
+    
+    mutex_unlock(&device->cache_mutex);
+    
+    DMR_DEBUG(3, "Cache entry inserted: %llu -> %llu (index %u)",
+              (unsigned long long)original_sector,
+              (unsigned long long)remapped_sector, cache_index);
+}
+
+/**
+ * dm_remap_cache_resize() - Replace the remap cache with an empty one
+ * @cache_size: New number of entries, a power of two, 0 to drop the cache
+ * 
+ * v4.3: Entries are not carried over; the cache refills from the remap
+ * table on the next misses. Process context only.
+ */
+static int dm_remap_cache_resize(struct dm_remap_device_v4_real *device,
+                                 uint32_t cache_size)
+{
+    struct dm_remap_perf_optimizer *perf = &device->perf_optimizer;
+    struct dm_remap_cache_entry *entries = NULL, *old;
+    
+    if (cache_size) {
+        entries = kcalloc(cache_size, sizeof(*entries), GFP_KERNEL);
+        if (!entries)
+            return -ENOMEM;
+    }
+    
+    mutex_lock(&device->cache_mutex);
+    old = perf->cache_entries;
+    perf->cache_entries = entries;
+    perf->cache_size = cache_size;
+    perf->cache_mask = cache_size ? cache_size - 1 : 0;
+    mutex_unlock(&device->cache_mutex);
+    
+    kfree(old);
+    return 0;
+}
+
+/**
+ * dm_remap_cache_clear() - Forget all cached lookups
+ * 
+ * v4.3: For when the index is rebuilt under the cache.
+ */
+static void dm_remap_cache_clear(struct dm_remap_device_v4_real *device)
+{
+    struct dm_remap_perf_optimizer *perf = &device->perf_optimizer;
+    
+    mutex_lock(&device->cache_mutex);
+    if (perf->cache_entries)
+        memset(perf->cache_entries, 0, perf->cache_size * sizeof(*perf->cache_entries));
+    mutex_unlock(&device->cache_mutex);
+}
+
+/**
+ * dm_remap_update_io_pattern() - Update I/O pattern analysis
+ */
+static void dm_remap_update_io_pattern(struct dm_remap_device_v4_real *device,
+                                      sector_t sector)
+{
+    struct dm_remap_perf_optimizer *perf = &device->perf_optimizer;
+    ktime_t current_time = ktime_get();
+    
+    mutex_lock(&device->cache_mutex);
+    
+    /* Check if this is sequential I/O */
+    if (perf->io_pattern.last_sector + 1 == sector) {
+        perf->io_pattern.sequential_count++;
+    } else {
+        perf->io_pattern.random_count++;
+    }
+    
+    perf->io_pattern.last_sector = sector;
+    
+    /* Update pattern classification every 1000 I/Os */
+    if ((perf->io_pattern.sequential_count + perf->io_pattern.random_count) % 1000 == 0) {
+        perf->io_pattern.is_sequential_workload = 
+            (perf->io_pattern.sequential_count > perf->io_pattern.random_count);
+        
+        DMR_DEBUG(3, "I/O pattern: %s (seq: %u, rand: %u)",
+                  perf->io_pattern.is_sequential_workload ? "sequential" : "random",
+                  perf->io_pattern.sequential_count, perf->io_pattern.random_count);
+    }
+    
+    perf->io_pattern.pattern_update_time = current_time;
+    
+    mutex_unlock(&device->cache_mutex);
+}
+
+/**
+ * dm_remap_validate_device_compatibility() - Enhanced device compatibility checking
+ */
+static int dm_remap_validate_device_compatibility(struct file *main_dev, 
+                                                 struct file *spare_dev)
+{
+    sector_t main_size, spare_size;
+    unsigned int main_sector_size, spare_sector_size;
+    unsigned int main_physical_size, spare_physical_size;
+    u64 main_capacity, spare_capacity;
+    sector_t min_spare_size;
+    
+    if (!main_dev || IS_ERR(main_dev) || !spare_dev || IS_ERR(spare_dev)) {
+        return -EINVAL;
+    }
+    
+    /* Get device sizes in sectors */
+    main_size = dm_remap_get_device_size(main_dev);
+    spare_size = dm_remap_get_device_size(spare_dev);
+    
     /* Get sector sizes */
     main_sector_size = dm_remap_get_sector_size(main_dev);
     spare_sector_size = dm_remap_get_sector_size(spare_dev);
     
-    /* Get physical sector sizes */
-    main_physical_size = dm_remap_get_physical_sector_size(main_dev);
-    spare_physical_size = dm_remap_get_physical_sector_size(spare_dev);
+    /* Get physical sector sizes */
+    main_physical_size = dm_remap_get_physical_sector_size(main_dev);
+    spare_physical_size = dm_remap_get_physical_sector_size(spare_dev);
+    
+    /* Get capacities in bytes */
+    main_capacity = dm_remap_get_device_capacity_bytes(main_dev);
+    spare_capacity = dm_remap_get_device_capacity_bytes(spare_dev);
+    
+    DMR_DEBUG(2, "Device geometry: main=%llu sectors (%u/%u bytes), spare=%llu sectors (%u/%u bytes)",
+              (unsigned long long)main_size, main_sector_size, main_physical_size,
+              (unsigned long long)spare_size, spare_sector_size, spare_physical_size);
+    
+    /* Validate sector size compatibility */
+    if (main_sector_size != spare_sector_size) {
+        DMR_ERROR("Sector size mismatch: main=%u, spare=%u bytes",
+                  main_sector_size, spare_sector_size);
+        return -EINVAL;
+    }
+    
+    /* Check minimum size requirements */
+    if (main_size < DM_REMAP_MIN_DEVICE_SECTORS) {
+        DMR_ERROR("Main device too small: %llu < %u sectors",
+                  (unsigned long long)main_size, DM_REMAP_MIN_DEVICE_SECTORS);
+        return -ENOSPC;
+    }
+    
+    /* Calculate minimum spare size using intelligent algorithm (v4.0.1)
+     * 
+     * LEGACY MODE (strict_spare_sizing=true):
+     *   min_spare = main_size * 1.05
+     *   
+     * OPTIMIZED MODE (strict_spare_sizing=false, default):
+     *   Components:
+     *   1. Metadata base: 4KB
+     *   2. Expected bad sectors: main_size * spare_overhead_percent / 100
+     *   3. Mapping overhead: expected_bad_sectors * 64 bytes per entry
+     *   4. Safety margin: 20% of calculated need
+     *   
+     * Example with 1TB main, 2% expected bad sectors:
+     *   - Bad sectors: 1TB * 2% = 20GB
+     *   - Metadata: 4KB + (20GB/512 * 64 bytes) = ~2.5MB
+     *   - Safety margin: (20GB + 2.5MB) * 1.2 = 24GB
+     *   - Total: ~24GB spare instead of 1.05TB!
+     */
+    if (strict_spare_sizing) {
+        /* Legacy mode: spare must be >= main + 5% */
+        min_spare_size = main_size + (main_size / 20);
+        DMR_INFO("Using strict spare sizing (legacy): %llu sectors required",
+                 (unsigned long long)min_spare_size);
+    } else {
+        /* Optimized mode: calculate realistic minimum */
+        sector_t metadata_sectors;
+        sector_t expected_bad_sectors;
+        sector_t mapping_overhead_sectors;
+        sector_t base_requirement;
+        
+        /* Clamp overhead percentage to sane range (0-20%) */
+        uint overhead_pct = spare_overhead_percent;
+        if (overhead_pct > 20) {
+            DMR_INFO("Clamping spare_overhead_percent from %u to 20%%", overhead_pct);
+            overhead_pct = 20;
+        }
+        
+        /* Calculate components */
+        metadata_sectors = DM_REMAP_METADATA_BASE_SIZE / main_sector_size + 1;
+        expected_bad_sectors = (main_size * overhead_pct) / 100;
+        mapping_overhead_sectors = (expected_bad_sectors * DM_REMAP_METADATA_PER_MAPPING) / main_sector_size + 1;
+        
+        /* Base requirement = metadata + bad sectors + mapping overhead */
+        base_requirement = metadata_sectors + expected_bad_sectors + mapping_overhead_sectors;
+        
+        /* Add safety margin (20%) */
+        min_spare_size = base_requirement + (base_requirement * DM_REMAP_SAFETY_MARGIN_PCT / 100);
+        
+        DMR_INFO("Optimized spare sizing calculation:");
+        DMR_INFO("  Main device: %llu sectors (%llu MB)",
+                 (unsigned long long)main_size,
+                 (unsigned long long)(main_size * main_sector_size / (1024*1024)));
+        DMR_INFO("  Expected bad sectors (%u%%): %llu sectors (%llu MB)",
+                 overhead_pct,
+                 (unsigned long long)expected_bad_sectors,
+                 (unsigned long long)(expected_bad_sectors * main_sector_size / (1024*1024)));
+        DMR_INFO("  Metadata overhead: %llu sectors (%llu KB)",
+                 (unsigned long long)(metadata_sectors + mapping_overhead_sectors),
+                 (unsigned long long)((metadata_sectors + mapping_overhead_sectors) * main_sector_size / 1024));
+        DMR_INFO("  Minimum spare (with %u%% safety margin): %llu sectors (%llu MB)",
+                 DM_REMAP_SAFETY_MARGIN_PCT,
+                 (unsigned long long)min_spare_size,
+                 (unsigned long long)(min_spare_size * main_sector_size / (1024*1024)));
+    }
+    
+    /* Spare device should have adequate capacity */
+    if (spare_size < min_spare_size) {
+        if (strict_spare_sizing) {
+            DMR_ERROR("Spare device insufficient: %llu < %llu sectors (need %llu + 5%% overhead)",
+                      (unsigned long long)spare_size, (unsigned long long)min_spare_size,
+                      (unsigned long long)main_size);
+        } else {
+            DMR_ERROR("Spare device insufficient: %llu < %llu sectors", 
+                      (unsigned long long)spare_size, (unsigned long long)min_spare_size);
+            DMR_ERROR("  Increase spare size or reduce spare_overhead_percent parameter");
+            DMR_ERROR("  Current overhead: %u%%, try lower value or use strict_spare_sizing=1",
+                      spare_overhead_percent);
+        }
+        return -ENOSPC;
+    }
+    
+    /* Success - log the spare utilization efficiency */
+    {
+        u64 spare_size_mb = (spare_size * main_sector_size) / (1024*1024);
+        u64 main_size_mb = (main_size * main_sector_size) / (1024*1024);
+        uint efficiency_pct = (spare_size_mb * 100) / main_size_mb;
+        
+        if (efficiency_pct < 10) {
+            DMR_INFO("Excellent spare efficiency: %llu MB spare for %llu MB main (%u%%)",
+                     (unsigned long long)spare_size_mb, (unsigned long long)main_size_mb, efficiency_pct);
+        } else if (efficiency_pct < 50) {
+            DMR_INFO("Good spare efficiency: %llu MB spare for %llu MB main (%u%%)",
+                     (unsigned long long)spare_size_mb, (unsigned long long)main_size_mb, efficiency_pct);
+        } else {
+            DMR_INFO("Consider RAID1 mirroring: %llu MB spare for %llu MB main (%u%%)",
+                     (unsigned long long)spare_size_mb, (unsigned long long)main_size_mb, efficiency_pct);
+        }
+    }
+    
+    /* Warn about physical sector size differences */
+    if (main_physical_size != spare_physical_size) {
+        DMR_INFO("Physical sector size difference: main=%u, spare=%u bytes (performance may vary)",
+                 main_physical_size, spare_physical_size);
+    }
+    
+    /* Check device alignment for first sector */
+    if (!dm_remap_check_device_alignment(main_dev, 0)) {
+        DMR_ERROR("Main device not properly aligned");
+        return -EINVAL;
+    }
+    
+    if (!dm_remap_check_device_alignment(spare_dev, 0)) {
+        DMR_ERROR("Spare device not properly aligned");  
+        return -EINVAL;
+    }
+    
+    DMR_INFO("Enhanced device compatibility validated:");
+    DMR_INFO("  Main: %llu sectors, %llu bytes (%u/%u sector size)",
+             (unsigned long long)main_size, main_capacity, main_sector_size, main_physical_size);
+    DMR_INFO("  Spare: %llu sectors, %llu bytes (%u/%u sector size)",
+             (unsigned long long)spare_size, spare_capacity, spare_sector_size, spare_physical_size);
+    DMR_INFO("  Overhead available: %llu sectors (%llu%% of main size)",
+             (unsigned long long)(spare_size - main_size),
+             (unsigned long long)((spare_size - main_size) * 100 / main_size));
+    
+    return 0;
+}
+
+/**
+ * dm_remap_initialize_metadata_v4_real() - Initialize enhanced v4.0 metadata
+ */
+static void dm_remap_initialize_metadata_v4_real(struct dm_remap_device_v4_real *device)
+{
+    struct dm_remap_metadata_v4_real *meta = &device->metadata;
+    ktime_t now = ktime_get_real();
+    
+    /* Initialize header */
+    strncpy(meta->magic, "DM_REMAP_V4.0R", sizeof(meta->magic));
+    meta->version = 4;
+    meta->metadata_size = sizeof(*meta);
+    meta->creation_time = ktime_to_ns(now);
+    meta->last_update = meta->creation_time;
+    
+    /* Device identification */
+    strncpy(meta->main_device_path, device->main_path, sizeof(meta->main_device_path) - 1);
+    strncpy(meta->spare_device_path, device->spare_path, sizeof(meta->spare_device_path) - 1);
+    meta->main_device_size = device->main_device_sectors;
+    meta->spare_device_size = device->spare_device_sectors;
+    
+    /* Generate device fingerprint based on device characteristics */
+    snprintf(meta->device_fingerprint, sizeof(meta->device_fingerprint),
+             "v4r-%08llx-%08llx", 
+             (unsigned long long)meta->main_device_size,
+             (unsigned long long)meta->spare_device_size);
+    
+    /* Mapping information */
+    meta->sector_size = device->sector_size;
+    meta->total_sectors = device->main_device_sectors;
+    meta->max_mappings = 4294967295U;  /* Unlimited remaps (v4.2.2) - load factor based hash table sizing */
+    meta->active_mappings = 0;
+    
+    /* Health monitoring */
+    meta->health_scan_count = 0;
+    meta->last_health_scan = 0;
+    meta->predicted_failures = 0;
+    meta->health_flags = 0;
+    meta->total_errors = 0;
+    meta->last_error_time = 0;
+    
+    /* Performance statistics */
+    meta->total_reads = 0;
+    meta->total_writes = 0; 
+    meta->total_remaps = 0;
+    meta->total_io_time_ns = 0;
+    meta->peak_throughput = 0;
+    
+    /* Device status */
+    meta->main_device_status = 0;   /* Healthy */
+    meta->spare_device_status = 0;  /* Healthy */
+    meta->uptime_seconds = 0;
+    
+    DMR_DEBUG(2, "Initialized enhanced v4.0 metadata (size: %u bytes, fingerprint: %s)",
+              meta->metadata_size, meta->device_fingerprint);
+}
+
+/**
+ * dm_remap_clamp_run() - Keep a split point on a logical block boundary
+ * 
+ * Remaps are created block-aligned, so this only matters for hand-made
+ * sub-block remaps (test_remap); such a block follows its first sector.
+ */
+static inline sector_t dm_remap_clamp_run(struct dm_remap_device_v4_real *device,
+                                          sector_t run, sector_t nr_sectors)
+{
+    if (run >= nr_sectors || device->block_sectors <= 1)
+        return run;
+    
+    run = round_down(run, device->block_sectors);
+    return run ? run : min_t(sector_t, nr_sectors, device->block_sectors);
+}
+
+/**
+ * dm_remap_spare_io_end() - A bio on the spare leg has completed
+ * @gen: From dm_remap_spare_io_get()
+ */
+static inline void dm_remap_spare_io_end(struct dm_remap_device_v4_real *device,
+                                         unsigned int gen)
+{
+    if (atomic_dec_and_test(&device->spare_inflight[gen]) && wq_has_sleeper(&device->spare_wait))
+        wake_up(&device->spare_wait);
+}
+
+/**
+ * dm_remap_spare_io_get() - Count a bio on the spare leg
+ * 
+ * v4.3: In the current generation, so dm_remap_spare_drain() can wait for
+ * the bios sent before it without waiting for later ones. Returns the
+ * generation to pass to dm_remap_spare_io_end().
+ */
+static inline unsigned int dm_remap_spare_io_get(struct dm_remap_device_v4_real *device)
+{
+    unsigned int gen;
+    
+    for (;;) {
+        gen = READ_ONCE(device->spare_gen);
+        atomic_inc(&device->spare_inflight[gen]);
+        smp_mb__after_atomic();  /* Pairs with dm_remap_spare_quiesce() and _drain() */
+        if (likely(READ_ONCE(device->spare_gen) == gen))
+            return gen;
+        dm_remap_spare_io_end(device, gen);
+    }
+}
+
+static inline void dm_remap_spare_set_gen(struct dm_remap_io_ctx *ctx, unsigned int gen)
+{
+    if (gen)
+        ctx->flags |= DM_REMAP_IO_SPARE_GEN;
+    else
+        ctx->flags &= ~DM_REMAP_IO_SPARE_GEN;
+}
+
+/**
+ * dm_remap_spare_io_start() - Send a bio to @spare_sector on the spare device
+ * 
+ * v4.3: Bios on the spare leg are counted so a spare replacement can wait
+ * for them to drain. While the spare is being switched the bio is held and
+ * resubmitted to the new spare afterwards; then false is returned and the
+ * caller must return DM_MAPIO_SUBMITTED.
+ */
+static bool dm_remap_spare_io_start(struct dm_remap_device_v4_real *device,
+                                    struct bio *bio, struct dm_remap_io_ctx *ctx,
+                                    sector_t spare_sector)
+{
+    unsigned long flags;
+    unsigned int gen;
+    bool held = false;
+    
+    dm_remap_leg_start(device, ctx, DM_REMAP_LEG_SPARE);
+    ctx->flags |= DM_REMAP_IO_SPARE;
+    ctx->spare_sector = spare_sector;
+    bio->bi_iter.bi_sector = spare_sector;
+    ctx->iter = bio->bi_iter;
+    
+    gen = dm_remap_spare_io_get(device);
+    dm_remap_spare_set_gen(ctx, gen);
+    if (unlikely(smp_load_acquire(&device->spare_quiesced))) {
+        spin_lock_irqsave(&device->remap_lock, flags);
+        if (device->spare_quiesced) {
+            bio_list_add(&device->spare_deferred, bio);
+            held = true;
+        }
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        if (held) {
+            dm_remap_spare_io_end(device, gen);
+            return false;
+        }
+    }
+    
+    bio_set_dev(bio, file_bdev(device->spare_dev));
+    return true;
+}
+
+/**
+ * dm_remap_spare_io_sync() - Synchronous I/O on the spare for salvage and verify
+ * 
+ * v4.3: Counted on the spare leg like a bio, so a running spare replacement
+ * copies a write again; while the spare is being switched it waits.
+ * Process context only.
+ */
+static int dm_remap_spare_io_sync(struct dm_remap_device_v4_real *device, blk_opf_t opf,
+                                  sector_t sector, void *data, unsigned int nr)
+{
+    struct dm_remap_spare_migration *m;
+    unsigned int gen;
+    int ret;
+    
+    for (;;) {
+        gen = dm_remap_spare_io_get(device);
+        if (likely(!smp_load_acquire(&device->spare_quiesced)))
+            break;
+        dm_remap_spare_io_end(device, gen);
+        msleep(DM_REMAP_SALVAGE_DELAY_MS);
+    }
+    
+    ret = dm_remap_sync_io(file_bdev(device->spare_dev), opf, sector, data, nr);
+    m = READ_ONCE(device->migration);
+    if (m && op_is_write(opf))
+        dm_remap_migration_mark(m, sector, nr);
+    dm_remap_spare_io_end(device, gen);
+    return ret;
+}
+
+/**
+ * dm_remap_spare_quiesce() - Hold new spare bios and wait for the others
+ * 
+ * v4.3: Brackets the last copy pass and switch of a spare replacement.
+ * Main device I/O is not affected. Process context only.
+ */
+static void dm_remap_spare_quiesce(struct dm_remap_device_v4_real *device)
+{
+    unsigned long flags;
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    device->spare_quiesced = true;
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    smp_mb();  /* Pairs with dm_remap_spare_io_get() */
+    wait_event(device->spare_wait, !atomic_read(&device->spare_inflight[0]) &&
+                                   !atomic_read(&device->spare_inflight[1]));
+}
+
+/**
+ * dm_remap_spare_drain() - Wait for the spare bios sent so far
+ * 
+ * v4.3: Starts a new generation and waits for the bios of the last one,
+ * so space they may still write is not handed out again. Later bios go
+ * on. Callers are serialized by metadata_mutex. Process context only.
+ */
+static void dm_remap_spare_drain(struct dm_remap_device_v4_real *device)
+{
+    unsigned long flags;
+    unsigned int old;
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    old = device->spare_gen;
+    WRITE_ONCE(device->spare_gen, !old);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    smp_mb();  /* Pairs with dm_remap_spare_io_get() */
+    wait_event(device->spare_wait, !atomic_read(&device->spare_inflight[old]));
+}
+
+/**
+ * dm_remap_spare_unquiesce() - Let spare I/O through and resubmit held bios
+ * 
+ * Held bios go to whatever spare_dev is now.
+ */
+static void dm_remap_spare_unquiesce(struct dm_remap_device_v4_real *device)
+{
+    struct bio_list bios;
+    struct bio *bio;
+    unsigned long flags;
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    smp_store_release(&device->spare_quiesced, false);
+    bios = device->spare_deferred;
+    bio_list_init(&device->spare_deferred);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    while ((bio = bio_list_pop(&bios))) {
+        dm_remap_spare_set_gen(dm_per_bio_data(bio, sizeof(struct dm_remap_io_ctx)),
+                               dm_remap_spare_io_get(device));
+        bio_set_dev(bio, file_bdev(device->spare_dev));
+        dm_submit_bio_remap(bio, NULL);
+    }
+}
+
+/**
+ * dm_remap_bio_zeroing() - Does a write leave its whole range reading as zeros
+ * 
+ * v4.3: Discards and write zeroes, and plain writes whose data is all zero.
+ * Writes carrying protection information are kept as they are.
+ */
+static bool dm_remap_bio_zeroing(struct bio *bio)
+{
+    struct bvec_iter iter;
+    struct bio_vec bv;
+    bool zero = true;
+    void *p;
+    
+    if (bio_op(bio) == REQ_OP_DISCARD || bio_op(bio) == REQ_OP_WRITE_ZEROES)
+        return true;
+    if (bio_op(bio) != REQ_OP_WRITE || bio_integrity(bio))
+        return false;
+    
+    bio_for_each_segment(bv, bio, iter) {
+        p = bvec_kmap_local(&bv);
+        zero = !memchr_inv(p, 0, bv.bv_len);
+        kunmap_local(p);
+        if (!zero)
+            break;
+    }
+    return zero;
+}
+
+/**
+ * dm_remap_map_zero() - Map a bio to remapped sectors that need no spare I/O
+ * @device: Target device
+ * @bio: Bio covering one run of dm_remap_lookup_run()
+ * @ctx: Its context
+ * @zeroing: dm_remap_bio_zeroing() is true for @bio
+ * @spare_sector: The run's first spare sector, 0 for a zero run
+ * 
+ * v4.3: A zeroing write to a run on the spare is queued for
+ * dm_remap_atomic_commit_work() without any I/O and turns the run zero,
+ * releasing its spare sectors. A zero run serves reads zero-filled and
+ * takes zeroing writes as they are. Any other write to it is staged through
+ * a new spare extent, allocated only now, which the commit switches in.
+ * 
+ * Returns DM_MAPIO_SUBMITTED if the bio was dealt with here, or
+ * DM_MAPIO_REMAPPED with @spare_sector set to where the staged write goes.
+ */
+static int dm_remap_map_zero(struct dm_remap_device_v4_real *device, struct bio *bio,
+                             struct dm_remap_io_ctx *ctx, bool zeroing,
+                             sector_t *spare_sector)
+{
+    unsigned long flags;
+    int ret;
+    
+    if (*spare_sector) {
+        atomic64_inc(&device->zero_writes);
+        ctx->flags |= DM_REMAP_IO_STAGED;
+        ctx->stage_sector = 0;
+        spin_lock_irqsave(&device->remap_lock, flags);
+        list_add_tail(&ctx->list, &device->atomic_commit_list);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        mod_delayed_work(device->metadata_workqueue, &device->atomic_commit_work, 0);
+        return DM_MAPIO_SUBMITTED;
+    }
+    
+    if (!op_is_write(bio_op(bio)) || zeroing) {
+        if (op_is_write(bio_op(bio))) {
+            atomic64_inc(&device->zero_writes);
+        } else {
+            atomic64_inc(&device->zero_reads);
+            zero_fill_bio(bio);
+        }
+        ctx->flags |= DM_REMAP_IO_REFUSED;
+        bio_endio(bio);
+        return DM_MAPIO_SUBMITTED;
+    }
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    ret = dm_remap_alloc_spare_extent(device, ctx->nr_sectors, device->block_sectors, 0,
+                                      spare_sector);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    if (ret) {
+        DMR_DEBUG(2, "No spare space for a write to zero remaps at sector %llu",
+                  (unsigned long long)ctx->orig_sector);
+        ctx->flags |= DM_REMAP_IO_REFUSED;
+        bio->bi_status = BLK_STS_NOSPC;
+        bio_endio(bio);
+        return DM_MAPIO_SUBMITTED;
+    }
+    
+    atomic64_inc(&device->zero_allocs);
+    ctx->flags |= DM_REMAP_IO_STAGED;
+    ctx->stage_sector = *spare_sector;
+    return DM_MAPIO_REMAPPED;
+}
+
+/* v4.3: Attempts at a unit whose remaps keep changing under the compress work */
+#define DM_REMAP_COMPRESS_TRIES  3
+
+/* v4.3: A unit's sectors as the table had them, flags 0 for the main device */
+struct dm_remap_compress_slot {
+    sector_t spare_sector;
+    u32 flags;
+};
+
+/*
+ * v4.3: Snapshot the unit starting at @unit. PENDING entries are not used
+ * for I/O yet and are left out. Caller holds remap_lock.
+ */
+static void dm_remap_compress_slots(struct dm_remap_device_v4_real *device, sector_t unit,
+                                    struct dm_remap_compress_slot *slots)
+{
+    struct dm_remap_entry_v4 *entry;
+    
+    memset(slots, 0, DM_REMAP_V4_COMPRESS_SECTORS * sizeof(*slots));
+    for (entry = dm_remap_index_ceil(device, unit);
+         entry && entry->original_sector < unit + DM_REMAP_V4_COMPRESS_SECTORS;
+         entry = dm_remap_index_next(entry)) {
+        if (entry->flags & DM_REMAP_FLAG_PENDING)
+            continue;
+        slots[entry->original_sector - unit].spare_sector = entry->spare_sector;
+        slots[entry->original_sector - unit].flags = entry->flags;
+    }
+}
+
+/* v4.3: How many slots from @i, up to @end, one I/O can serve */
+static unsigned int dm_remap_compress_run(const struct dm_remap_compress_slot *slots,
+                                          unsigned int i, unsigned int end)
+{
+    const u32 mask = DM_REMAP_FLAG_ACTIVE | DM_REMAP_FLAG_ZERO | DM_REMAP_FLAG_COMPRESSED;
+    u32 kind = slots[i].flags & mask;
+    unsigned int n;
+    
+    for (n = 1; i + n < end; n++) {
+        if ((slots[i + n].flags & mask) != kind ||
+            (kind == DM_REMAP_FLAG_ACTIVE &&
+             slots[i + n].spare_sector != slots[i].spare_sector + n) ||
+            ((kind & DM_REMAP_FLAG_COMPRESSED) &&
+             slots[i + n].spare_sector != slots[i].spare_sector))
+            break;
+    }
+    return n;
+}
+
+/*
+ * v4.3: Point slots @first..@end of a unit at new spare space, if the table
+ * still matches @slots there. With DM_REMAP_FLAG_COMPRESSED in @stored every
+ * entry names @spare_sector, otherwise each takes its own sector from it.
+ * Every slot must be remapped. Caller holds remap_lock.
+ */
+static bool dm_remap_compress_switch(struct dm_remap_device_v4_real *device, sector_t unit,
+                                     const struct dm_remap_compress_slot *slots,
+                                     unsigned int first, unsigned int end,
+                                     sector_t spare_sector, u32 stored)
+{
+    struct dm_remap_compress_slot now[DM_REMAP_V4_COMPRESS_SECTORS];
+    struct dm_remap_entry_v4 *entry;
+    sector_t old_spare;
+    unsigned int i;
+    u32 old_flags;
+    
+    dm_remap_compress_slots(device, unit, now);
+    if (memcmp(now + first, slots + first, (end - first) * sizeof(*now)))
+        return false;
+    
+    for (entry = dm_remap_index_ceil(device, unit + first);
+         entry && entry->original_sector < unit + end;
+         entry = dm_remap_index_next(entry)) {
+        if (entry->flags & DM_REMAP_FLAG_PENDING)
+            continue;
+        i = entry->original_sector - unit;
+        old_spare = entry->spare_sector;
+        old_flags = entry->flags;
+        entry->spare_sector = (stored & DM_REMAP_FLAG_COMPRESSED) ?
+                              spare_sector : spare_sector + i - first;
+        entry->flags = DM_REMAP_FLAG_ACTIVE | stored;
+        dm_remap_release_spare(device, entry->original_sector, old_spare, old_flags);
+    }
+    return true;
+}
+
+/**
+ * dm_remap_compress_fill() - Read slots @first..@end of a unit into @buf
+ * @buf: The unit, followed by a page each to decompress and to read an
+ *       extent into
+ * 
+ * v4.3: Process context only.
+ */
+static int dm_remap_compress_fill(struct dm_remap_device_v4_real *device, sector_t unit,
+                                  const struct dm_remap_compress_slot *slots,
+                                  unsigned int first, unsigned int end, void *buf)
+{
+    void *scratch = buf + PAGE_SIZE, *extent = buf + 2 * PAGE_SIZE, *p;
+    unsigned int i, n, clen;
+    int ret;
+    
+    for (i = first; i < end; i += n) {
+        n = dm_remap_compress_run(slots, i, end);
+        p = buf + (i << SECTOR_SHIFT);
+        if (!slots[i].flags) {
+            ret = dm_remap_sync_io(file_bdev(device->main_dev), REQ_OP_READ | REQ_SYNC,
+                                   unit + i, p, n);
+        } else if (slots[i].flags & DM_REMAP_FLAG_ZERO) {
+            memset(p, 0, n << SECTOR_SHIFT);
+            ret = 0;
+        } else if (slots[i].flags & DM_REMAP_FLAG_COMPRESSED) {
+            clen = DM_REMAP_V4_REMAP_CLEN(slots[i].flags);
+            ret = dm_remap_spare_io_sync(device, REQ_OP_READ | REQ_SYNC,
+                                         slots[i].spare_sector, extent, clen);
+            if (!ret)
+                ret = dm_remap_decompress_unit(&device->compress, unit, extent, clen, scratch);
+            if (!ret)
+                memcpy(p, scratch + (i << SECTOR_SHIFT), n << SECTOR_SHIFT);
+        } else {
+            ret = dm_remap_spare_io_sync(device, REQ_OP_READ | REQ_SYNC,
+                                         slots[i].spare_sector, p, n);
+        }
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/**
+ * dm_remap_compress_store() - Store a compressed unit and switch it in
+ * 
+ * v4.3: The extent is written to new spare space, then all the unit's
+ * entries are pointed at it if none changed meanwhile (-EAGAIN otherwise).
+ */
+static int dm_remap_compress_store(struct dm_remap_device_v4_real *device, sector_t unit,
+                                   const struct dm_remap_compress_slot *slots,
+                                   void *extent, unsigned int clen, blk_opf_t fua)
+{
+    sector_t start;
+    unsigned long flags;
+    unsigned int i;
+    int ret;
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    ret = dm_remap_alloc_spare_extent(device, clen, 1, 0, &start);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    if (ret)
+        return ret;
+    
+    ret = dm_remap_spare_io_sync(device, REQ_OP_WRITE | REQ_SYNC | fua, start, extent, clen);
+    spin_lock_irqsave(&device->remap_lock, flags);
+    if (!ret && !dm_remap_compress_switch(device, unit, slots, 0, DM_REMAP_V4_COMPRESS_SECTORS,
+                                          start, DM_REMAP_FLAG_COMPRESSED |
+                                          (clen << DM_REMAP_V4_REMAP_CLEN_SHIFT)))
+        ret = -EAGAIN;
+    if (ret)
+        dm_remap_freelist_add(&device->spare_released, start, clen);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    if (ret)
+        return ret;
+    
+    /* A cached 0 is a miss: compressed remaps are always looked up */
+    for (i = 0; i < DM_REMAP_V4_COMPRESS_SECTORS; i++)
+        dm_remap_cache_insert(device, unit + i, 0);
+    dm_remap_flatten_note(device, unit, DM_REMAP_V4_COMPRESS_SECTORS);
+    return 0;
+}
+
+/**
+ * dm_remap_compress_write_raw() - Write slots @first..@end of a unit as they are
+ * 
+ * v4.3: Sectors on the spare are written in place. Zero and compressed
+ * slots get new spare space, switched in if the table did not change
+ * (-EAGAIN otherwise). @commit is set when the table changed.
+ */
+static int dm_remap_compress_write_raw(struct dm_remap_device_v4_real *device, sector_t unit,
+                                       const struct dm_remap_compress_slot *slots,
+                                       unsigned int first, unsigned int end, blk_opf_t fua,
+                                       void *buf, bool *commit)
+{
+    unsigned int i, j, n;
+    unsigned long flags;
+    sector_t start;
+    void *p;
+    int ret;
+    
+    for (i = first; i < end; i += n) {
+        n = dm_remap_compress_run(slots, i, end);
+        p = buf + (i << SECTOR_SHIFT);
+        if (!slots[i].flags) {
+            ret = dm_remap_sync_io(file_bdev(device->main_dev), REQ_OP_WRITE | REQ_SYNC | fua,
+                                   unit + i, p, n);
+        } else if (!(slots[i].flags & (DM_REMAP_FLAG_ZERO | DM_REMAP_FLAG_COMPRESSED))) {
+            ret = dm_remap_spare_io_sync(device, REQ_OP_WRITE | REQ_SYNC | fua,
+                                         slots[i].spare_sector, p, n);
+            if (!ret)
+                ret = dm_remap_csum_note(device, unit + i, slots[i].spare_sector, p, n);
+        } else {
+            spin_lock_irqsave(&device->remap_lock, flags);
+            ret = dm_remap_alloc_spare_extent(device, n, 1, 0, &start);
+            spin_unlock_irqrestore(&device->remap_lock, flags);
+            if (ret)
+                return ret;
+            ret = dm_remap_spare_io_sync(device, REQ_OP_WRITE | REQ_SYNC | fua, start, p, n);
+            if (!ret)
+                ret = dm_remap_csum_note(device, unit + i, start, p, n);
+            spin_lock_irqsave(&device->remap_lock, flags);
+            if (!ret && !dm_remap_compress_switch(device, unit, slots, i, i + n, start, 0))
+                ret = -EAGAIN;
+            if (ret)
+                dm_remap_freelist_add(&device->spare_released, start, n);
+            spin_unlock_irqrestore(&device->remap_lock, flags);
+            if (ret)
+                return ret;
+            
+            if (slots[i].flags & DM_REMAP_FLAG_ZERO)
+                atomic64_inc(&device->zero_allocs);
+            for (j = 0; j < n; j++)
+                dm_remap_cache_insert(device, unit + i + j, start + j);
+            *commit = true;
+        }
+        if (ret)
+            return ret;
+        dm_remap_flatten_note(device, unit + i, n);
+    }
+    return 0;
+}
+
+/**
+ * dm_remap_compress_write() - Write slots @first..@end of a unit from @buf
+ * 
+ * v4.3: With compression on, a unit whose sectors are all remapped is
+ * completed from where its other sectors are now, compressed and stored
+ * as one extent. Anything else, or a unit that does not compress, is
+ * written as is (a unit that does not compress all of it, so that no
+ * part stays in an extent); so is one the compression path failed for.
+ */
+static int dm_remap_compress_write(struct dm_remap_device_v4_real *device, sector_t unit,
+                                   unsigned int first, unsigned int end, blk_opf_t fua,
+                                   void *buf, bool *commit)
+{
+    struct dm_remap_compress_slot slots[DM_REMAP_V4_COMPRESS_SECTORS];
+    u32 alg = READ_ONCE(device->tunables.compress);
+    unsigned int tries, clen, i, raw_first, raw_end;
+    unsigned long flags;
+    bool full;
+    int ret = -EAGAIN;
+    
+    for (tries = 0; tries < DM_REMAP_COMPRESS_TRIES && ret == -EAGAIN; tries++) {
+        spin_lock_irqsave(&device->remap_lock, flags);
+        dm_remap_compress_slots(device, unit, slots);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        
+        for (i = 0, full = true; i < DM_REMAP_V4_COMPRESS_SECTORS; i++)
+            full &= !!slots[i].flags;
+        
+        ret = -E2BIG;
+        raw_first = first;
+        raw_end = end;
+        if (alg && full) {
+            ret = dm_remap_compress_fill(device, unit, slots, 0, first, buf);
+            if (!ret)
+                ret = dm_remap_compress_fill(device, unit, slots, end,
+                                             DM_REMAP_V4_COMPRESS_SECTORS, buf);
+            if (!ret) {
+                ret = dm_remap_compress_unit(&device->compress, alg, unit, buf,
+                                             buf + 2 * PAGE_SIZE, &clen);
+                /* The whole unit is in @buf: leave none of it compressed */
+                if (ret == -E2BIG) {
+                    raw_first = 0;
+                    raw_end = DM_REMAP_V4_COMPRESS_SECTORS;
+                }
+            }
+            if (!ret)
+                ret = dm_remap_compress_store(device, unit, slots, buf + 2 * PAGE_SIZE,
+                                              clen, fua);
+            if (!ret)
+                *commit = true;
+        }
+        if (ret && ret != -EAGAIN)
+            ret = dm_remap_compress_write_raw(device, unit, slots, raw_first, raw_end, fua,
+                                              buf, commit);
+    }
+    return ret;
+}
+
+/* v4.3: Copy @len bytes between @buf and @bio at @iter, advancing it */
+static void dm_remap_bio_copy(struct bio *bio, struct bvec_iter *iter, void *buf,
+                              unsigned int len, bool to_bio)
+{
+    struct bio_vec bv;
+    
+    while (len) {
+        bv = bio_iter_iovec(bio, *iter);
+        bv.bv_len = min(bv.bv_len, len);
+        if (to_bio)
+            memcpy_to_bvec(&bv, buf);
+        else
+            memcpy_from_bvec(buf, &bv);
+        bio_advance_iter_single(bio, iter, bv.bv_len);
+        buf += bv.bv_len;
+        len -= bv.bv_len;
+    }
+}
+
+/**
+ * dm_remap_compress_bio() - Serve one bio held by dm_remap_map_compress()
+ * 
+ * v4.3: A unit at a time. Returns 0 or the first error.
+ */
+static int dm_remap_compress_bio(struct dm_remap_device_v4_real *device,
+                                 struct dm_remap_io_ctx *ctx, void *buf, bool *commit)
+{
+    struct bio *bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+    struct dm_remap_compress_slot slots[DM_REMAP_V4_COMPRESS_SECTORS];
+    sector_t sector, unit, end = ctx->orig_sector + ctx->nr_sectors;
+    struct bvec_iter iter = ctx->iter;
+    unsigned int first, last;
+    unsigned long flags;
+    int ret;
+    
+    for (sector = ctx->orig_sector; sector < end; sector = unit + last) {
+        unit = round_down(sector, DM_REMAP_V4_COMPRESS_SECTORS);
+        first = sector - unit;
+        last = min_t(sector_t, end - unit, DM_REMAP_V4_COMPRESS_SECTORS);
+        
+        if (op_is_write(bio_op(bio))) {
+            dm_remap_bio_copy(bio, &iter, buf + (first << SECTOR_SHIFT),
+                              (last - first) << SECTOR_SHIFT, false);
+            ret = dm_remap_compress_write(device, unit, first, last,
+                                          bio->bi_opf & REQ_FUA, buf, commit);
+        } else {
+            spin_lock_irqsave(&device->remap_lock, flags);
+            dm_remap_compress_slots(device, unit, slots);
+            spin_unlock_irqrestore(&device->remap_lock, flags);
+            ret = dm_remap_compress_fill(device, unit, slots, first, last, buf);
+            if (!ret)
+                dm_remap_bio_copy(bio, &iter, buf + (first << SECTOR_SHIFT),
+                                  (last - first) << SECTOR_SHIFT, true);
+        }
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/**
+ * dm_remap_compress_work() - Serve the bios held for compressed remaps
+ * 
+ * v4.3: Runs on the metadata workqueue; being one work item it never runs
+ * twice at once, so units are never read and rewritten by two bios at the
+ * same time. Writes that changed the table share one commit and are only
+ * acknowledged after it, as staged atomic writes are.
+ */
+static void dm_remap_compress_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device =
+        container_of(work, struct dm_remap_device_v4_real, compress_work);
+    struct dm_remap_io_ctx *ctx, *tmp;
+    struct dm_remap_io_scope scope;
+    bool commit = false;
+    unsigned long flags;
+    struct bio *bio;
+    LIST_HEAD(batch);
+    void *buf;
+    int ret = 0;
+    
+    BUILD_BUG_ON(DM_REMAP_COMPRESS_UNIT_BYTES > PAGE_SIZE);
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_splice_init(&device->compress_list, &batch);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    if (list_empty(&batch))
+        return;
+    
+    buf = __vmalloc(3 * PAGE_SIZE, GFP_NOIO);
+    list_for_each_entry(ctx, &batch, list) {
+        bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+        dm_remap_io_enter_bio(bio, &scope);
+        ret = buf ? dm_remap_compress_bio(device, ctx, buf, &commit) : -ENOMEM;
+        dm_remap_io_leave(&scope);
+        if (ret)
+            bio->bi_status = errno_to_blk_status(ret);
+    }
+    vfree(buf);
+    
+    ret = 0;
+    if (commit) {
+        dm_remap_io_enter(&device->ioclass, DM_REMAP_IOS_METADATA, &scope);
+        ret = dm_remap_csum_flush(device);
+        if (!ret)
+            ret = dm_remap_commit_metadata(device);
+        dm_remap_io_leave(&scope);
+        if (ret) {
+            /* The new mappings stay valid in memory; retry persisting them */
+            DMR_ERROR("Compressed remap commit failed: %d", ret);
+            device->metadata_dirty = true;
+            dm_remap_request_metadata_write(device);
+        }
+    }
+    
+    list_for_each_entry_safe(ctx, tmp, &batch, list) {
+        list_del_init(&ctx->list);
+        bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+        if (ret && op_is_write(bio_op(bio)) && !bio->bi_status)
+            bio->bi_status = errno_to_blk_status(ret);
+        ctx->flags |= DM_REMAP_IO_COMPRESS;
+        atomic64_inc(&device->compress_ios);
+        atomic64_add(ktime_get_ns() - ctx->start_ns, &device->compress_io_ns);
+        bio_endio(bio);
+    }
+}
+
+/**
+ * dm_remap_map_compress() - Hand a bio to the compress work
+ * 
+ * v4.3: Reads and writes of compressed runs, and with compression on
+ * every plain write to remapped sectors, so that nothing writes a unit's
+ * sectors while the work completes the unit from them.
+ */
+static int dm_remap_map_compress(struct dm_remap_device_v4_real *device,
+                                 struct dm_remap_io_ctx *ctx)
+{
+    struct bio *bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+    unsigned long flags;
+    
+    ctx->iter = bio->bi_iter;
+    ctx->start_ns = ktime_get_ns();
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_add_tail(&ctx->list, &device->compress_list);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    queue_work(device->metadata_workqueue, &device->compress_work);
+    return DM_MAPIO_SUBMITTED;
+}
+
+/**
+ * dm_remap_compress_enable() - Check and prepare a compression algorithm
+ * 
+ * v4.3: Extents are packed at sector granularity, which only 512-byte
+ * logical blocks can address, and protection information cannot follow
+ * data into one, so no other kind of device compresses (-EOPNOTSUPP).
+ * Otherwise the transform is allocated now, failing if the kernel does
+ * not have the algorithm.
+ */
+static int dm_remap_compress_enable(struct dm_remap_device_v4_real *device, u32 alg)
+{
+    if (device->block_sectors > 1 || device->integrity_enabled)
+        return -EOPNOTSUPP;
+    return dm_remap_compress_prepare(&device->compress, alg);
+}
+
+/**
+ * dm_remap_compress_copy_out() - Write a compressed run to a flatten target
+ * 
+ * v4.3: kcopyd cannot decompress, so the unit is read and decompressed
+ * here and the run written to @bdev synchronously. Process context only.
+ */
+static int dm_remap_compress_copy_out(struct dm_remap_device_v4_real *device, sector_t sector,
+                                      sector_t nr_sectors, struct block_device *bdev)
+{
+    struct dm_remap_compress_slot slots[DM_REMAP_V4_COMPRESS_SECTORS];
+    sector_t unit = round_down(sector, DM_REMAP_V4_COMPRESS_SECTORS);
+    unsigned int first = sector - unit;
+    unsigned long flags;
+    void *buf;
+    int ret;
+    
+    buf = __vmalloc(3 * PAGE_SIZE, GFP_NOIO);
+    if (!buf)
+        return -ENOMEM;
+    spin_lock_irqsave(&device->remap_lock, flags);
+    dm_remap_compress_slots(device, unit, slots);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    ret = dm_remap_compress_fill(device, unit, slots, first, first + nr_sectors, buf);
+    if (!ret)
+        ret = dm_remap_sync_io(bdev, REQ_OP_WRITE | REQ_SYNC, sector,
+                               buf + (first << SECTOR_SHIFT), nr_sectors);
+    vfree(buf);
+    return ret;
+}
+
+/**
+ * dm_remap_overlay_fill() - Read slots @first..@end of a unit, not on the overlay
+ * 
+ * v4.3: As dm_remap_compress_fill(), a run at a time, so that a failed
+ * main device run is recorded with no more than its own sectors.
+ */
+static int dm_remap_overlay_fill(struct dm_remap_device_v4_real *device, sector_t unit,
+                                 const struct dm_remap_compress_slot *slots,
+                                 unsigned int first, unsigned int end, void *buf)
+{
+    unsigned int i, n;
+    int ret;
+    
+    for (i = first; i < end; i += n) {
+        n = dm_remap_compress_run(slots, i, end);
+        ret = dm_remap_compress_fill(device, unit, slots, i, i + n, buf);
+        if (ret) {
+            if (!slots[i].flags)
+                dm_remap_forensic_note_error(&device->forensic, unit + i, n);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/**
+ * dm_remap_overlay_bio() - Serve one bio held by dm_remap_map_overlay()
+ * 
+ * v4.3: A unit at a time. Written sectors already on the overlay are
+ * rewritten where they are, the others get overlay space and are mapped
+ * once their data is there. Reads take each run from the overlay or from
+ * where the remap table has it. Returns 0 or the first error.
+ */
+static int dm_remap_overlay_bio(struct dm_remap_device_v4_real *device,
+                                struct dm_remap_io_ctx *ctx, void *buf)
+{
+    struct bio *bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+    struct dm_remap_compress_slot slots[DM_REMAP_V4_COMPRESS_SECTORS];
+    sector_t sector, unit, end = ctx->orig_sector + ctx->nr_sectors, overlay_sector;
+    struct block_device *overlay = device->overlay_dev ? file_bdev(device->overlay_dev) : NULL;
+    bool write = op_is_write(bio_op(bio)), mapped;
+    blk_opf_t fua = bio->bi_opf & REQ_FUA;
+    struct bvec_iter iter = ctx->iter;
+    unsigned int first, last, i, n;
+    unsigned long flags;
+    void *p;
+    int ret = 0;
+    
+    for (sector = ctx->orig_sector; sector < end; sector = unit + last) {
+        unit = round_down(sector, DM_REMAP_V4_COMPRESS_SECTORS);
+        first = sector - unit;
+        last = min_t(sector_t, end - unit, DM_REMAP_V4_COMPRESS_SECTORS);
+        
+        if (write) {
+            dm_remap_bio_copy(bio, &iter, buf + (first << SECTOR_SHIFT),
+                              (last - first) << SECTOR_SHIFT, false);
+        } else {
+            spin_lock_irqsave(&device->remap_lock, flags);
+            dm_remap_compress_slots(device, unit, slots);
+            spin_unlock_irqrestore(&device->remap_lock, flags);
+        }
+        
+        for (i = first; i < last && !ret; i += n) {
+            n = dm_remap_overlay_run(&device->forensic, unit + i, last - i,
+                                     &overlay_sector, &mapped);
+            p = buf + (i << SECTOR_SHIFT);
+            if (write) {
+                if (!mapped)
+                    ret = dm_remap_overlay_alloc(&device->forensic, n, &overlay_sector);
+                if (!ret)
+                    ret = dm_remap_sync_io(overlay, REQ_OP_WRITE | REQ_SYNC | fua,
+                                           overlay_sector, p, n);
+                if (!ret && !mapped)
+                    ret = dm_remap_overlay_insert(&device->forensic, unit + i, n,
+                                                  overlay_sector);
+            } else if (mapped) {
+                ret = dm_remap_sync_io(overlay, REQ_OP_READ | REQ_SYNC, overlay_sector, p, n);
+            } else {
+                ret = dm_remap_overlay_fill(device, unit, slots, i, i + n, buf);
+            }
+        }
+        if (ret)
+            return ret;
+        if (!write)
+            dm_remap_bio_copy(bio, &iter, buf + (first << SECTOR_SHIFT),
+                              (last - first) << SECTOR_SHIFT, true);
+    }
+    
+    atomic64_inc(write ? &device->forensic.writes : &device->forensic.reads);
+    return 0;
+}
+
+/**
+ * dm_remap_overlay_work() - Serve the bios held for the overlay
+ * 
+ * v4.3: One work item, so two bios never allocate overlay space for the
+ * same sectors at once.
+ */
+static void dm_remap_overlay_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device =
+        container_of(work, struct dm_remap_device_v4_real, overlay_work);
+    struct dm_remap_io_ctx *ctx, *tmp;
+    struct dm_remap_io_scope scope;
+    unsigned long flags;
+    struct bio *bio;
+    LIST_HEAD(batch);
+    void *buf;
+    int ret;
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_splice_init(&device->overlay_list, &batch);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    if (list_empty(&batch))
+        return;
+    
+    buf = __vmalloc(3 * PAGE_SIZE, GFP_NOIO);
+    list_for_each_entry_safe(ctx, tmp, &batch, list) {
+        list_del_init(&ctx->list);
+        bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+        dm_remap_io_enter_bio(bio, &scope);
+        ret = buf ? dm_remap_overlay_bio(device, ctx, buf) : -ENOMEM;
+        dm_remap_io_leave(&scope);
+        if (ret)
+            bio->bi_status = errno_to_blk_status(ret);
+        ctx->flags |= DM_REMAP_IO_OVERLAY;
+        bio_endio(bio);
+    }
+    vfree(buf);
+}
+
+/**
+ * dm_remap_map_overlay() - Hand a bio of a read-only target to the overlay work
+ * 
+ * v4.3: Every write, and reads of ranges with sectors on the overlay.
+ */
+static int dm_remap_map_overlay(struct dm_remap_device_v4_real *device,
+                                struct dm_remap_io_ctx *ctx)
+{
+    struct bio *bio = dm_bio_from_per_bio_data(ctx, sizeof(struct dm_remap_io_ctx));
+    unsigned long flags;
+    
+    ctx->iter = bio->bi_iter;
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_add_tail(&ctx->list, &device->overlay_list);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    queue_work(device->metadata_workqueue, &device->overlay_work);
+    return DM_MAPIO_SUBMITTED;
+}
+
+/**
+ * dm_remap_map_atomic_write() - Route a REQ_ATOMIC write without splitting it
+ * 
+ * v4.3: An atomic write must reach exactly one leg in one piece. If its range
+ * is entirely on the main device, or is one naturally aligned contiguous run
+ * on the spare, it is simply redirected. Otherwise it is staged through a new
+ * spare extent and switched in by dm_remap_atomic_commit_work(). If staging
+ * is disabled or not possible, the write is refused with BLK_STS_NOTSUPP so
+ * the submitter can fall back to non-atomic I/O instead of tearing.
+ */
+static int dm_remap_map_atomic_write(struct dm_remap_device_v4_real *device,
+                                     struct bio *bio, struct dm_remap_io_ctx *ctx)
+{
+    sector_t nr = ctx->nr_sectors, run = nr, spare_sector = 0;
+    sector_t align = is_power_of_2(nr) ? nr : device->block_sectors;
+    bool remapped = false, compressed;
+    unsigned long flags;
+    int ret = -EOPNOTSUPP;
+    
+    atomic64_inc(&device->atomic_writes);
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    if (device->remap_count_active) {
+        run = dm_remap_lookup_run(device, ctx->orig_sector, nr, &spare_sector, &remapped,
+                                  &compressed);
+        /* A misaligned spare run could cross an atomic boundary below us;
+         * a zero or compressed run has nowhere to take the write. With
+         * compression on, the compress work may be reading the run for its
+         * unit, so the write must change the table rather than the data. */
+        if (remapped && (!spare_sector || compressed || READ_ONCE(device->tunables.compress) ||
+                         !IS_ALIGNED(spare_sector, align)))
+            run = 0;
+    }
+    if (run < nr && atomic_write_staging &&
+        device->remap_count_active + nr <= DM_REMAP_V4_MAX_REMAPS)
+        ret = dm_remap_alloc_spare_extent(device, nr, align, 0, &spare_sector);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    if (run == nr) {
+        if (remapped) {
+            atomic64_inc(&device->stats.remapped_ios);
+            if (!dm_remap_spare_io_start(device, bio, ctx, spare_sector))
+                return DM_MAPIO_SUBMITTED;
+        } else {
+            atomic64_inc(&device->stats.normal_ios);
+            bio_set_dev(bio, file_bdev(device->main_dev));
+            bio->bi_iter.bi_sector = ctx->orig_sector;
+        }
+        return DM_MAPIO_REMAPPED;
+    }
+    
+    if (ret) {
+        atomic64_inc(&device->atomic_refused);
+        DMR_DEBUG(2, "Refusing atomic write at sector %llu (+%llu): straddles a remap (%d)",
+                  (unsigned long long)ctx->orig_sector, (unsigned long long)nr, ret);
+        ctx->flags |= DM_REMAP_IO_REFUSED;
+        bio->bi_status = BLK_STS_NOTSUPP;
+        bio_endio(bio);
+        return DM_MAPIO_SUBMITTED;
+    }
+    
+    DMR_DEBUG(2, "Staging atomic write at sector %llu (+%llu) through spare %llu",
+              (unsigned long long)ctx->orig_sector, (unsigned long long)nr,
+              (unsigned long long)spare_sector);
+    
+    atomic64_inc(&device->atomic_staged);
+    atomic64_inc(&device->stats.remapped_ios);
+    ctx->flags |= DM_REMAP_IO_STAGED;
+    ctx->stage_sector = spare_sector;
+    if (!dm_remap_spare_io_start(device, bio, ctx, spare_sector))
+        return DM_MAPIO_SUBMITTED;
+    return DM_MAPIO_REMAPPED;
+}
+
+/**
+ * dm_remap_map_v4_real() - Enhanced real device I/O mapping with optimization
+ * 
+ * v4.3: A bio is only ever sent to one leg. When its range crosses a remap
+ * boundary it is split there with dm_accept_partial_bio() and device-mapper
+ * resubmits the remainder, which is then mapped on its own.
+ */
+static int dm_remap_map_v4_real(struct dm_target *ti, struct bio *bio)
+{
+    struct dm_remap_device_v4_real *device = ti->private;
+    struct dm_remap_io_ctx *ctx = dm_per_bio_data(bio, sizeof(struct dm_remap_io_ctx));
+    bool is_read = bio_data_dir(bio) == READ;
+    uint64_t sector = dm_target_offset(ti, bio->bi_iter.bi_sector);
+    unsigned int bio_size = bio->bi_iter.bi_size;
+    ktime_t start_time = ktime_get();
+    ktime_t io_time;
+    uint64_t throughput;
+    int r = DM_MAPIO_REMAPPED;
+    
+    ctx->orig_sector = sector;
+    ctx->nr_sectors = bio_sectors(bio);
+    ctx->flags = 0;
+    ctx->retries = 0;
+    INIT_LIST_HEAD(&ctx->list);
+    
+    /* v4.3: Empty flushes are cloned once per leg (num_flush_bios = 2) */
+    if (unlikely(!ctx->nr_sectors)) {
+        /* v4.3: ... read-only, only the overlay has anything to flush */
+        if (unlikely(device->read_only) && real_device_mode &&
+            (!device->overlay_dev || dm_bio_get_target_bio_nr(bio) == 1)) {
+            ctx->flags |= DM_REMAP_IO_REFUSED;
+            bio_endio(bio);
+            return DM_MAPIO_SUBMITTED;
+        }
+        if (unlikely(device->read_only) && real_device_mode) {
+            bio_set_dev(bio, file_bdev(device->overlay_dev));
+            return DM_MAPIO_REMAPPED;
+        }
+        if (real_device_mode && device->main_dev && !IS_ERR(device->main_dev)) {
+            if (dm_bio_get_target_bio_nr(bio) == 1) {
+                if (!dm_remap_spare_io_start(device, bio, ctx, bio->bi_iter.bi_sector))
+                    return DM_MAPIO_SUBMITTED;
+            } else {
+                bio_set_dev(bio, file_bdev(device->main_dev));
+                dm_remap_leg_start(device, ctx, DM_REMAP_LEG_MAIN);
+            }
+        }
+        return DM_MAPIO_REMAPPED;
+    }
+    
+    /* Validate I/O parameters */
+    if (sector >= device->main_device_sectors) {
+        DMR_ERROR("I/O beyond device bounds: sector %llu >= %llu",
+                  (unsigned long long)sector,
+                  (unsigned long long)device->main_device_sectors);
+        return DM_MAPIO_KILL;
+    }
+    
+    /* Check alignment for optimal performance */
+    if (!dm_remap_check_device_alignment(device->main_dev, sector)) {
+        DMR_DEBUG(2, "Unaligned I/O detected at sector %llu", (unsigned long long)sector);
+    }
+    
+    /* Update statistics with enhanced tracking */
+    if (is_read) {
+        atomic64_inc(&device->read_count);
+        atomic64_inc(&global_reads);
+        dm_remap_stats_inc_reads();  /* Update stats module */
+    } else {
+        atomic64_inc(&device->write_count);
+        atomic64_inc(&global_writes);
+        dm_remap_stats_inc_writes();  /* Update stats module */
+    }
+    
+    atomic64_inc(&device->io_operations);
+    atomic64_inc(&device->stats.total_ios);
+    
+    /* Phase 1.4: Update I/O pattern analysis */
+    dm_remap_update_io_pattern(device, sector);
+    
+    /* v4.3: Read-only: writes go to the overlay, if there is one, and so
+     * do reads of ranges written there */
+    if (unlikely(device->read_only) && real_device_mode) {
+        if (!is_read && !device->overlay_dev) {
+            ctx->flags |= DM_REMAP_IO_REFUSED;
+            return DM_MAPIO_KILL;
+        }
+        if (!is_read || dm_remap_overlay_any(&device->forensic, sector, ctx->nr_sectors)) {
+            r = dm_remap_map_overlay(device, ctx);
+            goto remap_complete;
+        }
+    }
+    
+    /* Phase 1.4: Check for cached remap first (fast path)
+     * v4.3: Only a single-sector bio cannot straddle a remap boundary.
+     */
+    sector_t cached_remap = 0;
+    if (device->perf_optimizer.fast_path_enabled && ctx->nr_sectors == 1) {
+        cached_remap = dm_remap_cache_lookup(device, sector);
+        /* v4.3: A zeroing write turns the remap zero, on the slow path, and
+         * with compression on every write goes to the compress work */
+        if (cached_remap > 0 && !is_read &&
+            (READ_ONCE(device->tunables.compress) || dm_remap_bio_zeroing(bio)))
+            cached_remap = 0;
+        if (cached_remap > 0) {
+            /* Fast path: use cached remap */
+            atomic64_inc(&device->stats.remapped_ios);
+            
+            DMR_DEBUG(3, "Fast path remap: sector %llu -> %llu (cached)",
+                      (unsigned long long)sector, (unsigned long long)cached_remap);
+            
+            if (real_device_mode && device->spare_dev &&
+                !dm_remap_spare_io_start(device, bio, ctx, cached_remap)) {
+                r = DM_MAPIO_SUBMITTED;
+                goto remap_complete;
+            }
+            
+            goto remap_complete;
+        }
+    }
+    
+    DMR_DEBUG(3, "Enhanced I/O: %s %u bytes to sector %llu on %s",
+              is_read ? "read" : "write", bio_size,
+              (unsigned long long)sector,
+              real_device_mode ? dm_remap_get_device_name(device->main_dev) : "demo");
+    
+    /* Phase 1.3 Enhanced I/O routing with sector remapping */
+    if (real_device_mode && device->main_dev && !IS_ERR(device->main_dev)) {
+        sector_t run = ctx->nr_sectors;
+        sector_t spare_sector = 0;
+        bool remapped = false, zeroing, compressed = false;
+        unsigned long flags;
+        
+        /* v4.3: Atomic writes are never split */
+        if (unlikely(dm_remap_bio_is_atomic(bio))) {
+            r = dm_remap_map_atomic_write(device, bio, ctx);
+            goto remap_complete;
+        }
+        
+        /* Check if this range has been (partly) remapped */
+        if (unlikely(device->remap_count_active)) {
+            spin_lock_irqsave(&device->remap_lock, flags);
+            run = dm_remap_lookup_run(device, sector, ctx->nr_sectors,
+                                      &spare_sector, &remapped, &compressed);
+            spin_unlock_irqrestore(&device->remap_lock, flags);
+            
+            run = dm_remap_clamp_run(device, run, ctx->nr_sectors);
+            if (run < ctx->nr_sectors) {
+                dm_accept_partial_bio(bio, run);
+                /* DM core only trims the integrity payload at clone time */
+                if (bio_integrity(bio))
+                    bio_integrity_trim(bio);
+                ctx->nr_sectors = run;
+                atomic64_inc(&device->split_ios);
+            }
+        }
+        
+        if (remapped) {
+            /* Redirect to spare device */
+            DMR_DEBUG(3, "Remapped I/O: sector %llu -> %llu (spare device, %llu sectors)",
+                      (unsigned long long)sector,
+                      (unsigned long long)spare_sector,
+                      (unsigned long long)run);
+            
+            /* Update remap statistics */
+            atomic64_inc(&device->stats.remapped_ios);
+            if (is_read) {
+                atomic64_inc(&device->remap_count);
+                atomic64_inc(&global_remaps);
+            }
+            
+            /* v4.3: Zero runs, and writes that would make a run zero */
+            zeroing = !is_read && dm_remap_bio_zeroing(bio);
+            if (!spare_sector || zeroing)
+                r = dm_remap_map_zero(device, bio, ctx, zeroing, &spare_sector);
+            else if (compressed || (bio_op(bio) == REQ_OP_WRITE &&
+                                    READ_ONCE(device->tunables.compress)))
+                r = dm_remap_map_compress(device, ctx);
+            if (r == DM_MAPIO_REMAPPED &&
+                !dm_remap_spare_io_start(device, bio, ctx, spare_sector))
+                r = DM_MAPIO_SUBMITTED;
+        } else {
+            /* Normal I/O to main device */
+            atomic64_inc(&device->stats.normal_ios);
+            bio_set_dev(bio, file_bdev(device->main_dev));
+            bio->bi_iter.bi_sector = sector;
+            ctx->iter = bio->bi_iter;
+            ctx->flags |= DM_REMAP_IO_MAIN;
+        }
+        
+    } else {
+        /* Demo mode - simulate successful I/O */
+        DMR_DEBUG(3, "Demo mode I/O simulation");
+    }
+    
+remap_complete:
+    /* v4.3: Spare bios were counted before they could be submitted */
+    if (r == DM_MAPIO_REMAPPED && real_device_mode && !(ctx->flags & DM_REMAP_IO_SPARE))
+        dm_remap_leg_start(device, ctx, DM_REMAP_LEG_MAIN);
+    
+    /* v4.3: Protection information travels with the clone. The bip seed
+     * keeps the virtual LBA, so the bottom device's PI prepare/complete
+     * remaps reference tags to whichever leg and LBA the bio ends up on.
+     */
+    if (r == DM_MAPIO_REMAPPED && bio_integrity(bio)) {
+        atomic64_inc(&device->integrity_ios);
+        if (ctx->flags & DM_REMAP_IO_SPARE)
+            atomic64_inc(&device->integrity_remapped);
+    }
+    
+    /* Calculate and update performance metrics */
+    io_time = ktime_sub(ktime_get(), start_time);
+    atomic64_add(ktime_to_ns(io_time), &device->total_io_time_ns);
+    
+    /* Calculate throughput (bytes per second) */
+    if (ktime_to_ns(io_time) > 0) {
+        throughput = (uint64_t)bio_size * 1000000000ULL / ktime_to_ns(io_time);
+        if (throughput > device->peak_throughput) {
+            device->peak_throughput = throughput;
+        }
+    }
+    
+    /* Update metadata statistics */
+    if (is_read) {
+        device->metadata.total_reads++;
+    } else {
+        device->metadata.total_writes++;
+    }
+    device->metadata.total_io_time_ns += ktime_to_ns(io_time);
+    device->metadata.last_update = ktime_to_ns(ktime_get_real());
+    
+    return r;
+}
+
+/**
+ * dm_remap_spare_migrate_work() - Copy the spare to a new device and switch
+ * 
+ * v4.3: Copy passes run while I/O continues until few chunks are dirty
+ * again. Then spare I/O is held, the rest is copied and the new spare is
+ * flushed, and a new metadata generation is written and flushed to it.
+ * Only then does the target switch devices; the old spare is released once
+ * nothing can reach it any more and keeps its last metadata generation.
+ */
+static void dm_remap_spare_migrate_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device =
+        container_of(work, struct dm_remap_device_v4_real, spare_migrate_work);
+    struct dm_remap_spare_migration *m = device->migration;
+    struct file *old_dev = device->spare_dev;
+    struct file *new_dev = device->new_spare_dev;
+    sector_t new_sectors = dm_remap_get_device_size(new_dev);
+    struct dm_bufio_client *client, *old_client;
+    struct dm_remap_io_scope scope;
+    bool quiesced = false;
+    unsigned long flags;
+    int ret = 0;
+    
+    dm_remap_io_enter(&device->ioclass, DM_REMAP_IOS_COPY, &scope);
+    while (dm_remap_migration_dirty_chunks(m) > DM_REMAP_MIGRATE_SWITCH_CHUNKS &&
+           m->passes < DM_REMAP_MIGRATE_MAX_PASSES) {
+        if (READ_ONCE(device->migrate_cancel)) {
+            ret = -ECANCELED;
+            goto out;
+        }
+        ret = dm_remap_migration_copy_pass(m);
+        if (ret)
+            goto out;
+    }
+    
+    WRITE_ONCE(device->migrate_state, DM_REMAP_MIGRATE_SWITCHING);
+    dm_remap_spare_quiesce(device);
+    quiesced = true;
+    
+    ret = dm_remap_migration_copy_pass(m);
+    if (!ret)
+        ret = blkdev_issue_flush(file_bdev(new_dev));
+    if (ret)
+        goto out;
+    
+    /* v4.3: Metadata kept on a metadata device stays there */
+    if (device->meta_dev) {
+        client = device->metadata_bufio_client;
+    } else {
+        client = dm_bufio_client_create(file_bdev(new_dev), DM_REMAP_V4_METADATA_BLOCK_SIZE,
+                                        1, 0, NULL, NULL, 0);
+        if (IS_ERR(client)) {
+            ret = PTR_ERR(client);
+            goto out;
+        }
+    }
+    
+    /* New generation on the new spare only; the old one keeps the last */
+    mutex_lock(&device->metadata_mutex);
+    device->persistent_metadata->device_config.spare_device_sectors = new_sectors;
+    dm_remap_sync_persistent_metadata(device);
+    ret = dm_remap_write_metadata_v4_sync(client, device->persistent_metadata);
+    if (!ret) {
+        dm_remap_pipeline_metadata_write(&device->pipeline, DM_REMAP_METADATA_WRITE_BYTES);
+        ret = dm_bufio_issue_flush(client);
+    }
+    if (ret) {
+        device->persistent_metadata->device_config.spare_device_sectors =
+            device->spare_device_sectors;
+        mutex_unlock(&device->metadata_mutex);
+        if (client != device->metadata_bufio_client)
+            dm_bufio_client_destroy(client);
+        goto out;
+    }
+    
+    old_client = device->metadata_bufio_client;
+    device->metadata_bufio_client = client;
+    device->spare_dev = new_dev;
+    device->spare_device_sectors = new_sectors;
+    device->metadata.spare_device_size = new_sectors;
+    dm_remap_fill_dm_dev(&device->spare_dm_dev, new_dev);
+    WRITE_ONCE(device->repair_ctx.spare_bdev, file_bdev(new_dev));
+    WRITE_ONCE(device->repair_ctx.bufio_client, client);
+    mutex_unlock(&device->metadata_mutex);
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    device->spare_sector_count = new_sectors / 2;
+    strscpy(device->spare_path, device->new_spare_path, sizeof(device->spare_path));
+    WRITE_ONCE(device->migration, NULL);
+    device->new_spare_dev = NULL;
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    dm_remap_spare_unquiesce(device);
+    
+    /* Repair and scrub may still be reading the old spare */
+    flush_work(&device->repair_ctx.repair_work);
+    cancel_delayed_work_sync(&device->repair_ctx.periodic_scrub_work);
+    if (atomic_read(&device->repair_ctx.scrub_enabled))
+        queue_delayed_work(device->repair_wq, &device->repair_ctx.periodic_scrub_work,
+                           msecs_to_jiffies(device->repair_ctx.scrub_interval_seconds * 1000));
+    
+    if (old_client != client)
+        dm_bufio_client_destroy(old_client);
+    dm_remap_close_bdev_real(old_dev);
+    
+    dm_remap_io_leave(&scope);
+    DMR_INFO("Spare replaced by %s (%llu sectors) after %u passes, %lld sectors copied",
+             device->spare_path, (unsigned long long)new_sectors, m->passes,
+             (long long)atomic64_read(&m->copied_sectors));
+    dm_remap_migration_destroy(m);
+    kfree(m);
+    WRITE_ONCE(device->migrate_error, 0);
+    WRITE_ONCE(device->migrate_state, DM_REMAP_MIGRATE_DONE);
+    dm_table_event(device->ti->table);
+    return;
+    
+out:
+    /* Nothing may still be marking chunks when the migration goes away */
+    if (!quiesced)
+        dm_remap_spare_quiesce(device);
+    spin_lock_irqsave(&device->remap_lock, flags);
+    device->spare_sector_count = device->migrate_saved_spare_count;
+    WRITE_ONCE(device->migration, NULL);
+    device->new_spare_dev = NULL;
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    dm_remap_spare_unquiesce(device);
+    
+    dm_remap_close_bdev_real(new_dev);
+    dm_remap_migration_destroy(m);
+    kfree(m);
+    dm_remap_io_leave(&scope);
+    
+    if (ret == -ECANCELED) {
+        DMR_INFO("Spare replacement cancelled");
+        WRITE_ONCE(device->migrate_state, DM_REMAP_MIGRATE_CANCELLED);
+    } else {
+        DMR_ERROR("Spare replacement failed: %d", ret);
+        WRITE_ONCE(device->migrate_state, DM_REMAP_MIGRATE_FAILED);
+    }
+    WRITE_ONCE(device->migrate_error, ret);
+    dm_table_event(device->ti->table);
+}
+
+/**
+ * dm_remap_spare_migrate_start() - Begin moving the spare to another device
+ * 
+ * v4.3: The new device must take every spare sector handed out so far, at
+ * the same offsets. Until the switch the allocator is kept within both
+ * devices. Returns 0 or a negative errno with *@error set.
+ */
+static int dm_remap_spare_migrate_start(struct dm_remap_device_v4_real *device,
+                                        const char *path, const char **error)
+{
+    struct dm_remap_spare_migration *m;
+    struct file *new_dev;
+    sector_t new_sectors;
+    unsigned long flags;
+    int ret;
+    
+    if (!real_device_mode || !device->spare_dev) {
+        *error = "Spare replacement needs real device mode";
+        return -EOPNOTSUPP;
+    }
+    if (!atomic_read(&device->metadata_loaded) || !atomic_read(&device->device_active)) {
+        *error = "Device not ready";
+        return -EBUSY;
+    }
+    if (READ_ONCE(device->migration)) {
+        *error = "Spare replacement already running";
+        return -EBUSY;
+    }
+    
+    new_dev = dm_remap_open_bdev_real(path, BLK_OPEN_READ | BLK_OPEN_WRITE, device->ti);
+    if (IS_ERR(new_dev)) {
+        *error = "Cannot open new spare device";
+        return PTR_ERR(new_dev);
+    }
+    
+    ret = -EINVAL;
+    if (file_bdev(new_dev) == file_bdev(device->spare_dev) ||
+        file_bdev(new_dev) == file_bdev(device->main_dev)) {
+        *error = "New spare must be a different device";
+        goto out_close;
+    }
+    if (dm_remap_get_sector_size(new_dev) > device->block_sectors << SECTOR_SHIFT) {
+        *error = "New spare has a larger logical block size";
+        goto out_close;
+    }
+    if (device->integrity_enabled && !dm_remap_integrity_compatible(device->main_dev, new_dev)) {
+        *error = "New spare has a different integrity profile";
+        goto out_close;
+    }
+    new_sectors = dm_remap_get_device_size(new_dev);
+    
+    m = kmalloc(sizeof(*m), GFP_KERNEL);
+    if (!m) {
+        ret = -ENOMEM;
+        *error = "Out of memory";
+        goto out_close;
+    }
+    ret = dm_remap_migration_init(m, file_bdev(device->spare_dev), file_bdev(new_dev),
+                                  device->spare_sector_count);
+    if (ret) {
+        *error = "Cannot set up copy";
+        kfree(m);
+        goto out_close;
+    }
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    if (device->migration) {
+        *error = "Spare replacement already running";
+        ret = -EBUSY;
+    } else if (device->flatten) {
+        *error = "Flatten running";
+        ret = -EBUSY;
+    } else if (device->next_spare_sector > new_sectors / 2) {
+        *error = "New spare too small for the spare sectors in use";
+        ret = -ENOSPC;
+    } else {
+        device->migrate_saved_spare_count = device->spare_sector_count;
+        device->spare_sector_count = min(device->spare_sector_count, new_sectors / 2);
+        if (device->next_spare_sector > DM_REMAP_V4_SPARE_DATA_START)
+            dm_remap_migration_mark(m, DM_REMAP_V4_SPARE_DATA_START,
+                                    device->next_spare_sector - DM_REMAP_V4_SPARE_DATA_START);
+        device->new_spare_dev = new_dev;
+        strscpy(device->new_spare_path, path, sizeof(device->new_spare_path));
+        device->migrate_cancel = false;
+        device->migrate_error = 0;
+        device->migrate_state = DM_REMAP_MIGRATE_COPYING;
+        WRITE_ONCE(device->migration, m);
+    }
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    if (ret) {
+        dm_remap_migration_destroy(m);
+        kfree(m);
+        goto out_close;
+    }
+    
+    DMR_INFO("Replacing spare %s with %s (%llu sectors to copy)", device->spare_path, path,
+             (unsigned long long)(device->next_spare_sector - DM_REMAP_V4_SPARE_DATA_START));
+    queue_work(device->repair_wq, &device->spare_migrate_work);
+    return 0;
+    
+out_close:
+    dm_remap_close_bdev_real(new_dev);
+    return ret;
+}
+
+/* v4.3: The flatten record in the metadata expansion area */
+static inline struct dm_remap_v4_flatten_info *dm_remap_flatten_info(struct dm_remap_device_v4_real *device)
+{
+    return (struct dm_remap_v4_flatten_info *)
+        (device->persistent_metadata->future_expansion.expansion_data +
+         DM_REMAP_V4_FLATTEN_INFO_OFFSET);
+}
+
+/**
+ * dm_remap_flatten_record() - Commit the flatten record
+ * @flags: DM_REMAP_V4_FLATTEN_*, 0 removes the record
+ * @cursor: Sectors copied, trusted with DM_REMAP_V4_FLATTEN_CLEAN only
+ * 
+ * Process context only. Returns 0 or a commit error.
+ */
+static int dm_remap_flatten_record(struct dm_remap_device_v4_real *device, u32 flags,
+                                   sector_t cursor)
+{
+    struct dm_remap_metadata_v4 *pm = device->persistent_metadata;
+    struct dm_remap_v4_flatten_info *info = dm_remap_flatten_info(device);
+    
+    mutex_lock(&device->metadata_mutex);
+    memset(info, 0, sizeof(*info));
+    if (flags) {
+        strscpy(info->path, device->flatten_path, sizeof(info->path));
+        info->nr_sectors = device->ti->len;
+        info->cursor_sector = cursor;
+        info->flags = flags;
+        pm->future_expansion.expansion_version |= DM_REMAP_V4_EXPANSION_FLATTEN;
+        pm->future_expansion.expansion_size =
+            max_t(u32, pm->future_expansion.expansion_size,
+                  DM_REMAP_V4_FLATTEN_INFO_OFFSET + sizeof(*info));
+    } else {
+        pm->future_expansion.expansion_version &= ~DM_REMAP_V4_EXPANSION_FLATTEN;
+    }
+    mutex_unlock(&device->metadata_mutex);
+    return dm_remap_commit_metadata(device);
+}
+
+/**
+ * dm_remap_flatten_note() - A range of the target changed under a running flatten
+ * 
+ * v4.3: Completed writes and remaps that moved data. A copy that has
+ * caught up is woken to copy the range again. Any context.
+ */
+static void dm_remap_flatten_note(struct dm_remap_device_v4_real *device, sector_t sector,
+                                  sector_t nr_sectors)
+{
+    unsigned long flags;
+    bool kick = false;
+    
+    if (likely(!READ_ONCE(device->flatten)))
+        return;
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    if (device->flatten)
+        kick = dm_remap_flatten_mark(device->flatten, sector, nr_sectors) &&
+               READ_ONCE(device->flatten_state) == DM_REMAP_FLATTEN_SYNCED;
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    if (kick)
+        queue_delayed_work(device->repair_wq, &device->flatten_work, 0);
+}
+
+/**
+ * dm_remap_flatten_chunk() - Issue the copies for one chunk
+ * 
+ * Runs on the main device are copied from there, runs of ACTIVE remaps
+ * from the spare, as the target would read them now. Compressed runs are
+ * decompressed and written here, synchronously.
+ */
+static void dm_remap_flatten_chunk(struct dm_remap_device_v4_real *device,
+                                   struct dm_remap_flatten *f, unsigned long chunk)
+{
+    sector_t sector = (sector_t)chunk * DM_REMAP_FLATTEN_CHUNK_SECTORS;
+    sector_t end = min_t(sector_t, sector + DM_REMAP_FLATTEN_CHUNK_SECTORS, f->nr_sectors);
+    struct dm_io_region from;
+    sector_t run, spare_sector = 0;
+    unsigned long flags;
+    bool remapped, compressed;
+    
+    while (sector < end) {
+        spin_lock_irqsave(&device->remap_lock, flags);
+        run = dm_remap_lookup_run(device, sector, end - sector, &spare_sector, &remapped,
+                                  &compressed);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        
+        if (remapped && !spare_sector) {
+            dm_remap_flatten_zero(f, sector, run);
+            sector += run;
+            continue;
+        }
+        if (compressed) {
+            dm_remap_flatten_written(f, run, dm_remap_compress_copy_out(device, sector, run,
+                                                                        f->dst));
+            sector += run;
+            continue;
+        }
+        from.bdev = file_bdev(remapped ? device->spare_dev : device->main_dev);
+        from.sector = remapped ? spare_sector : sector;
+        from.count = run;
+        dm_remap_flatten_copy(f, &from, sector);
+        sector += run;
+    }
+}
+
+/**
+ * dm_remap_flatten_stop() - End a flatten that failed or was cancelled
+ * 
+ * The record is removed, so a later table does not carry on with it.
+ * Caller holds flatten_mutex; nothing is being copied.
+ */
+static void dm_remap_flatten_stop(struct dm_remap_device_v4_real *device, int ret)
+{
+    struct dm_remap_flatten *f = device->flatten;
+    unsigned long flags;
+    
+    spin_lock_irqsave(&device->remap_lock, flags);
+    WRITE_ONCE(device->flatten, NULL);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
     
-    /* Get capacities in bytes */
-    main_capacity = dm_remap_get_device_capacity_bytes(main_dev);
-    spare_capacity = dm_remap_get_device_capacity_bytes(spare_dev);
+    dm_remap_flatten_destroy(f);
+    kfree(f);
+    dm_remap_close_bdev_real(device->flatten_dev);
+    device->flatten_dev = NULL;
     
-    DMR_DEBUG(2, "Device geometry: main=%llu sectors (%u/%u bytes), spare=%llu sectors (%u/%u bytes)",
-              (unsigned long long)main_size, main_sector_size, main_physical_size,
-              (unsigned long long)spare_size, spare_sector_size, spare_physical_size);
+    if (dm_remap_flatten_record(device, 0, 0))
+        DMR_WARN("Failed to remove the flatten record");
     
-    /* Validate sector size compatibility */
-    if (main_sector_size != spare_sector_size) {
-        DMR_ERROR("Sector size mismatch: main=%u, spare=%u bytes",
-                  main_sector_size, spare_sector_size);
-        return -EINVAL;
+    if (ret == -ECANCELED) {
+        DMR_INFO("Flatten to %s cancelled", device->flatten_path);
+        WRITE_ONCE(device->flatten_state, DM_REMAP_FLATTEN_CANCELLED);
+    } else {
+        DMR_ERROR("Flatten to %s failed: %d", device->flatten_path, ret);
+        WRITE_ONCE(device->flatten_state, DM_REMAP_FLATTEN_FAILED);
     }
+    WRITE_ONCE(device->flatten_error, ret);
+    dm_table_event(device->ti->table);
+}
+
+/**
+ * dm_remap_flatten_work() - Copy the next batch of chunks
+ * 
+ * v4.3: Chunks written since they were copied go first, then the first
+ * pass moves on. Between batches the work waits long enough to keep the
+ * reads within flatten_rate. A failed batch is retried a second later, up
+ * to DM_REMAP_FLATTEN_MAX_FAILURES times in a row. Once the first pass is
+ * done and nothing is dirty the copy is "synced" and only runs again when
+ * a write marks a chunk.
+ */
+static void dm_remap_flatten_work(struct work_struct *work)
+{
+    struct dm_remap_device_v4_real *device =
+        container_of(to_delayed_work(work), struct dm_remap_device_v4_real, flatten_work);
+    unsigned long chunks[DM_REMAP_FLATTEN_BATCH_CHUNKS], chunk;
+    struct dm_remap_flatten *f;
+    unsigned int i, nr = 0;
+    unsigned long delay = 0;
+    struct dm_remap_io_scope scope;
+    u64 copied;
+    u32 rate;
+    int ret;
     
-    /* Check minimum size requirements */
-    if (main_size < DM_REMAP_MIN_DEVICE_SECTORS) {
-        DMR_ERROR("Main device too small: %llu < %u sectors",
-                  (unsigned long long)main_size, DM_REMAP_MIN_DEVICE_SECTORS);
-        return -ENOSPC;
+    mutex_lock(&device->flatten_mutex);
+    dm_remap_io_enter(&device->ioclass, DM_REMAP_IOS_COPY, &scope);
+    f = device->flatten;
+    if (!f)
+        goto out;
+    if (READ_ONCE(device->flatten_cancel)) {
+        dm_remap_flatten_stop(device, -ECANCELED);
+        goto out;
     }
     
-    /* Calculate minimum spare size using intelligent algorithm (v4.0.1)
-     * 
-     * LEGACY MODE (strict_spare_sizing=true):
-     *   min_spare = main_size * 1.05
-     *   
-     * OPTIMIZED MODE (strict_spare_sizing=false, default):
-     *   Components:
-     *   1. Metadata base: 4KB
-     *   2. Expected bad sectors: main_size * spare_overhead_percent / 100
-     *   3. Mapping overhead: expected_bad_sectors * 64 bytes per entry
-     *   4. Safety margin: 20% of calculated need
-     *   
-     * Example with 1TB main, 2% expected bad sectors:
-     *   - Bad sectors: 1TB * 2% = 20GB
-     *   - Metadata: 4KB + (20GB/512 * 64 bytes) = ~2.5MB
-     *   - Safety margin: (20GB + 2.5MB) * 1.2 = 24GB
-     *   - Total: ~24GB spare instead of 1.05TB!
-     */
-    if (strict_spare_sizing) {
-        /* Legacy mode: spare must be >= main + 5% */
-        min_spare_size = main_size + (main_size / 20);
-        DMR_INFO("Using strict spare sizing (legacy): %llu sectors required",
-                 (unsigned long long)min_spare_size);
-    } else {
-        /* Optimized mode: calculate realistic minimum */
-        sector_t metadata_sectors;
-        sector_t expected_bad_sectors;
-        sector_t mapping_overhead_sectors;
-        sector_t base_requirement;
-        
-        /* Clamp overhead percentage to sane range (0-20%) */
-        uint overhead_pct = spare_overhead_percent;
-        if (overhead_pct > 20) {
-            DMR_INFO("Clamping spare_overhead_percent from %u to 20%%", overhead_pct);
-            overhead_pct = 20;
-        }
-        
-        /* Calculate components */
-        metadata_sectors = DM_REMAP_METADATA_BASE_SIZE / main_sector_size + 1;
-        expected_bad_sectors = (main_size * overhead_pct) / 100;
-        mapping_overhead_sectors = (expected_bad_sectors * DM_REMAP_METADATA_PER_MAPPING) / main_sector_size + 1;
-        
-        /* Base requirement = metadata + bad sectors + mapping overhead */
-        base_requirement = metadata_sectors + expected_bad_sectors + mapping_overhead_sectors;
-        
-        /* Add safety margin (20%) */
-        min_spare_size = base_requirement + (base_requirement * DM_REMAP_SAFETY_MARGIN_PCT / 100);
-        
-        DMR_INFO("Optimized spare sizing calculation:");
-        DMR_INFO("  Main device: %llu sectors (%llu MB)",
-                 (unsigned long long)main_size,
-                 (unsigned long long)(main_size * main_sector_size / (1024*1024)));
-        DMR_INFO("  Expected bad sectors (%u%%): %llu sectors (%llu MB)",
-                 overhead_pct,
-                 (unsigned long long)expected_bad_sectors,
-                 (unsigned long long)(expected_bad_sectors * main_sector_size / (1024*1024)));
-        DMR_INFO("  Metadata overhead: %llu sectors (%llu KB)",
-                 (unsigned long long)(metadata_sectors + mapping_overhead_sectors),
-                 (unsigned long long)((metadata_sectors + mapping_overhead_sectors) * main_sector_size / 1024));
-        DMR_INFO("  Minimum spare (with %u%% safety margin): %llu sectors (%llu MB)",
-                 DM_REMAP_SAFETY_MARGIN_PCT,
-                 (unsigned long long)min_spare_size,
-                 (unsigned long long)(min_spare_size * main_sector_size / (1024*1024)));
+    copied = atomic64_read(&f->copied_sectors);
+    for_each_set_bit(chunk, f->dirty, f->nr_chunks) {
+        if (nr == DM_REMAP_FLATTEN_BATCH_CHUNKS)
+            break;
+        if (!test_and_clear_bit(chunk, f->dirty))
+            continue;
+        chunks[nr++] = chunk;
+        dm_remap_flatten_chunk(device, f, chunk);
+    }
+    while (nr < DM_REMAP_FLATTEN_BATCH_CHUNKS && f->cursor < f->nr_chunks) {
+        chunk = f->cursor;
+        WRITE_ONCE(f->cursor, chunk + 1);
+        smp_mb();  /* Pairs with dm_remap_flatten_mark() */
+        chunks[nr++] = chunk;
+        dm_remap_flatten_chunk(device, f, chunk);
     }
     
-    /* Spare device should have adequate capacity */
-    if (spare_size < min_spare_size) {
-        if (strict_spare_sizing) {
-            DMR_ERROR("Spare device insufficient: %llu < %llu sectors (need %llu + 5%% overhead)",
-                      (unsigned long long)spare_size, (unsigned long long)min_spare_size,
-                      (unsigned long long)main_size);
-        } else {
-            DMR_ERROR("Spare device insufficient: %llu < %llu sectors", 
-                      (unsigned long long)spare_size, (unsigned long long)min_spare_size);
-            DMR_ERROR("  Increase spare size or reduce spare_overhead_percent parameter");
-            DMR_ERROR("  Current overhead: %u%%, try lower value or use strict_spare_sizing=1",
-                      spare_overhead_percent);
+    ret = dm_remap_flatten_wait(f);
+    if (ret) {
+        for (i = 0; i < nr; i++)
+            set_bit(chunks[i], f->dirty);
+        atomic64_inc(&f->copy_errors);
+        if (++device->flatten_failures >= DM_REMAP_FLATTEN_MAX_FAILURES) {
+            dm_remap_flatten_stop(device, ret);
+            goto out;
         }
-        return -ENOSPC;
+        DMR_WARN("Flatten copy of chunk %lu and %u more failed (error=%d), retrying",
+                 chunks[0], nr - 1, ret);
+        queue_delayed_work(device->repair_wq, &device->flatten_work, HZ);
+        goto out;
+    }
+    device->flatten_failures = 0;
+    
+    if (f->cursor < f->nr_chunks || dm_remap_flatten_dirty_chunks(f)) {
+        rate = READ_ONCE(device->tunables.flatten_rate);
+        copied = atomic64_read(&f->copied_sectors) - copied;
+        if (rate)
+            delay = msecs_to_jiffies(div_u64(copied * MSEC_PER_SEC,
+                                             (u64)rate << (20 - SECTOR_SHIFT)));
+        queue_delayed_work(device->repair_wq, &device->flatten_work, delay);
+        goto out;
     }
     
-    /* Success - log the spare utilization efficiency */
-    {
-        u64 spare_size_mb = (spare_size * main_sector_size) / (1024*1024);
-        u64 main_size_mb = (main_size * main_sector_size) / (1024*1024);
-        uint efficiency_pct = (spare_size_mb * 100) / main_size_mb;
+    if (READ_ONCE(device->flatten_state) == DM_REMAP_FLATTEN_COPYING) {
+        WRITE_ONCE(device->flatten_state, DM_REMAP_FLATTEN_SYNCED);
+        DMR_INFO("Flatten to %s caught up after %lld sectors; suspend the target to finish",
+                 device->flatten_path, (long long)atomic64_read(&f->copied_sectors));
+        dm_table_event(device->ti->table);
         
-        if (efficiency_pct < 10) {
-            DMR_INFO("Excellent spare efficiency: %llu MB spare for %llu MB main (%u%%)",
-                     (unsigned long long)spare_size_mb, (unsigned long long)main_size_mb, efficiency_pct);
-        } else if (efficiency_pct < 50) {
-            DMR_INFO("Good spare efficiency: %llu MB spare for %llu MB main (%u%%)",
-                     (unsigned long long)spare_size_mb, (unsigned long long)main_size_mb, efficiency_pct);
-        } else {
-            DMR_INFO("Consider RAID1 mirroring: %llu MB spare for %llu MB main (%u%%)",
-                     (unsigned long long)spare_size_mb, (unsigned long long)main_size_mb, efficiency_pct);
-        }
+        /* A chunk marked before the state changed did not wake us */
+        smp_mb();
+        if (dm_remap_flatten_dirty_chunks(f))
+            queue_delayed_work(device->repair_wq, &device->flatten_work, 0);
     }
+out:
+    dm_remap_io_leave(&scope);
+    mutex_unlock(&device->flatten_mutex);
+}
+
+/**
+ * dm_remap_flatten_begin() - Open the replacement device and start copying
+ * @start: Sectors already copied by an earlier run stopped cleanly
+ * 
+ * The record is committed without DM_REMAP_V4_FLATTEN_CLEAN before the
+ * copy starts, so the cursor is not trusted again until the next suspend.
+ * Caller holds flatten_mutex. Returns 0 or a negative errno with *@error
+ * set.
+ */
+static int dm_remap_flatten_begin(struct dm_remap_device_v4_real *device, const char *path,
+                                  sector_t start, const char **error)
+{
+    struct dm_remap_flatten *f;
+    struct file *dev;
+    unsigned long flags;
+    int ret;
     
-    /* Warn about physical sector size differences */
-    if (main_physical_size != spare_physical_size) {
-        DMR_INFO("Physical sector size difference: main=%u, spare=%u bytes (performance may vary)",
-                 main_physical_size, spare_physical_size);
+    dev = dm_remap_open_bdev_real(path, BLK_OPEN_READ | BLK_OPEN_WRITE, device->ti);
+    if (IS_ERR(dev)) {
+        *error = "Cannot open replacement device";
+        return PTR_ERR(dev);
     }
     
-    /* Check device alignment for first sector */
-    if (!dm_remap_check_device_alignment(main_dev, 0)) {
-        DMR_ERROR("Main device not properly aligned");
-        return -EINVAL;
+    ret = -EINVAL;
+    if (file_bdev(dev) == file_bdev(device->main_dev) ||
+        file_bdev(dev) == file_bdev(device->spare_dev)) {
+        *error = "Replacement must be a different device";
+        goto out_close;
+    }
+    if (dm_remap_get_sector_size(dev) > device->block_sectors << SECTOR_SHIFT) {
+        *error = "Replacement has a larger logical block size";
+        goto out_close;
+    }
+    if (dm_remap_get_device_size(dev) < device->ti->len) {
+        *error = "Replacement smaller than the target";
+        ret = -ENOSPC;
+        goto out_close;
     }
     
-    if (!dm_remap_check_device_alignment(spare_dev, 0)) {
-        DMR_ERROR("Spare device not properly aligned");  
-        return -EINVAL;
+    f = kmalloc(sizeof(*f), GFP_KERNEL);
+    if (!f) {
+        ret = -ENOMEM;
+        *error = "Out of memory";
+        goto out_close;
+    }
+    ret = dm_remap_flatten_init(f, file_bdev(dev), device->ti->len, start);
+    if (ret) {
+        *error = "Cannot set up copy";
+        kfree(f);
+        goto out_close;
     }
     
-    DMR_INFO("Enhanced device compatibility validated:");
-    DMR_INFO("  Main: %llu sectors, %llu bytes (%u/%u sector size)",
-             (unsigned long long)main_size, main_capacity, main_sector_size, main_physical_size);
-    DMR_INFO("  Spare: %llu sectors, %llu bytes (%u/%u sector size)",
-             (unsigned long long)spare_size, spare_capacity, spare_sector_size, spare_physical_size);
-    DMR_INFO("  Overhead available: %llu sectors (%llu%% of main size)",
-             (unsigned long long)(spare_size - main_size),
-             (unsigned long long)((spare_size - main_size) * 100 / main_size));
+    strscpy(device->flatten_path, path, sizeof(device->flatten_path));
+    ret = dm_remap_flatten_record(device, DM_REMAP_V4_FLATTEN_ACTIVE,
+                                  (sector_t)f->cursor * DM_REMAP_FLATTEN_CHUNK_SECTORS);
+    if (ret) {
+        *error = "Metadata commit failed";
+        dm_remap_flatten_destroy(f);
+        kfree(f);
+        goto out_close;
+    }
     
+    device->flatten_dev = dev;
+    device->flatten_cancel = false;
+    device->flatten_failures = 0;
+    device->flatten_error = 0;
+    WRITE_ONCE(device->flatten_state, DM_REMAP_FLATTEN_COPYING);
+    spin_lock_irqsave(&device->remap_lock, flags);
+    WRITE_ONCE(device->flatten, f);
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
+    DMR_INFO("Flattening onto %s from sector %llu (%llu sectors)", path,
+             (unsigned long long)min_t(sector_t, (sector_t)f->cursor *
+                                       DM_REMAP_FLATTEN_CHUNK_SECTORS, f->nr_sectors),
+             (unsigned long long)f->nr_sectors);
+    queue_delayed_work(device->repair_wq, &device->flatten_work, 0);
     return 0;
+    
+out_close:
+    dm_remap_close_bdev_real(dev);
+    return ret;
 }
 
 /**
- * dm_remap_initialize_metadata_v4_real() - Initialize enhanced v4.0 metadata
+ * dm_remap_flatten_start() - Begin copying the target to a replacement device
+ * 
+ * v4.3: Not together with a spare replacement; both read the spare
+ * outside the I/O path. Returns 0 or a negative errno with *@error set.
  */
-static void dm_remap_initialize_metadata_v4_real(struct dm_remap_device_v4_real *device)
+static int dm_remap_flatten_start(struct dm_remap_device_v4_real *device, const char *path,
+                                  const char **error)
 {
-    struct dm_remap_metadata_v4_real *meta = &device->metadata;
-    ktime_t now = ktime_get_real();
+    int ret;
     
-    /* Initialize header */
-    strncpy(meta->magic, "DM_REMAP_V4.0R", sizeof(meta->magic));
-    meta->version = 4;
-    meta->metadata_size = sizeof(*meta);
-    meta->creation_time = ktime_to_ns(now);
-    meta->last_update = meta->creation_time;
+    if (!real_device_mode || !device->spare_dev) {
+        *error = "Flatten needs real device mode";
+        return -EOPNOTSUPP;
+    }
+    if (!atomic_read(&device->metadata_loaded) || !atomic_read(&device->device_active)) {
+        *error = "Device not ready";
+        return -EBUSY;
+    }
     
-    /* Device identification */
-    strncpy(meta->main_device_path, device->main_path, sizeof(meta->main_device_path) - 1);
-    strncpy(meta->spare_device_path, device->spare_path, sizeof(meta->spare_device_path) - 1);
-    meta->main_device_size = device->main_device_sectors;
-    meta->spare_device_size = device->spare_device_sectors;
+    mutex_lock(&device->flatten_mutex);
+    if (device->flatten) {
+        *error = "Flatten already running";
+        ret = -EBUSY;
+    } else if (READ_ONCE(device->migration)) {
+        *error = "Spare replacement running";
+        ret = -EBUSY;
+    } else {
+        ret = dm_remap_flatten_begin(device, path, 0, error);
+    }
+    mutex_unlock(&device->flatten_mutex);
+    return ret;
+}
+
+/**
+ * dm_remap_flatten_load() - Carry on with the flatten of an earlier table
+ * 
+ * v4.3: Runs while the metadata is loaded, before any I/O. The copy goes
+ * on from the recorded cursor if the last suspend left it clean and the
+ * target has the same length, from the start otherwise. If the device
+ * cannot be opened the record is removed: writes from now on would not be
+ * tracked. A copy that was done is only reported: the replacement has
+ * likely been switched to, and writing it now would corrupt it.
+ */
+static void dm_remap_flatten_load(struct dm_remap_device_v4_real *device)
+{
+    struct dm_remap_v4_flatten_info *info;
+    char path[sizeof(info->path) + 1];
+    const char *error = NULL;
+    sector_t start = 0;
+    int ret;
     
-    /* Generate device fingerprint based on device characteristics */
-    snprintf(meta->device_fingerprint, sizeof(meta->device_fingerprint),
-             "v4r-%08llx-%08llx", 
-             (unsigned long long)meta->main_device_size,
-             (unsigned long long)meta->spare_device_size);
+    if (!device->persistent_metadata || !device->spare_dev ||
+        !(device->persistent_metadata->future_expansion.expansion_version &
+          DM_REMAP_V4_EXPANSION_FLATTEN))
+        return;
     
-    /* Mapping information */
-    meta->sector_size = device->sector_size;
-    meta->total_sectors = device->main_device_sectors;
-    meta->max_mappings = 4294967295U;  /* Unlimited remaps (v4.2.2) - load factor based hash table sizing */
-    meta->active_mappings = 0;
+    info = dm_remap_flatten_info(device);
+    memcpy(path, info->path, sizeof(info->path));
+    path[sizeof(info->path)] = '\0';
+    if (info->flags & DM_REMAP_V4_FLATTEN_DONE) {
+        strscpy(device->flatten_path, path, sizeof(device->flatten_path));
+        WRITE_ONCE(device->flatten_state, DM_REMAP_FLATTEN_DONE);
+        DMR_INFO("Flatten to %s was done: not following writes unless started again", path);
+        return;
+    }
+    if (!(info->flags & DM_REMAP_V4_FLATTEN_ACTIVE))
+        return;
+    if ((info->flags & DM_REMAP_V4_FLATTEN_CLEAN) && info->nr_sectors == device->ti->len)
+        start = info->cursor_sector;
     
-    /* Health monitoring */
-    meta->health_scan_count = 0;
-    meta->last_health_scan = 0;
-    meta->predicted_failures = 0;
-    meta->health_flags = 0;
-    meta->total_errors = 0;
-    meta->last_error_time = 0;
+    mutex_lock(&device->flatten_mutex);
+    ret = dm_remap_flatten_begin(device, path, start, &error);
+    if (ret) {
+        DMR_WARN("Cannot carry on flattening onto %s: %s (error=%d)", path, error, ret);
+        strscpy(device->flatten_path, path, sizeof(device->flatten_path));
+        WRITE_ONCE(device->flatten_state, DM_REMAP_FLATTEN_FAILED);
+        WRITE_ONCE(device->flatten_error, ret);
+        if (dm_remap_flatten_record(device, 0, 0))
+            DMR_WARN("Failed to remove the flatten record");
+    }
+    mutex_unlock(&device->flatten_mutex);
+}
+
+/**
+ * dm_remap_flatten_suspend() - Copy what is left while nothing can write
+ * 
+ * v4.3: Every write has completed, so once the dirty chunks are copied and
+ * the replacement is flushed it holds everything below the cursor. That
+ * is committed as clean for a later table to carry on from. With the first
+ * pass complete the replacement is now an exact copy of the target
+ * ("done"), until the target is resumed. The record then says so, and a
+ * later table leaves the replacement alone.
+ */
+static void dm_remap_flatten_suspend(struct dm_remap_device_v4_real *device)
+{
+    struct dm_remap_flatten *f;
+    unsigned long chunk;
+    bool done;
+    int ret;
     
-    /* Performance statistics */
-    meta->total_reads = 0;
-    meta->total_writes = 0; 
-    meta->total_remaps = 0;
-    meta->total_io_time_ns = 0;
-    meta->peak_throughput = 0;
+    cancel_delayed_work_sync(&device->flatten_work);
+    mutex_lock(&device->flatten_mutex);
+    f = device->flatten;
+    if (!f)
+        goto out;
+    if (READ_ONCE(device->flatten_cancel)) {
+        dm_remap_flatten_stop(device, -ECANCELED);
+        goto out;
+    }
     
-    /* Device status */
-    meta->main_device_status = 0;   /* Healthy */
-    meta->spare_device_status = 0;  /* Healthy */
-    meta->uptime_seconds = 0;
+    for_each_set_bit(chunk, f->dirty, f->nr_chunks) {
+        clear_bit(chunk, f->dirty);
+        dm_remap_flatten_chunk(device, f, chunk);
+    }
+    ret = dm_remap_flatten_wait(f);
+    if (ret) {
+        atomic64_inc(&f->copy_errors);
+        bitmap_set(f->dirty, 0, f->cursor);  /* Which chunk failed is not known */
+    }
+    if (!ret)
+        ret = blkdev_issue_flush(f->dst);
+    done = f->cursor == f->nr_chunks;
+    if (!ret)
+        ret = dm_remap_flatten_record(device, DM_REMAP_V4_FLATTEN_CLEAN |
+                                      (done ? DM_REMAP_V4_FLATTEN_DONE :
+                                              DM_REMAP_V4_FLATTEN_ACTIVE),
+                                      min_t(sector_t, (sector_t)f->cursor *
+                                            DM_REMAP_FLATTEN_CHUNK_SECTORS, f->nr_sectors));
+    if (ret) {
+        DMR_WARN("Flatten to %s not brought up to date at suspend (error=%d)",
+                 device->flatten_path, ret);
+        goto out;
+    }
     
-    DMR_DEBUG(2, "Initialized enhanced v4.0 metadata (size: %u bytes, fingerprint: %s)",
-              meta->metadata_size, meta->device_fingerprint);
+    if (done) {
+        WRITE_ONCE(device->flatten_state, DM_REMAP_FLATTEN_DONE);
+        DMR_INFO("Flatten to %s done: it holds the target's contents while suspended",
+                 device->flatten_path);
+    }
+out:
+    mutex_unlock(&device->flatten_mutex);
 }
 
 /**
- * dm_remap_map_v4_real() - Enhanced real device I/O mapping with optimization
+ * dm_remap_flatten_resume() - Follow writes again after a suspend
+ * 
+ * The record loses DM_REMAP_V4_FLATTEN_CLEAN before the first write.
+ * Returns 0 or a commit error, which keeps the target suspended.
+ */
+static int dm_remap_flatten_resume(struct dm_remap_device_v4_real *device)
+{
+    struct dm_remap_flatten *f;
+    int ret = 0;
+    
+    mutex_lock(&device->flatten_mutex);
+    f = device->flatten;
+    if (f) {
+        ret = dm_remap_flatten_record(device, DM_REMAP_V4_FLATTEN_ACTIVE,
+                                      (sector_t)f->cursor * DM_REMAP_FLATTEN_CHUNK_SECTORS);
+        if (ret) {
+            DMR_ERROR("Cannot record the flatten to %s as running: %d",
+                      device->flatten_path, ret);
+        } else {
+            WRITE_ONCE(device->flatten_state, f->cursor == f->nr_chunks ?
+                       DM_REMAP_FLATTEN_SYNCED : DM_REMAP_FLATTEN_COPYING);
+            queue_delayed_work(device->repair_wq, &device->flatten_work, 0);
+        }
+    }
+    mutex_unlock(&device->flatten_mutex);
+    return ret;
+}
+
+/**
+ * dm_remap_spare_resize() - Pick up a change in the spare device's size
+ * @device: Target device
+ * @old_sectors: Set to the spare size in use until now
+ * @new_sectors: Set to the current size of the spare device
+ * 
+ * v4.3: Half the spare holds remapped data, so the allocator's bound
+ * follows the device. Growing only moves the bound; nothing in the I/O
+ * path is reallocated. Shrinking is refused while spare sectors are in use
+ * beyond the new bound. The new size is committed to the metadata, or
+ * recorded when the deferred metadata read completes if it has not yet.
+ * Process context only. Returns 0, -EBUSY or a commit error.
  */
-static int dm_remap_map_v4_real(struct dm_target *ti, struct bio *bio)
+static int dm_remap_spare_resize(struct dm_remap_device_v4_real *device,
+                                 sector_t *old_sectors, sector_t *new_sectors)
 {
-    struct dm_remap_device_v4_real *device = ti->private;
-    bool is_read = bio_data_dir(bio) == READ;
-    uint64_t sector = bio->bi_iter.bi_sector;
-    unsigned int bio_size = bio->bi_iter.bi_size;
-    ktime_t start_time = ktime_get();
-    ktime_t io_time;
-    uint64_t throughput;
+    unsigned long flags;
+    int ret = 0;
     
-    /* Validate I/O parameters */
-    if (sector >= device->main_device_sectors) {
-        DMR_ERROR("I/O beyond device bounds: sector %llu >= %llu",
-                  (unsigned long long)sector,
-                  (unsigned long long)device->main_device_sectors);
-        return -EIO;
-    }
+    *old_sectors = device->spare_device_sectors;
+    *new_sectors = *old_sectors;
+    if (!real_device_mode || !device->spare_dev || device->read_only)
+        return 0;
     
-    /* Check alignment for optimal performance */
-    if (!dm_remap_check_device_alignment(device->main_dev, sector)) {
-        DMR_DEBUG(2, "Unaligned I/O detected at sector %llu", (unsigned long long)sector);
-    }
+    *new_sectors = dm_remap_get_device_size(device->spare_dev);
+    if (*new_sectors == *old_sectors)
+        return 0;
     
-    /* Update statistics with enhanced tracking */
-    if (is_read) {
-        atomic64_inc(&device->read_count);
-        atomic64_inc(&global_reads);
-        dm_remap_stats_inc_reads();  /* Update stats module */
+    spin_lock_irqsave(&device->remap_lock, flags);
+    if (device->migration) {
+        ret = -EBUSY;  /* Bound is pinned to both devices until the switch */
+    } else if (*new_sectors / 2 < device->next_spare_sector) {
+        ret = -EBUSY;
     } else {
-        atomic64_inc(&device->write_count);
-        atomic64_inc(&global_writes);
-        dm_remap_stats_inc_writes();  /* Update stats module */
+        device->spare_sector_count = *new_sectors / 2;
+        device->spare_device_sectors = *new_sectors;
+    }
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    if (ret) {
+        DMR_WARN("Spare device now %llu sectors, keeping %llu: sectors up to %llu are in use",
+                 (unsigned long long)*new_sectors, (unsigned long long)*old_sectors,
+                 (unsigned long long)device->next_spare_sector);
+        return ret;
     }
     
-    atomic64_inc(&device->io_operations);
-    atomic64_inc(&device->stats.total_ios);
-    device->last_io_time = start_time;
+    device->metadata.spare_device_size = *new_sectors;
+    DMR_INFO("Spare device resized from %llu to %llu sectors (allocation limit %llu)",
+             (unsigned long long)*old_sectors, (unsigned long long)*new_sectors,
+             (unsigned long long)(*new_sectors / 2));
     
-    /* Phase 1.4: Update I/O pattern analysis */
-    dm_remap_update_io_pattern(device, sector);
+    if (atomic_read(&device->metadata_loaded) && device->persistent_metadata) {
+        mutex_lock(&device->metadata_mutex);
+        device->persistent_metadata->device_config.spare_device_sectors = *new_sectors;
+        mutex_unlock(&device->metadata_mutex);
+        ret = dm_remap_commit_metadata(device);
+    }
     
-    /* Phase 1.4: Check for cached remap first (fast path) */
-    sector_t cached_remap = 0;
-    if (device->perf_optimizer.fast_path_enabled) {
-        cached_remap = dm_remap_cache_lookup(device, sector);
-        if (cached_remap > 0) {
-            /* Fast path: use cached remap */
-            atomic64_inc(&device->stats.remapped_ios);
-            
-            DMR_DEBUG(3, "Fast path remap: sector %llu -> %llu (cached)",
-                      (unsigned long long)sector, (unsigned long long)cached_remap);
-            
-            if (real_device_mode && device->spare_dev) {
-                bio_set_dev(bio, file_bdev(device->spare_dev));
-                bio->bi_iter.bi_sector = cached_remap;
-            }
-            
-            goto remap_complete;
-        }
+    if (device->ti->table)
+        dm_table_event(device->ti->table);
+    return ret;
+}
+
+/**
+ * dm_remap_open_metadata_dev() - Open the separate metadata device
+ * 
+ * v4.3: Several targets may keep their metadata on one device, each in its
+ * own DM_REMAP_V4_METADATA_AREA_SECTORS from its offset, so the device is
+ * claimed with a holder they all share. An area overlapping that of another
+ * active target is refused; a reload of the same device may reuse its own.
+ * The spare keeps its metadata area reserved either way.
+ */
+static int dm_remap_open_metadata_dev(struct dm_remap_device_v4_real *device,
+                                      const struct dm_remap_table_args *args)
+{
+    sector_t start = args->metadata_offset, end = start + DM_REMAP_V4_METADATA_AREA_SECTORS;
+    struct mapped_device *md = dm_table_get_md(device->ti->table);
+    struct dm_remap_device_v4_real *other;
+    unsigned int lbs;
+    struct file *dev;
+    int ret = 0;
+    
+    dev = dm_remap_open_bdev_real(args->metadata_path, device->device_mode,
+                                  &dm_remap_metadata_holder);
+    if (IS_ERR(dev)) {
+        DMR_ERROR("Failed to open metadata device %s: %ld", args->metadata_path, PTR_ERR(dev));
+        return PTR_ERR(dev);
     }
     
-    DMR_DEBUG(3, "Enhanced I/O: %s %u bytes to sector %llu on %s",
-              is_read ? "read" : "write", bio_size,
-              (unsigned long long)sector,
-              real_device_mode ? dm_remap_get_device_name(device->main_dev) : "demo");
+    lbs = dm_remap_get_sector_size(dev) >> SECTOR_SHIFT;
+    if (start % lbs || (DM_REMAP_V4_METADATA_BLOCK_SIZE >> SECTOR_SHIFT) % lbs) {
+        DMR_ERROR("Metadata offset %llu not aligned to the %u-byte blocks of %s",
+                  (unsigned long long)start, lbs << SECTOR_SHIFT, args->metadata_path);
+        ret = -EINVAL;
+    } else if (dm_remap_get_device_size(dev) < DM_REMAP_V4_METADATA_AREA_SECTORS ||
+               start > dm_remap_get_device_size(dev) - DM_REMAP_V4_METADATA_AREA_SECTORS) {
+        DMR_ERROR("Metadata area at %llu (%u sectors) beyond the end of %s",
+                  (unsigned long long)start, DM_REMAP_V4_METADATA_AREA_SECTORS,
+                  args->metadata_path);
+        ret = -ENOSPC;
+    }
+    if (ret)
+        goto out_close;
     
-    /* Phase 1.3 Enhanced I/O routing with sector remapping */
-    if (real_device_mode && device->main_dev && !IS_ERR(device->main_dev)) {
-        struct dm_remap_entry_v4 *remap_entry;
-        struct block_device *target_bdev;
-        sector_t target_sector = sector;
-        
-        /* Check if this sector has been remapped */
-        remap_entry = dm_remap_find_remap_entry(device, sector);
-        if (remap_entry) {
-            /* Redirect to spare device */
-            target_bdev = file_bdev(device->spare_dev);
-            target_sector = remap_entry->spare_sector;
-            
-            DMR_DEBUG(3, "Remapped I/O: sector %llu -> %llu (spare device)",
-                      (unsigned long long)sector,
-                      (unsigned long long)target_sector);
-            
-            /* Update remap statistics */
-            atomic64_inc(&device->stats.remapped_ios);
-            if (is_read) {
-                atomic64_inc(&device->remap_count);
-                atomic64_inc(&global_remaps);
-            }
-        } else {
-            /* Normal I/O to main device */
-            target_bdev = file_bdev(device->main_dev);
-            atomic64_inc(&device->stats.normal_ios);
+    mutex_lock(&dm_remap_devices_mutex);
+    list_for_each_entry(other, &dm_remap_devices, device_list) {
+        if (!other->meta_dev || file_bdev(other->meta_dev) != file_bdev(dev) ||
+            dm_table_get_md(other->ti->table) == md)
+            continue;
+        if (other->meta_offset < end &&
+            start < other->meta_offset + DM_REMAP_V4_METADATA_AREA_SECTORS) {
+            DMR_ERROR("Metadata area at %llu on %s overlaps the one at %llu of %s",
+                      (unsigned long long)start, args->metadata_path,
+                      (unsigned long long)other->meta_offset,
+                      dm_device_name(dm_table_get_md(other->ti->table)));
+            ret = -EBUSY;
+            break;
         }
-        
-        /* Set target device and sector */
-        bio_set_dev(bio, target_bdev);
-        bio->bi_iter.bi_sector = target_sector;
-        
-    } else {
-        /* Demo mode - simulate successful I/O */
-        DMR_DEBUG(3, "Demo mode I/O simulation");
     }
+    mutex_unlock(&dm_remap_devices_mutex);
+    if (ret)
+        goto out_close;
+    
+    device->meta_dev = dev;
+    strscpy(device->meta_path, args->metadata_path, sizeof(device->meta_path));
+    device->meta_offset = start;
+    DMR_INFO("  Metadata: %s, sectors %llu-%llu", dm_remap_get_device_name(dev),
+             (unsigned long long)start, (unsigned long long)end - 1);
+    return 0;
     
-remap_complete:
-    /* Calculate and update performance metrics */
-    io_time = ktime_sub(ktime_get(), start_time);
-    atomic64_add(ktime_to_ns(io_time), &device->total_io_time_ns);
-    
-    /* Calculate throughput (bytes per second) */
-    if (ktime_to_ns(io_time) > 0) {
-        throughput = (uint64_t)bio_size * 1000000000ULL / ktime_to_ns(io_time);
-        if (throughput > device->peak_throughput) {
-            device->peak_throughput = throughput;
-        }
+out_close:
+    dm_remap_close_bdev_real(dev);
+    return ret;
+}
+
+/**
+ * dm_remap_open_overlay_dev() - Open the overlay of a read-only target
+ * 
+ * v4.3: The only device such a target writes to. Overlay space is handed
+ * out a sector at a time, so its logical blocks may be no larger than the
+ * target's, and no unit (DM_REMAP_V4_COMPRESS_SECTORS) may span two blocks.
+ */
+static int dm_remap_open_overlay_dev(struct dm_remap_device_v4_real *device,
+                                     const struct dm_remap_table_args *args)
+{
+    struct block_device *bdev;
+    unsigned int lbs;
+    struct file *dev;
+    
+    dev = dm_remap_open_bdev_real(args->overlay_path, BLK_OPEN_READ | BLK_OPEN_WRITE,
+                                  device->ti);
+    if (IS_ERR(dev)) {
+        DMR_ERROR("Failed to open overlay device %s: %ld", args->overlay_path, PTR_ERR(dev));
+        return PTR_ERR(dev);
     }
     
-    /* Update metadata statistics */
-    if (is_read) {
-        device->metadata.total_reads++;
-    } else {
-        device->metadata.total_writes++;
+    bdev = file_bdev(dev);
+    lbs = dm_remap_get_sector_size(dev) >> SECTOR_SHIFT;
+    if (bdev == file_bdev(device->main_dev) || bdev == file_bdev(device->spare_dev) ||
+        (device->meta_dev && bdev == file_bdev(device->meta_dev))) {
+        DMR_ERROR("Overlay device %s is one of the target's other devices", args->overlay_path);
+        dm_remap_close_bdev_real(dev);
+        return -EINVAL;
+    }
+    if (lbs > device->block_sectors ||
+        device->block_sectors > DM_REMAP_V4_COMPRESS_SECTORS) {
+        DMR_ERROR("Overlay device %s: %u-byte blocks, the target's are %u bytes",
+                  args->overlay_path, lbs << SECTOR_SHIFT,
+                  device->block_sectors << SECTOR_SHIFT);
+        dm_remap_close_bdev_real(dev);
+        return -EINVAL;
     }
-    device->metadata.total_io_time_ns += ktime_to_ns(io_time);
-    device->metadata.last_update = ktime_to_ns(ktime_get_real());
     
-    return DM_MAPIO_REMAPPED;
+    device->overlay_dev = dev;
+    strscpy(device->overlay_path, args->overlay_path, sizeof(device->overlay_path));
+    device->forensic.nr_sectors = dm_remap_get_device_size(dev);
+    DMR_INFO("  Overlay: %s (%llu sectors)", dm_remap_get_device_name(dev),
+             (unsigned long long)device->forensic.nr_sectors);
+    return 0;
 }
 
 /**
  * dm_remap_ctr_v4_real() - Constructor for real device support
+ * 
+ * Table line: <main_device> <spare_device> [<metadata_device> <offset>]
+ * [<#features> <key> <value>...] (see dm_remap_parse_table_args()).
+ * v4.3 (target version 4.3.0) added the optional metadata device with the
+ * sector its area starts at, and the feature arguments: any "set" key,
+ * "mode ro|rw", and with "mode ro" an "overlay <device>" taking the writes.
  */
 static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **argv)
 {
     struct dm_remap_device_v4_real *device;
+    struct dm_remap_table_args args;
     struct file *main_dev, *spare_dev;
-    int ret;
+    bool read_only;
+    blk_mode_t mode;
+    int ret, cpu;
     
-    if (argc != 2) {
-        ti->error = "Invalid argument count: dm-remap-v4 <main_device> <spare_device>";
-        return -EINVAL;
-    }
+    ret = dm_remap_parse_table_args(argc, argv, &args, &ti->error);
+    if (ret)
+        return ret;
+    
+    /* v4.3: A table loaded read-only gets a read-only target too */
+    read_only = args.read_only || !(dm_table_get_mode(ti->table) & BLK_OPEN_WRITE);
+    mode = read_only ? BLK_OPEN_READ : BLK_OPEN_READ | BLK_OPEN_WRITE;
     
-    DMR_INFO("Creating real device target: main=%s, spare=%s", argv[0], argv[1]);
+    DMR_INFO("Creating real device target: main=%s, spare=%s%s", args.main_path,
+             args.spare_path, read_only ? " (read-only)" : "");
     
     /* Open devices */
     if (real_device_mode) {
-        main_dev = dm_remap_open_bdev_real(argv[0], BLK_OPEN_READ | BLK_OPEN_WRITE, ti);
+        main_dev = dm_remap_open_bdev_real(args.main_path, mode, ti);
         if (IS_ERR(main_dev)) {
             ret = PTR_ERR(main_dev);
             ti->error = "Cannot open main device";
-            DMR_ERROR("Failed to open main device %s: %d", argv[0], ret);
+            DMR_ERROR("Failed to open main device %s: %d", args.main_path, ret);
             return ret;
         }
         
-        spare_dev = dm_remap_open_bdev_real(argv[1], BLK_OPEN_READ | BLK_OPEN_WRITE, ti);
+        spare_dev = dm_remap_open_bdev_real(args.spare_path, mode, ti);
         if (IS_ERR(spare_dev)) {
             ret = PTR_ERR(spare_dev);
             ti->error = "Cannot open spare device";
-            DMR_ERROR("Failed to open spare device %s: %d", argv[1], ret);
+            DMR_ERROR("Failed to open spare device %s: %d", args.spare_path, ret);
             dm_remap_close_bdev_real(main_dev);
             return ret;
         }
@@ -1752,19 +6719,34 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
             dm_remap_close_bdev_real(spare_dev);
             return ret;
         }
+        
+        /* v4.3: The table length is the target's size; the main device may be larger */
+        if (dm_remap_get_device_size(main_dev) < ti->len) {
+            ti->error = "Main device smaller than target length";
+            dm_remap_close_bdev_real(main_dev);
+            dm_remap_close_bdev_real(spare_dev);
+            return -EINVAL;
+        }
+        
+        /* v4.3: PI can only pass through if both legs use the same format */
+        if ((dm_remap_has_integrity(main_dev) || dm_remap_has_integrity(spare_dev)) &&
+            !dm_remap_integrity_compatible(main_dev, spare_dev)) {
+            DMR_WARN("Integrity profiles of %s and %s differ, integrity disabled",
+                     args.main_path, args.spare_path);
+        }
     } else {
         /* Demo mode - validate paths but don't open real devices */
-        ret = dm_remap_open_bdev(argv[0], FMODE_READ | FMODE_WRITE, ti);
+        ret = dm_remap_open_bdev(args.main_path, FMODE_READ | FMODE_WRITE, ti);
         if (ret < 0) {
             ti->error = "Cannot access main device";
-            DMR_ERROR("Main device access failed: %s (error: %d)", argv[0], ret);
+            DMR_ERROR("Main device access failed: %s (error: %d)", args.main_path, ret);
             return ret;
         }
         
-        ret = dm_remap_open_bdev(argv[1], FMODE_READ | FMODE_WRITE, ti);
+        ret = dm_remap_open_bdev(args.spare_path, FMODE_READ | FMODE_WRITE, ti);
         if (ret < 0) {
             ti->error = "Cannot access spare device";
-            DMR_ERROR("Spare device access failed: %s (error: %d)", argv[1], ret);
+            DMR_ERROR("Spare device access failed: %s (error: %d)", args.spare_path, ret);
             return ret;
         }
         
@@ -1782,24 +6764,46 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
         }
         return -ENOMEM;
     }
+    dm_remap_ioclass_init(&device->ioclass);
+    dm_remap_correlate_init(&device->correlate);
+    
+    /* v4.3: Per-leg I/O counters */
+    device->leg_stats = alloc_percpu(struct dm_remap_leg_pcpu);
+    if (!device->leg_stats) {
+        ti->error = "Cannot allocate I/O counters";
+        kfree(device);
+        if (real_device_mode) {
+            dm_remap_close_bdev_real(main_dev);
+            dm_remap_close_bdev_real(spare_dev);
+        }
+        return -ENOMEM;
+    }
+    device->leg_stats_since = ktime_get_ns();
+    for_each_possible_cpu(cpu) {
+        spin_lock_init(&per_cpu_ptr(device->leg_stats, cpu)->lock);
+        INIT_LIST_HEAD(&per_cpu_ptr(device->leg_stats, cpu)->inflight);
+    }
     
     /* Initialize device structure */
     device->main_dev = main_dev;
     device->spare_dev = spare_dev;
-    device->device_mode = BLK_OPEN_READ | BLK_OPEN_WRITE;
-    strncpy(device->main_path, argv[0], sizeof(device->main_path) - 1);
-    strncpy(device->spare_path, argv[1], sizeof(device->spare_path) - 1);
+    device->device_mode = mode;
+    device->read_only = read_only;
+    device->ro_feature = args.read_only;
+    strncpy(device->main_path, args.main_path, sizeof(device->main_path) - 1);
+    strncpy(device->spare_path, args.spare_path, sizeof(device->spare_path) - 1);
     
     /* Get enhanced device information */
     if (real_device_mode && main_dev && spare_dev) {
-        device->main_device_sectors = dm_remap_get_device_size(main_dev);
+        device->main_device_sectors = ti->len;
         device->spare_device_sectors = dm_remap_get_device_size(spare_dev);
         device->sector_size = dm_remap_get_sector_size(main_dev);
         
         DMR_INFO("Real devices opened with enhanced detection:");
-        DMR_INFO("  Main: %s (%llu sectors, %u byte sectors)",
+        DMR_INFO("  Main: %s (%llu of %llu sectors, %u byte sectors)",
                  dm_remap_get_device_name(main_dev), 
                  (unsigned long long)device->main_device_sectors,
+                 (unsigned long long)dm_remap_get_device_size(main_dev),
                  device->sector_size);
         DMR_INFO("  Spare: %s (%llu sectors, %u byte sectors)",
                  dm_remap_get_device_name(spare_dev),
@@ -1810,11 +6814,23 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
         device->metadata.main_device_size = device->main_device_sectors;
         device->metadata.spare_device_size = device->spare_device_sectors;
         device->metadata.sector_size = device->sector_size;
+        
+        /* v4.3: Remaps never split a logical block of either leg */
+        device->block_sectors = max(device->sector_size,
+                                    dm_remap_get_sector_size(spare_dev)) >> SECTOR_SHIFT;
+        dm_remap_fill_dm_dev(&device->main_dm_dev, main_dev);
+        dm_remap_fill_dm_dev(&device->spare_dm_dev, spare_dev);
+        device->integrity_enabled = dm_remap_has_integrity(main_dev) &&
+                                    dm_remap_integrity_compatible(main_dev, spare_dev);
+        if (device->integrity_enabled)
+            DMR_INFO("  Integrity: passthrough enabled (%u-byte tuples)",
+                     bdev_get_integrity(file_bdev(main_dev))->tuple_size);
     } else {
         /* Demo mode defaults */
         device->main_device_sectors = ti->len;
         device->spare_device_sectors = ti->len;
         device->sector_size = 512;
+        device->block_sectors = 1;
         
         DMR_INFO("Demo mode: simulated devices (%llu sectors, %u byte sectors)",
                  (unsigned long long)device->main_device_sectors, device->sector_size);
@@ -1831,7 +6847,8 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
     spin_lock_init(&device->remap_lock);
     device->remap_count_active = 0;
     device->spare_sector_count = device->spare_device_sectors / 2; /* Reserve half for remapping */
-    device->next_spare_sector = 0;
+    device->next_spare_sector = DM_REMAP_V4_SPARE_DATA_START; /* Skip metadata copies */
+    device->remap_tree = RB_ROOT;
     
     /* Phase 3: Initialize hash table for O(1) remap lookup
      * ADAPTIVE SIZING (v4.2.1 Optimization):
@@ -1860,6 +6877,7 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
     if (!device->metadata_workqueue) {
         DMR_ERROR("Failed to create metadata sync workqueue");
         mutex_destroy(&device->metadata_mutex);
+        free_percpu(device->leg_stats);
         kfree(device);
         if (real_device_mode) {
             dm_remap_close_bdev_real(main_dev);
@@ -1873,6 +6891,27 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
     INIT_WORK(&device->writeahead_remap_work, dm_remap_writeahead_remap_work);
     INIT_DELAYED_WORK(&device->deferred_metadata_read_work, dm_remap_deferred_metadata_read_work);
     atomic_set(&device->metadata_loaded, 0);
+    INIT_DELAYED_WORK(&device->atomic_commit_work, dm_remap_atomic_commit_work);
+    INIT_LIST_HEAD(&device->atomic_commit_list);
+    INIT_LIST_HEAD(&device->atomic_held_list);
+    INIT_DELAYED_WORK(&device->retry_work, dm_remap_retry_work);
+    INIT_LIST_HEAD(&device->retry_list);
+    INIT_WORK(&device->salvage_work, dm_remap_salvage_work);
+    INIT_LIST_HEAD(&device->salvage_list);
+    INIT_WORK(&device->salvage_commit_work, dm_remap_salvage_commit_work);
+    INIT_LIST_HEAD(&device->salvage_commit_list);
+    INIT_WORK(&device->compress_work, dm_remap_compress_work);
+    INIT_LIST_HEAD(&device->compress_list);
+    dm_remap_compress_init(&device->compress);
+    INIT_WORK(&device->overlay_work, dm_remap_overlay_work);
+    INIT_LIST_HEAD(&device->overlay_list);
+    INIT_WORK(&device->verify_work, dm_remap_verify_work);
+    INIT_LIST_HEAD(&device->verify_list);
+    INIT_WORK(&device->verify_fix_work, dm_remap_verify_fix_work);
+    INIT_LIST_HEAD(&device->verify_fix_list);
+    INIT_WORK(&device->csum_work, dm_remap_csum_work);
+    INIT_LIST_HEAD(&device->csum_list);
+    INIT_WORK(&device->csum_setup_work, dm_remap_csum_setup_work);
     
     /* Initialize v4.2.2 kernel thread for metadata writes */
     init_waitqueue_head(&device->metadata_wait_queue);
@@ -1886,6 +6925,7 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
         DMR_ERROR("Failed to create metadata write thread");
         destroy_workqueue(device->metadata_workqueue);
         mutex_destroy(&device->metadata_mutex);
+        free_percpu(device->leg_stats);
         kfree(device);
         if (real_device_mode) {
             dm_remap_close_bdev_real(main_dev);
@@ -1904,6 +6944,7 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
         kthread_stop(device->metadata_thread);
         destroy_workqueue(device->metadata_workqueue);
         mutex_destroy(&device->metadata_mutex);
+        free_percpu(device->leg_stats);
         kfree(device);
         if (real_device_mode) {
             dm_remap_close_bdev_real(main_dev);
@@ -1915,6 +6956,7 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
     dm_remap_init_repair_context(&device->repair_ctx, 
                                  file_bdev(device->spare_dev),
                                  device->repair_wq);
+    device->repair_ctx.ioclass = &device->ioclass;
     
     /* Initialize statistics */
     atomic64_set(&device->read_count, 0);
@@ -1933,28 +6975,57 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
     atomic64_set(&device->stats.remapped_sectors, 0);
     device->stats.total_latency_ns = 0;
     device->stats.max_latency_ns = 0;
+    atomic64_set(&device->atomic_writes, 0);
+    atomic64_set(&device->atomic_staged, 0);
+    atomic64_set(&device->atomic_refused, 0);
+    atomic64_set(&device->zero_reads, 0);
+    atomic64_set(&device->zero_writes, 0);
+    atomic64_set(&device->zero_allocs, 0);
+    atomic64_set(&device->compress_ios, 0);
+    atomic64_set(&device->compress_io_ns, 0);
+    atomic64_set(&device->split_ios, 0);
+    atomic64_set(&device->integrity_ios, 0);
+    atomic64_set(&device->integrity_remapped, 0);
+    atomic64_set(&device->integrity_errors, 0);
+    atomic64_set(&device->policy_retried, 0);
+    atomic64_set(&device->policy_ignored, 0);
+    dm_remap_error_stats_reset(device);
+    atomic_set(&device->inject_count, 0);
+    atomic64_set(&device->active_remaps, 0);
+    atomic64_set(&device->active_predictions, 0);
+    device->ti = ti;
+    dm_remap_event_log_init(&device->events);
+    dm_remap_pipeline_init(&device->pipeline);
+    dm_remap_shadow_init(&device->shadow);
+    device->tunables = args.tunables;
+    mutex_init(&device->tunables_mutex);
+    mutex_init(&device->csum_mutex);
+    atomic_set(&device->spare_inflight[0], 0);
+    atomic_set(&device->spare_inflight[1], 0);
+    init_waitqueue_head(&device->spare_wait);
+    bio_list_init(&device->spare_deferred);
+    INIT_WORK(&device->spare_migrate_work, dm_remap_spare_migrate_work);
+    device->migrate_state = DM_REMAP_MIGRATE_IDLE;
+    INIT_DELAYED_WORK(&device->flatten_work, dm_remap_flatten_work);
+    mutex_init(&device->flatten_mutex);
+    device->flatten_state = DM_REMAP_FLATTEN_IDLE;
     
     /* Initialize Phase 1.4: Health monitoring */
     mutex_init(&device->health_mutex);
     memset(&device->health_monitor, 0, sizeof(device->health_monitor));
-    device->health_monitor.scan_interval_seconds = 300; /* 5 minutes */
+    device->health_monitor.scan_interval_seconds = device->tunables.scan_interval;
     device->health_monitor.failure_prediction_score = 100; /* Start healthy */
     INIT_DELAYED_WORK(&device->health_scan_work, dm_remap_health_scan_work);
+    INIT_DELAYED_WORK(&device->hung_work, dm_remap_hung_work);
     
     /* Initialize Phase 1.4: Performance optimization */
     mutex_init(&device->cache_mutex);
     memset(&device->perf_optimizer, 0, sizeof(device->perf_optimizer));
     
     /* Allocate remap cache (power of 2 size for fast modulo) */
-    device->perf_optimizer.cache_size = 256;
-    device->perf_optimizer.cache_mask = device->perf_optimizer.cache_size - 1;
-    device->perf_optimizer.cache_entries = kzalloc(
-        device->perf_optimizer.cache_size * sizeof(struct dm_remap_cache_entry),
-        GFP_KERNEL);
-    if (!device->perf_optimizer.cache_entries) {
+    if (dm_remap_cache_resize(device, device->tunables.cache_size)) {
         DMR_WARN("Failed to allocate remap cache, performance may be reduced");
-        device->perf_optimizer.cache_size = 0;
-        device->perf_optimizer.cache_mask = 0;
+        device->tunables.cache_size = 0;
     }
     
     device->perf_optimizer.fast_path_enabled = true;
@@ -1972,6 +7043,49 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
     /* Initialize enhanced metadata */
     dm_remap_initialize_metadata_v4_real(device);
     
+    /* v4.3: Where the target's own I/O is charged */
+    ret = dm_remap_ioclass_set(&device->ioclass, &device->tunables);
+    if (ret) {
+        DMR_ERROR("Cannot find the cgroups the settings name");
+        goto error_cleanup;
+    }
+    
+    /* v4.3: The targets whose errors are correlated with this one's */
+    ret = dm_remap_correlate_join(&device->correlate, device->tunables.error_domain,
+                                  device->main_dev ? file_bdev(device->main_dev) : NULL);
+    if (ret) {
+        DMR_ERROR("Failed to set up the error domain");
+        goto error_cleanup;
+    }
+    
+    /* v4.3: Read errors of a read-only target, and its overlay map */
+    ret = dm_remap_forensic_init(&device->forensic, 0);
+    if (ret) {
+        DMR_ERROR("Failed to allocate the read error list");
+        goto error_cleanup;
+    }
+    
+    /* v4.3: Free spare space, rebuilt when the remap table is loaded */
+    ret = dm_remap_freelist_init(&device->spare_free);
+    if (!ret)
+        ret = dm_remap_freelist_init(&device->spare_released);
+    if (!ret)
+        ret = dm_remap_freelist_init(&device->spare_committing);
+    if (ret) {
+        DMR_ERROR("Failed to allocate free spare extents");
+        goto error_cleanup;
+    }
+    
+    /* v4.3: Compressed remapped data */
+    if (device->tunables.compress) {
+        ret = dm_remap_compress_enable(device, device->tunables.compress);
+        if (ret) {
+            DMR_ERROR("Cannot compress with %s on this device: %d",
+                      dm_remap_compress_alg_name(device->tunables.compress), ret);
+            goto error_cleanup;
+        }
+    }
+    
     /* Initialize persistent v4 metadata structure */
     ret = dm_remap_init_persistent_metadata(device);
     if (ret) {
@@ -1979,11 +7093,25 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
         goto error_cleanup;
     }
     
+    /* v4.3: Metadata on a separate device, at this target's offset */
+    if (real_device_mode && args.metadata_path) {
+        ret = dm_remap_open_metadata_dev(device, &args);
+        if (ret)
+            goto error_cleanup;
+    }
+    
+    /* v4.3: Overlay for the writes to a read-only target */
+    if (real_device_mode && args.overlay_path) {
+        ret = dm_remap_open_overlay_dev(device, &args);
+        if (ret)
+            goto error_cleanup;
+    }
+    
     /* Create dm-bufio client for metadata I/O (kernel standard approach) */
     if (real_device_mode && device->spare_dev) {
         device->metadata_bufio_client = dm_bufio_client_create(
-            file_bdev(device->spare_dev),
-            131072,  /* Block size = 128KB (metadata is ~90KB with 2048 remaps) */
+            file_bdev(device->meta_dev ?: device->spare_dev),
+            DM_REMAP_V4_METADATA_BLOCK_SIZE,  /* 128KB (metadata is ~90KB with 2048 remaps) */
             1,       /* 1 reserved buffer */
             0,       /* No aux buffer */
             NULL,    /* No alloc callback */
@@ -1998,7 +7126,12 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
             goto error_cleanup;
         }
         
-        DMR_INFO("dm-bufio client created for metadata I/O (block_size=131072 bytes)");
+        if (device->meta_dev)
+            dm_bufio_set_sector_offset(device->metadata_bufio_client, device->meta_offset);
+        device->repair_ctx.bufio_client = device->metadata_bufio_client;
+        
+        DMR_INFO("dm-bufio client created for metadata I/O (block_size=%u bytes)",
+                 DM_REMAP_V4_METADATA_BLOCK_SIZE);
     }
     
     /* NOTE: Metadata reading is deferred to avoid blocking I/O during construction.
@@ -2009,111 +7142,324 @@ static int dm_remap_ctr_v4_real(struct dm_target *ti, unsigned int argc, char **
      * 
      * v4.2: Metadata reading is now scheduled via delayed workqueue, running
      * after constructor completes. This enables metadata persistence and auto-repair.
+     * 
+     * v4.3: It is read in preresume instead, after a table being replaced
+     * (a reload with a new length) has committed its remaps at postsuspend.
+     * The deferred work remains for demo mode.
      */
-    DMR_INFO("Scheduling deferred metadata read (avoiding constructor deadlock)");
-    schedule_delayed_work(&device->deferred_metadata_read_work, msecs_to_jiffies(100)); /* 100ms delay */
     
     /* Start background health monitoring */
     schedule_delayed_work(&device->health_scan_work, 
                          msecs_to_jiffies(device->health_monitor.scan_interval_seconds * 1000));
+    if (device->tunables.hung_timeout)
+        schedule_delayed_work(&device->hung_work,
+                              dm_remap_hung_interval(device->tunables.hung_timeout));
+    
+    /* v4.3: Per-bio context, and one empty flush per leg */
+    ti->per_io_data_size = sizeof(struct dm_remap_io_ctx);
+    ti->num_flush_bios = 2;
+    /* v4.3: Discards and write zeroes may turn remaps zero; a read-only
+     * target has nowhere to send them */
+    ti->num_discard_bios = read_only ? 0 : 1;
+    ti->num_write_zeroes_bios = read_only ? 0 : 1;
+    
+    /* Add to global device list */
+    mutex_lock(&dm_remap_devices_mutex);
+    list_add_tail(&device->device_list, &dm_remap_devices);
+    atomic_inc(&dm_remap_device_count);
+    mutex_unlock(&dm_remap_devices_mutex);
+    
+    ti->private = device;
+    
+    DMR_INFO("Real device target created successfully (%s mode)",
+             real_device_mode ? "real device" : "demo");
+    
+    return 0;
+
+error_cleanup:
+    /* Cleanup on error */
+    destroy_workqueue(device->metadata_workqueue);
+    if (device->perf_optimizer.cache_entries)
+        kfree(device->perf_optimizer.cache_entries);
+    mutex_destroy(&device->cache_mutex);
+    mutex_destroy(&device->health_mutex);
+    mutex_destroy(&device->tunables_mutex);
+    mutex_destroy(&device->csum_mutex);
+    mutex_destroy(&device->flatten_mutex);
+    mutex_destroy(&device->metadata_mutex);
+    free_percpu(device->leg_stats);
+    dm_remap_freelist_destroy(&device->spare_free);
+    dm_remap_freelist_destroy(&device->spare_released);
+    dm_remap_freelist_destroy(&device->spare_committing);
+    dm_remap_compress_destroy(&device->compress);
+    dm_remap_forensic_destroy(&device->forensic);
+    dm_remap_ioclass_destroy(&device->ioclass);
+    dm_remap_correlate_leave(&device->correlate);
+    if (device->metadata_bufio_client)
+        dm_bufio_client_destroy(device->metadata_bufio_client);
+    dm_remap_close_bdev_real(device->meta_dev);
+    dm_remap_close_bdev_real(device->overlay_dev);
+    kfree(device);
+    if (real_device_mode) {
+        dm_remap_close_bdev_real(main_dev);
+        dm_remap_close_bdev_real(spare_dev);
+    }
+    ti->error = "Initialization failed";
+    return ret;
+}
+
+/**
+ * dm_remap_presuspend_v4_real() - Stop starting new background work
+ * 
+ * v4.3: Bios may still be in flight and may still create remaps, so the
+ * metadata thread and the remap work keep running. The index is kept
+ * for resume; it is only freed in the destructor.
+ */
+static void dm_remap_presuspend_v4_real(struct dm_target *ti)
+{
+    struct dm_remap_device_v4_real *device = ti->private;
+    
+    if (!device) {
+        return;
+    }
+    
+    DMR_INFO("Presuspend: stopping background work");
+    
+    /* Background work checks this before it starts anything new */
+    atomic_set(&device->device_active, 0);
+    
+    /* v4.3: A spare replacement is cancelled unless already switching */
+    WRITE_ONCE(device->migrate_cancel, true);
+    flush_work(&device->spare_migrate_work);
+    
+    cancel_delayed_work_sync(&device->health_scan_work);
+}
+
+/**
+ * dm_remap_postsuspend_v4_real() - Settle remap and metadata state
+ * 
+ * v4.3: Nothing is in flight any more. Remap and commit work still queued
+ * runs to completion and a dirty table is committed, so while suspended
+ * the metadata generation on the spare matches the in-memory index.
+ */
+static void dm_remap_postsuspend_v4_real(struct dm_target *ti)
+{
+    struct dm_remap_device_v4_real *device = ti->private;
+    
+    if (!device) {
+        return;
+    }
+    
+    cancel_delayed_work_sync(&device->deferred_metadata_read_work);
+    flush_delayed_work(&device->retry_work);
+    cancel_delayed_work_sync(&device->hung_work);
+    flush_work(&device->salvage_work);
+    flush_work(&device->salvage_commit_work);
+    flush_work(&device->compress_work);
+    flush_work(&device->overlay_work);
+    flush_work(&device->verify_work);
+    flush_work(&device->verify_fix_work);
+    flush_work(&device->csum_work);
+    flush_work(&device->csum_setup_work);
+    flush_work(&device->writeahead_remap_work);
+    flush_delayed_work(&device->atomic_commit_work);
+    flush_work(&device->error_analysis_work);
+    cancel_work_sync(&device->metadata_sync_work);
+    dm_remap_flatten_suspend(device);
+    
+    if (atomic_read(&device->metadata_loaded) && device->metadata_dirty &&
+        !device->read_only && dm_remap_commit_metadata(device))
+        DMR_WARN("Postsuspend: metadata commit failed, retrying after resume");
+    
+    mutex_lock(&device->metadata_mutex);
+    device->suspend_generation = device->persistent_metadata ?
+        device->persistent_metadata->header.sequence_number : 0;
+    mutex_unlock(&device->metadata_mutex);
+    device->suspended = true;
+    
+    DMR_INFO("Postsuspend: %u remaps kept, metadata generation %llu",
+             device->remap_count_active, (unsigned long long)device->suspend_generation);
+}
+
+/**
+ * dm_remap_read_generation() - Sequence number of the first metadata copy on disk
+ * 
+ * Cached blocks are dropped first, so this sees writes made by others.
+ */
+static int dm_remap_read_generation(struct dm_remap_device_v4_real *device, u64 *generation)
+{
+    const struct dm_remap_metadata_v4 *meta;
+    struct dm_buffer *buffer;
+    u64 io_start;
+    int ret = 0;
+    
+    dm_bufio_forget_buffers(device->metadata_bufio_client);
+    io_start = dm_remap_meta_io_start(device, 1);
+    meta = dm_bufio_read(device->metadata_bufio_client, 0, &buffer);
+    dm_remap_meta_io_end(device, 1, io_start);
+    if (IS_ERR(meta))
+        return PTR_ERR(meta);
+    
+    if (meta->header.magic == DM_REMAP_METADATA_V4_MAGIC)
+        *generation = meta->header.sequence_number;
+    else
+        ret = -ENODATA;
+    dm_bufio_release(buffer);
+    return ret;
+}
+
+/**
+ * dm_remap_reload_index() - Replace the in-memory remaps with the table on disk
+ * 
+ * v4.3: Used when the table was changed while the device was suspended.
+ * If no valid table can be read the current index is kept and marked dirty,
+ * so it is written back over whatever is there.
+ */
+static int dm_remap_reload_index(struct dm_remap_device_v4_real *device)
+{
+    struct dm_remap_metadata_v4 *meta;
+    struct dm_remap_entry_v4 *entry, *tmp;
+    unsigned long flags;
+    int ret;
+    
+    meta = kvmalloc(sizeof(*meta), GFP_KERNEL);
+    if (!meta)
+        return -ENOMEM;
+    
+    ret = dm_remap_read_metadata_v4_bufio(device->metadata_bufio_client, meta);
+    if (ret) {
+        DMR_WARN("No valid metadata on spare (%d), keeping %u remaps in memory",
+                 ret, device->remap_count_active);
+        kvfree(meta);
+        device->metadata_dirty = true;
+        return 0;
+    }
+    if (meta->header.sequence_number == device->suspend_generation) {
+        kvfree(meta);  /* Only the first copy was stale */
+        return 0;
+    }
     
-    /* Set target length */
-    ti->len = device->main_device_sectors;
+    DMR_WARN("Metadata generation changed from %llu to %llu while suspended, reloading remaps",
+             (unsigned long long)device->suspend_generation,
+             (unsigned long long)meta->header.sequence_number);
     
-    /* Add to global device list */
-    mutex_lock(&dm_remap_devices_mutex);
-    list_add_tail(&device->device_list, &dm_remap_devices);
-    atomic_inc(&dm_remap_device_count);
-    mutex_unlock(&dm_remap_devices_mutex);
+    mutex_lock(&device->metadata_mutex);
+    memcpy(device->persistent_metadata, meta, sizeof(*meta));
     
-    ti->private = device;
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_for_each_entry_safe(entry, tmp, &device->remap_list, list) {
+        dm_remap_index_remove(device, entry);
+        kfree(entry);
+    }
+    device->remap_count_active = 0;
+    device->next_spare_sector = DM_REMAP_V4_SPARE_DATA_START;
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    dm_remap_cache_clear(device);
     
-    DMR_INFO("Real device target created successfully (%s mode)",
-             real_device_mode ? "real device" : "demo");
+    ret = dm_remap_restore_remaps(device);
+    device->metadata_dirty = false;
+    mutex_unlock(&device->metadata_mutex);
     
-    return 0;
-
-error_cleanup:
-    /* Cleanup on error */
-    destroy_workqueue(device->metadata_workqueue);
-    if (device->perf_optimizer.cache_entries)
-        kfree(device->perf_optimizer.cache_entries);
-    mutex_destroy(&device->cache_mutex);
-    mutex_destroy(&device->health_mutex);
-    mutex_destroy(&device->metadata_mutex);
-    kfree(device);
-    if (real_device_mode) {
-        dm_remap_close_bdev_real(main_dev);
-        dm_remap_close_bdev_real(spare_dev);
-    }
-    ti->error = "Initialization failed";
+    kvfree(meta);
     return ret;
 }
 
 /**
- * dm_remap_presuspend_v4_real() - Presuspend hook - cancel background work
+ * dm_remap_preresume_v4_real() - Revalidate the index before I/O restarts
  * 
- * CRITICAL: This is called by device-mapper BEFORE device removal.
- * We MUST cancel all background work and free remaps here, while
- * device-mapper guarantees no new I/O will arrive.
+ * v4.3: The first resume of a table loads the metadata, reconciling it
+ * with the table length (see dm_remap_load_metadata()). Later the index
+ * survives a suspend, so only what may have changed underneath is
+ * checked: the main device must still cover the target, and the metadata
+ * generation on the spare must be the one committed at postsuspend.
+ * Otherwise the index is rebuilt from the table on disk. An error keeps
+ * the device suspended.
  */
-static void dm_remap_presuspend_v4_real(struct dm_target *ti)
+static int dm_remap_preresume_v4_real(struct dm_target *ti)
 {
     struct dm_remap_device_v4_real *device = ti->private;
-    struct dm_remap_entry_v4 *entry, *tmp;
+    sector_t main_sectors;
+    u64 generation;
     
-    if (!device) {
-        return;
-    }
+    if (!device || !real_device_mode)
+        return 0;
     
-    DMR_INFO("Presuspend: stopping all background work");
+    if (!atomic_read(&device->metadata_loaded) && device->metadata_bufio_client) {
+        cancel_delayed_work_sync(&device->deferred_metadata_read_work);
+        return dm_remap_load_metadata(device);
+    }
     
-    /* CRITICAL: Mark device inactive FIRST so running work items will exit */
-    atomic_set(&device->device_active, 0);
+    if (!device->suspended)
+        return 0;
     
-    /* v4.2.2: Stop metadata write kernel thread */
-    if (device->metadata_thread) {
-        DMR_INFO("Presuspend: stopping metadata write thread");
-        kthread_stop(device->metadata_thread);
-        DMR_INFO("Presuspend: metadata thread stopped");
+    main_sectors = dm_remap_get_device_size(device->main_dev);
+    if (main_sectors < ti->len) {
+        DMR_ERROR("Main device shrank to %llu sectors while suspended, table needs %llu",
+                  (unsigned long long)main_sectors, (unsigned long long)ti->len);
+        return -EINVAL;
     }
+    if (main_sectors != device->main_device_sectors)
+        DMR_INFO("Main device is now %llu sectors (was %llu)",
+                 (unsigned long long)main_sectors,
+                 (unsigned long long)device->main_device_sectors);
     
-    /* v4.1: Just cancel work (non-blocking)
-     * DON'T use cancel_work_sync() - it can deadlock if work is queued but not running.
-     * Instead, we'll let destroy_workqueue() in destructor handle cleanup properly.
-     */
-    DMR_INFO("Presuspend: cancelling work items (non-blocking)");
-    cancel_work(&device->metadata_sync_work);
-    cancel_work(&device->error_analysis_work);
-    cancel_delayed_work(&device->health_scan_work);
-    cancel_delayed_work(&device->deferred_metadata_read_work); /* v4.2 */
-    DMR_INFO("Presuspend: work cancellation signaled");
+    if (!atomic_read(&device->metadata_loaded) || !device->metadata_bufio_client)
+        return 0;
     
-    DMR_INFO("Presuspend: freeing %u remap entries", device->remap_count_active);
+    if (!dm_remap_read_generation(device, &generation) &&
+        generation == device->suspend_generation)
+        return dm_remap_flatten_resume(device);
     
-    /* Free remap entries (safe now - no more I/O can arrive) */
-    spin_lock(&device->remap_lock);
-    list_for_each_entry_safe(entry, tmp, &device->remap_list, list) {
-        list_del(&entry->list);
-        /* Phase 3: Also remove from hash table */
-        hlist_del(&entry->hlist);
-        kfree(entry);
+    return dm_remap_reload_index(device) ?: dm_remap_flatten_resume(device);
+}
+
+/**
+ * dm_remap_resume_v4_real() - Pick up device changes made while suspended
+ * 
+ * v4.3: A spare extended or shrunk under a suspended target (lvextend,
+ * partition resize) is noticed here. The "grow" message does the same
+ * without a suspend.
+ */
+static void dm_remap_resume_v4_real(struct dm_target *ti)
+{
+    struct dm_remap_device_v4_real *device = ti->private;
+    sector_t old_sectors, new_sectors;
+    
+    if (!device)
+        return;
+    
+    if (!atomic_read(&device->metadata_loaded))
+        schedule_delayed_work(&device->deferred_metadata_read_work, 0);
+    
+    if (device->suspended) {
+        device->suspended = false;
+        atomic_set(&device->device_active, 1);
+        
+        if (atomic_read(&device->metadata_loaded) && device->metadata_dirty)
+            dm_remap_request_metadata_write(device);
+        schedule_delayed_work(&device->health_scan_work,
+                              msecs_to_jiffies(device->health_monitor.scan_interval_seconds * 1000));
+        if (device->tunables.hung_timeout)
+            schedule_delayed_work(&device->hung_work,
+                                  dm_remap_hung_interval(device->tunables.hung_timeout));
+        DMR_INFO("Resumed with %u remaps", device->remap_count_active);
     }
-    device->remap_count_active = 0;
-    spin_unlock(&device->remap_lock);
     
-    DMR_INFO("Presuspend: complete");
+    dm_remap_spare_resize(device, &old_sectors, &new_sectors);
 }
 
 /**
  * dm_remap_dtr_v4_real() - Destructor for real device support
  * 
- * NOTE: presuspend has already cancelled work and freed remaps.
- * This function just destroys the workqueue and releases resources.
+ * v4.3: A table that was never resumed is destroyed without a presuspend,
+ * so everything that may still be running is stopped here, and the remap
+ * entries kept across suspends are freed.
  */
 static void dm_remap_dtr_v4_real(struct dm_target *ti)
 {
     struct dm_remap_device_v4_real *device = ti->private;
+    struct dm_remap_entry_v4 *entry, *tmp;
+    unsigned long flags;
     
     if (!device) {
         return;
@@ -2125,6 +7471,35 @@ static void dm_remap_dtr_v4_real(struct dm_target *ti)
     /* Mark device as inactive */
     atomic_set(&device->device_active, 0);
     
+    WRITE_ONCE(device->migrate_cancel, true);
+    flush_work(&device->spare_migrate_work);
+    cancel_delayed_work_sync(&device->flatten_work);
+    if (device->flatten) {
+        /* The record stays for a later table to carry on */
+        dm_remap_flatten_destroy(device->flatten);
+        kfree(device->flatten);
+        device->flatten = NULL;
+        dm_remap_close_bdev_real(device->flatten_dev);
+    }
+    cancel_delayed_work_sync(&device->deferred_metadata_read_work);
+    cancel_delayed_work_sync(&device->health_scan_work);
+    flush_delayed_work(&device->retry_work);
+    cancel_delayed_work_sync(&device->hung_work);
+    flush_work(&device->salvage_work);
+    flush_work(&device->salvage_commit_work);
+    flush_work(&device->compress_work);
+    flush_work(&device->overlay_work);
+    flush_work(&device->verify_work);
+    flush_work(&device->verify_fix_work);
+    flush_work(&device->csum_work);
+    flush_work(&device->csum_setup_work);
+    
+    /* v4.2.2: Stop metadata write kernel thread */
+    if (device->metadata_thread) {
+        kthread_stop(device->metadata_thread);
+        device->metadata_thread = NULL;
+    }
+    
     /* Remove from global device list */
     mutex_lock(&dm_remap_devices_mutex);
     list_del(&device->device_list);
@@ -2136,6 +7511,15 @@ static void dm_remap_dtr_v4_real(struct dm_target *ti)
         kfree(device->perf_optimizer.cache_entries);
     }
     
+    DMR_INFO("Destructor: freeing %u remap entries", device->remap_count_active);
+    spin_lock_irqsave(&device->remap_lock, flags);
+    list_for_each_entry_safe(entry, tmp, &device->remap_list, list) {
+        dm_remap_index_remove(device, entry);
+        kfree(entry);
+    }
+    device->remap_count_active = 0;
+    spin_unlock_irqrestore(&device->remap_lock, flags);
+    
     /* Phase 3: Free hash table */
     if (device->remap_hash_table) {
         kfree(device->remap_hash_table);
@@ -2170,8 +7554,6 @@ static void dm_remap_dtr_v4_real(struct dm_target *ti)
         DMR_INFO("Destructor: repair subsystem cleaned up");
     }
     
-    /* NOTE: Remaps already freed in presuspend */
-    
     /* Destroy dm-bufio client */
     if (device->metadata_bufio_client) {
         dm_bufio_client_destroy(device->metadata_bufio_client);
@@ -2192,14 +7574,37 @@ static void dm_remap_dtr_v4_real(struct dm_target *ti)
         if (device->spare_dev) {
             dm_remap_close_bdev_real(device->spare_dev);  
         }
+        dm_remap_close_bdev_real(device->meta_dev);
+        dm_remap_close_bdev_real(device->overlay_dev);
     }
     
+    /* v4.3: Read errors and the overlay map */
+    dm_remap_forensic_destroy(&device->forensic);
+    dm_remap_ioclass_destroy(&device->ioclass);
+    dm_remap_correlate_leave(&device->correlate);
+    
+    /* v4.3: Checksum records */
+    dm_remap_csum_destroy(&device->csum);
+    vfree(device->csum_buf);
+    
+    /* v4.3: Free spare extents */
+    dm_remap_freelist_destroy(&device->spare_free);
+    dm_remap_freelist_destroy(&device->spare_released);
+    dm_remap_freelist_destroy(&device->spare_committing);
+    
+    /* v4.3: Compression transforms */
+    dm_remap_compress_destroy(&device->compress);
+    
     /* Destroy mutexes */
     mutex_destroy(&device->metadata_mutex);
     mutex_destroy(&device->health_mutex);
     mutex_destroy(&device->cache_mutex);
+    mutex_destroy(&device->tunables_mutex);
+    mutex_destroy(&device->csum_mutex);
+    mutex_destroy(&device->flatten_mutex);
     
     /* Free device structure */
+    free_percpu(device->leg_stats);
     kfree(device);
     
     DMR_INFO("Real device target destroyed");
@@ -2270,7 +7675,7 @@ static void dm_remap_status_v4_real(struct dm_target *ti, status_type_t type,
     
     switch (type) {
     case STATUSTYPE_INFO:
-        DMEMIT("v4.0-phase1.4 %s %s %llu %llu %llu %llu %u %llu %llu %llu %llu %u %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %u %u %u %s %s",
+        DMEMIT("v4.0-phase1.4 %s %s %llu %llu %llu %llu %u %llu %llu %llu %llu %u %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %u %u %u %s %s %ld %ld %ld",
                device->main_path, device->spare_path,
                reads, writes, remaps, errors,                      /* Basic I/O stats */
                device->metadata.active_mappings,                   /* Active remaps */
@@ -2282,12 +7687,27 @@ static void dm_remap_status_v4_real(struct dm_target *ti, status_type_t type,
                health_scans,                                       /* Health monitoring */
                health_score, hotspot_count, cache_hit_rate,        /* Health & performance metrics */
                maintenance_mode ? "maintenance" : "operational",   /* Operational state */
-               real_device_mode ? "real" : "demo");               /* Mode */
+               real_device_mode ? "real" : "demo",                /* Mode */
+               dm_remap_leg_inflight(device, DM_REMAP_LEG_MAIN),  /* v4.3: Bios in flight */
+               dm_remap_leg_inflight(device, DM_REMAP_LEG_SPARE),
+               dm_remap_leg_inflight(device, DM_REMAP_LEG_META));
         break;
         
-    case STATUSTYPE_TABLE:
-        DMEMIT("%s %s", device->main_path, device->spare_path);
+    case STATUSTYPE_TABLE: {
+        /* v4.3: Features and non-default settings, so a reload keeps them */
+        struct dm_remap_table_args args = {
+            .main_path = device->main_path,
+            .spare_path = device->spare_path,
+            .metadata_path = device->meta_dev ? device->meta_path : NULL,
+            .metadata_offset = device->meta_offset,
+            .read_only = device->ro_feature,
+            .overlay_path = device->overlay_dev ? device->overlay_path : NULL,
+            .tunables = device->tunables,
+        };
+        
+        sz += dm_remap_table_args_format(&args, result + sz, maxlen - sz);
         break;
+    }
         
     case STATUSTYPE_IMA:
         /* Enhanced integrity information */
@@ -2299,6 +7719,47 @@ static void dm_remap_status_v4_real(struct dm_target *ti, status_type_t type,
     }
 }
 
+/**
+ * dm_remap_iterate_devices_v4_real() - Report both legs to device-mapper core
+ * 
+ * v4.3: Lets DM core stack queue limits (including atomic write units) from
+ * both devices, since any sector may end up on either of them. The legs are
+ * opened by path rather than with dm_get_device(), so the target keeps
+ * struct dm_dev views of them.
+ */
+static int dm_remap_iterate_devices_v4_real(struct dm_target *ti,
+                                           iterate_devices_callout_fn fn, void *data)
+{
+    struct dm_remap_device_v4_real *device = ti->private;
+    int ret = 0;
+    
+    if (!device || !device->main_dm_dev.bdev) {
+        return 0;  /* Demo mode */
+    }
+    
+    ret = fn(ti, &device->main_dm_dev, 0, ti->len, data);
+    if (!ret && device->spare_dm_dev.bdev) {
+        ret = fn(ti, &device->spare_dm_dev, 0, device->spare_device_sectors, data);
+    }
+    
+    return ret;
+}
+
+/**
+ * dm_remap_io_hints_v4_real() - Adjust stacked queue limits (v4.3)
+ *
+ * DM stacks the legs' integrity profile because we pass integrity. Drop it
+ * again when the legs disagree, so the block layer generates and verifies
+ * PI on each leg instead of handing us tuples the spare cannot store.
+ */
+static void dm_remap_io_hints_v4_real(struct dm_target *ti, struct queue_limits *limits)
+{
+    struct dm_remap_device_v4_real *device = ti->private;
+    
+    if (!device->integrity_enabled)
+        memset(&limits->integrity, 0, sizeof(limits->integrity));
+}
+
 /**
  * dm_remap_end_io_v4_real() - Handle I/O completion and error detection
  */
@@ -2306,18 +7767,98 @@ static int dm_remap_end_io_v4_real(struct dm_target *ti, struct bio *bio,
                                   blk_status_t *error)
 {
     struct dm_remap_device_v4_real *device = ti->private;
-    ktime_t io_end_time = ktime_get();
-    u64 io_latency_ns = ktime_to_ns(ktime_sub(io_end_time, device->last_io_time));
+    struct dm_remap_io_ctx *ctx = dm_per_bio_data(bio, sizeof(struct dm_remap_io_ctx));
+    u64 io_latency_ns;
+    unsigned long flags;
+    
+    /* v4.3: Refused atomic writes never reached a device */
+    if (ctx->flags & DM_REMAP_IO_REFUSED)
+        return DM_ENDIO_DONE;
+    
+    /* v4.3: Salvaged reads, verified and checksummed writes were accounted
+     * when first seen; the compress and overlay work's bios never reached a leg */
+    if (ctx->flags & (DM_REMAP_IO_SALVAGED | DM_REMAP_IO_VERIFIED | DM_REMAP_IO_CSUM |
+                      DM_REMAP_IO_COMPRESS | DM_REMAP_IO_OVERLAY))
+        return DM_ENDIO_DONE;
+    
+    /* v4.3: Per-bio latency, on the leg the bio went to */
+    io_latency_ns = dm_remap_leg_end(device, ctx);
+    
+    /* v4.3: Spare leg accounting, once per bio (a committed staged write
+     * comes through here a second time). A running spare replacement copies
+     * written chunks again, whether or not the write succeeded.
+     */
+    if ((ctx->flags & (DM_REMAP_IO_SPARE | DM_REMAP_IO_COMMITTED)) == DM_REMAP_IO_SPARE) {
+        struct dm_remap_spare_migration *m = READ_ONCE(device->migration);
+        
+        if (m && op_is_write(bio_op(bio)))
+            dm_remap_migration_mark(m, ctx->spare_sector, ctx->nr_sectors);
+        dm_remap_spare_io_end(device, !!(ctx->flags & DM_REMAP_IO_SPARE_GEN));
+    }
+    
+    /* v4.3: Hold a staged atomic write until its extent is committed */
+    if (ctx->flags & DM_REMAP_IO_STAGED) {
+        if (ctx->flags & DM_REMAP_IO_COMMITTED)
+            return DM_ENDIO_DONE;
+        if (*error != BLK_STS_OK) {
+            /* Old mapping untouched; the staged extent is released */
+            DMR_WARN("Staged write to spare sector %llu failed (error=%d)",
+                     (unsigned long long)ctx->stage_sector, blk_status_to_errno(*error));
+            spin_lock_irqsave(&device->remap_lock, flags);
+            dm_remap_freelist_add(&device->spare_released, ctx->stage_sector, ctx->nr_sectors);
+            spin_unlock_irqrestore(&device->remap_lock, flags);
+            return DM_ENDIO_DONE;
+        }
+        
+        spin_lock_irqsave(&device->remap_lock, flags);
+        list_add_tail(&ctx->list, &device->atomic_commit_list);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        mod_delayed_work(device->metadata_workqueue, &device->atomic_commit_work, 0);
+        return DM_ENDIO_INCOMPLETE;
+    }
+    
+    /* v4.3: A running flatten copies written ranges again */
+    if (op_is_write(bio_op(bio)) && ctx->nr_sectors)
+        dm_remap_flatten_note(device, ctx->orig_sector, ctx->nr_sectors);
     
     /* Update performance statistics */
     device->stats.total_latency_ns += io_latency_ns;
     device->stats.max_latency_ns = max(device->stats.max_latency_ns, io_latency_ns);
     
-    /* Handle I/O errors for automatic remapping */
-    if (*error != BLK_STS_OK) {
-        sector_t failed_sector = bio->bi_iter.bi_sector;
+    /* v4.3: "inject_error" fails main device completions on request */
+    if (unlikely(atomic_read(&device->inject_count)) && *error == BLK_STS_OK &&
+        (ctx->flags & DM_REMAP_IO_MAIN) && atomic_dec_if_positive(&device->inject_count) >= 0)
+        *error = READ_ONCE(device->inject_status);
+    
+    if (unlikely(*error == BLK_STS_PROTECTION))
+        atomic64_inc(&device->integrity_errors);
+    
+    if (unlikely(ctx->retries) && *error == BLK_STS_OK) {
+        atomic64_inc(&device->retries_recovered);
+        DMR_INFO("Sector %llu recovered after %u retries",
+                 (unsigned long long)ctx->orig_sector, ctx->retries);
+    }
+    
+    /* v4.3: Checksum what went to or came back from the spare */
+    if (*error == BLK_STS_OK)
+        dm_remap_csum_io(device, bio, ctx, error);
+    
+    /* v4.3: Read back writes where a silent failure is likeliest */
+    if (*error == BLK_STS_OK && dm_remap_verify_io(device, bio, ctx))
+        return DM_ENDIO_INCOMPLETE;
+    
+    /* v4.3: Spare writes complete once their checksum records are written */
+    if (*error == BLK_STS_OK && dm_remap_csum_hold(device, bio, ctx))
+        return DM_ENDIO_INCOMPLETE;
+    
+    /* Handle I/O errors for automatic remapping (data I/O only, not flushes) */
+    if (*error != BLK_STS_OK && ctx->nr_sectors) {
+        sector_t failed_sector = ctx->orig_sector;
         int errno_val = blk_status_to_errno(*error);
+        enum dm_remap_error_class class = dm_remap_classify_error(*error);
+        u32 action = READ_ONCE(device->tunables.error_action[class]);
         struct block_device * __maybe_unused main_bdev = device->main_dev ? file_bdev(device->main_dev) : NULL;
+        bool burst_started;
         
         DMR_WARN("I/O error detected on sector %llu (error=%d)",
                  (unsigned long long)failed_sector, errno_val);
@@ -2328,19 +7869,65 @@ static int dm_remap_end_io_v4_real(struct dm_target *ti, struct bio *bio,
          * We only reject errors from the spare device to avoid remapping spare errors.
          */
         if (device->main_dev) {
-            struct block_device *spare_bdev = device->spare_dev ? file_bdev(device->spare_dev) : NULL;
-            
             /* Only handle errors from main device (not spare) */
-            if (!spare_bdev || bio->bi_bdev != spare_bdev) {
-                /* Queue write-ahead remap creation
-                 * 
-                 * v4.2 Data Safety: This I/O will fail, but write-ahead metadata
-                 * ensures the remap is persisted before any future I/O can use it.
-                 * Next I/O to this sector will find the ACTIVE remap and succeed.
-                 * 
-                 * The error handler checks for duplicate remaps internally.
-                 */
-                dm_remap_handle_io_error(device, failed_sector, errno_val);
+            if (!(ctx->flags & DM_REMAP_IO_SPARE)) {
+                /* v4.3: Each bio is counted once, not again after retries */
+                if (!ctx->retries)
+                    atomic64_inc(&device->error_class_count[class]);
+                
+                /* Retrying a REQ_NOWAIT bio would block on its behalf */
+                if (class == DM_REMAP_ERR_RESOURCE && (bio->bi_opf & REQ_NOWAIT))
+                    action = DM_REMAP_ACT_PASS;
+                
+                /* v4.3: Errors on several targets at once are the controller's */
+                if (class != DM_REMAP_ERR_RESOURCE && class != DM_REMAP_ERR_UNSUPPORTED &&
+                    dm_remap_correlate_error(&device->correlate, &burst_started)) {
+                    if (burst_started)
+                        dm_remap_event_record(&device->events, DM_REMAP_EVENT_BURST,
+                                              failed_sector, ctx->nr_sectors);
+                    if (action == DM_REMAP_ACT_REMAP) {
+                        action = READ_ONCE(device->tunables.correlated_action);
+                        if (action != DM_REMAP_ACT_REMAP && !ctx->retries)
+                            atomic64_inc(&device->correlated_errors);
+                    }
+                }
+                
+                /* v4.3: Read-only: recorded, never remapped */
+                if (device->read_only && action == DM_REMAP_ACT_REMAP)
+                    action = DM_REMAP_ACT_COUNT;
+                
+                switch (action) {
+                case DM_REMAP_ACT_RETRY:
+                    if (dm_remap_retry_io(device, bio, ctx))
+                        return DM_ENDIO_INCOMPLETE;
+                    break;
+                case DM_REMAP_ACT_PASS:
+                    break;
+                case DM_REMAP_ACT_COUNT:
+                    dm_remap_count_io_error(device, failed_sector);
+                    break;
+                default:
+                    /* Queue write-ahead remap creation
+                     * 
+                     * v4.2 Data Safety: This I/O will fail, but write-ahead metadata
+                     * ensures the remap is persisted before any future I/O can use it.
+                     * Next I/O to this sector will find the ACTIVE remap and succeed.
+                     * 
+                     * The error handler checks for duplicate remaps internally.
+                     * 
+                     * v4.3: Reads are re-read first and what comes back goes
+                     * to the new spare extent (dm_remap_salvage_work()).
+                     */
+                    if (dm_remap_salvage_io(device, bio, ctx, *error))
+                        return DM_ENDIO_INCOMPLETE;
+                    dm_remap_handle_io_error(device, failed_sector, errno_val,
+                                             op_is_write(bio_op(bio)));
+                    break;
+                }
+                
+                if (device->read_only)
+                    dm_remap_forensic_note_error(&device->forensic, failed_sector,
+                                                 ctx->nr_sectors);
             }
         }
     }
@@ -2348,29 +7935,133 @@ static int dm_remap_end_io_v4_real(struct dm_target *ti, struct bio *bio,
     return DM_ENDIO_DONE;
 }
 
+/**
+ * dm_remap_apply_tunables() - Switch a live device to new settings
+ * 
+ * v4.3: Takes effect without reloading the table. The cache is reallocated
+ * if its size changed and a pending health scan or hung I/O check is moved
+ * to the new interval; data checksums start recording at once and are set
+ * up in the background. cgroup paths and the error domain are looked up
+ * here. Remap granularity, commit policy, salvage and verify settings are
+ * read where they are used.
+ * Caller holds tunables_mutex.
+ */
+static int dm_remap_apply_tunables(struct dm_remap_device_v4_real *device,
+                                   const struct dm_remap_tunables *tunables)
+{
+    bool csum_changed = tunables->data_checksums != device->tunables.data_checksums;
+    int ret;
+    
+    /* v4.3: Placing or retiring the checksum table writes the spare */
+    if (csum_changed && device->read_only)
+        return -EROFS;
+    
+    if (csum_changed && tunables->data_checksums) {
+        ret = dm_remap_csum_enable(device);
+        if (ret)
+            return ret;
+    }
+    
+    if (tunables->cache_size != device->tunables.cache_size) {
+        ret = dm_remap_cache_resize(device, tunables->cache_size);
+        if (ret)
+            return ret;
+    }
+    
+    if (tunables->compress && tunables->compress != device->tunables.compress) {
+        ret = dm_remap_compress_enable(device, tunables->compress);
+        if (ret)
+            return ret;
+    }
+    
+    if (memcmp(tunables->ioprio, device->tunables.ioprio, sizeof(tunables->ioprio)) ||
+        memcmp(tunables->cgroup, device->tunables.cgroup, sizeof(tunables->cgroup))) {
+        ret = dm_remap_ioclass_set(&device->ioclass, tunables);
+        if (ret)
+            return ret;
+    }
+    
+    if (strcmp(tunables->error_domain, device->tunables.error_domain)) {
+        ret = dm_remap_correlate_join(&device->correlate, tunables->error_domain,
+                                      device->main_dev ? file_bdev(device->main_dev) : NULL);
+        if (ret)
+            return ret;
+    }
+    
+    if (tunables->scan_interval != device->tunables.scan_interval) {
+        mutex_lock(&device->health_mutex);
+        device->health_monitor.scan_interval_seconds = tunables->scan_interval;
+        mutex_unlock(&device->health_mutex);
+        
+        if (atomic_read(&device->device_active))
+            mod_delayed_work(system_wq, &device->health_scan_work,
+                             msecs_to_jiffies(tunables->scan_interval * 1000));
+    }
+    
+    if (tunables->hung_timeout != device->tunables.hung_timeout &&
+        atomic_read(&device->device_active)) {
+        if (tunables->hung_timeout)
+            mod_delayed_work(system_wq, &device->hung_work,
+                             dm_remap_hung_interval(tunables->hung_timeout));
+        else
+            cancel_delayed_work(&device->hung_work);
+    }
+    
+    device->tunables = *tunables;
+    device->enterprise.configuration_version++;
+    
+    /* Placing, loading or retiring the checksum table commits metadata */
+    if (csum_changed && atomic_read(&device->metadata_loaded))
+        queue_work(device->metadata_workqueue, &device->csum_setup_work);
+    
+    DMR_INFO("Settings changed: scan_interval=%u cache_size=%u commit_policy=%u "
+             "remap_granularity=%u compress=%s",
+             tunables->scan_interval, tunables->cache_size,
+             tunables->commit_policy, tunables->remap_granularity,
+             dm_remap_compress_alg_name(tunables->compress));
+    return 0;
+}
+
 /**
  * dm_remap_message_v4_real() - Handle dmsetup message commands
  * 
  * Allows runtime control via: dmsetup message <device> 0 <command> [args]
+ * Arguments are parsed by dm_remap_message_parse() (dm-remap-v4-message.c);
+ * checks that need device state are done here.
  */
 static int dm_remap_message_v4_real(struct dm_target *ti, unsigned argc, char **argv,
                                    char *result, unsigned maxlen)
 {
     struct dm_remap_device_v4_real *device = ti->private;
+    struct dm_remap_msg msg;
+    int ret;
     
-    if (argc < 1) {
-        return -EINVAL;
+    ret = dm_remap_message_parse(argc, argv, &msg);
+    if (ret) {
+        if (msg.error)
+            scnprintf(result, maxlen, "%s", msg.error);
+        else if (argc >= 1)
+            scnprintf(result, maxlen, "Unknown command '%s'. Try 'help'", argv[0]);
+        return ret;
+    }
+    
+    /* v4.3: Nothing that writes the devices runs on a read-only target */
+    if (device->read_only &&
+        (msg.cmd == DM_REMAP_MSG_TEST_REMAP || msg.cmd == DM_REMAP_MSG_GROW ||
+         (msg.cmd == DM_REMAP_MSG_REPLACE_SPARE && msg.op == DM_REMAP_MSG_REPLACE_START) ||
+         (msg.cmd == DM_REMAP_MSG_FLATTEN && msg.op == DM_REMAP_MSG_FLATTEN_START))) {
+        scnprintf(result, maxlen, "Target is read-only");
+        return -EROFS;
     }
     
+    switch (msg.cmd) {
     /* Help command */
-    if (!strcasecmp(argv[0], "help")) {
-        scnprintf(result, maxlen,
-                 "Commands: help, status, stats, clear_stats, health, cache_stats, test_remap");
+    case DM_REMAP_MSG_HELP:
+        scnprintf(result, maxlen, DM_REMAP_MSG_HELP_TEXT);
         return 0;
-    }
     
     /* Status command - quick overview */
-    if (!strcasecmp(argv[0], "status")) {
+    case DM_REMAP_MSG_STATUS:
         scnprintf(result, maxlen,
                  "mappings=%u reads=%llu writes=%llu errors=%llu health=%u%%",
                  device->metadata.active_mappings,
@@ -2379,13 +8070,39 @@ static int dm_remap_message_v4_real(struct dm_target *ti, unsigned argc, char **
                  (unsigned long long)atomic64_read(&device->stats.io_errors),
                  device->health_monitor.failure_prediction_score);
         return 0;
-    }
     
     /* Stats command - detailed statistics */
-    if (!strcasecmp(argv[0], "stats")) {
-        scnprintf(result, maxlen,
+    case DM_REMAP_MSG_STATS: {
+        struct dm_remap_entry_v4 *entry;
+        unsigned int sz, zero_remaps = 0, compressed_remaps = 0;
+        sector_t spare_free, compressed_sectors = 0, extent = 0;
+        u64 ratio, ios;
+        unsigned long flags;
+        
+        /* v4.3: Zero and compressed remaps, and spare space no remap uses
+         * any more. A unit's entries are neighbours in the index. */
+        spin_lock_irqsave(&device->remap_lock, flags);
+        for (entry = dm_remap_index_ceil(device, 0); entry; entry = dm_remap_index_next(entry)) {
+            if (entry->flags & DM_REMAP_FLAG_ZERO)
+                zero_remaps++;
+            if (!(entry->flags & DM_REMAP_FLAG_COMPRESSED))
+                continue;
+            compressed_remaps++;
+            if (entry->spare_sector != extent)
+                compressed_sectors += DM_REMAP_V4_REMAP_CLEN(entry->flags);
+            extent = entry->spare_sector;
+        }
+        spare_free = device->spare_free.sectors + device->spare_released.sectors +
+                     device->spare_committing.sectors;
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        
+        sz = scnprintf(result, maxlen,
                  "total_ios=%llu normal=%llu remapped=%llu errors=%llu "
-                 "remapped_sectors=%llu avg_latency_ns=%llu max_latency_ns=%llu",
+                 "remapped_sectors=%llu avg_latency_ns=%llu max_latency_ns=%llu "
+                 "split_ios=%llu atomic_writes=%llu atomic_staged=%llu atomic_refused=%llu "
+                 "integrity=%s integrity_ios=%llu integrity_remapped=%llu integrity_errors=%llu "
+                 "zero_remaps=%u zero_saved_bytes=%llu spare_free_sectors=%llu "
+                 "zero_reads=%llu zero_writes=%llu zero_allocs=%llu",
                  (unsigned long long)atomic64_read(&device->stats.total_ios),
                  (unsigned long long)atomic64_read(&device->stats.normal_ios),
                  (unsigned long long)atomic64_read(&device->stats.remapped_ios),
@@ -2393,12 +8110,41 @@ static int dm_remap_message_v4_real(struct dm_target *ti, unsigned argc, char **
                  (unsigned long long)atomic64_read(&device->stats.remapped_sectors),
                  atomic64_read(&device->stats.total_ios) > 0 ?
                      device->stats.total_latency_ns / atomic64_read(&device->stats.total_ios) : 0,
-                 device->stats.max_latency_ns);
+                 device->stats.max_latency_ns,
+                 (unsigned long long)atomic64_read(&device->split_ios),
+                 (unsigned long long)atomic64_read(&device->atomic_writes),
+                 (unsigned long long)atomic64_read(&device->atomic_staged),
+                 (unsigned long long)atomic64_read(&device->atomic_refused),
+                 device->integrity_enabled ? "on" : "off",
+                 (unsigned long long)atomic64_read(&device->integrity_ios),
+                 (unsigned long long)atomic64_read(&device->integrity_remapped),
+                 (unsigned long long)atomic64_read(&device->integrity_errors),
+                 zero_remaps, (unsigned long long)zero_remaps << SECTOR_SHIFT,
+                 (unsigned long long)spare_free,
+                 (unsigned long long)atomic64_read(&device->zero_reads),
+                 (unsigned long long)atomic64_read(&device->zero_writes),
+                 (unsigned long long)atomic64_read(&device->zero_allocs));
+        
+        ratio = compressed_sectors ? div64_u64((u64)compressed_remaps * 100, compressed_sectors) : 0;
+        ios = atomic64_read(&device->compress_ios);
+        sz += scnprintf(result + sz, maxlen - sz,
+                        " compress=%s compressed_remaps=%u compressed_spare_sectors=%llu "
+                        "compress_saved_bytes=%llu compress_ratio=%llu.%02llu "
+                        "compress_ios=%llu compress_lat_us=%llu",
+                        dm_remap_compress_alg_name(READ_ONCE(device->tunables.compress)),
+                        compressed_remaps, (unsigned long long)compressed_sectors,
+                        (unsigned long long)(compressed_remaps - compressed_sectors) << SECTOR_SHIFT,
+                        (unsigned long long)(ratio / 100), (unsigned long long)(ratio % 100),
+                        (unsigned long long)ios,
+                        (unsigned long long)(ios ? div64_u64(atomic64_read(&device->compress_io_ns),
+                                                             ios * 1000) : 0));
+        sz += dm_remap_compress_format(&device->compress, result + sz, maxlen - sz);
+        dm_remap_leg_stats_format(device, result + sz, maxlen - sz);
         return 0;
     }
     
     /* Clear stats command */
-    if (!strcasecmp(argv[0], "clear_stats")) {
+    case DM_REMAP_MSG_CLEAR_STATS:
         atomic64_set(&device->read_count, 0);
         atomic64_set(&device->write_count, 0);
         atomic64_set(&device->remap_count, 0);
@@ -2410,25 +8156,44 @@ static int dm_remap_message_v4_real(struct dm_target *ti, unsigned argc, char **
         atomic64_set(&device->stats.remapped_sectors, 0);
         device->stats.total_latency_ns = 0;
         device->stats.max_latency_ns = 0;
+        atomic64_set(&device->split_ios, 0);
+        atomic64_set(&device->atomic_writes, 0);
+        atomic64_set(&device->atomic_staged, 0);
+        atomic64_set(&device->atomic_refused, 0);
+        atomic64_set(&device->integrity_ios, 0);
+        atomic64_set(&device->integrity_remapped, 0);
+        atomic64_set(&device->integrity_errors, 0);
+        atomic64_set(&device->zero_reads, 0);
+        atomic64_set(&device->zero_writes, 0);
+        atomic64_set(&device->zero_allocs, 0);
+        atomic64_set(&device->compress_ios, 0);
+        atomic64_set(&device->compress_io_ns, 0);
+        dm_remap_compress_stats_reset(&device->compress);
+        atomic64_set(&device->policy_retried, 0);
+        atomic64_set(&device->policy_ignored, 0);
+        atomic64_set(&device->hung_ios, 0);
+        dm_remap_error_stats_reset(device);
+        dm_remap_pipeline_reset(&device->pipeline);
+        dm_remap_leg_stats_reset(device);
+        dm_remap_csum_stats_reset(&device->csum);
         scnprintf(result, maxlen, "Statistics cleared");
         return 0;
-    }
     
     /* Health command - health monitoring info */
-    if (!strcasecmp(argv[0], "health")) {
+    case DM_REMAP_MSG_HEALTH:
         scnprintf(result, maxlen,
                  "health_score=%u%% scan_count=%llu hotspot_sectors=%u "
-                 "consecutive_errors=%u trend=%u",
+                 "consecutive_errors=%u trend=%u slow_ios=%u",
                  device->health_monitor.failure_prediction_score,
                  (unsigned long long)atomic64_read(&device->health_scan_count),
                  device->health_monitor.hotspot_count,
                  device->health_monitor.consecutive_errors,
-                 device->health_monitor.health_trend);
+                 device->health_monitor.health_trend,
+                 device->health_monitor.timeout_count);
         return 0;
-    }
     
     /* Cache stats command - performance cache info */
-    if (!strcasecmp(argv[0], "cache_stats")) {
+    case DM_REMAP_MSG_CACHE_STATS: {
         u64 hits = atomic64_read(&device->perf_optimizer.cache_hits);
         u64 misses = atomic64_read(&device->perf_optimizer.cache_misses);
         u64 total = hits + misses;
@@ -2443,23 +8208,167 @@ static int dm_remap_message_v4_real(struct dm_target *ti, unsigned argc, char **
         return 0;
     }
     
-    /* Test remap command - manually create a test remap entry for testing */
-    if (!strcasecmp(argv[0], "test_remap")) {
-        if (argc < 3) {
-            scnprintf(result, maxlen, "Usage: test_remap <bad_sector> <spare_sector>");
+    /* Policy command - attached BPF remap policy and its verdicts */
+    case DM_REMAP_MSG_POLICY: {
+        char name[DM_REMAP_POLICY_NAME_LEN];
+        
+        dm_remap_policy_name(name, sizeof(name));
+        scnprintf(result, maxlen, "policy=%s retried=%llu ignored=%llu",
+                 name,
+                 (unsigned long long)atomic64_read(&device->policy_retried),
+                 (unsigned long long)atomic64_read(&device->policy_ignored));
+        return 0;
+    }
+    
+    /* Errors command - main device errors by class and retry outcome */
+    case DM_REMAP_MSG_ERRORS: {
+        unsigned int class, sz = 0;
+        
+        for (class = 0; class < DM_REMAP_NR_ERROR_CLASSES; class++)
+            sz += scnprintf(result + sz, maxlen - sz, "%s=%llu ",
+                            dm_remap_error_class_name(class),
+                            (unsigned long long)atomic64_read(&device->error_class_count[class]));
+        sz += scnprintf(result + sz, maxlen - sz, "retried=%llu recovered=%llu exhausted=%llu "
+                        "salvage_transient=%llu salvage_hard=%llu salvage_recovered=%llu "
+                        "salvage_lost=%llu verified=%llu verify_failed=%llu verify_remapped=%llu "
+                        "verify_evacuated=%llu injecting=%d correlated=%llu",
+                        (unsigned long long)atomic64_read(&device->retries_issued),
+                        (unsigned long long)atomic64_read(&device->retries_recovered),
+                        (unsigned long long)atomic64_read(&device->retries_exhausted),
+                        (unsigned long long)atomic64_read(&device->salvage_transient),
+                        (unsigned long long)atomic64_read(&device->salvage_hard),
+                        (unsigned long long)atomic64_read(&device->salvage_recovered_sectors),
+                        (unsigned long long)atomic64_read(&device->salvage_lost_sectors),
+                        (unsigned long long)atomic64_read(&device->verify_writes),
+                        (unsigned long long)atomic64_read(&device->verify_failed),
+                        (unsigned long long)atomic64_read(&device->verify_remapped),
+                        (unsigned long long)atomic64_read(&device->verify_evacuated),
+                        atomic_read(&device->inject_count),
+                        (unsigned long long)atomic64_read(&device->correlated_errors));
+        dm_remap_correlate_format(&device->correlate, result + sz, maxlen - sz);
+        return 0;
+    }
+    
+    case DM_REMAP_MSG_HUNG:
+        dm_remap_hung_format(device, result, maxlen);
+        return 0;
+    
+    /* Checksums command - spare data checksum table and counters */
+    case DM_REMAP_MSG_CHECKSUMS: {
+        int n = scnprintf(result, maxlen, "state=%s area=%llu ",
+                          dm_remap_csum_state_names[READ_ONCE(device->csum_state)],
+                          (unsigned long long)device->csum_area);
+        
+        dm_remap_csum_format(&device->csum, result + n, maxlen - n);
+        return 0;
+    }
+    
+    /* Pipeline command - remap creation stage timing and metadata cost */
+    case DM_REMAP_MSG_PIPELINE:
+        dm_remap_pipeline_format(&device->pipeline, result, maxlen);
+        return 0;
+    
+    /* Inject error command - fail the next main device completions (testing)
+     *   inject_error <status> [<count>]   count 0 stops a running injection
+     */
+    case DM_REMAP_MSG_INJECT_ERROR: {
+        unsigned int i;
+        
+        for (i = 0; i < ARRAY_SIZE(dm_remap_inject_statuses); i++) {
+            if (!strcasecmp(msg.argv[0], dm_remap_inject_statuses[i].name))
+                break;
+        }
+        if (i == ARRAY_SIZE(dm_remap_inject_statuses) || msg.arg[0] > INT_MAX) {
+            scnprintf(result, maxlen, "%s (medium, ioerr, protection, target, transport, "
+                      "timeout, offline, nexus, resource, again, notsupp, nospc)", msg.error);
             return -EINVAL;
         }
         
-        u64 bad_sector = simple_strtoull(argv[1], NULL, 0);
-        u64 spare_sector = simple_strtoull(argv[2], NULL, 0);
+        atomic_set(&device->inject_count, 0);
+        WRITE_ONCE(device->inject_status, dm_remap_inject_statuses[i].status);
+        atomic_set(&device->inject_count, msg.arg[0]);
+        scnprintf(result, maxlen, "Injecting %s (%s errors) into the next %llu completions",
+                  dm_remap_inject_statuses[i].name,
+                  dm_remap_error_class_name(dm_remap_classify_error(dm_remap_inject_statuses[i].status)),
+                  msg.arg[0]);
+        return 0;
+    }
+    
+    /* Shadow command - dry-run an alternate policy on the live error stream
+     *   shadow                       show shadow and active decisions
+     *   shadow set <key=value>...    (re)start with the given parameters
+     *   shadow reset | off
+     */
+    case DM_REMAP_MSG_SHADOW: {
+        int n;
+        
+        if (msg.op == DM_REMAP_MSG_SHADOW_SET) {
+            struct dm_remap_policy_params active = {
+                .remap_after_errors = 1,
+                .remap_granularity = dm_remap_remap_granularity(device),
+                .predict_consecutive = DM_REMAP_PREDICT_CONSECUTIVE,
+                .predict_step = DM_REMAP_PREDICT_STEP,
+                .migrate_score = 0,
+            };
+            
+            ret = dm_remap_shadow_configure(&device->shadow, &active, msg.argc, msg.argv);
+            if (ret) {
+                scnprintf(result, maxlen, "%s", msg.error);
+                return ret;
+            }
+        } else if (msg.op == DM_REMAP_MSG_SHADOW_RESET) {
+            dm_remap_shadow_reset(&device->shadow);
+        } else if (msg.op == DM_REMAP_MSG_SHADOW_OFF) {
+            dm_remap_shadow_disable(&device->shadow);
+        }
+        
+        n = dm_remap_shadow_format(&device->shadow, result, maxlen);
+        scnprintf(result + n, maxlen - n,
+                 " active_remaps=%llu active_spare_sectors=%llu active_predictions=%llu",
+                 (unsigned long long)atomic64_read(&device->active_remaps),
+                 (unsigned long long)atomic64_read(&device->stats.remapped_sectors),
+                 (unsigned long long)atomic64_read(&device->active_predictions));
+        return 0;
+    }
+    
+    /* Events command - recent remap decisions, optionally after a sequence number */
+    case DM_REMAP_MSG_EVENTS:
+        dm_remap_event_format(&device->events, msg.arg[0], result, maxlen);
+        return 0;
+    
+    /* Test remap command - manually create a test remap entry for testing */
+    case DM_REMAP_MSG_TEST_REMAP: {
+        u64 bad_sector = msg.arg[0];
+        u64 spare_sector = msg.arg[1];
+        unsigned long flags;
+        
+        if (bad_sector >= ti->len ||
+            spare_sector < DM_REMAP_V4_SPARE_DATA_START ||
+            spare_sector >= device->spare_sector_count) {
+            scnprintf(result, maxlen,
+                     "Sector out of range: bad_sector < %llu, %llu <= spare_sector < %llu",
+                     (unsigned long long)ti->len,
+                     (unsigned long long)DM_REMAP_V4_SPARE_DATA_START,
+                     (unsigned long long)device->spare_sector_count);
+            return -ERANGE;
+        }
         
         /* Add remap entry */
-        int ret = dm_remap_add_remap_entry(device, bad_sector, spare_sector);
+        ret = dm_remap_add_remap_entry(device, bad_sector, spare_sector);
         if (ret) {
             scnprintf(result, maxlen, "Failed to add remap: %d", ret);
             return ret;
         }
         
+        /* Keep the allocator from handing out the same spare sector again */
+        spin_lock_irqsave(&device->remap_lock, flags);
+        if (device->next_spare_sector <= spare_sector)
+            device->next_spare_sector = spare_sector + 1;
+        dm_remap_freelist_claim(&device->spare_free, spare_sector, 1);
+        dm_remap_freelist_claim(&device->spare_released, spare_sector, 1);
+        dm_remap_freelist_claim(&device->spare_committing, spare_sector, 1);
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        
         /* Request immediate metadata write to persist the remap */
         dm_remap_request_metadata_write(device);
         
@@ -2468,6 +8377,153 @@ static int dm_remap_message_v4_real(struct dm_target *ti, unsigned argc, char **
         return 0;
     }
     
+    /* Set command - show or change per-device settings
+     *   set                  show all settings
+     *   set <key> <value>    validate and apply one setting
+     */
+    case DM_REMAP_MSG_SET: {
+        struct dm_remap_tunables tunables;
+        
+        mutex_lock(&device->tunables_mutex);
+        tunables = device->tunables;
+        if (msg.argc) {
+            ret = dm_remap_tunable_set(&tunables, msg.argv[0], msg.argv[1]);
+            if (!ret)
+                ret = dm_remap_apply_tunables(device, &tunables);
+            if (ret) {
+                mutex_unlock(&device->tunables_mutex);
+                scnprintf(result, maxlen, "%s",
+                         ret == -EINVAL ? msg.error :
+                         ret == -EROFS ? "Target is read-only" :
+                         ret == -EOPNOTSUPP ? "Compression not supported on this device" :
+                         ret == -ENOENT ? "Compression algorithm not available" :
+                         ret == -ESRCH ? "No such cgroup" :
+                         "Cannot allocate remap cache");
+                return ret;
+            }
+        }
+        mutex_unlock(&device->tunables_mutex);
+        
+        dm_remap_tunables_format(&tunables, false, result, maxlen);
+        return 0;
+    }
+    
+    /* Replace spare command - move the spare to another device online
+     *   replace_spare                     show progress of the last replacement
+     *   replace_spare <new_spare_device>  start copying
+     *   replace_spare cancel              stop before the switch
+     */
+    case DM_REMAP_MSG_REPLACE_SPARE: {
+        struct dm_remap_spare_migration *m;
+        const char *error = NULL;
+        unsigned long flags;
+        
+        if (msg.op == DM_REMAP_MSG_REPLACE_START) {
+            ret = dm_remap_spare_migrate_start(device, msg.argv[0], &error);
+            if (ret) {
+                scnprintf(result, maxlen, "%s", error);
+                return ret;
+            }
+        } else if (msg.op == DM_REMAP_MSG_REPLACE_CANCEL) {
+            if (!READ_ONCE(device->migration)) {
+                scnprintf(result, maxlen, "No spare replacement running");
+                return -EINVAL;
+            }
+            WRITE_ONCE(device->migrate_cancel, true);
+        }
+        
+        /* The migration is freed only after it is unpublished under remap_lock */
+        spin_lock_irqsave(&device->remap_lock, flags);
+        m = device->migration;
+        scnprintf(result, maxlen,
+                  "state=%s spare=%s new_spare=%s passes=%u copied_sectors=%lld "
+                  "dirty_chunks=%lu error=%d",
+                  dm_remap_migrate_state_name(READ_ONCE(device->migrate_state)),
+                  device->spare_path, m ? device->new_spare_path : "-",
+                  m ? m->passes : 0, m ? (long long)atomic64_read(&m->copied_sectors) : 0LL,
+                  m ? dm_remap_migration_dirty_chunks(m) : 0UL,
+                  READ_ONCE(device->migrate_error));
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        return 0;
+    }
+    
+    /* Flatten command - copy the target onto a replacement device online
+     *   flatten                           show progress of the last flatten
+     *   flatten <replacement_device>      start copying
+     *   flatten cancel                    stop and forget the copy
+     */
+    case DM_REMAP_MSG_FLATTEN: {
+        struct dm_remap_flatten *f;
+        const char *error = NULL;
+        unsigned long flags;
+        
+        if (msg.op == DM_REMAP_MSG_FLATTEN_START) {
+            ret = dm_remap_flatten_start(device, msg.argv[0], &error);
+            if (ret) {
+                scnprintf(result, maxlen, "%s", error);
+                return ret;
+            }
+        } else if (msg.op == DM_REMAP_MSG_FLATTEN_CANCEL) {
+            mutex_lock(&device->flatten_mutex);
+            ret = device->flatten ? 0 : -EINVAL;
+            if (!ret) {
+                WRITE_ONCE(device->flatten_cancel, true);
+                mod_delayed_work(device->repair_wq, &device->flatten_work, 0);
+            }
+            mutex_unlock(&device->flatten_mutex);
+            if (ret) {
+                scnprintf(result, maxlen, "No flatten running");
+                return ret;
+            }
+        }
+        
+        /* The copy is freed only after it is unpublished under remap_lock */
+        spin_lock_irqsave(&device->remap_lock, flags);
+        f = device->flatten;
+        scnprintf(result, maxlen,
+                  "state=%s device=%s copied_chunks=%lu/%lu dirty_chunks=%lu "
+                  "copied_sectors=%lld copy_errors=%lld rate=%u error=%d",
+                  dm_remap_flatten_state_name(READ_ONCE(device->flatten_state)),
+                  device->flatten_path[0] ? device->flatten_path : "-",
+                  f ? READ_ONCE(f->cursor) : 0UL, f ? f->nr_chunks : 0UL,
+                  f ? dm_remap_flatten_dirty_chunks(f) : 0UL,
+                  f ? (long long)atomic64_read(&f->copied_sectors) : 0LL,
+                  f ? (long long)atomic64_read(&f->copy_errors) : 0LL,
+                  READ_ONCE(device->tunables.flatten_rate),
+                  READ_ONCE(device->flatten_error));
+        spin_unlock_irqrestore(&device->remap_lock, flags);
+        return 0;
+    }
+    
+    /* Forensic command - read-only activation, overlay use and read errors */
+    case DM_REMAP_MSG_FORENSIC: {
+        unsigned int sz;
+        
+        sz = scnprintf(result, maxlen, "mode=%s overlay=%s", device->read_only ? "ro" : "rw",
+                       device->overlay_dev ? device->overlay_path : "none");
+        dm_remap_forensic_format(&device->forensic, result + sz, maxlen - sz);
+        return 0;
+    }
+    
+    /* Grow command - use a spare device that was resized while active */
+    case DM_REMAP_MSG_GROW: {
+        sector_t old_sectors, new_sectors;
+        
+        ret = dm_remap_spare_resize(device, &old_sectors, &new_sectors);
+        if (ret == -EBUSY) {
+            scnprintf(result, maxlen, "%s",
+                      READ_ONCE(device->migration) ? "Spare replacement running" :
+                      "Spare sectors in use beyond the new size");
+            return ret;
+        }
+        scnprintf(result, maxlen, "old_sectors=%llu new_sectors=%llu alloc_limit=%llu%s",
+                  (unsigned long long)old_sectors, (unsigned long long)new_sectors,
+                  (unsigned long long)device->spare_sector_count,
+                  ret ? " (metadata commit failed)" : "");
+        return ret;
+    }
+    }
+    
     /* Unknown command */
     scnprintf(result, maxlen, "Unknown command '%s'. Try 'help'", argv[0]);
     return -EINVAL;
@@ -2476,7 +8532,8 @@ static int dm_remap_message_v4_real(struct dm_target *ti, unsigned argc, char **
 /* Device mapper target structure */
 static struct target_type dm_remap_target_v4_real = {
     .name = "dm-remap-v4",
-    .version = {4, 0, 0},
+    .version = {4, 3, 0},
+    .features = DM_TARGET_ATOMIC_WRITES | DM_TARGET_PASSES_INTEGRITY,
     .module = THIS_MODULE,
     .ctr = dm_remap_ctr_v4_real,
     .dtr = dm_remap_dtr_v4_real,
@@ -2484,7 +8541,12 @@ static struct target_type dm_remap_target_v4_real = {
     .end_io = dm_remap_end_io_v4_real,
     .status = dm_remap_status_v4_real,
     .message = dm_remap_message_v4_real,
-    .presuspend = dm_remap_presuspend_v4_real,  /* CRITICAL FIX: Cancel work before removal */
+    .iterate_devices = dm_remap_iterate_devices_v4_real,
+    .io_hints = dm_remap_io_hints_v4_real,
+    .presuspend = dm_remap_presuspend_v4_real,
+    .postsuspend = dm_remap_postsuspend_v4_real,
+    .preresume = dm_remap_preresume_v4_real,
+    .resume = dm_remap_resume_v4_real,
 };
 
 /**
@@ -2510,6 +8572,9 @@ static int __init dm_remap_init_v4_real(void)
         return -ENOMEM;
     }
     
+    /* v4.3: BPF remap policy hooks (built-in policy if unavailable) */
+    dm_remap_policy_init();
+    
     /* Register device mapper target */
     ret = dm_register_target(&dm_remap_target_v4_real);
     if (ret < 0) {
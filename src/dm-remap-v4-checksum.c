@@ -0,0 +1,291 @@
+/**
+ * dm-remap-v4-checksum.c - Checksums of remapped data (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * An open-addressed table of crc32c records keyed by original sector, the
+ * same layout in memory as on the spare. A sector is looked up with its
+ * spare location too, so a record left behind by an extent that has since
+ * moved is never taken for the current one. All of it is irq-safe and
+ * never allocates once the table exists.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/crc32.h>
+#include <linux/hash.h>
+#include <linux/highmem.h>
+#include <linux/ktime.h>
+#include <linux/string.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+#include <linux/crc32c.h>
+#endif
+
+#include "../include/dm-remap-v4-checksum.h"
+
+#define DM_REMAP_CSUM_SEED         (~0U)
+#define DM_REMAP_CSUM_PER_SECTOR   (SECTOR_SIZE / sizeof(struct dm_remap_v4_csum_record))
+/* Keep probe chains short: refuse new records past three quarters full */
+#define DM_REMAP_CSUM_MAX_USED     (DM_REMAP_V4_CSUM_SLOTS / 4 * 3)
+
+int dm_remap_csum_init(struct dm_remap_csum_table *t)
+{
+    spin_lock_init(&t->lock);
+    t->records = vzalloc(DM_REMAP_V4_CSUM_AREA_SECTORS << SECTOR_SHIFT);
+    if (!t->records)
+        return -ENOMEM;
+    dm_remap_csum_reset(t);
+    dm_remap_csum_stats_reset(t);
+    return 0;
+}
+
+void dm_remap_csum_destroy(struct dm_remap_csum_table *t)
+{
+    vfree(t->records);
+    t->records = NULL;
+}
+
+/**
+ * dm_remap_csum_reset() - Forget every record
+ *
+ * The whole table is marked dirty, so the next write-out clears it on the
+ * spare as well.
+ */
+void dm_remap_csum_reset(struct dm_remap_csum_table *t)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&t->lock, flags);
+    memset(t->records, 0, DM_REMAP_V4_CSUM_AREA_SECTORS << SECTOR_SHIFT);
+    t->used = 0;
+    bitmap_fill(t->dirty, DM_REMAP_V4_CSUM_AREA_SECTORS);
+    spin_unlock_irqrestore(&t->lock, flags);
+}
+
+/* Slot holding @sector, or the free slot where it would go. Caller holds t->lock. */
+static unsigned int dm_remap_csum_slot(struct dm_remap_csum_table *t, sector_t sector)
+{
+    unsigned int slot = hash_64(sector, ilog2(DM_REMAP_V4_CSUM_SLOTS));
+
+    while (t->records[slot].spare_sector && t->records[slot].original_sector != sector)
+        slot = (slot + 1) % DM_REMAP_V4_CSUM_SLOTS;
+    return slot;
+}
+
+/* Store a record; @replace false keeps one already there. Caller holds t->lock. */
+static void dm_remap_csum_store(struct dm_remap_csum_table *t, sector_t sector,
+                                sector_t spare_sector, u32 crc, bool replace)
+{
+    unsigned int slot = dm_remap_csum_slot(t, sector);
+    struct dm_remap_v4_csum_record *rec = &t->records[slot];
+
+    if (rec->spare_sector) {
+        if (!replace)
+            return;
+    } else if (t->used >= DM_REMAP_CSUM_MAX_USED) {
+        atomic64_inc(&t->dropped);
+        return;
+    } else {
+        rec->original_sector = sector;
+        t->used++;
+    }
+    rec->spare_sector = spare_sector;
+    rec->crc = crc;
+    __set_bit(slot / DM_REMAP_CSUM_PER_SECTOR, t->dirty);
+}
+
+/**
+ * dm_remap_csum_load() - Take a record read back from the spare
+ *
+ * Records made since the table was reset win over loaded ones. Returns
+ * false if @rec was not taken.
+ */
+bool dm_remap_csum_load(struct dm_remap_csum_table *t, const struct dm_remap_v4_csum_record *rec)
+{
+    unsigned long flags;
+    unsigned int slot;
+    bool taken = false;
+
+    spin_lock_irqsave(&t->lock, flags);
+    slot = dm_remap_csum_slot(t, rec->original_sector);
+    if (!t->records[slot].spare_sector) {
+        dm_remap_csum_store(t, rec->original_sector, rec->spare_sector, rec->crc, false);
+        taken = t->records[slot].spare_sector;
+    }
+    spin_unlock_irqrestore(&t->lock, flags);
+    return taken;
+}
+
+/**
+ * dm_remap_csum_record_buf() - Record the checksums of @nr sectors in a buffer
+ * @replace: Overwrite existing records; false only fills in missing ones
+ */
+void dm_remap_csum_record_buf(struct dm_remap_csum_table *t, sector_t sector,
+                              sector_t spare_sector, const void *data, unsigned int nr,
+                              bool replace)
+{
+    u64 start = ktime_get_ns();
+    unsigned long flags;
+    unsigned int i;
+    u32 crc;
+
+    for (i = 0; i < nr; i++) {
+        crc = crc32c(DM_REMAP_CSUM_SEED, data + ((size_t)i << SECTOR_SHIFT), SECTOR_SIZE);
+        spin_lock_irqsave(&t->lock, flags);
+        dm_remap_csum_store(t, sector + i, spare_sector + i, crc, replace);
+        spin_unlock_irqrestore(&t->lock, flags);
+    }
+    atomic64_add(nr, &t->recorded);
+    atomic64_add((u64)nr << SECTOR_SHIFT, &t->bytes);
+    atomic64_add(ktime_get_ns() - start, &t->cpu_ns);
+}
+
+/* Check one sector read back. Caller holds t->lock. */
+static bool dm_remap_csum_check(struct dm_remap_csum_table *t, sector_t sector,
+                                sector_t spare_sector, u32 crc)
+{
+    struct dm_remap_v4_csum_record *rec = &t->records[dm_remap_csum_slot(t, sector)];
+
+    if (rec->spare_sector != spare_sector) {
+        atomic64_inc(&t->unchecked);
+        return true;
+    }
+    if (rec->crc != crc) {
+        atomic64_inc(&t->failed);
+        return false;
+    }
+    atomic64_inc(&t->verified);
+    return true;
+}
+
+/**
+ * dm_remap_csum_bio() - Record or check every sector of a completed bio
+ * @iter: The bio's iterator as it was submitted
+ * @sector: Original sector of the first one
+ * @spare_sector: Where it went on the spare
+ * @write: Record the data rather than check it
+ *
+ * Sectors may straddle segments. Returns the number of sectors read back
+ * that did not match their record; 0 for a write.
+ */
+unsigned int dm_remap_csum_bio(struct dm_remap_csum_table *t, struct bio *bio,
+                               struct bvec_iter iter, sector_t sector,
+                               sector_t spare_sector, bool write)
+{
+    unsigned int i = 0, fill = 0, bad = 0, off, n;
+    u32 crc = DM_REMAP_CSUM_SEED;
+    u64 start = ktime_get_ns();
+    struct bvec_iter it;
+    struct bio_vec bv;
+    unsigned long flags;
+    void *p;
+
+    __bio_for_each_segment(bv, bio, it, iter) {
+        p = bvec_kmap_local(&bv);
+        for (off = 0; off < bv.bv_len; off += n) {
+            n = min_t(unsigned int, bv.bv_len - off, SECTOR_SIZE - fill);
+            crc = crc32c(crc, p + off, n);
+            fill += n;
+            if (fill < SECTOR_SIZE)
+                continue;
+
+            spin_lock_irqsave(&t->lock, flags);
+            if (write)
+                dm_remap_csum_store(t, sector + i, spare_sector + i, crc, true);
+            else if (!dm_remap_csum_check(t, sector + i, spare_sector + i, crc))
+                bad++;
+            spin_unlock_irqrestore(&t->lock, flags);
+            i++;
+            fill = 0;
+            crc = DM_REMAP_CSUM_SEED;
+        }
+        kunmap_local(p);
+    }
+
+    if (write)
+        atomic64_add(i, &t->recorded);
+    atomic64_add((u64)i << SECTOR_SHIFT, &t->bytes);
+    atomic64_add(ktime_get_ns() - start, &t->cpu_ns);
+    return bad;
+}
+
+/**
+ * dm_remap_csum_take_dirty() - Copy out the first run of dirty table sectors
+ * @area: Buffer the size of the table; the run lands at its own offset
+ * @first: Set to the first sector of the run
+ *
+ * The run is marked clean; put it back with dm_remap_csum_mark_dirty() if
+ * writing it fails. Returns its length, 0 if nothing is dirty.
+ */
+unsigned int dm_remap_csum_take_dirty(struct dm_remap_csum_table *t, void *area,
+                                      unsigned int *first)
+{
+    unsigned int start, end;
+    unsigned long flags;
+
+    spin_lock_irqsave(&t->lock, flags);
+    start = find_first_bit(t->dirty, DM_REMAP_V4_CSUM_AREA_SECTORS);
+    if (start >= DM_REMAP_V4_CSUM_AREA_SECTORS) {
+        spin_unlock_irqrestore(&t->lock, flags);
+        return 0;
+    }
+    end = find_next_zero_bit(t->dirty, DM_REMAP_V4_CSUM_AREA_SECTORS, start);
+    memcpy(area + ((size_t)start << SECTOR_SHIFT), (void *)t->records + ((size_t)start << SECTOR_SHIFT),
+           (size_t)(end - start) << SECTOR_SHIFT);
+    bitmap_clear(t->dirty, start, end - start);
+    spin_unlock_irqrestore(&t->lock, flags);
+
+    atomic64_inc(&t->area_writes);
+    *first = start;
+    return end - start;
+}
+
+void dm_remap_csum_mark_dirty(struct dm_remap_csum_table *t, unsigned int first,
+                              unsigned int nr)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&t->lock, flags);
+    bitmap_set(t->dirty, first, nr);
+    spin_unlock_irqrestore(&t->lock, flags);
+}
+
+void dm_remap_csum_stats_reset(struct dm_remap_csum_table *t)
+{
+    atomic64_set(&t->recorded, 0);
+    atomic64_set(&t->verified, 0);
+    atomic64_set(&t->failed, 0);
+    atomic64_set(&t->unchecked, 0);
+    atomic64_set(&t->dropped, 0);
+    atomic64_set(&t->area_writes, 0);
+    atomic64_set(&t->bytes, 0);
+    atomic64_set(&t->cpu_ns, 0);
+}
+
+/**
+ * dm_remap_csum_format() - Print the record count and counters
+ *
+ * "records=.. recorded=.. verified=.. failed=.. unchecked=.. dropped=..
+ * area_writes=.. bytes=.. cpu_ns=.. ns_per_kib=..". Returns the number of
+ * characters written.
+ */
+int dm_remap_csum_format(struct dm_remap_csum_table *t, char *buf, size_t len)
+{
+    u64 bytes = atomic64_read(&t->bytes), ns = atomic64_read(&t->cpu_ns);
+
+    return scnprintf(buf, len, "records=%u recorded=%llu verified=%llu failed=%llu "
+                     "unchecked=%llu dropped=%llu area_writes=%llu bytes=%llu cpu_ns=%llu "
+                     "ns_per_kib=%llu",
+                     READ_ONCE(t->used),
+                     (unsigned long long)atomic64_read(&t->recorded),
+                     (unsigned long long)atomic64_read(&t->verified),
+                     (unsigned long long)atomic64_read(&t->failed),
+                     (unsigned long long)atomic64_read(&t->unchecked),
+                     (unsigned long long)atomic64_read(&t->dropped),
+                     (unsigned long long)atomic64_read(&t->area_writes),
+                     (unsigned long long)bytes, (unsigned long long)ns,
+                     (unsigned long long)(bytes >= 1024 ? div64_u64(ns, bytes >> 10) : 0));
+}
@@ -10,6 +10,9 @@
 
 #include <linux/version.h>
 #include <linux/blkdev.h>
+#include <linux/blk-integrity.h>
+#include <linux/device-mapper.h>
+#include <linux/kdev_t.h>
 #include "../include/dm-remap-logging.h"
 
 /* Compatibility wrapper for bdev_name() */
@@ -149,6 +152,81 @@ static inline const char *dm_remap_get_device_name(struct file *bdev_file)
     return dm_remap_bdev_name(bdev);
 }
 
+/*
+ * Describe a device opened with dm_remap_open_bdev_real() as a struct dm_dev
+ * so it can be reported through iterate_devices. Device-mapper core only
+ * looks at ->bdev, ->bdev_file, ->dax_dev and ->name of iterated devices.
+ */
+static inline void dm_remap_fill_dm_dev(struct dm_dev *dd, struct file *bdev_file)
+{
+    memset(dd, 0, sizeof(*dd));
+    
+    if (!bdev_file || IS_ERR(bdev_file)) {
+        return;
+    }
+    
+    dd->bdev_file = bdev_file;
+    dd->bdev = file_bdev(bdev_file);
+    dd->mode = BLK_OPEN_READ | BLK_OPEN_WRITE;
+    format_dev_t(dd->name, dd->bdev->bd_dev);
+}
+
+/*
+ * Atomic writes (REQ_ATOMIC) - DM core stacks atomic_write_* limits only for
+ * targets flagged DM_TARGET_ATOMIC_WRITES (kernel 6.11+). On older kernels
+ * the flag is defined as 0 and no bio is ever atomic.
+ */
+#ifdef DM_TARGET_ATOMIC_WRITES
+static inline bool dm_remap_bio_is_atomic(struct bio *bio)
+{
+    return bio->bi_opf & REQ_ATOMIC;
+}
+#else
+#define DM_TARGET_ATOMIC_WRITES 0
+static inline bool dm_remap_bio_is_atomic(struct bio *bio)
+{
+    return false;
+}
+#endif
+
+/* Check whether a device carries block integrity metadata (T10 PI etc.) */
+static inline bool dm_remap_has_integrity(struct file *bdev_file)
+{
+    if (!bdev_file || IS_ERR(bdev_file)) {
+        return false;
+    }
+    
+    return bdev_get_integrity(file_bdev(bdev_file)) != NULL;
+}
+
+/*
+ * Check that two devices use the same integrity format (or none at all), so
+ * protection information generated for one is valid on the other.
+ */
+static inline bool dm_remap_integrity_compatible(struct file *a, struct file *b)
+{
+#ifdef CONFIG_BLK_DEV_INTEGRITY
+    struct blk_integrity *bi_a, *bi_b;
+    
+    if (!a || IS_ERR(a) || !b || IS_ERR(b)) {
+        return false;
+    }
+    
+    bi_a = bdev_get_integrity(file_bdev(a));
+    bi_b = bdev_get_integrity(file_bdev(b));
+    if (!bi_a || !bi_b) {
+        return !bi_a && !bi_b;
+    }
+    
+    return bi_a->csum_type == bi_b->csum_type &&
+           bi_a->tuple_size == bi_b->tuple_size &&
+           bi_a->interval_exp == bi_b->interval_exp &&
+           bi_a->tag_size == bi_b->tag_size;
+#else
+    return true;
+#endif
+}
+
 /* Compatibility wrapper for device opening (legacy for demo mode) */
 static inline int dm_remap_open_bdev(const char *path, fmode_t mode, void *holder)
 {
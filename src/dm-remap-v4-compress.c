@@ -0,0 +1,290 @@
+/**
+ * dm-remap-v4-compress.c - Compressed remapped data (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * One unit in, one extent out: a struct dm_remap_v4_compress_header and
+ * the compressed bytes, zero-padded to whole sectors. The header names the
+ * unit it was written for and carries a crc32 of the compressed bytes, so
+ * an extent left over from an older unit, or torn by a crash, fails the
+ * read rather than decompressing into wrong data. Buffers are single pages
+ * from vmalloc or kmalloc, as the target's synchronous I/O uses them.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/crc32.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/scatterlist.h>
+#include <linux/sched/mm.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <crypto/acompress.h>
+
+#include "../include/dm-remap-v4-compress.h"
+#include "../include/dm-remap-logging.h"
+
+static const char * const dm_remap_compress_algs[DM_REMAP_COMPRESS_NR_ALGS] = {
+    [DM_REMAP_V4_COMPRESS_LZ4]  = "lz4",
+    [DM_REMAP_V4_COMPRESS_ZSTD] = "zstd",
+};
+
+void dm_remap_compress_init(struct dm_remap_compress *c)
+{
+    mutex_init(&c->lock);
+    memset(c->tfm, 0, sizeof(c->tfm));
+    memset(c->req, 0, sizeof(c->req));
+    dm_remap_compress_stats_reset(c);
+}
+
+void dm_remap_compress_destroy(struct dm_remap_compress *c)
+{
+    unsigned int alg;
+
+    for (alg = 0; alg < DM_REMAP_COMPRESS_NR_ALGS; alg++) {
+        if (c->req[alg])
+            acomp_request_free(c->req[alg]);
+        if (c->tfm[alg])
+            crypto_free_acomp(c->tfm[alg]);
+        c->req[alg] = NULL;
+        c->tfm[alg] = NULL;
+    }
+    mutex_destroy(&c->lock);
+}
+
+const char *dm_remap_compress_alg_name(unsigned int alg)
+{
+    return alg < DM_REMAP_COMPRESS_NR_ALGS && dm_remap_compress_algs[alg] ?
+           dm_remap_compress_algs[alg] : "off";
+}
+
+/*
+ * The transform for @alg, allocated on first use. The caller may be on
+ * the I/O path of a device being reclaimed to, so no allocation may
+ * recurse into the block layer. Caller holds c->lock.
+ */
+static struct acomp_req *dm_remap_compress_req(struct dm_remap_compress *c, unsigned int alg)
+{
+    struct crypto_acomp *tfm;
+    unsigned int noio;
+
+    if (alg >= DM_REMAP_COMPRESS_NR_ALGS || !dm_remap_compress_algs[alg])
+        return ERR_PTR(-EINVAL);
+    if (c->req[alg])
+        return c->req[alg];
+
+    noio = memalloc_noio_save();
+    tfm = crypto_alloc_acomp(dm_remap_compress_algs[alg], 0, 0);
+    if (IS_ERR(tfm)) {
+        memalloc_noio_restore(noio);
+        DMR_WARN("Compression algorithm %s unavailable: %ld",
+                 dm_remap_compress_algs[alg], PTR_ERR(tfm));
+        return ERR_CAST(tfm);
+    }
+    c->req[alg] = acomp_request_alloc(tfm);
+    memalloc_noio_restore(noio);
+    if (!c->req[alg]) {
+        crypto_free_acomp(tfm);
+        return ERR_PTR(-ENOMEM);
+    }
+    c->tfm[alg] = tfm;
+    return c->req[alg];
+}
+
+/**
+ * dm_remap_compress_prepare() - Allocate the transform for @alg now
+ *
+ * So that choosing an algorithm the kernel does not have fails at once
+ * rather than on the first write. Returns 0 or the allocation error.
+ */
+int dm_remap_compress_prepare(struct dm_remap_compress *c, unsigned int alg)
+{
+    struct acomp_req *req;
+
+    mutex_lock(&c->lock);
+    req = dm_remap_compress_req(c, alg);
+    mutex_unlock(&c->lock);
+    return PTR_ERR_OR_ZERO(req);
+}
+
+static struct page *dm_remap_compress_page(const void *buf)
+{
+    return is_vmalloc_addr(buf) ? vmalloc_to_page(buf) : virt_to_page(buf);
+}
+
+/* Run @req from @src to @dst; returns the output length in *@dlen */
+static int dm_remap_compress_run(struct acomp_req *req, bool compress,
+                                 const void *src, unsigned int slen,
+                                 void *dst, unsigned int *dlen)
+{
+    struct scatterlist sg_src, sg_dst;
+    DECLARE_CRYPTO_WAIT(wait);
+    int ret;
+
+    sg_init_table(&sg_src, 1);
+    sg_set_page(&sg_src, dm_remap_compress_page(src), slen, offset_in_page(src));
+    sg_init_table(&sg_dst, 1);
+    sg_set_page(&sg_dst, dm_remap_compress_page(dst), *dlen, offset_in_page(dst));
+
+    acomp_request_set_params(req, &sg_src, &sg_dst, slen, *dlen);
+    acomp_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG, crypto_req_done, &wait);
+    ret = crypto_wait_req(compress ? crypto_acomp_compress(req) :
+                                     crypto_acomp_decompress(req), &wait);
+    if (!ret)
+        *dlen = req->dlen;
+    return ret;
+}
+
+/**
+ * dm_remap_compress_unit() - Compress one unit into a spare extent
+ * @alg: DM_REMAP_V4_COMPRESS_*
+ * @sector: First main device sector of the unit
+ * @src: DM_REMAP_COMPRESS_UNIT_BYTES of data, within one page
+ * @extent: Page-sized buffer, filled with the header and compressed bytes
+ * @nr_sectors: Set to the extent length
+ *
+ * Returns 0, -E2BIG if the unit would take DM_REMAP_V4_COMPRESS_SECTORS
+ * sectors or more (store it as is), or the transform's error.
+ */
+int dm_remap_compress_unit(struct dm_remap_compress *c, unsigned int alg, sector_t sector,
+                           const void *src, void *extent, unsigned int *nr_sectors)
+{
+    struct dm_remap_v4_compress_header *hdr = extent;
+    unsigned int dlen = DM_REMAP_V4_COMPRESS_MAX_BYTES, len;
+    struct acomp_req *req;
+    u64 start;
+    int ret;
+
+    mutex_lock(&c->lock);
+    req = dm_remap_compress_req(c, alg);
+    if (IS_ERR(req)) {
+        mutex_unlock(&c->lock);
+        atomic64_inc(&c->errors);
+        return PTR_ERR(req);
+    }
+
+    start = ktime_get_ns();
+    ret = dm_remap_compress_run(req, true, src, DM_REMAP_COMPRESS_UNIT_BYTES,
+                                extent + sizeof(*hdr), &dlen);
+    atomic64_add(ktime_get_ns() - start, &c->compress_ns);
+    mutex_unlock(&c->lock);
+    atomic64_add(DM_REMAP_COMPRESS_UNIT_BYTES, &c->bytes_in);
+
+    /* Algorithms report a full output buffer differently */
+    if ((ret == -ENOSPC || ret == -E2BIG || ret == -EOVERFLOW) ||
+        (!ret && dlen > DM_REMAP_V4_COMPRESS_MAX_BYTES)) {
+        atomic64_inc(&c->incompressible);
+        return -E2BIG;
+    }
+    if (ret) {
+        atomic64_inc(&c->errors);
+        return ret;
+    }
+
+    hdr->magic = DM_REMAP_V4_COMPRESS_MAGIC;
+    hdr->alg = alg;
+    hdr->reserved = 0;
+    hdr->length = dlen;
+    hdr->original_sector = sector;
+    hdr->crc = crc32(0, extent + sizeof(*hdr), dlen);
+    hdr->reserved2 = 0;
+
+    len = sizeof(*hdr) + dlen;
+    *nr_sectors = DIV_ROUND_UP(len, SECTOR_SIZE);
+    memset(extent + len, 0, ((size_t)*nr_sectors << SECTOR_SHIFT) - len);
+
+    atomic64_inc(&c->units);
+    atomic64_add(dlen, &c->bytes_out);
+    return 0;
+}
+
+/**
+ * dm_remap_decompress_unit() - Read a unit back from its extent
+ * @sector: First main device sector of the unit the extent should hold
+ * @extent: The extent as read from the spare
+ * @nr_sectors: Its length from the remap entry
+ * @dst: DM_REMAP_COMPRESS_UNIT_BYTES, within one page
+ *
+ * Returns 0, or -EIO if the extent is not a valid one for @sector.
+ */
+int dm_remap_decompress_unit(struct dm_remap_compress *c, sector_t sector,
+                             const void *extent, unsigned int nr_sectors, void *dst)
+{
+    const struct dm_remap_v4_compress_header *hdr = extent;
+    unsigned int dlen = DM_REMAP_COMPRESS_UNIT_BYTES;
+    struct acomp_req *req;
+    u64 start;
+    int ret;
+
+    if (hdr->magic != DM_REMAP_V4_COMPRESS_MAGIC || hdr->original_sector != sector ||
+        hdr->length > ((size_t)nr_sectors << SECTOR_SHIFT) - sizeof(*hdr) ||
+        hdr->crc != crc32(0, extent + sizeof(*hdr), hdr->length)) {
+        DMR_WARN("Compressed extent for sector %llu is not valid",
+                 (unsigned long long)sector);
+        atomic64_inc(&c->errors);
+        return -EIO;
+    }
+
+    mutex_lock(&c->lock);
+    req = dm_remap_compress_req(c, hdr->alg);
+    if (IS_ERR(req)) {
+        mutex_unlock(&c->lock);
+        atomic64_inc(&c->errors);
+        return -EIO;
+    }
+
+    start = ktime_get_ns();
+    ret = dm_remap_compress_run(req, false, extent + sizeof(*hdr), hdr->length, dst, &dlen);
+    atomic64_add(ktime_get_ns() - start, &c->decompress_ns);
+    mutex_unlock(&c->lock);
+    if (ret || dlen != DM_REMAP_COMPRESS_UNIT_BYTES) {
+        DMR_WARN("Compressed extent for sector %llu does not decompress: %d",
+                 (unsigned long long)sector, ret);
+        atomic64_inc(&c->errors);
+        return -EIO;
+    }
+
+    atomic64_inc(&c->decompressed);
+    return 0;
+}
+
+void dm_remap_compress_stats_reset(struct dm_remap_compress *c)
+{
+    atomic64_set(&c->units, 0);
+    atomic64_set(&c->incompressible, 0);
+    atomic64_set(&c->bytes_in, 0);
+    atomic64_set(&c->bytes_out, 0);
+    atomic64_set(&c->compress_ns, 0);
+    atomic64_set(&c->decompressed, 0);
+    atomic64_set(&c->decompress_ns, 0);
+    atomic64_set(&c->errors, 0);
+}
+
+/**
+ * dm_remap_compress_format() - Print the counters
+ *
+ * " compressed_units=.. incompressible_units=.. compress_bytes_in=..
+ * compress_bytes_out=.. compress_ns_avg=.. decompressed_units=..
+ * decompress_ns_avg=.. compress_errors=..". Averages are per unit.
+ * Returns the number of characters written.
+ */
+int dm_remap_compress_format(struct dm_remap_compress *c, char *buf, size_t len)
+{
+    u64 tried = atomic64_read(&c->units) + atomic64_read(&c->incompressible);
+    u64 decompressed = atomic64_read(&c->decompressed);
+
+    return scnprintf(buf, len, " compressed_units=%llu incompressible_units=%llu "
+                     "compress_bytes_in=%llu compress_bytes_out=%llu compress_ns_avg=%llu "
+                     "decompressed_units=%llu decompress_ns_avg=%llu compress_errors=%llu",
+                     (unsigned long long)atomic64_read(&c->units),
+                     (unsigned long long)atomic64_read(&c->incompressible),
+                     (unsigned long long)atomic64_read(&c->bytes_in),
+                     (unsigned long long)atomic64_read(&c->bytes_out),
+                     (unsigned long long)(tried ?
+                         div64_u64(atomic64_read(&c->compress_ns), tried) : 0),
+                     (unsigned long long)decompressed,
+                     (unsigned long long)(decompressed ?
+                         div64_u64(atomic64_read(&c->decompress_ns), decompressed) : 0),
+                     (unsigned long long)atomic64_read(&c->errors));
+}
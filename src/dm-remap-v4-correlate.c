@@ -0,0 +1,372 @@
+/**
+ * dm-remap-v4-correlate.c - Error correlation across targets (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * Domains are module-wide, looked up by name and shared by reference
+ * count under a mutex. Errors are noted from bio completion, so a domain's
+ * members and burst state are under a spinlock with interrupts off, and a
+ * target's domain pointer is read under RCU. A burst lasts only while
+ * enough members have failed within the window: every error recounts
+ * them, so one target that keeps failing alone ends it, and a timer,
+ * pushed back by every error of the burst, ends it after a quiet window.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/jiffies.h>
+#include <linux/mutex.h>
+#include <linux/pci.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/timer.h>
+
+#include "../include/dm-remap-v4-correlate.h"
+#include "../include/dm-remap-v4-message.h"
+#include "../include/dm-remap-logging.h"
+
+static unsigned int correlation_window_ms = 1000;
+module_param(correlation_window_ms, uint, 0644);
+MODULE_PARM_DESC(correlation_window_ms, "Window in ms for errors on several targets of an error domain to be correlated (default 1000)");
+
+static unsigned int correlation_targets = 2;
+module_param(correlation_targets, uint, 0644);
+MODULE_PARM_DESC(correlation_targets, "Targets of an error domain failing within the window that make a burst, below 2 = off (default 2)");
+
+/**
+ * struct dm_remap_err_domain - Targets behind one controller
+ * @list: In dm_remap_domains
+ * @users: Member targets, under dm_remap_domains_mutex
+ * @lock: Protects the rest, and the members' error state
+ * @members: struct dm_remap_correlate of each target
+ * @timer: Ends a burst once no error came for a window
+ * @burst: In a burst
+ * @burst_start: jiffies the burst started
+ * @burst_targets: Targets with errors in the burst
+ * @burst_errors: Errors in the burst
+ * @bursts: Bursts since the domain was set up
+ */
+struct dm_remap_err_domain {
+    struct list_head list;
+    unsigned int users;
+    spinlock_t lock;
+    struct list_head members;
+    struct timer_list timer;
+    bool burst;
+    unsigned long burst_start;
+    unsigned int burst_targets;
+    u64 burst_errors;
+    u64 bursts;
+    char name[DM_REMAP_DOMAIN_NAME_LEN];
+};
+
+static LIST_HEAD(dm_remap_domains);
+static DEFINE_MUTEX(dm_remap_domains_mutex);
+
+/* What a burst came to, for the message once it is over */
+struct dm_remap_burst_end {
+    unsigned int targets;
+    unsigned int ms;
+    u64 errors;
+};
+
+static unsigned long dm_remap_correlation_window(void)
+{
+    return msecs_to_jiffies(READ_ONCE(correlation_window_ms));
+}
+
+/* Members that failed within @window of @now. Called with d->lock held */
+static unsigned int dm_remap_domain_recent(struct dm_remap_err_domain *d,
+                                           unsigned long now, unsigned long window)
+{
+    struct dm_remap_correlate *m;
+    unsigned int nr = 0;
+
+    list_for_each_entry(m, &d->members, node)
+        nr += m->erred && now - m->last_error <= window;
+    return nr;
+}
+
+/* Called with d->lock held */
+static void dm_remap_domain_end_burst(struct dm_remap_err_domain *d,
+                                      struct dm_remap_burst_end *end)
+{
+    struct dm_remap_correlate *m;
+
+    d->burst = false;
+    end->targets = d->burst_targets;
+    end->errors = d->burst_errors;
+    end->ms = jiffies_to_msecs(jiffies - d->burst_start);
+    list_for_each_entry(m, &d->members, node)
+        m->in_burst = false;
+}
+
+static void dm_remap_domain_log_end(struct dm_remap_err_domain *d,
+                                    const struct dm_remap_burst_end *end)
+{
+    DMR_WARN("Error burst in domain %s over after %u ms: %llu errors on %u targets",
+             d->name, end->ms, (unsigned long long)end->errors, end->targets);
+}
+
+static void dm_remap_domain_quiet(struct timer_list *t)
+{
+    struct dm_remap_err_domain *d = container_of(t, struct dm_remap_err_domain, timer);
+    unsigned long window = dm_remap_correlation_window(), flags;
+    struct dm_remap_burst_end end;
+
+    spin_lock_irqsave(&d->lock, flags);
+    /* An error of the burst came in and pushed the timer back */
+    if (!d->burst || timer_pending(&d->timer)) {
+        spin_unlock_irqrestore(&d->lock, flags);
+        return;
+    }
+    /* The window was made longer since the timer was set */
+    if (dm_remap_domain_recent(d, jiffies, window) >= max(READ_ONCE(correlation_targets), 2U)) {
+        mod_timer(&d->timer, jiffies + window);
+        spin_unlock_irqrestore(&d->lock, flags);
+        return;
+    }
+    dm_remap_domain_end_burst(d, &end);
+    spin_unlock_irqrestore(&d->lock, flags);
+
+    dm_remap_domain_log_end(d, &end);
+}
+
+/* Called with dm_remap_domains_mutex held */
+static struct dm_remap_err_domain *dm_remap_domain_get(const char *name)
+{
+    struct dm_remap_err_domain *d;
+
+    list_for_each_entry(d, &dm_remap_domains, list) {
+        if (!strcmp(d->name, name)) {
+            d->users++;
+            return d;
+        }
+    }
+
+    d = kzalloc(sizeof(*d), GFP_KERNEL);
+    if (!d)
+        return NULL;
+    spin_lock_init(&d->lock);
+    INIT_LIST_HEAD(&d->members);
+    timer_setup(&d->timer, dm_remap_domain_quiet, 0);
+    strscpy(d->name, name, sizeof(d->name));
+    d->users = 1;
+    list_add_tail(&d->list, &dm_remap_domains);
+    return d;
+}
+
+/* Called with dm_remap_domains_mutex held, after an RCU grace period */
+static void dm_remap_domain_put(struct dm_remap_err_domain *d)
+{
+    if (--d->users)
+        return;
+    list_del(&d->list);
+    timer_delete_sync(&d->timer);
+    kfree(d);
+}
+
+/*
+ * The PCI function (HBA, NVMe controller) above the main device, or its
+ * parent device for other buses, or the disk itself if it has none.
+ */
+static void dm_remap_domain_auto_name(struct block_device *bdev, char *name, size_t len)
+{
+    struct device *dev, *p;
+
+    if (!bdev) {
+        strscpy(name, "none", len);
+        return;
+    }
+
+    dev = disk_to_dev(bdev->bd_disk)->parent;
+    for (p = dev; p; p = p->parent) {
+        if (dev_is_pci(p)) {
+            dev = p;
+            break;
+        }
+    }
+    strscpy(name, dev ? dev_name(dev) : bdev->bd_disk->disk_name, len);
+}
+
+void dm_remap_correlate_init(struct dm_remap_correlate *c)
+{
+    RCU_INIT_POINTER(c->domain, NULL);
+    INIT_LIST_HEAD(&c->node);
+    c->erred = false;
+    c->in_burst = false;
+}
+
+/**
+ * dm_remap_correlate_join() - Move a target to the domain @domain names
+ * @domain: The "error_domain" setting: "" for the controller of @bdev,
+ *          "none" for no domain, or a name
+ *
+ * Leaves the previous domain, if different. Returns 0 or -ENOMEM, with
+ * the target left where it was. Process context.
+ */
+int dm_remap_correlate_join(struct dm_remap_correlate *c, const char *domain,
+                            struct block_device *bdev)
+{
+    struct dm_remap_err_domain *d = NULL, *old;
+    char name[DM_REMAP_DOMAIN_NAME_LEN];
+
+    if (domain[0])
+        strscpy(name, domain, sizeof(name));
+    else
+        dm_remap_domain_auto_name(bdev, name, sizeof(name));
+
+    mutex_lock(&dm_remap_domains_mutex);
+    old = rcu_dereference_protected(c->domain, lockdep_is_held(&dm_remap_domains_mutex));
+    if (old && !strcmp(old->name, name)) {
+        mutex_unlock(&dm_remap_domains_mutex);
+        return 0;
+    }
+    if (strcmp(name, "none")) {
+        d = dm_remap_domain_get(name);
+        if (!d) {
+            mutex_unlock(&dm_remap_domains_mutex);
+            return -ENOMEM;
+        }
+    }
+
+    if (old) {
+        spin_lock_irq(&old->lock);
+        list_del_init(&c->node);
+        spin_unlock_irq(&old->lock);
+        RCU_INIT_POINTER(c->domain, NULL);
+        synchronize_rcu();
+        dm_remap_domain_put(old);
+    }
+
+    c->erred = false;
+    c->in_burst = false;
+    if (d) {
+        spin_lock_irq(&d->lock);
+        list_add_tail(&c->node, &d->members);
+        spin_unlock_irq(&d->lock);
+        rcu_assign_pointer(c->domain, d);
+        DMR_INFO("Correlating errors in domain %s (%u targets)", d->name, d->users);
+    }
+    mutex_unlock(&dm_remap_domains_mutex);
+    return 0;
+}
+
+/**
+ * dm_remap_correlate_leave() - Leave the target's domain
+ *
+ * Also fine on a target in none. Process context.
+ */
+void dm_remap_correlate_leave(struct dm_remap_correlate *c)
+{
+    dm_remap_correlate_join(c, "none", NULL);
+}
+
+/**
+ * dm_remap_correlate_error() - Note a main device error of the target
+ * @started: Set if this error started a burst
+ *
+ * Returns true if the target's domain is in a burst. Any context.
+ */
+bool dm_remap_correlate_error(struct dm_remap_correlate *c, bool *started)
+{
+    unsigned int targets = READ_ONCE(correlation_targets);
+    unsigned long window = dm_remap_correlation_window(), now = jiffies, flags;
+    struct dm_remap_burst_end end;
+    struct dm_remap_err_domain *d;
+    struct dm_remap_correlate *m;
+    bool burst = false, ended = false;
+    unsigned int nr;
+
+    *started = false;
+    rcu_read_lock();
+    d = rcu_dereference(c->domain);
+    if (!d || targets < 2) {
+        rcu_read_unlock();
+        return false;
+    }
+
+    spin_lock_irqsave(&d->lock, flags);
+    c->last_error = now;
+    c->erred = true;
+    nr = dm_remap_domain_recent(d, now, window);
+    if (!d->burst && nr >= targets) {
+        list_for_each_entry(m, &d->members, node)
+            m->in_burst = m->erred && now - m->last_error <= window;
+        d->burst = true;
+        d->burst_start = now;
+        d->burst_targets = nr;
+        d->burst_errors = 0;
+        d->bursts++;
+        *started = true;
+    } else if (d->burst && nr < targets) {
+        /* The others recovered: this target is failing on its own */
+        dm_remap_domain_end_burst(d, &end);
+        ended = true;
+    }
+    if (d->burst) {
+        if (!c->in_burst) {
+            c->in_burst = true;
+            d->burst_targets++;
+        }
+        d->burst_errors++;
+        mod_timer(&d->timer, now + window);
+        burst = true;
+    }
+    spin_unlock_irqrestore(&d->lock, flags);
+
+    if (*started)
+        DMR_WARN("Errors on %u targets of domain %s within %u ms: controller or enclosure "
+                 "fault, not remapping", nr, d->name, jiffies_to_msecs(window));
+    if (ended)
+        dm_remap_domain_log_end(d, &end);
+    rcu_read_unlock();
+    return burst;
+}
+
+/**
+ * dm_remap_correlate_burst() - Whether the target's domain is in a burst
+ */
+bool dm_remap_correlate_burst(struct dm_remap_correlate *c)
+{
+    struct dm_remap_err_domain *d;
+    bool burst;
+
+    rcu_read_lock();
+    d = rcu_dereference(c->domain);
+    burst = d && READ_ONCE(d->burst);
+    rcu_read_unlock();
+    return burst;
+}
+
+/**
+ * dm_remap_correlate_format() - Print the target's domain
+ *
+ * " domain=<name> domain_targets=.. burst=0|1 bursts=..".
+ * Returns the number of characters written.
+ */
+int dm_remap_correlate_format(struct dm_remap_correlate *c, char *buf, size_t len)
+{
+    struct dm_remap_err_domain *d;
+    unsigned int targets = 0;
+    struct dm_remap_correlate *m;
+    unsigned long flags;
+    int sz;
+
+    rcu_read_lock();
+    d = rcu_dereference(c->domain);
+    if (!d) {
+        rcu_read_unlock();
+        return scnprintf(buf, len, " domain=none domain_targets=0 burst=0 bursts=0");
+    }
+    spin_lock_irqsave(&d->lock, flags);
+    list_for_each_entry(m, &d->members, node)
+        targets++;
+    sz = scnprintf(buf, len, " domain=%s domain_targets=%u burst=%d bursts=%llu",
+                   d->name, targets, d->burst, (unsigned long long)d->bursts);
+    spin_unlock_irqrestore(&d->lock, flags);
+    rcu_read_unlock();
+    return sz;
+}
@@ -0,0 +1,92 @@
+/**
+ * dm-remap-v4-events.c - Remap event stream (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * Fixed-size ring of recent remap decisions. Recording is irq-safe and
+ * never allocates, so it can be called from bio completion. Old events are
+ * overwritten; readers notice the gap from the sequence numbers.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/string.h>
+
+#include "../include/dm-remap-v4-events.h"
+
+static const char * const dm_remap_event_names[DM_REMAP_EVENT_MAX] = {
+    [DM_REMAP_EVENT_REMAP] = "remap",
+    [DM_REMAP_EVENT_RETRY] = "retry",
+    [DM_REMAP_EVENT_IGNORE] = "ignore",
+    [DM_REMAP_EVENT_SHADOW_REMAP] = "shadow_remap",
+    [DM_REMAP_EVENT_SHADOW_MIGRATE] = "shadow_migrate",
+    [DM_REMAP_EVENT_SHADOW_PREDICT] = "shadow_predict",
+    [DM_REMAP_EVENT_HUNG] = "hung",
+    [DM_REMAP_EVENT_VERIFY] = "verify",
+    [DM_REMAP_EVENT_CHECKSUM] = "checksum",
+    [DM_REMAP_EVENT_BURST] = "burst",
+};
+
+void dm_remap_event_log_init(struct dm_remap_event_log *log)
+{
+    spin_lock_init(&log->lock);
+    log->next_seq = 1;
+    memset(log->ring, 0, sizeof(log->ring));
+}
+
+void dm_remap_event_record(struct dm_remap_event_log *log, enum dm_remap_event_type type,
+                           u64 sector, u32 nr_sectors)
+{
+    struct dm_remap_event *ev;
+    unsigned long flags;
+
+    spin_lock_irqsave(&log->lock, flags);
+    ev = &log->ring[log->next_seq & (DM_REMAP_EVENT_RING_SIZE - 1)];
+    ev->seq = log->next_seq++;
+    ev->time_ns = ktime_get_real_ns();
+    ev->sector = sector;
+    ev->nr_sectors = nr_sectors;
+    ev->type = type;
+    spin_unlock_irqrestore(&log->lock, flags);
+}
+
+/**
+ * dm_remap_event_format() - Print events newer than @since_seq, oldest first
+ *
+ * One "<seq> <time_ns> <type> <sector>+<nr_sectors>" line per event, as many
+ * as fit in @buf, preceded by "next_seq=<n>" so a reader can poll from there.
+ * Returns the number of characters written.
+ */
+int dm_remap_event_format(struct dm_remap_event_log *log, u64 since_seq,
+                          char *buf, size_t len)
+{
+    struct dm_remap_event ev;
+    unsigned long flags;
+    u64 seq, next_seq, oldest;
+    int n;
+
+    spin_lock_irqsave(&log->lock, flags);
+    next_seq = log->next_seq;
+    spin_unlock_irqrestore(&log->lock, flags);
+
+    oldest = next_seq > DM_REMAP_EVENT_RING_SIZE ? next_seq - DM_REMAP_EVENT_RING_SIZE : 1;
+    n = scnprintf(buf, len, "next_seq=%llu", (unsigned long long)next_seq);
+
+    for (seq = max(since_seq + 1, oldest); seq < next_seq; seq++) {
+        spin_lock_irqsave(&log->lock, flags);
+        ev = log->ring[seq & (DM_REMAP_EVENT_RING_SIZE - 1)];
+        spin_unlock_irqrestore(&log->lock, flags);
+        if (ev.seq != seq)
+            continue;  /* Overwritten while we were printing */
+
+        if (len - n < 64)
+            break;
+        n += scnprintf(buf + n, len - n, "\n%llu %llu %s %llu+%u",
+                       (unsigned long long)ev.seq, (unsigned long long)ev.time_ns,
+                       ev.type < DM_REMAP_EVENT_MAX ? dm_remap_event_names[ev.type] : "?",
+                       (unsigned long long)ev.sector, ev.nr_sectors);
+    }
+
+    return n;
+}
@@ -0,0 +1,182 @@
+/**
+ * dm-remap-v4-flatten.c - Copy engine for flattening onto a new device (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * Sector N of the target is copied to sector N of the new device, from
+ * wherever the target reads it. Only the copy, the first-pass cursor and
+ * the dirty map live here; splitting chunks between the main device and
+ * the spare is done by the core, which owns the remap index.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/bitmap.h>
+#include <linux/blkdev.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+
+#include "../include/dm-remap-v4-flatten.h"
+
+static const char * const dm_remap_flatten_state_names[] = {
+    [DM_REMAP_FLATTEN_IDLE] = "idle",
+    [DM_REMAP_FLATTEN_COPYING] = "copying",
+    [DM_REMAP_FLATTEN_SYNCED] = "synced",
+    [DM_REMAP_FLATTEN_DONE] = "done",
+    [DM_REMAP_FLATTEN_FAILED] = "failed",
+    [DM_REMAP_FLATTEN_CANCELLED] = "cancelled",
+};
+
+const char *dm_remap_flatten_state_name(enum dm_remap_flatten_state state)
+{
+    if (state >= ARRAY_SIZE(dm_remap_flatten_state_names))
+        return "unknown";
+    return dm_remap_flatten_state_names[state];
+}
+
+/**
+ * dm_remap_flatten_init() - Prepare a copy of @nr_sectors to @dst
+ * @start: Sectors already on @dst from an earlier, cleanly stopped copy
+ *
+ * Process context only.
+ */
+int dm_remap_flatten_init(struct dm_remap_flatten *f, struct block_device *dst,
+                          sector_t nr_sectors, sector_t start)
+{
+    memset(f, 0, sizeof(*f));
+
+    f->nr_chunks = DIV_ROUND_UP(nr_sectors, DM_REMAP_FLATTEN_CHUNK_SECTORS);
+    f->dirty = kvcalloc(BITS_TO_LONGS(f->nr_chunks), sizeof(unsigned long), GFP_KERNEL);
+    if (!f->dirty)
+        return -ENOMEM;
+
+    f->kc = dm_kcopyd_client_create(NULL);
+    if (IS_ERR(f->kc)) {
+        int ret = PTR_ERR(f->kc);
+
+        kvfree(f->dirty);
+        f->dirty = NULL;
+        f->kc = NULL;
+        return ret;
+    }
+
+    f->dst = dst;
+    f->nr_sectors = nr_sectors;
+    f->cursor = min_t(unsigned long, start / DM_REMAP_FLATTEN_CHUNK_SECTORS, f->nr_chunks);
+    atomic_set(&f->pending, 0);
+    init_waitqueue_head(&f->wait);
+    atomic64_set(&f->copied_sectors, 0);
+    atomic64_set(&f->copy_errors, 0);
+    return 0;
+}
+
+void dm_remap_flatten_destroy(struct dm_remap_flatten *f)
+{
+    if (f->kc)
+        dm_kcopyd_client_destroy(f->kc);
+    kvfree(f->dirty);
+    f->kc = NULL;
+    f->dirty = NULL;
+}
+
+/**
+ * dm_remap_flatten_mark() - Note that a range of the target changed
+ *
+ * Called after a write has completed or a range was remapped, from any
+ * context. Chunks the first pass has not reached are left to it; the
+ * cursor is moved before a chunk's copy is issued, so a change that misses
+ * it here is read by that copy. Returns true if a chunk became dirty.
+ */
+bool dm_remap_flatten_mark(struct dm_remap_flatten *f, sector_t sector, sector_t nr_sectors)
+{
+    unsigned long chunk, last, cursor;
+    bool marked = false;
+
+    if (!nr_sectors || sector >= f->nr_sectors)
+        return false;
+
+    smp_mb();  /* The change is complete before the cursor is read */
+    cursor = READ_ONCE(f->cursor);
+    last = (min(sector + nr_sectors, f->nr_sectors) - 1) / DM_REMAP_FLATTEN_CHUNK_SECTORS;
+    for (chunk = sector / DM_REMAP_FLATTEN_CHUNK_SECTORS; chunk <= last && chunk < cursor; chunk++)
+        marked |= !test_and_set_bit(chunk, f->dirty);
+    return marked;
+}
+
+unsigned long dm_remap_flatten_dirty_chunks(struct dm_remap_flatten *f)
+{
+    return bitmap_weight(f->dirty, f->nr_chunks);
+}
+
+static void dm_remap_flatten_copy_done(int read_err, unsigned long write_err, void *context)
+{
+    struct dm_remap_flatten *f = context;
+
+    if (read_err || write_err)
+        cmpxchg(&f->error, 0, -EIO);
+    if (atomic_dec_and_test(&f->pending))
+        wake_up(&f->wait);
+}
+
+/**
+ * dm_remap_flatten_copy() - Copy one region to @sector of the new device
+ *
+ * Asynchronous; collect the result with dm_remap_flatten_wait().
+ */
+void dm_remap_flatten_copy(struct dm_remap_flatten *f, struct dm_io_region *from,
+                           sector_t sector)
+{
+    struct dm_io_region to = {
+        .bdev = f->dst,
+        .sector = sector,
+        .count = from->count,
+    };
+
+    atomic_inc(&f->pending);
+    atomic64_add(from->count, &f->copied_sectors);
+    dm_kcopyd_copy(f->kc, from, 1, &to, 0, dm_remap_flatten_copy_done, f);
+}
+
+/**
+ * dm_remap_flatten_zero() - Zero @nr_sectors at @sector of the new device
+ *
+ * For ranges the target serves as zeros without any device holding them.
+ */
+void dm_remap_flatten_zero(struct dm_remap_flatten *f, sector_t sector, sector_t nr_sectors)
+{
+    struct dm_io_region to = {
+        .bdev = f->dst,
+        .sector = sector,
+        .count = nr_sectors,
+    };
+
+    atomic_inc(&f->pending);
+    atomic64_add(nr_sectors, &f->copied_sectors);
+    dm_kcopyd_zero(f->kc, 1, &to, 0, dm_remap_flatten_copy_done, f);
+}
+
+/**
+ * dm_remap_flatten_written() - Account a region the core wrote itself
+ *
+ * For ranges the target has to decompress (v4.3), written synchronously by
+ * the core; the result is collected by dm_remap_flatten_wait() like a
+ * copy's.
+ */
+void dm_remap_flatten_written(struct dm_remap_flatten *f, sector_t nr_sectors, int error)
+{
+    atomic64_add(nr_sectors, &f->copied_sectors);
+    if (error)
+        cmpxchg(&f->error, 0, -EIO);
+}
+
+/**
+ * dm_remap_flatten_wait() - Wait for every copy issued so far
+ *
+ * Returns 0, or -EIO if any of them failed since the last call.
+ */
+int dm_remap_flatten_wait(struct dm_remap_flatten *f)
+{
+    wait_event(f->wait, !atomic_read(&f->pending));
+    return xchg(&f->error, 0);
+}
@@ -0,0 +1,182 @@
+/**
+ * dm-remap-v4-forensic.c - Read-only (forensic) activation (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * Bookkeeping only: the recorded read errors and the map of sectors
+ * written to the overlay. The core does the I/O. Errors are noted from
+ * bio completion, so the extent list is a fixed array under a spinlock
+ * with interrupts off; the map is an xarray with its own locking.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "../include/dm-remap-v4-forensic.h"
+
+int dm_remap_forensic_init(struct dm_remap_forensic *f, sector_t overlay_sectors)
+{
+    memset(f, 0, sizeof(*f));
+    spin_lock_init(&f->lock);
+    xa_init(&f->map);
+    f->nr_sectors = overlay_sectors;
+    f->bad = kcalloc(DM_REMAP_FORENSIC_BAD_EXTENTS, sizeof(*f->bad), GFP_KERNEL);
+    return f->bad ? 0 : -ENOMEM;
+}
+
+void dm_remap_forensic_destroy(struct dm_remap_forensic *f)
+{
+    xa_destroy(&f->map);
+    kfree(f->bad);
+    f->bad = NULL;
+    f->nr_bad = 0;
+}
+
+/**
+ * dm_remap_forensic_note_error() - Record failed main device sectors
+ *
+ * Merged with the extents they overlap or touch. Any context.
+ */
+void dm_remap_forensic_note_error(struct dm_remap_forensic *f, sector_t sector, sector_t nr)
+{
+    sector_t end = sector + nr;
+    unsigned int i = 0, j;
+    unsigned long flags;
+
+    if (!nr || !f->bad)
+        return;
+
+    spin_lock_irqsave(&f->lock, flags);
+    while (i < f->nr_bad && f->bad[i].start + f->bad[i].nr < sector)
+        i++;
+    for (j = i; j < f->nr_bad && f->bad[j].start <= end; j++) {
+        sector = min(sector, f->bad[j].start);
+        end = max(end, f->bad[j].start + f->bad[j].nr);
+    }
+
+    if (j > i) {
+        f->bad[i].start = sector;
+        f->bad[i].nr = end - sector;
+        memmove(&f->bad[i + 1], &f->bad[j], (f->nr_bad - j) * sizeof(*f->bad));
+        f->nr_bad -= j - i - 1;
+    } else if (f->nr_bad < DM_REMAP_FORENSIC_BAD_EXTENTS) {
+        memmove(&f->bad[i + 1], &f->bad[i], (f->nr_bad - i) * sizeof(*f->bad));
+        f->bad[i].start = sector;
+        f->bad[i].nr = nr;
+        f->nr_bad++;
+    } else {
+        f->bad_dropped += nr;
+    }
+    spin_unlock_irqrestore(&f->lock, flags);
+}
+
+/**
+ * dm_remap_overlay_any() - Whether any of @nr sectors from @sector is on the overlay
+ */
+bool dm_remap_overlay_any(struct dm_remap_forensic *f, sector_t sector, sector_t nr)
+{
+    unsigned long index = sector;
+
+    return xa_find(&f->map, &index, sector + nr - 1, XA_PRESENT) != NULL;
+}
+
+/**
+ * dm_remap_overlay_run() - Length of the run at @sector one I/O can serve
+ * @mapped: Set if the run is on the overlay, from *@overlay_sector on
+ *
+ * Either none of the run's sectors is on the overlay, or all are, one
+ * after the other. At most @nr.
+ */
+sector_t dm_remap_overlay_run(struct dm_remap_forensic *f, sector_t sector, sector_t nr,
+                              sector_t *overlay_sector, bool *mapped)
+{
+    void *entry = xa_load(&f->map, sector);
+    sector_t n;
+
+    *mapped = entry != NULL;
+    *overlay_sector = entry ? xa_to_value(entry) : 0;
+    for (n = 1; n < nr; n++) {
+        entry = xa_load(&f->map, sector + n);
+        if (!!entry != *mapped || (entry && xa_to_value(entry) != *overlay_sector + n))
+            break;
+    }
+    return n;
+}
+
+/**
+ * dm_remap_overlay_alloc() - Take @nr overlay sectors
+ *
+ * Space is never given back: a rewrite goes where the sector already is.
+ * Returns -ENOSPC once the overlay is full.
+ */
+int dm_remap_overlay_alloc(struct dm_remap_forensic *f, sector_t nr, sector_t *overlay_sector)
+{
+    unsigned long flags;
+    int ret = 0;
+
+    spin_lock_irqsave(&f->lock, flags);
+    if (nr > f->nr_sectors - f->next) {
+        atomic64_inc(&f->full);
+        ret = -ENOSPC;
+    } else {
+        *overlay_sector = f->next;
+        f->next += nr;
+    }
+    spin_unlock_irqrestore(&f->lock, flags);
+    return ret;
+}
+
+/**
+ * dm_remap_overlay_insert() - Map @nr sectors to the overlay from @overlay_sector
+ *
+ * Called once their data is on the overlay. May sleep.
+ */
+int dm_remap_overlay_insert(struct dm_remap_forensic *f, sector_t sector, sector_t nr,
+                            sector_t overlay_sector)
+{
+    sector_t i;
+    int ret;
+
+    for (i = 0; i < nr; i++) {
+        ret = xa_err(xa_store(&f->map, sector + i, xa_mk_value(overlay_sector + i), GFP_NOIO));
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/**
+ * dm_remap_forensic_format() - Print the overlay counters and read errors
+ *
+ * " overlay_sectors=.. overlay_used=.. overlay_reads=.. overlay_writes=..
+ * overlay_full=.. bad_extents=.. bad_sectors=.. bad_dropped=..", then one
+ * "<start>+<count>" line per recorded extent, as many as fit.
+ * Returns the number of characters written.
+ */
+int dm_remap_forensic_format(struct dm_remap_forensic *f, char *buf, size_t len)
+{
+    unsigned long flags;
+    sector_t bad = 0;
+    unsigned int i;
+    int sz;
+
+    spin_lock_irqsave(&f->lock, flags);
+    for (i = 0; i < f->nr_bad; i++)
+        bad += f->bad[i].nr;
+    sz = scnprintf(buf, len, " overlay_sectors=%llu overlay_used=%llu overlay_reads=%llu "
+                   "overlay_writes=%llu overlay_full=%llu bad_extents=%u bad_sectors=%llu "
+                   "bad_dropped=%llu",
+                   (unsigned long long)f->nr_sectors, (unsigned long long)f->next,
+                   (unsigned long long)atomic64_read(&f->reads),
+                   (unsigned long long)atomic64_read(&f->writes),
+                   (unsigned long long)atomic64_read(&f->full),
+                   f->nr_bad, (unsigned long long)bad, (unsigned long long)f->bad_dropped);
+    for (i = 0; i < f->nr_bad; i++)
+        sz += scnprintf(buf + sz, len - sz, "\n%llu+%llu",
+                        (unsigned long long)f->bad[i].start,
+                        (unsigned long long)f->bad[i].nr);
+    spin_unlock_irqrestore(&f->lock, flags);
+    return sz;
+}
@@ -0,0 +1,185 @@
+/**
+ * dm-remap-v4-freelist.c - Free spare extents (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * A fixed array of extents sorted by start sector. Nothing allocates after
+ * dm_remap_freelist_init(), so every operation is safe under a spinlock
+ * with interrupts off. Extents that cannot be kept are counted in
+ * @dropped, never handed out twice.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "../include/dm-remap-v4-freelist.h"
+
+int dm_remap_freelist_init(struct dm_remap_freelist *fl)
+{
+    memset(fl, 0, sizeof(*fl));
+    fl->ext = kcalloc(DM_REMAP_FREELIST_EXTENTS, sizeof(*fl->ext), GFP_KERNEL);
+    return fl->ext ? 0 : -ENOMEM;
+}
+
+void dm_remap_freelist_destroy(struct dm_remap_freelist *fl)
+{
+    kfree(fl->ext);
+    fl->ext = NULL;
+    fl->nr_ext = 0;
+}
+
+void dm_remap_freelist_reset(struct dm_remap_freelist *fl)
+{
+    fl->nr_ext = 0;
+    fl->sectors = 0;
+    fl->dropped = 0;
+}
+
+static void dm_remap_freelist_insert(struct dm_remap_freelist *fl, unsigned int pos,
+                                     sector_t start, sector_t nr)
+{
+    memmove(&fl->ext[pos + 1], &fl->ext[pos], (fl->nr_ext - pos) * sizeof(*fl->ext));
+    fl->ext[pos].start = start;
+    fl->ext[pos].nr = nr;
+    fl->nr_ext++;
+}
+
+static void dm_remap_freelist_remove(struct dm_remap_freelist *fl, unsigned int pos)
+{
+    fl->nr_ext--;
+    memmove(&fl->ext[pos], &fl->ext[pos + 1], (fl->nr_ext - pos) * sizeof(*fl->ext));
+}
+
+/*
+ * Take @start..@start+@nr out of extent @i, which holds it. If that splits
+ * the extent and there is no slot for the second half, the half after the
+ * cut is dropped.
+ */
+static void dm_remap_freelist_cut(struct dm_remap_freelist *fl, unsigned int i,
+                                  sector_t start, sector_t nr)
+{
+    struct dm_remap_free_extent *e = &fl->ext[i];
+    sector_t head = start - e->start;
+    sector_t tail = e->start + e->nr - (start + nr);
+
+    fl->sectors -= nr;
+    if (head && tail) {
+        e->nr = head;
+        if (fl->nr_ext < DM_REMAP_FREELIST_EXTENTS) {
+            dm_remap_freelist_insert(fl, i + 1, start + nr, tail);
+        } else {
+            fl->sectors -= tail;
+            fl->dropped += tail;
+        }
+    } else if (head) {
+        e->nr = head;
+    } else if (tail) {
+        e->start = start + nr;
+        e->nr = tail;
+    } else {
+        dm_remap_freelist_remove(fl, i);
+    }
+}
+
+/**
+ * dm_remap_freelist_add() - Return an extent, merging it with its neighbours
+ *
+ * The extent must not overlap one already on the list.
+ */
+void dm_remap_freelist_add(struct dm_remap_freelist *fl, sector_t start, sector_t nr)
+{
+    unsigned int pos = 0;
+    bool prev, next;
+
+    if (!nr)
+        return;
+    while (pos < fl->nr_ext && fl->ext[pos].start < start)
+        pos++;
+
+    prev = pos > 0 && fl->ext[pos - 1].start + fl->ext[pos - 1].nr == start;
+    next = pos < fl->nr_ext && start + nr == fl->ext[pos].start;
+    if (prev && next) {
+        fl->ext[pos - 1].nr += nr + fl->ext[pos].nr;
+        dm_remap_freelist_remove(fl, pos);
+    } else if (prev) {
+        fl->ext[pos - 1].nr += nr;
+    } else if (next) {
+        fl->ext[pos].start = start;
+        fl->ext[pos].nr += nr;
+    } else if (fl->nr_ext < DM_REMAP_FREELIST_EXTENTS) {
+        dm_remap_freelist_insert(fl, pos, start, nr);
+    } else {
+        fl->dropped += nr;
+        return;
+    }
+    fl->sectors += nr;
+}
+
+/**
+ * dm_remap_freelist_take() - Allocate @nr sectors aligned to @align
+ * @align: Power of two
+ *
+ * First fit, lowest sectors first. Returns false if no extent can hold it.
+ */
+bool dm_remap_freelist_take(struct dm_remap_freelist *fl, sector_t nr, sector_t align,
+                            sector_t *start)
+{
+    struct dm_remap_free_extent *e;
+    unsigned int i;
+    sector_t s;
+
+    for (i = 0; i < fl->nr_ext; i++) {
+        e = &fl->ext[i];
+        s = ALIGN(e->start, align);
+        if (s + nr > e->start + e->nr)
+            continue;
+        /* Splitting a full list would drop the rest; try further on */
+        if (s > e->start && s + nr < e->start + e->nr &&
+            fl->nr_ext == DM_REMAP_FREELIST_EXTENTS)
+            continue;
+        dm_remap_freelist_cut(fl, i, s, nr);
+        *start = s;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * dm_remap_freelist_claim() - Remove whatever part of a range is on the list
+ *
+ * For space taken by other means, and to forget everything past a new end
+ * of the spare data area.
+ */
+void dm_remap_freelist_claim(struct dm_remap_freelist *fl, sector_t start, sector_t nr)
+{
+    sector_t end = start + nr, lo, hi;
+    unsigned int i = 0, before;
+
+    while (i < fl->nr_ext) {
+        lo = max(fl->ext[i].start, start);
+        hi = min(fl->ext[i].start + fl->ext[i].nr, end);
+        if (lo >= hi) {
+            i++;
+            continue;
+        }
+        before = fl->nr_ext;
+        dm_remap_freelist_cut(fl, i, lo, hi - lo);
+        if (fl->nr_ext >= before)
+            i++;
+    }
+}
+
+/**
+ * dm_remap_freelist_splice() - Move every extent of @from to @to
+ */
+void dm_remap_freelist_splice(struct dm_remap_freelist *to, struct dm_remap_freelist *from)
+{
+    unsigned int i;
+
+    for (i = 0; i < from->nr_ext; i++)
+        dm_remap_freelist_add(to, from->ext[i].start, from->ext[i].nr);
+    to->dropped += from->dropped;
+    dm_remap_freelist_reset(from);
+}
@@ -0,0 +1,171 @@
+/**
+ * dm-remap-v4-ioclass.c - cgroup and I/O priority of the target's own I/O (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * Cgroup paths are looked up when a setting changes, not per I/O: a
+ * source holds a reference on the io controller state of its cgroup
+ * (of the nearest ancestor with the controller, should the cgroup not
+ * have it). A cgroup removed later stays usable until the setting is
+ * changed or the target goes away.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/blk-cgroup.h>
+#include <linux/cgroup.h>
+#include <linux/iocontext.h>
+#include <linux/ioprio.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+
+#include "../include/dm-remap-v4-ioclass.h"
+#include "../include/dm-remap-logging.h"
+
+void dm_remap_ioclass_init(struct dm_remap_ioclass *ioc)
+{
+    BUILD_BUG_ON(DM_REMAP_IOPRIO(DM_REMAP_IOPRIO_BE, 3) !=
+                 IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 3));
+    BUILD_BUG_ON(DM_REMAP_IOPRIO(DM_REMAP_IOPRIO_IDLE, 0) !=
+                 IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0));
+
+    spin_lock_init(&ioc->lock);
+    memset(ioc->css, 0, sizeof(ioc->css));
+    memset(ioc->ioprio, 0, sizeof(ioc->ioprio));
+}
+
+/* The io controller state charged for @path, with a reference */
+static struct cgroup_subsys_state *dm_remap_ioclass_css(const char *path)
+{
+#ifdef CONFIG_BLK_CGROUP
+    struct cgroup_subsys_state *css;
+    struct cgroup *cgrp;
+
+    cgrp = cgroup_get_from_path(path);
+    if (IS_ERR(cgrp))
+        return ERR_CAST(cgrp);
+    css = cgroup_get_e_css(cgrp, &io_cgrp_subsys);
+    cgroup_put(cgrp);
+    return css;
+#else
+    return ERR_PTR(-EOPNOTSUPP);
+#endif
+}
+
+/**
+ * dm_remap_ioclass_set() - Take the cgroups and priorities of @tunables
+ *
+ * All paths are looked up before anything changes. Returns 0, or -ESRCH
+ * if a path names no cgroup (or the kernel has no io controller), with
+ * the previous settings kept. Process context.
+ */
+int dm_remap_ioclass_set(struct dm_remap_ioclass *ioc, const struct dm_remap_tunables *tunables)
+{
+    struct cgroup_subsys_state *css[DM_REMAP_NR_IO_SOURCES] = { NULL };
+    unsigned int source;
+
+    for (source = 0; source < DM_REMAP_NR_IO_SOURCES; source++) {
+        if (!tunables->cgroup[source][0])
+            continue;
+        css[source] = dm_remap_ioclass_css(tunables->cgroup[source]);
+        if (IS_ERR(css[source])) {
+            DMR_WARN("No cgroup %s for %s I/O: %ld", tunables->cgroup[source],
+                     dm_remap_io_source_name(source), PTR_ERR(css[source]));
+            css[source] = NULL;
+            while (source--)
+                if (css[source])
+                    css_put(css[source]);
+            return -ESRCH;
+        }
+    }
+
+    spin_lock(&ioc->lock);
+    for (source = 0; source < DM_REMAP_NR_IO_SOURCES; source++) {
+        swap(ioc->css[source], css[source]);
+        ioc->ioprio[source] = tunables->ioprio[source];
+    }
+    spin_unlock(&ioc->lock);
+
+    for (source = 0; source < DM_REMAP_NR_IO_SOURCES; source++)
+        if (css[source])
+            css_put(css[source]);
+    return 0;
+}
+
+/**
+ * dm_remap_ioclass_destroy() - Drop the cgroup references
+ *
+ * Also fine on a zeroed or merely initialised @ioc.
+ */
+void dm_remap_ioclass_destroy(struct dm_remap_ioclass *ioc)
+{
+    unsigned int source;
+
+    for (source = 0; source < DM_REMAP_NR_IO_SOURCES; source++) {
+        if (ioc->css[source])
+            css_put(ioc->css[source]);
+        ioc->css[source] = NULL;
+    }
+}
+
+static void dm_remap_io_scope_begin(struct dm_remap_io_scope *scope,
+                                    struct cgroup_subsys_state *css, u16 ioprio)
+{
+    memset(scope, 0, sizeof(*scope));
+    if (!(current->flags & PF_KTHREAD))
+        return;
+    scope->active = true;
+
+    if (css) {
+        kthread_associate_blkcg(css);
+        scope->css = true;
+    }
+    if (ioprio) {
+        scope->old_prio = current->io_context ? current->io_context->ioprio : 0;
+        scope->prio = !set_task_ioprio(current, ioprio);
+    }
+}
+
+/**
+ * dm_remap_io_enter() - Charge what this thread submits to @source
+ *
+ * Until dm_remap_io_leave(). Scopes do not nest. Process context.
+ */
+void dm_remap_io_enter(struct dm_remap_ioclass *ioc, unsigned int source,
+                       struct dm_remap_io_scope *scope)
+{
+    struct cgroup_subsys_state *css;
+    u16 ioprio;
+
+    spin_lock(&ioc->lock);
+    css = ioc->css[source];
+    if (css)
+        css_get(css);
+    ioprio = ioc->ioprio[source];
+    spin_unlock(&ioc->lock);
+
+    dm_remap_io_scope_begin(scope, css, ioprio);
+    if (css)
+        css_put(css);
+}
+
+/**
+ * dm_remap_io_enter_bio() - Charge what this thread submits like @bio
+ *
+ * To its cgroup, at its priority, for I/O done on its behalf.
+ */
+void dm_remap_io_enter_bio(struct bio *bio, struct dm_remap_io_scope *scope)
+{
+    dm_remap_io_scope_begin(scope, bio_blkcg_css(bio), bio->bi_ioprio);
+}
+
+void dm_remap_io_leave(struct dm_remap_io_scope *scope)
+{
+    if (!scope->active)
+        return;
+    if (scope->prio)
+        set_task_ioprio(current, scope->old_prio);
+    if (scope->css)
+        kthread_associate_blkcg(NULL);
+}
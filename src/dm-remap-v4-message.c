@@ -0,0 +1,776 @@
+/**
+ * dm-remap-v4-message.c - Table and message argument parsing (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * Everything here is pure string handling with no device state, so the
+ * same file is compiled into the fuzz harness in tests/fuzz.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/ctype.h>
+#include <linux/kstrtox.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+
+#include "../include/dm-remap-v4-message.h"
+#include "../include/dm-remap-v4-policy.h"
+
+struct dm_remap_msg_spec {
+    const char *name;
+    enum dm_remap_msg_cmd cmd;
+    unsigned int min_args;       /* Not counting the command itself */
+    unsigned int max_args;
+    const char *usage;
+};
+
+static const struct dm_remap_msg_spec dm_remap_msg_specs[] = {
+    { "help",        DM_REMAP_MSG_HELP,        0, 0, "help" },
+    { "status",      DM_REMAP_MSG_STATUS,      0, 0, "status" },
+    { "stats",       DM_REMAP_MSG_STATS,       0, 0, "stats" },
+    { "clear_stats", DM_REMAP_MSG_CLEAR_STATS, 0, 0, "clear_stats" },
+    { "health",      DM_REMAP_MSG_HEALTH,      0, 0, "health" },
+    { "cache_stats", DM_REMAP_MSG_CACHE_STATS, 0, 0, "cache_stats" },
+    { "policy",      DM_REMAP_MSG_POLICY,      0, 0, "policy" },
+    { "shadow",      DM_REMAP_MSG_SHADOW,      0, UINT_MAX,
+      "Usage: shadow [set <key=value>... | reset | off]" },
+    { "events",      DM_REMAP_MSG_EVENTS,      0, 1, "Usage: events [<since_seq>]" },
+    { "test_remap",  DM_REMAP_MSG_TEST_REMAP,  2, 2,
+      "Usage: test_remap <bad_sector> <spare_sector>" },
+    { "set",         DM_REMAP_MSG_SET,         0, 2,
+      "Usage: set [<key> <value>] (scan_interval, cache_size, commit_policy, remap_granularity, "
+      "media_errors, transport_errors, resource_errors, unsupported_errors, other_errors, "
+      "retry_limit, shrink_policy, hung_timeout, salvage_retries, salvage_sectors, "
+      "write_verify, verify_window, data_checksums, flatten_rate, compress, "
+      "<source>_ioprio, <source>_cgroup for metadata, repair, copy, "
+      "correlated_errors, error_domain)" },
+    { "replace_spare", DM_REMAP_MSG_REPLACE_SPARE, 0, 1,
+      "Usage: replace_spare [<new_spare_device> | cancel]" },
+    { "grow",        DM_REMAP_MSG_GROW,        0, 0, "grow" },
+    { "errors",      DM_REMAP_MSG_ERRORS,      0, 0, "errors" },
+    { "inject_error", DM_REMAP_MSG_INJECT_ERROR, 1, 2,
+      "Usage: inject_error <status> [<count>]" },
+    { "pipeline",    DM_REMAP_MSG_PIPELINE,    0, 0, "pipeline" },
+    { "hung",        DM_REMAP_MSG_HUNG,        0, 0, "hung" },
+    { "checksums",   DM_REMAP_MSG_CHECKSUMS,   0, 0, "checksums" },
+    { "flatten",     DM_REMAP_MSG_FLATTEN,     0, 1,
+      "Usage: flatten [<replacement_device> | cancel]" },
+    { "forensic",    DM_REMAP_MSG_FORENSIC,    0, 0, "forensic" },
+};
+
+static const char * const dm_remap_commit_policy_names[] = {
+    [DM_REMAP_COMMIT_ASYNC] = "async",
+    [DM_REMAP_COMMIT_SYNC]  = "sync",
+};
+
+static const char * const dm_remap_shrink_policy_names[] = {
+    [DM_REMAP_SHRINK_REFUSE] = "refuse",
+    [DM_REMAP_SHRINK_DROP]   = "drop",
+};
+
+static const char * const dm_remap_write_verify_names[] = {
+    [DM_REMAP_VERIFY_OFF]      = "off",
+    [DM_REMAP_VERIFY_REMAPPED] = "remapped",
+    [DM_REMAP_VERIFY_ERRORS]   = "errors",
+    [DM_REMAP_VERIFY_ALL]      = "all",
+};
+
+static const char * const dm_remap_data_checksums_names[] = {
+    [0] = "off",
+    [1] = "on",
+};
+
+static const char * const dm_remap_compress_names[] = {
+    [DM_REMAP_COMPRESS_OFF]  = "off",
+    [DM_REMAP_COMPRESS_LZ4]  = "lz4",
+    [DM_REMAP_COMPRESS_ZSTD] = "zstd",
+};
+
+static const char * const dm_remap_error_class_names[] = {
+    [DM_REMAP_ERR_MEDIA]       = "media",
+    [DM_REMAP_ERR_TRANSPORT]   = "transport",
+    [DM_REMAP_ERR_RESOURCE]    = "resource",
+    [DM_REMAP_ERR_UNSUPPORTED] = "unsupported",
+    [DM_REMAP_ERR_OTHER]       = "other",
+};
+
+/* Setting keys, by class */
+static const char * const dm_remap_error_class_keys[] = {
+    [DM_REMAP_ERR_MEDIA]       = "media_errors",
+    [DM_REMAP_ERR_TRANSPORT]   = "transport_errors",
+    [DM_REMAP_ERR_RESOURCE]    = "resource_errors",
+    [DM_REMAP_ERR_UNSUPPORTED] = "unsupported_errors",
+    [DM_REMAP_ERR_OTHER]       = "other_errors",
+};
+
+static const char * const dm_remap_error_action_names[] = {
+    [DM_REMAP_ACT_REMAP] = "remap",
+    [DM_REMAP_ACT_RETRY] = "retry",
+    [DM_REMAP_ACT_PASS]  = "pass",
+    [DM_REMAP_ACT_COUNT] = "count",
+};
+
+/* Default action by class */
+static const u32 dm_remap_default_error_action[] = {
+    [DM_REMAP_ERR_MEDIA]       = DM_REMAP_ACT_REMAP,
+    [DM_REMAP_ERR_TRANSPORT]   = DM_REMAP_ACT_RETRY,
+    [DM_REMAP_ERR_RESOURCE]    = DM_REMAP_ACT_RETRY,
+    [DM_REMAP_ERR_UNSUPPORTED] = DM_REMAP_ACT_PASS,
+    [DM_REMAP_ERR_OTHER]       = DM_REMAP_ACT_PASS,
+};
+
+static const char * const dm_remap_io_source_names[] = {
+    [DM_REMAP_IOS_METADATA] = "metadata",
+    [DM_REMAP_IOS_REPAIR]   = "repair",
+    [DM_REMAP_IOS_COPY]     = "copy",
+};
+
+/* Setting keys, by source */
+static const char * const dm_remap_ioprio_keys[] = {
+    [DM_REMAP_IOS_METADATA] = "metadata_ioprio",
+    [DM_REMAP_IOS_REPAIR]   = "repair_ioprio",
+    [DM_REMAP_IOS_COPY]     = "copy_ioprio",
+};
+
+static const char * const dm_remap_cgroup_keys[] = {
+    [DM_REMAP_IOS_METADATA] = "metadata_cgroup",
+    [DM_REMAP_IOS_REPAIR]   = "repair_cgroup",
+    [DM_REMAP_IOS_COPY]     = "copy_cgroup",
+};
+
+/* Default priority by source: commits ahead of user I/O, repair when idle */
+static const u32 dm_remap_default_ioprio[] = {
+    [DM_REMAP_IOS_METADATA] = DM_REMAP_IOPRIO(DM_REMAP_IOPRIO_BE, 0),
+    [DM_REMAP_IOS_REPAIR]   = DM_REMAP_IOPRIO(DM_REMAP_IOPRIO_IDLE, 0),
+    [DM_REMAP_IOS_COPY]     = DM_REMAP_IOPRIO(DM_REMAP_IOPRIO_BE, 7),
+};
+
+/**
+ * dm_remap_error_class_name() - Name of an enum dm_remap_error_class
+ */
+const char *dm_remap_error_class_name(unsigned int class)
+{
+    return class < ARRAY_SIZE(dm_remap_error_class_names) ?
+           dm_remap_error_class_names[class] : "?";
+}
+
+static const char *dm_remap_error_action_name(u32 action)
+{
+    return action < ARRAY_SIZE(dm_remap_error_action_names) ?
+           dm_remap_error_action_names[action] : "?";
+}
+
+/**
+ * dm_remap_io_source_name() - Name of an enum dm_remap_io_source
+ */
+const char *dm_remap_io_source_name(unsigned int source)
+{
+    return source < ARRAY_SIZE(dm_remap_io_source_names) ?
+           dm_remap_io_source_names[source] : "?";
+}
+
+/* "none", "idle", "rt:<level>" or "be:<level>" */
+static int dm_remap_ioprio_parse(const char *value, u32 *ioprio)
+{
+    unsigned int class, level;
+
+    if (!strcasecmp(value, "none")) {
+        *ioprio = 0;
+        return 0;
+    }
+    if (!strcasecmp(value, "idle")) {
+        *ioprio = DM_REMAP_IOPRIO(DM_REMAP_IOPRIO_IDLE, 0);
+        return 0;
+    }
+    if (!strncasecmp(value, "rt:", 3))
+        class = DM_REMAP_IOPRIO_RT;
+    else if (!strncasecmp(value, "be:", 3))
+        class = DM_REMAP_IOPRIO_BE;
+    else
+        return -EINVAL;
+    if (kstrtouint(value + 3, 10, &level) || level >= DM_REMAP_IOPRIO_LEVELS)
+        return -EINVAL;
+    *ioprio = DM_REMAP_IOPRIO(class, level);
+    return 0;
+}
+
+static const char *dm_remap_ioprio_name(u32 ioprio, char *buf, size_t len)
+{
+    unsigned int level = ioprio & (DM_REMAP_IOPRIO_LEVELS - 1);
+
+    switch (ioprio >> DM_REMAP_IOPRIO_CLASS_SHIFT) {
+    case DM_REMAP_IOPRIO_NONE:
+        return "none";
+    case DM_REMAP_IOPRIO_IDLE:
+        return "idle";
+    case DM_REMAP_IOPRIO_RT:
+        scnprintf(buf, len, "rt:%u", level);
+        return buf;
+    case DM_REMAP_IOPRIO_BE:
+        scnprintf(buf, len, "be:%u", level);
+        return buf;
+    }
+    return "?";
+}
+
+/*
+ * "none", or an absolute path below the cgroup v2 mount. No backslashes,
+ * which dm_split_args() would take as escapes when the table is reloaded.
+ */
+static int dm_remap_cgroup_parse(const char *value, char *cgroup)
+{
+    size_t len = strlen(value);
+
+    if (!strcasecmp(value, "none")) {
+        memset(cgroup, 0, DM_REMAP_CGROUP_PATH_LEN);
+        return 0;
+    }
+    if (value[0] != '/' || len >= DM_REMAP_CGROUP_PATH_LEN || strchr(value, '\\'))
+        return -EINVAL;
+    memset(cgroup, 0, DM_REMAP_CGROUP_PATH_LEN);
+    memcpy(cgroup, value, len);
+    return 0;
+}
+
+/*
+ * "auto", or a name of letters, digits and "-_.:" shared by the targets
+ * to correlate. "none" is kept as a name; the core takes it as no domain.
+ */
+static int dm_remap_domain_parse(const char *value, char *domain)
+{
+    size_t len = strlen(value), i;
+
+    if (!strcasecmp(value, "auto")) {
+        memset(domain, 0, DM_REMAP_DOMAIN_NAME_LEN);
+        return 0;
+    }
+    if (!len || len >= DM_REMAP_DOMAIN_NAME_LEN)
+        return -EINVAL;
+    for (i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)value[i]) && !strchr("-_.:", value[i]))
+            return -EINVAL;
+    }
+    memset(domain, 0, DM_REMAP_DOMAIN_NAME_LEN);
+    memcpy(domain, value, len);
+    return 0;
+}
+
+static int dm_remap_parse_shadow(unsigned int argc, char **argv, struct dm_remap_msg *msg)
+{
+    if (!argc) {
+        msg->op = DM_REMAP_MSG_SHADOW_SHOW;
+        return 0;
+    }
+
+    if (!strcasecmp(argv[0], "set")) {
+        msg->op = DM_REMAP_MSG_SHADOW_SET;
+        msg->argc = argc - 1;
+        msg->argv = argv + 1;
+        return 0;
+    }
+    if (argc == 1 && !strcasecmp(argv[0], "reset")) {
+        msg->op = DM_REMAP_MSG_SHADOW_RESET;
+        return 0;
+    }
+    if (argc == 1 && !strcasecmp(argv[0], "off")) {
+        msg->op = DM_REMAP_MSG_SHADOW_OFF;
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
+/**
+ * dm_remap_message_parse() - Parse "dmsetup message" arguments
+ *
+ * Returns 0, or -EINVAL with msg->error set to a usage line (or NULL for an
+ * unknown command).
+ */
+int dm_remap_message_parse(unsigned int argc, char **argv, struct dm_remap_msg *msg)
+{
+    const struct dm_remap_msg_spec *spec = NULL;
+    unsigned int i, nargs;
+
+    memset(msg, 0, sizeof(*msg));
+    if (argc < 1 || !argv[0])
+        return -EINVAL;
+
+    for (i = 0; i < ARRAY_SIZE(dm_remap_msg_specs); i++) {
+        if (!strcasecmp(argv[0], dm_remap_msg_specs[i].name)) {
+            spec = &dm_remap_msg_specs[i];
+            break;
+        }
+    }
+    if (!spec)
+        return -EINVAL;
+
+    msg->cmd = spec->cmd;
+    msg->error = spec->usage;
+    nargs = argc - 1;
+    if (nargs < spec->min_args || nargs > spec->max_args)
+        return -EINVAL;
+
+    switch (spec->cmd) {
+    case DM_REMAP_MSG_SHADOW:
+        return dm_remap_parse_shadow(nargs, argv + 1, msg);
+    case DM_REMAP_MSG_EVENTS:
+    case DM_REMAP_MSG_TEST_REMAP:
+        for (i = 0; i < nargs; i++) {
+            if (kstrtou64(argv[i + 1], 0, &msg->arg[i]))
+                return -EINVAL;
+        }
+        return 0;
+    case DM_REMAP_MSG_SET:
+        if (nargs == 1)
+            return -EINVAL;
+        msg->argc = nargs;
+        msg->argv = argv + 1;
+        return 0;
+    case DM_REMAP_MSG_INJECT_ERROR:
+        if (!*argv[1])
+            return -EINVAL;
+        msg->arg[0] = 1;
+        if (nargs == 2 && kstrtou64(argv[2], 0, &msg->arg[0]))
+            return -EINVAL;
+        msg->argc = 1;
+        msg->argv = argv + 1;
+        return 0;
+    case DM_REMAP_MSG_REPLACE_SPARE:
+        if (!nargs)
+            msg->op = DM_REMAP_MSG_REPLACE_SHOW;
+        else if (!strcasecmp(argv[1], "cancel"))
+            msg->op = DM_REMAP_MSG_REPLACE_CANCEL;
+        else if (*argv[1])
+            msg->op = DM_REMAP_MSG_REPLACE_START;
+        else
+            return -EINVAL;
+        msg->argc = nargs;
+        msg->argv = argv + 1;
+        return 0;
+    case DM_REMAP_MSG_FLATTEN:
+        if (!nargs)
+            msg->op = DM_REMAP_MSG_FLATTEN_SHOW;
+        else if (!strcasecmp(argv[1], "cancel"))
+            msg->op = DM_REMAP_MSG_FLATTEN_CANCEL;
+        else if (*argv[1])
+            msg->op = DM_REMAP_MSG_FLATTEN_START;
+        else
+            return -EINVAL;
+        msg->argc = nargs;
+        msg->argv = argv + 1;
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * dm_remap_tunables_init() - Settings of a device with no feature arguments
+ */
+void dm_remap_tunables_init(struct dm_remap_tunables *tunables)
+{
+    tunables->scan_interval = DM_REMAP_DEFAULT_SCAN_INTERVAL;
+    tunables->cache_size = DM_REMAP_DEFAULT_CACHE_SIZE;
+    tunables->commit_policy = DM_REMAP_COMMIT_ASYNC;
+    tunables->remap_granularity = 0;
+    memcpy(tunables->error_action, dm_remap_default_error_action,
+           sizeof(tunables->error_action));
+    tunables->retry_limit = DM_REMAP_DEFAULT_RETRY_LIMIT;
+    tunables->shrink_policy = DM_REMAP_SHRINK_REFUSE;
+    tunables->hung_timeout = DM_REMAP_DEFAULT_HUNG_TIMEOUT;
+    tunables->salvage_retries = DM_REMAP_DEFAULT_SALVAGE_RETRIES;
+    tunables->salvage_sectors = 0;
+    tunables->write_verify = DM_REMAP_VERIFY_OFF;
+    tunables->verify_window = DM_REMAP_DEFAULT_VERIFY_WINDOW;
+    tunables->data_checksums = 0;
+    tunables->flatten_rate = 0;
+    tunables->compress = DM_REMAP_COMPRESS_OFF;
+    memcpy(tunables->ioprio, dm_remap_default_ioprio, sizeof(tunables->ioprio));
+    memset(tunables->cgroup, 0, sizeof(tunables->cgroup));
+    tunables->correlated_action = DM_REMAP_ACT_RETRY;
+    memset(tunables->error_domain, 0, sizeof(tunables->error_domain));
+}
+
+/**
+ * dm_remap_tunable_set() - Validate and store one setting
+ *
+ * Returns -EINVAL for an unknown key or a value out of range, leaving
+ * @tunables unchanged.
+ */
+int dm_remap_tunable_set(struct dm_remap_tunables *tunables,
+                         const char *key, const char *value)
+{
+    unsigned int class, source;
+    u32 v;
+
+    for (class = 0; class < DM_REMAP_NR_ERROR_CLASSES; class++) {
+        if (strcasecmp(key, dm_remap_error_class_keys[class]))
+            continue;
+        for (v = 0; v < ARRAY_SIZE(dm_remap_error_action_names); v++) {
+            if (!strcasecmp(value, dm_remap_error_action_names[v])) {
+                tunables->error_action[class] = v;
+                return 0;
+            }
+        }
+        return -EINVAL;
+    }
+
+    /* v4.3: Correlation of errors across targets */
+    if (!strcasecmp(key, "correlated_errors")) {
+        for (v = 0; v < ARRAY_SIZE(dm_remap_error_action_names); v++) {
+            if (!strcasecmp(value, dm_remap_error_action_names[v])) {
+                tunables->correlated_action = v;
+                return 0;
+            }
+        }
+        return -EINVAL;
+    }
+    if (!strcasecmp(key, "error_domain"))
+        return dm_remap_domain_parse(value, tunables->error_domain);
+
+    /* v4.3: Attribution of the target's own I/O */
+    for (source = 0; source < DM_REMAP_NR_IO_SOURCES; source++) {
+        if (!strcasecmp(key, dm_remap_ioprio_keys[source]))
+            return dm_remap_ioprio_parse(value, &tunables->ioprio[source]);
+        if (!strcasecmp(key, dm_remap_cgroup_keys[source]))
+            return dm_remap_cgroup_parse(value, tunables->cgroup[source]);
+    }
+
+    if (!strcasecmp(key, "commit_policy")) {
+        for (v = 0; v < ARRAY_SIZE(dm_remap_commit_policy_names); v++) {
+            if (!strcasecmp(value, dm_remap_commit_policy_names[v])) {
+                tunables->commit_policy = v;
+                return 0;
+            }
+        }
+        return -EINVAL;
+    }
+
+    if (!strcasecmp(key, "shrink_policy")) {
+        for (v = 0; v < ARRAY_SIZE(dm_remap_shrink_policy_names); v++) {
+            if (!strcasecmp(value, dm_remap_shrink_policy_names[v])) {
+                tunables->shrink_policy = v;
+                return 0;
+            }
+        }
+        return -EINVAL;
+    }
+
+    if (!strcasecmp(key, "write_verify")) {
+        for (v = 0; v < ARRAY_SIZE(dm_remap_write_verify_names); v++) {
+            if (!strcasecmp(value, dm_remap_write_verify_names[v])) {
+                tunables->write_verify = v;
+                return 0;
+            }
+        }
+        return -EINVAL;
+    }
+
+    if (!strcasecmp(key, "data_checksums")) {
+        for (v = 0; v < ARRAY_SIZE(dm_remap_data_checksums_names); v++) {
+            if (!strcasecmp(value, dm_remap_data_checksums_names[v])) {
+                tunables->data_checksums = v;
+                return 0;
+            }
+        }
+        return -EINVAL;
+    }
+
+    if (!strcasecmp(key, "compress")) {
+        for (v = 0; v < ARRAY_SIZE(dm_remap_compress_names); v++) {
+            if (!strcasecmp(value, dm_remap_compress_names[v])) {
+                tunables->compress = v;
+                return 0;
+            }
+        }
+        return -EINVAL;
+    }
+
+    if (kstrtou32(value, 0, &v))
+        return -EINVAL;
+
+    if (!strcasecmp(key, "scan_interval") && v >= 1 && v <= DM_REMAP_MAX_SCAN_INTERVAL)
+        tunables->scan_interval = v;
+    else if (!strcasecmp(key, "cache_size") && (!v || is_power_of_2(v)) &&
+             v <= DM_REMAP_MAX_CACHE_SIZE)
+        tunables->cache_size = v;
+    else if (!strcasecmp(key, "remap_granularity") && (!v || is_power_of_2(v)) &&
+             v <= DM_REMAP_POLICY_MAX_GRANULARITY)
+        tunables->remap_granularity = v;
+    else if (!strcasecmp(key, "retry_limit") && v <= DM_REMAP_MAX_RETRY_LIMIT)
+        tunables->retry_limit = v;
+    else if (!strcasecmp(key, "hung_timeout") && v <= DM_REMAP_MAX_HUNG_TIMEOUT)
+        tunables->hung_timeout = v;
+    else if (!strcasecmp(key, "salvage_retries") && v <= DM_REMAP_MAX_RETRY_LIMIT)
+        tunables->salvage_retries = v;
+    else if (!strcasecmp(key, "salvage_sectors") && (!v || is_power_of_2(v)) &&
+             v <= DM_REMAP_MAX_SALVAGE_SECTORS)
+        tunables->salvage_sectors = v;
+    else if (!strcasecmp(key, "verify_window") && v <= DM_REMAP_MAX_VERIFY_WINDOW)
+        tunables->verify_window = v;
+    else if (!strcasecmp(key, "flatten_rate") && v <= DM_REMAP_MAX_FLATTEN_RATE)
+        tunables->flatten_rate = v;
+    else
+        return -EINVAL;
+
+    return 0;
+}
+
+/*
+ * Settings as key=value, or for a table line (@table) " <#features>
+ * <key> <value>..." with the table-only features of @args, if given,
+ * first and then the settings that differ from the defaults.
+ */
+static int dm_remap_features_format(const struct dm_remap_tunables *tunables, bool table,
+                                    const struct dm_remap_table_args *args,
+                                    char *result, unsigned int maxlen)
+{
+    const char *commit = tunables->commit_policy < ARRAY_SIZE(dm_remap_commit_policy_names) ?
+                         dm_remap_commit_policy_names[tunables->commit_policy] : "?";
+    const char *shrink = tunables->shrink_policy < ARRAY_SIZE(dm_remap_shrink_policy_names) ?
+                         dm_remap_shrink_policy_names[tunables->shrink_policy] : "?";
+    const char *verify = tunables->write_verify < ARRAY_SIZE(dm_remap_write_verify_names) ?
+                         dm_remap_write_verify_names[tunables->write_verify] : "?";
+    const char *checksums = tunables->data_checksums < ARRAY_SIZE(dm_remap_data_checksums_names) ?
+                            dm_remap_data_checksums_names[tunables->data_checksums] : "?";
+    const char *compress = tunables->compress < ARRAY_SIZE(dm_remap_compress_names) ?
+                           dm_remap_compress_names[tunables->compress] : "?";
+    struct dm_remap_tunables def;
+    unsigned int class, source, nr, sz = 0;
+    char prio[8];
+
+    if (!table) {
+        sz += scnprintf(result + sz, maxlen - sz,
+                        "scan_interval=%u cache_size=%u commit_policy=%s remap_granularity=%u",
+                        tunables->scan_interval, tunables->cache_size, commit,
+                        tunables->remap_granularity);
+        for (class = 0; class < DM_REMAP_NR_ERROR_CLASSES; class++)
+            sz += scnprintf(result + sz, maxlen - sz, " %s=%s",
+                            dm_remap_error_class_keys[class],
+                            dm_remap_error_action_name(tunables->error_action[class]));
+        sz += scnprintf(result + sz, maxlen - sz,
+                        " retry_limit=%u shrink_policy=%s hung_timeout=%u "
+                        "salvage_retries=%u salvage_sectors=%u write_verify=%s verify_window=%u "
+                        "data_checksums=%s flatten_rate=%u compress=%s",
+                        tunables->retry_limit, shrink, tunables->hung_timeout,
+                        tunables->salvage_retries, tunables->salvage_sectors, verify,
+                        tunables->verify_window, checksums, tunables->flatten_rate, compress);
+        for (source = 0; source < DM_REMAP_NR_IO_SOURCES; source++)
+            sz += scnprintf(result + sz, maxlen - sz, " %s=%s %s=%s",
+                            dm_remap_ioprio_keys[source],
+                            dm_remap_ioprio_name(tunables->ioprio[source], prio, sizeof(prio)),
+                            dm_remap_cgroup_keys[source],
+                            tunables->cgroup[source][0] ? tunables->cgroup[source] : "none");
+        sz += scnprintf(result + sz, maxlen - sz, " correlated_errors=%s error_domain=%s",
+                        dm_remap_error_action_name(tunables->correlated_action),
+                        tunables->error_domain[0] ? tunables->error_domain : "auto");
+        return sz;
+    }
+
+    dm_remap_tunables_init(&def);
+    nr = (tunables->scan_interval != def.scan_interval) +
+         (tunables->cache_size != def.cache_size) +
+         (tunables->commit_policy != def.commit_policy) +
+         (tunables->remap_granularity != def.remap_granularity) +
+         (tunables->retry_limit != def.retry_limit) +
+         (tunables->shrink_policy != def.shrink_policy) +
+         (tunables->hung_timeout != def.hung_timeout) +
+         (tunables->salvage_retries != def.salvage_retries) +
+         (tunables->salvage_sectors != def.salvage_sectors) +
+         (tunables->write_verify != def.write_verify) +
+         (tunables->verify_window != def.verify_window) +
+         (tunables->data_checksums != def.data_checksums) +
+         (tunables->flatten_rate != def.flatten_rate) +
+         (tunables->compress != def.compress) +
+         (tunables->correlated_action != def.correlated_action) +
+         !!tunables->error_domain[0];
+    for (class = 0; class < DM_REMAP_NR_ERROR_CLASSES; class++)
+        nr += tunables->error_action[class] != def.error_action[class];
+    for (source = 0; source < DM_REMAP_NR_IO_SOURCES; source++)
+        nr += (tunables->ioprio[source] != def.ioprio[source]) + !!tunables->cgroup[source][0];
+    if (args)
+        nr += args->read_only + !!args->overlay_path;
+    if (!nr)
+        return 0;
+
+    sz += scnprintf(result + sz, maxlen - sz, " %u", 2 * nr);
+    if (args && args->read_only)
+        sz += scnprintf(result + sz, maxlen - sz, " mode ro");
+    if (args && args->overlay_path)
+        sz += scnprintf(result + sz, maxlen - sz, " overlay %s", args->overlay_path);
+    if (tunables->scan_interval != def.scan_interval)
+        sz += scnprintf(result + sz, maxlen - sz, " scan_interval %u", tunables->scan_interval);
+    if (tunables->cache_size != def.cache_size)
+        sz += scnprintf(result + sz, maxlen - sz, " cache_size %u", tunables->cache_size);
+    if (tunables->commit_policy != def.commit_policy)
+        sz += scnprintf(result + sz, maxlen - sz, " commit_policy %s", commit);
+    if (tunables->remap_granularity != def.remap_granularity)
+        sz += scnprintf(result + sz, maxlen - sz, " remap_granularity %u",
+                        tunables->remap_granularity);
+    for (class = 0; class < DM_REMAP_NR_ERROR_CLASSES; class++) {
+        if (tunables->error_action[class] != def.error_action[class])
+            sz += scnprintf(result + sz, maxlen - sz, " %s %s",
+                            dm_remap_error_class_keys[class],
+                            dm_remap_error_action_name(tunables->error_action[class]));
+    }
+    if (tunables->retry_limit != def.retry_limit)
+        sz += scnprintf(result + sz, maxlen - sz, " retry_limit %u", tunables->retry_limit);
+    if (tunables->shrink_policy != def.shrink_policy)
+        sz += scnprintf(result + sz, maxlen - sz, " shrink_policy %s", shrink);
+    if (tunables->hung_timeout != def.hung_timeout)
+        sz += scnprintf(result + sz, maxlen - sz, " hung_timeout %u", tunables->hung_timeout);
+    if (tunables->salvage_retries != def.salvage_retries)
+        sz += scnprintf(result + sz, maxlen - sz, " salvage_retries %u",
+                        tunables->salvage_retries);
+    if (tunables->salvage_sectors != def.salvage_sectors)
+        sz += scnprintf(result + sz, maxlen - sz, " salvage_sectors %u",
+                        tunables->salvage_sectors);
+    if (tunables->write_verify != def.write_verify)
+        sz += scnprintf(result + sz, maxlen - sz, " write_verify %s", verify);
+    if (tunables->verify_window != def.verify_window)
+        sz += scnprintf(result + sz, maxlen - sz, " verify_window %u",
+                        tunables->verify_window);
+    if (tunables->data_checksums != def.data_checksums)
+        sz += scnprintf(result + sz, maxlen - sz, " data_checksums %s", checksums);
+    if (tunables->flatten_rate != def.flatten_rate)
+        sz += scnprintf(result + sz, maxlen - sz, " flatten_rate %u", tunables->flatten_rate);
+    if (tunables->compress != def.compress)
+        sz += scnprintf(result + sz, maxlen - sz, " compress %s", compress);
+    for (source = 0; source < DM_REMAP_NR_IO_SOURCES; source++) {
+        if (tunables->ioprio[source] != def.ioprio[source])
+            sz += scnprintf(result + sz, maxlen - sz, " %s %s", dm_remap_ioprio_keys[source],
+                            dm_remap_ioprio_name(tunables->ioprio[source], prio, sizeof(prio)));
+        if (tunables->cgroup[source][0])
+            sz += scnprintf(result + sz, maxlen - sz, " %s %s", dm_remap_cgroup_keys[source],
+                            tunables->cgroup[source]);
+    }
+    if (tunables->correlated_action != def.correlated_action)
+        sz += scnprintf(result + sz, maxlen - sz, " correlated_errors %s",
+                        dm_remap_error_action_name(tunables->correlated_action));
+    if (tunables->error_domain[0])
+        sz += scnprintf(result + sz, maxlen - sz, " error_domain %s", tunables->error_domain);
+    return sz;
+}
+
+/**
+ * dm_remap_tunables_format() - Print settings
+ * @table: Emit " <#features> <key> <value>..." for STATUSTYPE_TABLE, listing
+ *         only settings that differ from the defaults; otherwise all of
+ *         them as key=value
+ *
+ * Returns the number of characters written.
+ */
+int dm_remap_tunables_format(const struct dm_remap_tunables *tunables, bool table,
+                             char *result, unsigned int maxlen)
+{
+    return dm_remap_features_format(tunables, table, NULL, result, maxlen);
+}
+
+/**
+ * dm_remap_parse_table_args() - Parse the target's table line
+ *
+ * "<main_device> <spare_device> [<metadata_device> <metadata_offset>]
+ * [<#features> <key> <value>...]", where #features counts the words that
+ * follow. A third word that is not a number names the metadata device.
+ * Besides the settings, the features may be "mode ro|rw" and, with
+ * "mode ro", "overlay <device>".
+ * Returns 0, or -EINVAL with *@error set for ti->error.
+ */
+int dm_remap_parse_table_args(unsigned int argc, char **argv,
+                              struct dm_remap_table_args *args, char **error)
+{
+    unsigned int nr, i, first = 2;
+
+    memset(args, 0, sizeof(*args));
+
+    if (argc < 2) {
+        *error = "Invalid argument count: dm-remap-v4 <main_device> <spare_device> "
+                 "[<metadata_device> <metadata_offset>] [<#features> <key> <value>...]";
+        return -EINVAL;
+    }
+    if (!argv[0] || !*argv[0] || !argv[1] || !*argv[1]) {
+        *error = "Empty device path";
+        return -EINVAL;
+    }
+    if (!strcmp(argv[0], argv[1])) {
+        *error = "Main and spare device must differ";
+        return -EINVAL;
+    }
+
+    /* v4.3: Optional separate metadata device */
+    if (argc > 2 && kstrtouint(argv[2], 10, &nr)) {
+        if (argc < 4 || !*argv[2]) {
+            *error = "Metadata device needs an offset";
+            return -EINVAL;
+        }
+        if (!strcmp(argv[2], argv[0]) || !strcmp(argv[2], argv[1])) {
+            *error = "Metadata device must differ from main and spare";
+            return -EINVAL;
+        }
+        if (kstrtou64(argv[3], 10, &args->metadata_offset) ||
+            args->metadata_offset % DM_REMAP_METADATA_OFFSET_ALIGN) {
+            *error = "Invalid metadata offset";
+            return -EINVAL;
+        }
+        args->metadata_path = argv[2];
+        first = 4;
+    }
+
+    dm_remap_tunables_init(&args->tunables);
+    if (argc > first) {
+        if (kstrtouint(argv[first], 10, &nr) || nr != argc - first - 1 || nr % 2) {
+            *error = "Invalid number of feature arguments";
+            return -EINVAL;
+        }
+        for (i = first + 1; i < argc; i += 2) {
+            /* v4.3: Table-only features */
+            if (!strcasecmp(argv[i], "mode")) {
+                if (strcasecmp(argv[i + 1], "ro") && strcasecmp(argv[i + 1], "rw")) {
+                    *error = "Invalid mode (ro or rw)";
+                    return -EINVAL;
+                }
+                args->read_only = !strcasecmp(argv[i + 1], "ro");
+            } else if (!strcasecmp(argv[i], "overlay")) {
+                if (!*argv[i + 1] || !strcmp(argv[i + 1], argv[0]) ||
+                    !strcmp(argv[i + 1], argv[1]) ||
+                    (args->metadata_path && !strcmp(argv[i + 1], args->metadata_path))) {
+                    *error = "Overlay device must differ from main, spare and metadata";
+                    return -EINVAL;
+                }
+                args->overlay_path = argv[i + 1];
+            } else if (dm_remap_tunable_set(&args->tunables, argv[i], argv[i + 1])) {
+                *error = "Invalid feature argument";
+                return -EINVAL;
+            }
+        }
+    }
+    if (args->overlay_path && !args->read_only) {
+        *error = "Overlay device needs mode ro";
+        return -EINVAL;
+    }
+
+    args->main_path = argv[0];
+    args->spare_path = argv[1];
+    return 0;
+}
+
+/**
+ * dm_remap_table_args_format() - Print a table line for STATUSTYPE_TABLE
+ *
+ * The devices, then the features: "mode ro" and the overlay if given, and
+ * the settings that differ from the defaults. dm_remap_parse_table_args()
+ * reads it back into the same @args. Returns the number of characters
+ * written.
+ */
+int dm_remap_table_args_format(const struct dm_remap_table_args *args,
+                               char *result, unsigned int maxlen)
+{
+    unsigned int sz;
+
+    sz = scnprintf(result, maxlen, "%s %s", args->main_path, args->spare_path);
+    if (args->metadata_path)
+        sz += scnprintf(result + sz, maxlen - sz, " %s %llu", args->metadata_path,
+                        (unsigned long long)args->metadata_offset);
+    return sz + dm_remap_features_format(&args->tunables, true, args, result + sz, maxlen - sz);
+}
@@ -0,0 +1,222 @@
+/**
+ * dm-remap-v4-metadata-parse.c - v4 metadata validation and copy selection
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * Everything that interprets an on-disk metadata copy, split out of
+ * dm-remap-v4-metadata.c so it can be built and fuzzed in userspace
+ * (tests/fuzz). No I/O and no device state: a copy is only trusted once it
+ * has passed dm_remap_validate_metadata_v4().
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/crc32.h>
+#include <linux/ktime.h>
+#include <linux/timekeeping.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+
+#include "dm-remap-v4.h"
+#include "../include/dm-remap-logging.h"
+
+/**
+ * dm_remap_metadata_v4_crc32() - Calculate CRC32 for entire metadata structure
+ *
+ * Single checksum covers the entire metadata (excluding checksum field itself)
+ * for maximum simplicity and performance.
+ */
+uint32_t dm_remap_metadata_v4_crc32(const struct dm_remap_metadata_v4 *metadata)
+{
+    uint32_t crc = 0;
+    size_t offset_after_checksum = offsetof(struct dm_remap_metadata_v4, header.copy_index);
+    size_t remaining_size = sizeof(*metadata) - offset_after_checksum;
+
+    /* Calculate CRC of everything except the checksum field itself */
+    crc = crc32(0, &metadata->header.magic, sizeof(metadata->header.magic));
+    crc = crc32(crc, &metadata->header.version, sizeof(metadata->header.version));
+    crc = crc32(crc, &metadata->header.sequence_number, sizeof(metadata->header.sequence_number));
+    crc = crc32(crc, &metadata->header.timestamp, sizeof(metadata->header.timestamp));
+
+    /* CRC the rest of the structure after the checksum field */
+    crc = crc32(crc, (uint8_t*)metadata + offset_after_checksum, remaining_size);
+
+    return crc;
+}
+EXPORT_SYMBOL(dm_remap_metadata_v4_crc32);
+
+/**
+ * dm_remap_validate_remap_table_v4() - Check remap entries against device sizes
+ * @main_sectors: Size of the main device, 0 to skip the check
+ * @spare_sectors: Size of the spare device, 0 to skip the check
+ *
+ * v4.3: The CRC only proves a copy was written as-is, not that the table
+ * makes sense. Rejects entries outside either device, spare sectors inside
+ * the metadata area, and sectors remapped (or spare sectors used) twice.
+ * Zero remaps (DM_REMAP_V4_REMAP_ZERO) must not have a spare sector. The
+ * entries of one compressed unit share their extent; no other entry may
+ * overlap it.
+ */
+static uint32_t dm_remap_remap_spare_len_v4(uint16_t flags)
+{
+    if (flags & DM_REMAP_V4_REMAP_ZERO)
+        return 0;
+    if (flags & DM_REMAP_V4_REMAP_COMPRESSED)
+        return DM_REMAP_V4_REMAP_CLEN(flags);
+    return 1;
+}
+
+int dm_remap_validate_remap_table_v4(const struct dm_remap_metadata_v4 *metadata,
+                                     uint64_t main_sectors, uint64_t spare_sectors)
+{
+    uint32_t count = metadata->remap_data.active_remaps;
+    uint32_t i, j, len, other_len;
+
+    if (count > DM_REMAP_V4_MAX_REMAPS) {
+        DMR_DEBUG(2, "Invalid remap count: %u > %u", count, DM_REMAP_V4_MAX_REMAPS);
+        return -EINVAL;
+    }
+
+    if (spare_sectors && metadata->remap_data.next_spare_sector > spare_sectors) {
+        DMR_DEBUG(2, "Invalid next spare sector: %u > %llu",
+                  metadata->remap_data.next_spare_sector, spare_sectors);
+        return -EINVAL;
+    }
+
+    for (i = 0; i < count; i++) {
+        uint64_t orig = metadata->remap_data.remaps[i].original_sector;
+        uint64_t spare = metadata->remap_data.remaps[i].spare_sector;
+        uint16_t flags = metadata->remap_data.remaps[i].flags;
+        bool zero = flags & DM_REMAP_V4_REMAP_ZERO;
+
+        if (main_sectors && orig >= main_sectors) {
+            DMR_DEBUG(2, "Remap %u: sector %llu beyond main device", i, orig);
+            return -EINVAL;
+        }
+        if ((flags & DM_REMAP_V4_REMAP_COMPRESSED) &&
+            (zero || !DM_REMAP_V4_REMAP_CLEN(flags) ||
+             DM_REMAP_V4_REMAP_CLEN(flags) >= DM_REMAP_V4_COMPRESS_SECTORS)) {
+            DMR_DEBUG(2, "Remap %u: invalid compressed flags 0x%x", i, flags);
+            return -EINVAL;
+        }
+        len = dm_remap_remap_spare_len_v4(flags);
+        if (zero ? spare != 0 :
+            spare < DM_REMAP_V4_SPARE_DATA_START ||
+            (spare_sectors && (spare >= spare_sectors || len > spare_sectors - spare))) {
+            DMR_DEBUG(2, "Remap %u: spare sector %llu outside data area", i, spare);
+            return -EINVAL;
+        }
+
+        for (j = 0; j < i; j++) {
+            uint64_t other = metadata->remap_data.remaps[j].spare_sector;
+            uint16_t other_flags = metadata->remap_data.remaps[j].flags;
+
+            if (metadata->remap_data.remaps[j].original_sector == orig) {
+                DMR_DEBUG(2, "Remap %u duplicates remap %u", i, j);
+                return -EINVAL;
+            }
+            other_len = dm_remap_remap_spare_len_v4(other_flags);
+            if (!len || !other_len || spare >= other + other_len || other >= spare + len)
+                continue;
+            /* Only the entries of one unit may share a compressed extent */
+            if ((flags & DM_REMAP_V4_REMAP_COMPRESSED) && other == spare &&
+                !((other_flags ^ flags) &
+                  (DM_REMAP_V4_REMAP_COMPRESSED | DM_REMAP_V4_REMAP_CLEN_MASK)) &&
+                metadata->remap_data.remaps[j].original_sector /
+                    DM_REMAP_V4_COMPRESS_SECTORS == orig / DM_REMAP_V4_COMPRESS_SECTORS)
+                continue;
+            DMR_DEBUG(2, "Remap %u duplicates remap %u", i, j);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+EXPORT_SYMBOL(dm_remap_validate_remap_table_v4);
+
+/**
+ * dm_remap_validate_metadata_v4() - Validate v4.0 metadata structure
+ *
+ * Returns 0, -EBADMSG on a checksum mismatch or -EINVAL if the copy is
+ * well-formed on disk but its contents are not.
+ */
+int dm_remap_validate_metadata_v4(const struct dm_remap_metadata_v4 *metadata)
+{
+    uint32_t expected_checksum;
+    uint64_t current_time;
+
+    /* Check magic number and version */
+    if (metadata->header.magic != DM_REMAP_METADATA_V4_MAGIC) {
+        DMR_DEBUG(2, "Invalid magic: 0x%08x (expected 0x%08x)",
+                  metadata->header.magic, DM_REMAP_METADATA_V4_MAGIC);
+        return -EINVAL;
+    }
+
+    if (metadata->header.version != DM_REMAP_METADATA_V4_VERSION) {
+        DMR_DEBUG(2, "Invalid version: %u (expected %u)",
+                  metadata->header.version, DM_REMAP_METADATA_V4_VERSION);
+        return -EINVAL;
+    }
+
+    /* Validate checksum */
+    expected_checksum = dm_remap_metadata_v4_crc32(metadata);
+    if (metadata->header.metadata_checksum != expected_checksum) {
+        DMR_DEBUG(2, "Checksum mismatch: 0x%08x != 0x%08x",
+                  metadata->header.metadata_checksum, expected_checksum);
+        return -EBADMSG;
+    }
+
+    /* Validate structure sanity */
+    if (metadata->health_data.health_score > 100) {
+        DMR_DEBUG(2, "Invalid health score: %u > 100",
+                  metadata->health_data.health_score);
+        return -EINVAL;
+    }
+
+    /* Validate timestamp is reasonable (not too far in future) */
+    current_time = ktime_get_real_seconds();
+    if (metadata->header.timestamp > current_time + 86400) { /* 1 day tolerance */
+        DMR_DEBUG(2, "Timestamp too far in future: %llu vs %llu",
+                  metadata->header.timestamp, current_time);
+        return -EINVAL;
+    }
+
+    /* v4.3: The remap table must fit the devices the copy describes */
+    return dm_remap_validate_remap_table_v4(metadata,
+                                            metadata->device_config.main_device_sectors,
+                                            metadata->device_config.spare_device_sectors);
+}
+EXPORT_SYMBOL(dm_remap_validate_metadata_v4);
+
+/**
+ * dm_remap_select_metadata_copy_v4() - Pick the copy to use
+ * @valid: Which of @copies passed dm_remap_validate_metadata_v4()
+ *
+ * Highest sequence number wins, then the newest timestamp. Returns the
+ * index of the copy or -ENODATA if none is valid.
+ */
+int dm_remap_select_metadata_copy_v4(const struct dm_remap_metadata_v4 *copies,
+                                     const bool *valid, int nr_copies)
+{
+    uint64_t best_sequence = 0;
+    uint64_t best_timestamp = 0;
+    int best_copy = -ENODATA;
+    int i;
+
+    for (i = 0; i < nr_copies; i++) {
+        if (!valid[i])
+            continue;
+
+        if (best_copy < 0 ||
+            copies[i].header.sequence_number > best_sequence ||
+            (copies[i].header.sequence_number == best_sequence &&
+             copies[i].header.timestamp > best_timestamp)) {
+            best_copy = i;
+            best_sequence = copies[i].header.sequence_number;
+            best_timestamp = copies[i].header.timestamp;
+        }
+    }
+
+    return best_copy;
+}
+EXPORT_SYMBOL(dm_remap_select_metadata_copy_v4);
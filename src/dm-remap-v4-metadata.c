@@ -46,83 +46,14 @@ struct dm_remap_metadata_stats {
 
 static struct dm_remap_metadata_stats metadata_stats;
 
-/**
- * calculate_metadata_crc32() - Calculate CRC32 for entire metadata structure
- * 
- * Single checksum covers the entire metadata (excluding checksum field itself)
- * for maximum simplicity and performance.
- */
-static uint32_t calculate_metadata_crc32(const struct dm_remap_metadata_v4 *metadata)
-{
-    uint32_t crc = 0;
-    size_t offset_after_checksum = offsetof(struct dm_remap_metadata_v4, header.copy_index);
-    size_t remaining_size = sizeof(*metadata) - offset_after_checksum;
-    
-    /* Calculate CRC of everything except the checksum field itself */
-    crc = crc32(0, &metadata->header.magic, sizeof(metadata->header.magic));
-    crc = crc32(crc, &metadata->header.version, sizeof(metadata->header.version));
-    crc = crc32(crc, &metadata->header.sequence_number, sizeof(metadata->header.sequence_number));
-    crc = crc32(crc, &metadata->header.timestamp, sizeof(metadata->header.timestamp));
-    
-    /* CRC the rest of the structure after the checksum field */
-    crc = crc32(crc, (uint8_t*)metadata + offset_after_checksum, remaining_size);
-    
-    return crc;
-}
-
-/**
- * validate_metadata_v4() - Validate v4.0 metadata structure
- * 
- * Pure v4.0 validation - no version detection complexity
- */
+/* v4.3: Validate a copy, counting checksum failures */
 static bool validate_metadata_v4(const struct dm_remap_metadata_v4 *metadata)
 {
-    uint32_t expected_checksum;
-    
-    /* Check magic number and version */
-    if (metadata->header.magic != DM_REMAP_METADATA_V4_MAGIC) {
-        DMR_DEBUG(2, "Invalid magic: 0x%08x (expected 0x%08x)",
-                  metadata->header.magic, DM_REMAP_METADATA_V4_MAGIC);
-        return false;
-    }
-    
-    if (metadata->header.version != DM_REMAP_METADATA_V4_VERSION) {
-        DMR_DEBUG(2, "Invalid version: %u (expected %u)",
-                  metadata->header.version, DM_REMAP_METADATA_V4_VERSION);
-        return false;
-    }
+    int ret = dm_remap_validate_metadata_v4(metadata);
     
-    /* Validate checksum */
-    expected_checksum = calculate_metadata_crc32(metadata);
-    if (metadata->header.metadata_checksum != expected_checksum) {
-        DMR_DEBUG(2, "Checksum mismatch: 0x%08x != 0x%08x",
-                  metadata->header.metadata_checksum, expected_checksum);
+    if (ret == -EBADMSG)
         atomic64_inc(&metadata_stats.checksum_failures);
-        return false;
-    }
-    
-    /* Validate structure sanity */
-    if (metadata->remap_data.active_remaps > DM_REMAP_V4_MAX_REMAPS) {
-        DMR_DEBUG(2, "Invalid remap count: %u > %u",
-                  metadata->remap_data.active_remaps, DM_REMAP_V4_MAX_REMAPS);
-        return false;
-    }
-    
-    if (metadata->health_data.health_score > 100) {
-        DMR_DEBUG(2, "Invalid health score: %u > 100",
-                  metadata->health_data.health_score);
-        return false;
-    }
-    
-    /* Validate timestamp is reasonable (not too far in future) */
-    uint64_t current_time = ktime_get_real_seconds();
-    if (metadata->header.timestamp > current_time + 86400) { /* 1 day tolerance */
-        DMR_DEBUG(2, "Timestamp too far in future: %llu vs %llu",
-                  metadata->header.timestamp, current_time);
-        return false;
-    }
-    
-    return true;
+    return ret == 0;
 }
 
 /**
@@ -277,9 +208,7 @@ int dm_remap_read_metadata_v4_bufio_with_repair(struct dm_bufio_client *client,
 {
     struct dm_remap_metadata_v4 *copies;
     bool valid[5] = {false};
-    int best_copy = -1;
-    uint64_t best_sequence = 0;
-    uint64_t best_timestamp = 0;
+    int best_copy;
     int valid_count = 0;
     int i, ret;
     ktime_t start_time, end_time;
@@ -301,24 +230,17 @@ int dm_remap_read_metadata_v4_bufio_with_repair(struct dm_bufio_client *client,
         if (ret == 0 && validate_metadata_v4(&copies[i])) {
             valid[i] = true;
             valid_count++;
-            
-            /* Track best copy (highest sequence number, then timestamp) */
-            if (copies[i].header.sequence_number > best_sequence ||
-                (copies[i].header.sequence_number == best_sequence &&
-                 copies[i].header.timestamp > best_timestamp)) {
-                best_copy = i;
-                best_sequence = copies[i].header.sequence_number;
-                best_timestamp = copies[i].header.timestamp;
-            }
         }
     }
     
+    /* Track best copy (highest sequence number, then timestamp) */
+    best_copy = dm_remap_select_metadata_copy_v4(copies, valid, 5);
     if (best_copy >= 0) {
         /* Copy best metadata to output */
         memcpy(metadata, &copies[best_copy], sizeof(*metadata));
         
         DMR_DEBUG(1, "Selected metadata copy %d: seq=%llu, valid_copies=%d/5",
-                  best_copy, best_sequence, valid_count);
+                  best_copy, metadata->header.sequence_number, valid_count);
         
         /* Schedule repair if we have corrupted copies */
         if (valid_count < 5) {
@@ -375,12 +297,9 @@ int dm_remap_read_metadata_v4_with_repair(struct block_device *bdev,
                                           struct dm_remap_metadata_v4 *metadata,
                                           struct dm_remap_repair_context *repair_ctx)
 {
-    const sector_t copy_sectors[] = DM_REMAP_V4_COPY_SECTORS;
     struct dm_remap_metadata_v4 *copies; /* Dynamic allocation to avoid stack overflow */
     bool valid[5] = {false};
-    int best_copy = -1;
-    uint64_t best_sequence = 0;
-    uint64_t best_timestamp = 0;
+    int best_copy;
     int valid_count = 0;
     int i, ret;
     ktime_t start_time, end_time;
@@ -398,28 +317,21 @@ int dm_remap_read_metadata_v4_with_repair(struct block_device *bdev,
     
     /* Read all 5 copies */
     for (i = 0; i < 5; i++) {
-        ret = read_metadata_copy(bdev, copy_sectors[i], &copies[i]);
+        ret = read_metadata_copy(bdev, DM_REMAP_V4_COPY_SECTOR(i), &copies[i]);
         if (ret == 0 && validate_metadata_v4(&copies[i])) {
             valid[i] = true;
             valid_count++;
-            
-            /* Track best copy (highest sequence number, then timestamp) */
-            if (copies[i].header.sequence_number > best_sequence ||
-                (copies[i].header.sequence_number == best_sequence &&
-                 copies[i].header.timestamp > best_timestamp)) {
-                best_copy = i;
-                best_sequence = copies[i].header.sequence_number;
-                best_timestamp = copies[i].header.timestamp;
-            }
         }
     }
     
+    /* Track best copy (highest sequence number, then timestamp) */
+    best_copy = dm_remap_select_metadata_copy_v4(copies, valid, 5);
     if (best_copy >= 0) {
         /* Copy best metadata to output */
         memcpy(metadata, &copies[best_copy], sizeof(*metadata));
         
         DMR_DEBUG(1, "Selected metadata copy %d: seq=%llu, valid_copies=%d/5",
-                  best_copy, best_sequence, valid_count);
+                  best_copy, metadata->header.sequence_number, valid_count);
         
         /* Schedule repair if we have corrupted copies */
         if (valid_count < 5) {
@@ -456,7 +368,6 @@ int dm_remap_read_metadata_v4_with_repair(struct block_device *bdev,
 int dm_remap_write_metadata_v4(struct block_device *bdev,
                                struct dm_remap_metadata_v4 *metadata)
 {
-    const sector_t copy_sectors[] = DM_REMAP_V4_COPY_SECTORS;
     int ret = 0;
     int i;
     ktime_t start_time, end_time;
@@ -481,7 +392,7 @@ int dm_remap_write_metadata_v4(struct block_device *bdev,
     
     /* Calculate checksum for updated metadata */
     printk(KERN_CRIT "dm-remap CRASH-DEBUG: write_metadata_v4 before calculate_metadata_crc32\n");
-    metadata->header.metadata_checksum = calculate_metadata_crc32(metadata);
+    metadata->header.metadata_checksum = dm_remap_metadata_v4_crc32(metadata);
     printk(KERN_CRIT "dm-remap CRASH-DEBUG: write_metadata_v4 after calculate_metadata_crc32, checksum=0x%08x\n",
            metadata->header.metadata_checksum);
     
@@ -492,12 +403,12 @@ int dm_remap_write_metadata_v4(struct block_device *bdev,
     printk(KERN_CRIT "dm-remap CRASH-DEBUG: write_metadata_v4 starting loop to write 5 copies\n");
     for (i = 0; i < 5; i++) {
         printk(KERN_CRIT "dm-remap CRASH-DEBUG: write_metadata_v4 writing copy %d to sector %llu\n",
-               i, (unsigned long long)copy_sectors[i]);
+               i, (unsigned long long)DM_REMAP_V4_COPY_SECTOR(i));
         
         metadata->header.copy_index = i;
         
         printk(KERN_CRIT "dm-remap CRASH-DEBUG: write_metadata_v4 *** CALLING write_metadata_copy copy=%d ***\n", i);
-        ret = write_metadata_copy(bdev, copy_sectors[i], metadata);
+        ret = write_metadata_copy(bdev, DM_REMAP_V4_COPY_SECTOR(i), metadata);
         printk(KERN_CRIT "dm-remap CRASH-DEBUG: write_metadata_v4 *** RETURNED from write_metadata_copy copy=%d ret=%d ***\n",
                i, ret);
         
@@ -531,67 +442,94 @@ int dm_remap_write_metadata_v4(struct block_device *bdev,
 
 /**
  * dm_remap_repair_metadata_v4() - Repair corrupted metadata copies
+ * @client: dm-bufio client of the metadata area (v4.3: at its sector offset)
  * 
- * Find best copy and overwrite corrupted copies
+ * Find best copy and overwrite corrupted copies. Clean cached copies are
+ * dropped first so the check sees what is on the disk.
  */
-int dm_remap_repair_metadata_v4(struct block_device *bdev)
+int dm_remap_repair_metadata_v4(struct dm_bufio_client *client)
 {
     struct dm_remap_metadata_v4 *best_metadata;
-    struct dm_remap_metadata_v4 *copy;
-    const sector_t copy_sectors[] = DM_REMAP_V4_COPY_SECTORS;
-    int ret, i, repairs_made = 0;
+    struct dm_remap_metadata_v4 *copies;
+    bool valid[5] = {false};
+    int ret, i, best_copy, repairs_made = 0, failed = 0;
+    
+    if (!client)
+        return -EINVAL;
     
-    DMR_DEBUG(1, "Repairing metadata on device");
+    DMR_DEBUG(1, "Repairing metadata copies");
     
     /* Allocate on heap to avoid stack overflow */
     best_metadata = kmalloc(sizeof(struct dm_remap_metadata_v4), GFP_KERNEL);
-    copy = kmalloc(sizeof(struct dm_remap_metadata_v4), GFP_KERNEL);
-    if (!best_metadata || !copy) {
+    copies = kmalloc(5 * sizeof(struct dm_remap_metadata_v4), GFP_KERNEL);
+    if (!best_metadata || !copies) {
         DMR_ERROR("Failed to allocate memory for metadata repair");
         kfree(best_metadata);
-        kfree(copy);
+        kfree(copies);
         return -ENOMEM;
     }
     
+    /* A metadata write in between could make the best copy stale */
+    mutex_lock(&dm_remap_metadata_mutex);
+    
     /* Find best copy */
-    ret = dm_remap_read_metadata_v4(bdev, best_metadata);
-    if (ret) {
+    for (i = 0; i < 5; i++) {
+        dm_bufio_forget(client, i);
+        ret = read_metadata_copy_bufio(client, i, &copies[i]);
+        valid[i] = ret == 0 && validate_metadata_v4(&copies[i]);
+    }
+    best_copy = dm_remap_select_metadata_copy_v4(copies, valid, 5);
+    if (best_copy < 0) {
+        mutex_unlock(&dm_remap_metadata_mutex);
         DMR_DEBUG(0, "Cannot repair: no valid metadata found");
         kfree(best_metadata);
-        kfree(copy);
-        return ret;
+        kfree(copies);
+        return -ENODATA;
     }
+    memcpy(best_metadata, &copies[best_copy], sizeof(*best_metadata));
     
     /* Check each copy and repair if needed */
     for (i = 0; i < 5; i++) {
-        ret = read_metadata_copy(bdev, copy_sectors[i], copy);
-        if (ret != 0 || !validate_metadata_v4(copy) ||
-            copy->header.sequence_number != best_metadata->header.sequence_number) {
-            
-            /* Repair this copy */
-            best_metadata->header.copy_index = i;
-            best_metadata->header.metadata_checksum = calculate_metadata_crc32(best_metadata);
-            
-            ret = write_metadata_copy(bdev, copy_sectors[i], best_metadata);
-            if (ret == 0) {
-                repairs_made++;
-                DMR_DEBUG(1, "Repaired metadata copy %d at sector %llu", 
-                          i, copy_sectors[i]);
-            } else {
-                DMR_DEBUG(0, "Failed to repair copy %d: %d", i, ret);
-            }
+        struct dm_buffer *buffer;
+        void *data;
+        
+        if (valid[i] &&
+            copies[i].header.sequence_number == best_metadata->header.sequence_number)
+            continue;
+        
+        /* Repair this copy */
+        best_metadata->header.copy_index = i;
+        best_metadata->header.metadata_checksum = dm_remap_metadata_v4_crc32(best_metadata);
+        
+        data = dm_bufio_new(client, i, &buffer);
+        if (IS_ERR(data)) {
+            DMR_DEBUG(0, "Failed to repair copy %d: %ld", i, PTR_ERR(data));
+            failed++;
+            continue;
         }
+        memcpy(data, best_metadata, sizeof(*best_metadata));
+        dm_bufio_mark_buffer_dirty(buffer);
+        dm_bufio_release(buffer);
+        repairs_made++;
     }
     
+    mutex_unlock(&dm_remap_metadata_mutex);
+    
+    ret = 0;
     if (repairs_made > 0) {
-        atomic64_inc(&metadata_stats.repairs_performed);
-        DMR_DEBUG(1, "Metadata repair completed: %d copies repaired", repairs_made);
+        ret = dm_bufio_write_dirty_buffers(client);
+        if (ret) {
+            DMR_DEBUG(0, "Failed to write repaired copies: %d", ret);
+        } else {
+            atomic64_inc(&metadata_stats.repairs_performed);
+            DMR_DEBUG(1, "Metadata repair completed: %d copies repaired", repairs_made);
+        }
     }
     
     kfree(best_metadata);
-    kfree(copy);
+    kfree(copies);
     
-    return repairs_made > 0 ? 0 : -EIO;
+    return ret ?: (failed ? -EIO : 0);
 }
 
 /**
@@ -785,7 +723,7 @@ int dm_remap_write_metadata_v4_async(struct dm_bufio_client *bufio_client,
 	metadata->header.sequence_number = atomic64_inc_return(&dm_remap_global_sequence);
 	metadata->header.timestamp = ktime_get_real_seconds();
 	metadata->header.structure_size = sizeof(*metadata);
-	metadata->header.metadata_checksum = calculate_metadata_crc32(metadata);
+	metadata->header.metadata_checksum = dm_remap_metadata_v4_crc32(metadata);
 	
 	/* Write 5 redundant copies using dm-bufio */
 	for (i = 0; i < 5; i++) {
@@ -830,6 +768,37 @@ int dm_remap_write_metadata_v4_async(struct dm_bufio_client *bufio_client,
 }
 EXPORT_SYMBOL(dm_remap_write_metadata_v4_async);
 
+/**
+ * dm_remap_write_metadata_v4_sync - Write metadata and wait until it is durable
+ * 
+ * dm_remap_write_metadata_v4_async() only dirties the dm-bufio buffers; they
+ * reach the disk whenever dm-bufio decides to write them back. Callers that
+ * must not acknowledge I/O before the new remap table is on stable storage
+ * (atomic write staging, write-ahead remaps) use this variant instead.
+ * dm_bufio_write_dirty_buffers() waits for the copies and then flushes the
+ * device's volatile write cache.
+ */
+int dm_remap_write_metadata_v4_sync(struct dm_bufio_client *bufio_client,
+                                    struct dm_remap_metadata_v4 *metadata)
+{
+	int ret;
+	
+	ret = dm_remap_write_metadata_v4_async(bufio_client, metadata, NULL);
+	if (ret)
+		return ret;
+	
+	ret = dm_bufio_write_dirty_buffers(bufio_client);
+	if (ret) {
+		DMR_ERROR("dm-bufio: metadata writeback failed: %d", ret);
+		return ret;
+	}
+	
+	DMR_DEBUG(2, "Metadata committed (seq: %llu)",
+	          (unsigned long long)metadata->header.sequence_number);
+	return 0;
+}
+EXPORT_SYMBOL(dm_remap_write_metadata_v4_sync);
+
 /**
  * dm_remap_wait_metadata_write - Wait for async metadata write completion
  */
@@ -0,0 +1,129 @@
+/**
+ * dm-remap-v4-pipeline.c - Remap pipeline timing (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * Per-stage latency histograms for write-ahead remap creation and metadata
+ * write accounting. Recording is irq-safe and never allocates; all of it
+ * is fixed-size, so reading it never has to chase a remap list.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/string.h>
+
+#include "../include/dm-remap-v4-pipeline.h"
+
+static const char * const dm_remap_pipe_stage_names[DM_REMAP_PIPE_NR_STAGES] = {
+    [DM_REMAP_PIPE_QUEUE] = "queue",
+    [DM_REMAP_PIPE_SALVAGE] = "salvage",
+    [DM_REMAP_PIPE_ALLOC] = "alloc",
+    [DM_REMAP_PIPE_SERIALIZE] = "serialize",
+    [DM_REMAP_PIPE_WRITE] = "write",
+    [DM_REMAP_PIPE_TOTAL] = "total",
+};
+
+void dm_remap_pipeline_init(struct dm_remap_pipeline_stats *p)
+{
+    spin_lock_init(&p->lock);
+    dm_remap_pipeline_reset(p);
+}
+
+void dm_remap_pipeline_reset(struct dm_remap_pipeline_stats *p)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&p->lock, flags);
+    memset(p->stage, 0, sizeof(p->stage));
+    p->remaps = 0;
+    p->remapped_bytes = 0;
+    p->metadata_writes = 0;
+    p->metadata_bytes = 0;
+    spin_unlock_irqrestore(&p->lock, flags);
+}
+
+void dm_remap_pipeline_record(struct dm_remap_pipeline_stats *p,
+                              enum dm_remap_pipe_stage stage, u64 ns)
+{
+    struct dm_remap_pipe_hist *h = &p->stage[stage];
+    unsigned int bucket = min(fls64(ns / NSEC_PER_USEC), DM_REMAP_PIPE_BUCKETS - 1);
+    unsigned long flags;
+
+    spin_lock_irqsave(&p->lock, flags);
+    h->count++;
+    h->sum_ns += ns;
+    h->max_ns = max(h->max_ns, ns);
+    h->buckets[bucket]++;
+    spin_unlock_irqrestore(&p->lock, flags);
+}
+
+void dm_remap_pipeline_remap(struct dm_remap_pipeline_stats *p, u64 bytes)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&p->lock, flags);
+    p->remaps++;
+    p->remapped_bytes += bytes;
+    spin_unlock_irqrestore(&p->lock, flags);
+}
+
+void dm_remap_pipeline_metadata_write(struct dm_remap_pipeline_stats *p, u64 bytes)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&p->lock, flags);
+    p->metadata_writes++;
+    p->metadata_bytes += bytes;
+    spin_unlock_irqrestore(&p->lock, flags);
+}
+
+/**
+ * dm_remap_pipeline_format() - Print the counters and one line per stage
+ *
+ * "remaps=.. remapped_bytes=.. metadata_writes=.. metadata_bytes=..
+ * bytes_per_remap=.. bytes_per_data_byte=..", then for each stage
+ * "<stage> count=.. avg_us=.. max_us=.. hist=<b0>,<b1>,..." with the
+ * histogram cut after its last non-empty bucket. Returns the number of
+ * characters written.
+ */
+int dm_remap_pipeline_format(struct dm_remap_pipeline_stats *p, char *buf, size_t len)
+{
+    struct dm_remap_pipe_hist h;
+    u64 remaps, remapped_bytes, writes, bytes;
+    unsigned long flags;
+    unsigned int stage, last, i;
+    int n;
+
+    spin_lock_irqsave(&p->lock, flags);
+    remaps = p->remaps;
+    remapped_bytes = p->remapped_bytes;
+    writes = p->metadata_writes;
+    bytes = p->metadata_bytes;
+    spin_unlock_irqrestore(&p->lock, flags);
+
+    n = scnprintf(buf, len, "remaps=%llu remapped_bytes=%llu metadata_writes=%llu "
+                  "metadata_bytes=%llu bytes_per_remap=%llu bytes_per_data_byte=%llu",
+                  (unsigned long long)remaps, (unsigned long long)remapped_bytes,
+                  (unsigned long long)writes, (unsigned long long)bytes,
+                  (unsigned long long)(remaps ? bytes / remaps : 0),
+                  (unsigned long long)(remapped_bytes ? bytes / remapped_bytes : 0));
+
+    for (stage = 0; stage < DM_REMAP_PIPE_NR_STAGES; stage++) {
+        spin_lock_irqsave(&p->lock, flags);
+        h = p->stage[stage];
+        spin_unlock_irqrestore(&p->lock, flags);
+
+        n += scnprintf(buf + n, len - n, "\n%s count=%llu avg_us=%llu max_us=%llu hist=",
+                       dm_remap_pipe_stage_names[stage], (unsigned long long)h.count,
+                       (unsigned long long)(h.count ? h.sum_ns / h.count / NSEC_PER_USEC : 0),
+                       (unsigned long long)(h.max_ns / NSEC_PER_USEC));
+        for (last = DM_REMAP_PIPE_BUCKETS - 1; last > 0 && !h.buckets[last]; last--)
+            ;
+        for (i = 0; i <= last; i++)
+            n += scnprintf(buf + n, len - n, i ? ",%llu" : "%llu",
+                           (unsigned long long)h.buckets[i]);
+    }
+
+    return n;
+}
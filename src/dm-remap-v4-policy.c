@@ -0,0 +1,252 @@
+/**
+ * dm-remap-v4-policy.c - BPF-programmable remap policy (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * Registers the dm_remap_policy_ops struct_ops type. One policy can be
+ * attached at a time (bpftool struct_ops register, or a libbpf link) and
+ * serves every dm-remap target. The attached ops are published with RCU
+ * and the core's call sites are gated by the dm_remap_policy_attached
+ * static key, which is only enabled while a policy is registered.
+ *
+ * Hook results are range-checked here so the core never has to trust a
+ * program: unknown verdicts fall back to remapping, granularities must be
+ * a power-of-two multiple of the default, and scan intervals are clamped.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/string.h>
+#include <linux/log2.h>
+#include <linux/bpf.h>
+#include <linux/btf.h>
+
+#include "../include/dm-remap-v4-policy.h"
+#include "../include/dm-remap-logging.h"
+
+/* Longest scan interval a policy may ask for (one week) */
+#define DM_REMAP_POLICY_MAX_SCAN_INTERVAL  (7 * 24 * 3600)
+
+DEFINE_STATIC_KEY_FALSE(dm_remap_policy_attached);
+
+static struct dm_remap_policy_ops __rcu *dm_remap_policy;
+static DEFINE_MUTEX(dm_remap_policy_mutex);
+
+int __dm_remap_policy_should_remap(u32 dev, u64 sector, int error, bool is_write)
+{
+    struct dm_remap_policy_ops *ops;
+    int verdict = DM_REMAP_POLICY_REMAP;
+
+    rcu_read_lock();
+    ops = rcu_dereference(dm_remap_policy);
+    if (ops && ops->should_remap)
+        verdict = ops->should_remap(dev, sector, error, is_write);
+    rcu_read_unlock();
+
+    if (verdict != DM_REMAP_POLICY_RETRY && verdict != DM_REMAP_POLICY_IGNORE)
+        verdict = DM_REMAP_POLICY_REMAP;
+    return verdict;
+}
+
+u32 __dm_remap_policy_remap_granularity(u32 dev, u64 sector, u32 default_sectors)
+{
+    struct dm_remap_policy_ops *ops;
+    u32 nr = 0;
+
+    rcu_read_lock();
+    ops = rcu_dereference(dm_remap_policy);
+    if (ops && ops->remap_granularity)
+        nr = ops->remap_granularity(dev, sector, default_sectors);
+    rcu_read_unlock();
+
+    /* Remaps must stay whole logical blocks and naturally aligned */
+    if (!nr || !is_power_of_2(nr) || nr < default_sectors ||
+        nr % default_sectors || nr > DM_REMAP_POLICY_MAX_GRANULARITY)
+        return default_sectors;
+    return nr;
+}
+
+u64 __dm_remap_policy_spare_placement(u32 dev, u64 sector, u32 nr_sectors)
+{
+    struct dm_remap_policy_ops *ops;
+    u64 hint = 0;
+
+    rcu_read_lock();
+    ops = rcu_dereference(dm_remap_policy);
+    if (ops && ops->spare_placement)
+        hint = ops->spare_placement(dev, sector, nr_sectors);
+    rcu_read_unlock();
+
+    /* Validated against the spare allocator by the caller */
+    return hint;
+}
+
+u32 __dm_remap_policy_scan_interval(u32 dev, u32 health_score, u32 default_seconds)
+{
+    struct dm_remap_policy_ops *ops;
+    u32 seconds = 0;
+
+    rcu_read_lock();
+    ops = rcu_dereference(dm_remap_policy);
+    if (ops && ops->scan_interval)
+        seconds = ops->scan_interval(dev, health_score, default_seconds);
+    rcu_read_unlock();
+
+    if (!seconds)
+        return default_seconds;
+    return min_t(u32, seconds, DM_REMAP_POLICY_MAX_SCAN_INTERVAL);
+}
+
+/**
+ * dm_remap_policy_name() - Name of the attached policy for status output
+ *
+ * Returns the number of characters written, "none" when nothing is attached.
+ */
+int dm_remap_policy_name(char *buf, size_t len)
+{
+    struct dm_remap_policy_ops *ops;
+    int ret;
+
+    rcu_read_lock();
+    ops = rcu_dereference(dm_remap_policy);
+    ret = scnprintf(buf, len, "%s", ops ? ops->name : "none");
+    rcu_read_unlock();
+
+    return ret;
+}
+
+#if IS_ENABLED(CONFIG_BPF_JIT) && IS_ENABLED(CONFIG_BPF_SYSCALL)
+
+static bool dm_remap_policy_is_valid_access(int off, int size,
+                                            enum bpf_access_type type,
+                                            const struct bpf_prog *prog,
+                                            struct bpf_insn_access_aux *info)
+{
+    /* All hook arguments are scalars */
+    return bpf_tracing_btf_ctx_access(off, size, type, prog, info);
+}
+
+static const struct bpf_verifier_ops dm_remap_policy_verifier_ops = {
+    .get_func_proto = bpf_base_func_proto,
+    .is_valid_access = dm_remap_policy_is_valid_access,
+};
+
+static int dm_remap_policy_btf_init(struct btf *btf)
+{
+    return 0;
+}
+
+static int dm_remap_policy_init_member(const struct btf_type *t,
+                                       const struct btf_member *member,
+                                       void *kdata, const void *udata)
+{
+    const struct dm_remap_policy_ops *uops = udata;
+    struct dm_remap_policy_ops *ops = kdata;
+    u32 moff = __btf_member_bit_offset(t, member) / 8;
+
+    if (moff != offsetof(struct dm_remap_policy_ops, name))
+        return 0;
+
+    if (strscpy(ops->name, uops->name, sizeof(ops->name)) <= 0)
+        return -EINVAL;
+    return 1;
+}
+
+static int dm_remap_policy_reg(void *kdata, struct bpf_link *link)
+{
+    struct dm_remap_policy_ops *ops = kdata;
+    int ret = 0;
+
+    mutex_lock(&dm_remap_policy_mutex);
+    if (rcu_access_pointer(dm_remap_policy)) {
+        ret = -EEXIST;
+    } else {
+        rcu_assign_pointer(dm_remap_policy, ops);
+        static_branch_enable(&dm_remap_policy_attached);
+    }
+    mutex_unlock(&dm_remap_policy_mutex);
+
+    if (!ret)
+        DMR_INFO("Remap policy '%s' attached", ops->name);
+    return ret;
+}
+
+static void dm_remap_policy_unreg(void *kdata, struct bpf_link *link)
+{
+    struct dm_remap_policy_ops *ops = kdata;
+
+    mutex_lock(&dm_remap_policy_mutex);
+    if (rcu_access_pointer(dm_remap_policy) == ops) {
+        static_branch_disable(&dm_remap_policy_attached);
+        RCU_INIT_POINTER(dm_remap_policy, NULL);
+        synchronize_rcu();
+        DMR_INFO("Remap policy '%s' detached", ops->name);
+    }
+    mutex_unlock(&dm_remap_policy_mutex);
+}
+
+/* CFI stubs: the signatures BPF programs are checked against */
+static int dm_remap_policy_should_remap_stub(u32 dev, u64 sector, int error, bool is_write)
+{
+    return DM_REMAP_POLICY_REMAP;
+}
+
+static u32 dm_remap_policy_remap_granularity_stub(u32 dev, u64 sector, u32 default_sectors)
+{
+    return 0;
+}
+
+static u64 dm_remap_policy_spare_placement_stub(u32 dev, u64 sector, u32 nr_sectors)
+{
+    return 0;
+}
+
+static u32 dm_remap_policy_scan_interval_stub(u32 dev, u32 health_score, u32 default_seconds)
+{
+    return 0;
+}
+
+static struct dm_remap_policy_ops dm_remap_policy_stubs = {
+    .should_remap = dm_remap_policy_should_remap_stub,
+    .remap_granularity = dm_remap_policy_remap_granularity_stub,
+    .spare_placement = dm_remap_policy_spare_placement_stub,
+    .scan_interval = dm_remap_policy_scan_interval_stub,
+};
+
+static struct bpf_struct_ops bpf_dm_remap_policy_ops = {
+    .verifier_ops = &dm_remap_policy_verifier_ops,
+    .init = dm_remap_policy_btf_init,
+    .init_member = dm_remap_policy_init_member,
+    .reg = dm_remap_policy_reg,
+    .unreg = dm_remap_policy_unreg,
+    .cfi_stubs = &dm_remap_policy_stubs,
+    .name = "dm_remap_policy_ops",
+    .owner = THIS_MODULE,
+};
+
+/**
+ * dm_remap_policy_init() - Register the struct_ops type
+ *
+ * Failure is not fatal: without module BTF the target simply runs with the
+ * built-in policy.
+ */
+int dm_remap_policy_init(void)
+{
+    int ret;
+
+    ret = register_bpf_struct_ops(&bpf_dm_remap_policy_ops, dm_remap_policy_ops);
+    if (ret)
+        DMR_WARN("BPF remap policy hooks unavailable (%d), using built-in policy", ret);
+    return 0;
+}
+
+#else /* !CONFIG_BPF_JIT || !CONFIG_BPF_SYSCALL */
+
+int dm_remap_policy_init(void)
+{
+    return 0;
+}
+
+#endif
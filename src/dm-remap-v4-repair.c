@@ -21,8 +21,10 @@
 #include <linux/delay.h>
 #include <linux/time.h>
 #include <linux/blkdev.h>
+#include <linux/dm-bufio.h>
 #include "dm-remap-v4-compat.h"
 #include "dm-remap-v4.h"
+#include "../include/dm-remap-v4-ioclass.h"
 
 /* Forward declaration */
 static void dm_remap_repair_work(struct work_struct *work);
@@ -68,7 +70,9 @@ void dm_remap_init_repair_context(struct dm_remap_repair_context *ctx,
     
     /* Store references */
     ctx->spare_bdev = spare_bdev;
+    ctx->bufio_client = NULL;  /* Set once the metadata client exists */
     ctx->repair_wq = repair_wq;
+    ctx->ioclass = NULL;
     
     DMR_INFO("Repair context initialized (scrub interval: %u sec)",
              ctx->scrub_interval_seconds);
@@ -162,12 +166,15 @@ EXPORT_SYMBOL(dm_remap_schedule_metadata_repair);
 static void dm_remap_repair_work(struct work_struct *work)
 {
     struct dm_remap_repair_context *ctx;
+    struct dm_remap_io_scope scope = { };
+    struct dm_bufio_client *client;
     int ret;
     uint32_t retry_count = 0;
     
     ctx = container_of(work, struct dm_remap_repair_context, repair_work);
-    if (!ctx || !ctx->spare_bdev) {
-        DMR_ERROR("repair_work: Invalid context or spare device");
+    client = ctx ? READ_ONCE(ctx->bufio_client) : NULL;
+    if (!client) {
+        DMR_ERROR("repair_work: Invalid context or metadata client");
         return;
     }
     
@@ -178,10 +185,12 @@ static void dm_remap_repair_work(struct work_struct *work)
     }
     
     DMR_INFO("Starting metadata repair");
+    if (ctx->ioclass)
+        dm_remap_io_enter(ctx->ioclass, DM_REMAP_IOS_REPAIR, &scope);
     
     /* Execute repair with retry logic */
     do {
-        ret = dm_remap_repair_metadata_v4(ctx->spare_bdev);
+        ret = dm_remap_repair_metadata_v4(client);
         
         if (ret == 0) {
             /* Success */
@@ -206,6 +215,7 @@ static void dm_remap_repair_work(struct work_struct *work)
     if (ret != 0) {
         DMR_ERROR("Metadata repair failed after %u attempts", retry_count);
     }
+    dm_remap_io_leave(&scope);
     
     /* Clear repair in progress flag */
     atomic_set(&ctx->repair_in_progress, 0);
@@ -230,13 +240,16 @@ static void dm_remap_periodic_scrub_work(struct work_struct *work)
     struct dm_remap_repair_context *ctx;
     struct delayed_work *dwork;
     struct dm_remap_metadata_v4 *metadata;
-    int ret;
+    struct dm_remap_io_scope scope = { };
+    struct dm_bufio_client *client;
+    int ret, i;
     
     dwork = container_of(work, struct delayed_work, work);
     ctx = container_of(dwork, struct dm_remap_repair_context, periodic_scrub_work);
     
-    if (!ctx || !ctx->spare_bdev) {
-        DMR_ERROR("scrub_work: Invalid context or spare device");
+    client = ctx ? READ_ONCE(ctx->bufio_client) : NULL;
+    if (!client) {
+        DMR_ERROR("scrub_work: Invalid context or metadata client");
         return;
     }
     
@@ -256,8 +269,14 @@ static void dm_remap_periodic_scrub_work(struct work_struct *work)
     
     DMR_INFO("Starting periodic metadata scrub");
     
-    /* Read metadata - this will detect corruption if present */
-    ret = dm_remap_read_metadata_v4(ctx->spare_bdev, metadata);
+    /* Read metadata from the disk, not the cache - a copy with fewer
+     * than five valid ones schedules a repair on its own */
+    if (ctx->ioclass)
+        dm_remap_io_enter(ctx->ioclass, DM_REMAP_IOS_REPAIR, &scope);
+    for (i = 0; i < DM_REMAP_V4_REDUNDANT_COPIES; i++)
+        dm_bufio_forget(client, i);
+    ret = dm_remap_read_metadata_v4_bufio_with_repair(client, metadata, ctx);
+    dm_remap_io_leave(&scope);
     
     if (ret != 0) {
         DMR_WARN("Periodic scrub detected corruption: %d", ret);
@@ -39,12 +39,17 @@ uint32_t dm_remap_v4_calculate_metadata_crc32(const struct dm_remap_v4_setup_met
                 sizeof(*metadata) - sizeof(metadata->overall_crc32));
 }
 
+/* True if a fixed-size on-disk string field is NUL-terminated */
+#define dm_remap_v4_string_terminated(field) \
+    (strnlen((field), sizeof(field)) < sizeof(field))
+
 /*
  * Verify metadata integrity using CRC32 checksums
  */
 int dm_remap_v4_verify_metadata_integrity(const struct dm_remap_v4_setup_metadata *metadata)
 {
     uint32_t calculated_crc;
+    uint32_t i;
     
     if (!metadata) {
         return -EINVAL;
@@ -75,6 +80,29 @@ int dm_remap_v4_verify_metadata_integrity(const struct dm_remap_v4_setup_metadat
         return -DM_REMAP_V4_REASSEMBLY_ERROR_CRC_MISMATCH;
     }
     
+    /* The CRCs only prove the copy is intact. Counts index fixed arrays and
+     * strings are printed and copied by discovery, so bound them too. */
+    if (metadata->num_spare_devices > DM_REMAP_V4_MAX_SPARE_DEVICES ||
+        metadata->sysfs_config.num_settings > DM_REMAP_V4_MAX_SYSFS_SETTINGS ||
+        metadata->policy_config.num_rules > DM_REMAP_V4_MAX_POLICY_RULES ||
+        metadata->metadata_copies_count > DM_REMAP_V4_METADATA_COPY_SECTORS) {
+        DMERR("Metadata counts out of range");
+        return -DM_REMAP_V4_REASSEMBLY_ERROR_CORRUPTED;
+    }
+    
+    if (!dm_remap_v4_string_terminated(metadata->setup_description) ||
+        !dm_remap_v4_string_terminated(metadata->main_device.device_path) ||
+        !dm_remap_v4_string_terminated(metadata->target_config.target_params)) {
+        DMERR("Unterminated string in metadata");
+        return -DM_REMAP_V4_REASSEMBLY_ERROR_CORRUPTED;
+    }
+    for (i = 0; i < metadata->num_spare_devices; i++) {
+        if (!dm_remap_v4_string_terminated(metadata->spare_devices[i].spare_fingerprint.device_path)) {
+            DMERR("Unterminated spare device path in metadata");
+            return -DM_REMAP_V4_REASSEMBLY_ERROR_CORRUPTED;
+        }
+    }
+    
     DMINFO("Metadata integrity verification passed");
     return DM_REMAP_V4_REASSEMBLY_SUCCESS;
 }
@@ -0,0 +1,206 @@
+/**
+ * dm-remap-v4-shadow.c - Shadow (dry-run) remap policy (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * The shadow is fed from the I/O error path, so everything here is
+ * irq-safe, bounded and allocation-free. Failing regions are tracked in a
+ * fixed table like the health monitor's hotspots; once it is full, new
+ * regions are counted as untracked rather than simulated.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kstrtox.h>
+#include <linux/log2.h>
+#include <linux/string.h>
+
+#include "../include/dm-remap-v4-shadow.h"
+#include "../include/dm-remap-v4-policy.h"
+
+void dm_remap_shadow_init(struct dm_remap_shadow *shadow)
+{
+    memset(shadow, 0, sizeof(*shadow));
+    spin_lock_init(&shadow->lock);
+}
+
+/* Clear simulated state and decisions. Caller holds shadow->lock. */
+static void __dm_remap_shadow_reset(struct dm_remap_shadow *shadow)
+{
+    memset(shadow->regions, 0, sizeof(shadow->regions));
+    shadow->nr_regions = 0;
+    shadow->last_sector = 0;
+    shadow->consecutive = 0;
+    shadow->predict_score = 0;
+    shadow->errors_seen = 0;
+    shadow->would_remap = 0;
+    shadow->would_migrate = 0;
+    shadow->would_retry = 0;
+    shadow->would_predict = 0;
+    shadow->would_spare_sectors = 0;
+    shadow->untracked = 0;
+}
+
+/**
+ * dm_remap_shadow_configure() - Start a shadow run with new parameters
+ * @defaults: The active policy's parameters, used for keys not given
+ * @argv: "key=value" pairs
+ *
+ * Keys: remap_after, granularity, predict_consecutive, predict_step,
+ * migrate_score. Restarts the simulation from a clean state.
+ */
+int dm_remap_shadow_configure(struct dm_remap_shadow *shadow,
+                              const struct dm_remap_policy_params *defaults,
+                              unsigned int argc, char **argv)
+{
+    struct dm_remap_policy_params params = *defaults;
+    unsigned long flags;
+    unsigned int i;
+    char *val;
+    u32 v;
+
+    for (i = 0; i < argc; i++) {
+        val = strchr(argv[i], '=');
+        if (!val || kstrtou32(val + 1, 0, &v))
+            return -EINVAL;
+        *val = '\0';
+
+        if (!strcasecmp(argv[i], "remap_after") && v >= 1)
+            params.remap_after_errors = v;
+        else if (!strcasecmp(argv[i], "granularity") && is_power_of_2(v) &&
+                 v <= DM_REMAP_POLICY_MAX_GRANULARITY)
+            params.remap_granularity = v;
+        else if (!strcasecmp(argv[i], "predict_consecutive"))
+            params.predict_consecutive = v;
+        else if (!strcasecmp(argv[i], "predict_step") && v <= 100)
+            params.predict_step = v;
+        else if (!strcasecmp(argv[i], "migrate_score") && v <= 100)
+            params.migrate_score = v;
+        else
+            return -EINVAL;
+    }
+
+    spin_lock_irqsave(&shadow->lock, flags);
+    shadow->params = params;
+    __dm_remap_shadow_reset(shadow);
+    shadow->enabled = true;
+    spin_unlock_irqrestore(&shadow->lock, flags);
+    return 0;
+}
+
+void dm_remap_shadow_disable(struct dm_remap_shadow *shadow)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&shadow->lock, flags);
+    shadow->enabled = false;
+    spin_unlock_irqrestore(&shadow->lock, flags);
+}
+
+void dm_remap_shadow_reset(struct dm_remap_shadow *shadow)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&shadow->lock, flags);
+    __dm_remap_shadow_reset(shadow);
+    spin_unlock_irqrestore(&shadow->lock, flags);
+}
+
+/**
+ * dm_remap_shadow_error() - Feed one main-device error to the shadow policy
+ *
+ * Mirrors the active path: the predictor looks at consecutive errors on one
+ * sector, and a region is remapped once it reaches remap_after_errors, or
+ * earlier once the prediction score reaches migrate_score.
+ */
+void dm_remap_shadow_error(struct dm_remap_shadow *shadow, struct dm_remap_event_log *log,
+                           u64 sector)
+{
+    struct dm_remap_policy_params *p = &shadow->params;
+    struct dm_remap_shadow_region *region = NULL;
+    unsigned long flags;
+    u64 start;
+    u32 i;
+
+    spin_lock_irqsave(&shadow->lock, flags);
+    if (!shadow->enabled)
+        goto out;
+
+    shadow->errors_seen++;
+
+    if (shadow->consecutive && shadow->last_sector == sector) {
+        shadow->consecutive++;
+    } else {
+        shadow->consecutive = 1;
+        shadow->last_sector = sector;
+    }
+    if (p->predict_step && shadow->consecutive > p->predict_consecutive) {
+        shadow->predict_score = min(shadow->predict_score + p->predict_step, 100U);
+        shadow->would_predict++;
+        dm_remap_event_record(log, DM_REMAP_EVENT_SHADOW_PREDICT, sector, 1);
+    }
+
+    start = round_down(sector, p->remap_granularity);
+    for (i = 0; i < shadow->nr_regions; i++) {
+        if (shadow->regions[i].sector == start) {
+            region = &shadow->regions[i];
+            break;
+        }
+    }
+    if (!region) {
+        if (shadow->nr_regions == DM_REMAP_SHADOW_TRACKED) {
+            shadow->untracked++;
+            goto out;
+        }
+        region = &shadow->regions[shadow->nr_regions++];
+        region->sector = start;
+    }
+    if (region->remapped)
+        goto out;  /* Errors on the old location no longer reach a remapped region */
+
+    region->errors++;
+    if (region->errors >= p->remap_after_errors) {
+        shadow->would_remap++;
+        dm_remap_event_record(log, DM_REMAP_EVENT_SHADOW_REMAP, start, p->remap_granularity);
+    } else if (p->migrate_score && shadow->predict_score >= p->migrate_score) {
+        shadow->would_migrate++;
+        dm_remap_event_record(log, DM_REMAP_EVENT_SHADOW_MIGRATE, start, p->remap_granularity);
+    } else {
+        shadow->would_retry++;
+        goto out;
+    }
+    region->remapped = true;
+    shadow->would_spare_sectors += p->remap_granularity;
+out:
+    spin_unlock_irqrestore(&shadow->lock, flags);
+}
+
+/**
+ * dm_remap_shadow_format() - Print the shadow configuration and decisions
+ */
+int dm_remap_shadow_format(struct dm_remap_shadow *shadow, char *buf, size_t len)
+{
+    struct dm_remap_policy_params *p = &shadow->params;
+    unsigned long flags;
+    int n;
+
+    spin_lock_irqsave(&shadow->lock, flags);
+    if (!shadow->enabled) {
+        spin_unlock_irqrestore(&shadow->lock, flags);
+        return scnprintf(buf, len, "shadow=off");
+    }
+
+    n = scnprintf(buf, len,
+                  "shadow=on remap_after=%u granularity=%u predict_consecutive=%u "
+                  "predict_step=%u migrate_score=%u errors=%llu would_remap=%llu "
+                  "would_migrate=%llu would_retry=%llu would_predict=%llu "
+                  "would_spare_sectors=%llu predict_score=%u untracked=%llu",
+                  p->remap_after_errors, p->remap_granularity, p->predict_consecutive,
+                  p->predict_step, p->migrate_score,
+                  shadow->errors_seen, shadow->would_remap, shadow->would_migrate,
+                  shadow->would_retry, shadow->would_predict,
+                  shadow->would_spare_sectors, shadow->predict_score, shadow->untracked);
+    spin_unlock_irqrestore(&shadow->lock, flags);
+
+    return n;
+}
@@ -0,0 +1,155 @@
+/**
+ * dm-remap-v4-spare-migrate.c - Copy engine for live spare replacement (v4.3)
+ *
+ * Copyright (C) 2025 dm-remap Development Team
+ *
+ * Sector N of the old spare is copied to sector N of the new one, so the
+ * remap table stays valid unchanged. Only the copy and the dirty map live
+ * here; quiescing spare I/O and switching devices is done by the core.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/bitmap.h>
+#include <linux/blkdev.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+
+#include "../include/dm-remap-v4-spare-migrate.h"
+#include "../include/dm-remap-logging.h"
+
+static const char * const dm_remap_migrate_state_names[] = {
+    [DM_REMAP_MIGRATE_IDLE] = "idle",
+    [DM_REMAP_MIGRATE_COPYING] = "copying",
+    [DM_REMAP_MIGRATE_SWITCHING] = "switching",
+    [DM_REMAP_MIGRATE_DONE] = "done",
+    [DM_REMAP_MIGRATE_FAILED] = "failed",
+    [DM_REMAP_MIGRATE_CANCELLED] = "cancelled",
+};
+
+const char *dm_remap_migrate_state_name(enum dm_remap_migrate_state state)
+{
+    if (state >= ARRAY_SIZE(dm_remap_migrate_state_names))
+        return "unknown";
+    return dm_remap_migrate_state_names[state];
+}
+
+/**
+ * dm_remap_migration_init() - Prepare a copy of @nr_sectors from @src to @dst
+ *
+ * Nothing is marked dirty yet. Process context only.
+ */
+int dm_remap_migration_init(struct dm_remap_spare_migration *m, struct block_device *src,
+                            struct block_device *dst, sector_t nr_sectors)
+{
+    memset(m, 0, sizeof(*m));
+
+    m->nr_chunks = DIV_ROUND_UP(nr_sectors, DM_REMAP_MIGRATE_CHUNK_SECTORS);
+    m->dirty = kvcalloc(BITS_TO_LONGS(m->nr_chunks), sizeof(unsigned long), GFP_KERNEL);
+    if (!m->dirty)
+        return -ENOMEM;
+
+    m->kc = dm_kcopyd_client_create(NULL);
+    if (IS_ERR(m->kc)) {
+        int ret = PTR_ERR(m->kc);
+
+        kvfree(m->dirty);
+        m->dirty = NULL;
+        m->kc = NULL;
+        return ret;
+    }
+
+    m->src = src;
+    m->dst = dst;
+    m->nr_sectors = nr_sectors;
+    atomic_set(&m->pending, 0);
+    init_waitqueue_head(&m->wait);
+    atomic64_set(&m->copied_sectors, 0);
+    return 0;
+}
+
+void dm_remap_migration_destroy(struct dm_remap_spare_migration *m)
+{
+    if (m->kc)
+        dm_kcopyd_client_destroy(m->kc);
+    kvfree(m->dirty);
+    m->kc = NULL;
+    m->dirty = NULL;
+}
+
+/**
+ * dm_remap_migration_mark() - Note that a spare range changed on the old spare
+ *
+ * Called after a write to the old spare has completed, from any context.
+ * Ranges beyond the tracked area are ignored; nothing can be allocated
+ * there while a migration runs.
+ */
+void dm_remap_migration_mark(struct dm_remap_spare_migration *m, sector_t sector,
+                             sector_t nr_sectors)
+{
+    unsigned long chunk, last;
+
+    if (!nr_sectors || sector >= m->nr_sectors)
+        return;
+
+    last = (min(sector + nr_sectors, m->nr_sectors) - 1) / DM_REMAP_MIGRATE_CHUNK_SECTORS;
+    for (chunk = sector / DM_REMAP_MIGRATE_CHUNK_SECTORS; chunk <= last; chunk++)
+        set_bit(chunk, m->dirty);
+}
+
+unsigned long dm_remap_migration_dirty_chunks(struct dm_remap_spare_migration *m)
+{
+    return bitmap_weight(m->dirty, m->nr_chunks);
+}
+
+static void dm_remap_migration_copy_done(int read_err, unsigned long write_err, void *context)
+{
+    struct dm_remap_spare_migration *m = context;
+
+    if (read_err || write_err)
+        cmpxchg(&m->error, 0, -EIO);
+    if (atomic_dec_and_test(&m->pending))
+        wake_up(&m->wait);
+}
+
+/**
+ * dm_remap_migration_copy_pass() - Copy every chunk that is dirty now
+ *
+ * A chunk's bit is cleared before its copy is issued, so a write that
+ * completes on the old spare during the copy sets it again and the chunk
+ * is picked up by the next pass. Waits for all copies. Returns 0 or -EIO.
+ */
+int dm_remap_migration_copy_pass(struct dm_remap_spare_migration *m)
+{
+    struct dm_io_region from, to;
+    unsigned long chunk;
+
+    m->error = 0;
+    atomic_set(&m->pending, 1);  /* Bias until all copies are issued */
+
+    for_each_set_bit(chunk, m->dirty, m->nr_chunks) {
+        if (!test_and_clear_bit(chunk, m->dirty))
+            continue;
+
+        from.bdev = m->src;
+        from.sector = (sector_t)chunk * DM_REMAP_MIGRATE_CHUNK_SECTORS;
+        from.count = min_t(sector_t, DM_REMAP_MIGRATE_CHUNK_SECTORS,
+                           m->nr_sectors - from.sector);
+        to = from;
+        to.bdev = m->dst;
+
+        atomic_inc(&m->pending);
+        atomic64_add(from.count, &m->copied_sectors);
+        dm_kcopyd_copy(m->kc, &from, 1, &to, 0, dm_remap_migration_copy_done, m);
+        cond_resched();
+    }
+
+    if (!atomic_dec_and_test(&m->pending))
+        wait_event(m->wait, !atomic_read(&m->pending));
+
+    m->passes++;
+    DMR_DEBUG(2, "Spare migration pass %u done, %lu chunks dirty again (error=%d)",
+              m->passes, dm_remap_migration_dirty_chunks(m), m->error);
+    return m->error;
+}
@@ -277,6 +277,107 @@ int spare_pool_remove_device(struct spare_pool *pool, const char *dev_path)
 }
 EXPORT_SYMBOL(spare_pool_remove_device);
 
+/*
+ * Find a spare device by path; caller holds spares_lock
+ */
+static struct spare_device *spare_pool_find_device(struct spare_pool *pool,
+						   const char *dev_path)
+{
+	struct spare_device *spare;
+	
+	spare_for_each_device(pool, spare) {
+		if (strcmp(spare->dev_path, dev_path) == 0)
+			return spare;
+	}
+	return NULL;
+}
+
+/*
+ * Pick up a change in a spare device's size
+ *
+ * The new bitmap is allocated before any lock is taken and swapped in
+ * under the device lock, so allocations never wait on memory allocation.
+ * Shrinking is refused while allocations exist beyond the new end.
+ */
+int spare_pool_resize_device(struct spare_pool *pool, const char *dev_path,
+			     sector_t *old_sectors, sector_t *new_sectors)
+{
+	struct spare_device *spare;
+	unsigned long *bitmap, *old_bitmap;
+	unsigned long flags, old_bits, new_bits;
+	size_t bitmap_longs;
+	sector_t sectors;
+	int ret = 0;
+	
+	if (!pool || !dev_path)
+		return -EINVAL;
+	
+	spin_lock_irqsave(&pool->spares_lock, flags);
+	spare = spare_pool_find_device(pool, dev_path);
+	sectors = spare ? get_capacity(spare->bdev->bd_disk) : 0;
+	spin_unlock_irqrestore(&pool->spares_lock, flags);
+	
+	if (!spare) {
+		DMERR("Spare device %s not found in pool", dev_path);
+		return -ENOENT;
+	}
+	if (sectors == 0)
+		return -EINVAL;
+	
+	bitmap_longs = BITS_TO_LONGS(sectors / pool->allocation_unit);
+	bitmap = kcalloc(bitmap_longs, sizeof(unsigned long), GFP_KERNEL);
+	if (!bitmap)
+		return -ENOMEM;
+	
+	spin_lock_irqsave(&pool->spares_lock, flags);
+	/* Removed or replaced while the bitmap was allocated */
+	if (spare_pool_find_device(pool, dev_path) != spare) {
+		spin_unlock_irqrestore(&pool->spares_lock, flags);
+		kfree(bitmap);
+		return -ENOENT;
+	}
+	
+	spin_lock(&spare->lock);
+	*old_sectors = spare->total_sectors;
+	*new_sectors = sectors;
+	old_bits = spare->bitmap_size * BITS_PER_LONG;
+	new_bits = bitmap_longs * BITS_PER_LONG;
+	if (find_next_bit(spare->allocation_bitmap, old_bits,
+			  sectors / pool->allocation_unit) < old_bits) {
+		ret = -EBUSY;
+	} else {
+		bitmap_copy(bitmap, spare->allocation_bitmap, min(old_bits, new_bits));
+		old_bitmap = spare->allocation_bitmap;
+		spare->allocation_bitmap = bitmap;
+		spare->bitmap_size = bitmap_longs;
+		spare->total_sectors = sectors;
+		spare->free_sectors = sectors > spare->allocated_sectors ?
+				      sectors - spare->allocated_sectors : 0;
+		if (spare->free_sectors == 0)
+			spare->state = SPARE_STATE_FULL;
+		else if (spare->state == SPARE_STATE_FULL)
+			spare->state = SPARE_STATE_IN_USE;
+		atomic64_add(sectors - *old_sectors, &pool->total_spare_capacity);
+		bitmap = old_bitmap;
+	}
+	spin_unlock(&spare->lock);
+	spin_unlock_irqrestore(&pool->spares_lock, flags);
+	
+	kfree(bitmap);
+	
+	if (ret) {
+		DMERR("Cannot shrink spare %s to %llu sectors: allocations beyond the new end",
+		      dev_path, (unsigned long long)sectors);
+		return ret;
+	}
+	
+	DMINFO("Resized spare device %s from %llu to %llu sectors",
+	       dev_path, (unsigned long long)*old_sectors,
+	       (unsigned long long)*new_sectors);
+	return 0;
+}
+EXPORT_SYMBOL(spare_pool_resize_device);
+
 /*
  * Find first available sector in spare device using bitmap
  */
@@ -616,6 +717,14 @@ int spare_pool_message(struct spare_pool *pool, unsigned int argc, char **argv)
 		return spare_pool_remove_device(pool, argv[1]);
 	}
 	
+	if (strcmp(argv[0], "spare_resize") == 0) {
+		sector_t old_sectors, new_sectors;
+		
+		if (argc != 2)
+			return -EINVAL;
+		return spare_pool_resize_device(pool, argv[1], &old_sectors, &new_sectors);
+	}
+	
 	if (strcmp(argv[0], "spare_stats") == 0) {
 		spare_pool_print_stats(pool);
 		return 0;
@@ -18,16 +18,12 @@
 #include <linux/mutex.h>
 #include <linux/atomic.h>
 #include "../include/dm-remap-logging.h"
+#include "../include/dm-remap-v4-ondisk.h"
 
 /* Forward declarations */
 struct dm_remap_repair_context;
+struct dm_remap_ioclass;
 struct dm_bufio_client;  /* dm-bufio client for metadata I/O */
-/* v4.0 Constants */
-#define DM_REMAP_METADATA_V4_MAGIC      0x444D5234  /* "DMR4" */
-#define DM_REMAP_METADATA_V4_VERSION    4
-#define DM_REMAP_V4_MAX_REMAPS          2048
-#define DM_REMAP_V4_REDUNDANT_COPIES    5
-#define DM_REMAP_V4_COPY_SECTORS        {0, 1024, 2048, 4096, 8192}
 /* Health scoring constants */
 #define DM_REMAP_HEALTH_PERFECT         100
 #define DM_REMAP_HEALTH_GOOD            80
@@ -35,83 +31,6 @@ struct dm_bufio_client;  /* dm-bufio client for metadata I/O */
 #define DM_REMAP_HEALTH_CRITICAL        40
 #define DM_REMAP_HEALTH_FAILING         20
 
-/**
- * Pure v4.0 Metadata Structure - No Legacy Baggage
- * 
- * Total size: ~24KB (vs 32KB with v3.0 compatibility)
- * Optimized layout for cache performance and minimal I/O
- */
-struct dm_remap_metadata_v4 {
-    /* Streamlined header with single checksum */
-    struct {
-        uint32_t magic;                 /* 0x444D5234 (DMR4) */
-        uint32_t version;               /* Always 4 (no version detection needed) */
-        uint64_t sequence_number;       /* For conflict resolution */
-        uint64_t timestamp;             /* Creation/update time */
-        uint32_t metadata_checksum;     /* Single CRC32 for entire structure */
-        uint32_t copy_index;            /* Which redundant copy (0-4) */
-        uint32_t structure_size;        /* Total metadata size */
-        uint32_t reserved;              /* Future header expansion */
-    } header __attribute__((packed));
-    
-    /* Device identification and configuration */
-    struct {
-        char main_device_uuid[37];      /* Main device UUID */
-        char spare_device_uuid[37];     /* Spare device UUID */
-        uint64_t main_device_sectors;   /* Main device size */
-        uint64_t spare_device_sectors;  /* Spare device size */
-        uint32_t sector_size;           /* Device sector size */
-        uint32_t remap_capacity;        /* Max remaps supported */
-        uint8_t device_fingerprint[32]; /* SHA-256 device fingerprint */
-        char device_model[64];          /* Device model for validation */
-    } device_config __attribute__((packed));
-    
-    /* Health monitoring and scanning */
-    struct {
-        uint64_t last_full_scan;        /* Last complete scan timestamp */
-        uint64_t next_scheduled_scan;   /* Next scan time */
-        uint32_t health_score;          /* Overall health (0-100) */
-        uint32_t scan_progress_percent; /* Current scan progress */
-        uint32_t total_errors_found;    /* Lifetime error count */
-        uint32_t predictive_remaps;     /* Proactive remaps created */
-        uint32_t scan_interval_hours;   /* Configured scan interval */
-        uint32_t scan_flags;            /* Scanning configuration */
-        
-        /* Scan statistics */
-        struct {
-            uint32_t sectors_scanned;
-            uint32_t errors_detected;
-            uint32_t slow_sectors_found;
-            uint32_t scan_interruptions;
-        } scan_stats;
-    } health_data __attribute__((packed));
-    
-    /* Simplified remap table (direct mapping, no indirection) */
-    struct {
-        uint32_t active_remaps;         /* Current number of remaps */
-        uint32_t max_remaps;            /* Maximum capacity */
-        uint32_t next_spare_sector;     /* Next available spare sector */
-        uint32_t remap_flags;           /* Remap behavior flags */
-        
-        /* Direct remap entries (no complex indexing) */
-        struct {
-            uint64_t original_sector;   /* Failing sector */
-            uint64_t spare_sector;      /* Replacement sector */
-            uint64_t remap_timestamp;   /* When remap was created */
-            uint32_t access_count;      /* Usage counter */
-            uint32_t error_count;       /* Errors on original sector */
-            uint16_t remap_reason;      /* Why remap was created */
-            uint16_t flags;             /* Remap-specific flags */
-        } remaps[DM_REMAP_V4_MAX_REMAPS];
-    } remap_data __attribute__((packed));
-    
-    /* Future expansion without breaking compatibility */
-    struct {
-        uint32_t expansion_version;     /* For future v4.x features */
-        uint32_t expansion_size;        /* Bytes used in expansion area */
-        uint8_t expansion_data[2048];   /* Reserved for v4.1, v4.2, etc. */
-    } future_expansion __attribute__((packed));
-} __attribute__((packed));
 /**
  * Background Health Scanner Structure
  */
@@ -239,7 +158,7 @@ int dm_remap_read_metadata_v4_with_repair(struct block_device *bdev,
                                           struct dm_remap_repair_context *repair_ctx);
 int dm_remap_write_metadata_v4(struct block_device *bdev,
                                struct dm_remap_metadata_v4 *metadata);
-int dm_remap_repair_metadata_v4(struct block_device *bdev);
+int dm_remap_repair_metadata_v4(struct dm_bufio_client *client);
 void dm_remap_init_metadata_v4(struct dm_remap_metadata_v4 *metadata,
                                const char *main_device_uuid,
                                const char *spare_device_uuid,
@@ -308,6 +227,18 @@ struct dm_remap_async_metadata_context {
 int dm_remap_write_metadata_v4_async(struct dm_bufio_client *bufio_client,
                                      struct dm_remap_metadata_v4 *metadata,
                                      struct dm_remap_async_metadata_context *context);
+/**
+ * dm_remap_write_metadata_v4_sync - Write metadata and wait until it is durable
+ * @bufio_client: dm-bufio client for the spare device
+ * @metadata: Metadata structure to write
+ * 
+ * Like dm_remap_write_metadata_v4_async(), but also writes back the dirty
+ * buffers and flushes the spare device before returning. Process context only.
+ * 
+ * Returns: 0 on success, negative error code on failure
+ */
+int dm_remap_write_metadata_v4_sync(struct dm_bufio_client *bufio_client,
+                                    struct dm_remap_metadata_v4 *metadata);
 /**
  * dm_remap_cancel_metadata_write - Cancel in-flight async metadata write
  * @context: Async context for the write to cancel
@@ -372,7 +303,9 @@ struct dm_remap_repair_context {
 	
 	/* References */
 	struct block_device *spare_bdev;  /* Spare device for metadata repair */
+	struct dm_bufio_client *bufio_client;  /* v4.3: Metadata copies to repair */
 	struct workqueue_struct *repair_wq;  /* Repair workqueue */
+	struct dm_remap_ioclass *ioclass;    /* v4.3: cgroups and priorities, or NULL */
 };
 /**
  * dm_remap_schedule_metadata_repair - Schedule metadata repair
@@ -129,6 +129,11 @@ echo -e "\n${BLUE}Device Status:${NC}"
 sudo dmsetup status dm-remap-v4-perf
 sudo dmsetup table dm-remap-v4-perf
 
+# v4.3: remap creation stage timing and metadata cost (see test_v4.3_remap_pipeline.sh
+# for a run that actually creates remaps)
+echo -e "\n${BLUE}Remap Pipeline:${NC}"
+sudo dmsetup message dm-remap-v4-perf 0 pipeline
+
 echo -e "\n${BLUE}=== I/O Pattern Analysis ===${NC}"
 
 # Test different I/O patterns
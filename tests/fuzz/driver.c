@@ -0,0 +1,92 @@
+/*
+ * driver.c - Standalone main() for the fuzz targets (not used with libFuzzer)
+ *
+ *   ./fuzz_x                 read one input from stdin (AFL without @@)
+ *   ./fuzz_x FILE|DIR...     run every file given, recursing into directories
+ */
+
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "fuzz.h"
+
+static int run_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t *data = NULL;
+    size_t size = 0, cap = 0, n;
+
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    do {
+        if (size == cap) {
+            cap = cap ? cap * 2 : 65536;
+            data = realloc(data, cap);
+            if (!data)
+                abort();
+        }
+        n = fread(data + size, 1, cap - size, f);
+        size += n;
+    } while (n);
+    fclose(f);
+
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+    return 0;
+}
+
+static int run_path(const char *path)
+{
+    struct dirent *de;
+    struct stat st;
+    char sub[4096];
+    DIR *dir;
+    int ret = 0;
+
+    if (stat(path, &st)) {
+        perror(path);
+        return 1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        printf("  %s\n", path);
+        return run_file(path);
+    }
+
+    dir = opendir(path);
+    if (!dir) {
+        perror(path);
+        return 1;
+    }
+    while ((de = readdir(dir))) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+        ret |= run_path(sub);
+    }
+    closedir(dir);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    int i, ret = 0;
+
+    if (argc < 2) {
+        uint8_t *data = malloc(1 << 20);
+        size_t size;
+
+        if (!data)
+            abort();
+        size = fread(data, 1, 1 << 20, stdin);
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+        return 0;
+    }
+
+    for (i = 1; i < argc; i++)
+        ret |= run_path(argv[i]);
+    return ret;
+}
@@ -0,0 +1,102 @@
+/*
+ * fuzz.h - Shared helpers for the dm-remap fuzz targets
+ *
+ * Each target defines LLVMFuzzerTestOneInput(). With libFuzzer that is the
+ * entry point; otherwise driver.c provides main() and feeds it files, which
+ * also serves AFL (afl-fuzz ... -- ./fuzz_x @@) and regression runs.
+ *
+ * Targets check their own invariants and abort() on a violation, so a
+ * logic bug is reported like a memory error.
+ */
+
+#ifndef DM_REMAP_FUZZ_H
+#define DM_REMAP_FUZZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+#define FUZZ_CHECK(cond)                                                     \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: invariant violated: %s\n",               \
+                    __FILE__, __LINE__, #cond);                              \
+            abort();                                                         \
+        }                                                                    \
+    } while (0)
+
+#define FUZZ_MAX_ARGS 32
+
+/*
+ * Split @data into whitespace-separated words the way dmsetup hands them to
+ * the target. Returns argc; @buf (size + 1 bytes) holds the strings.
+ */
+static inline unsigned int fuzz_split_args(const uint8_t *data, size_t size, char *buf,
+                                           char **argv)
+{
+    unsigned int argc = 0;
+    size_t i;
+    int in_word = 0;
+
+    for (i = 0; i < size; i++) {
+        char c = (char)data[i];
+
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\0') {
+            buf[i] = '\0';
+            in_word = 0;
+            continue;
+        }
+        buf[i] = c;
+        if (!in_word && argc < FUZZ_MAX_ARGS)
+            argv[argc++] = &buf[i];
+        in_word = 1;
+    }
+    buf[size] = '\0';
+    return argc;
+}
+
+#ifdef DM_REMAP_V4_MESSAGE_H
+/*
+ * Settings must be in range, and the table line the target reports for
+ * them must parse back to the same settings, or a reload would change them.
+ */
+static inline void fuzz_check_tunables(const struct dm_remap_tunables *t)
+{
+    char line[1024] = "main spare";
+    char *argv[FUZZ_MAX_ARGS];
+    struct dm_remap_table_args args;
+    char *error = NULL;
+    unsigned int argc;
+    int n;
+
+    FUZZ_CHECK(t->scan_interval >= 1 && t->scan_interval <= DM_REMAP_MAX_SCAN_INTERVAL);
+    FUZZ_CHECK(t->cache_size <= DM_REMAP_MAX_CACHE_SIZE);
+    FUZZ_CHECK(!t->cache_size || is_power_of_2(t->cache_size));
+    FUZZ_CHECK(t->commit_policy <= DM_REMAP_COMMIT_SYNC);
+    FUZZ_CHECK(!t->remap_granularity || is_power_of_2(t->remap_granularity));
+    for (n = 0; n < DM_REMAP_NR_ERROR_CLASSES; n++)
+        FUZZ_CHECK(t->error_action[n] <= DM_REMAP_ACT_COUNT);
+    FUZZ_CHECK(t->retry_limit <= DM_REMAP_MAX_RETRY_LIMIT);
+    FUZZ_CHECK(t->shrink_policy <= DM_REMAP_SHRINK_DROP);
+    for (n = 0; n < DM_REMAP_NR_IO_SOURCES; n++) {
+        FUZZ_CHECK((t->ioprio[n] >> DM_REMAP_IOPRIO_CLASS_SHIFT) <= DM_REMAP_IOPRIO_IDLE);
+        FUZZ_CHECK(!t->cgroup[n][0] || t->cgroup[n][0] == '/');
+        FUZZ_CHECK(!t->cgroup[n][DM_REMAP_CGROUP_PATH_LEN - 1]);
+    }
+    FUZZ_CHECK(t->correlated_action <= DM_REMAP_ACT_COUNT);
+    FUZZ_CHECK(!t->error_domain[DM_REMAP_DOMAIN_NAME_LEN - 1]);
+    FUZZ_CHECK(!strchr(t->error_domain, ' ') && !strchr(t->error_domain, '\\'));
+
+    n = dm_remap_tunables_format(t, true, line + 10, sizeof(line) - 10);
+    FUZZ_CHECK(n >= 0 && 10 + n < (int)sizeof(line) - 1);
+    argc = fuzz_split_args((const uint8_t *)line, strlen(line), line, argv);
+    FUZZ_CHECK(dm_remap_parse_table_args(argc, argv, &args, &error) == 0);
+    FUZZ_CHECK(!memcmp(&args.tunables, t, sizeof(*t)));
+}
+#endif
+
+#endif /* DM_REMAP_FUZZ_H */
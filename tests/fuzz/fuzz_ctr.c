@@ -0,0 +1,86 @@
+/*
+ * fuzz_ctr.c - Fuzz table line parsing
+ *
+ * "<main_device> <spare_device> [<metadata_device> <metadata_offset>]
+ *  [<#features> <key> <value>...]", and the line the target reports for it.
+ */
+
+#include <linux/kernel.h>
+
+#include "dm-remap-v4-message.h"
+#include "fuzz.h"
+
+/* The table line the target reports must load the same table again */
+static void check_table_line(const struct dm_remap_table_args *args)
+{
+    size_t len = strlen(args->main_path) + strlen(args->spare_path) + 1024;
+    struct dm_remap_table_args again;
+    char *argv[FUZZ_MAX_ARGS];
+    char *line, *error = NULL;
+    unsigned int argc;
+    int n;
+
+    if (args->metadata_path)
+        len += strlen(args->metadata_path);
+    if (args->overlay_path)
+        len += strlen(args->overlay_path);
+    line = malloc(len);
+    if (!line)
+        abort();
+
+    n = dm_remap_table_args_format(args, line, len);
+    FUZZ_CHECK(n > 0 && (size_t)n < len - 1);
+    argc = fuzz_split_args((const uint8_t *)line, n, line, argv);
+    FUZZ_CHECK(dm_remap_parse_table_args(argc, argv, &again, &error) == 0);
+    FUZZ_CHECK(!strcmp(again.main_path, args->main_path));
+    FUZZ_CHECK(!strcmp(again.spare_path, args->spare_path));
+    FUZZ_CHECK(!again.metadata_path == !args->metadata_path);
+    FUZZ_CHECK(!args->metadata_path || (!strcmp(again.metadata_path, args->metadata_path) &&
+                                        again.metadata_offset == args->metadata_offset));
+    FUZZ_CHECK(again.read_only == args->read_only);
+    FUZZ_CHECK(!again.overlay_path == !args->overlay_path);
+    FUZZ_CHECK(!args->overlay_path || !strcmp(again.overlay_path, args->overlay_path));
+    FUZZ_CHECK(!memcmp(&again.tunables, &args->tunables, sizeof(args->tunables)));
+    free(line);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char *argv[FUZZ_MAX_ARGS];
+    struct dm_remap_table_args args;
+    char *error = NULL;
+    unsigned int argc;
+    char *buf;
+
+    buf = malloc(size + 1);
+    if (!buf)
+        abort();
+    argc = fuzz_split_args(data, size, buf, argv);
+
+    if (dm_remap_parse_table_args(argc, argv, &args, &error)) {
+        FUZZ_CHECK(error != NULL);
+    } else {
+        FUZZ_CHECK(args.main_path && *args.main_path);
+        FUZZ_CHECK(args.spare_path && *args.spare_path);
+        FUZZ_CHECK(strcmp(args.main_path, args.spare_path) != 0);
+        FUZZ_CHECK(argc == 2 || argc == 4 || argc % 2 == 1);
+        if (args.metadata_path) {
+            FUZZ_CHECK(argc >= 4 && *args.metadata_path);
+            FUZZ_CHECK(strcmp(args.metadata_path, args.main_path) != 0);
+            FUZZ_CHECK(strcmp(args.metadata_path, args.spare_path) != 0);
+            FUZZ_CHECK(args.metadata_offset % DM_REMAP_METADATA_OFFSET_ALIGN == 0);
+        } else {
+            FUZZ_CHECK(argc != 4);
+        }
+        if (args.overlay_path) {
+            FUZZ_CHECK(args.read_only && *args.overlay_path);
+            FUZZ_CHECK(strcmp(args.overlay_path, args.main_path) != 0);
+            FUZZ_CHECK(strcmp(args.overlay_path, args.spare_path) != 0);
+        }
+        fuzz_check_tunables(&args.tunables);
+        check_table_line(&args);
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * fuzz_message.c - Fuzz "dmsetup message" parsing
+ *
+ * Input: one byte selecting the reply buffer size, then the message text.
+ * Runs dm_remap_message_parse() and, for the commands whose arguments are
+ * consumed outside the parser (shadow set, events), the code that consumes
+ * them, formatting into the short reply buffer as the target would. "pipeline"
+ * formats histograms filled across every bucket.
+ */
+
+#include <linux/kernel.h>
+
+#include "dm-remap-v4-message.h"
+#include "dm-remap-v4-shadow.h"
+#include "dm-remap-v4-events.h"
+#include "dm-remap-v4-pipeline.h"
+#include "fuzz.h"
+
+static struct dm_remap_shadow shadow;
+static struct dm_remap_event_log events;
+static struct dm_remap_pipeline_stats pipeline;
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    const struct dm_remap_policy_params defaults = {
+        .remap_after_errors = 1,
+        .remap_granularity = 8,
+        .predict_consecutive = DM_REMAP_PREDICT_CONSECUTIVE,
+        .predict_step = DM_REMAP_PREDICT_STEP,
+        .migrate_score = 0,
+    };
+    char *argv[FUZZ_MAX_ARGS];
+    struct dm_remap_msg msg;
+    unsigned int argc, maxlen, i;
+    char *buf, *result;
+    int ret, n;
+
+    if (size < 1)
+        return 0;
+    maxlen = data[0] + 1;
+    data++;
+    size--;
+
+    buf = malloc(size + 1);
+    result = malloc(maxlen);
+    if (!buf || !result)
+        abort();
+    argc = fuzz_split_args(data, size, buf, argv);
+
+    ret = dm_remap_message_parse(argc, argv, &msg);
+    if (ret) {
+        FUZZ_CHECK(ret == -EINVAL);
+        goto out;
+    }
+
+    switch (msg.cmd) {
+    case DM_REMAP_MSG_TEST_REMAP:
+        FUZZ_CHECK(argc == 3);
+        break;
+    case DM_REMAP_MSG_EVENTS:
+        dm_remap_event_log_init(&events);
+        for (i = 0; i < 2 * DM_REMAP_EVENT_RING_SIZE; i++)
+            dm_remap_event_record(&events, i % DM_REMAP_EVENT_MAX, i, 8);
+        n = dm_remap_event_format(&events, msg.arg[0], result, maxlen);
+        FUZZ_CHECK(n >= 0 && (unsigned int)n < maxlen);
+        break;
+    case DM_REMAP_MSG_PIPELINE:
+        FUZZ_CHECK(argc == 1);
+        dm_remap_pipeline_init(&pipeline);
+        for (i = 0; i < 64; i++)
+            dm_remap_pipeline_record(&pipeline, i % DM_REMAP_PIPE_NR_STAGES, 1ULL << i);
+        dm_remap_pipeline_remap(&pipeline, 4096);
+        dm_remap_pipeline_metadata_write(&pipeline, U64_MAX);
+        for (i = 0; i < DM_REMAP_PIPE_NR_STAGES; i++)
+            FUZZ_CHECK(pipeline.stage[i].buckets[DM_REMAP_PIPE_BUCKETS - 1] > 0);
+        n = dm_remap_pipeline_format(&pipeline, result, maxlen);
+        FUZZ_CHECK(n >= 0 && (unsigned int)n < maxlen);
+        break;
+    case DM_REMAP_MSG_SHADOW:
+        dm_remap_shadow_init(&shadow);
+        dm_remap_event_log_init(&events);
+        if (msg.op == DM_REMAP_MSG_SHADOW_SET) {
+            FUZZ_CHECK(msg.argv + msg.argc == argv + argc);
+            if (dm_remap_shadow_configure(&shadow, &defaults, msg.argc, msg.argv))
+                break;
+            FUZZ_CHECK(is_power_of_2(shadow.params.remap_granularity));
+            FUZZ_CHECK(shadow.params.remap_after_errors >= 1);
+            for (i = 0; i < 4 * DM_REMAP_SHADOW_TRACKED; i++)
+                dm_remap_shadow_error(&shadow, &events, (i * 7) % 3000);
+        }
+        n = dm_remap_shadow_format(&shadow, result, maxlen);
+        FUZZ_CHECK(n >= 0 && (unsigned int)n < maxlen);
+        break;
+    case DM_REMAP_MSG_SET: {
+        struct dm_remap_tunables tunables, before;
+
+        FUZZ_CHECK(msg.argc == 0 || msg.argc == 2);
+        dm_remap_tunables_init(&tunables);
+        before = tunables;
+        if (msg.argc && dm_remap_tunable_set(&tunables, msg.argv[0], msg.argv[1]))
+            FUZZ_CHECK(!memcmp(&tunables, &before, sizeof(tunables)));
+        fuzz_check_tunables(&tunables);
+        n = dm_remap_tunables_format(&tunables, false, result, maxlen);
+        FUZZ_CHECK(n >= 0 && (unsigned int)n < maxlen);
+        break;
+    }
+    case DM_REMAP_MSG_INJECT_ERROR:
+        FUZZ_CHECK(argc == 2 || argc == 3);
+        FUZZ_CHECK(msg.argc == 1 && msg.argv[0] && *msg.argv[0]);
+        FUZZ_CHECK(argc == 3 || msg.arg[0] == 1);
+        break;
+    case DM_REMAP_MSG_REPLACE_SPARE:
+        FUZZ_CHECK(msg.argc == argc - 1);
+        FUZZ_CHECK((msg.op == DM_REMAP_MSG_REPLACE_SHOW) == (argc == 1));
+        if (msg.op == DM_REMAP_MSG_REPLACE_START)
+            FUZZ_CHECK(msg.argv[0] && *msg.argv[0] && strcasecmp(msg.argv[0], "cancel"));
+        break;
+    case DM_REMAP_MSG_FLATTEN:
+        FUZZ_CHECK(msg.argc == argc - 1);
+        FUZZ_CHECK((msg.op == DM_REMAP_MSG_FLATTEN_SHOW) == (argc == 1));
+        if (msg.op == DM_REMAP_MSG_FLATTEN_START)
+            FUZZ_CHECK(msg.argv[0] && *msg.argv[0] && strcasecmp(msg.argv[0], "cancel"));
+        break;
+    default:
+        FUZZ_CHECK(argc == 1);
+        break;
+    }
+
+out:
+    free(result);
+    free(buf);
+    return 0;
+}
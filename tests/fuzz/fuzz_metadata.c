@@ -0,0 +1,116 @@
+/*
+ * fuzz_metadata.c - Fuzz the v4 metadata copy parser
+ *
+ * Input: one flags byte, then up to DM_REMAP_V4_REDUNDANT_COPIES raw
+ * struct dm_remap_metadata_v4 images back to back (missing bytes read as
+ * zero, like a short spare device). With FLAG_FIX_CRC set the checksum of
+ * each copy is recomputed first, so mutations reach the checks behind it.
+ *
+ * Mirrors dm_remap_read_metadata_v4_bufio_with_repair() followed by the
+ * restore loop of dm_remap_read_persistent_metadata().
+ */
+
+#include <linux/kernel.h>
+
+#include "dm-remap-v4.h"
+#include "fuzz.h"
+
+#define FLAG_FIX_CRC 0x01
+
+static struct dm_remap_metadata_v4 copies[DM_REMAP_V4_REDUNDANT_COPIES];
+
+static u64 spare_len(u16 flags)
+{
+    if (flags & DM_REMAP_V4_REMAP_ZERO)
+        return 0;
+    if (flags & DM_REMAP_V4_REMAP_COMPRESSED)
+        return DM_REMAP_V4_REMAP_CLEN(flags);
+    return 1;
+}
+
+static void check_remap_table(const struct dm_remap_metadata_v4 *meta)
+{
+    u64 main = meta->device_config.main_device_sectors;
+    u64 spare = meta->device_config.spare_device_sectors;
+    u64 start, len, other, other_len;
+    u32 i, j;
+
+    /* What the restore loop relies on once a copy is accepted */
+    FUZZ_CHECK(meta->remap_data.active_remaps <= DM_REMAP_V4_MAX_REMAPS);
+    FUZZ_CHECK(!spare || meta->remap_data.next_spare_sector <= spare);
+    for (i = 0; i < meta->remap_data.active_remaps; i++) {
+        u16 flags = meta->remap_data.remaps[i].flags;
+        bool zero = flags & DM_REMAP_V4_REMAP_ZERO;
+
+        start = meta->remap_data.remaps[i].spare_sector;
+        len = spare_len(flags);
+        FUZZ_CHECK(!main || meta->remap_data.remaps[i].original_sector < main);
+        if (zero) {
+            /* Never read from the spare, in particular not the metadata area */
+            FUZZ_CHECK(start == 0);
+            FUZZ_CHECK(!(flags & DM_REMAP_V4_REMAP_COMPRESSED));
+        } else {
+            FUZZ_CHECK(len >= 1 && len < DM_REMAP_V4_COMPRESS_SECTORS);
+            FUZZ_CHECK(start >= DM_REMAP_V4_SPARE_DATA_START);
+            FUZZ_CHECK(!spare || (start < spare && len <= spare - start));
+        }
+        for (j = 0; j < i; j++) {
+            FUZZ_CHECK(meta->remap_data.remaps[j].original_sector !=
+                       meta->remap_data.remaps[i].original_sector);
+            other = meta->remap_data.remaps[j].spare_sector;
+            other_len = spare_len(meta->remap_data.remaps[j].flags);
+            if (!len || !other_len || start >= other + other_len || other >= start + len)
+                continue;
+            /* Overlapping spare space: one compressed extent of one unit */
+            FUZZ_CHECK(start == other && (flags & DM_REMAP_V4_REMAP_COMPRESSED) && len == other_len);
+            FUZZ_CHECK(meta->remap_data.remaps[j].original_sector / DM_REMAP_V4_COMPRESS_SECTORS ==
+                       meta->remap_data.remaps[i].original_sector / DM_REMAP_V4_COMPRESS_SECTORS);
+        }
+    }
+
+    /* Smaller devices than recorded must only ever tighten the result */
+    if (main > 1 && spare > 1 &&
+        dm_remap_validate_remap_table_v4(meta, main / 2, spare / 2) == 0)
+        FUZZ_CHECK(dm_remap_validate_remap_table_v4(meta, main, spare) == 0);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    bool valid[DM_REMAP_V4_REDUNDANT_COPIES];
+    u64 best_seq = 0;
+    int i, best, valid_count = 0;
+    uint8_t flags;
+
+    if (size < 1)
+        return 0;
+    flags = data[0];
+    data++;
+    size--;
+
+    memset(copies, 0, sizeof(copies));
+    memcpy(copies, data, min(size, sizeof(copies)));
+
+    for (i = 0; i < DM_REMAP_V4_REDUNDANT_COPIES; i++) {
+        if (flags & FLAG_FIX_CRC)
+            copies[i].header.metadata_checksum = dm_remap_metadata_v4_crc32(&copies[i]);
+
+        valid[i] = dm_remap_validate_metadata_v4(&copies[i]) == 0;
+        if (valid[i]) {
+            valid_count++;
+            check_remap_table(&copies[i]);
+            if (copies[i].header.sequence_number > best_seq)
+                best_seq = copies[i].header.sequence_number;
+        }
+    }
+
+    best = dm_remap_select_metadata_copy_v4(copies, valid, DM_REMAP_V4_REDUNDANT_COPIES);
+    if (!valid_count) {
+        FUZZ_CHECK(best == -ENODATA);
+        return 0;
+    }
+    FUZZ_CHECK(best >= 0 && best < DM_REMAP_V4_REDUNDANT_COPIES);
+    FUZZ_CHECK(valid[best]);
+    FUZZ_CHECK(copies[best].header.sequence_number == best_seq);
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * fuzz_reassembly.c - Fuzz setup-reassembly metadata verification
+ *
+ * Input: one flags byte, the discovery counters (copies_found, copies_valid,
+ * corruption_level; u32 each), then a raw struct dm_remap_v4_setup_metadata. With FLAG_FIX_CRC set the header and overall
+ * CRCs are recomputed first. Whatever dm_remap_v4_verify_metadata_integrity()
+ * accepts is then walked the way discovery and storage walk it.
+ */
+
+#include <linux/kernel.h>
+
+#include "dm-remap-v4-setup-reassembly.h"
+#include "fuzz.h"
+
+#define FLAG_FIX_CRC 0x01
+
+static struct dm_remap_v4_discovery_result result;
+
+/* Reads that go past the array they index stay inside the structure, where
+ * ASan cannot see them, so the bounds are checked explicitly as well */
+static void walk_metadata(const struct dm_remap_v4_setup_metadata *meta)
+{
+    char path[DM_REMAP_V4_MAX_DEVICE_PATH];
+    uint32_t i;
+
+    FUZZ_CHECK(meta->num_spare_devices <= DM_REMAP_V4_MAX_SPARE_DEVICES);
+    FUZZ_CHECK(meta->sysfs_config.num_settings <= DM_REMAP_V4_MAX_SYSFS_SETTINGS);
+    FUZZ_CHECK(meta->policy_config.num_rules <= DM_REMAP_V4_MAX_POLICY_RULES);
+    FUZZ_CHECK(meta->metadata_copies_count <= DM_REMAP_V4_METADATA_COPY_SECTORS);
+    FUZZ_CHECK(strnlen(meta->setup_description, sizeof(meta->setup_description)) <
+               sizeof(meta->setup_description));
+    FUZZ_CHECK(strnlen(meta->main_device.device_path, sizeof(meta->main_device.device_path)) <
+               sizeof(meta->main_device.device_path));
+    FUZZ_CHECK(strnlen(meta->target_config.target_params,
+                       sizeof(meta->target_config.target_params)) <
+               sizeof(meta->target_config.target_params));
+
+    dm_remap_v4_print_setup_metadata(meta);
+    for (i = 0; i < meta->num_spare_devices; i++) {
+        const char *p = meta->spare_devices[i].spare_fingerprint.device_path;
+
+        FUZZ_CHECK(strnlen(p, DM_REMAP_V4_MAX_DEVICE_PATH) < DM_REMAP_V4_MAX_DEVICE_PATH);
+        snprintf(path, sizeof(path), "%s", p);
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    struct dm_remap_v4_setup_metadata *meta = &result.metadata;
+    uint32_t score;
+    uint8_t flags;
+    size_t n;
+
+    if (size < 1)
+        return 0;
+    flags = data[0];
+    data++;
+    size--;
+
+    memset(&result, 0, sizeof(result));
+    if (size >= 3 * sizeof(uint32_t)) {
+        memcpy(&result.copies_found, data, sizeof(uint32_t));
+        memcpy(&result.copies_valid, data + 4, sizeof(uint32_t));
+        memcpy(&result.corruption_level, data + 8, sizeof(uint32_t));
+        data += 3 * sizeof(uint32_t);
+        size -= 3 * sizeof(uint32_t);
+    }
+    n = min(size, sizeof(*meta));
+    memcpy(meta, data, n);
+
+    if (flags & FLAG_FIX_CRC)
+        dm_remap_v4_update_metadata_version(meta);
+
+    score = dm_remap_v4_calculate_confidence_score(&result);
+    FUZZ_CHECK(score <= 100);
+
+    if (dm_remap_v4_verify_metadata_integrity(meta) == DM_REMAP_V4_REASSEMBLY_SUCCESS)
+        walk_metadata(meta);
+
+    return 0;
+}
@@ -0,0 +1,597 @@
+/*
+ * gen_corpus.c - Seed corpus, regression inputs and fault-injected images
+ *
+ *   gen_corpus CORPUS_DIR REGRESSION_DIR
+ *       Write the seed corpus and the regression inputs for every target.
+ *
+ *   gen_corpus image OUT SPARE_SECTORS MAIN_SECTORS SEED [raw]
+ *       Write a spare device image: five metadata copies at their dm-bufio
+ *       blocks, with the remap table of some copies damaged according to
+ *       SEED. Checksums are recomputed unless "raw" is given, so the damage
+ *       gets past the CRC and reaches the kernel's table validation. Used by
+ *       fuzz_activation.sh.
+ *
+ * Built against the real metadata code so layouts and checksums can never
+ * drift from what the target reads. Binary inputs are written without
+ * trailing zero bytes; the targets zero-fill short inputs.
+ */
+
+#include <linux/kernel.h>
+#include <time.h>
+
+#include "dm-remap-v4.h"
+#include "dm-remap-v4-setup-reassembly.h"
+
+#define FLAG_FIX_CRC 0x01
+
+static void write_file(const char *dir, const char *name, const void *data, size_t size,
+                       bool trim)
+{
+    const uint8_t *b = data;
+    char path[4096];
+    FILE *f;
+
+    while (trim && size && !b[size - 1])
+        size--;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    f = fopen(path, "wb");
+    if (!f || fwrite(data, 1, size, f) != size || fclose(f)) {
+        perror(path);
+        exit(1);
+    }
+}
+
+/* Returns "@base/@target", created if needed */
+static const char *make_dir(const char *base, const char *target)
+{
+    static char dirs[8][4096];
+    static unsigned int next;
+    char *dir = dirs[next++ % ARRAY_SIZE(dirs)];
+
+    snprintf(dir, sizeof(dirs[0]), "%s", base);
+    mkdir(dir, 0755);
+    snprintf(dir, sizeof(dirs[0]), "%s/%s", base, target);
+    if (mkdir(dir, 0755) && errno != EEXIST) {
+        perror(dir);
+        exit(1);
+    }
+    return dir;
+}
+
+/* ---- v4 metadata ------------------------------------------------------ */
+
+struct metadata_input {
+    uint8_t flags;
+    struct dm_remap_metadata_v4 copies[DM_REMAP_V4_REDUNDANT_COPIES];
+} __packed;
+
+static struct metadata_input meta_in;
+
+static void init_copy(struct dm_remap_metadata_v4 *m, uint64_t seq, uint32_t nr_remaps)
+{
+    uint32_t i;
+
+    memset(m, 0, sizeof(*m));
+    m->header.magic = DM_REMAP_METADATA_V4_MAGIC;
+    m->header.version = DM_REMAP_METADATA_V4_VERSION;
+    m->header.sequence_number = seq;
+    m->header.timestamp = DM_REMAP_FUZZ_NOW - 3600;
+    m->header.structure_size = sizeof(*m);
+    m->device_config.main_device_sectors = 1 << 20;
+    m->device_config.spare_device_sectors = 1 << 18;
+    m->device_config.sector_size = 512;
+    m->health_data.health_score = 100;
+    m->remap_data.max_remaps = DM_REMAP_V4_MAX_REMAPS;
+    m->remap_data.active_remaps = nr_remaps;
+    for (i = 0; i < nr_remaps; i++) {
+        m->remap_data.remaps[i].original_sector = 1000 + 8 * i;
+        m->remap_data.remaps[i].spare_sector = DM_REMAP_V4_SPARE_DATA_START + i;
+        m->remap_data.remaps[i].remap_timestamp = DM_REMAP_FUZZ_NOW - 60;
+        m->remap_data.remaps[i].error_count = 1;
+    }
+    m->remap_data.next_spare_sector = DM_REMAP_V4_SPARE_DATA_START + nr_remaps;
+}
+
+static void seal(struct dm_remap_metadata_v4 *m, uint32_t copy_index)
+{
+    m->header.copy_index = copy_index;
+    m->header.metadata_checksum = dm_remap_metadata_v4_crc32(m);
+}
+
+static void write_metadata(const char *dir, const char *name, uint8_t flags, int nr_copies)
+{
+    int i;
+
+    meta_in.flags = flags;
+    for (i = 0; i < nr_copies; i++)
+        seal(&meta_in.copies[i], i);
+    write_file(dir, name, &meta_in, 1 + nr_copies * sizeof(meta_in.copies[0]), true);
+}
+
+/* Ten remaps, the first eight one unit compressed into 3 spare sectors */
+static void init_compressed(struct dm_remap_metadata_v4 *m)
+{
+    uint32_t i;
+
+    init_copy(m, 4, 10);
+    for (i = 0; i < 8; i++) {
+        m->remap_data.remaps[i].original_sector = 4096 + i;
+        m->remap_data.remaps[i].spare_sector = DM_REMAP_V4_SPARE_DATA_START + 16;
+        m->remap_data.remaps[i].flags = DM_REMAP_V4_REMAP_COMPRESSED |
+                                        (3 << DM_REMAP_V4_REMAP_CLEN_SHIFT);
+    }
+    m->remap_data.next_spare_sector = DM_REMAP_V4_SPARE_DATA_START + 19;
+}
+
+static void gen_metadata(const char *corpus, const char *regress)
+{
+    int i;
+
+    /* Seeds */
+    init_copy(&meta_in.copies[0], 1, 0);
+    write_metadata(corpus, "empty_1copy", 0, 1);
+
+    init_copy(&meta_in.copies[0], 7, 16);
+    write_metadata(corpus, "remaps_1copy", 0, 1);
+    write_metadata(corpus, "remaps_fixcrc", FLAG_FIX_CRC, 1);
+
+    for (i = 0; i < 3; i++)
+        init_copy(&meta_in.copies[i], 5 + i, 4 + i);
+    write_metadata(corpus, "three_generations", 0, 3);
+    meta_in.copies[2].remap_data.remaps[0].spare_sector ^= 1;  /* Torn newest copy */
+    write_file(corpus, "torn_newest", &meta_in, 1 + 3 * sizeof(meta_in.copies[0]), true);
+
+    init_copy(&meta_in.copies[0], 3, 2);
+    seal(&meta_in.copies[0], 0);
+    meta_in.copies[0].header.magic ^= 0xff;
+    write_file(corpus, "bad_magic", &meta_in, 1 + sizeof(meta_in.copies[0]), true);
+
+    init_copy(&meta_in.copies[0], 3, 2);
+    meta_in.copies[0].header.timestamp = DM_REMAP_FUZZ_NOW * 1000000000ULL;
+    write_metadata(corpus, "timestamp_ns", 0, 1);
+
+    init_copy(&meta_in.copies[0], 4, 6);
+    for (i = 1; i < 6; i += 2) {
+        meta_in.copies[0].remap_data.remaps[i].spare_sector = 0;
+        meta_in.copies[0].remap_data.remaps[i].flags = DM_REMAP_V4_REMAP_ZERO;
+    }
+    write_metadata(corpus, "zero_remaps", 0, 1);
+
+    init_compressed(&meta_in.copies[0]);
+    write_metadata(corpus, "compressed_unit", 0, 1);
+
+    /* Regressions: tables that passed the CRC but not a sanity check */
+    init_copy(&meta_in.copies[0], 2, 4);
+    meta_in.copies[0].remap_data.remaps[3].original_sector = meta_in.copies[0].remap_data.remaps[1].original_sector;
+    write_metadata(regress, "duplicate_original", 0, 1);
+
+    init_copy(&meta_in.copies[0], 2, 4);
+    meta_in.copies[0].remap_data.remaps[2].spare_sector = meta_in.copies[0].remap_data.remaps[0].spare_sector;
+    write_metadata(regress, "duplicate_spare", 0, 1);
+
+    init_copy(&meta_in.copies[0], 2, 1);
+    meta_in.copies[0].remap_data.remaps[0].spare_sector = 0;  /* Would overwrite metadata copy 0 */
+    write_metadata(regress, "spare_in_metadata_area", 0, 1);
+
+    init_copy(&meta_in.copies[0], 2, 2);
+    meta_in.copies[0].remap_data.remaps[1].flags = DM_REMAP_V4_REMAP_ZERO;  /* Keeps its spare sector */
+    write_metadata(regress, "zero_remap_with_spare", 0, 1);
+
+    init_compressed(&meta_in.copies[0]);
+    meta_in.copies[0].remap_data.remaps[9].spare_sector = DM_REMAP_V4_SPARE_DATA_START + 17;
+    write_metadata(regress, "compressed_extent_overlap", 0, 1);
+
+    init_compressed(&meta_in.copies[0]);
+    meta_in.copies[0].remap_data.remaps[8].original_sector = 4104;  /* Next unit, same extent */
+    meta_in.copies[0].remap_data.remaps[8].spare_sector = DM_REMAP_V4_SPARE_DATA_START + 16;
+    meta_in.copies[0].remap_data.remaps[8].flags = meta_in.copies[0].remap_data.remaps[0].flags;
+    write_metadata(regress, "compressed_extent_two_units", 0, 1);
+
+    init_compressed(&meta_in.copies[0]);
+    for (i = 0; i < 8; i++)
+        meta_in.copies[0].remap_data.remaps[i].flags &= ~DM_REMAP_V4_REMAP_CLEN_MASK;
+    write_metadata(regress, "compressed_length_zero", 0, 1);
+
+    init_compressed(&meta_in.copies[0]);
+    for (i = 0; i < 8; i++)
+        meta_in.copies[0].remap_data.remaps[i].spare_sector =
+            meta_in.copies[0].device_config.spare_device_sectors - 1;
+    write_metadata(regress, "compressed_extent_beyond_device", 0, 1);
+
+    init_copy(&meta_in.copies[0], 2, 1);
+    meta_in.copies[0].remap_data.remaps[0].original_sector = UINT64_MAX;
+    write_metadata(regress, "original_beyond_main", 0, 1);
+
+    init_copy(&meta_in.copies[0], 2, 1);
+    meta_in.copies[0].remap_data.remaps[0].spare_sector = UINT64_MAX;
+    write_metadata(regress, "spare_beyond_device", 0, 1);
+
+    init_copy(&meta_in.copies[0], 2, 0);
+    meta_in.copies[0].remap_data.active_remaps = UINT32_MAX;
+    write_metadata(regress, "remap_count_overflow", 0, 1);
+
+    init_copy(&meta_in.copies[0], 2, 0);
+    meta_in.copies[0].remap_data.next_spare_sector = UINT32_MAX;
+    write_metadata(regress, "next_spare_beyond_device", 0, 1);
+
+    /* Copy selection ignored a valid copy with sequence number and timestamp 0 */
+    init_copy(&meta_in.copies[0], 0, 1);
+    meta_in.copies[0].header.timestamp = 0;
+    write_metadata(regress, "sequence_zero", 0, 1);
+}
+
+/* ---- Setup reassembly metadata ---------------------------------------- */
+
+/* Input layout: flags, copies_found, copies_valid, corruption_level, metadata */
+static struct {
+    struct dm_remap_v4_setup_metadata meta;
+} rin;
+
+static void init_setup(struct dm_remap_v4_setup_metadata *m, uint32_t nr_spares)
+{
+    uint32_t i;
+
+    memset(m, 0, sizeof(*m));
+    m->magic = DM_REMAP_V4_REASSEMBLY_MAGIC;
+    m->metadata_version = 1;
+    m->created_timestamp = DM_REMAP_FUZZ_NOW - 86400;
+    snprintf(m->setup_description, sizeof(m->setup_description), "fuzz setup");
+    snprintf(m->main_device.device_path, sizeof(m->main_device.device_path), "/dev/loop0");
+    m->main_device.device_size = 1 << 20;
+    m->num_spare_devices = nr_spares;
+    for (i = 0; i < nr_spares; i++)
+        snprintf(m->spare_devices[i].spare_fingerprint.device_path,
+                 sizeof(m->spare_devices[i].spare_fingerprint.device_path),
+                 "/dev/loop%u", i + 1);
+    snprintf(m->target_config.target_params, sizeof(m->target_config.target_params),
+             "/dev/loop0 /dev/loop1");
+    m->metadata_copies_count = DM_REMAP_V4_METADATA_COPY_SECTORS;
+    dm_remap_v4_update_metadata_version(m);
+}
+
+static void write_reassembly(const char *dir, const char *name, uint8_t flags)
+{
+    static uint8_t buf[1 + sizeof(rin.meta) + 3 * sizeof(uint32_t)];
+    const uint32_t counters[3] = { 5, 4, 1 };  /* found, valid, corruption */
+
+    buf[0] = flags;
+    memcpy(buf + 1, counters, sizeof(counters));
+    memcpy(buf + 1 + sizeof(counters), &rin.meta, sizeof(rin.meta));
+    write_file(dir, name, buf, sizeof(buf), true);
+}
+
+static void gen_reassembly(const char *corpus, const char *regress)
+{
+    init_setup(&rin.meta, 2);
+    write_reassembly(corpus, "two_spares", 0);
+    rin.meta.overall_crc32 ^= 1;
+    write_reassembly(corpus, "bad_crc", 0);
+    init_setup(&rin.meta, 0);
+    write_reassembly(corpus, "no_spares_fixcrc", FLAG_FIX_CRC);
+
+    /* Regressions: counts and strings trusted once the CRCs matched */
+    init_setup(&rin.meta, 1);
+    rin.meta.num_spare_devices = 1000;
+    dm_remap_v4_update_metadata_version(&rin.meta);
+    write_reassembly(regress, "spare_count_overflow", 0);
+
+    init_setup(&rin.meta, 1);
+    rin.meta.sysfs_config.num_settings = UINT32_MAX;
+    dm_remap_v4_update_metadata_version(&rin.meta);
+    write_reassembly(regress, "settings_count_overflow", 0);
+
+    init_setup(&rin.meta, 1);
+    memset(rin.meta.setup_description, 'A', sizeof(rin.meta.setup_description));
+    dm_remap_v4_update_metadata_version(&rin.meta);
+    write_reassembly(regress, "unterminated_description", 0);
+
+    init_setup(&rin.meta, 1);
+    memset(rin.meta.spare_devices[0].spare_fingerprint.device_path, 'B',
+           sizeof(rin.meta.spare_devices[0].spare_fingerprint.device_path));
+    dm_remap_v4_update_metadata_version(&rin.meta);
+    write_reassembly(regress, "unterminated_spare_path", 0);
+}
+
+/* ---- Text inputs ------------------------------------------------------ */
+
+/* Message inputs start with one byte giving the reply buffer size - 1 */
+static void write_message(const char *dir, const char *name, uint8_t maxlen, const char *text)
+{
+    char buf[1024];
+    size_t n = strlen(text);
+
+    buf[0] = (char)maxlen;
+    memcpy(buf + 1, text, n);
+    write_file(dir, name, buf, n + 1, false);
+}
+
+static void gen_message(const char *corpus, const char *regress)
+{
+    static const char * const commands[] = {
+        "help", "status", "stats", "clear_stats", "health", "cache_stats", "policy",
+        "shadow", "shadow reset", "shadow off", "events", "events 3",
+        "test_remap 100 2000",
+        "shadow set remap_after=3 granularity=64 predict_consecutive=2 predict_step=20 migrate_score=50",
+        "set", "set scan_interval 3600", "set cache_size 0", "set commit_policy sync",
+        "set remap_granularity 64", "replace_spare", "replace_spare /dev/loop2",
+        "replace_spare cancel", "grow", "errors", "inject_error timeout 4",
+        "inject_error medium", "set transport_errors pass", "set media_errors count",
+        "set retry_limit 0", "set shrink_policy drop", "pipeline", "hung",
+        "set hung_timeout 0", "set salvage_retries 0", "set salvage_sectors 8",
+        "set write_verify all", "set verify_window 0", "checksums",
+        "set data_checksums on", "flatten", "flatten /dev/loop2", "flatten cancel",
+        "set flatten_rate 100", "set compress lz4", "forensic",
+        "set metadata_ioprio rt:0", "set repair_ioprio none", "set copy_cgroup /dm-remap/copy",
+        "set metadata_cgroup none", "set correlated_errors count",
+        "set error_domain enclosure-1", "set error_domain auto",
+    };
+    char name[64];
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(commands); i++) {
+        snprintf(name, sizeof(name), "cmd%02u", i);
+        write_message(corpus, name, 255, commands[i]);
+    }
+    write_message(corpus, "events_short_reply", 40, "events");
+    write_message(corpus, "shadow_short_reply", 16, "shadow set granularity=8");
+    write_message(corpus, "pipeline_short_reply", 100, "pipeline");
+
+    write_message(regress, "test_remap_one_arg", 255, "test_remap 1");
+    write_message(regress, "test_remap_trailing_junk", 255, "test_remap 1x 2");
+    write_message(regress, "events_overflow", 255, "events 18446744073709551616");
+    write_message(regress, "events_negative", 255, "events -1");
+    write_message(regress, "events_extra_arg", 255, "events 1 2");
+    write_message(regress, "shadow_granularity_zero", 255, "shadow set granularity=0");
+    write_message(regress, "shadow_granularity_huge", 255, "shadow set granularity=4294967296");
+    write_message(regress, "shadow_remap_after_zero", 255, "shadow set remap_after=0");
+    write_message(regress, "shadow_empty_key", 255, "shadow set =1");
+    write_message(regress, "shadow_no_value", 255, "shadow set remap_after");
+    write_message(regress, "shadow_reset_extra", 255, "shadow reset now");
+    write_message(regress, "help_extra", 255, "help me");
+    write_message(regress, "many_args", 255,
+                  "shadow set a=1 b=2 c=3 d=4 e=5 f=6 g=7 h=8 i=9 j=10 k=11 l=12 m=13 "
+                  "n=14 o=15 p=16 q=17 r=18 s=19 t=20 u=21 v=22 w=23 x=24 y=25 z=26 "
+                  "aa=27 ab=28 ac=29 ad=30 ae=31 af=32 ag=33");
+    write_message(regress, "set_key_only", 255, "set scan_interval");
+    write_message(regress, "set_scan_interval_zero", 255, "set scan_interval 0");
+    write_message(regress, "set_cache_not_pow2", 255, "set cache_size 1000");
+    write_message(regress, "set_commit_unknown", 255, "set commit_policy later");
+    write_message(regress, "set_granularity_huge", 255, "set remap_granularity 256");
+    write_message(regress, "set_error_action_unknown", 255, "set media_errors ignore");
+    write_message(regress, "set_error_class_unknown", 255, "set disk_errors remap");
+    write_message(regress, "set_retry_limit_huge", 255, "set retry_limit 17");
+    write_message(regress, "set_shrink_policy_unknown", 255, "set shrink_policy truncate");
+    write_message(regress, "inject_error_no_status", 255, "inject_error");
+    write_message(regress, "inject_error_bad_count", 255, "inject_error ioerr -1");
+    write_message(regress, "inject_error_extra_arg", 255, "inject_error ioerr 1 2");
+    write_message(regress, "replace_spare_extra_arg", 255, "replace_spare /dev/loop2 now");
+    write_message(regress, "grow_extra_arg", 255, "grow 1048576");
+    write_message(regress, "pipeline_one_byte_reply", 0, "pipeline");
+    write_message(regress, "set_hung_timeout_huge", 255, "set hung_timeout 3601");
+    write_message(regress, "hung_extra_arg", 255, "hung 30");
+    write_message(regress, "set_salvage_retries_huge", 255, "set salvage_retries 17");
+    write_message(regress, "set_salvage_sectors_not_pow2", 255, "set salvage_sectors 24");
+    write_message(regress, "set_salvage_sectors_huge", 255, "set salvage_sectors 1024");
+    write_message(regress, "set_write_verify_unknown", 255, "set write_verify some");
+    write_message(regress, "set_verify_window_huge", 255, "set verify_window 2097153");
+    write_message(regress, "set_data_checksums_unknown", 255, "set data_checksums crc");
+    write_message(regress, "set_flatten_rate_huge", 255, "set flatten_rate 65537");
+    write_message(regress, "set_compress_unknown", 255, "set compress gzip");
+    write_message(regress, "flatten_extra_arg", 255, "flatten /dev/loop2 now");
+    write_message(regress, "forensic_extra_arg", 255, "forensic reset");
+    write_message(regress, "set_ioprio_level_huge", 255, "set copy_ioprio be:8");
+    write_message(regress, "set_ioprio_idle_level", 255, "set repair_ioprio idle:0");
+    write_message(regress, "set_ioprio_no_level", 255, "set metadata_ioprio be:");
+    write_message(regress, "set_cgroup_relative", 255, "set copy_cgroup dm-remap");
+    write_message(regress, "set_cgroup_backslash", 255, "set copy_cgroup /dm\\x20remap");
+    write_message(regress, "set_cgroup_too_long", 255,
+                  "set repair_cgroup /aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+    write_message(regress, "set_correlated_unknown", 255, "set correlated_errors ignore");
+    write_message(regress, "set_domain_slash", 255, "set error_domain shelf/1");
+    write_message(regress, "set_domain_too_long", 255,
+                  "set error_domain aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+    write_message(regress, "set_domain_space", 255, "set error_domain shelf\\ 1");
+    write_message(regress, "empty", 255, "");
+    write_message(regress, "one_byte_reply", 0, "stats");
+}
+
+static void write_text(const char *dir, const char *name, const char *text)
+{
+    write_file(dir, name, text, strlen(text), false);
+}
+
+static void gen_ctr(const char *corpus, const char *regress)
+{
+    write_file(corpus, "loop", "/dev/loop0 /dev/loop1", 21, false);
+    write_file(corpus, "mapper", "/dev/mapper/main /dev/mapper/spare", 34, false);
+    write_text(corpus, "features",
+               "/dev/loop0 /dev/loop1 8 scan_interval 60 cache_size 1024 "
+               "commit_policy sync remap_granularity 8");
+    write_text(corpus, "error_actions",
+               "/dev/loop0 /dev/loop1 22 scan_interval 604800 cache_size 65536 "
+               "commit_policy sync remap_granularity 128 media_errors count "
+               "transport_errors remap resource_errors remap unsupported_errors retry "
+               "other_errors retry retry_limit 16");
+    write_text(corpus, "shrink_policy", "/dev/loop0 /dev/loop1 2 shrink_policy drop");
+    write_text(corpus, "hung_timeout", "/dev/loop0 /dev/loop1 2 hung_timeout 5");
+    write_text(corpus, "salvage",
+               "/dev/loop0 /dev/loop1 4 salvage_retries 1 salvage_sectors 8");
+    write_text(corpus, "write_verify",
+               "/dev/loop0 /dev/loop1 4 write_verify errors verify_window 64");
+    write_text(corpus, "data_checksums", "/dev/loop0 /dev/loop1 2 data_checksums on");
+    write_text(corpus, "flatten_rate", "/dev/loop0 /dev/loop1 2 flatten_rate 50");
+    write_text(corpus, "compress", "/dev/loop0 /dev/loop1 2 compress zstd");
+    write_text(corpus, "mode_ro", "/dev/loop0 /dev/loop1 2 mode ro");
+    write_text(corpus, "io_attribution", "/dev/loop0 /dev/loop1 6 metadata_ioprio rt:1 "
+               "repair_ioprio be:7 copy_cgroup /system.slice/dm-remap-copy");
+    write_text(corpus, "error_domain", "/dev/loop0 /dev/loop1 4 correlated_errors pass "
+               "error_domain 0000:03:00.0");
+    write_text(corpus, "overlay", "/dev/loop0 /dev/loop1 4 mode ro overlay /dev/loop2");
+    write_text(corpus, "metadata_device", "/dev/loop0 /dev/loop1 /dev/loop2 2048");
+    write_text(corpus, "metadata_device_features",
+               "/dev/loop0 /dev/loop1 /dev/nvme0n1p3 1280 2 commit_policy sync");
+
+    write_file(regress, "same_device", "/dev/loop0 /dev/loop0", 21, false);
+    write_file(regress, "one_device", "/dev/loop0", 10, false);
+    write_file(regress, "three_devices", "/dev/loop0 /dev/loop1 /dev/loop2", 32, false);
+    write_file(regress, "empty", "", 0, false);
+    write_text(regress, "features_odd", "/dev/loop0 /dev/loop1 1 cache_size");
+    write_text(regress, "features_count_short", "/dev/loop0 /dev/loop1 4 cache_size 8");
+    write_text(regress, "features_count_negative", "/dev/loop0 /dev/loop1 -2 cache_size 8");
+    write_text(regress, "features_unknown_key", "/dev/loop0 /dev/loop1 2 colour blue");
+    write_text(regress, "features_cache_huge", "/dev/loop0 /dev/loop1 2 cache_size 131072");
+    write_text(regress, "metadata_is_spare", "/dev/loop0 /dev/loop1 /dev/loop1 0");
+    write_text(regress, "metadata_offset_unaligned", "/dev/loop0 /dev/loop1 /dev/loop2 7");
+    write_text(regress, "metadata_offset_huge",
+               "/dev/loop0 /dev/loop1 /dev/loop2 18446744073709551616");
+    write_text(regress, "metadata_features_short", "/dev/loop0 /dev/loop1 /dev/loop2 0 2 cache_size");
+    write_text(regress, "mode_unknown", "/dev/loop0 /dev/loop1 2 mode rw+");
+    write_text(regress, "overlay_without_ro", "/dev/loop0 /dev/loop1 2 overlay /dev/loop2");
+    write_text(regress, "overlay_is_spare",
+               "/dev/loop0 /dev/loop1 4 mode ro overlay /dev/loop1");
+    write_text(regress, "overlay_is_metadata",
+               "/dev/loop0 /dev/loop1 /dev/loop2 0 4 overlay /dev/loop2 mode ro");
+}
+
+/* ---- Fault-injected spare images -------------------------------------- */
+
+static uint64_t rng_state;
+
+static uint64_t rnd(void)
+{
+    /* xorshift64*: deterministic per seed */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static void inject_fault(struct dm_remap_metadata_v4 *m, uint64_t spare_sectors,
+                         uint64_t main_sectors)
+{
+    uint32_t n = m->remap_data.active_remaps;
+    uint32_t i = n ? rnd() % n : 0;
+
+    switch (rnd() % 8) {
+    case 0:
+        m->remap_data.active_remaps = rnd() % 2 ? UINT32_MAX : DM_REMAP_V4_MAX_REMAPS + 1;
+        break;
+    case 1:
+        if (n > 1)
+            m->remap_data.remaps[i].original_sector =
+                m->remap_data.remaps[(i + 1) % n].original_sector;
+        break;
+    case 2:
+        if (n > 1)
+            m->remap_data.remaps[i].spare_sector =
+                m->remap_data.remaps[(i + 1) % n].spare_sector;
+        break;
+    case 3:
+        m->remap_data.remaps[i].spare_sector = rnd() % DM_REMAP_V4_SPARE_DATA_START;
+        break;
+    case 4:
+        m->remap_data.remaps[i].spare_sector = spare_sectors + rnd() % 1024;
+        break;
+    case 5:
+        m->remap_data.remaps[i].original_sector = main_sectors + rnd() % 1024;
+        break;
+    case 6:
+        m->remap_data.next_spare_sector = (uint32_t)rnd();
+        break;
+    default:
+        ((uint8_t *)m)[rnd() % sizeof(*m)] ^= 1 << (rnd() % 8);
+        break;
+    }
+}
+
+static int gen_image(int argc, char **argv)
+{
+    static struct dm_remap_metadata_v4 m;
+    uint64_t spare_sectors, main_sectors;
+    uint32_t nr_remaps;
+    bool raw;
+    FILE *f;
+    int i;
+
+    if (argc < 6) {
+        fprintf(stderr, "usage: %s image OUT SPARE_SECTORS MAIN_SECTORS SEED [raw]\n", argv[0]);
+        return 2;
+    }
+    spare_sectors = strtoull(argv[3], NULL, 0);
+    main_sectors = strtoull(argv[4], NULL, 0);
+    rng_state = strtoull(argv[5], NULL, 0) * 0x9e3779b97f4a7c15ULL + 1;
+    raw = argc > 6 && !strcmp(argv[6], "raw");
+
+    if (spare_sectors / 2 <= DM_REMAP_V4_SPARE_DATA_START + 64) {
+        fprintf(stderr, "spare device too small\n");
+        return 2;
+    }
+
+    f = fopen(argv[2], "r+b");
+    if (!f)
+        f = fopen(argv[2], "wb");
+    if (!f) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    nr_remaps = 1 + rnd() % 64;
+    for (i = 0; i < DM_REMAP_V4_REDUNDANT_COPIES; i++) {
+        uint32_t r;
+
+        memset(&m, 0, sizeof(m));
+        m.header.magic = DM_REMAP_METADATA_V4_MAGIC;
+        m.header.version = DM_REMAP_METADATA_V4_VERSION;
+        m.header.sequence_number = 10 + rnd() % 3;
+        m.header.timestamp = (uint64_t)time(NULL) - 60;
+        m.header.structure_size = sizeof(m);
+        m.device_config.main_device_sectors = main_sectors;
+        m.device_config.spare_device_sectors = spare_sectors;
+        m.device_config.sector_size = 512;
+        m.health_data.health_score = 100;
+        m.remap_data.max_remaps = DM_REMAP_V4_MAX_REMAPS;
+        m.remap_data.active_remaps = nr_remaps;
+        for (r = 0; r < nr_remaps; r++) {
+            m.remap_data.remaps[r].original_sector = (r * 4099) % main_sectors;
+            m.remap_data.remaps[r].spare_sector = DM_REMAP_V4_SPARE_DATA_START + r;
+            m.remap_data.remaps[r].error_count = 1;
+        }
+        m.remap_data.next_spare_sector = DM_REMAP_V4_SPARE_DATA_START + nr_remaps;
+
+        /* Damage about half the copies, sometimes all of them */
+        if (rnd() % 2 || rnd() % 8 == 0)
+            inject_fault(&m, spare_sectors / 2, main_sectors);
+
+        m.header.copy_index = i;
+        if (!raw || rnd() % 4)
+            m.header.metadata_checksum = dm_remap_metadata_v4_crc32(&m);
+
+        if (fseeko(f, (off_t)i * DM_REMAP_V4_METADATA_BLOCK_SIZE, SEEK_SET) ||
+            fwrite(&m, sizeof(m), 1, f) != 1) {
+            perror(argv[2]);
+            return 1;
+        }
+    }
+
+    return fclose(f) ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2 && !strcmp(argv[1], "image"))
+        return gen_image(argc, argv);
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s CORPUS_DIR REGRESSION_DIR\n"
+                        "       %s image OUT SPARE_SECTORS MAIN_SECTORS SEED [raw]\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+
+    gen_metadata(make_dir(argv[1], "metadata"), make_dir(argv[2], "metadata"));
+    gen_reassembly(make_dir(argv[1], "reassembly"), make_dir(argv[2], "reassembly"));
+    gen_message(make_dir(argv[1], "message"), make_dir(argv[2], "message"));
+    gen_ctr(make_dir(argv[1], "ctr"), make_dir(argv[2], "ctr"));
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * kernel_shim.c - Out-of-line parts of the userspace kernel shim
+ */
+
+#include "kernel_shim.h"
+
+int dm_remap_debug = 3;  /* Exercise every DMR_DEBUG() format */
+
+static bool shim_verbose(void)
+{
+    static int verbose = -1;
+
+    if (verbose < 0)
+        verbose = getenv("DM_REMAP_FUZZ_VERBOSE") != NULL;
+    return verbose;
+}
+
+int printk(const char *fmt, ...)
+{
+    char buf[1024];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (shim_verbose())
+        fputs(buf, stderr);
+    return n;
+}
+
+int scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (!size)
+        return 0;
+    va_start(ap, fmt);
+    n = vsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return 0;
+    return (size_t)n >= size ? (int)(size - 1) : n;
+}
+
+/* Same rules as lib/kstrtox.c: optional '+', base prefix for base 0, one
+ * trailing newline, nothing else. */
+int kstrtou64(const char *s, unsigned int base, u64 *res)
+{
+    u64 acc = 0;
+    unsigned int digit;
+    bool any = false;
+
+    if (*s == '+')
+        s++;
+    if (base == 0 || base == 16) {
+        if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X') && isxdigit((unsigned char)s[2])) {
+            s += 2;
+            base = 16;
+        } else if (base == 0) {
+            base = (s[0] == '0' && s[1]) ? 8 : 10;
+        }
+    }
+
+    for (; *s; s++) {
+        if (*s >= '0' && *s <= '9')
+            digit = *s - '0';
+        else if (*s >= 'a' && *s <= 'f')
+            digit = *s - 'a' + 10;
+        else if (*s >= 'A' && *s <= 'F')
+            digit = *s - 'A' + 10;
+        else
+            break;
+        if (digit >= base)
+            break;
+        if (acc > (U64_MAX - digit) / base)
+            return -ERANGE;
+        acc = acc * base + digit;
+        any = true;
+    }
+    if (!any)
+        return -EINVAL;
+    if (*s == '\n')
+        s++;
+    if (*s)
+        return -EINVAL;
+
+    *res = acc;
+    return 0;
+}
+
+int kstrtou32(const char *s, unsigned int base, u32 *res)
+{
+    u64 v;
+    int ret = kstrtou64(s, base, &v);
+
+    if (ret)
+        return ret;
+    if (v > U32_MAX)
+        return -ERANGE;
+    *res = (u32)v;
+    return 0;
+}
+
+int kstrtouint(const char *s, unsigned int base, unsigned int *res)
+{
+    return kstrtou32(s, base, res);
+}
+
+int kstrtoint(const char *s, unsigned int base, int *res)
+{
+    u64 v;
+    bool neg = *s == '-';
+    int ret = kstrtou64(neg ? s + 1 : s, base, &v);
+
+    if (ret)
+        return ret;
+    if (v > (u64)INT_MAX + neg)
+        return -ERANGE;
+    *res = neg ? (int)-(s64)v : (int)v;
+    return 0;
+}
+
+/* Little-endian CRC32 (polynomial 0xedb88320), no pre/post inversion:
+ * matches the kernel's crc32_le() */
+u32 crc32_le(u32 crc, const void *p, size_t len)
+{
+    static u32 table[256];
+    const u8 *b = p;
+    u32 i, j, c;
+
+    if (!table[1]) {
+        for (i = 0; i < 256; i++) {
+            for (c = i, j = 0; j < 8; j++)
+                c = (c >> 1) ^ (0xedb88320 & -(c & 1));
+            table[i] = c;
+        }
+    }
+
+    while (len--)
+        crc = (crc >> 8) ^ table[(crc ^ *b++) & 0xff];
+    return crc;
+}
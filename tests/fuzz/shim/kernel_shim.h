@@ -0,0 +1,227 @@
+/*
+ * kernel_shim.h - Minimal kernel API for building dm-remap parsers in userspace
+ *
+ * Every <linux/...> header under shim/linux/ includes this file, so the
+ * target sources compile unmodified. Only what the fuzzed files use is
+ * provided; locking is a no-op (the harness is single-threaded) and time
+ * is fixed so runs are reproducible.
+ */
+
+#ifndef DM_REMAP_FUZZ_KERNEL_SHIM_H
+#define DM_REMAP_FUZZ_KERNEL_SHIM_H
+
+/* System headers may include <linux/...> themselves: let those through */
+#define DM_REMAP_FUZZ_SYSTEM
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#undef DM_REMAP_FUZZ_SYSTEM
+
+/* Types */
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;  /* As in the kernel, for %llu */
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef u64 sector_t;
+typedef s64 ktime_t;
+typedef unsigned int gfp_t;
+typedef unsigned int fmode_t;
+typedef unsigned int blk_mode_t;
+
+typedef struct { u8 b[16]; } uuid_t;
+
+#define __packed           __attribute__((packed))
+#define __maybe_unused     __attribute__((unused))
+#define __user
+#define __init
+#define __exit
+#define likely(x)          __builtin_expect(!!(x), 1)
+#define unlikely(x)        __builtin_expect(!!(x), 0)
+
+#define SECTOR_SHIFT       9
+#define SECTOR_SIZE        512
+#define PAGE_SIZE          4096
+
+/* Helpers */
+#define ARRAY_SIZE(a)      (sizeof(a) / sizeof((a)[0]))
+#define min(a, b)          ((a) < (b) ? (a) : (b))
+#define max(a, b)          ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)     ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b)     ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define round_down(x, y)   ((x) & ~((__typeof__(x))(y) - 1))
+#define round_up(x, y)     ((((x) - 1) | ((__typeof__(x))(y) - 1)) + 1)
+#define ALIGN(x, a)        round_up(x, a)
+#define is_power_of_2(n)   ((n) != 0 && (((n) & ((n) - 1)) == 0))
+static inline int fls64(u64 x) { return x ? 64 - __builtin_clzll(x) : 0; }
+#define U32_MAX            UINT32_MAX
+#define U64_MAX            UINT64_MAX
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* Error pointers */
+#define MAX_ERRNO          4095
+#define IS_ERR_VALUE(x)    ((unsigned long)(void *)(x) >= (unsigned long)-MAX_ERRNO)
+static inline void *ERR_PTR(long error) { return (void *)error; }
+static inline long PTR_ERR(const void *ptr) { return (long)ptr; }
+static inline bool IS_ERR(const void *ptr) { return IS_ERR_VALUE(ptr); }
+
+/* Modules */
+#define EXPORT_SYMBOL(sym)
+#define EXPORT_SYMBOL_GPL(sym)
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_VERSION(x)
+#define module_param(name, type, perm)
+#define MODULE_PARM_DESC(name, desc)
+
+/* Logging: formatted (so ASan sees bad %s arguments) and dropped unless
+ * DM_REMAP_FUZZ_VERBOSE is set */
+#define KERN_EMERG         ""
+#define KERN_ALERT         ""
+#define KERN_CRIT          ""
+#define KERN_ERR           ""
+#define KERN_WARNING       ""
+#define KERN_NOTICE        ""
+#define KERN_INFO          ""
+#define KERN_DEBUG         ""
+int printk(const char *fmt, ...);  /* No format check: uint64_t is %lu here */
+#define pr_err(fmt, ...)   printk(fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...)  printk(fmt, ##__VA_ARGS__)
+#define pr_info(fmt, ...)  printk(fmt, ##__VA_ARGS__)
+#define pr_debug(fmt, ...) printk(fmt, ##__VA_ARGS__)
+#define DMERR(fmt, ...)    printk(fmt "\n", ##__VA_ARGS__)
+#define DMWARN(fmt, ...)   printk(fmt "\n", ##__VA_ARGS__)
+#define DMINFO(fmt, ...)   printk(fmt "\n", ##__VA_ARGS__)
+#define DMDEBUG(fmt, ...)  printk(fmt "\n", ##__VA_ARGS__)
+
+int scnprintf(char *buf, size_t size, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/* Strings */
+int kstrtou64(const char *s, unsigned int base, u64 *res);
+int kstrtou32(const char *s, unsigned int base, u32 *res);
+int kstrtouint(const char *s, unsigned int base, unsigned int *res);
+int kstrtoint(const char *s, unsigned int base, int *res);
+
+/* Memory */
+#define GFP_KERNEL         0u
+#define GFP_NOIO           0u
+#define GFP_ATOMIC         0u
+static inline void *kmalloc(size_t size, gfp_t flags) { (void)flags; return malloc(size); }
+static inline void *kzalloc(size_t size, gfp_t flags) { (void)flags; return calloc(1, size); }
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags) { (void)flags; return calloc(n, size); }
+static inline void kfree(const void *p) { free((void *)p); }
+#define vmalloc(size)      malloc(size)
+#define vzalloc(size)      calloc(1, size)
+#define vfree(p)           free(p)
+
+/* CRC */
+u32 crc32_le(u32 crc, const void *p, size_t len);
+#define crc32(seed, p, len) crc32_le(seed, p, len)
+
+/* Time: fixed, see DM_REMAP_FUZZ_NOW. Tools that check real devices
+ * (tools/dmremap-meta) build with DM_REMAP_SHIM_WALL_CLOCK instead. */
+#define DM_REMAP_FUZZ_NOW  1760000000ULL
+#define NSEC_PER_SEC       1000000000ULL
+#define NSEC_PER_USEC      1000ULL
+#ifdef DM_REMAP_SHIM_WALL_CLOCK
+#include <time.h>
+static inline u64 ktime_get_real_seconds(void) { return (u64)time(NULL); }
+#else
+static inline u64 ktime_get_real_seconds(void) { return DM_REMAP_FUZZ_NOW; }
+#endif
+static inline u64 ktime_get_real_ns(void) { return DM_REMAP_FUZZ_NOW * NSEC_PER_SEC; }
+static inline ktime_t ktime_get(void) { return (ktime_t)(DM_REMAP_FUZZ_NOW * NSEC_PER_SEC); }
+static inline ktime_t ktime_get_real(void) { return ktime_get(); }
+static inline s64 ktime_to_ns(ktime_t t) { return t; }
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b) { return a - b; }
+static inline u64 get_jiffies_64(void) { return 0; }
+
+/* Locking and atomics (single-threaded) */
+typedef struct { int unused; } spinlock_t;
+struct mutex { int unused; };
+#define DEFINE_SPINLOCK(x)             spinlock_t x
+#define DEFINE_MUTEX(x)                struct mutex x
+#define spin_lock_init(l)              ((void)(l))
+#define spin_lock(l)                   ((void)(l))
+#define spin_unlock(l)                 ((void)(l))
+#define spin_lock_irqsave(l, f)        ((void)(l), (f) = 0)
+#define spin_unlock_irqrestore(l, f)   ((void)(l), (void)(f))
+#define mutex_init(m)                  ((void)(m))
+#define mutex_lock(m)                  ((void)(m))
+#define mutex_unlock(m)                ((void)(m))
+
+typedef struct { int counter; } atomic_t;
+typedef struct { s64 counter; } atomic64_t;
+#define ATOMIC_INIT(i)                 { (i) }
+#define ATOMIC64_INIT(i)               { (i) }
+#define atomic_read(v)                 ((v)->counter)
+#define atomic_set(v, i)               ((v)->counter = (i))
+#define atomic_inc(v)                  ((v)->counter++)
+#define atomic64_read(v)               ((v)->counter)
+#define atomic64_set(v, i)             ((v)->counter = (i))
+#define atomic64_inc(v)                ((v)->counter++)
+#define atomic64_add(i, v)             ((v)->counter += (i))
+#define atomic64_inc_return(v)         (++(v)->counter)
+
+/* Opaque kernel objects referenced by the headers */
+struct list_head { struct list_head *next, *prev; };
+struct rb_node { unsigned long parent_color; struct rb_node *rb_right, *rb_left; };
+struct rb_root { struct rb_node *rb_node; };
+
+/* Static keys: plain booleans */
+struct static_key_false { bool enabled; };
+#define DECLARE_STATIC_KEY_FALSE(name)  extern struct static_key_false name
+#define DEFINE_STATIC_KEY_FALSE(name)   struct static_key_false name
+#define static_branch_unlikely(key)     unlikely((key)->enabled)
+struct completion { int done; };
+struct work_struct { int unused; };
+struct delayed_work { struct work_struct work; };
+struct workqueue_struct;
+struct bio;
+struct page;
+struct dm_dev;
+struct dm_target;
+struct dm_bufio_client;
+struct block_device;
+struct inode { unsigned int i_mode; };
+struct file { struct inode *f_inode; };
+
+/* Device access always fails: the harness never touches real devices */
+static inline struct file *filp_open(const char *path, int flags, int mode)
+{
+    (void)path; (void)flags; (void)mode;
+    return ERR_PTR(-ENOENT);
+}
+static inline int filp_close(struct file *f, void *id) { (void)f; (void)id; return 0; }
+static inline struct inode *file_inode(struct file *f) { return f->f_inode; }
+static inline struct block_device *I_BDEV(struct inode *inode) { (void)inode; return NULL; }
+static inline sector_t bdev_nr_sectors(struct block_device *bdev) { (void)bdev; return 0; }
+static inline unsigned int bdev_logical_block_size(struct block_device *bdev) { (void)bdev; return 512; }
+
+/* UUIDs */
+static inline bool uuid_equal(const uuid_t *a, const uuid_t *b) { return !memcmp(a, b, sizeof(*a)); }
+static inline void uuid_gen(uuid_t *u) { memset(u, 0x5a, sizeof(*u)); }
+static inline bool uuid_is_null(const uuid_t *u)
+{
+    static const uuid_t null_uuid;
+    return uuid_equal(u, &null_uuid);
+}
+
+#endif /* DM_REMAP_FUZZ_KERNEL_SHIM_H */
@@ -0,0 +1,5 @@
+#ifdef DM_REMAP_FUZZ_SYSTEM
+#include_next <linux/file.h>
+#else
+#include "../kernel_shim.h"
+#endif
@@ -0,0 +1,183 @@
+#!/bin/bash
+#
+# test_v4.3_atomic_writes.sh - Atomic write (REQ_ATOMIC) support
+#
+# Tests:
+# 1. Atomic write limits are stacked from both legs
+# 2. Atomic write entirely on the main device
+# 3. Atomic write straddling a remap is staged and switched in one commit
+# 4. Staged data survives a table reload (metadata committed)
+# 5. With atomic_write_staging=0 a straddling write is refused (EOPNOTSUPP)
+#
+# Needs a kernel with RWF_ATOMIC (6.11+) and scsi_debug with atomic_wr.
+#
+# Usage: sudo ./test_v4.3_atomic_writes.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-atomic"
+DEV_SIZE_MB=64
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    sleep 1
+    rmmod dm_remap 2>/dev/null || true
+    modprobe -r scsi_debug 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+# atomic_pwrite <dev> <offset> <len> <byte> - prints 0 or the errno
+atomic_pwrite() {
+    python3 - "$@" <<'EOF'
+import mmap, os, sys
+dev, off, length, val = sys.argv[1], int(sys.argv[2]), int(sys.argv[3]), int(sys.argv[4], 0)
+RWF_ATOMIC = getattr(os, "RWF_ATOMIC", 0x40)
+fd = os.open(dev, os.O_RDWR | os.O_DIRECT)
+buf = mmap.mmap(-1, length)
+buf.write(bytes([val]) * length)
+try:
+    os.pwritev(fd, [buf], off, RWF_ATOMIC)
+    print(0)
+except OSError as e:
+    print(e.errno)
+EOF
+}
+
+# read_pattern <dev> <offset> <len> - prints the distinct bytes found
+read_pattern() {
+    dd if="$1" bs=512 skip=$(( $2 / 512 )) count=$(( $3 / 512 )) iflag=direct 2>/dev/null | \
+        od -An -tx1 -v | tr -s ' ' '\n' | grep -v '^$' | sort -u | tr '\n' ' '
+}
+
+stat_value() {
+    dmsetup message ${DM_NAME} 0 stats | tr ' ' '\n' | grep "^$1=" | cut -d= -f2
+}
+
+create_target() {
+    dmsetup create ${DM_NAME} --table "0 ${MAIN_SECTORS} dm-remap-v4 /dev/${MAIN} /dev/${SPARE}" || \
+        error_exit "Failed to create ${DM_NAME}"
+    sleep 1  # Deferred metadata read
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+
+echo "========================================="
+echo "dm-remap v4.3 Atomic Write Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+echo -e "${YELLOW}[1/6] Setting up scsi_debug devices with atomic write support...${NC}"
+modprobe scsi_debug add_host=2 per_host_store=1 dev_size_mb=${DEV_SIZE_MB} atomic_wr=1 || \
+    error_exit "scsi_debug does not support atomic_wr on this kernel"
+udevadm settle
+DISKS=($(ls /sys/bus/pseudo/drivers/scsi_debug/adapter*/host*/target*/*:*/block/ | grep '^sd'))
+[ ${#DISKS[@]} -ge 2 ] || error_exit "Expected two scsi_debug disks, found ${#DISKS[@]}"
+MAIN=${DISKS[0]}
+SPARE=${DISKS[1]}
+MAIN_SECTORS=$(blockdev --getsz /dev/${MAIN})
+echo "Main: /dev/${MAIN}, spare: /dev/${SPARE} (${MAIN_SECTORS} sectors)"
+
+echo -e "${YELLOW}[2/6] Loading dm-remap and creating target...${NC}"
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+create_target
+DM_BLOCK=$(basename $(readlink -f /dev/mapper/${DM_NAME}))
+
+echo -e "${YELLOW}[3/6] Checking stacked atomic write limits...${NC}"
+UNIT_MAX=$(cat /sys/block/${DM_BLOCK}/queue/atomic_write_unit_max_bytes 2>/dev/null || echo 0)
+echo "atomic_write_unit_max_bytes=${UNIT_MAX}"
+if [ "${UNIT_MAX}" -ge 16384 ]; then
+    report_test "Atomic write limits advertised" "PASS"
+else
+    report_test "Atomic write limits advertised" "FAIL"
+    error_exit "Need at least 16KiB atomic writes to continue"
+fi
+
+# Remap sectors 8 and 100 (one inside each 16KiB range used below), then
+# reload so the remaps are restored ACTIVE from metadata
+dmsetup message ${DM_NAME} 0 test_remap 8 4096 >/dev/null
+dmsetup message ${DM_NAME} 0 test_remap 100 4100 >/dev/null
+sleep 1
+dmsetup remove ${DM_NAME}
+create_target
+
+echo -e "${YELLOW}[4/6] Atomic write on healthy sectors...${NC}"
+RET=$(atomic_pwrite /dev/mapper/${DM_NAME} 65536 16384 0xaa)
+if [ "${RET}" = "0" ] && [ "$(read_pattern /dev/${MAIN} 65536 16384)" = "aa " ]; then
+    report_test "Atomic write to main device" "PASS"
+else
+    report_test "Atomic write to main device (ret=${RET})" "FAIL"
+fi
+
+echo -e "${YELLOW}[5/6] Atomic write straddling a remapped sector...${NC}"
+RET=$(atomic_pwrite /dev/mapper/${DM_NAME} 0 16384 0x5a)
+if [ "${RET}" = "0" ] && [ "$(stat_value atomic_staged)" = "1" ] && \
+   [ "$(read_pattern /dev/mapper/${DM_NAME} 0 16384)" = "5a " ]; then
+    report_test "Straddling atomic write staged" "PASS"
+else
+    report_test "Straddling atomic write staged (ret=${RET})" "FAIL"
+fi
+
+dmsetup remove ${DM_NAME}
+create_target
+if [ "$(read_pattern /dev/mapper/${DM_NAME} 0 16384)" = "5a " ]; then
+    report_test "Staged extent persisted across reload" "PASS"
+else
+    report_test "Staged extent persisted across reload" "FAIL"
+fi
+
+echo -e "${YELLOW}[6/6] Refusal with staging disabled...${NC}"
+echo 0 > /sys/module/dm_remap/parameters/atomic_write_staging
+RET=$(atomic_pwrite /dev/mapper/${DM_NAME} 49152 16384 0x33)
+echo 1 > /sys/module/dm_remap/parameters/atomic_write_staging
+if [ "${RET}" = "95" ] && [ "$(stat_value atomic_refused)" = "1" ] && \
+   [ "$(read_pattern /dev/mapper/${DM_NAME} 49152 16384)" != "33 " ]; then
+    report_test "Straddling atomic write refused with EOPNOTSUPP" "PASS"
+else
+    report_test "Straddling atomic write refused (ret=${RET})" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
@@ -0,0 +1,191 @@
+#!/bin/bash
+#
+# test_v4.3_error_classes.sh - Error classification ("errors", "inject_error")
+#
+# Tests:
+# 1. A media error from dm-dust is remapped
+# 2. A transient transport error is retried and recovers without a remap
+# 3. A timeout that outlasts retry_limit is passed up without a remap
+# 4. An unsupported operation is passed up without a remap
+# 5. "media_errors count" counts a media error but does not remap
+# 6. Error actions survive a table reload
+#
+# dm-dust and dm-flakey only fail bios with BLK_STS_IOERR, so the other
+# statuses come from the target's own "inject_error" hook.
+#
+# Usage: sudo ./test_v4.3_error_classes.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-errclass"
+DUST_NAME="test-remap-errclass-dust"
+MAIN_IMG="/tmp/dm-remap-errclass-main.img"
+SPARE_IMG="/tmp/dm-remap-errclass-spare.img"
+MAIN_LOOP=""
+SPARE_LOOP=""
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    dmsetup remove ${DUST_NAME} 2>/dev/null || true
+    sleep 1
+    [ -n "${MAIN_LOOP}" ] && losetup -d ${MAIN_LOOP} 2>/dev/null
+    [ -n "${SPARE_LOOP}" ] && losetup -d ${SPARE_LOOP} 2>/dev/null
+    rm -f ${MAIN_IMG} ${SPARE_IMG}
+    rmmod dm_remap 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+mappings() {
+    dmsetup message ${DM_NAME} 0 status | tr ' ' '\n' | grep '^mappings=' | cut -d= -f2
+}
+
+error_value() {
+    dmsetup message ${DM_NAME} 0 errors | tr ' ' '\n' | grep "^$1=" | cut -d= -f2
+}
+
+# read_block <block>: direct 4k read through the target, returns dd's status
+read_block() {
+    dd if=/dev/mapper/${DM_NAME} of=/dev/null bs=4096 skip=$1 count=1 iflag=direct 2>/dev/null
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+
+echo "========================================="
+echo "dm-remap v4.3 Error Classification Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+modprobe dm-dust || error_exit "dm-dust is required"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/zero of=${SPARE_IMG} bs=1M count=64 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG})
+SPARE_LOOP=$(losetup -f --show ${SPARE_IMG})
+MAIN_SECTORS=$(blockdev --getsz ${MAIN_LOOP})
+dmsetup create ${DUST_NAME} --table "0 ${MAIN_SECTORS} dust ${MAIN_LOOP} 0 512" || \
+    error_exit "Failed to create dust device"
+dmsetup create ${DM_NAME} --table \
+    "0 ${MAIN_SECTORS} dm-remap-v4 /dev/mapper/${DUST_NAME} ${SPARE_LOOP}" || \
+    error_exit "Failed to create ${DM_NAME}"
+sleep 1  # Deferred metadata read
+
+echo -e "${YELLOW}[1/6] Media error...${NC}"
+dmsetup message ${DUST_NAME} 0 addbadblock 800 >/dev/null
+dmsetup message ${DUST_NAME} 0 enable >/dev/null
+read_block 100
+sleep 2  # Let the write-ahead remap commit
+REMAPS=$(mappings)
+if [ "$(error_value media)" = "1" ] && [ "${REMAPS}" -ge 1 ] && read_block 100; then
+    report_test "IOERR classed as media and remapped" "PASS"
+else
+    report_test "IOERR classed as media and remapped (mappings=${REMAPS})" "FAIL"
+fi
+
+echo -e "${YELLOW}[2/6] Transient transport error...${NC}"
+dmsetup message ${DM_NAME} 0 inject_error transport 2 >/dev/null
+if read_block 1000 && [ "$(error_value transport)" = "1" ] && \
+   [ "$(error_value retried)" = "2" ] && [ "$(error_value recovered)" = "1" ] && \
+   [ "$(mappings)" = "${REMAPS}" ]; then
+    report_test "Transport error retried and recovered" "PASS"
+else
+    report_test "Transport error retried and recovered ($(dmsetup message ${DM_NAME} 0 errors))" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/6] Timeout beyond retry_limit...${NC}"
+dmsetup message ${DM_NAME} 0 set retry_limit 1 >/dev/null
+dmsetup message ${DM_NAME} 0 inject_error timeout 5 >/dev/null
+FAILED=0
+read_block 2000 || FAILED=1
+dmsetup message ${DM_NAME} 0 inject_error timeout 0 >/dev/null
+sleep 1
+if [ ${FAILED} -eq 1 ] && [ "$(error_value exhausted)" = "1" ] && [ "$(mappings)" = "${REMAPS}" ]; then
+    report_test "Exhausted timeout passed up, nothing remapped" "PASS"
+else
+    report_test "Exhausted timeout passed up, nothing remapped (failed=${FAILED})" "FAIL"
+fi
+
+echo -e "${YELLOW}[4/6] Unsupported operation...${NC}"
+dmsetup message ${DM_NAME} 0 inject_error notsupp >/dev/null
+FAILED=0
+read_block 3000 || FAILED=1
+sleep 1
+if [ ${FAILED} -eq 1 ] && [ "$(error_value unsupported)" = "1" ] && \
+   [ "$(error_value retried)" = "3" ] && [ "$(mappings)" = "${REMAPS}" ]; then
+    report_test "NOTSUPP passed up without retry or remap" "PASS"
+else
+    report_test "NOTSUPP passed up without retry or remap ($(dmsetup message ${DM_NAME} 0 errors))" "FAIL"
+fi
+
+echo -e "${YELLOW}[5/6] media_errors count...${NC}"
+dmsetup message ${DM_NAME} 0 set media_errors count >/dev/null
+ERRORS_BEFORE=$(dmsetup message ${DM_NAME} 0 stats | tr ' ' '\n' | grep '^errors=' | cut -d= -f2)
+dmsetup message ${DM_NAME} 0 inject_error medium >/dev/null
+FAILED=0
+read_block 4000 || FAILED=1
+sleep 2
+ERRORS_AFTER=$(dmsetup message ${DM_NAME} 0 stats | tr ' ' '\n' | grep '^errors=' | cut -d= -f2)
+if [ ${FAILED} -eq 1 ] && [ "$(error_value media)" = "2" ] && [ "$(mappings)" = "${REMAPS}" ] && \
+   [ "${ERRORS_AFTER}" != "${ERRORS_BEFORE}" ]; then
+    report_test "Counted media error not remapped" "PASS"
+else
+    report_test "Counted media error not remapped (errors ${ERRORS_BEFORE} -> ${ERRORS_AFTER})" "FAIL"
+fi
+
+echo -e "${YELLOW}[6/6] Actions in the table...${NC}"
+TABLE=$(dmsetup table ${DM_NAME})
+echo "  ${TABLE}"
+dmsetup suspend ${DM_NAME}
+dmsetup reload ${DM_NAME} --table "${TABLE}" || error_exit "Table refused: ${TABLE}"
+dmsetup resume ${DM_NAME}
+SETTINGS=$(dmsetup message ${DM_NAME} 0 set)
+if echo "${SETTINGS}" | grep -q "media_errors=count" && echo "${SETTINGS}" | grep -q "retry_limit=1"; then
+    report_test "Error actions kept across reload" "PASS"
+else
+    report_test "Error actions kept across reload (${SETTINGS})" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
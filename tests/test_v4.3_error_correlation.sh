@@ -0,0 +1,257 @@
+#!/bin/bash
+#
+# test_v4.3_error_correlation.sh - Errors correlated across targets
+#
+# Tests:
+# 1. error_domain is shown, kept in the table and checked
+# 2. An error on one target alone is remapped as usual
+# 3. Errors on three targets at once are a burst: nothing is remapped,
+#    and the burst is logged and recorded once
+# 4. The burst ends after a quiet window
+# 5. A target that keeps failing after the others recovered ends the
+#    burst and is remapped
+#
+# Each target's main device is a dm-bio-error device over a loop device.
+# Reloading the bio-error tables between suspend and resume makes them
+# fail together, as they would behind a failing enclosure.
+#
+# Usage: sudo ./test_v4.3_error_correlation.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+BIO_ERROR_MODULE="${SCRIPT_DIR}/../src/dm-bio-error.ko"
+DM_PREFIX="test-remap-corr"
+DOMAIN="test-shelf"
+NR_TARGETS=3
+DEV_SIZE_MB=32
+NO_ERRORS="999999999 999999999"  # An error range past the end
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    for i in $(seq 0 $((NR_TARGETS - 1))); do
+        dmsetup remove ${DM_PREFIX}-${i} 2>/dev/null || true
+        dmsetup remove ${DM_PREFIX}-err-${i} 2>/dev/null || true
+    done
+    sleep 1
+    for i in $(seq 0 $((NR_TARGETS - 1))); do
+        losetup -d $(losetup -j /tmp/${DM_PREFIX}-main-${i}.img -O NAME --noheadings) 2>/dev/null
+        losetup -d $(losetup -j /tmp/${DM_PREFIX}-spare-${i}.img -O NAME --noheadings) 2>/dev/null
+        rm -f /tmp/${DM_PREFIX}-main-${i}.img /tmp/${DM_PREFIX}-spare-${i}.img
+    done
+    rmmod dm_remap 2>/dev/null || true
+    rmmod dm_bio_error 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+# error_value <target> <key> - e.g. error_value 0 correlated
+error_value() {
+    dmsetup message ${DM_PREFIX}-$1 0 errors | tr ' ' '\n' | grep "^$2=" | cut -d= -f2
+}
+
+mappings() {
+    dmsetup message ${DM_PREFIX}-$1 0 status | cut -d' ' -f1
+}
+
+# fail_range <first_sector> <last_sector> <target>... - reload the bio-error
+# devices under the targets together
+fail_range() {
+    local range="$1 $2" i
+    shift 2
+    for i in "$@"; do
+        dmsetup suspend ${DM_PREFIX}-err-${i}
+    done
+    for i in "$@"; do
+        dmsetup load ${DM_PREFIX}-err-${i} --table \
+            "0 ${MAIN_SECTORS} bio-error ${MAIN_LOOP[$i]} ${range}"
+    done
+    for i in "$@"; do
+        dmsetup resume ${DM_PREFIX}-err-${i}
+    done
+}
+
+read_sector() {
+    dd if=/dev/mapper/${DM_PREFIX}-$1 of=/dev/null bs=512 skip=$2 count=8 iflag=direct 2>/dev/null
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+
+echo "========================================="
+echo "dm-remap v4.3 Error Correlation Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+echo -e "${YELLOW}[1/6] Setting up ${NR_TARGETS} targets in domain ${DOMAIN}...${NC}"
+rmmod dm_remap 2>/dev/null || true
+rmmod dm_bio_error 2>/dev/null || true
+insmod ${BIO_ERROR_MODULE} || error_exit "Failed to load ${BIO_ERROR_MODULE}"
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+echo 2 > /sys/module/dm_remap/parameters/correlation_targets
+echo 1000 > /sys/module/dm_remap/parameters/correlation_window_ms
+
+declare -a MAIN_LOOP SPARE_LOOP
+for i in $(seq 0 $((NR_TARGETS - 1))); do
+    dd if=/dev/zero of=/tmp/${DM_PREFIX}-main-${i}.img bs=1M count=${DEV_SIZE_MB} 2>/dev/null
+    dd if=/dev/zero of=/tmp/${DM_PREFIX}-spare-${i}.img bs=1M count=$((DEV_SIZE_MB / 2)) 2>/dev/null
+    MAIN_LOOP[$i]=$(losetup -f --show /tmp/${DM_PREFIX}-main-${i}.img) || \
+        error_exit "Failed to set up main loop device ${i}"
+    SPARE_LOOP[$i]=$(losetup -f --show /tmp/${DM_PREFIX}-spare-${i}.img) || \
+        error_exit "Failed to set up spare loop device ${i}"
+    MAIN_SECTORS=$(blockdev --getsz ${MAIN_LOOP[$i]})
+    dmsetup create ${DM_PREFIX}-err-${i} --table \
+        "0 ${MAIN_SECTORS} bio-error ${MAIN_LOOP[$i]} ${NO_ERRORS}" || \
+        error_exit "Failed to create ${DM_PREFIX}-err-${i}"
+    dmsetup create ${DM_PREFIX}-${i} --table "0 ${MAIN_SECTORS} dm-remap-v4 \
+/dev/mapper/${DM_PREFIX}-err-${i} ${SPARE_LOOP[$i]} 2 error_domain ${DOMAIN}" || \
+        error_exit "Failed to create ${DM_PREFIX}-${i}"
+done
+sleep 1  # Deferred metadata read
+
+echo -e "${YELLOW}[2/6] Checking the settings...${NC}"
+if [ "$(error_value 0 domain)" = "${DOMAIN}" ] && \
+   [ "$(error_value 0 domain_targets)" = "${NR_TARGETS}" ] && \
+   dmsetup message ${DM_PREFIX}-0 0 set | grep -q "error_domain=${DOMAIN}" && \
+   dmsetup message ${DM_PREFIX}-0 0 set | grep -q "correlated_errors=retry" && \
+   dmsetup table ${DM_PREFIX}-0 | grep -q "error_domain ${DOMAIN}"; then
+    report_test "Domain shown and kept in the table" "PASS"
+else
+    report_test "Domain shown and kept in the table" "FAIL"
+fi
+
+if ! dmsetup message ${DM_PREFIX}-2 0 set error_domain shelf/1 >/dev/null 2>&1 && \
+   ! dmsetup message ${DM_PREFIX}-2 0 set correlated_errors ignore >/dev/null 2>&1 && \
+   dmsetup message ${DM_PREFIX}-2 0 set error_domain none >/dev/null && \
+   [ "$(error_value 0 domain_targets)" = "$((NR_TARGETS - 1))" ] && \
+   [ "$(error_value 2 domain)" = "none" ] && \
+   dmsetup message ${DM_PREFIX}-2 0 set error_domain ${DOMAIN} >/dev/null && \
+   [ "$(error_value 0 domain_targets)" = "${NR_TARGETS}" ]; then
+    report_test "Domains left, joined and checked" "PASS"
+else
+    report_test "Domains left, joined and checked" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/6] Failing one target alone...${NC}"
+BEFORE=$(mappings 0)
+fail_range 1000 1007 0
+read_sector 0 1000
+sleep 2
+fail_range ${NO_ERRORS} 0
+sleep 2  # Past the window
+echo "Mappings of ${DM_PREFIX}-0: ${BEFORE} -> $(mappings 0)"
+if [ "$(mappings 0)" -gt "${BEFORE}" ] && [ "$(error_value 0 correlated)" = "0" ] && \
+   [ "$(error_value 0 bursts)" = "0" ]; then
+    report_test "Lone error remapped" "PASS"
+else
+    report_test "Lone error remapped" "FAIL"
+fi
+
+echo -e "${YELLOW}[4/6] Failing all targets at once...${NC}"
+LOGGED=$(dmesg | grep -c "targets of domain ${DOMAIN} within")
+declare -a BEFORE_ALL
+for i in $(seq 0 $((NR_TARGETS - 1))); do
+    BEFORE_ALL[$i]=$(mappings ${i})
+done
+fail_range 2000 2007 $(seq 0 $((NR_TARGETS - 1)))
+for i in $(seq 0 $((NR_TARGETS - 1))); do
+    read_sector ${i} 2000 &
+done
+wait
+BURST=$(error_value 0 burst)
+fail_range ${NO_ERRORS} $(seq 0 $((NR_TARGETS - 1)))
+sleep 1
+
+REMAPPED=0
+CORRELATED=0
+EVENTS=0
+for i in $(seq 0 $((NR_TARGETS - 1))); do
+    REMAPPED=$(( REMAPPED + $(mappings ${i}) - ${BEFORE_ALL[$i]} ))
+    CORRELATED=$(( CORRELATED + $(error_value ${i} correlated) ))
+    EVENTS=$(( EVENTS + $(dmsetup message ${DM_PREFIX}-${i} 0 events | grep -c " burst ") ))
+done
+LOGGED=$(( $(dmesg | grep -c "targets of domain ${DOMAIN} within") - LOGGED ))
+echo "Remapped: ${REMAPPED}, correlated: ${CORRELATED}, burst events: ${EVENTS}, logged: ${LOGGED}"
+if [ ${REMAPPED} -eq 0 ] && [ ${CORRELATED} -ge ${NR_TARGETS} ] && [ "${BURST}" = "1" ]; then
+    report_test "Correlated errors not remapped" "PASS"
+else
+    report_test "Correlated errors not remapped" "FAIL"
+fi
+if [ ${EVENTS} -eq 1 ] && [ ${LOGGED} -eq 1 ] && [ "$(error_value 1 bursts)" = "1" ]; then
+    report_test "One aggregated event per burst" "PASS"
+else
+    report_test "One aggregated event per burst" "FAIL"
+fi
+
+echo -e "${YELLOW}[5/6] Waiting for the burst to end...${NC}"
+sleep 2
+if [ "$(error_value 0 burst)" = "0" ] && \
+   dmesg | tail -50 | grep -q "Error burst in domain ${DOMAIN} over"; then
+    report_test "Burst over after a quiet window" "PASS"
+else
+    report_test "Burst over after a quiet window" "FAIL"
+fi
+
+echo -e "${YELLOW}[6/6] Failing all targets, then one alone...${NC}"
+BEFORE=$(mappings 0)
+fail_range 3000 3999 $(seq 0 $((NR_TARGETS - 1)))
+for i in $(seq 0 $((NR_TARGETS - 1))); do
+    read_sector ${i} 3000 &
+done
+wait
+BURST=$(error_value 0 burst)
+fail_range ${NO_ERRORS} $(seq 1 $((NR_TARGETS - 1)))
+# Target 0 goes on failing, faster than the window, past the others' errors
+for sector in $(seq 3008 40 3968); do
+    read_sector 0 ${sector}
+    sleep 0.25
+done
+echo "Mappings of ${DM_PREFIX}-0: ${BEFORE} -> $(mappings 0), burst: ${BURST} -> $(error_value 0 burst)"
+if [ "${BURST}" = "1" ] && [ "$(error_value 0 burst)" = "0" ] && \
+   [ "$(mappings 0)" -gt "${BEFORE}" ]; then
+    report_test "Target failing alone after a burst remapped" "PASS"
+else
+    report_test "Target failing alone after a burst remapped" "FAIL"
+fi
+fail_range ${NO_ERRORS} 0
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
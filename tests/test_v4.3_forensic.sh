@@ -0,0 +1,193 @@
+#!/bin/bash
+#
+# test_v4.3_forensic.sh - Read-only (forensic) activation
+#
+# Tests:
+# 1. A "mode ro" target presents remapped sectors from the spare
+# 2. Writes without an overlay fail and remap commands are refused
+# 3. A main device read error is recorded, not remapped
+# 4. With an overlay, reads return what was written
+# 5. Neither the main nor the spare device changed
+#
+# Usage: sudo ./test_v4.3_forensic.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-forensic"
+MAIN_IMG="/tmp/dm-remap-forensic-main.img"
+SPARE_IMG="/tmp/dm-remap-forensic-spare.img"
+OVERLAY_IMG="/tmp/dm-remap-forensic-overlay.img"
+MAIN_LOOP=""
+SPARE_LOOP=""
+OVERLAY_LOOP=""
+DEV_SIZE_MB=64
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    sleep 1
+    for loop in ${MAIN_LOOP} ${SPARE_LOOP} ${OVERLAY_LOOP}; do
+        losetup -d ${loop} 2>/dev/null
+    done
+    rm -f ${MAIN_IMG} ${SPARE_IMG} ${OVERLAY_IMG}
+    rmmod dm_remap 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+# read_pattern <sector> <count> - prints the distinct bytes found
+read_pattern() {
+    dd if=/dev/mapper/${DM_NAME} bs=512 skip=$1 count=$2 iflag=direct 2>/dev/null | \
+        od -An -tx1 -v | tr -s ' ' '\n' | grep -v '^$' | sort -u | tr '\n' ' '
+}
+
+# write_byte <sector> <count> <byte> - as one write
+write_byte() {
+    head -c $(( $2 * 512 )) /dev/zero | tr '\0' "\\$(printf '%03o' $3)" | \
+        dd of=/dev/mapper/${DM_NAME} bs=$(( $2 * 512 )) count=1 iflag=fullblock \
+           seek=$(( $1 * 512 )) oflag=direct,seek_bytes conv=notrunc 2>/dev/null
+}
+
+forensic_value() {
+    dmsetup message ${DM_NAME} 0 forensic | head -1 | tr ' ' '\n' | grep "^$1=" | cut -d= -f2
+}
+
+devices_sum() {
+    cat ${MAIN_LOOP} ${SPARE_LOOP} | md5sum | cut -d' ' -f1
+}
+
+create_target() {
+    dmsetup create ${DM_NAME} --table "0 ${MAIN_SECTORS} dm-remap-v4 ${MAIN_LOOP} ${SPARE_LOOP} $*" || \
+        error_exit "Failed to create ${DM_NAME}"
+    sleep 1  # Deferred metadata read
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+
+echo "========================================="
+echo "dm-remap v4.3 Forensic Activation Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+echo -e "${YELLOW}[1/5] Setting up a target with remapped data...${NC}"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=${DEV_SIZE_MB} 2>/dev/null
+dd if=/dev/zero of=${SPARE_IMG} bs=1M count=${DEV_SIZE_MB} 2>/dev/null
+dd if=/dev/zero of=${OVERLAY_IMG} bs=1M count=8 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG}) || error_exit "Failed to set up main loop device"
+SPARE_LOOP=$(losetup -f --show ${SPARE_IMG}) || error_exit "Failed to set up spare loop device"
+OVERLAY_LOOP=$(losetup -f --show ${OVERLAY_IMG}) || error_exit "Failed to set up overlay loop device"
+MAIN_SECTORS=$(blockdev --getsz ${MAIN_LOOP})
+echo "Main: ${MAIN_LOOP}, spare: ${SPARE_LOOP}, overlay: ${OVERLAY_LOOP}"
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+create_target
+
+# Sectors 0-7 remapped and holding 0xaa, 8-15 on the main device with 0x55
+for i in $(seq 0 7); do
+    dmsetup message ${DM_NAME} 0 test_remap ${i} $(( 4096 + i )) >/dev/null
+done
+sleep 1
+dmsetup remove ${DM_NAME}
+create_target
+write_byte 0 8 0xaa
+write_byte 8 8 0x55
+dmsetup remove ${DM_NAME}
+BEFORE=$(devices_sum)
+
+echo -e "${YELLOW}[2/5] Activating read-only...${NC}"
+create_target 2 mode ro
+if [ "$(read_pattern 0 8)" = "aa " ] && [ "$(read_pattern 8 8)" = "55 " ] && \
+   [ "$(forensic_value mode)" = "ro" ] && \
+   dmsetup table ${DM_NAME} | grep -q "mode ro"; then
+    report_test "Read-only target presents remapped data" "PASS"
+else
+    report_test "Read-only target presents remapped data" "FAIL"
+fi
+
+if ! write_byte 8 8 0x11 && [ "$(read_pattern 8 8)" = "55 " ] && \
+   ! dmsetup message ${DM_NAME} 0 test_remap 100 5000 >/dev/null 2>&1 && \
+   ! dmsetup message ${DM_NAME} 0 set data_checksums on >/dev/null 2>&1; then
+    report_test "Writes and remap commands refused" "PASS"
+else
+    report_test "Writes and remap commands refused" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/5] Injecting a main device read error...${NC}"
+MAPPINGS=$(dmsetup message ${DM_NAME} 0 status)
+dmsetup message ${DM_NAME} 0 inject_error medium 1
+read_pattern 64 8 >/dev/null
+sleep 1
+dmsetup message ${DM_NAME} 0 forensic
+if [ "$(forensic_value bad_extents)" = "1" ] && \
+   dmsetup message ${DM_NAME} 0 forensic | grep -q "^64+8$" && \
+   [ "$(dmsetup message ${DM_NAME} 0 status | cut -d' ' -f1)" = "${MAPPINGS%% *}" ]; then
+    report_test "Read error recorded, not remapped" "PASS"
+else
+    report_test "Read error recorded, not remapped" "FAIL"
+fi
+dmsetup remove ${DM_NAME}
+
+echo -e "${YELLOW}[4/5] Writing through an overlay...${NC}"
+create_target 4 mode ro overlay ${OVERLAY_LOOP}
+write_byte 4 8 0x77
+write_byte 100 8 0x66
+if [ "$(read_pattern 0 4)" = "aa " ] && [ "$(read_pattern 4 8)" = "77 " ] && \
+   [ "$(read_pattern 12 4)" = "55 " ] && [ "$(read_pattern 100 8)" = "66 " ] && \
+   [ "$(forensic_value overlay_used)" = "16" ] && \
+   [ "$(forensic_value overlay_writes)" = "2" ]; then
+    report_test "Overlay holds the writes" "PASS"
+else
+    report_test "Overlay holds the writes" "FAIL"
+fi
+dmsetup remove ${DM_NAME}
+
+echo -e "${YELLOW}[5/5] Checking the devices...${NC}"
+if [ "$(devices_sum)" = "${BEFORE}" ]; then
+    report_test "Main and spare devices unchanged" "PASS"
+else
+    report_test "Main and spare devices unchanged" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
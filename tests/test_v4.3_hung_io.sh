@@ -0,0 +1,192 @@
+#!/bin/bash
+#
+# test_v4.3_hung_io.sh - Hung I/O watchdog ("hung", hung_timeout)
+#
+# Tests:
+# 1. A main device read held by dm-delay is reported past hung_timeout
+# 2. The report raises a dm event and a "hung" entry in the event stream
+# 3. The sector is fed to the health score as a slow region
+# 4. The late completion is logged and nothing is left outstanding
+# 5. hung_timeout 0 turns the watchdog off
+# 6. hung_timeout is kept in the table
+#
+# dm-delay sits under the target as the main device and is switched
+# between no delay and a long one. Needs dm-delay.
+#
+# Usage: sudo ./test_v4.3_hung_io.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-hung"
+DELAY_NAME="test-remap-hung-delay"
+MAIN_IMG="/tmp/dm-remap-hung-main.img"
+SPARE_IMG="/tmp/dm-remap-hung-spare.img"
+MAIN_LOOP=""
+SPARE_LOOP=""
+DD_PID=""
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    [ -n "${DD_PID}" ] && wait ${DD_PID} 2>/dev/null
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    dmsetup remove ${DELAY_NAME} 2>/dev/null || true
+    sleep 1
+    [ -n "${MAIN_LOOP}" ] && losetup -d ${MAIN_LOOP} 2>/dev/null
+    [ -n "${SPARE_LOOP}" ] && losetup -d ${SPARE_LOOP} 2>/dev/null
+    rm -f ${MAIN_IMG} ${SPARE_IMG}
+    rmmod dm_remap 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+hung_value() {
+    dmsetup message ${DM_NAME} 0 hung | head -n 1 | tr ' ' '\n' | grep "^$1=" | cut -d= -f2
+}
+
+# set_delay <ms>: delay every bio to the main device by <ms>
+set_delay() {
+    dmsetup suspend ${DELAY_NAME}
+    dmsetup reload ${DELAY_NAME} --table "0 ${MAIN_SECTORS} delay ${MAIN_LOOP} 0 $1"
+    dmsetup resume ${DELAY_NAME}
+}
+
+# slow_read <block>: start a direct 4k read through the target in the background
+slow_read() {
+    dd if=/dev/mapper/${DM_NAME} of=/dev/null bs=4096 skip=$1 count=1 iflag=direct 2>/dev/null &
+    DD_PID=$!
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+
+echo "========================================="
+echo "dm-remap v4.3 Hung I/O Watchdog Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+modprobe dm-delay || error_exit "dm-delay is required"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/zero of=${SPARE_IMG} bs=1M count=64 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG})
+SPARE_LOOP=$(losetup -f --show ${SPARE_IMG})
+MAIN_SECTORS=$(blockdev --getsz ${MAIN_LOOP})
+dmsetup create ${DELAY_NAME} --table "0 ${MAIN_SECTORS} delay ${MAIN_LOOP} 0 0" || \
+    error_exit "Failed to create delay device"
+dmsetup create ${DM_NAME} --table \
+    "0 ${MAIN_SECTORS} dm-remap-v4 /dev/mapper/${DELAY_NAME} ${SPARE_LOOP} 2 hung_timeout 2" || \
+    error_exit "Failed to create ${DM_NAME}"
+sleep 1  # Deferred metadata read
+
+echo -e "${YELLOW}[1/6] Read held for 8 s...${NC}"
+dmesg -C
+EVENTS_BEFORE=$(dmsetup info -c --noheadings -o events ${DM_NAME})
+set_delay 8000
+slow_read 10240
+sleep 4
+REPLY=$(dmsetup message ${DM_NAME} 0 hung)
+echo "${REPLY}" | sed 's/^/  /'
+if [ "$(hung_value outstanding)" = "1" ] && [ "$(hung_value hung_ios)" = "1" ] && \
+   echo "${REPLY}" | grep -q "^main READ 81920+8 " && dmesg | grep -q "Hung I/O: main READ"; then
+    report_test "Held read reported" "PASS"
+else
+    report_test "Held read reported" "FAIL"
+fi
+
+echo -e "${YELLOW}[2/6] Event...${NC}"
+EVENTS_AFTER=$(dmsetup info -c --noheadings -o events ${DM_NAME})
+if [ "${EVENTS_AFTER}" -gt "${EVENTS_BEFORE}" ] && \
+   dmsetup message ${DM_NAME} 0 events | grep -q " hung 81920+8$"; then
+    report_test "dm event and hung entry in the event stream" "PASS"
+else
+    report_test "dm event and hung entry (events ${EVENTS_BEFORE} -> ${EVENTS_AFTER})" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/6] Health...${NC}"
+HEALTH=$(dmsetup message ${DM_NAME} 0 health)
+echo "  ${HEALTH}"
+if echo "${HEALTH}" | grep -q "slow_ios=1" && echo "${HEALTH}" | grep -q "hotspot_sectors=1"; then
+    report_test "Slow region recorded for health" "PASS"
+else
+    report_test "Slow region recorded for health" "FAIL"
+fi
+
+echo -e "${YELLOW}[4/6] Late completion...${NC}"
+wait ${DD_PID}
+DD_RC=$?
+DD_PID=""
+set_delay 0
+if [ ${DD_RC} -eq 0 ] && dmesg | grep -q "Hung I/O at sector 81920 completed" && \
+   [ "$(hung_value outstanding)" = "0" ]; then
+    report_test "Completion logged, nothing outstanding" "PASS"
+else
+    report_test "Completion logged, nothing outstanding (dd=${DD_RC})" "FAIL"
+fi
+
+echo -e "${YELLOW}[5/6] hung_timeout 0...${NC}"
+dmsetup message ${DM_NAME} 0 set hung_timeout 0 >/dev/null
+dmesg -C
+set_delay 4000
+slow_read 20480
+sleep 3
+wait ${DD_PID}
+DD_PID=""
+set_delay 0
+if [ "$(hung_value hung_ios)" = "1" ] && ! dmesg | grep -q "Hung I/O"; then
+    report_test "Watchdog off" "PASS"
+else
+    report_test "Watchdog off (hung_ios=$(hung_value hung_ios))" "FAIL"
+fi
+
+echo -e "${YELLOW}[6/6] hung_timeout in the table...${NC}"
+dmsetup message ${DM_NAME} 0 set hung_timeout 5 >/dev/null
+TABLE=$(dmsetup table ${DM_NAME})
+echo "  ${TABLE}"
+if echo "${TABLE}" | grep -q "hung_timeout 5"; then
+    report_test "hung_timeout kept in the table" "PASS"
+else
+    report_test "hung_timeout kept in the table" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
@@ -0,0 +1,197 @@
+#!/bin/bash
+#
+# test_v4.3_iocgroup.sh - cgroup and I/O priority of the target's own I/O
+#
+# Tests:
+# 1. <source>_cgroup and <source>_ioprio are shown, kept in the table and
+#    checked
+# 2. A remap's metadata commit is charged to metadata_cgroup
+# 3. io.max on that cgroup throttles the commit
+# 4. Salvage re-reads are charged to the reader's cgroup
+#
+# The spare is a memory-backed null_blk device, so its I/O shows up in
+# io.stat apart from the main device's. Needs cgroup v2 at /sys/fs/cgroup.
+#
+# Usage: sudo ./test_v4.3_iocgroup.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-iocgroup"
+MAIN_IMG="/tmp/dm-remap-iocgroup-main.img"
+MAIN_LOOP=""
+SPARE_DEV=""
+CGROOT="/sys/fs/cgroup"
+CG_META="dm-remap-test-meta"
+CG_USER="dm-remap-test-user"
+DEV_SIZE_MB=64
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    sleep 1
+    rmdir ${CGROOT}/${CG_META} ${CGROOT}/${CG_USER} 2>/dev/null
+    losetup -d ${MAIN_LOOP} 2>/dev/null
+    rm -f ${MAIN_IMG}
+    rmmod dm_remap 2>/dev/null || true
+    rmmod null_blk 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+# io_stat <cgroup> <device> <key> - e.g. io_stat dm-remap-test-meta /dev/nullb0 wbytes
+io_stat() {
+    local dev=$(printf '%d:%d' 0x$(stat -c %t $2) 0x$(stat -c %T $2))
+    local v=$(awk -v d="$dev" '$1 == d' ${CGROOT}/$1/io.stat | tr ' ' '\n' | \
+              grep "^$3=" | cut -d= -f2)
+    echo ${v:-0}
+}
+
+setting() {
+    dmsetup message ${DM_NAME} 0 set | tr ' ' '\n' | grep "^$1=" | cut -d= -f2
+}
+
+mappings() {
+    dmsetup message ${DM_NAME} 0 status | cut -d' ' -f1
+}
+
+# fail_read <sector> - read a sector with the next main device read failing
+fail_read() {
+    dmsetup message ${DM_NAME} 0 inject_error medium 1
+    dd if=/dev/mapper/${DM_NAME} of=/dev/null bs=512 skip=$1 count=8 iflag=direct 2>/dev/null
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+grep -qw io ${CGROOT}/cgroup.controllers 2>/dev/null || \
+    error_exit "No cgroup v2 io controller at ${CGROOT}"
+
+echo "========================================="
+echo "dm-remap v4.3 I/O Attribution Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+echo -e "${YELLOW}[1/5] Setting up...${NC}"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=${DEV_SIZE_MB} 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG}) || error_exit "Failed to set up main loop device"
+rmmod null_blk 2>/dev/null || true
+modprobe null_blk nr_devices=1 gb=1 memory_backed=1 || error_exit "Failed to load null_blk"
+SPARE_DEV=/dev/nullb0
+MAIN_SECTORS=$(blockdev --getsz ${MAIN_LOOP})
+echo "Main: ${MAIN_LOOP}, spare: ${SPARE_DEV}"
+
+echo "+io" > ${CGROOT}/cgroup.subtree_control
+mkdir -p ${CGROOT}/${CG_META} ${CGROOT}/${CG_USER}
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+dmsetup create ${DM_NAME} --table "0 ${MAIN_SECTORS} dm-remap-v4 ${MAIN_LOOP} ${SPARE_DEV} \
+4 metadata_cgroup /${CG_META} copy_ioprio idle" || error_exit "Failed to create ${DM_NAME}"
+sleep 1  # Deferred metadata read
+dmsetup message ${DM_NAME} 0 set salvage_retries 1 >/dev/null
+
+echo -e "${YELLOW}[2/5] Checking the settings...${NC}"
+if [ "$(setting metadata_cgroup)" = "/${CG_META}" ] && [ "$(setting copy_ioprio)" = "idle" ] && \
+   [ "$(setting metadata_ioprio)" = "be:0" ] && [ "$(setting repair_cgroup)" = "none" ] && \
+   dmsetup table ${DM_NAME} | grep -q "metadata_cgroup /${CG_META}" && \
+   dmsetup table ${DM_NAME} | grep -q "copy_ioprio idle"; then
+    report_test "Settings shown and kept in the table" "PASS"
+else
+    report_test "Settings shown and kept in the table" "FAIL"
+fi
+
+if ! dmsetup message ${DM_NAME} 0 set repair_cgroup /no-such-cgroup >/dev/null 2>&1 && \
+   ! dmsetup message ${DM_NAME} 0 set repair_ioprio be:8 >/dev/null 2>&1 && \
+   ! dmsetup message ${DM_NAME} 0 set repair_cgroup relative >/dev/null 2>&1 && \
+   [ "$(setting repair_cgroup)" = "none" ] && \
+   dmsetup message ${DM_NAME} 0 set repair_ioprio rt:3 >/dev/null && \
+   [ "$(setting repair_ioprio)" = "rt:3" ]; then
+    report_test "Unknown cgroups and priorities refused" "PASS"
+else
+    report_test "Unknown cgroups and priorities refused" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/5] Remapping a failed read...${NC}"
+BEFORE=$(io_stat ${CG_META} ${SPARE_DEV} wbytes)
+MAPPINGS=$(mappings)
+fail_read 1000
+sleep 2
+AFTER=$(io_stat ${CG_META} ${SPARE_DEV} wbytes)
+echo "Spare bytes written by ${CG_META}: $(( AFTER - BEFORE ))"
+if [ "$(mappings)" != "${MAPPINGS}" ] && [ $(( AFTER - BEFORE )) -ge 131072 ]; then
+    report_test "Metadata commit charged to metadata_cgroup" "PASS"
+else
+    report_test "Metadata commit charged to metadata_cgroup" "FAIL"
+fi
+
+echo -e "${YELLOW}[4/5] Throttling the metadata cgroup...${NC}"
+SPARE_MAJMIN=$(printf '%d:%d' 0x$(stat -c %t ${SPARE_DEV}) 0x$(stat -c %T ${SPARE_DEV}))
+echo "${SPARE_MAJMIN} wbps=262144" > ${CGROOT}/${CG_META}/io.max
+START=$(date +%s%N)
+fail_read 3000
+ELAPSED_MS=$(( ($(date +%s%N) - START) / 1000000 ))
+echo "${SPARE_MAJMIN} wbps=max" > ${CGROOT}/${CG_META}/io.max
+echo "Failed read completed after ${ELAPSED_MS} ms"
+# Five 128 KiB metadata copies at 256 KiB/s
+if [ ${ELAPSED_MS} -ge 1000 ]; then
+    report_test "io.max throttles metadata commits" "PASS"
+else
+    report_test "io.max throttles metadata commits" "FAIL"
+fi
+
+echo -e "${YELLOW}[5/5] Reading a failing sector from another cgroup...${NC}"
+BEFORE=$(io_stat ${CG_USER} ${MAIN_LOOP} rbytes)
+(
+    echo ${BASHPID} > ${CGROOT}/${CG_USER}/cgroup.procs
+    fail_read 5000
+)
+sleep 2
+AFTER=$(io_stat ${CG_USER} ${MAIN_LOOP} rbytes)
+# The read itself and at least one re-read of its 4 KiB
+echo "Main device bytes read by ${CG_USER}: $(( AFTER - BEFORE ))"
+if [ $(( AFTER - BEFORE )) -ge 8192 ]; then
+    report_test "Salvage re-reads charged to the reader" "PASS"
+else
+    report_test "Salvage re-reads charged to the reader" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
@@ -0,0 +1,200 @@
+#!/bin/bash
+#
+# test_v4.3_main_resize.sh - Main device resize by table reload
+#
+# Tests:
+# 1. A shorter table that would lose remaps is refused, nothing changes
+# 2. "shrink_policy drop" shrinks and drops the remaps beyond the end
+# 3. Growing back keeps the remaining remaps and maps the new sectors
+# 4. The new length is in the metadata when the target is recreated
+#
+# All reloads happen under fio with verification. Needs dm-dust and fio.
+#
+# Usage: sudo ./test_v4.3_main_resize.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-resize"
+DUST_NAME="test-remap-resize-dust"
+MAIN_IMG="/tmp/dm-remap-resize-main.img"
+SPARE_IMG="/tmp/dm-remap-resize-spare.img"
+PATTERN="/tmp/dm-remap-resize-pattern.bin"
+FIO_LOG="/tmp/dm-remap-resize-fio.log"
+MAIN_LOOP=""
+SPARE_LOOP=""
+FIO_PID=""
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    [ -n "${FIO_PID}" ] && kill ${FIO_PID} 2>/dev/null
+    dmsetup resume ${DM_NAME} 2>/dev/null || true
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    dmsetup remove ${DUST_NAME} 2>/dev/null || true
+    sleep 1
+    [ -n "${MAIN_LOOP}" ] && losetup -d ${MAIN_LOOP} 2>/dev/null
+    [ -n "${SPARE_LOOP}" ] && losetup -d ${SPARE_LOOP} 2>/dev/null
+    rm -f ${MAIN_IMG} ${SPARE_IMG} ${PATTERN} ${FIO_LOG}
+    rmmod dm_remap 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+mappings() {
+    dmsetup message ${DM_NAME} 0 status | tr ' ' '\n' | grep '^mappings=' | cut -d= -f2
+}
+
+# table <sectors> [<features>...]
+table() {
+    local sectors=$1
+    shift
+    echo "0 ${sectors} dm-remap-v4 /dev/mapper/${DUST_NAME} ${SPARE_LOOP} $*"
+}
+
+# reload <sectors> [<features>...]: swap in a table of the given length
+reload() {
+    dmsetup reload ${DM_NAME} --table "$(table "$@")" && dmsetup resume ${DM_NAME}
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+command -v fio >/dev/null 2>&1 || error_exit "fio is required"
+
+echo "========================================="
+echo "dm-remap v4.3 Main Device Resize Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+modprobe dm-dust || error_exit "dm-dust is required"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=128 2>/dev/null
+dd if=/dev/zero of=${SPARE_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/urandom of=${PATTERN} bs=4096 count=1 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG})
+SPARE_LOOP=$(losetup -f --show ${SPARE_IMG})
+FULL=$(blockdev --getsz ${MAIN_LOOP})
+HALF=$((FULL / 2))
+dmsetup create ${DUST_NAME} --table "0 ${FULL} dust ${MAIN_LOOP} 0 512" || \
+    error_exit "Failed to create dust device"
+dmsetup create ${DM_NAME} --table "$(table ${FULL})" || error_exit "Failed to create ${DM_NAME}"
+
+# One remap in each half of the device
+for block in 100 30000; do
+    dmsetup message ${DUST_NAME} 0 addbadblock $((block * 8)) >/dev/null
+done
+dmsetup message ${DUST_NAME} 0 enable >/dev/null
+for block in 100 30000; do
+    dd if=/dev/mapper/${DM_NAME} of=/dev/null bs=4096 skip=${block} count=1 iflag=direct 2>/dev/null
+done
+sleep 2  # Let the write-ahead remaps commit
+[ "$(mappings)" = "2" ] || error_exit "Expected 2 remaps, got $(mappings)"
+
+# Keep verified writes going in the first 32MB through every reload
+fio --name=resize --filename=/dev/mapper/${DM_NAME} --direct=1 \
+    --rw=randwrite --bs=4k --iodepth=8 --ioengine=libaio \
+    --offset=1M --size=31M --runtime=40 --time_based \
+    --verify=crc32c --verify_fatal=1 --verify_backlog=1024 \
+    >${FIO_LOG} 2>&1 &
+FIO_PID=$!
+sleep 2
+
+echo -e "${YELLOW}[1/4] Shrink that would lose a remap...${NC}"
+REFUSED=0
+reload ${HALF} 2>/dev/null || REFUSED=1
+dmsetup reload ${DM_NAME} --table "$(table ${FULL})"
+dmsetup resume ${DM_NAME} || error_exit "Resume with the old length failed"
+if [ ${REFUSED} -eq 1 ] && [ "$(mappings)" = "2" ] && \
+   [ "$(blockdev --getsz /dev/mapper/${DM_NAME})" = "${FULL}" ]; then
+    report_test "Lossy shrink refused" "PASS"
+else
+    report_test "Lossy shrink refused (refused=${REFUSED}, mappings=$(mappings))" "FAIL"
+fi
+
+echo -e "${YELLOW}[2/4] Shrink with shrink_policy drop...${NC}"
+dmesg -C
+reload ${HALF} 2 shrink_policy drop || error_exit "Shrink with drop refused"
+dmesg | grep "Main device resized" | sed 's/^/  /'
+if [ "$(mappings)" = "1" ] && [ "$(blockdev --getsz /dev/mapper/${DM_NAME})" = "${HALF}" ] && \
+   dmesg | grep -q "1 remaps dropped"; then
+    report_test "Shrunk, remap beyond the end dropped" "PASS"
+else
+    report_test "Shrunk, remap beyond the end dropped (mappings=$(mappings))" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/4] Grow back...${NC}"
+reload ${FULL} || error_exit "Grow refused"
+GROWN=0
+if dd if=${PATTERN} of=/dev/mapper/${DM_NAME} bs=4096 seek=30000 count=1 \
+      oflag=direct conv=notrunc 2>/dev/null && \
+   dd if=/dev/mapper/${DM_NAME} bs=4096 skip=30000 count=1 iflag=direct 2>/dev/null | \
+      cmp -s - ${PATTERN}; then
+    GROWN=1
+fi
+if [ "$(mappings)" = "1" ] && [ "$(blockdev --getsz /dev/mapper/${DM_NAME})" = "${FULL}" ] && \
+   [ ${GROWN} -eq 1 ]; then
+    report_test "Grown, remaps kept and new sectors usable" "PASS"
+else
+    report_test "Grown, remaps kept and new sectors usable (mappings=$(mappings))" "FAIL"
+fi
+
+wait ${FIO_PID}
+FIO_RC=$?
+FIO_PID=""
+if [ ${FIO_RC} -ne 0 ]; then
+    tail -n 20 ${FIO_LOG}
+    report_test "fio verified through the reloads" "FAIL"
+else
+    report_test "fio verified through the reloads" "PASS"
+fi
+
+echo -e "${YELLOW}[4/4] New length persisted...${NC}"
+dmsetup remove ${DM_NAME}
+dmesg -C
+dmsetup create ${DM_NAME} --table "$(table ${FULL})" || error_exit "Failed to recreate ${DM_NAME}"
+if [ "$(mappings)" = "1" ] && ! dmesg | grep -q "Main device resized"; then
+    report_test "Metadata records the new length" "PASS"
+else
+    report_test "Metadata records the new length (mappings=$(mappings))" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
@@ -0,0 +1,181 @@
+#!/bin/bash
+#
+# test_v4.3_remap_pipeline.sh - Remap pipeline timing ("pipeline" message)
+#
+# Tests:
+# 1. Every write-ahead remap is timed in every stage
+# 2. The stages add up: total is at least queue + alloc + serialize + write
+# 3. Metadata bytes are whole 5-copy generations, at least one per remap
+# 4. clear_stats resets the histograms and counters
+#
+# Prints the pipeline report after the remaps, so it doubles as a remap
+# creation benchmark: REMAPS=<n> sets how many blocks fail. Needs dm-dust.
+#
+# Usage: sudo ./test_v4.3_remap_pipeline.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-pipeline"
+DUST_NAME="test-remap-pipeline-dust"
+MAIN_IMG="/tmp/dm-remap-pipeline-main.img"
+SPARE_IMG="/tmp/dm-remap-pipeline-spare.img"
+MAIN_LOOP=""
+SPARE_LOOP=""
+REMAPS=${REMAPS:-16}
+GENERATION_BYTES=$((5 * 131072))
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    dmsetup remove ${DUST_NAME} 2>/dev/null || true
+    sleep 1
+    [ -n "${MAIN_LOOP}" ] && losetup -d ${MAIN_LOOP} 2>/dev/null
+    [ -n "${SPARE_LOOP}" ] && losetup -d ${SPARE_LOOP} 2>/dev/null
+    rm -f ${MAIN_IMG} ${SPARE_IMG}
+    rmmod dm_remap 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+# pipeline_value <line> <key>: <line> is "counters" or a stage name
+pipeline_value() {
+    local out
+    out=$(dmsetup message ${DM_NAME} 0 pipeline)
+    if [ "$1" = "counters" ]; then
+        echo "${out}" | head -n 1
+    else
+        echo "${out}" | grep "^$1 "
+    fi | tr ' ' '\n' | grep "^$2=" | cut -d= -f2
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+
+echo "========================================="
+echo "dm-remap v4.3 Remap Pipeline Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+modprobe dm-dust || error_exit "dm-dust is required"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/zero of=${SPARE_IMG} bs=1M count=64 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG})
+SPARE_LOOP=$(losetup -f --show ${SPARE_IMG})
+MAIN_SECTORS=$(blockdev --getsz ${MAIN_LOOP})
+dmsetup create ${DUST_NAME} --table "0 ${MAIN_SECTORS} dust ${MAIN_LOOP} 0 512" || \
+    error_exit "Failed to create dust device"
+dmsetup create ${DM_NAME} --table \
+    "0 ${MAIN_SECTORS} dm-remap-v4 /dev/mapper/${DUST_NAME} ${SPARE_LOOP}" || \
+    error_exit "Failed to create ${DM_NAME}"
+sleep 1  # Deferred metadata read
+dmsetup message ${DM_NAME} 0 clear_stats >/dev/null
+
+# One bad block every 100 blocks, read one at a time so each gets its own work
+for i in $(seq 1 ${REMAPS}); do
+    dmsetup message ${DUST_NAME} 0 addbadblock $((i * 800)) >/dev/null
+done
+dmsetup message ${DUST_NAME} 0 enable >/dev/null
+START=$(date +%s%N)
+for i in $(seq 1 ${REMAPS}); do
+    dd if=/dev/mapper/${DM_NAME} of=/dev/null bs=4096 skip=$((i * 100)) count=1 \
+        iflag=direct 2>/dev/null
+    for wait in $(seq 1 50); do
+        [ "$(pipeline_value counters remaps)" = "${i}" ] && break
+        sleep 0.1
+    done
+done
+ELAPSED_MS=$((($(date +%s%N) - START) / 1000000))
+sleep 1  # Background write recording the last remap ACTIVE
+
+echo ""
+echo "${REMAPS} remaps in ${ELAPSED_MS}ms:"
+dmsetup message ${DM_NAME} 0 pipeline | sed 's/^/  /'
+echo ""
+
+echo -e "${YELLOW}[1/4] Every remap timed...${NC}"
+TIMED=1
+for stage in queue alloc serialize write total; do
+    [ "$(pipeline_value ${stage} count)" = "${REMAPS}" ] || TIMED=0
+done
+if [ "$(pipeline_value counters remaps)" = "${REMAPS}" ] && [ ${TIMED} -eq 1 ]; then
+    report_test "${REMAPS} remaps timed in every stage" "PASS"
+else
+    report_test "${REMAPS} remaps timed in every stage" "FAIL"
+fi
+
+echo -e "${YELLOW}[2/4] Stages add up...${NC}"
+SUM=0
+for stage in queue alloc serialize write; do
+    SUM=$((SUM + $(pipeline_value ${stage} avg_us)))
+done
+TOTAL=$(pipeline_value total avg_us)
+# Each average rounds down by up to 1us
+if [ $((TOTAL + 4)) -ge ${SUM} ] && [ "$(pipeline_value write max_us)" -le "$(pipeline_value total max_us)" ]; then
+    report_test "total (${TOTAL}us) covers the stages (${SUM}us)" "PASS"
+else
+    report_test "total (${TOTAL}us) covers the stages (${SUM}us)" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/4] Metadata bytes...${NC}"
+WRITES=$(pipeline_value counters metadata_writes)
+BYTES=$(pipeline_value counters metadata_bytes)
+REMAPPED=$(pipeline_value counters remapped_bytes)
+if [ ${WRITES} -ge ${REMAPS} ] && [ ${BYTES} -eq $((WRITES * GENERATION_BYTES)) ] && \
+   [ "$(pipeline_value counters bytes_per_data_byte)" = "$((BYTES / REMAPPED))" ]; then
+    report_test "${WRITES} generations of ${GENERATION_BYTES} bytes for ${REMAPPED} bytes remapped" "PASS"
+else
+    report_test "Metadata bytes (writes=${WRITES} bytes=${BYTES} remapped=${REMAPPED})" "FAIL"
+fi
+
+echo -e "${YELLOW}[4/4] clear_stats...${NC}"
+dmsetup message ${DM_NAME} 0 clear_stats >/dev/null
+if [ "$(pipeline_value counters remaps)" = "0" ] && [ "$(pipeline_value counters metadata_bytes)" = "0" ] && \
+   [ "$(pipeline_value total count)" = "0" ]; then
+    report_test "Pipeline statistics cleared" "PASS"
+else
+    report_test "Pipeline statistics cleared" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
@@ -0,0 +1,212 @@
+#!/bin/bash
+#
+# test_v4.3_replace_spare.sh - Live spare replacement ("replace_spare" message)
+#
+# Tests:
+# 1. Unusable replacements are refused
+# 2. The spare is replaced while writes continue
+# 3. Remapped data reads back the same from the new spare
+# 4. The table names the new spare and recreating from it keeps the remaps
+#
+# Needs dm-dust.
+#
+# Usage: sudo ./test_v4.3_replace_spare.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-replace"
+DUST_NAME="test-remap-replace-dust"
+MAIN_IMG="/tmp/dm-remap-replace-main.img"
+SPARE_IMG="/tmp/dm-remap-replace-spare.img"
+NEW_IMG="/tmp/dm-remap-replace-new.img"
+SMALL_IMG="/tmp/dm-remap-replace-small.img"
+PATTERN="/tmp/dm-remap-replace-pattern.bin"
+MAIN_LOOP=""
+SPARE_LOOP=""
+NEW_LOOP=""
+SMALL_LOOP=""
+WRITER_PID=""
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    [ -n "${WRITER_PID}" ] && kill ${WRITER_PID} 2>/dev/null
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    dmsetup remove ${DUST_NAME} 2>/dev/null || true
+    sleep 1
+    for loop in ${MAIN_LOOP} ${SPARE_LOOP} ${NEW_LOOP} ${SMALL_LOOP}; do
+        losetup -d ${loop} 2>/dev/null
+    done
+    rm -f ${MAIN_IMG} ${SPARE_IMG} ${NEW_IMG} ${SMALL_IMG} ${PATTERN}
+    rmmod dm_remap 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+replace_value() {
+    dmsetup message ${DM_NAME} 0 replace_spare | tr ' ' '\n' | grep "^$1=" | cut -d= -f2
+}
+
+mappings() {
+    dmsetup message ${DM_NAME} 0 status | tr ' ' '\n' | grep '^mappings=' | cut -d= -f2
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+
+echo "========================================="
+echo "dm-remap v4.3 Spare Replacement Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+modprobe dm-dust || error_exit "dm-dust is required"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/zero of=${SPARE_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/zero of=${NEW_IMG} bs=1M count=128 2>/dev/null
+dd if=/dev/zero of=${SMALL_IMG} bs=1M count=1 2>/dev/null
+dd if=/dev/urandom of=${PATTERN} bs=4096 count=1 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG})
+SPARE_LOOP=$(losetup -f --show ${SPARE_IMG})
+NEW_LOOP=$(losetup -f --show ${NEW_IMG})
+SMALL_LOOP=$(losetup -f --show ${SMALL_IMG})
+dmsetup create ${DUST_NAME} --table "0 $(blockdev --getsz ${MAIN_LOOP}) dust ${MAIN_LOOP} 0 512" || \
+    error_exit "Failed to create dust device"
+dmsetup create ${DM_NAME} --table \
+    "0 $(blockdev --getsz /dev/mapper/${DUST_NAME}) dm-remap-v4 /dev/mapper/${DUST_NAME} ${SPARE_LOOP}" || \
+    error_exit "Failed to create ${DM_NAME}"
+sleep 1  # Deferred metadata read
+
+# Remap a few blocks and put known data on them
+for block in 100 2000 5000; do
+    dmsetup message ${DUST_NAME} 0 addbadblock $((block * 8)) >/dev/null
+done
+dmsetup message ${DUST_NAME} 0 enable >/dev/null
+for block in 100 2000 5000; do
+    dd if=/dev/mapper/${DM_NAME} of=/dev/null bs=4096 skip=${block} count=1 iflag=direct 2>/dev/null
+done
+sleep 2  # Let the write-ahead remaps commit
+for block in 100 2000 5000; do
+    dd if=${PATTERN} of=/dev/mapper/${DM_NAME} bs=4096 seek=${block} count=1 oflag=direct conv=notrunc 2>/dev/null
+done
+REMAPS=$(mappings)
+echo "  ${REMAPS} remaps before replacement"
+
+echo -e "${YELLOW}[1/4] Unusable replacements...${NC}"
+BAD=0
+for dev in ${SPARE_LOOP} ${MAIN_LOOP} ${SMALL_LOOP} /dev/does-not-exist; do
+    if dmsetup message ${DM_NAME} 0 replace_spare ${dev} >/dev/null 2>&1; then
+        echo "  accepted: ${dev}"
+        BAD=1
+    fi
+done
+dmsetup message ${DM_NAME} 0 replace_spare cancel >/dev/null 2>&1 && BAD=1
+if [ ${BAD} -eq 0 ] && [ "$(replace_value state)" = "idle" ]; then
+    report_test "Unusable replacements refused" "PASS"
+else
+    report_test "Unusable replacements refused" "FAIL"
+fi
+
+echo -e "${YELLOW}[2/4] Replace under I/O...${NC}"
+(
+    while true; do
+        for block in 100 2000 5000 7000; do
+            dd if=${PATTERN} of=/dev/mapper/${DM_NAME} bs=4096 seek=${block} count=1 \
+               oflag=direct conv=notrunc 2>/dev/null
+        done
+    done
+) &
+WRITER_PID=$!
+sleep 1
+dmsetup message ${DM_NAME} 0 replace_spare ${NEW_LOOP} >/dev/null || error_exit "replace_spare refused"
+STATE=""
+for i in $(seq 1 60); do
+    STATE=$(replace_value state)
+    [ "${STATE}" != "copying" ] && [ "${STATE}" != "switching" ] && break
+    sleep 1
+done
+kill ${WRITER_PID} 2>/dev/null
+wait ${WRITER_PID} 2>/dev/null
+WRITER_PID=""
+echo "  $(dmsetup message ${DM_NAME} 0 replace_spare)"
+if [ "${STATE}" = "done" ] && [ "$(replace_value spare)" = "${NEW_LOOP}" ]; then
+    report_test "Spare replaced while writing" "PASS"
+else
+    report_test "Spare replaced while writing (state=${STATE})" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/4] Data after replacement...${NC}"
+DATA_OK=1
+for block in 100 2000 5000 7000; do
+    if ! dd if=/dev/mapper/${DM_NAME} bs=4096 skip=${block} count=1 iflag=direct 2>/dev/null | \
+         cmp -s - ${PATTERN}; then
+        echo "  block ${block} differs"
+        DATA_OK=0
+    fi
+done
+if [ ${DATA_OK} -eq 1 ] && [ "$(mappings)" = "${REMAPS}" ]; then
+    report_test "Remapped data intact" "PASS"
+else
+    report_test "Remapped data intact" "FAIL"
+fi
+
+echo -e "${YELLOW}[4/4] Recreate from the new spare...${NC}"
+SAVED=$(dmsetup table ${DM_NAME})
+echo "  ${SAVED}"
+dmsetup remove ${DM_NAME}
+losetup -d ${SPARE_LOOP}
+SPARE_LOOP=""
+dmsetup create ${DM_NAME} --table "${SAVED}" || error_exit "Saved table refused: ${SAVED}"
+sleep 1
+DATA_OK=1
+for block in 100 2000 5000; do
+    dd if=/dev/mapper/${DM_NAME} bs=4096 skip=${block} count=1 iflag=direct 2>/dev/null | \
+        cmp -s - ${PATTERN} || DATA_OK=0
+done
+if echo "${SAVED}" | grep -q " ${NEW_LOOP}\b" && [ "$(mappings)" = "${REMAPS}" ] && [ ${DATA_OK} -eq 1 ]; then
+    report_test "New spare carries remaps and data" "PASS"
+else
+    report_test "New spare carries remaps and data (mappings=$(mappings))" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
@@ -0,0 +1,175 @@
+#!/bin/bash
+#
+# test_v4.3_salvage.sh - Read salvage before remapping
+#
+# Tests:
+# 1. A read that fails once is re-read, succeeds and is not remapped
+# 2. A read that keeps failing is remapped, the failed sector reads as zeros
+# 3. With salvage_sectors the good parts of the extent reach the spare
+# 4. salvage_retries 0 remaps without re-reading
+#
+# The loop devices have 512-byte sectors, so without remap_granularity
+# only the failed sector is remapped.
+#
+# Usage: sudo ./test_v4.3_salvage.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-salvage"
+DUST_NAME="test-remap-salvage-dust"
+MAIN_IMG="/tmp/dm-remap-salvage-main.img"
+SPARE_IMG="/tmp/dm-remap-salvage-spare.img"
+PATTERN="/tmp/dm-remap-salvage-pattern.bin"
+MAIN_LOOP=""
+SPARE_LOOP=""
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    dmsetup remove ${DUST_NAME} 2>/dev/null || true
+    sleep 1
+    [ -n "${MAIN_LOOP}" ] && losetup -d ${MAIN_LOOP} 2>/dev/null
+    [ -n "${SPARE_LOOP}" ] && losetup -d ${SPARE_LOOP} 2>/dev/null
+    rm -f ${MAIN_IMG} ${SPARE_IMG} ${PATTERN}
+    rmmod dm_remap 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+mappings() {
+    dmsetup message ${DM_NAME} 0 status | tr ' ' '\n' | grep '^mappings=' | cut -d= -f2
+}
+
+error_value() {
+    dmsetup message ${DM_NAME} 0 errors | tr ' ' '\n' | grep "^$1=" | cut -d= -f2
+}
+
+# read_blocks <block> <count>: direct 4k reads through the target to stdout
+read_blocks() {
+    dd if=/dev/mapper/${DM_NAME} bs=4096 skip=$1 count=$2 iflag=direct 2>/dev/null
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+
+echo "========================================="
+echo "dm-remap v4.3 Read Salvage Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+modprobe dm-dust || error_exit "dm-dust is required"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/zero of=${SPARE_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/urandom of=${PATTERN} bs=4096 count=8 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG})
+SPARE_LOOP=$(losetup -f --show ${SPARE_IMG})
+MAIN_SECTORS=$(blockdev --getsz ${MAIN_LOOP})
+dmsetup create ${DUST_NAME} --table "0 ${MAIN_SECTORS} dust ${MAIN_LOOP} 0 512" || \
+    error_exit "Failed to create dust device"
+dmsetup create ${DM_NAME} --table \
+    "0 ${MAIN_SECTORS} dm-remap-v4 /dev/mapper/${DUST_NAME} ${SPARE_LOOP}" || \
+    error_exit "Failed to create ${DM_NAME}"
+sleep 1  # Deferred metadata read
+
+# Known data in 32KB at block 200 (sector 1600, 64-sector aligned) and at block 100
+dd if=${PATTERN} of=/dev/mapper/${DM_NAME} bs=4096 seek=200 count=8 \
+    oflag=direct conv=notrunc 2>/dev/null || error_exit "Pattern write failed"
+dd if=${PATTERN} of=/dev/mapper/${DM_NAME} bs=4096 seek=100 count=1 \
+    oflag=direct conv=notrunc 2>/dev/null || error_exit "Pattern write failed"
+
+echo -e "${YELLOW}[1/4] Transient read error...${NC}"
+dmsetup message ${DM_NAME} 0 inject_error medium >/dev/null
+if read_blocks 100 1 | cmp -s - <(head -c 4096 ${PATTERN}) && \
+   [ "$(error_value salvage_transient)" = "1" ] && [ "$(mappings)" = "0" ]; then
+    report_test "Re-read succeeded, nothing remapped" "PASS"
+else
+    report_test "Re-read succeeded, nothing remapped ($(dmsetup message ${DM_NAME} 0 errors))" "FAIL"
+fi
+
+echo -e "${YELLOW}[2/4] Hard read error...${NC}"
+dmsetup message ${DUST_NAME} 0 addbadblock 800 >/dev/null
+dmsetup message ${DUST_NAME} 0 enable >/dev/null
+FAILED=0
+read_blocks 100 1 >/dev/null || FAILED=1
+sleep 2  # Let the remap commit
+if [ ${FAILED} -eq 1 ] && [ "$(error_value salvage_hard)" = "1" ] && \
+   [ "$(error_value salvage_lost)" = "8" ] && [ "$(mappings)" -ge 1 ] && \
+   read_blocks 100 1 | cmp -s - <(head -c 512 /dev/zero; tail -c +513 ${PATTERN} | head -c 3584); then
+    report_test "Unreadable sector remapped, reads back as zeros" "PASS"
+else
+    report_test "Unreadable block remapped ($(dmsetup message ${DM_NAME} 0 errors))" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/4] Salvage in 4KB units...${NC}"
+dmsetup message ${DM_NAME} 0 set remap_granularity 64 >/dev/null
+dmsetup message ${DM_NAME} 0 set salvage_sectors 8 >/dev/null
+dmsetup message ${DM_NAME} 0 clear_stats >/dev/null
+dmsetup message ${DUST_NAME} 0 addbadblock 1608 >/dev/null
+FAILED=0
+read_blocks 200 8 >/dev/null || FAILED=1
+sleep 3  # Unit re-reads and the remap
+EXPECTED=$( (head -c 4096 ${PATTERN}; head -c 4096 /dev/zero; tail -c +8193 ${PATTERN}) | md5sum)
+ACTUAL=$(read_blocks 200 8 | md5sum)
+if [ ${FAILED} -eq 1 ] && [ "$(error_value salvage_recovered)" = "56" ] && \
+   [ "$(error_value salvage_lost)" = "8" ] && [ "${ACTUAL}" = "${EXPECTED}" ]; then
+    report_test "Readable units copied to the spare, lost unit zeroed" "PASS"
+else
+    report_test "Readable units copied to the spare ($(dmsetup message ${DM_NAME} 0 errors))" "FAIL"
+fi
+
+echo -e "${YELLOW}[4/4] Salvage off...${NC}"
+dmsetup message ${DM_NAME} 0 set salvage_retries 0 >/dev/null
+dmsetup message ${DM_NAME} 0 clear_stats >/dev/null
+REMAPS=$(mappings)
+dmsetup message ${DUST_NAME} 0 addbadblock 4000 >/dev/null
+read_blocks 500 1 >/dev/null
+sleep 2
+if [ "$(error_value salvage_hard)" = "0" ] && [ "$(mappings)" -gt "${REMAPS}" ]; then
+    report_test "Remapped without re-reading" "PASS"
+else
+    report_test "Remapped without re-reading ($(dmsetup message ${DM_NAME} 0 errors))" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
@@ -0,0 +1,154 @@
+#!/bin/bash
+#
+# test_v4.3_spare_grow.sh - Online spare growth ("grow" message)
+#
+# Tests:
+# 1. "grow" on an unchanged spare changes nothing
+# 2. A spare extended under the live target is picked up
+# 3. Shrinking below the sectors in use is refused
+# 4. The new size is in the metadata when the target is recreated
+#
+# Usage: sudo ./test_v4.3_spare_grow.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-grow"
+MAIN_IMG="/tmp/dm-remap-grow-main.img"
+SPARE_IMG="/tmp/dm-remap-grow-spare.img"
+MAIN_LOOP=""
+SPARE_LOOP=""
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    sleep 1
+    [ -n "${MAIN_LOOP}" ] && losetup -d ${MAIN_LOOP} 2>/dev/null
+    [ -n "${SPARE_LOOP}" ] && losetup -d ${SPARE_LOOP} 2>/dev/null
+    rm -f ${MAIN_IMG} ${SPARE_IMG}
+    rmmod dm_remap 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+grow_value() {
+    echo "$1" | tr ' ' '\n' | grep "^$2=" | cut -d= -f2
+}
+
+create_target() {
+    dmsetup create ${DM_NAME} --table \
+        "0 $(blockdev --getsz ${MAIN_LOOP}) dm-remap-v4 ${MAIN_LOOP} ${SPARE_LOOP}" || return 1
+    sleep 1  # Deferred metadata read
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+
+echo "========================================="
+echo "dm-remap v4.3 Spare Growth Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/zero of=${SPARE_IMG} bs=1M count=16 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG})
+SPARE_LOOP=$(losetup -f --show ${SPARE_IMG})
+create_target || error_exit "Failed to create ${DM_NAME}"
+
+echo -e "${YELLOW}[1/4] Unchanged spare...${NC}"
+OUT=$(dmsetup message ${DM_NAME} 0 grow)
+echo "  ${OUT}"
+if [ "$(grow_value "${OUT}" old_sectors)" = "32768" ] && \
+   [ "$(grow_value "${OUT}" new_sectors)" = "32768" ]; then
+    report_test "grow without a resize is a no-op" "PASS"
+else
+    report_test "grow without a resize is a no-op" "FAIL"
+fi
+
+echo -e "${YELLOW}[2/4] Grow under the live target...${NC}"
+dd if=/dev/urandom of=/dev/mapper/${DM_NAME} bs=1M count=8 oflag=direct 2>/dev/null &
+IO_PID=$!
+truncate -s 64M ${SPARE_IMG}
+losetup -c ${SPARE_LOOP}
+OUT=$(dmsetup message ${DM_NAME} 0 grow)
+wait ${IO_PID}
+IO_RC=$?
+echo "  ${OUT}"
+if [ "$(grow_value "${OUT}" old_sectors)" = "32768" ] && \
+   [ "$(grow_value "${OUT}" new_sectors)" = "131072" ] && \
+   [ "$(grow_value "${OUT}" alloc_limit)" = "65536" ] && [ ${IO_RC} -eq 0 ]; then
+    report_test "Larger spare picked up online" "PASS"
+else
+    report_test "Larger spare picked up online (io=${IO_RC})" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/4] Shrink below sectors in use...${NC}"
+truncate -s 1M ${SPARE_IMG}
+losetup -c ${SPARE_LOOP}
+if ! dmsetup message ${DM_NAME} 0 grow 2>/dev/null; then
+    truncate -s 64M ${SPARE_IMG}
+    losetup -c ${SPARE_LOOP}
+    OUT=$(dmsetup message ${DM_NAME} 0 grow)
+    if [ "$(grow_value "${OUT}" old_sectors)" = "131072" ]; then
+        report_test "Shrink refused, old size kept" "PASS"
+    else
+        report_test "Shrink refused, old size kept (${OUT})" "FAIL"
+    fi
+else
+    truncate -s 64M ${SPARE_IMG}
+    losetup -c ${SPARE_LOOP}
+    report_test "Shrink refused, old size kept" "FAIL"
+fi
+
+echo -e "${YELLOW}[4/4] New size persisted...${NC}"
+dmesg -C
+dmsetup remove ${DM_NAME}
+create_target || error_exit "Failed to recreate ${DM_NAME}"
+if ! dmesg | grep -q "Spare device size changed" && dmesg | grep -q "Deferred metadata read completed"; then
+    report_test "Metadata records the new spare size" "PASS"
+else
+    report_test "Metadata records the new spare size" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
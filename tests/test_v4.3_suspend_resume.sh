@@ -0,0 +1,189 @@
+#!/bin/bash
+#
+# test_v4.3_suspend_resume.sh - Remap index across suspend/resume
+#
+# Tests:
+# 1. Remaps survive a suspend/resume and data reads back
+# 2. Repeated suspend/resume under fio with verification
+# 3. Resume is refused while the main device is too small
+#
+# Needs dm-dust and fio.
+#
+# Usage: sudo ./test_v4.3_suspend_resume.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-suspend"
+DUST_NAME="test-remap-suspend-dust"
+MAIN_IMG="/tmp/dm-remap-suspend-main.img"
+SPARE_IMG="/tmp/dm-remap-suspend-spare.img"
+PATTERN="/tmp/dm-remap-suspend-pattern.bin"
+FIO_LOG="/tmp/dm-remap-suspend-fio.log"
+MAIN_LOOP=""
+SPARE_LOOP=""
+FIO_PID=""
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    [ -n "${FIO_PID}" ] && kill ${FIO_PID} 2>/dev/null
+    dmsetup resume ${DM_NAME} 2>/dev/null || true
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    dmsetup remove ${DUST_NAME} 2>/dev/null || true
+    sleep 1
+    [ -n "${MAIN_LOOP}" ] && losetup -d ${MAIN_LOOP} 2>/dev/null
+    [ -n "${SPARE_LOOP}" ] && losetup -d ${SPARE_LOOP} 2>/dev/null
+    rm -f ${MAIN_IMG} ${SPARE_IMG} ${PATTERN} ${FIO_LOG}
+    rmmod dm_remap 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+mappings() {
+    dmsetup message ${DM_NAME} 0 status | tr ' ' '\n' | grep '^mappings=' | cut -d= -f2
+}
+
+check_pattern() {
+    local block
+    for block in 100 2000 5000; do
+        dd if=/dev/mapper/${DM_NAME} bs=4096 skip=${block} count=1 iflag=direct 2>/dev/null | \
+            cmp -s - ${PATTERN} || return 1
+    done
+    return 0
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+command -v fio >/dev/null 2>&1 || error_exit "fio is required"
+
+echo "========================================="
+echo "dm-remap v4.3 Suspend/Resume Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+modprobe dm-dust || error_exit "dm-dust is required"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=128 2>/dev/null
+dd if=/dev/zero of=${SPARE_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/urandom of=${PATTERN} bs=4096 count=1 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG})
+SPARE_LOOP=$(losetup -f --show ${SPARE_IMG})
+MAIN_SECTORS=$(blockdev --getsz ${MAIN_LOOP})
+dmsetup create ${DUST_NAME} --table "0 ${MAIN_SECTORS} dust ${MAIN_LOOP} 0 512" || \
+    error_exit "Failed to create dust device"
+dmsetup create ${DM_NAME} --table \
+    "0 ${MAIN_SECTORS} dm-remap-v4 /dev/mapper/${DUST_NAME} ${SPARE_LOOP}" || \
+    error_exit "Failed to create ${DM_NAME}"
+sleep 1  # Deferred metadata read
+
+# Remap a few blocks and put known data on them
+for block in 100 2000 5000; do
+    dmsetup message ${DUST_NAME} 0 addbadblock $((block * 8)) >/dev/null
+done
+dmsetup message ${DUST_NAME} 0 enable >/dev/null
+for block in 100 2000 5000; do
+    dd if=/dev/mapper/${DM_NAME} of=/dev/null bs=4096 skip=${block} count=1 iflag=direct 2>/dev/null
+done
+sleep 2  # Let the write-ahead remaps commit
+for block in 100 2000 5000; do
+    dd if=${PATTERN} of=/dev/mapper/${DM_NAME} bs=4096 seek=${block} count=1 oflag=direct conv=notrunc 2>/dev/null
+done
+REMAPS=$(mappings)
+echo "  ${REMAPS} remaps before suspending"
+
+echo -e "${YELLOW}[1/3] Single suspend/resume...${NC}"
+dmesg -C
+dmsetup suspend ${DM_NAME} || error_exit "suspend failed"
+dmsetup resume ${DM_NAME} || error_exit "resume failed"
+if [ "$(mappings)" = "${REMAPS}" ] && check_pattern && \
+   ! dmesg | grep -q "reloading remaps"; then
+    report_test "Remap index kept across suspend" "PASS"
+else
+    report_test "Remap index kept across suspend (mappings=$(mappings))" "FAIL"
+fi
+
+echo -e "${YELLOW}[2/3] Suspend/resume loop under fio...${NC}"
+# Stay clear of the remapped blocks so the pattern check below still holds
+fio --name=suspend-loop --filename=/dev/mapper/${DM_NAME} --direct=1 \
+    --rw=randwrite --bs=4k --iodepth=16 --ioengine=libaio \
+    --offset=32M --size=64M --runtime=30 --time_based \
+    --verify=crc32c --verify_fatal=1 --verify_backlog=1024 \
+    >${FIO_LOG} 2>&1 &
+FIO_PID=$!
+sleep 2
+CYCLES=0
+for i in $(seq 1 20); do
+    dmsetup suspend ${DM_NAME} || break
+    sleep 0.2
+    dmsetup resume ${DM_NAME} || break
+    CYCLES=$((CYCLES + 1))
+    sleep 1
+done
+wait ${FIO_PID}
+FIO_RC=$?
+FIO_PID=""
+echo "  ${CYCLES} cycles, fio exit ${FIO_RC}"
+if [ ${CYCLES} -eq 20 ] && [ ${FIO_RC} -eq 0 ] && [ "$(mappings)" = "${REMAPS}" ] && check_pattern; then
+    report_test "fio verified through 20 suspend/resume cycles" "PASS"
+else
+    tail -n 20 ${FIO_LOG}
+    report_test "fio verified through 20 suspend/resume cycles" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/3] Main device shrunk while suspended...${NC}"
+dmsetup suspend ${DM_NAME} || error_exit "suspend failed"
+dmsetup suspend ${DUST_NAME}
+dmsetup reload ${DUST_NAME} --table "0 $((MAIN_SECTORS / 2)) dust ${MAIN_LOOP} 0 512"
+dmsetup resume ${DUST_NAME}
+REFUSED=0
+dmsetup resume ${DM_NAME} 2>/dev/null || REFUSED=1
+dmsetup suspend ${DUST_NAME}
+dmsetup reload ${DUST_NAME} --table "0 ${MAIN_SECTORS} dust ${MAIN_LOOP} 0 512"
+dmsetup resume ${DUST_NAME}
+if [ ${REFUSED} -eq 1 ] && dmsetup resume ${DM_NAME} && [ "$(mappings)" = "${REMAPS}" ]; then
+    report_test "Resume refused until the main device is back" "PASS"
+else
+    report_test "Resume refused until the main device is back (refused=${REFUSED})" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
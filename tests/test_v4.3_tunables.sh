@@ -0,0 +1,177 @@
+#!/bin/bash
+#
+# test_v4.3_tunables.sh - Table feature arguments and the "set" message
+#
+# Tests:
+# 1. Bad feature arguments are refused at table load
+# 2. Feature arguments show up in "dmsetup table", defaults do not
+# 3. "set" validates and changes settings on the live device
+# 4. A table saved with "dmsetup table" recreates the same settings
+# 5. remap_granularity changed at runtime applies to the next remap
+#
+# Needs dm-dust.
+#
+# Usage: sudo ./test_v4.3_tunables.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-tunables"
+DUST_NAME="test-remap-tunables-dust"
+MAIN_IMG="/tmp/dm-remap-tunables-main.img"
+SPARE_IMG="/tmp/dm-remap-tunables-spare.img"
+MAIN_LOOP=""
+SPARE_LOOP=""
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    dmsetup remove ${DUST_NAME} 2>/dev/null || true
+    sleep 1
+    [ -n "${MAIN_LOOP}" ] && losetup -d ${MAIN_LOOP} 2>/dev/null
+    [ -n "${SPARE_LOOP}" ] && losetup -d ${SPARE_LOOP} 2>/dev/null
+    rm -f ${MAIN_IMG} ${SPARE_IMG}
+    rmmod dm_remap 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+setting() {
+    dmsetup message ${DM_NAME} 0 set | tr ' ' '\n' | grep "^$1=" | cut -d= -f2
+}
+
+# create_target [<#features> <key> <value>...] - target on the dust device
+create_target() {
+    dmsetup create ${DM_NAME} --table \
+        "0 $(blockdev --getsz /dev/mapper/${DUST_NAME}) dm-remap-v4 /dev/mapper/${DUST_NAME} ${SPARE_LOOP} $*" \
+        2>/dev/null || return 1
+    sleep 1  # Deferred metadata read
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+
+echo "========================================="
+echo "dm-remap v4.3 Tunables Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+modprobe dm-dust || error_exit "dm-dust is required"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/zero of=${SPARE_IMG} bs=1M count=64 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG})
+SPARE_LOOP=$(losetup -f --show ${SPARE_IMG})
+dmsetup create ${DUST_NAME} --table "0 $(blockdev --getsz ${MAIN_LOOP}) dust ${MAIN_LOOP} 0 512" || \
+    error_exit "Failed to create dust device"
+
+echo -e "${YELLOW}[1/5] Bad feature arguments...${NC}"
+BAD=0
+for features in "1 cache_size" "4 cache_size 8" "2 colour blue" "2 cache_size 1000" \
+                "2 scan_interval 0" "2 commit_policy later" "2 remap_granularity 256"; do
+    if create_target ${features}; then
+        echo "  accepted: ${features}"
+        dmsetup remove ${DM_NAME}
+        BAD=1
+    fi
+done
+if [ ${BAD} -eq 0 ]; then
+    report_test "Bad feature arguments refused" "PASS"
+else
+    report_test "Bad feature arguments refused" "FAIL"
+fi
+
+echo -e "${YELLOW}[2/5] Feature arguments in the table...${NC}"
+create_target || error_exit "Failed to create ${DM_NAME}"
+DEFAULT_TABLE=$(dmsetup table ${DM_NAME})
+dmsetup remove ${DM_NAME}
+create_target 4 scan_interval 60 commit_policy sync || error_exit "Failed to create ${DM_NAME}"
+TABLE=$(dmsetup table ${DM_NAME})
+echo "  ${TABLE}"
+if [ "$(echo ${DEFAULT_TABLE} | wc -w)" = "5" ] && \
+   echo "${TABLE}" | grep -q "${SPARE_LOOP} 4 scan_interval 60 commit_policy sync$" && \
+   [ "$(setting cache_size)" = "256" ]; then
+    report_test "Non-default settings listed in table" "PASS"
+else
+    report_test "Non-default settings listed in table" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/5] Runtime changes...${NC}"
+dmsetup message ${DM_NAME} 0 set cache_size 4096 >/dev/null
+dmsetup message ${DM_NAME} 0 set scan_interval 3600 >/dev/null
+if [ "$(setting cache_size)" = "4096" ] && [ "$(setting scan_interval)" = "3600" ] && \
+   dmsetup message ${DM_NAME} 0 cache_stats | grep -q "cache_size=4096" && \
+   ! dmsetup message ${DM_NAME} 0 set cache_size 3 2>/dev/null && \
+   ! dmsetup message ${DM_NAME} 0 set scan_interval 2>/dev/null && \
+   [ "$(setting cache_size)" = "4096" ]; then
+    report_test "set applies valid settings, refuses invalid ones" "PASS"
+else
+    report_test "set applies valid settings, refuses invalid ones ($(dmsetup message ${DM_NAME} 0 set))" "FAIL"
+fi
+
+echo -e "${YELLOW}[4/5] Recreate from saved table...${NC}"
+SAVED=$(dmsetup table ${DM_NAME})
+dmsetup remove ${DM_NAME}
+dmsetup create ${DM_NAME} --table "${SAVED}" || error_exit "Saved table refused: ${SAVED}"
+sleep 1
+if [ "$(setting cache_size)" = "4096" ] && [ "$(setting scan_interval)" = "3600" ] && \
+   [ "$(setting commit_policy)" = "sync" ]; then
+    report_test "Saved table keeps settings" "PASS"
+else
+    report_test "Saved table keeps settings ($(dmsetup message ${DM_NAME} 0 set))" "FAIL"
+fi
+
+echo -e "${YELLOW}[5/5] Live remap granularity...${NC}"
+dmsetup message ${DM_NAME} 0 set remap_granularity 64 >/dev/null
+dmsetup message ${DUST_NAME} 0 addbadblock 1000 >/dev/null
+dmsetup message ${DUST_NAME} 0 enable >/dev/null
+dd if=/dev/mapper/${DM_NAME} of=/dev/null bs=512 skip=1000 count=1 iflag=direct 2>/dev/null
+sleep 2  # Let the write-ahead remap commit
+REMAPPED=$(dmsetup message ${DM_NAME} 0 stats | tr ' ' '\n' | grep '^remapped_sectors=' | cut -d= -f2)
+if [ "${REMAPPED}" = "64" ]; then
+    report_test "Remap uses 64-sector granularity" "PASS"
+else
+    report_test "Remap uses 64-sector granularity (remapped=${REMAPPED})" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
@@ -0,0 +1,168 @@
+#!/bin/bash
+#
+# test_v4.3_write_verify.sh - Write verification ("write_verify")
+#
+# Tests:
+# 1. Nothing is read back with write_verify off
+# 2. "remapped" reads back writes to the spare
+# 3. "errors" catches a corrupted write near a recent error and remaps it
+# 4. Writes far from any error are not read back
+#
+# The main device is dm-flakey, switched to corrupting writes for tests 3
+# and 4.
+#
+# Usage: sudo ./test_v4.3_write_verify.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-verify"
+FLAKEY_NAME="test-remap-verify-flakey"
+MAIN_IMG="/tmp/dm-remap-verify-main.img"
+SPARE_IMG="/tmp/dm-remap-verify-spare.img"
+PATTERN="/tmp/dm-remap-verify-pattern.bin"
+MAIN_LOOP=""
+SPARE_LOOP=""
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    dmsetup remove ${FLAKEY_NAME} 2>/dev/null || true
+    sleep 1
+    [ -n "${MAIN_LOOP}" ] && losetup -d ${MAIN_LOOP} 2>/dev/null
+    [ -n "${SPARE_LOOP}" ] && losetup -d ${SPARE_LOOP} 2>/dev/null
+    rm -f ${MAIN_IMG} ${SPARE_IMG} ${PATTERN}
+    rmmod dm_remap 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+error_value() {
+    dmsetup message ${DM_NAME} 0 errors | tr ' ' '\n' | grep "^$1=" | cut -d= -f2
+}
+
+# flakey <args>: swap the flakey table under the target
+flakey() {
+    dmsetup suspend ${FLAKEY_NAME} && \
+    dmsetup reload ${FLAKEY_NAME} --table "0 ${MAIN_SECTORS} flakey ${MAIN_LOOP} 0 $*" && \
+    dmsetup resume ${FLAKEY_NAME}
+}
+
+# write_block <block>: direct 4k pattern write through the target
+write_block() {
+    dd if=${PATTERN} of=/dev/mapper/${DM_NAME} bs=4096 seek=$1 count=1 \
+        oflag=direct conv=notrunc 2>/dev/null
+}
+
+# check_block <block>: the block reads back as the pattern
+check_block() {
+    dd if=/dev/mapper/${DM_NAME} bs=4096 skip=$1 count=1 iflag=direct 2>/dev/null | \
+        cmp -s - ${PATTERN}
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+
+echo "========================================="
+echo "dm-remap v4.3 Write Verification Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+modprobe dm-flakey || error_exit "dm-flakey is required"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/zero of=${SPARE_IMG} bs=1M count=64 2>/dev/null
+dd if=/dev/urandom of=${PATTERN} bs=4096 count=1 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG})
+SPARE_LOOP=$(losetup -f --show ${SPARE_IMG})
+MAIN_SECTORS=$(blockdev --getsz ${MAIN_LOOP})
+dmsetup create ${FLAKEY_NAME} --table "0 ${MAIN_SECTORS} flakey ${MAIN_LOOP} 0 3600 0" || \
+    error_exit "Failed to create flakey device"
+dmsetup create ${DM_NAME} --table \
+    "0 ${MAIN_SECTORS} dm-remap-v4 /dev/mapper/${FLAKEY_NAME} ${SPARE_LOOP} 2 salvage_retries 0" || \
+    error_exit "Failed to create ${DM_NAME}"
+sleep 1  # Deferred metadata read
+
+echo -e "${YELLOW}[1/4] write_verify off...${NC}"
+if write_block 50 && [ "$(error_value verified)" = "0" ]; then
+    report_test "No read-back by default" "PASS"
+else
+    report_test "No read-back by default ($(dmsetup message ${DM_NAME} 0 errors))" "FAIL"
+fi
+
+echo -e "${YELLOW}[2/4] write_verify remapped...${NC}"
+dmsetup message ${DM_NAME} 0 inject_error medium >/dev/null
+dd if=/dev/mapper/${DM_NAME} of=/dev/null bs=4096 skip=100 count=1 iflag=direct 2>/dev/null
+sleep 2  # Let the write-ahead remap of sector 800 commit
+dmsetup message ${DM_NAME} 0 set write_verify remapped >/dev/null
+if write_block 100 && check_block 100 && [ "$(error_value verified)" -ge 1 ] && \
+   [ "$(error_value verify_failed)" = "0" ]; then
+    report_test "Spare write read back and matched" "PASS"
+else
+    report_test "Spare write read back and matched ($(dmsetup message ${DM_NAME} 0 errors))" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/4] Corrupted write near the error...${NC}"
+dmsetup message ${DM_NAME} 0 set write_verify errors >/dev/null
+flakey "0 1 5 corrupt_bio_byte 1 w 0 0" || error_exit "Failed to make flakey corrupt writes"
+write_block 110
+WRITE_RC=$?
+if [ ${WRITE_RC} -eq 0 ] && check_block 110 && [ "$(error_value verify_failed)" -ge 1 ] && \
+   [ "$(error_value verify_remapped)" -ge 1 ] && \
+   dmsetup message ${DM_NAME} 0 events | grep -q " verify "; then
+    report_test "Corrupted write remapped with its data" "PASS"
+else
+    report_test "Corrupted write remapped ($(dmsetup message ${DM_NAME} 0 errors))" "FAIL"
+fi
+
+echo -e "${YELLOW}[4/4] Write outside verify_window...${NC}"
+VERIFIED=$(error_value verified)
+write_block 10000
+flakey "3600 0" || error_exit "Failed to restore flakey"
+if [ "$(error_value verified)" = "${VERIFIED}" ]; then
+    report_test "Far write not read back" "PASS"
+else
+    report_test "Far write not read back ($(dmsetup message ${DM_NAME} 0 errors))" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
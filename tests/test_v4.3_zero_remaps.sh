@@ -0,0 +1,188 @@
+#!/bin/bash
+#
+# test_v4.3_zero_remaps.sh - Zero remaps that hold no spare space
+#
+# Tests:
+# 1. Writing zeros over remapped sectors makes them zero remaps
+# 2. Zero remaps read as zeros without spare I/O
+# 3. A discard makes remapped sectors zero remaps
+# 4. A data write gives a zero remap spare space again, reusing freed space
+# 5. Zero remaps and their data survive a table reload
+#
+# Usage: sudo ./test_v4.3_zero_remaps.sh
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+MODULE="${SCRIPT_DIR}/../src/dm-remap.ko"
+DM_NAME="test-remap-zero"
+MAIN_IMG="/tmp/dm-remap-zero-main.img"
+SPARE_IMG="/tmp/dm-remap-zero-spare.img"
+MAIN_LOOP=""
+SPARE_LOOP=""
+DEV_SIZE_MB=64
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+
+cleanup() {
+    echo -e "${YELLOW}Cleaning up...${NC}"
+    dmsetup remove ${DM_NAME} 2>/dev/null || true
+    sleep 1
+    for loop in ${MAIN_LOOP} ${SPARE_LOOP}; do
+        losetup -d ${loop} 2>/dev/null
+    done
+    rm -f ${MAIN_IMG} ${SPARE_IMG}
+    rmmod dm_remap 2>/dev/null || true
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        echo -e "${GREEN}✓ PASS${NC}: $test_name"
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+# read_pattern <dev> <sector> <count> - prints the distinct bytes found
+read_pattern() {
+    dd if="$1" bs=512 skip=$2 count=$3 iflag=direct 2>/dev/null | \
+        od -An -tx1 -v | tr -s ' ' '\n' | grep -v '^$' | sort -u | tr '\n' ' '
+}
+
+# write_byte <sector> <count> <byte>
+write_byte() {
+    head -c $(( $2 * 512 )) /dev/zero | tr '\0' "\\$(printf '%03o' $3)" | \
+        dd of=/dev/mapper/${DM_NAME} bs=512 seek=$1 oflag=direct conv=notrunc 2>/dev/null
+}
+
+stat_value() {
+    dmsetup message ${DM_NAME} 0 stats | tr ' ' '\n' | grep "^$1=" | cut -d= -f2
+}
+
+create_target() {
+    dmsetup create ${DM_NAME} --table "0 ${MAIN_SECTORS} dm-remap-v4 ${MAIN_LOOP} ${SPARE_LOOP}" || \
+        error_exit "Failed to create ${DM_NAME}"
+    sleep 1  # Deferred metadata read
+}
+
+if [ "$EUID" -ne 0 ]; then
+    error_exit "This test must be run as root"
+fi
+
+echo "========================================="
+echo "dm-remap v4.3 Zero Remap Test Suite"
+echo "========================================="
+echo ""
+
+trap cleanup EXIT
+
+echo -e "${YELLOW}[1/6] Setting up loop devices...${NC}"
+dd if=/dev/zero of=${MAIN_IMG} bs=1M count=${DEV_SIZE_MB} 2>/dev/null
+dd if=/dev/zero of=${SPARE_IMG} bs=1M count=${DEV_SIZE_MB} 2>/dev/null
+MAIN_LOOP=$(losetup -f --show ${MAIN_IMG}) || error_exit "Failed to set up main loop device"
+SPARE_LOOP=$(losetup -f --show ${SPARE_IMG}) || error_exit "Failed to set up spare loop device"
+MAIN_SECTORS=$(blockdev --getsz ${MAIN_LOOP})
+echo "Main: ${MAIN_LOOP}, spare: ${SPARE_LOOP} (${MAIN_SECTORS} sectors)"
+
+rmmod dm_remap 2>/dev/null || true
+insmod ${MODULE} || error_exit "Failed to load ${MODULE}"
+create_target
+
+# Remap sectors 0-7 and 64-71, then reload so they are restored ACTIVE
+for i in $(seq 0 7); do
+    dmsetup message ${DM_NAME} 0 test_remap ${i} $(( 4096 + i )) >/dev/null
+    dmsetup message ${DM_NAME} 0 test_remap $(( 64 + i )) $(( 4200 + i )) >/dev/null
+done
+sleep 1
+dmsetup remove ${DM_NAME}
+create_target
+write_byte 0 8 0xaa
+write_byte 64 8 0xbb
+
+echo -e "${YELLOW}[2/6] Writing zeros over remapped sectors...${NC}"
+dd if=/dev/zero of=/dev/mapper/${DM_NAME} bs=512 seek=0 count=8 oflag=direct 2>/dev/null
+ZERO_REMAPS=$(stat_value zero_remaps)
+SPARE_FREE=$(stat_value spare_free_sectors)
+echo "zero_remaps=${ZERO_REMAPS} spare_free_sectors=${SPARE_FREE}"
+if [ "${ZERO_REMAPS}" = "8" ] && [ "$(stat_value zero_saved_bytes)" = "4096" ] && \
+   [ "${SPARE_FREE}" -ge 8 ]; then
+    report_test "Zero write turns remaps zero and frees their spare sectors" "PASS"
+else
+    report_test "Zero write turns remaps zero and frees their spare sectors" "FAIL"
+fi
+
+echo -e "${YELLOW}[3/6] Reading zero remaps...${NC}"
+# Put something else on the old spare sectors: the read must not go there
+dd if=/dev/urandom of=${SPARE_LOOP} bs=512 seek=4096 count=8 oflag=direct conv=notrunc 2>/dev/null
+READS_BEFORE=$(stat_value zero_reads)
+if [ "$(read_pattern /dev/mapper/${DM_NAME} 0 8)" = "00 " ] && \
+   [ "$(stat_value zero_reads)" -gt "${READS_BEFORE}" ]; then
+    report_test "Zero remaps read as zeros from memory" "PASS"
+else
+    report_test "Zero remaps read as zeros from memory" "FAIL"
+fi
+
+echo -e "${YELLOW}[4/6] Discarding remapped sectors...${NC}"
+if blkdiscard -o $(( 64 * 512 )) -l 4096 /dev/mapper/${DM_NAME} 2>/dev/null; then
+    if [ "$(stat_value zero_remaps)" = "16" ] && \
+       [ "$(read_pattern /dev/mapper/${DM_NAME} 64 8)" = "00 " ]; then
+        report_test "Discard turns remaps zero" "PASS"
+    else
+        report_test "Discard turns remaps zero" "FAIL"
+    fi
+else
+    echo "Discard not supported by the loop devices, skipped"
+    dd if=/dev/zero of=/dev/mapper/${DM_NAME} bs=512 seek=64 count=8 oflag=direct 2>/dev/null
+fi
+
+echo -e "${YELLOW}[5/6] Writing data to zero remaps...${NC}"
+SPARE_FREE=$(stat_value spare_free_sectors)
+write_byte 0 8 0x5a
+echo "zero_allocs=$(stat_value zero_allocs) spare_free_sectors=$(stat_value spare_free_sectors)"
+if [ "$(stat_value zero_remaps)" = "8" ] && [ "$(stat_value zero_allocs)" = "1" ] && \
+   [ "$(stat_value spare_free_sectors)" -lt "${SPARE_FREE}" ] && \
+   [ "$(read_pattern /dev/mapper/${DM_NAME} 0 8)" = "5a " ]; then
+    report_test "Data write allocates spare space lazily from freed sectors" "PASS"
+else
+    report_test "Data write allocates spare space lazily from freed sectors" "FAIL"
+fi
+
+echo -e "${YELLOW}[6/6] Reloading the table...${NC}"
+dmsetup remove ${DM_NAME}
+create_target
+if [ "$(stat_value zero_remaps)" = "8" ] && \
+   [ "$(read_pattern /dev/mapper/${DM_NAME} 0 8)" = "5a " ] && \
+   [ "$(read_pattern /dev/mapper/${DM_NAME} 64 8)" = "00 " ]; then
+    report_test "Zero remaps and staged data persisted across reload" "PASS"
+else
+    report_test "Zero remaps and staged data persisted across reload" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * retry_policy.bpf.c - Example dm-remap remap policy
+ *
+ * - Read errors are retried: a sector is only remapped on its third
+ *   failed read. Write errors are remapped straight away.
+ * - Errors in an optional "flaky" sector range are ignored.
+ * - Remaps cover whole 64 KiB chunks.
+ *
+ * Spare placement and scan interval are left to the built-in policy.
+ */
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+
+#define DM_REMAP_POLICY_REMAP   0
+#define DM_REMAP_POLICY_RETRY   1
+#define DM_REMAP_POLICY_IGNORE  2
+
+#define READ_RETRIES    3
+#define CHUNK_SECTORS   128
+
+char _license[] SEC("license") = "GPL";
+
+/* Ignored range, set from userspace before registering (0/0 = none) */
+const volatile u64 flaky_start = 0;
+const volatile u64 flaky_end = 0;
+
+struct error_key {
+    u32 dev;
+    u64 sector;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 4096);
+    __type(key, struct error_key);
+    __type(value, u32);
+} read_errors SEC(".maps");
+
+SEC("struct_ops/should_remap")
+int BPF_PROG(retry_should_remap, u32 dev, u64 sector, int error, bool is_write)
+{
+    struct error_key key = { .dev = dev, .sector = sector };
+    u32 one = 1, *count;
+
+    if (sector >= flaky_start && sector < flaky_end)
+        return DM_REMAP_POLICY_IGNORE;
+    if (is_write)
+        return DM_REMAP_POLICY_REMAP;
+
+    count = bpf_map_lookup_elem(&read_errors, &key);
+    if (!count) {
+        bpf_map_update_elem(&read_errors, &key, &one, BPF_ANY);
+        return DM_REMAP_POLICY_RETRY;
+    }
+    if (++*count < READ_RETRIES)
+        return DM_REMAP_POLICY_RETRY;
+
+    bpf_map_delete_elem(&read_errors, &key);
+    return DM_REMAP_POLICY_REMAP;
+}
+
+SEC("struct_ops/remap_granularity")
+u32 BPF_PROG(chunk_remap_granularity, u32 dev, u64 sector, u32 default_sectors)
+{
+    return CHUNK_SECTORS;
+}
+
+SEC(".struct_ops")
+struct dm_remap_policy_ops retry_policy = {
+    .should_remap = (void *)retry_should_remap,
+    .remap_granularity = (void *)chunk_remap_granularity,
+    .name = "retry3_64k",
+};
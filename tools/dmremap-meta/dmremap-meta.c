@@ -0,0 +1,554 @@
+/*
+ * dmremap-meta - Offline inspection and repair of dm-remap spare metadata
+ *
+ * Reads the metadata copies at the start of a spare device (or an image of
+ * one), or in a target's area on a separate metadata device, without the
+ * module loaded. The on-disk structure comes from
+ * include/dm-remap-v4-ondisk.h and the checks from
+ * src/dm-remap-v4-metadata-parse.c, built against the userspace kernel
+ * shim of tests/fuzz, so a copy is judged exactly as the module would.
+ *
+ * Exit status: 0 all copies valid and identical, 1 some copies bad but a
+ * valid one exists, 2 no valid copy, 3 usage or I/O error.
+ */
+
+#include "dm-remap-v4-ondisk.h"  /* First: pulls in the shim and libc */
+
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+
+#define DMREMAP_META_VERSION "1.0.0"
+
+enum {
+    EXIT_CLEAN = 0,
+    EXIT_DAMAGED = 1,
+    EXIT_NO_VALID = 2,
+    EXIT_ERROR = 3,
+};
+
+/* Why a copy was not used, worst first */
+enum copy_status {
+    COPY_OK,
+    COPY_STALE,        /* Valid, older sequence number than the best copy */
+    COPY_DIVERGED,     /* Valid, same sequence number, different contents */
+    COPY_INVALID,      /* CRC good, contents rejected */
+    COPY_CRC_MISMATCH,
+    COPY_BAD_VERSION,
+    COPY_BAD_MAGIC,
+    COPY_EMPTY,        /* All zeroes: never written */
+    COPY_UNREADABLE,
+};
+
+static const char * const copy_status_names[] = {
+    [COPY_OK] = "ok",
+    [COPY_STALE] = "stale",
+    [COPY_DIVERGED] = "diverged",
+    [COPY_INVALID] = "invalid",
+    [COPY_CRC_MISMATCH] = "crc_mismatch",
+    [COPY_BAD_VERSION] = "bad_version",
+    [COPY_BAD_MAGIC] = "bad_magic",
+    [COPY_EMPTY] = "empty",
+    [COPY_UNREADABLE] = "unreadable",
+};
+
+struct copy_info {
+    enum copy_status status;
+    u32 computed_crc;
+};
+
+struct inspection {
+    const char *path;
+    u64 size_sectors;
+    u64 offset;                   /* Start of the area on a metadata device, in sectors */
+    bool metadata_device;         /* --offset given: the device holds no remapped data */
+    struct copy_info info[DM_REMAP_V4_REDUNDANT_COPIES];
+    bool valid[DM_REMAP_V4_REDUNDANT_COPIES];
+    int best;                     /* Index of the copy the module would use, or -1 */
+    bool table_fits;              /* Remap table fits the real devices */
+    int repaired[DM_REMAP_V4_REDUNDANT_COPIES];
+    int nr_repaired;
+};
+
+static struct dm_remap_metadata_v4 copies[DM_REMAP_V4_REDUNDANT_COPIES];
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr, "dmremap-meta v%s - dm-remap spare metadata inspection and repair\n",
+            DMREMAP_META_VERSION);
+    fprintf(stderr, "Usage: %s [OPTIONS] <spare device or image>\n\n", prog);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -f, --format FORMAT      Output format: human|json (default: human)\n");
+    fprintf(stderr, "  -r, --remaps             List the remap table (human format)\n");
+    fprintf(stderr, "  -m, --main-sectors N     Also check remaps against a main device of N sectors\n");
+    fprintf(stderr, "  -o, --offset N           Read the area at sector N of a separate metadata device\n");
+    fprintf(stderr, "  -R, --repair             Rewrite bad copies from the best valid copy\n");
+    fprintf(stderr, "  -v, --verbose            Explain why copies are rejected\n");
+    fprintf(stderr, "  -h, --help               Show this help message\n");
+    fprintf(stderr, "  -V, --version            Show version\n");
+    fprintf(stderr, "\nExamples:\n");
+    fprintf(stderr, "  # Check the copies on a spare that will not activate\n");
+    fprintf(stderr, "  sudo dmremap-meta /dev/sdb1\n");
+    fprintf(stderr, "  # Dump everything, including the remap table, as JSON\n");
+    fprintf(stderr, "  sudo dmremap-meta --format json /dev/sdb1\n");
+    fprintf(stderr, "  # Rewrite damaged copies (the target must not be active)\n");
+    fprintf(stderr, "  sudo dmremap-meta --repair /dev/sdb1\n");
+    fprintf(stderr, "  # Check a target whose table has \"/dev/nvme0n1p3 2048\" as metadata device\n");
+    fprintf(stderr, "  sudo dmremap-meta --offset 2048 /dev/nvme0n1p3\n");
+}
+
+static bool all_zero(const void *p, size_t len)
+{
+    const u8 *b = p;
+
+    while (len--)
+        if (*b++)
+            return false;
+    return true;
+}
+
+/* Everything except copy_index and the checksum, which differ per copy */
+static bool same_contents(const struct dm_remap_metadata_v4 *a,
+                          const struct dm_remap_metadata_v4 *b)
+{
+    size_t body = offsetof(struct dm_remap_metadata_v4, device_config);
+
+    return a->header.magic == b->header.magic &&
+           a->header.version == b->header.version &&
+           a->header.sequence_number == b->header.sequence_number &&
+           a->header.timestamp == b->header.timestamp &&
+           a->header.structure_size == b->header.structure_size &&
+           !memcmp((const u8 *)a + body, (const u8 *)b + body, sizeof(*a) - body);
+}
+
+/* Byte offset of copy @i on the device */
+static u64 copy_offset(const struct inspection *insp, int i)
+{
+    return (insp->offset + DM_REMAP_V4_COPY_SECTOR(i)) << SECTOR_SHIFT;
+}
+
+static void read_copies(int fd, struct inspection *insp)
+{
+    int i;
+
+    /* Drop cached pages: the module writes around the page cache */
+    posix_fadvise(fd, (off_t)copy_offset(insp, 0),
+                  (off_t)DM_REMAP_V4_REDUNDANT_COPIES * DM_REMAP_V4_METADATA_BLOCK_SIZE,
+                  POSIX_FADV_DONTNEED);
+
+    for (i = 0; i < DM_REMAP_V4_REDUNDANT_COPIES; i++) {
+        struct dm_remap_metadata_v4 *m = &copies[i];
+        struct copy_info *ci = &insp->info[i];
+        ssize_t n;
+        int ret;
+
+        memset(m, 0, sizeof(*m));
+        insp->valid[i] = false;
+        n = pread(fd, m, sizeof(*m), (off_t)copy_offset(insp, i));
+        if (n < 0) {
+            fprintf(stderr, "Warning: copy %d: %s\n", i, strerror(errno));
+            ci->status = COPY_UNREADABLE;
+            continue;
+        }
+        if ((size_t)n < sizeof(*m)) {
+            ci->status = n ? COPY_UNREADABLE : COPY_EMPTY;
+            continue;
+        }
+
+        ci->computed_crc = dm_remap_metadata_v4_crc32(m);
+        if (m->header.magic != DM_REMAP_METADATA_V4_MAGIC) {
+            ci->status = all_zero(m, sizeof(*m)) ? COPY_EMPTY : COPY_BAD_MAGIC;
+            continue;
+        }
+        if (m->header.version != DM_REMAP_METADATA_V4_VERSION) {
+            ci->status = COPY_BAD_VERSION;
+            continue;
+        }
+
+        ret = dm_remap_validate_metadata_v4(m);
+        if (ret == -EBADMSG) {
+            ci->status = COPY_CRC_MISMATCH;
+        } else if (ret) {
+            ci->status = COPY_INVALID;
+        } else {
+            ci->status = COPY_OK;
+            insp->valid[i] = true;
+        }
+    }
+}
+
+/* Pick the copy the module would use and compare the other valid ones to it */
+static void cross_check(struct inspection *insp, u64 main_sectors)
+{
+    const struct dm_remap_metadata_v4 *best;
+    int i;
+
+    insp->best = dm_remap_select_metadata_copy_v4(copies, insp->valid,
+                                                  DM_REMAP_V4_REDUNDANT_COPIES);
+    insp->table_fits = true;
+    if (insp->best < 0)
+        return;
+    best = &copies[insp->best];
+
+    for (i = 0; i < DM_REMAP_V4_REDUNDANT_COPIES; i++) {
+        if (!insp->valid[i] || i == insp->best)
+            continue;
+        if (copies[i].header.sequence_number != best->header.sequence_number)
+            insp->info[i].status = COPY_STALE;
+        else if (!same_contents(&copies[i], best))
+            insp->info[i].status = COPY_DIVERGED;
+    }
+
+    /* The copy only vouches for the sizes it recorded; the module skips
+     * remaps that fall outside the devices it is assembled from. On a
+     * metadata device the spare is not at hand, so take its recorded size. */
+    if (dm_remap_validate_remap_table_v4(best, main_sectors,
+                                         insp->metadata_device ?
+                                         best->device_config.spare_device_sectors :
+                                         insp->size_sectors))
+        insp->table_fits = false;
+}
+
+static void inspect(int fd, struct inspection *insp, u64 main_sectors)
+{
+    read_copies(fd, insp);
+    cross_check(insp, main_sectors);
+}
+
+static int exit_status(const struct inspection *insp)
+{
+    int i;
+
+    if (insp->best < 0)
+        return EXIT_NO_VALID;
+    for (i = 0; i < DM_REMAP_V4_REDUNDANT_COPIES; i++)
+        if (insp->info[i].status != COPY_OK)
+            return EXIT_DAMAGED;
+    return EXIT_CLEAN;
+}
+
+/**
+ * repair_copies() - Rewrite every copy that is not identical to the best one
+ *
+ * Each rewritten copy gets its own copy_index and checksum, as the module
+ * writes them. Returns 0 or -errno.
+ */
+static int repair_copies(int fd, struct inspection *insp)
+{
+    static struct dm_remap_metadata_v4 fixed;
+    int i;
+
+    insp->nr_repaired = 0;
+    if (insp->best < 0)
+        return -ENODATA;
+
+    for (i = 0; i < DM_REMAP_V4_REDUNDANT_COPIES; i++) {
+        if (insp->info[i].status == COPY_OK)
+            continue;
+
+        fixed = copies[insp->best];
+        fixed.header.copy_index = i;
+        fixed.header.metadata_checksum = dm_remap_metadata_v4_crc32(&fixed);
+
+        if (pwrite(fd, &fixed, sizeof(fixed), (off_t)copy_offset(insp, i)) !=
+            (ssize_t)sizeof(fixed)) {
+            int ret = errno ? -errno : -EIO;
+
+            fprintf(stderr, "Error: rewriting copy %d: %s\n", i, strerror(-ret));
+            return ret;
+        }
+        insp->repaired[insp->nr_repaired++] = i;
+    }
+
+    if (fsync(fd)) {
+        fprintf(stderr, "Error: fsync: %s\n", strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+/* ---- Output ------------------------------------------------------------ */
+
+static void json_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++) {
+        unsigned char c = *s;
+
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+static void print_json(const struct inspection *insp)
+{
+    const struct dm_remap_metadata_v4 *best = insp->best >= 0 ? &copies[insp->best] : NULL;
+    u32 i, nr_remaps;
+
+    printf("{\n  \"device\": ");
+    json_string(insp->path);
+    printf(",\n  \"size_sectors\": %llu,\n", insp->size_sectors);
+    if (insp->metadata_device)
+        printf("  \"metadata_offset\": %llu,\n", insp->offset);
+    printf("  \"copies\": [\n");
+    for (i = 0; i < DM_REMAP_V4_REDUNDANT_COPIES; i++) {
+        const struct dm_remap_metadata_v4 *m = &copies[i];
+        const struct copy_info *ci = &insp->info[i];
+
+        printf("    {\"index\": %u, \"offset\": %llu, \"status\": \"%s\"", i,
+               copy_offset(insp, i), copy_status_names[ci->status]);
+        if (ci->status != COPY_UNREADABLE && ci->status != COPY_EMPTY)
+            printf(", \"magic\": \"0x%08x\", \"version\": %u, \"sequence\": %llu, "
+                   "\"timestamp\": %llu, \"copy_index\": %u, \"stored_crc\": \"0x%08x\", "
+                   "\"computed_crc\": \"0x%08x\", \"active_remaps\": %u",
+                   m->header.magic, m->header.version,
+                   (u64)m->header.sequence_number, (u64)m->header.timestamp,
+                   m->header.copy_index, m->header.metadata_checksum, ci->computed_crc,
+                   m->remap_data.active_remaps);
+        printf("}%s\n", i + 1 < DM_REMAP_V4_REDUNDANT_COPIES ? "," : "");
+    }
+    printf("  ],\n");
+
+    if (!best) {
+        printf("  \"best_copy\": null,\n  \"remaps\": [],\n");
+    } else {
+        printf("  \"best_copy\": %d,\n", insp->best);
+        printf("  \"metadata\": {\"sequence\": %llu, \"timestamp\": %llu, "
+               "\"main_device_sectors\": %llu, \"spare_device_sectors\": %llu, "
+               "\"sector_size\": %u, \"health_score\": %u, \"active_remaps\": %u, "
+               "\"max_remaps\": %u, \"next_spare_sector\": %u, \"fits_devices\": %s},\n",
+               (u64)best->header.sequence_number, (u64)best->header.timestamp,
+               (u64)best->device_config.main_device_sectors,
+               (u64)best->device_config.spare_device_sectors,
+               best->device_config.sector_size, best->health_data.health_score,
+               best->remap_data.active_remaps, best->remap_data.max_remaps,
+               best->remap_data.next_spare_sector, insp->table_fits ? "true" : "false");
+
+        nr_remaps = best->remap_data.active_remaps;
+        printf("  \"remaps\": [");
+        for (i = 0; i < nr_remaps; i++) {
+            printf("%s\n    {\"original_sector\": %llu, \"spare_sector\": %llu, "
+                   "\"timestamp\": %llu, \"access_count\": %u, \"error_count\": %u, "
+                   "\"reason\": %u, \"flags\": %u}", i ? "," : "",
+                   (u64)best->remap_data.remaps[i].original_sector,
+                   (u64)best->remap_data.remaps[i].spare_sector,
+                   (u64)best->remap_data.remaps[i].remap_timestamp,
+                   best->remap_data.remaps[i].access_count,
+                   best->remap_data.remaps[i].error_count,
+                   best->remap_data.remaps[i].remap_reason,
+                   best->remap_data.remaps[i].flags);
+        }
+        printf("%s],\n", nr_remaps ? "\n  " : "");
+    }
+
+    printf("  \"repaired\": [");
+    for (i = 0; i < (u32)insp->nr_repaired; i++)
+        printf("%s%d", i ? ", " : "", insp->repaired[i]);
+    printf("]\n}\n");
+}
+
+static const char *format_time(u64 seconds, char *buf, size_t len)
+{
+    time_t t = (time_t)seconds;
+    struct tm tm;
+
+    if (!seconds || !gmtime_r(&t, &tm) || !strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm))
+        snprintf(buf, len, "-");
+    return buf;
+}
+
+static void print_human(const struct inspection *insp, bool list_remaps)
+{
+    const struct dm_remap_metadata_v4 *best = insp->best >= 0 ? &copies[insp->best] : NULL;
+    char when[32];
+    u32 i;
+
+    if (insp->metadata_device)
+        printf("Metadata device: %s (%llu sectors), area at sector %llu\n\n", insp->path,
+               insp->size_sectors, insp->offset);
+    else
+        printf("Spare: %s (%llu sectors)\n\n", insp->path, insp->size_sectors);
+    printf("Copy  Offset    Sequence  Written (UTC)        Stored CRC  Computed    Remaps  Status\n");
+    for (i = 0; i < DM_REMAP_V4_REDUNDANT_COPIES; i++) {
+        const struct dm_remap_metadata_v4 *m = &copies[i];
+        const struct copy_info *ci = &insp->info[i];
+
+        if (ci->status == COPY_UNREADABLE || ci->status == COPY_EMPTY) {
+            printf("%-4u  %-8llu  %-8s  %-19s  %-10s  %-10s  %-6s  %s\n", i,
+                   copy_offset(insp, i), "-", "-", "-", "-", "-",
+                   copy_status_names[ci->status]);
+            continue;
+        }
+        printf("%-4u  %-8llu  %-8llu  %-19s  0x%08x  0x%08x  %-6u  %s\n", i,
+               copy_offset(insp, i), (u64)m->header.sequence_number,
+               format_time(m->header.timestamp, when, sizeof(when)),
+               m->header.metadata_checksum, ci->computed_crc, m->remap_data.active_remaps,
+               copy_status_names[ci->status]);
+    }
+    printf("\n");
+
+    if (!best) {
+        printf("No valid copy: the target cannot restore any remaps from this device.\n");
+        return;
+    }
+
+    printf("Best copy: %d (sequence %llu, written %s UTC)\n", insp->best,
+           (u64)best->header.sequence_number, format_time(best->header.timestamp, when, sizeof(when)));
+    printf("  Main device:   %llu sectors\n", (u64)best->device_config.main_device_sectors);
+    printf("  Spare device:  %llu sectors\n", (u64)best->device_config.spare_device_sectors);
+    printf("  Remaps:        %u of %u, next spare sector %u\n",
+           best->remap_data.active_remaps, best->remap_data.max_remaps,
+           best->remap_data.next_spare_sector);
+    printf("  Health score:  %u\n", best->health_data.health_score);
+    if (!insp->table_fits)
+        printf("  Warning: some remaps fall outside the devices given; the target skips them\n");
+
+    if (list_remaps && best->remap_data.active_remaps) {
+        printf("\n  %-20s  %-20s  %-6s  %s\n", "Original sector", "Spare sector", "Errors",
+               "Remapped (UTC)");
+        for (i = 0; i < best->remap_data.active_remaps; i++) {
+            char spare[24];
+
+            /* Zero remaps hold no spare sector; a compressed unit shares an extent */
+            if (best->remap_data.remaps[i].flags & DM_REMAP_V4_REMAP_ZERO)
+                snprintf(spare, sizeof(spare), "zero");
+            else if (best->remap_data.remaps[i].flags & DM_REMAP_V4_REMAP_COMPRESSED)
+                snprintf(spare, sizeof(spare), "%llu+%u (z)",
+                         (u64)best->remap_data.remaps[i].spare_sector,
+                         DM_REMAP_V4_REMAP_CLEN(best->remap_data.remaps[i].flags));
+            else
+                snprintf(spare, sizeof(spare), "%llu",
+                         (u64)best->remap_data.remaps[i].spare_sector);
+            printf("  %-20llu  %-20s  %-6u  %s\n",
+                   (u64)best->remap_data.remaps[i].original_sector, spare,
+                   best->remap_data.remaps[i].error_count,
+                   format_time(best->remap_data.remaps[i].remap_timestamp, when, sizeof(when)));
+        }
+    }
+
+    if (insp->nr_repaired) {
+        printf("\nRepaired copies:");
+        for (i = 0; i < (u32)insp->nr_repaired; i++)
+            printf(" %d", insp->repaired[i]);
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"format", required_argument, 0, 'f'},
+        {"remaps", no_argument, 0, 'r'},
+        {"main-sectors", required_argument, 0, 'm'},
+        {"offset", required_argument, 0, 'o'},
+        {"repair", no_argument, 0, 'R'},
+        {"verbose", no_argument, 0, 'v'},
+        {"help", no_argument, 0, 'h'},
+        {"version", no_argument, 0, 'V'},
+        {0, 0, 0, 0}
+    };
+    struct inspection insp = { .best = -1 };
+    bool json = false, list_remaps = false, repair = false;
+    u64 main_sectors = 0;
+    struct stat st;
+    off_t size;
+    int opt, fd, ret;
+
+    while ((opt = getopt_long(argc, argv, "f:rm:o:RvhV", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+            if (!strcmp(optarg, "json")) {
+                json = true;
+            } else if (strcmp(optarg, "human")) {
+                fprintf(stderr, "Error: unknown format '%s'\n", optarg);
+                return EXIT_ERROR;
+            }
+            break;
+        case 'r':
+            list_remaps = true;
+            break;
+        case 'm':
+            if (kstrtou64(optarg, 0, &main_sectors)) {
+                fprintf(stderr, "Error: invalid sector count '%s'\n", optarg);
+                return EXIT_ERROR;
+            }
+            break;
+        case 'o':
+            if (kstrtou64(optarg, 0, &insp.offset) || insp.offset % 8) {
+                fprintf(stderr, "Error: invalid metadata offset '%s'\n", optarg);
+                return EXIT_ERROR;
+            }
+            insp.metadata_device = true;
+            break;
+        case 'R':
+            repair = true;
+            break;
+        case 'v':
+            setenv("DM_REMAP_FUZZ_VERBOSE", "1", 1);  /* Shim prints DMR_DEBUG() */
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            return EXIT_CLEAN;
+        case 'V':
+            printf("dmremap-meta v%s\n", DMREMAP_META_VERSION);
+            return EXIT_CLEAN;
+        default:
+            print_usage(argv[0]);
+            return EXIT_ERROR;
+        }
+    }
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return EXIT_ERROR;
+    }
+    insp.path = argv[optind];
+
+    /* O_EXCL on a block device fails while a target still holds it */
+    fd = open(insp.path, repair ? O_RDWR : O_RDONLY);
+    if (fd >= 0 && repair && !fstat(fd, &st) && S_ISBLK(st.st_mode)) {
+        close(fd);
+        fd = open(insp.path, O_RDWR | O_EXCL);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "Error: %s: %s%s\n", insp.path, strerror(errno),
+                errno == EBUSY ? " (is the target still active?)" : "");
+        return EXIT_ERROR;
+    }
+
+    size = lseek(fd, 0, SEEK_END);
+    if (size < 0) {
+        fprintf(stderr, "Error: %s: %s\n", insp.path, strerror(errno));
+        close(fd);
+        return EXIT_ERROR;
+    }
+    insp.size_sectors = (u64)size >> SECTOR_SHIFT;
+    if (insp.offset + DM_REMAP_V4_METADATA_AREA_SECTORS > insp.size_sectors) {
+        fprintf(stderr, "Error: %s: metadata area at sector %llu runs past the end\n",
+                insp.path, insp.offset);
+        close(fd);
+        return EXIT_ERROR;
+    }
+
+    inspect(fd, &insp, main_sectors);
+    ret = 0;
+    if (repair && exit_status(&insp) == EXIT_DAMAGED) {
+        ret = repair_copies(fd, &insp);
+        if (!ret)
+            inspect(fd, &insp, main_sectors);  /* Report what is on the device now */
+    }
+    close(fd);
+    if (ret)
+        return EXIT_ERROR;
+
+    if (json)
+        print_json(&insp);
+    else
+        print_human(&insp, list_remaps);
+
+    return exit_status(&insp);
+}
@@ -0,0 +1,185 @@
+#!/bin/bash
+#
+# test-dmremap-meta.sh - dmremap-meta against generated spare images
+#
+# Images come from tests/fuzz/gen_corpus, which damages a random subset of
+# the five copies. For each image:
+# 1. The exit status matches what the JSON output reports
+# 2. A repairable image comes back clean after --repair
+# 3. An image without a valid copy is left alone
+#
+# A blank image covers the case of no valid copy at all, and one image is
+# moved to an offset in a larger one to check --offset.
+#
+# Needs no root and no module.
+
+# Color codes for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+TOOL="${SCRIPT_DIR}/dmremap-meta"
+FUZZ_DIR="${SCRIPT_DIR}/../../tests/fuzz"
+IMG="$(mktemp /tmp/dmremap-meta-test.XXXXXX)"
+SEEDS=40
+
+# Statistics
+TESTS_PASSED=0
+TESTS_FAILED=0
+SEEN_CLEAN=0
+SEEN_DAMAGED=0
+SEEN_NO_VALID=0
+
+cleanup() {
+    rm -f "${IMG}" "${IMG}.json" "${IMG}.meta" "${IMG}.meta.json"
+}
+
+error_exit() {
+    echo -e "${RED}ERROR: $1${NC}"
+    exit 1
+}
+
+report_test() {
+    local test_name="$1"
+    local result="$2"
+
+    if [ "$result" = "PASS" ]; then
+        ((TESTS_PASSED++))
+    else
+        echo -e "${RED}✗ FAIL${NC}: $test_name"
+        ((TESTS_FAILED++))
+    fi
+}
+
+# Exit status the JSON output implies: 0 clean, 1 damaged, 2 no valid copy
+json_status() {
+    python3 - "$1" <<'PY'
+import json, sys
+d = json.load(open(sys.argv[1]))
+if d["best_copy"] is None:
+    print(2)
+elif all(c["status"] == "ok" for c in d["copies"]):
+    print(0)
+else:
+    print(1)
+PY
+}
+
+trap cleanup EXIT
+
+echo "========================================="
+echo "dmremap-meta Test Suite"
+echo "========================================="
+
+make -s -C "${FUZZ_DIR}" gen_corpus || error_exit "Failed to build gen_corpus"
+[ -x "${TOOL}" ] || error_exit "Build ${TOOL} first"
+
+for seed in $(seq 1 ${SEEDS}); do
+    rm -f "${IMG}"
+    truncate -s 32M "${IMG}"
+    "${FUZZ_DIR}/gen_corpus" image "${IMG}" 65536 131072 ${seed} >/dev/null || \
+        error_exit "gen_corpus image failed for seed ${seed}"
+
+    "${TOOL}" --format json "${IMG}" >"${IMG}.json"
+    RC=$?
+    if [ "$(json_status "${IMG}.json")" = "${RC}" ]; then
+        report_test "seed ${seed}: exit status matches JSON" "PASS"
+    else
+        report_test "seed ${seed}: exit status ${RC} does not match JSON" "FAIL"
+    fi
+
+    case ${RC} in
+    0)
+        ((SEEN_CLEAN++))
+        ;;
+    1)
+        ((SEEN_DAMAGED++))
+        "${TOOL}" --repair "${IMG}" >/dev/null
+        REPAIR_RC=$?
+        "${TOOL}" "${IMG}" >/dev/null
+        if [ ${REPAIR_RC} -eq 0 ] && [ $? -eq 0 ]; then
+            report_test "seed ${seed}: repaired" "PASS"
+        else
+            report_test "seed ${seed}: repair left damage (rc=${REPAIR_RC})" "FAIL"
+        fi
+        ;;
+    2)
+        ((SEEN_NO_VALID++))
+        SUM=$(md5sum < "${IMG}")
+        "${TOOL}" --repair "${IMG}" >/dev/null
+        REPAIR_RC=$?
+        if [ ${REPAIR_RC} -eq 2 ] && [ "$(md5sum < "${IMG}")" = "${SUM}" ]; then
+            report_test "seed ${seed}: nothing to repair from" "PASS"
+        else
+            report_test "seed ${seed}: image without valid copy modified (rc=${REPAIR_RC})" "FAIL"
+        fi
+        ;;
+    *)
+        report_test "seed ${seed}: exit status ${RC}" "FAIL"
+        ;;
+    esac
+done
+
+echo "  ${SEEN_CLEAN} clean, ${SEEN_DAMAGED} damaged, ${SEEN_NO_VALID} without a valid copy"
+if [ ${SEEN_DAMAGED} -eq 0 ]; then
+    report_test "Seeds cover damaged images" "FAIL"
+fi
+
+rm -f "${IMG}"
+truncate -s 32M "${IMG}"
+"${TOOL}" --repair "${IMG}" >/dev/null
+RC=$?
+if [ ${RC} -eq 2 ] && [ -z "$(tr -d '\0' < "${IMG}" | head -c 1)" ]; then
+    report_test "blank image: no valid copy, nothing written" "PASS"
+else
+    report_test "blank image: rc=${RC}" "FAIL"
+fi
+
+# The area of seed 1 at sector 2048 of a metadata device image
+rm -f "${IMG}" "${IMG}.meta"
+truncate -s 32M "${IMG}"
+truncate -s 8M "${IMG}.meta"
+"${FUZZ_DIR}/gen_corpus" image "${IMG}" 65536 131072 1 >/dev/null || \
+    error_exit "gen_corpus image failed for seed 1"
+dd if="${IMG}" of="${IMG}.meta" bs=512 count=1280 seek=2048 conv=notrunc status=none
+"${TOOL}" --format json "${IMG}" >"${IMG}.json"
+RC=$?
+"${TOOL}" --format json --offset 2048 "${IMG}.meta" >"${IMG}.meta.json"
+META_RC=$?
+if [ ${META_RC} -eq ${RC} ] && python3 - "${IMG}.json" "${IMG}.meta.json" <<'PY'
+import json, sys
+a, b = (json.load(open(f)) for f in sys.argv[1:])
+ok = a["best_copy"] == b["best_copy"] and \
+     [c["status"] for c in a["copies"]] == [c["status"] for c in b["copies"]] and \
+     all(cb["offset"] == ca["offset"] + 2048 * 512 for ca, cb in zip(a["copies"], b["copies"]))
+sys.exit(0 if ok else 1)
+PY
+then
+    report_test "--offset: area read at its offset" "PASS"
+else
+    report_test "--offset: rc=${META_RC}, expected ${RC}" "FAIL"
+fi
+"${TOOL}" --offset 1001 "${IMG}.meta" >/dev/null 2>&1
+RC=$?
+"${TOOL}" --offset 15360 "${IMG}.meta" >/dev/null 2>&1
+END_RC=$?
+if [ ${RC} -eq 3 ] && [ ${END_RC} -eq 3 ]; then
+    report_test "--offset: unaligned or past the end refused" "PASS"
+else
+    report_test "--offset: bad offsets accepted" "FAIL"
+fi
+
+# Summary
+echo ""
+echo "========================================="
+echo "Test Summary"
+echo "========================================="
+echo -e "${GREEN}Tests passed: ${TESTS_PASSED}${NC}"
+if [ ${TESTS_FAILED} -gt 0 ]; then
+    echo -e "${RED}Tests failed: ${TESTS_FAILED}${NC}"
+    exit 1
+fi
+echo -e "${GREEN}All tests PASSED${NC}"
+exit 0